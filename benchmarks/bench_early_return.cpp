@@ -0,0 +1,110 @@
+#include "ScriptManager.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Script;
+
+// Measures the cost of early returns and loop control in the interpreter.
+// Usage: bench_early_return [iterations]
+
+namespace {
+
+const char *kSource = R"(
+    bool isValidCode(int32 code) {
+        if (code < 0) {
+            return false;
+        }
+        if (code > 100000) {
+            return false;
+        }
+        if (code % 7 == 0) {
+            return false;
+        }
+        return true;
+    }
+
+    int32 countValid(int32 n) {
+        int32 valid = 0;
+        for (int32 i = 0; i < n; i += 1) {
+            if (isValidCode(i)) {
+                valid += 1;
+            }
+        }
+        return valid;
+    }
+
+    int32 skipAndStop(int32 n) {
+        int32 total = 0;
+        int32 i = 0;
+        while (true) {
+            i += 1;
+            if (i > n) {
+                break;
+            }
+            if (i % 2 == 0) {
+                continue;
+            }
+            total += 1;
+        }
+        return total;
+    }
+)";
+
+double runNanosPerIteration(ScriptManager &manager, const std::string &proc,
+                            int32_t iterations) {
+  Value result;
+  std::string errorMsg;
+  auto start = std::chrono::steady_clock::now();
+  if (!manager.executeProcedure(proc, {iterations}, result, errorMsg)) {
+    std::cerr << errorMsg << std::endl;
+    std::exit(1);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         iterations;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int32_t iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+  struct EngineEntry {
+    const char *name;
+    ExecutionEngine engine;
+  };
+  const EngineEntry engines[] = {
+      {"tree", ExecutionEngine::TREE_WALKER},
+      {"bytecode", ExecutionEngine::BYTECODE},
+      {"closure", ExecutionEngine::CLOSURE},
+  };
+
+  std::cout << "iterations: " << iterations << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+
+  for (const auto &entry : engines) {
+    ScriptManager manager;
+    manager.setExecutionEngine(entry.engine);
+
+    std::vector<CompilationError> errors;
+    if (!manager.loadScriptSource(kSource, "bench.script", errors)) {
+      for (const auto &error : errors) {
+        std::cerr << error.toString() << std::endl;
+      }
+      return 1;
+    }
+
+    double earlyReturn = runNanosPerIteration(manager, "countValid", iterations);
+    double loopControl = runNanosPerIteration(manager, "skipAndStop", iterations);
+
+    std::cout << std::setw(10) << entry.name << "  early return: "
+              << earlyReturn << " ns/call  break/continue: " << loopControl
+              << " ns/iteration" << std::endl;
+  }
+
+  return 0;
+}
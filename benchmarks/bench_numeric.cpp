@@ -0,0 +1,127 @@
+#include "ScriptManager.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Script;
+
+// Measures numeric loops (checksum, bit twiddling and an array scan) on each
+// engine, on the tree walker without superoperators, and with the JIT
+// enabled.
+// Usage: bench_numeric [iterations]
+
+namespace {
+
+const char *kSource = R"(
+    int64 checksum(int32 n) {
+        int64 hash = 1469598103;
+        for (int32 i = 0; i < n; i += 1) {
+            hash = (hash ^ i) * 16777619;
+            hash = hash & 4294967295;
+        }
+        return hash;
+    }
+
+    int32 popcount(int32 n) {
+        int32 bits = 0;
+        for (int32 i = 0; i < n; i += 1) {
+            int64 v = i;
+            while (v != 0) {
+                bits += 1;
+                v = v & (v - 1);
+            }
+        }
+        return bits;
+    }
+
+    int32 scan(int32 n) {
+        int32[] values = [3, 1, 4, 1, 5, 9, 2, 6];
+        int32 size = 8;
+        int32 found = 0;
+        int32 j = 0;
+        for (int32 i = 0; i < n; i += 1) {
+            if (j >= 0 && j < size && values[j] > 2) {
+                found += 1;
+            }
+            j = j + 1;
+            if (j == size) {
+                j = 0;
+            }
+        }
+        return found;
+    }
+)";
+
+double runNanosPerIteration(ScriptManager &manager, const std::string &proc,
+                            int32_t iterations) {
+  Value result;
+  std::string errorMsg;
+  auto start = std::chrono::steady_clock::now();
+  if (!manager.executeProcedure(proc, {iterations}, result, errorMsg)) {
+    std::cerr << errorMsg << std::endl;
+    std::exit(1);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         iterations;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int32_t iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+  struct EngineEntry {
+    const char *name;
+    ExecutionEngine engine;
+    bool jit;
+    bool superoperators;
+  };
+  const EngineEntry engines[] = {
+      {"tree", ExecutionEngine::TREE_WALKER, false, true},
+      {"tree-plain", ExecutionEngine::TREE_WALKER, false, false},
+      {"bytecode", ExecutionEngine::BYTECODE, false, true},
+      {"closure", ExecutionEngine::CLOSURE, false, true},
+      {"jit", ExecutionEngine::TREE_WALKER, true, true},
+  };
+  std::string treeReport;
+
+  std::cout << "iterations: " << iterations << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+
+  for (const auto &entry : engines) {
+    ScriptManager manager;
+    manager.setExecutionEngine(entry.engine);
+    manager.setJitEnabled(entry.jit);
+    manager.setSuperoperatorsEnabled(entry.superoperators);
+
+    std::vector<CompilationError> errors;
+    if (!manager.loadScriptSource(kSource, "bench.script", errors)) {
+      for (const auto &error : errors) {
+        std::cerr << error.toString() << std::endl;
+      }
+      return 1;
+    }
+
+    double checksum = runNanosPerIteration(manager, "checksum", iterations);
+    double popcount = runNanosPerIteration(manager, "popcount", iterations);
+    double scan = runNanosPerIteration(manager, "scan", iterations);
+
+    std::cout << std::setw(10) << entry.name << "  checksum: " << checksum
+              << " ns/iteration  popcount: " << popcount
+              << " ns/iteration  scan: " << scan << " ns/iteration"
+              << std::endl;
+    if (entry.engine == ExecutionEngine::TREE_WALKER && !entry.jit &&
+        entry.superoperators) {
+      treeReport = manager.getSuperoperatorReport();
+    }
+  }
+
+  std::cout << std::endl << "tree walker superoperators:" << std::endl
+            << treeReport;
+
+  return 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Builtins.h"
 #include "DataTypes.h"
 #include "Token.h"
 #include <functional>
@@ -13,6 +14,10 @@ namespace Script {
 class ASTNode;
 class Expression;
 class Statement;
+struct BytecodeProcedure;
+struct ClosureProcedure;
+struct JitProcedure;
+struct NativeProcedure;
 
 using ASTNodePtr = std::shared_ptr<ASTNode>;
 using ExprPtr = std::shared_ptr<Expression>;
@@ -20,13 +25,61 @@ using StmtPtr = std::shared_ptr<Statement>;
 using ExternalFunctionCallback =
   std::function<Value(const std::vector<Value> &)>;
 
+// Concrete node type, used to dispatch with a switch instead of RTTI
+enum class NodeKind : uint8_t {
+  // Expressions
+  LITERAL,
+  VARIABLE,
+  BINARY,
+  UNARY,
+  CALL,
+  CONDITIONAL,
+  ARRAY_LITERAL,
+  INDEX,
+  FIELD,
+  RECORD,
+
+  // Statements
+  EXPRESSION_STMT,
+  VAR_DECL,
+  ASSIGN,
+  INDEX_ASSIGN,
+  FIELD_ASSIGN,
+  BLOCK,
+  IF,
+  WHILE,
+  FOR,
+  DO_WHILE,
+  SWITCH,
+  RETURN,
+  BREAK,
+  CONTINUE,
+
+  PROCEDURE
+};
+
+// Fused forms of hot node shapes, tagged at load time so the tree walker
+// runs the whole shape in one step (see Superoperators.h). The children stay
+// in place, so the other engines compile a tagged node as usual.
+enum class Superop : uint8_t {
+  NONE,
+  LOCAL_COMPARE,     // local < local, local == literal, ...
+  LOCAL_ADD_LITERAL, // x = x + literal, x = x - literal, x += literal, ...
+  LOCAL_INDEX,       // local[local]
+  COMPARE_CHAIN,     // comparison && comparison && ...
+  COUNT
+};
+
 // Base AST Node
 class ASTNode {
 public:
+  const NodeKind kind;
+  Superop superop = Superop::NONE;
   int line;
   int column;
 
-  ASTNode(int ln = 0, int col = 0) : line(ln), column(col) {}
+  ASTNode(NodeKind k, int ln = 0, int col = 0)
+      : kind(k), line(ln), column(col) {}
   virtual ~ASTNode() = default;
 };
 
@@ -35,23 +88,31 @@ class Expression : public ASTNode {
 public:
   using ASTNode::ASTNode;
   virtual ~Expression() = default;
+
+  // Type every evaluation yields, from the TypeChecker; VOID if unknown
+  TypeInfo staticType;
 };
 
 class LiteralExpr : public Expression {
 public:
   Value value;
   TypeInfo type;
+  // value as the engines hold it, so passing a string literal as an
+  // argument shares one box instead of allocating one per call
+  CompactValue compact;
 
     LiteralExpr(const Value &val, TypeInfo t, int ln = 0, int col = 0)
-      : Expression(ln, col), value(val), type(t) {}
+      : Expression(NodeKind::LITERAL, ln, col), value(val), type(t),
+        compact(val) {}
 };
 
 class VariableExpr : public Expression {
 public:
   std::string name;
+  int32_t slot = -1; // frame slot from Resolver; -1 for external variables
 
   VariableExpr(const std::string &n, int ln = 0, int col = 0)
-      : Expression(ln, col), name(n) {}
+      : Expression(NodeKind::VARIABLE, ln, col), name(n) {}
 };
 
 class BinaryExpr : public Expression {
@@ -82,7 +143,12 @@ public:
   Operator op;
 
   BinaryExpr(ExprPtr l, ExprPtr r, Operator o, int ln = 0, int col = 0)
-      : Expression(ln, col), left(l), right(r), op(o) {}
+      : Expression(NodeKind::BINARY, ln, col), left(l), right(r), op(o) {}
+
+  // The operator applied to two evaluated operands. Used by the tree
+  // walker and by constant folding, so folded literals are exactly what
+  // the script would compute.
+  static Value apply(Operator op, const Value &left, const Value &right);
 };
 
 class UnaryExpr : public Expression {
@@ -93,7 +159,7 @@ public:
   Operator op;
 
   UnaryExpr(ExprPtr expr, Operator o, int ln = 0, int col = 0)
-      : Expression(ln, col), operand(expr), op(o) {}
+      : Expression(NodeKind::UNARY, ln, col), operand(expr), op(o) {}
 };
 
 class CallExpr : public Expression {
@@ -101,16 +167,33 @@ public:
   std::string functionName;
   std::vector<ExprPtr> arguments;
 
+  // Procedure of the same script the TypeChecker checked this call
+  // against, and whether every argument already has its parameter's type.
+  // A call that reaches another procedure (one loaded later under the same
+  // name) converts its arguments and returns whatever that procedure
+  // returns, which need not have staticType.
+  std::weak_ptr<class ProcedureDecl> checkedProcedure;
+  bool argumentsTyped = false;
+
+  // The callee's returned expression with the arguments in place of its
+  // parameters (Inliner), evaluated instead of the call while
+  // inlinedProcedure is still the procedure loaded under functionName
+  ExprPtr inlined;
+  std::weak_ptr<class ProcedureDecl> inlinedProcedure;
+
   // Inline cache for call dispatch
   mutable uint64_t cacheVersion = 0;
   mutable bool cachedIsProcedure = false;
+  mutable bool cachedIsChecked = false; // cachedProcedure is checkedProcedure
+  mutable bool cachedIsInlined = false; // cachedProcedure is inlinedProcedure
   mutable bool cachedIsExternal = false;
   mutable std::weak_ptr<class ProcedureDecl> cachedProcedure;
   mutable ExternalFunctionCallback cachedExternal;
+  mutable BuiltinFunction cachedBuiltin = nullptr;
 
   CallExpr(const std::string &name, const std::vector<ExprPtr> &args,
            int ln = 0, int col = 0)
-      : Expression(ln, col), functionName(name), arguments(args) {}
+      : Expression(NodeKind::CALL, ln, col), functionName(name), arguments(args) {}
 };
 
 class ConditionalExpr : public Expression {
@@ -120,7 +203,7 @@ public:
   ExprPtr elseExpr;
 
   ConditionalExpr(ExprPtr cond, ExprPtr t, ExprPtr e, int ln = 0, int col = 0)
-      : Expression(ln, col), condition(cond), thenExpr(t), elseExpr(e) {}
+      : Expression(NodeKind::CONDITIONAL, ln, col), condition(cond), thenExpr(t), elseExpr(e) {}
 };
 
 class ArrayLiteralExpr : public Expression {
@@ -128,7 +211,7 @@ public:
   std::vector<ExprPtr> elements;
 
   ArrayLiteralExpr(const std::vector<ExprPtr> &elems, int ln = 0, int col = 0)
-      : Expression(ln, col), elements(elems) {}
+      : Expression(NodeKind::ARRAY_LITERAL, ln, col), elements(elems) {}
 };
 
 class IndexExpr : public Expression {
@@ -137,7 +220,43 @@ public:
   ExprPtr indexExpr;
 
   IndexExpr(ExprPtr arr, ExprPtr idx, int ln = 0, int col = 0)
-      : Expression(ln, col), arrayExpr(arr), indexExpr(idx) {}
+      : Expression(NodeKind::INDEX, ln, col), arrayExpr(arr), indexExpr(idx) {}
+
+  // m[i][j] parses as (m[i])[j]; returns m after appending i and j, in
+  // that order, to indices
+  const ExprPtr &indexChain(std::vector<ExprPtr> &indices) const {
+    const ExprPtr &root =
+        arrayExpr->kind == NodeKind::INDEX
+            ? static_cast<IndexExpr *>(arrayExpr.get())->indexChain(indices)
+            : arrayExpr;
+    indices.push_back(indexExpr);
+    return root;
+  }
+};
+
+// record.field. When the Resolver can tell the record's struct type, it
+// sets structType and the field's index, so reads of records of that type
+// go straight to the field; other records look the field up by name.
+class FieldExpr : public Expression {
+public:
+  ExprPtr object;
+  std::string field;
+  std::shared_ptr<const StructType> structType;
+  int32_t index = -1;
+
+  FieldExpr(ExprPtr obj, const std::string &f, int ln = 0, int col = 0)
+      : Expression(NodeKind::FIELD, ln, col), object(obj), field(f) {}
+};
+
+// StructName(field0, field1, ...): a new record, one argument per field
+class RecordExpr : public Expression {
+public:
+  std::shared_ptr<const StructType> type;
+  std::vector<ExprPtr> fields;
+
+  RecordExpr(std::shared_ptr<const StructType> t,
+             const std::vector<ExprPtr> &f, int ln = 0, int col = 0)
+      : Expression(NodeKind::RECORD, ln, col), type(std::move(t)), fields(f) {}
 };
 
 // Statement Nodes
@@ -152,7 +271,7 @@ public:
   ExprPtr expression;
 
   ExpressionStmt(ExprPtr expr, int ln = 0, int col = 0)
-      : Statement(ln, col), expression(expr) {}
+      : Statement(NodeKind::EXPRESSION_STMT, ln, col), expression(expr) {}
 };
 
 class VarDeclStmt : public Statement {
@@ -160,10 +279,13 @@ public:
   TypeInfo type;
   std::string name;
   ExprPtr initializer;
+  int32_t slot = -1; // frame slot from Resolver
+  // The initializer already has the declared type (TypeChecker)
+  bool initializerTyped = false;
 
   VarDeclStmt(TypeInfo t, const std::string &n, ExprPtr init, int ln = 0,
               int col = 0)
-      : Statement(ln, col), type(t), name(n), initializer(init) {}
+      : Statement(NodeKind::VAR_DECL, ln, col), type(t), name(n), initializer(init) {}
 };
 
 class AssignStmt : public Statement {
@@ -179,10 +301,11 @@ public:
   std::string variableName;
   ExprPtr value;
   Operator op;
+  int32_t slot = -1; // frame slot from Resolver; -1 for external variables
 
   AssignStmt(const std::string &var, ExprPtr val, Operator o, int ln = 0,
              int col = 0)
-      : Statement(ln, col), variableName(var), value(val), op(o) {}
+      : Statement(NodeKind::ASSIGN, ln, col), variableName(var), value(val), op(o) {}
 };
 
 class IndexAssignStmt : public Statement {
@@ -193,7 +316,22 @@ public:
 
   IndexAssignStmt(ExprPtr arr, ExprPtr idx, ExprPtr val, int ln = 0,
                   int col = 0)
-      : Statement(ln, col), arrayExpr(arr), indexExpr(idx), value(val) {}
+      : Statement(NodeKind::INDEX_ASSIGN, ln, col), arrayExpr(arr), indexExpr(idx), value(val) {}
+};
+
+// record.field = value; structType and index as for FieldExpr
+class FieldAssignStmt : public Statement {
+public:
+  ExprPtr object;
+  std::string field;
+  ExprPtr value;
+  std::shared_ptr<const StructType> structType;
+  int32_t index = -1;
+
+  FieldAssignStmt(ExprPtr obj, const std::string &f, ExprPtr val, int ln = 0,
+                  int col = 0)
+      : Statement(NodeKind::FIELD_ASSIGN, ln, col), object(obj), field(f),
+        value(val) {}
 };
 
 class BlockStmt : public Statement {
@@ -201,7 +339,7 @@ public:
   std::vector<StmtPtr> statements;
 
   BlockStmt(const std::vector<StmtPtr> &stmts, int ln = 0, int col = 0)
-      : Statement(ln, col), statements(stmts) {}
+      : Statement(NodeKind::BLOCK, ln, col), statements(stmts) {}
 };
 
 class IfStmt : public Statement {
@@ -211,7 +349,7 @@ public:
   StmtPtr elseBranch;
 
   IfStmt(ExprPtr cond, StmtPtr thenB, StmtPtr elseB, int ln = 0, int col = 0)
-      : Statement(ln, col), condition(cond), thenBranch(thenB),
+      : Statement(NodeKind::IF, ln, col), condition(cond), thenBranch(thenB),
         elseBranch(elseB) {}
 };
 
@@ -221,7 +359,7 @@ public:
   StmtPtr body;
 
   WhileStmt(ExprPtr cond, StmtPtr b, int ln = 0, int col = 0)
-      : Statement(ln, col), condition(cond), body(b) {}
+      : Statement(NodeKind::WHILE, ln, col), condition(cond), body(b) {}
 };
 
 class ForStmt : public Statement {
@@ -233,7 +371,7 @@ public:
 
   ForStmt(StmtPtr init, ExprPtr cond, StmtPtr inc, StmtPtr b, int ln = 0,
           int col = 0)
-      : Statement(ln, col), initializer(init), condition(cond), increment(inc),
+      : Statement(NodeKind::FOR, ln, col), initializer(init), condition(cond), increment(inc),
         body(b) {}
 };
 
@@ -242,17 +380,17 @@ public:
   ExprPtr value;
 
   ReturnStmt(ExprPtr val, int ln = 0, int col = 0)
-      : Statement(ln, col), value(val) {}
+      : Statement(NodeKind::RETURN, ln, col), value(val) {}
 };
 
 class BreakStmt : public Statement {
 public:
-  BreakStmt(int ln = 0, int col = 0) : Statement(ln, col) {}
+  BreakStmt(int ln = 0, int col = 0) : Statement(NodeKind::BREAK, ln, col) {}
 };
 
 class ContinueStmt : public Statement {
 public:
-  ContinueStmt(int ln = 0, int col = 0) : Statement(ln, col) {}
+  ContinueStmt(int ln = 0, int col = 0) : Statement(NodeKind::CONTINUE, ln, col) {}
 };
 
 struct SwitchCase {
@@ -268,7 +406,7 @@ public:
 
   SwitchStmt(ExprPtr expr, const std::vector<SwitchCase> &cs, int ln = 0,
              int col = 0)
-      : Statement(ln, col), expression(expr), cases(cs) {}
+      : Statement(NodeKind::SWITCH, ln, col), expression(expr), cases(cs) {}
 };
 
 class DoWhileStmt : public Statement {
@@ -277,7 +415,7 @@ public:
   ExprPtr condition;
 
   DoWhileStmt(StmtPtr b, ExprPtr cond, int ln = 0, int col = 0)
-      : Statement(ln, col), body(b), condition(cond) {}
+      : Statement(NodeKind::DO_WHILE, ln, col), body(b), condition(cond) {}
 };
 
 // Procedure Declaration
@@ -293,20 +431,43 @@ public:
   std::vector<Parameter> parameters;
   StmtPtr body;
 
+  // Frame layout computed by Resolver: parameters, then block locals
+  uint32_t frameSize = 0;
+  bool resolved = false;
+  // Every returned value already has returnType (TypeChecker)
+  bool returnsTyped = false;
+
+  // Bytecode lowered from this procedure (bytecode engine only)
+  mutable std::shared_ptr<BytecodeProcedure> bytecode;
+  // Closure tree built from this procedure (closure engine only)
+  mutable std::shared_ptr<ClosureProcedure> closure;
+  // Native code (or the reason there is none) when the JIT is enabled
+  mutable std::shared_ptr<JitProcedure> jit;
+  // Set for procedures provided by a native module; the body is then empty
+  std::shared_ptr<NativeProcedure> native;
+
+  // The body before the optimizer relied on the pure externals it calls
+  // (Purity.h), and what those were registered as returning. Once one of
+  // them is shadowed by a procedure or registered differently, the
+  // interpreter replaces this procedure with a copy running generalBody.
+  StmtPtr generalBody;
+  std::vector<std::pair<std::string, TypeInfo>> pureExternals;
+
   ProcedureDecl(TypeInfo retType, const std::string &n,
                 const std::vector<Parameter> &params, StmtPtr b, int ln = 0,
                 int col = 0)
-      : ASTNode(ln, col), returnType(retType), name(n), parameters(params),
+      : ASTNode(NodeKind::PROCEDURE, ln, col), returnType(retType), name(n), parameters(params),
         body(b) {}
 };
 
 using ProcedureDeclPtr = std::shared_ptr<ProcedureDecl>;
 
-// Script (collection of procedures)
+// Script (collection of procedures and the structs they use)
 class Script {
 public:
   std::string filename;
   std::vector<ProcedureDeclPtr> procedures;
+  std::vector<std::shared_ptr<const StructType>> structs;
 
   Script(const std::string &file) : filename(file) {}
 };
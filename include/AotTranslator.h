@@ -0,0 +1,37 @@
+#pragma once
+
+#include "AST.h"
+#include <string>
+#include <vector>
+
+namespace Script {
+
+// Translates the procedures of a script into C++ source for a native module
+// (see NativeModule.h). The same subset as the JIT is supported: int32,
+// int64, double and bool locals and parameters, plus calls between
+// procedures that are translated too. Calls inside the module are bound when
+// the script is translated.
+//
+// The output is self-contained apart from NativeModule.h and reproduces the
+// interpreter's results and errors, including integer wrap-around and the
+// "Division by zero" and missing-return failures.
+class AotTranslator {
+public:
+  struct Skipped {
+    std::string procedure;
+    std::string reason;
+  };
+
+  // The script must have been through the Resolver. Procedures outside the
+  // supported subset are left out of the module and listed in skipped().
+  std::string translate(const Script &script);
+
+  const std::vector<Skipped> &skipped() const { return _skipped; }
+  const std::vector<std::string> &translated() const { return _translated; }
+
+private:
+  std::vector<Skipped> _skipped;
+  std::vector<std::string> _translated;
+};
+
+} // namespace Script
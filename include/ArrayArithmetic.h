@@ -0,0 +1,35 @@
+#pragma once
+
+#include "DataTypes.h"
+
+namespace Script {
+
+enum class ElementwiseOp {
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  MODULO,
+  BIT_AND,
+  BIT_OR,
+  BIT_XOR,
+  SHIFT_LEFT,
+  SHIFT_RIGHT
+};
+
+// Binary operators applied element by element when either operand is an
+// array: `a + b` on two arrays of the same length, or `a * 2.0` and
+// `1 - a` with a scalar broadcast to every element. Each element of the
+// new array is exactly what the scalar operator gives for that pair, so
+// the usual promotion rules pick the element type (int32[] + int32[] is
+// int32[], int32[] * 2.0 is double[], int32[] & 255 is int64[]).
+//
+// Arrays with a native buffer run as tight loops over the buffers; arrays
+// that fell back to Values go element by element through ValueHelper.
+class ArrayArithmetic {
+public:
+  static Value apply(ElementwiseOp op, const Value &a, const Value &b);
+  static const char *symbol(ElementwiseOp op);
+};
+
+} // namespace Script
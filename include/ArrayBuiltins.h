@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Builtins.h"
+#include "DataTypes.h"
+#include <string>
+#include <vector>
+
+namespace Script {
+
+// Instruction sets the array kernels can use, in increasing order
+enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+// Whole-array builtins: sum, min, max, dot, count_if_eq, index_of, slice
+// and the shape builtins. They rank below procedures and external functions
+// of the same name, so scripts that define their own `max` keep calling it.
+// Arrays of int32, int64 and double run SSE2/AVX2 kernels picked by CPU
+// detection; other element types, and arrays that fell back to Values, run
+// scalar loops. Multi-dimensional arrays count as all their elements, in
+// row-major order, except where an axis is given.
+//
+//   sum(a)            int64 for signed, uint64 for unsigned and double for
+//                     double elements; integer sums wrap
+//   min(a), max(a)    an element, ordered like the < and > operators;
+//                     errors on empty arrays
+//   sum(a, axis), min(a, axis), max(a, axis)
+//                     the same along one axis, giving an array of the other
+//                     axes' shape: axis 1 of a matrix reduces each row
+//   dot(a, b)         sum of products, typed like sum; sizes must match
+//   count_if_eq(a, v) int32 count of elements == v
+//   index_of(a, v)    int32 index of the first element == v, or -1
+//   slice(a, s, e)    view of elements [s, e) along the first axis sharing
+//                     a's storage, made in constant time;
+//                     0 <= s <= e <= len(a)
+//   reshape(a, d...)  view of a's elements with extents d, in constant time
+//   full(v, d...)     new array with extents d, every element v
+//   rank(a)           int32 number of dimensions
+//   shape(a)          int32[] of the extents
+//
+// Double sums and dot products add in a different order than a script
+// loop would, so they may differ from one in the last bits.
+class ArrayBuiltins {
+public:
+  static bool isBuiltin(const std::string &name);
+
+  // The builtin of that name, or null; the engines resolve it once per call
+  // site
+  static BuiltinFunction find(const std::string &name);
+
+  // Errors are thrown as std::runtime_error; the engines add the position
+  static Value call(const std::string &name, const std::vector<Value> &args);
+
+  // What the CPU supports, ignoring CXXSCRIPT_SIMD
+  static SimdLevel detectedSimdLevel();
+
+  // Level the kernels use; starts at the detected level, capped by
+  // CXXSCRIPT_SIMD=scalar|sse2|avx2. setSimdLevel clamps to the detected
+  // level and is process-wide; it may be called while scripts run on other
+  // threads, which pick the new level up on their next kernel call.
+  static SimdLevel simdLevel();
+  static void setSimdLevel(SimdLevel level);
+  static const char *simdLevelName(SimdLevel level);
+};
+
+} // namespace Script
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "AST.h"
+
+namespace Script {
+
+// Deep copies of statements and expressions, annotations included (slots,
+// static types, typed flags, resolved fields), so a pass that rewrites a
+// tree in place can leave the original to fall back on.
+class AstCloner {
+public:
+  static StmtPtr clone(const StmtPtr &stmt);
+  static ExprPtr clone(const ExprPtr &expr);
+};
+
+} // namespace Script
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "AST.h"
+#include <sstream>
+#include <string>
+
+namespace Script {
+
+// Prints procedures back as script source, to inspect what the optimizer
+// left of them. Nested operators are parenthesized, so the output shows
+// how the tree is grouped rather than how it was written.
+class AstPrinter {
+public:
+  static std::string print(const Script &script);
+  static std::string print(const ProcedureDecl &proc);
+  static std::string print(const Expression &expr);
+
+private:
+  std::ostringstream _out;
+  int _indent = 0;
+
+  void procedure(const ProcedureDecl &proc);
+  void statement(const Statement &stmt);
+  // A statement that follows a header such as `if (...)` or `else`
+  void body(const Statement &stmt);
+  // Variable declarations, assignments and expressions without the `;`,
+  // as they appear in a for header
+  void simple(const Statement &stmt);
+  void expression(const Expression &expr);
+  void operand(const Expression &expr);
+  void line();
+};
+
+} // namespace Script
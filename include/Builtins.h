@@ -0,0 +1,63 @@
+#pragma once
+
+#include "CompactValue.h"
+#include "DataTypes.h"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace Script {
+
+// The arguments of a builtin call, viewed where the caller holds them: in
+// bytecode registers, frame slots or a host's vector. Nothing is copied;
+// a compact scalar is built on demand in scratch space of its own, so
+// every argument's view stays valid for the call.
+class BuiltinArguments {
+public:
+  BuiltinArguments(const CompactValue *values, size_t count)
+      : _compact(values), _count(count) {}
+  BuiltinArguments(const std::vector<Value> &values)
+      : _values(values.data()), _count(values.size()) {}
+
+  BuiltinArguments(const BuiltinArguments &) = delete;
+  BuiltinArguments &operator=(const BuiltinArguments &) = delete;
+
+  size_t size() const { return _count; }
+  bool empty() const { return _count == 0; }
+
+  const Value &operator[](size_t i) const {
+    if (_values) {
+      return _values[i];
+    }
+    const CompactValue &value = _compact[i];
+    if (const Value *boxed = value.boxed()) {
+      return *boxed;
+    }
+    // Scalar Values need no destruction, so the scratch slot is simply
+    // built over
+    if (i < INLINE_SCRATCH) {
+      return *new (&_scratch[i]) Value(value.toValue());
+    }
+    if (_moreScratch.empty()) {
+      _moreScratch.resize(_count - INLINE_SCRATCH);
+    }
+    return _moreScratch[i - INLINE_SCRATCH] = value.toValue();
+  }
+
+private:
+  static constexpr size_t INLINE_SCRATCH = 4;
+
+  const Value *_values = nullptr;
+  const CompactValue *_compact = nullptr;
+  size_t _count;
+  mutable std::aligned_storage_t<sizeof(Value), alignof(Value)>
+      _scratch[INLINE_SCRATCH];
+  mutable std::vector<Value> _moreScratch;
+};
+
+// A builtin resolved from its name once, so calls skip the name lookup.
+// Errors are thrown as std::runtime_error; the engines add the position.
+using BuiltinFunction = Value (*)(const BuiltinArguments &args);
+
+} // namespace Script
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "AST.h"
+#include "CompactValue.h"
+#include "DataTypes.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Script {
+
+// Register-based instruction set. Operands a, b and c are register indices
+// unless noted otherwise; jump targets are absolute instruction indices.
+enum class OpCode : uint8_t {
+  LOAD_CONST,     // a = constants[b]
+  MOVE,           // a = b
+  LOAD_EXTERNAL,  // a = external variable names[b]
+  STORE_EXTERNAL, // external variable names[a] (assign op c) = b
+  NEW_ARRAY,      // a = empty array with element type types[b]
+  NEW_MAP,        // a = empty map of type types[b]
+  NEW_STRING_BUILDER, // a = empty string builder
+  NEW_RECORD,     // a = record of type types[b] with fields from registers
+                  // [c, c + field count), or default fields when c < 0
+  ARRAY_LITERAL,  // a = array of registers [b, b + c)
+  CONVERT,        // a = convertToType(b, types[c])
+  CHECK_TYPE,     // a = convertToType(a, types[b]) unless a already has
+                  // that type (see ValueHelper::needsConversion)
+  OWN_ARRAY,      // a = ValueHelper::ownedByScript(a)
+
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  MODULO,
+  EQUAL,
+  NOT_EQUAL,
+  LESS_THAN,
+  GREATER_THAN,
+  LESS_EQUAL,
+  GREATER_EQUAL,
+  BIT_AND,
+  BIT_OR,
+  BIT_XOR,
+  LSHIFT,
+  RSHIFT,
+
+  NEGATE,      // a = -b
+  LOGICAL_NOT, // a = !b
+  BIT_NOT,     // a = ~b
+  TO_BOOL,     // a = toBool(b)
+
+  JUMP,          // goto a
+  JUMP_IF_FALSE, // if (!a) goto b
+  JUMP_IF_TRUE,  // if (a) goto b
+
+  CHECK_ARRAY, // raise names[b] unless a holds an array; before a write
+               // (c = 1), also copy a's array if anything else shares it
+  INDEX,       // a = b[c]
+  CHECK_INDEX, // raise unless b is a valid index into a
+  STORE_INDEX, // a[b] = c (converted to the element type)
+  INDEX_ND,    // a = b[b + 1]...[b + c]
+  STORE_INDEX_ND, // a[b]...[c - 1] = c, one index per dimension
+  LEN,         // a = len(b)
+  PUSH,        // a = push(b, c)
+  POP,         // a = pop(b)
+  GET_FIELD,   // a = b.fields[c]
+  UNSHARE_FIELD, // a = b.fields[c], first copying that array in the record
+                 // if anything other than a shares it
+  SET_FIELD,   // a.fields[b] = c (converted to the field type)
+
+  CALL, // a = callSites[b](registers [c, c + argc))
+  INLINED, // unless callSites[a]'s inlined copy is current, goto b
+
+  RETURN,      // return a
+  RETURN_NONE, // fell off the end of the procedure
+  RAISE        // runtime error with message names[a]
+};
+
+struct Instruction {
+  OpCode op;
+  int32_t a;
+  int32_t b;
+  int32_t c;
+};
+
+struct SourcePosition {
+  int line;
+  int column;
+};
+
+// Call target resolved lazily and cached against the interpreter's call
+// cache version, mirroring the inline cache on CallExpr.
+struct CallSite {
+  std::string name;
+  uint32_t argumentCount = 0;
+  // What the TypeChecker found for the call (see CallExpr)
+  std::weak_ptr<ProcedureDecl> checkedProcedure;
+  bool argumentsTyped = false;
+  uint64_t cacheVersion = 0;
+  bool isProcedure = false;
+  bool isChecked = false; // procedure is checkedProcedure
+  // Procedure the call's inlined copy was made from (see CallExpr)
+  std::weak_ptr<ProcedureDecl> inlinedProcedure;
+  bool isInlined = false; // procedure is inlinedProcedure
+  std::weak_ptr<ProcedureDecl> procedure;
+  ExternalFunctionCallback external;
+  BuiltinFunction builtin = nullptr;
+};
+
+// A field access, with the layout and index the Resolver expects; records
+// of another type fall back to looking the name up.
+struct FieldSite {
+  std::shared_ptr<const StructType> structType;
+  int32_t index;
+  std::string name;
+};
+
+struct BytecodeProcedure {
+  std::vector<Instruction> code;
+  std::vector<SourcePosition> positions; // parallel to code
+  std::vector<CompactValue> constants;
+  std::vector<TypeInfo> types;
+  std::vector<std::string> names;
+  std::vector<CallSite> callSites;
+  std::vector<FieldSite> fields;
+  uint32_t registerCount = 0;
+
+  std::string disassemble() const;
+};
+
+using BytecodePtr = std::shared_ptr<BytecodeProcedure>;
+
+// Lowers a resolved procedure's AST to register bytecode. Locals live in
+// the registers matching their Resolver frame slots; temporaries are
+// allocated above the frame in stack order.
+class BytecodeCompiler {
+public:
+  BytecodePtr compile(const ProcedureDecl &proc);
+
+private:
+  struct JumpContext {
+    bool isSwitch;
+    std::vector<size_t> breakJumps;
+    std::vector<size_t> continueJumps;
+  };
+
+  BytecodeProcedure *_out = nullptr;
+  std::vector<JumpContext> _jumps;
+  int32_t _nextRegister = 0;
+  int _line = 0;
+  int _column = 0;
+
+  size_t emit(OpCode op, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+  size_t here() const { return _out->code.size(); }
+  void patch(size_t at, size_t target);
+  void setPosition(const ASTNode *node);
+
+  int32_t allocRegister();
+  void freeRegisters(int32_t mark) { _nextRegister = mark; }
+  int32_t constant(const Value &value);
+  int32_t type(const TypeInfo &info);
+  int32_t name(const std::string &text);
+  int32_t field(const std::string &name,
+                std::shared_ptr<const StructType> structType, int32_t index);
+
+  void compileStatement(Statement *stmt);
+  void compileVarDecl(VarDeclStmt *stmt);
+  void compileAssign(AssignStmt *stmt);
+  void compileIndexAssign(IndexAssignStmt *stmt);
+  void compileNestedIndexAssign(IndexAssignStmt *stmt);
+  void compileFieldAssign(FieldAssignStmt *stmt);
+  void compileBlock(BlockStmt *stmt);
+  void compileIf(IfStmt *stmt);
+  void compileWhile(WhileStmt *stmt);
+  void compileFor(ForStmt *stmt);
+  void compileDoWhile(DoWhileStmt *stmt);
+  void compileSwitch(SwitchStmt *stmt);
+  void compileReturn(ReturnStmt *stmt);
+  void compileBreak(BreakStmt *stmt);
+  void compileContinue(ContinueStmt *stmt);
+
+  // Evaluate into a specific register
+  void compileExpression(Expression *expr, int32_t dst);
+  // Evaluate into any register (locals are used in place)
+  int32_t compileOperand(Expression *expr);
+  // CHECK_ARRAY's c operand for a write to the array `array` evaluates to
+  int32_t unshare(Expression *array);
+  // Register holding the array a write goes to. For a record field, also
+  // the record's register and the field site, so that the write can copy
+  // the array in the record (record < 0 for other arrays).
+  struct ArrayTarget {
+    int32_t array;
+    int32_t record = -1;
+    int32_t site = -1;
+  };
+  ArrayTarget compileArrayTarget(Expression *array);
+  // Emits UNSHARE_FIELD for a field target; goes right before the write
+  void unshareField(const ArrayTarget &target);
+  void compileBinary(BinaryExpr *expr, int32_t dst);
+  void compileCall(CallExpr *expr, int32_t dst);
+  void compileIndex(IndexExpr *expr, int32_t dst);
+  void compileArrayLiteral(ArrayLiteralExpr *expr, int32_t dst);
+  void compileRecord(RecordExpr *expr, int32_t dst);
+
+  void patchLoopJumps(JumpContext &context, size_t continueTarget,
+                      size_t breakTarget);
+};
+
+} // namespace Script
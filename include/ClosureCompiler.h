@@ -0,0 +1,71 @@
+#pragma once
+
+#include "AST.h"
+#include "CompactValue.h"
+#include "DataTypes.h"
+#include "Interpreter.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Script {
+
+// Per-call state threaded through compiled closures
+struct ClosureFrame {
+  Interpreter &interpreter;
+  CompactValue *slots; // procedure frame laid out by Resolver
+  Value returnValue;
+};
+
+using ExprClosure = std::function<Value(ClosureFrame &)>;
+using StmtClosure = std::function<ExecStatus(ClosureFrame &)>;
+
+// A procedure body converted once into nested closures. Node kinds,
+// operators and variable slots are inspected at compile time only.
+struct ClosureProcedure {
+  StmtClosure body;
+};
+
+using ClosureProcedurePtr = std::shared_ptr<ClosureProcedure>;
+
+// Converts a resolved procedure into a tree of pre-bound closures.
+// Binary operators on locals and constants get closures specialized for
+// those operand shapes with int32/double fast paths, and arithmetic and
+// comparisons whose operands the TypeChecker knows to be int32 or double
+// get typed kernels; everything else follows the tree walker's semantics
+// exactly.
+class ClosureCompiler {
+public:
+  ClosureProcedurePtr compile(const ProcedureDecl &proc);
+
+private:
+  // The array push, pop or an index assignment writes to
+  struct ArrayTarget;
+
+  StmtClosure compileStatement(Statement *stmt);
+  StmtClosure compileVarDecl(VarDeclStmt *stmt);
+  StmtClosure compileAssign(AssignStmt *stmt);
+  StmtClosure compileIndexAssign(IndexAssignStmt *stmt);
+  StmtClosure compileNestedIndexAssign(IndexAssignStmt *stmt);
+  StmtClosure compileFieldAssign(FieldAssignStmt *stmt);
+  StmtClosure compileBlock(BlockStmt *stmt);
+  StmtClosure compileIf(IfStmt *stmt);
+  StmtClosure compileWhile(WhileStmt *stmt);
+  StmtClosure compileFor(ForStmt *stmt);
+  StmtClosure compileDoWhile(DoWhileStmt *stmt);
+  StmtClosure compileSwitch(SwitchStmt *stmt);
+  StmtClosure compileReturn(ReturnStmt *stmt);
+
+  ExprClosure compileExpression(Expression *expr);
+  ExprClosure compileVariable(VariableExpr *expr);
+  ExprClosure compileBinary(BinaryExpr *expr);
+  ExprClosure compileUnary(UnaryExpr *expr);
+  ExprClosure compileCall(CallExpr *expr);
+  ExprClosure compileIndex(IndexExpr *expr);
+  ExprClosure compileNestedIndex(IndexExpr *expr);
+  ExprClosure compileArrayLiteral(ArrayLiteralExpr *expr);
+  ExprClosure compileField(FieldExpr *expr);
+  ExprClosure compileRecord(RecordExpr *expr);
+};
+
+} // namespace Script
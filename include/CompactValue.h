@@ -0,0 +1,130 @@
+#pragma once
+
+#include "DataTypes.h"
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace Script {
+
+// 16-byte stand-in for Value used wherever the interpreter holds values:
+// tree-walker frames, bytecode registers, closure frames and call
+// arguments. It is an 8-byte payload plus the index of the Value
+// alternative it holds. Strings, arrays, maps, records and string builders
+// live in a reference-counted box holding the Value, so copying a
+// CompactValue never allocates and view() reads one without copying it.
+// Like the Interpreter, not thread-safe.
+class CompactValue {
+public:
+  // Same as a default-constructed Value (int8 zero)
+  CompactValue() : _tag(0) { _payload.i = 0; }
+  CompactValue(const Value &value);
+  CompactValue(Value &&value);
+  CompactValue(const CompactValue &other);
+  CompactValue(CompactValue &&other) noexcept;
+  CompactValue &operator=(const CompactValue &other);
+  CompactValue &operator=(CompactValue &&other) noexcept;
+  // Refills an unshared box rather than allocating another
+  CompactValue &operator=(Value &&value);
+  ~CompactValue() { release(); }
+
+  Value toValue() const;
+  // The value without copying it: boxed values are returned in place and
+  // scalars are built in `scratch`. The reference stays valid until this
+  // CompactValue is assigned or destroyed, or `scratch` changes.
+  const Value &view(Value &scratch) const;
+  // The boxed value of a string, array, map, record or string builder, or
+  // null for a scalar
+  const Value *boxed() const {
+    return isHeap() ? &_payload.heap->value : nullptr;
+  }
+  // Like toValue, but moves a value out of a box nothing else shares; for
+  // frames and registers about to be dropped
+  Value take();
+
+  static std::vector<Value> toValues(const std::vector<CompactValue> &values);
+
+  // Index of the Value alternative held
+  size_t index() const { return _tag; }
+
+  bool isInt32() const { return _tag == indexOf<int32_t>(); }
+  int32_t int32() const { return static_cast<int32_t>(_payload.i); }
+  void setInt32(int32_t value) {
+    release();
+    _tag = indexOf<int32_t>();
+    _payload.i = value;
+  }
+
+  bool isDouble() const { return _tag == indexOf<double>(); }
+  double doubleValue() const { return _payload.d; }
+  void setDouble(double value) {
+    release();
+    _tag = indexOf<double>();
+    _payload.d = value;
+  }
+
+  bool isBool() const { return _tag == indexOf<bool>(); }
+  bool boolean() const { return _payload.b; }
+  void setBool(bool value) {
+    release();
+    _tag = indexOf<bool>();
+    _payload.i = 0;
+    _payload.b = value;
+  }
+
+  bool isString() const { return _tag == indexOf<std::string>(); }
+  // Copies the string first if another CompactValue shares it
+  std::string &mutableString();
+
+  bool isArray() const { return _tag == indexOf<ArrayPtr>(); }
+  const ArrayPtr &array() const;
+  // Like ValueHelper::mutableArray: copies the array first if another
+  // CompactValue or Value shares it. A box other CompactValues share is
+  // left to them, so their views stay valid.
+  ArrayValue &mutableArray();
+
+  template <typename T, size_t I = 0> static constexpr uint8_t indexOf() {
+    if constexpr (std::is_same_v<std::variant_alternative_t<I, Value>, T>) {
+      return static_cast<uint8_t>(I);
+    } else {
+      return indexOf<T, I + 1>();
+    }
+  }
+
+private:
+  struct Heap {
+    uint32_t refs;
+    Value value;
+  };
+
+  union Payload {
+    int64_t i; // signed integers, sign-extended
+    uint64_t u;
+    double d;
+    bool b;
+    Heap *heap; // strings, arrays, maps, records and string builders
+  };
+
+  Payload _payload;
+  uint8_t _tag;
+
+  static bool isHeap(size_t tag) {
+    return tag == indexOf<std::string>() || tag == indexOf<ArrayPtr>() ||
+           tag == indexOf<MapPtr>() || tag == indexOf<RecordPtr>() ||
+           tag == indexOf<StringBuilderPtr>();
+  }
+  bool isHeap() const { return isHeap(_tag); }
+  void retain() const;
+  void release() {
+    if (isHeap()) {
+      releaseHeap();
+    }
+  }
+  void releaseHeap();
+};
+
+static_assert(sizeof(CompactValue) == 16, "CompactValue must stay 16 bytes");
+
+} // namespace Script
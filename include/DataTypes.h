@@ -1,11 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <variant>
 #include <stdexcept>
 #include <vector>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 namespace Script {
 
@@ -21,41 +24,82 @@ enum class DataType {
     DOUBLE,
     STRING,
     BOOL,
-    VOID
+    VOID,
+    MAP,
+    STRUCT,
+    STRING_BUILDER
 };
 
+struct StructType;
+
 struct TypeInfo {
     DataType baseType;
     bool isArray;
+    // Scalar key and value types of a map<K, V>; VOID for other types
+    DataType keyType = DataType::VOID;
+    DataType valueType = DataType::VOID;
+    // Layout of a struct type or an array of one; null for other types
+    std::shared_ptr<const StructType> structType;
 
     TypeInfo(DataType b = DataType::VOID, bool arr = false)
         : baseType(b), isArray(arr) {}
 
+    static TypeInfo map(DataType key, DataType value) {
+        TypeInfo type(DataType::MAP);
+        type.keyType = key;
+        type.valueType = value;
+        return type;
+    }
+    bool isMap() const { return baseType == DataType::MAP && !isArray; }
+
+    static TypeInfo record(std::shared_ptr<const StructType> layout,
+                           bool arr = false) {
+        TypeInfo type(DataType::STRUCT, arr);
+        type.structType = std::move(layout);
+        return type;
+    }
+    bool isRecord() const { return baseType == DataType::STRUCT && !isArray; }
+    bool isStringBuilder() const {
+        return baseType == DataType::STRING_BUILDER && !isArray;
+    }
+
+    // Struct types compare by identity: two declarations with the same
+    // fields are still different types
     bool operator==(const TypeInfo &other) const {
-        return baseType == other.baseType && isArray == other.isArray;
+        return baseType == other.baseType && isArray == other.isArray &&
+               keyType == other.keyType && valueType == other.valueType &&
+               structType == other.structType;
     }
 
     bool operator!=(const TypeInfo &other) const { return !(*this == other); }
 };
 
-struct ArrayValue {
-    DataType elementType;
-    std::vector<std::variant<
-        int8_t,
-        uint8_t,
-        int16_t,
-        uint16_t,
-        int32_t,
-        uint32_t,
-        int64_t,
-        uint64_t,
-        double,
-        std::string,
-        bool,
-        std::shared_ptr<ArrayValue>>> elements;
+// Field layout of a struct declaration. Fields are numbered in declaration
+// order, and a record stores field i at index i.
+struct StructType {
+    std::string name;
+    std::vector<std::string> fieldNames;
+    std::vector<TypeInfo> fieldTypes;
+
+    // Index of the named field, or -1
+    int32_t fieldIndex(const std::string &field) const {
+        for (size_t i = 0; i < fieldNames.size(); ++i) {
+            if (fieldNames[i] == field) {
+                return static_cast<int32_t>(i);
+            }
+        }
+        return -1;
+    }
 };
 
+class ArrayValue;
 using ArrayPtr = std::shared_ptr<ArrayValue>;
+class MapValue;
+using MapPtr = std::shared_ptr<MapValue>;
+class RecordValue;
+using RecordPtr = std::shared_ptr<RecordValue>;
+class StringBuilderValue;
+using StringBuilderPtr = std::shared_ptr<StringBuilderValue>;
 
 // Variant to hold any script value
 using Value = std::variant<
@@ -70,12 +114,303 @@ using Value = std::variant<
     double,
     std::string,
     bool,
-    ArrayPtr
+    ArrayPtr,
+    MapPtr,
+    RecordPtr,
+    StringBuilderPtr
 >;
 
+// Contiguous elements of one type inside an array's native buffer. Null
+// (false) when the array does not hold that type.
+template <typename T> class ElementSpan {
+public:
+    using value_type = T;
+
+    ElementSpan() = default;
+    ElementSpan(const T *data, size_t size) : _data(data), _size(size) {}
+
+    explicit operator bool() const { return _data != nullptr; }
+    const T *data() const { return _data; }
+    size_t size() const { return _size; }
+    const T &operator[](size_t index) const { return _data[index]; }
+    const T *begin() const { return _data; }
+    const T *end() const { return _data + _size; }
+
+private:
+    const T *_data = nullptr;
+    size_t _size = 0;
+};
+
+// Array storage. Elements live in one native buffer picked by the element
+// type (std::vector<int32_t> for int32[] and so on; the buffer's index in
+// Storage is the DataType). Arrays whose elements do not all have the
+// element type, such as mixed literals or `[]` grown with push, keep a
+// vector of Values instead. So do arrays of records, whose buffer holds one
+// record handle per element, and recordType() gives their struct type.
+//
+// Arrays have value semantics with copy-on-write: assigning an array or
+// passing it to a procedure shares the ArrayValue, and whoever modifies it
+// first takes a private copy (see ValueHelper::mutableArray). Code that
+// only reads never copies.
+//
+// A view (see slice) presents a range of another array's elements without
+// copying them. It holds a reference to that array, so writes to the array
+// copy it as for any other sharer; the first write to the view copies its
+// range into a buffer of its own. Arrays the host owns are the exception:
+// scripts change them in place, so views of them, and variables bound to
+// them, are copies from the start (see ValueHelper::ownedByScript).
+//
+// Multi-dimensional arrays keep all elements in the one buffer, row-major,
+// with a shape giving the extent of each axis. Indexing one with fewer
+// indices than its rank yields a view of a sub-array, so m[i] is row i of
+// a matrix. Size and element positions count all elements; len and
+// bounds checks use the first axis.
+class ArrayValue {
+public:
+    using Storage = std::variant<
+        std::vector<int8_t>,
+        std::vector<uint8_t>,
+        std::vector<int16_t>,
+        std::vector<uint16_t>,
+        std::vector<int32_t>,
+        std::vector<uint32_t>,
+        std::vector<int64_t>,
+        std::vector<uint64_t>,
+        std::vector<double>,
+        std::vector<std::string>,
+        std::vector<bool>,
+        std::vector<Value>>;
+
+    explicit ArrayValue(DataType elementType);
+    // Shapes of two or more extents must multiply out to the element count
+    ArrayValue(DataType elementType, const std::vector<Value> &elements,
+               std::vector<size_t> shape = {});
+    // Takes over a buffer; it must be the one elementType selects
+    ArrayValue(DataType elementType, Storage storage,
+               std::vector<size_t> shape = {})
+        : _elementType(elementType), _storage(std::move(storage)),
+          _shape(normalized(std::move(shape))) {}
+
+    // View of the `length` elements of array starting at `offset`, shaped
+    // like `shape` (empty for one dimension). Views of views refer to the
+    // underlying array directly.
+    static ArrayPtr view(const ArrayPtr &array, size_t offset, size_t length,
+                         std::vector<size_t> shape = {});
+    // View of the sub-arrays [start, end) along the first axis, which must
+    // be in range
+    static ArrayPtr slice(const ArrayPtr &array, size_t start, size_t end);
+
+    DataType elementType() const { return _elementType; }
+    // Struct type of a STRUCT array's elements; null for other arrays
+    const std::shared_ptr<const StructType> &recordType() const {
+        return _recordType;
+    }
+    void setRecordType(std::shared_ptr<const StructType> type) {
+        _recordType = std::move(type);
+    }
+    // Number of elements, across all dimensions
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    bool isView() const { return _viewOf != nullptr; }
+    // Set on arrays read through external variables, which scripts change
+    // in place (see Interpreter::arrayToModify)
+    bool hostOwned() const { return _hostOwned; }
+    void setHostOwned(bool hostOwned = true) { _hostOwned = hostOwned; }
+
+    size_t rank() const { return _shape.empty() ? 1 : _shape.size(); }
+    size_t extent(size_t axis) const {
+        return _shape.empty() ? size() : _shape[axis];
+    }
+    // Extent of the first axis, which len reports
+    size_t length() const { return extent(0); }
+    std::vector<size_t> shape() const {
+        return _shape.empty() ? std::vector<size_t>{size()} : _shape;
+    }
+    // The extents must multiply out to size()
+    void setShape(std::vector<size_t> shape) {
+        _shape = normalized(std::move(shape));
+    }
+
+    // Element access by position in the row-major buffer, which must be in
+    // range; push and pop only apply to one-dimensional arrays
+    Value get(size_t index) const;
+    void set(size_t index, Value value);
+    void push(Value value);
+    Value pop();
+
+    std::vector<Value> toValues() const;
+
+    // The native buffer this array owns, or null if it holds another type,
+    // has fallen back to Values or is a view
+    template <typename T> std::vector<T> *buffer() {
+        return _viewOf ? nullptr : std::get_if<std::vector<T>>(&_storage);
+    }
+    template <typename T> const std::vector<T> *buffer() const {
+        return _viewOf ? nullptr : std::get_if<std::vector<T>>(&_storage);
+    }
+    // The elements in a native buffer of T, owned or viewed
+    template <typename T> ElementSpan<T> elements() const {
+        static_assert(!std::is_same_v<T, bool>, "std::vector<bool> is packed");
+        if (_viewOf) {
+            const auto *buffer = _viewOf->template buffer<T>();
+            return buffer ? ElementSpan<T>(buffer->data() + _offset, _length)
+                          : ElementSpan<T>();
+        }
+        const auto *buffer = std::get_if<std::vector<T>>(&_storage);
+        return buffer ? ElementSpan<T>(buffer->data(), buffer->size())
+                      : ElementSpan<T>();
+    }
+    bool isTyped() const {
+        const Storage &storage = _viewOf ? _viewOf->_storage : _storage;
+        return !std::holds_alternative<std::vector<Value>>(storage);
+    }
+
+private:
+    DataType _elementType;
+    std::shared_ptr<const StructType> _recordType;
+    Storage _storage; // empty for views
+    ArrayPtr _viewOf; // the array a view presents, never itself a view
+    size_t _offset = 0;
+    size_t _length = 0;
+    std::vector<size_t> _shape; // empty for one dimension
+    bool _hostOwned = false;
+
+    static std::vector<size_t> normalized(std::vector<size_t> shape) {
+        if (shape.size() < 2) {
+            shape.clear();
+        }
+        return shape;
+    }
+
+    // Gives a view its own copy of the elements it presents
+    void detach();
+    // Moves typed elements into a vector of Values
+    std::vector<Value> &fallBackToValues();
+};
+
+// Hash map from keys of one scalar type to values of another. Entries sit
+// in two typed arrays, keys and values at the same position, found through
+// an open-addressing table of positions probed linearly. Removing an entry
+// moves the last one into its place, so keys() lists them in insertion
+// order only until the first removal.
+//
+// Unlike arrays, maps are references: assigning a map or passing it to a
+// procedure shares it, and a put through one handle shows through all.
+class MapValue {
+public:
+    MapValue(DataType keyType, DataType valueType);
+
+    DataType keyType() const { return _keys->elementType(); }
+    DataType valueType() const { return _values->elementType(); }
+    size_t size() const { return _keys->size(); }
+
+    // Keys and values must already have the map's types (see
+    // ValueHelper::convertElement)
+    bool has(const Value &key) const;
+    // False, leaving value alone, if key is absent
+    bool get(const Value &key, Value &value) const;
+    // Entry index of key, in keys() order, or -1 if it is absent
+    int64_t find(const Value &key) const;
+    Value valueAt(size_t entry) const { return _values->get(entry); }
+    void put(Value key, Value value);
+    // False if key was absent
+    bool remove(const Value &key);
+
+    // The keys, shared with the map until it next changes
+    const ArrayPtr &keys() const { return _keys; }
+
+private:
+    ArrayPtr _keys;
+    ArrayPtr _values;
+    // Entry position + 1 per slot, or EMPTY or REMOVED; a power of two long
+    std::vector<uint32_t> _slots;
+    size_t _used = 0; // slots not EMPTY
+
+    static constexpr uint32_t EMPTY = 0;
+    static constexpr uint32_t REMOVED = UINT32_MAX;
+
+    // Slot holding key, or the slot a new key would take (-1 if none)
+    int64_t findSlot(const Value &key, uint64_t hash, bool &found) const;
+    void rehash(size_t capacity);
+    // Copies the entry arrays if keys() handed them out
+    void unshare();
+};
+
+// Instance of a struct: its fields in one block, in declaration order.
+// Like maps, records are references; assigning a record or passing it to a
+// procedure copies the handle, and field writes show through every handle.
+class RecordValue {
+public:
+    // Fields take their types' default values
+    explicit RecordValue(std::shared_ptr<const StructType> type);
+    // Fields must already have their declared types
+    RecordValue(std::shared_ptr<const StructType> type,
+                std::vector<Value> fields)
+        : _type(std::move(type)), _fields(std::move(fields)) {}
+
+    const std::shared_ptr<const StructType> &type() const { return _type; }
+    size_t fieldCount() const { return _fields.size(); }
+    const Value &field(size_t index) const { return _fields[index]; }
+    void setField(size_t index, Value value) {
+        _fields[index] = std::move(value);
+    }
+    // The stored field, for writes that change its value in place (push to
+    // an array field copies the array here, not in a temporary)
+    Value &fieldSlot(size_t index) { return _fields[index]; }
+
+    // Index of the named field: `index` when the record has the `expected`
+    // type resolved at load time, otherwise looked up by name. Throws if
+    // there is no such field.
+    size_t fieldIndex(const std::string &name, const StructType *expected,
+                      int32_t index) const {
+        return _type.get() == expected ? static_cast<size_t>(index)
+                                       : lookupField(name);
+    }
+
+private:
+    std::shared_ptr<const StructType> _type;
+    std::vector<Value> _fields;
+
+    size_t lookupField(const std::string &name) const;
+};
+
+// Growable text buffer behind the stringbuilder type. Appends go into the
+// buffer's spare capacity, which at least doubles whenever it runs out, so
+// building n bytes copies O(n) bytes and allocates O(log n) times, where
+// repeated `s = s + x` copies the whole string on every step. Like maps,
+// builders are references.
+class StringBuilderValue {
+public:
+    size_t size() const { return _buffer.size(); }
+    size_t capacity() const { return _buffer.capacity(); }
+    const std::string &contents() const { return _buffer; }
+
+    void append(const std::string &text) {
+        reserveFor(text.size());
+        _buffer.append(text);
+    }
+    // Strings are appended as they are, other values as toString gives them
+    void append(const Value &value);
+
+private:
+    std::string _buffer;
+
+    void reserveFor(size_t extra) {
+        if (_buffer.size() + extra > _buffer.capacity()) {
+            _buffer.reserve(
+                std::max(_buffer.capacity() * 2, _buffer.size() + extra));
+        }
+    }
+};
+
 class ValueHelper {
 public:
     static TypeInfo getType(const Value& val);
+    // Whether a value typed statically as a scalar or record type has
+    // another one after all (a procedure reloaded with a different return
+    // type produced it), so binding it still needs convertToType. Always
+    // false for other types.
+    static bool needsConversion(const Value &val, const TypeInfo &type);
     static std::string typeToString(const TypeInfo &type);
     static TypeInfo stringToType(const std::string& str);
     
@@ -92,6 +427,10 @@ public:
     static Value multiply(const Value& a, const Value& b);
     static Value divide(const Value& a, const Value& b);
     static Value modulo(const Value& a, const Value& b);
+    // Same as target = add(target, b) for a string target, but appends in
+    // place so the string's spare capacity is reused. Returns false and
+    // leaves target alone when add would not give a string (b is an array).
+    static bool appendString(std::string &target, const Value &b);
     
     // Comparison operations
     static bool greaterThan(const Value& a, const Value& b);
@@ -106,6 +445,9 @@ public:
     static bool logicalOr(const Value& a, const Value& b);
     static bool logicalNot(const Value& a);
     static Value bitNot(const Value& a);
+    // Unary minus: doubles stay doubles, every other scalar is negated
+    // into an int32
+    static Value negate(const Value& a);
 
     // Bitwise operations (integers only)
     static Value bitAnd(const Value& a, const Value& b);
@@ -121,13 +463,47 @@ public:
     static Value createValue(DataType type, const std::string& strVal);
     static Value createValue(DataType type, bool boolVal);
 
+    // Value of an uninitialized declaration (arrays start out empty)
+    static Value defaultValue(const TypeInfo &type);
+
     // Array helpers
     static ArrayPtr createArray(const TypeInfo &elementType, const std::vector<Value> &values);
     static bool isArray(const Value &val);
     static TypeInfo arrayElementType(const Value &val);
-    static std::vector<Value> &arrayElements(Value &val);
-    static const std::vector<Value> &arrayElements(const Value &val);
+    static ArrayValue &arrayValue(const Value &val);
+    // The array to modify in place: val's own, after copying it into val if
+    // any other handle shares it
+    static ArrayValue &mutableArray(Value &val);
+    // val, or a copy of it if it is an array the host owns. Scripts change
+    // those in place, so a variable bound to one takes a copy to keep the
+    // elements it was given.
+    static Value ownedByScript(Value val);
+    // array[indices[0]][indices[1]]... in one step: the element, or a view
+    // of the sub-array when there are fewer indices than dimensions.
+    // Throws "Array index out of bounds", or "Indexing non-array value"
+    // when there are more indices than dimensions.
+    static Value indexArray(const Value &val, const Value *indices,
+                            size_t count);
+    // Position in the buffer of the element an index assignment with one
+    // index per dimension writes to
+    static size_t elementOffset(const ArrayValue &array, const Value *indices,
+                                size_t count);
+    // Copy of the elements as Values
+    static std::vector<Value> arrayElements(const Value &val);
     static Value convertElement(const Value &val, const TypeInfo &target);
+
+    // Map helpers
+    static MapPtr createMap(const TypeInfo &type);
+    static bool isMap(const Value &val);
+    static MapValue &mapValue(const Value &val);
+
+    // Record helpers
+    static bool isRecord(const Value &val);
+    static RecordValue &recordValue(const Value &val);
+
+    // String builder helpers
+    static bool isStringBuilder(const Value &val);
+    static StringBuilderValue &stringBuilderValue(const Value &val);
 };
 
 } // namespace Script
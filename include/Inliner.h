@@ -0,0 +1,63 @@
+#pragma once
+
+#include "AST.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Script {
+
+// Gives calls to small procedures a copy of the callee's returned
+// expression to evaluate in the caller's frame (CallExpr::inlined), when a
+// procedure is loaded. A callee is small when its body is a single
+// `return expr;`, optionally after locals initialized with literals of their
+// own type that expr does not read, and expr has at most MAX_NODES nodes.
+//
+// The copy is only equivalent to the call when no conversion would happen
+// and nothing the callee could change belongs to the caller, so a call is
+// inlined when:
+//  - the callee does not call itself and is not already being expanded,
+//    returns a value of exactly its return type
+//    (ProcedureDecl::returnsTyped) and does not push or pop
+//  - every argument is a literal or a local of exactly the parameter's
+//    scalar or record type; the copy reads it wherever the callee reads the
+//    parameter
+//
+// Calls inside the copy are inlined in turn, up to MAX_DEPTH levels. The
+// engines use the copy only while the procedure loaded under the call's name
+// is still the one it was made from, and make the call otherwise. Loading a
+// procedure runs the Inliner again over the callers loaded before it that
+// call its name (see callees), so the order files are loaded in does not
+// matter.
+class Inliner {
+public:
+  static constexpr size_t MAX_NODES = 32;
+  static constexpr size_t MAX_DEPTH = 4;
+
+  explicit Inliner(
+      const std::unordered_map<std::string, ProcedureDeclPtr> &procedures)
+      : _procedures(procedures) {}
+
+  void run(ProcedureDecl &proc);
+  // Names the last run's calls looked up, including those in the copies it
+  // made; a procedure loaded later under one of them may change the result
+  const std::unordered_set<std::string> &callees() const { return _callees; }
+
+  // The expression proc returns, if proc is small enough to inline
+  static const Expression *inlinableBody(const ProcedureDecl &proc);
+
+private:
+  const std::unordered_map<std::string, ProcedureDeclPtr> &_procedures;
+  // Procedures whose copies are being made, innermost last
+  std::vector<const ProcedureDecl *> _expanding;
+  std::unordered_set<std::string> _callees;
+
+  void visitStatement(Statement *stmt);
+  void visitExpression(Expression *expr);
+  void inlineCall(CallExpr &call);
+  // expr with each read of parameter i replaced by a copy of arguments[i]
+  ExprPtr copy(const Expression &expr, const std::vector<ExprPtr> &arguments);
+};
+
+} // namespace Script
@@ -1,13 +1,18 @@
 #pragma once
 
 #include "AST.h"
+#include "Builtins.h"
+#include "CompactValue.h"
 #include "DataTypes.h"
+#include "Superoperators.h"
+#include <array>
 #include <functional>
 #include <initializer_list>
-#include <limits>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace Script {
@@ -24,35 +29,81 @@ public:
         procedureName(procName) {}
 };
 
-class ReturnException : public std::exception {
-public:
-  Value value;
-  ReturnException(const Value &val) : value(val) {}
-};
-
-class BreakException : public std::exception {};
-class ContinueException : public std::exception {};
+// How a statement finished; loops and procedures consume the non-normal
+// results instead of unwinding with exceptions
+enum class ExecStatus { NORMAL, BREAK, CONTINUE, RETURN };
 
 // External function callback
 using ExternalFunctionCallback =
   std::function<Value(const std::vector<Value> &)>;
 
+// A pure function's result depends only on its arguments, and calling it
+// changes nothing, so the optimizer may call it fewer times than the script
+// does, though never where the script would not have (see Purity.h).
+// returnType, when not VOID, is the type every call returns; it lets the
+// optimizer keep a pure call's result in a typed local.
 struct ExternalBinding {
   std::string name;
   ExternalFunctionCallback callback;
+  bool pure = false;
+  TypeInfo returnType = TypeInfo(DataType::VOID);
 };
 
 // External variable callbacks
 using ExternalVariableGetter = std::function<Value()>;
 using ExternalVariableSetter = std::function<void(const Value &)>;
 
+// Strategy used to run procedures
+enum class ExecutionEngine {
+  TREE_WALKER, // evaluate the AST directly
+  BYTECODE,    // lower procedures to register bytecode and run it on the VM
+  CLOSURE      // convert procedures into pre-bound closures once, then call
+};
+
+class VirtualMachine;
+class ClosureCompiler;
+
 class Interpreter {
 public:
   Interpreter();
-
-  // Register an external function by name
+  ~Interpreter();
+
+  // Select the execution engine (procedures are lowered lazily if needed)
+  void setExecutionEngine(ExecutionEngine engine);
+  ExecutionEngine getExecutionEngine() const { return _engine; }
+
+  // Run eligible procedures as native code (x86-64 Linux only); the others
+  // keep using the selected engine
+  void setJitEnabled(bool enabled) { _jitEnabled = enabled; }
+  bool isJitEnabled() const { return _jitEnabled; }
+
+  // Fuse hot node shapes into superoperators for the tree walker (on by
+  // default); affects procedures loaded afterwards
+  void setSuperoperatorsEnabled(bool enabled) {
+    _superoperatorsEnabled = enabled;
+  }
+  bool areSuperoperatorsEnabled() const { return _superoperatorsEnabled; }
+
+  // Give calls to small procedures an inlined copy of the callee (see
+  // Inliner.h; on by default); affects procedures loaded afterwards
+  void setInliningEnabled(bool enabled) { _inliningEnabled = enabled; }
+  bool isInliningEnabled() const { return _inliningEnabled; }
+
+  // Sites, hits and absorbed node evaluations per superoperator
+  std::array<SuperoperatorCounter, SUPEROP_COUNT>
+  superoperatorCounters() const;
+
+  // The counters formatted as a table, one superoperator per row
+  std::string superoperatorReport() const;
+
+  // Register an external function by name; pure and returnType as for
+  // ExternalBinding. Whether a call reaches a pure function is decided when
+  // its script is loaded; procedures optimized on that basis go back to
+  // their unoptimized bodies once it no longer holds.
   void registerExternalFunction(const std::string &name,
-                                ExternalFunctionCallback callback);
+                                ExternalFunctionCallback callback,
+                                bool pure = false,
+                                const TypeInfo &returnType = TypeInfo());
 
   // Register multiple external functions at once
   void registerExternalFunctions(const std::vector<ExternalBinding> &bindings);
@@ -67,6 +118,12 @@ public:
   // Check if an external function is registered
   bool hasExternalFunction(const std::string &name) const;
 
+  // Check if an external function is registered as pure
+  bool isPureExternalFunction(const std::string &name) const;
+  // What a pure external function was registered as returning; VOID when
+  // unknown or the function is not pure
+  TypeInfo pureExternalReturnType(const std::string &name) const;
+
   // Register an external variable by name (getter required, setter optional)
   void registerExternalVariable(const std::string &name,
                                 ExternalVariableGetter getter,
@@ -85,13 +142,16 @@ public:
   // Load a script (add procedures to the interpreter)
   void loadScript(ScriptPtr script);
 
-  // Execute a procedure by name
+  // Execute a procedure by name. The host's arguments are converted to
+  // CompactValues here; from then on calls pass CompactValues along.
   Value executeProcedure(const std::string &name,
                          const std::vector<Value> &arguments);
 
-  // Internal fast path when procedure is already resolved
+  // Internal fast path when procedure is already resolved. Typed arguments
+  // already have the parameter types and are bound without conversion.
   Value executeProcedure(ProcedureDeclPtr proc,
-                         const std::vector<Value> &arguments);
+                         const std::vector<CompactValue> &arguments,
+                         bool argumentsTyped = false);
 
   // Check if a procedure exists
   bool hasProcedure(const std::string &name) const;
@@ -100,69 +160,216 @@ public:
   ProcedureDeclPtr getProcedure(const std::string &name) const;
 
 private:
-  // Environment for variables (stack of scopes)
-  class Environment {
-  public:
-    Environment(Environment *parent = nullptr) : _parent(parent) {}
-
-    void define(const std::string &name, const Value &value);
-    Value get(const std::string &name) const;
-    void assign(const std::string &name, const Value &value);
-    bool has(const std::string &name) const;
-
-    void enterScope();
-    void exitScope();
-
-  private:
-    Environment *_parent;
-    std::vector<std::unordered_map<std::string, Value>> _scopes;
-    std::unordered_map<std::string, Value> _globals;
-    mutable std::unordered_map<std::string, size_t> _lookupCache; // name -> scope index (GLOBAL = npos)
-    std::vector<std::vector<std::string>> _scopeNames;            // names defined per scope for cache invalidation
-
-    static constexpr size_t GLOBAL = std::numeric_limits<size_t>::max();
-  };
+  friend class VirtualMachine;
+  friend class ClosureCompiler;
 
   std::unordered_map<std::string, ProcedureDeclPtr> _procedures;
   std::unordered_map<std::string, ExternalFunctionCallback> _externalFunctions;
+  // Pure external functions and their return types
+  std::unordered_map<std::string, TypeInfo> _pureExternalFunctions;
   struct ExternalVariable {
     ExternalVariableGetter getter;
     ExternalVariableSetter setter;
+    // The getter's value, with an array marked as the host's
+    Value get() const;
   };
   std::unordered_map<std::string, ExternalVariable> _externalVariables;
-  Environment *_currentEnv;
+  // Flat frame storage: each tree-walker call claims frameSize slots
+  // starting at _frameBase, so locals are addressed by index. Slots are
+  // compact so a frame of scalars stays within a few cache lines; the
+  // bytecode VM's registers and closure frames are compact too.
+  std::vector<CompactValue> _stack;
+  size_t _frameBase = 0;
+
+  // Closure-engine frames. Compiled closures hold a pointer to their
+  // frame's slots, so frames come from blocks that never move rather than
+  // from _stack; blocks are kept once allocated, so calls past the deepest
+  // one so far allocate nothing. Frames are claimed and released in call
+  // order.
+  class FrameStack {
+  public:
+    // Default slots for one call, released when it goes out of scope
+    class Frame {
+    public:
+      Frame(FrameStack &stack, size_t count)
+          : _stack(stack), _slots(stack.claim(count)), _count(count) {}
+      ~Frame() { _stack.release(_slots, _count); }
+      Frame(const Frame &) = delete;
+      Frame &operator=(const Frame &) = delete;
+
+      CompactValue *data() const { return _slots; }
+      CompactValue &operator[](size_t i) const { return _slots[i]; }
+
+    private:
+      FrameStack &_stack;
+      CompactValue *_slots;
+      size_t _count;
+    };
+
+  private:
+    struct Block {
+      std::unique_ptr<CompactValue[]> slots;
+      size_t size = 0;
+      size_t used = 0;
+    };
+    static constexpr size_t BLOCK_SLOTS = 1024;
+
+    std::vector<Block> _blocks;
+    size_t _current = 0;
+
+    CompactValue *claim(size_t count);
+    // Resets the slots, so values they held are not kept alive
+    void release(CompactValue *slots, size_t count);
+  };
+  FrameStack _closureFrames;
+  Value _returnValue; // set by executeReturn alongside ExecStatus::RETURN
   std::string _currentProcedure;
   uint64_t _callCacheVersion = 1;
+  ExecutionEngine _engine = ExecutionEngine::TREE_WALKER;
+  bool _jitEnabled = false;
+  bool _superoperatorsEnabled = true;
+  bool _inliningEnabled = true;
+  // Sites tagged in each loaded procedure, replaced when it is reloaded
+  std::unordered_map<std::string, std::array<uint32_t, SUPEROP_COUNT>>
+      _superopSites;
+  // Names each loaded procedure calls, as its last inlining found them
+  // (see Inliner::callees)
+  std::unordered_map<std::string, std::unordered_set<std::string>> _callees;
+  std::array<SuperoperatorCounter, SUPEROP_COUNT> _superopCounters{};
+  std::unique_ptr<VirtualMachine> _vm;
+
+  BytecodeProcedure &bytecodeFor(const ProcedureDecl &proc);
+  ClosureProcedure &closureFor(const ProcedureDecl &proc);
+  const JitProcedure &jitFor(const ProcedureDecl &proc);
+
+  // Inline calls, tag superoperators and compile for the engine, once the
+  // procedure is in _procedures
+  void prepare(ProcedureDecl &proc);
+  // Replace each procedure whose optimized body relied on an external that
+  // is no longer pure as it was (see ProcedureDecl::generalBody)
+  void dropStalePurityAssumptions();
+
+  // Run a procedure provided by a native module
+  Value executeNative(const ProcedureDecl &proc,
+                      const std::vector<CompactValue> &arguments);
+
+  // Call from a site the TypeChecker checked: if proc is the procedure it
+  // was checked against, typed arguments skip conversion
+  Value executeChecked(const ProcedureDeclPtr &proc,
+                       const std::vector<CompactValue> &arguments,
+                       bool checked, bool argumentsTyped);
+
+  // The value a parameter of `type` is bound to: a typed argument that
+  // already has the type is shared, anything else converted
+  CompactValue bindParameter(const TypeInfo &type,
+                             const CompactValue &argument, bool typed);
+
+  // Shared procedure epilogue: rejects stray break/continue and converts the
+  // returned value to the declared return type
+  Value finishProcedure(const ProcedureDecl &proc, ExecStatus status,
+                        const Value &returnValue);
 
   // Evaluation methods
   Value evaluate(ExprPtr expr);
-  void execute(StmtPtr stmt);
+  ExecStatus execute(StmtPtr stmt);
 
   Value evaluateLiteral(LiteralExpr *expr);
   Value evaluateVariable(VariableExpr *expr);
   Value evaluateArrayLiteral(ArrayLiteralExpr *expr);
   Value evaluateIndex(IndexExpr *expr);
+  Value evaluateNestedIndex(IndexExpr *expr);
   Value evaluateBinary(BinaryExpr *expr);
   Value evaluateUnary(UnaryExpr *expr);
   Value evaluateCall(CallExpr *expr);
   Value evaluateConditional(ConditionalExpr *expr);
+  Value evaluateField(FieldExpr *expr);
+  Value evaluateRecord(RecordExpr *expr);
+
+  // Frame slot of a local variable expression, or null for anything else
+  CompactValue *localSlot(Expression *expr);
+  // What expr evaluates to. A local is viewed in its frame slot rather than
+  // copied out (see CompactValue::view), so the result must be used before
+  // anything that could change the local is evaluated.
+  const Value &evaluateInPlace(const ExprPtr &expr, Value &scratch);
+  // Call arguments; locals are shared with their slots, not copied out
+  std::vector<CompactValue> evaluateArguments(const CallExpr *expr);
+
+  // Field value of `object`, as evaluateField reads it
+  Value fieldOf(FieldExpr *expr, const Value &object);
+
+  // Evaluates the array push, pop or an index assignment writes to. When
+  // `target` is a record field, `owner` receives the record so the write
+  // lands in the field rather than in a copy of its array.
+  Value evaluateArrayTarget(const ExprPtr &target, RecordPtr &owner);
+  // The array push, pop or an index assignment writes to, given the value
+  // `target` evaluated to and the record evaluateArrayTarget found
+  ArrayValue &arrayToModify(Expression *target, Value &evaluated,
+                            RecordValue *owner);
+
+  // Truth value of a condition; fused comparisons skip the Value round trip
+  bool evaluateCondition(const ExprPtr &expr);
+
+  // Superoperator fast paths (see Superoperators.h)
+  bool evaluateLocalCompare(BinaryExpr *expr);
+  bool evaluateCompareChain(BinaryExpr *expr);
+  bool evaluateChainOperand(BinaryExpr *expr, uint64_t &absorbed);
+  Value evaluateLocalIndex(IndexExpr *expr);
+  void executeLocalAddLiteral(AssignStmt *stmt);
+  bool int32Operand(Expression *expr, int32_t &out) const;
+  const Value &operandValue(Expression *expr, Value &scratch) const;
+  void countSuperop(Superop op, uint64_t absorbed) {
+    auto &counter = _superopCounters[static_cast<size_t>(op)];
+    ++counter.hits;
+    counter.absorbed += absorbed;
+  }
 
   void executeExpression(ExpressionStmt *stmt);
   void executeVarDecl(VarDeclStmt *stmt);
   void executeAssign(AssignStmt *stmt);
-  void executeBlock(BlockStmt *stmt);
-  void executeIf(IfStmt *stmt);
-  void executeWhile(WhileStmt *stmt);
-  void executeFor(ForStmt *stmt);
-  void executeDoWhile(DoWhileStmt *stmt);
-  void executeSwitch(SwitchStmt *stmt);
-  void executeReturn(ReturnStmt *stmt);
-  void executeBreak(BreakStmt *stmt);
-  void executeContinue(ContinueStmt *stmt);
+  ExecStatus executeBlock(BlockStmt *stmt);
+  ExecStatus executeIf(IfStmt *stmt);
+  ExecStatus executeWhile(WhileStmt *stmt);
+  ExecStatus executeFor(ForStmt *stmt);
+  ExecStatus executeDoWhile(DoWhileStmt *stmt);
+  ExecStatus executeSwitch(SwitchStmt *stmt);
+  ExecStatus executeReturn(ReturnStmt *stmt);
   void executeIndexAssign(IndexAssignStmt *stmt);
+  void executeNestedIndexAssign(IndexAssignStmt *stmt);
+  void executeFieldAssign(FieldAssignStmt *stmt);
 
   RuntimeError runtimeError(const std::string &message, int line, int column);
 
+  // The array, map or stringbuilder builtin a call that found no procedure
+  // or external resolves to, or null for "Undefined function". Call sites
+  // cache it, so calling one costs no lookup and no argument vectors.
+  static BuiltinFunction findBuiltin(const std::string &name);
+  Value callBuiltin(BuiltinFunction builtin, const CompactValue *args,
+                    size_t count, int line, int column);
+  // Runs a resolved builtin on expr's arguments
+  Value evaluateBuiltinCall(CallExpr *expr, BuiltinFunction builtin);
+
+  // Slots above the current frame holding a builtin call's arguments while
+  // they are evaluated and passed; calls made meanwhile claim their frames
+  // above these. Released when it goes out of scope.
+  class ArgumentSlots {
+  public:
+    ArgumentSlots(Interpreter &interp, size_t count)
+        : _stack(interp._stack), _base(_stack.size()) {
+      _stack.resize(_base + count);
+    }
+    ~ArgumentSlots() { _stack.resize(_base); }
+    ArgumentSlots(const ArgumentSlots &) = delete;
+    ArgumentSlots &operator=(const ArgumentSlots &) = delete;
+
+    // Indexed afresh each time: calls in between may move the stack
+    CompactValue &operator[](size_t i) { return _stack[_base + i]; }
+    const CompactValue *data() const { return _stack.data() + _base; }
+
+  private:
+    std::vector<CompactValue> &_stack;
+    size_t _base;
+  };
+
   // Type conversion for parameters
   Value convertToType(const Value &val, const TypeInfo &targetType);
 };
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AST.h"
+#include "CompactValue.h"
+#include "DataTypes.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Script {
+
+// Machine code generated for one procedure. Procedures the JIT does not
+// handle still get an entry with a null `entry` and the reason recorded, so
+// the attempt is made only once.
+struct JitProcedure {
+  // Locals live in 64-bit cells; returns 0 on success, 1 to bail out
+  using Entry = int (*)(uint64_t *slots, uint64_t *result);
+
+  Entry entry = nullptr;
+  std::string declined; // why no code was generated
+
+  uint32_t slotCount = 0; // frame slots plus switch temporaries
+  std::vector<DataType> parameterTypes;
+  DataType returnType = DataType::VOID;
+
+  JitProcedure() = default;
+  JitProcedure(const JitProcedure &) = delete;
+  JitProcedure &operator=(const JitProcedure &) = delete;
+  ~JitProcedure();
+
+  // Run the native code. Returns false when the arguments cannot be passed
+  // natively or the code bailed out (e.g. division by zero); the caller then
+  // reruns the procedure on the interpreter, which is safe because compiled
+  // procedures only touch their own locals.
+  bool invoke(const std::vector<CompactValue> &arguments,
+              Value &result) const;
+
+private:
+  friend class JitCompiler;
+  void *_code = nullptr;
+  size_t _codeSize = 0;
+};
+
+using JitProcedurePtr = std::shared_ptr<JitProcedure>;
+
+// Baseline x86-64 compiler for procedures that only use int32, int64,
+// double and bool scalars held in locals. Anything else (calls, arrays,
+// strings, external variables, type-changing assignments) is declined and
+// left to the interpreter.
+class JitCompiler {
+public:
+  // True when native code can be generated on this platform
+  static bool isSupported();
+
+  JitProcedurePtr compile(const ProcedureDecl &proc);
+};
+
+} // namespace Script
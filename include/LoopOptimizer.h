@@ -0,0 +1,69 @@
+#pragma once
+
+#include "AST.h"
+#include "Purity.h"
+
+namespace Script {
+
+// Moves loop-invariant code out of while, do-while and for loops once the
+// type checker has annotated a procedure. An expression in a loop's
+// condition, increment or body is invariant when it is pure (see
+// PurityModel) and nothing the loop runs writes what it reads. The largest
+// such expressions (other than plain literals and locals) are evaluated
+// once into new locals declared just before the loop, and the loop reads
+// those instead:
+//
+//   while (i < len(xs)) { total += xs[i] * (scale + 1); i += 1; }
+//
+// runs as
+//
+//   { int32 $4 = len(xs); int32 $5 = scale + 1;
+//     while (i < $4) { total += xs[i] * $5; i += 1; } }
+//
+// Safe expressions cannot fail or change anything, so evaluating them when
+// the loop does not run (or in a branch it does not take) is unobservable.
+// Other invariant expressions, such as calls to pure externals, only move
+// when the first pass through the loop would evaluate them before anything
+// that may fail or change something. Those leading the condition (or a
+// do-while body) go just before the loop, after a for loop's initializer;
+// those leading a while or for body go behind a copy of the condition,
+// when it is safe, so a loop that does not run does not evaluate them:
+//
+//   for (int32 i = 0; i < n; i += 1) { total += weight(base) + i; }
+//
+// runs as
+//
+//   { int32 i = 0;
+//     if (i < n) { int32 $5 = weight(base);
+//                  for (; i < n; i += 1) { total += $5 + i; } } }
+//
+// Outer loops are done first; what stays in an inner loop is then
+// considered against the inner loop alone.
+class LoopOptimizer {
+public:
+  explicit LoopOptimizer(const PurityModel &purity) : _purity(purity) {}
+
+  void optimize(Script &script);
+  void optimize(ProcedureDecl &proc);
+
+private:
+  const PurityModel &_purity;
+  ProcedureDecl *_procedure = nullptr;
+
+  // What the loop being optimized writes, and the declarations of the
+  // locals its safe and its leading invariant expressions were moved to
+  const PurityModel::Writes *_writes = nullptr;
+  std::vector<StmtPtr> *_temporaries = nullptr;
+  std::vector<StmtPtr> *_leadingTemporaries = nullptr;
+
+  // The statement to put in stmt's place
+  StmtPtr visitStatement(const StmtPtr &stmt);
+  StmtPtr hoist(const StmtPtr &loop);
+  // leading: whether only safe code has run on the loop's first pass
+  // before stmt or expr; cleared once that no longer holds after it
+  void hoistStatement(StmtPtr &stmt, bool &leading);
+  void hoistExpression(ExprPtr &expr, bool &leading);
+  bool isInvariant(const Expression &expr) const;
+};
+
+} // namespace Script
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Builtins.h"
+#include "DataTypes.h"
+#include <string>
+#include <vector>
+
+namespace Script {
+
+// Builtins over map<K, V> values. Like the array builtins they rank below
+// procedures and external functions of the same name. Keys and values are
+// converted to the map's types as assignment would convert them.
+//
+//   get(m, k)        the value stored under k; errors if there is none
+//   get(m, k, d)     the same, or d converted to V if there is none
+//   put(m, k, v)     stores v under k, returning the int32 entry count
+//   has(m, k)        bool: whether k has a value
+//   remove(m, k)     bool: whether k had a value, which is now gone
+//   keys(m)          K[] of the keys, in insertion order until the first
+//                    remove; made in constant time
+//
+// len(m) gives the entry count. Lookups, puts and removes take expected
+// constant time.
+class MapBuiltins {
+public:
+  static bool isBuiltin(const std::string &name);
+
+  // The builtin of that name, or null; the engines resolve it once per
+  // call site
+  static BuiltinFunction find(const std::string &name);
+
+  // Errors are thrown as std::runtime_error; the engines add the position
+  static Value call(const std::string &name, const std::vector<Value> &args);
+};
+
+} // namespace Script
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+// Binary interface between the engine and shared objects generated by
+// cxxscript-aot. It is plain C so a module does not depend on the library's
+// C++ types: scalars cross it as 64-bit cells (see ScalarTypes) and types
+// are DataType values stored as uint8_t.
+
+#define CXXSCRIPT_NATIVE_ABI_VERSION 1
+
+extern "C" {
+
+// Filled in when a native procedure fails. A negative line means the
+// interpreter raises the error without a position (e.g. "Division by zero").
+struct CxxScriptNativeError {
+  const char *message;
+  int32_t line;
+  int32_t column;
+};
+
+struct CxxScriptNativeProcedure {
+  const char *name;
+  uint32_t parameterCount;
+  const uint8_t *parameterTypes;
+  uint8_t returnType;
+  int32_t line; // position of the declaration in the original script
+  int32_t column;
+  // Arguments arrive already converted to the parameter types. Returns 0 on
+  // success and non-zero after filling in `error`.
+  int (*invoke)(const uint64_t *args, uint64_t *result,
+                CxxScriptNativeError *error);
+};
+
+struct CxxScriptNativeModule {
+  uint32_t abiVersion;
+  uint32_t procedureCount;
+  const CxxScriptNativeProcedure *procedures;
+};
+
+// Every module exports this entry point
+typedef const CxxScriptNativeModule *(*CxxScriptNativeModuleEntry)();
+}
+
+#define CXXSCRIPT_NATIVE_MODULE_ENTRY "cxxscript_module"
+
+namespace Script {
+
+// A loaded shared object. Procedures keep it alive through NativeProcedure,
+// so it is unloaded only once nothing can call into it.
+class NativeModule {
+public:
+  // Throws std::runtime_error when the file cannot be loaded or was built
+  // for a different ABI version
+  static std::shared_ptr<NativeModule> open(const std::string &path);
+
+  NativeModule(const NativeModule &) = delete;
+  NativeModule &operator=(const NativeModule &) = delete;
+  ~NativeModule();
+
+  const std::string &path() const { return _path; }
+  const CxxScriptNativeModule &descriptor() const { return *_module; }
+
+private:
+  NativeModule(const std::string &path, void *handle,
+               const CxxScriptNativeModule *module)
+      : _path(path), _handle(handle), _module(module) {}
+
+  std::string _path;
+  void *_handle;
+  const CxxScriptNativeModule *_module;
+};
+
+using NativeModulePtr = std::shared_ptr<NativeModule>;
+
+// A procedure implemented by a native module
+struct NativeProcedure {
+  NativeModulePtr module;
+  const CxxScriptNativeProcedure *procedure;
+};
+
+} // namespace Script
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "AST.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Script {
+
+// Simplifies resolved procedures before the type checker sees them:
+//  - operators and ?: whose operands are literals become a single literal,
+//    computed with the same ValueHelper operations the engines use; an
+//    operation that fails (1 / 0) is left to fail at runtime
+//  - a local declared with a literal of exactly its scalar type, and never
+//    assigned, is replaced by that literal wherever it is read
+//  - branches and loops behind constant conditions are removed, and so are
+//    statements after a return, break or continue in the same block
+//
+// Declarations that are not in a block of their own (`if (c) int32 x = 1;`)
+// declare into the enclosing scope, so the branches holding them are kept.
+class Optimizer {
+public:
+  void optimize(Script &script);
+  void optimize(ProcedureDecl &proc);
+
+private:
+  // Name lookup as the Resolver does it, from each name to its declaration
+  // (null for parameters)
+  using Scope = std::unordered_map<std::string, const VarDeclStmt *>;
+  std::vector<Scope> _scopes;
+  // Declarations some assignment writes to
+  std::unordered_set<const VarDeclStmt *> _assigned;
+  // Literal each constant declaration can be replaced with
+  std::unordered_map<const VarDeclStmt *, std::shared_ptr<LiteralExpr>>
+      _constants;
+
+  const VarDeclStmt *lookup(const std::string &name) const;
+  void collectAssignments(Statement *stmt);
+
+  // Returns the replacement, or null when the statement can be dropped
+  StmtPtr optimizeStatement(const StmtPtr &stmt, bool sequenced = false);
+  // For positions that need a statement: an empty block replaces null
+  StmtPtr optimizeBody(const StmtPtr &stmt);
+  ExprPtr fold(const ExprPtr &expr);
+  ExprPtr foldBinary(BinaryExpr *expr, const ExprPtr &original);
+  ExprPtr foldUnary(UnaryExpr *expr, const ExprPtr &original);
+};
+
+} // namespace Script
@@ -3,8 +3,10 @@
 #include "AST.h"
 #include "Lexer.h"
 #include "Token.h"
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace Script {
@@ -33,6 +35,8 @@ private:
   size_t _current;
   std::string _currentProcedure;
   std::vector<ParseError> _errors;
+  // Structs declared so far; a struct must be declared before its uses
+  std::unordered_map<std::string, std::shared_ptr<const StructType>> _structs;
 
   // Utility methods
   bool isAtEnd() const;
@@ -46,7 +50,18 @@ private:
   ParseError error(const std::string &message);
   void synchronize();
 
+  // True if the next tokens declare a variable of a struct type
+  bool checkStructDeclaration() const;
+
+  // map, struct and stringbuilder are identifiers except where they start
+  // a type or a struct declaration, so scripts may still name variables
+  // and procedures after them
+  bool checkWord(const char *word) const;
+  bool checkMapOrBuilderType() const;
+  bool checkStructKeyword() const;
+
   // Parsing methods
+  std::shared_ptr<const StructType> structDeclaration();
   ProcedureDeclPtr procedureDeclaration();
   std::vector<Parameter> parameters();
   TypeInfo parseType();
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "AST.h"
+#include <string>
+#include <unordered_set>
+
+namespace Script {
+
+class Interpreter;
+
+// What evaluating code can change and what it depends on, for the passes
+// that move or reuse expressions once types are known (LoopOptimizer,
+// SubexpressionEliminator).
+//
+// A pure expression changes nothing and gives the same value for the same
+// locals, but may fail: it is built from operators, ?:, element and field
+// reads, len and pure external calls over literals and locals.
+//
+// A safe expression changes nothing, cannot fail, and reads nothing but
+// literals and locals, so it gives the same value wherever it is evaluated
+// as long as those locals, and the maps, records and arrays it reads
+// through them, are not written in between:
+//  - operators whose operands have known scalar types and never fail on
+//    them (no division by anything but a non-zero literal, no arithmetic on
+//    strings other than concatenation)
+//  - `?:`, field reads of records, and len of an array or map
+// Array elements are not safe (the index can be out of bounds), and
+// neither are external variables (their getter runs on every read) or
+// calls to pure externals (nothing stops them throwing, starting with a
+// wrong argument count).
+class PurityModel {
+public:
+  // Which names reach what is decided against the interpreter's procedures
+  // and externals and those of the script being loaded
+  PurityModel(const Interpreter &interpreter, const Script &script);
+
+  // What a statement or expression may write
+  struct Writes {
+    std::unordered_set<int32_t> slots;
+    // Through a reference: a field assignment, a write to an external
+    // variable's array (changed in place), or a call that is not pure
+    bool references = false;
+    // Pure externals it calls, which write nothing only while they stay
+    // pure and are not shadowed by a procedure
+    std::unordered_set<std::string> pureExternals;
+  };
+
+  // What a pure expression reads
+  struct Reads {
+    std::unordered_set<int32_t> slots;
+    // Through a map or record, array contents (a local may share an
+    // external variable's array), or a value of unknown type passed to a
+    // call
+    bool references = false;
+  };
+
+  bool isPure(const Expression &expr) const;
+  bool isSafe(const Expression &expr) const;
+  // Calls that write nothing: builtins that only read their arguments and
+  // pure externals. Procedures are never pure.
+  bool isPureCall(const CallExpr &call) const;
+
+  void collectWrites(const Statement *stmt, Writes &writes) const;
+  void collectWrites(const Expression *expr, Writes &writes) const;
+  static void collectReads(const Expression &expr, Reads &reads);
+  // Whether a value read as reads changes where writes happen
+  static bool overlaps(const Reads &reads, const Writes &writes);
+
+  // The type of a pure expression's value (VOID when unknown), taking that
+  // of pure externals from their registration
+  TypeInfo resultType(const Expression &expr) const;
+
+private:
+  const Interpreter &_interpreter;
+  std::unordered_set<std::string> _scriptProcedures;
+
+  bool isProcedure(const std::string &name) const;
+  bool isPureExternal(const std::string &name) const;
+};
+
+} // namespace Script
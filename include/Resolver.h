@@ -0,0 +1,52 @@
+#pragma once
+
+#include "AST.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Script {
+
+// Assigns every parameter and local variable a fixed slot in its
+// procedure's frame. Parameters take slots 0..n-1 in declaration order;
+// locals follow, and slots are reused once their block ends. Names with no
+// lexical declaration keep slot -1 and are looked up as external variables.
+//
+// Field accesses on expressions of a known struct type (declared
+// variables, their elements and fields, records and procedure results) get
+// the field's index; naming a field the struct lacks is a ParseError.
+class Resolver {
+public:
+  void resolve(Script &script);
+  void resolve(ProcedureDecl &proc);
+
+private:
+  struct Scope {
+    std::unordered_map<std::string, int32_t> slots;
+    std::unordered_map<std::string, TypeInfo> types;
+    int32_t firstSlot;
+  };
+
+  std::vector<Scope> _scopes;
+  int32_t _nextSlot = 0;
+  uint32_t _frameSize = 0;
+  std::string _procedure;
+  // Return types of the script's procedures, for fields of call results
+  std::unordered_map<std::string, TypeInfo> _returnTypes;
+
+  void enterScope();
+  void exitScope();
+  int32_t declare(const std::string &name, const TypeInfo &type);
+  int32_t lookup(const std::string &name) const;
+  // Declared type of an expression, or VOID if unknown
+  TypeInfo staticType(Expression *expr) const;
+  void resolveField(Expression *object, const std::string &field,
+                    std::shared_ptr<const StructType> &structType,
+                    int32_t &index, const ASTNode &node) const;
+
+  void resolveStatement(Statement *stmt);
+  void resolveExpression(Expression *expr);
+};
+
+} // namespace Script
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "AST.h"
+#include "DataTypes.h"
+#include <cstdint>
+
+namespace Script {
+
+// Static typing of the scalar subset that is compiled to native code (the
+// JIT and cxxscript-aot). Types are int32, int64, double and bool; results
+// follow ValueHelper's promotion rules so native code matches the
+// interpreter bit for bit.
+class ScalarTypes {
+public:
+  // int32, int64, double or bool (not an array)
+  static bool isSupported(const TypeInfo &type);
+
+  // Result type of a binary operator, or VOID when the operands fall outside
+  // the subset native code reproduces (bool arithmetic, double modulo,
+  // bitwise operators on non-integers)
+  static DataType binaryResult(BinaryExpr::Operator op, DataType left,
+                               DataType right);
+
+  // Result type of a unary operator, or VOID when unsupported
+  static DataType unaryResult(UnaryExpr::Operator op, DataType operand);
+
+  // Type of a literal, or VOID when it is not a supported scalar
+  static DataType literalType(const Value &value);
+
+  // Scalars travel to native code as 64-bit cells: integers sign-extended,
+  // doubles as their bit pattern and bools as 0/1. toCell applies the same
+  // conversion as binding a parameter; it throws like the interpreter for
+  // strings and arrays.
+  static uint64_t toCell(const Value &value, DataType type);
+  static Value fromCell(uint64_t cell, DataType type);
+};
+
+} // namespace Script
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "AstPrinter.h"
 #include "Interpreter.h"
 #include "Lexer.h"
+#include "LoopOptimizer.h"
+#include "Optimizer.h"
 #include "Parser.h"
+#include "Resolver.h"
+#include "SubexpressionEliminator.h"
+#include "TypeChecker.h"
 #include <initializer_list>
 #include <memory>
+#include <ostream>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
@@ -46,6 +53,12 @@ public:
   bool checkScriptSource(const std::string &source, const std::string &filename,
                          std::vector<CompilationError> &errors);
 
+  // Load a shared object generated by cxxscript-aot and register its
+  // procedures under their script names. A procedure that is already loaded
+  // is replaced, provided the signatures match.
+  bool loadNativeModule(const std::string &path,
+                        std::vector<CompilationError> &errors);
+
   // Execute a procedure from any loaded script
   bool executeProcedure(const std::string &procedureName,
                         const std::vector<Value> &arguments, Value &returnValue,
@@ -67,9 +80,15 @@ public:
 
   bool getProcedureInfo(const std::string &name, ProcedureInfo &info) const;
 
-  // Register an external function that can be called from scripts
+  // Register an external function that can be called from scripts. A pure
+  // function (see ExternalBinding) may be called fewer times than the
+  // script calls it, once per loop instead of once per iteration; the
+  // optimizer only keeps its results in locals when returnType says what
+  // it returns.
   void registerExternalFunction(const std::string &name,
-                                ExternalFunctionCallback callback);
+                                ExternalFunctionCallback callback,
+                                bool pure = false,
+                                const TypeInfo &returnType = TypeInfo());
 
   // Register multiple external functions at once
   void registerExternalFunctions(const std::vector<ExternalBinding> &bindings);
@@ -93,14 +112,17 @@ public:
   void registerExternalVariableReadOnly(const std::string &name,
                                          ExternalVariableGetter getter);
 
-  // Typed helpers for common unary/binary external functions
+  // Typed helpers for common unary/binary external functions; a pure one
+  // is registered with its return type
   template <typename Ret, typename Arg>
   void registerExternalFunctionUnary(const std::string &name,
-                                     std::function<Ret(Arg)> fn);
+                                     std::function<Ret(Arg)> fn,
+                                     bool pure = false);
 
   template <typename Ret, typename Arg1, typename Arg2>
   void registerExternalFunctionBinary(const std::string &name,
-                                      std::function<Ret(Arg1, Arg2)> fn);
+                                      std::function<Ret(Arg1, Arg2)> fn,
+                                      bool pure = false);
 
   // Unregister an external variable
   void unregisterExternalVariable(const std::string &name);
@@ -108,6 +130,54 @@ public:
   // Check if an external variable is registered
   bool hasExternalVariable(const std::string &name) const;
 
+  // Select how procedures are executed. The initial engine is taken from the
+  // CXXSCRIPT_ENGINE environment variable ("tree", "bytecode" or "closure")
+  // when set.
+  void setExecutionEngine(ExecutionEngine engine);
+  ExecutionEngine getExecutionEngine() const;
+
+  // Compile eligible numeric procedures to native code on first call. Also
+  // enabled by setting CXXSCRIPT_JIT=1 in the environment.
+  void setJitEnabled(bool enabled);
+  bool isJitEnabled() const;
+
+  // Fuse common loop shapes (int32 counter compares and increments, local
+  // array indexing, comparison chains) into single tree-walker steps. On by
+  // default; applies to scripts loaded afterwards.
+  void setSuperoperatorsEnabled(bool enabled);
+  bool areSuperoperatorsEnabled() const;
+
+  // Evaluate calls to small procedures (a single returned expression) as a
+  // copy of the callee in the caller, for as long as the callee is not
+  // reloaded. On by default; applies to scripts loaded afterwards.
+  void setInliningEnabled(bool enabled);
+  bool isInliningEnabled() const;
+
+  // Report conversions and operators that fail for every value of the
+  // types the type checker infers (a string passed as an int32, string &
+  // int32, ...) as compilation errors instead of runtime errors. Off by
+  // default; applies to scripts loaded or checked afterwards.
+  void setStrictTypes(bool enabled);
+  bool areStrictTypesEnabled() const;
+
+  // Fold operators on literals, replace never-assigned locals initialized
+  // with a literal by that literal, remove branches, loops and statements
+  // that cannot run (see Optimizer.h), evaluate repeated expressions once
+  // (see SubexpressionEliminator.h) and loop-invariant ones once before the
+  // loop (see LoopOptimizer.h). On by default; applies to scripts loaded
+  // afterwards.
+  void setOptimizationsEnabled(bool enabled);
+  bool areOptimizationsEnabled() const;
+
+  // Print each script loaded afterwards, as the engines will run it, to
+  // out (null stops it). Also enabled for std::cerr by setting
+  // CXXSCRIPT_DUMP_AST=1 in the environment.
+  void setAstDump(std::ostream *out);
+
+  // Per-superoperator table of tagged sites, fused evaluations and the node
+  // evaluations they absorbed
+  std::string getSuperoperatorReport() const;
+
   // Clear all loaded scripts
   void clear();
 
@@ -115,6 +185,9 @@ private:
   std::unique_ptr<Interpreter> _interpreter;
   std::unordered_map<std::string, std::string>
       _procedureFiles; // procedure name -> filename
+  bool _strictTypes = false;
+  bool _optimize = true;
+  std::ostream *_astDump = nullptr;
 
   bool compileScript(const std::string &source, const std::string &filename,
                      std::vector<CompilationError> &errors, bool load);
@@ -143,6 +216,10 @@ template <> inline std::string fromValue<std::string>(const Value &v) {
   return ValueHelper::toString(v);
 }
 
+template <typename T> inline TypeInfo typeOf() {
+  return ValueHelper::getType(toValue(T()));
+}
+
 template <typename T> struct IsSupportedType : std::false_type {};
 template <> struct IsSupportedType<int32_t> : std::true_type {};
 template <> struct IsSupportedType<double> : std::true_type {};
@@ -153,7 +230,8 @@ template <> struct IsSupportedType<std::string> : std::true_type {};
 
 template <typename Ret, typename Arg>
 void ScriptManager::registerExternalFunctionUnary(const std::string &name,
-                                                  std::function<Ret(Arg)> fn) {
+                                                  std::function<Ret(Arg)> fn,
+                                                  bool pure) {
   static_assert(detail::IsSupportedType<Ret>::value, "Unsupported return type");
   static_assert(detail::IsSupportedType<Arg>::value, "Unsupported argument type");
 
@@ -165,12 +243,13 @@ void ScriptManager::registerExternalFunctionUnary(const std::string &name,
         Arg a = detail::fromValue<Arg>(args[0]);
         Ret r = fn(a);
         return detail::toValue(r);
-      });
+      },
+      pure, detail::typeOf<Ret>());
 }
 
 template <typename Ret, typename Arg1, typename Arg2>
 void ScriptManager::registerExternalFunctionBinary(
-    const std::string &name, std::function<Ret(Arg1, Arg2)> fn) {
+    const std::string &name, std::function<Ret(Arg1, Arg2)> fn, bool pure) {
   static_assert(detail::IsSupportedType<Ret>::value, "Unsupported return type");
   static_assert(detail::IsSupportedType<Arg1>::value,
                 "Unsupported first argument type");
@@ -186,7 +265,8 @@ void ScriptManager::registerExternalFunctionBinary(
         Arg2 a2 = detail::fromValue<Arg2>(args[1]);
         Ret r = fn(a1, a2);
         return detail::toValue(r);
-      });
+      },
+      pure, detail::typeOf<Ret>());
 }
 
 } // namespace Script
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Builtins.h"
+#include "DataTypes.h"
+#include <string>
+#include <vector>
+
+namespace Script {
+
+// Builtins over stringbuilder values, ranked like the array and map
+// builtins below procedures and external functions of the same name.
+//
+//   append(b, x...)  appends each x, as string concatenation would show it,
+//                    returning the builder's int32 length
+//   build(b)         string copy of everything appended so far
+//
+// Appending takes time proportional to the text appended, not to what the
+// builder already holds.
+class StringBuilderBuiltins {
+public:
+  static bool isBuiltin(const std::string &name);
+
+  // The builtin of that name, or null; the engines resolve it once per
+  // call site
+  static BuiltinFunction find(const std::string &name);
+
+  // Errors are thrown as std::runtime_error; the engines add the position
+  static Value call(const std::string &name, const std::vector<Value> &args);
+};
+
+} // namespace Script
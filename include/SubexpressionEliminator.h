@@ -0,0 +1,93 @@
+#pragma once
+
+#include "AST.h"
+#include "Purity.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Script {
+
+// Evaluates repeated expressions once per block, once the type checker has
+// annotated a procedure. Within the statements of each block, identical
+// pure expressions (see PurityModel) are computed into a new local declared
+// before the statement of the first one, and every copy reads that local:
+//
+//   if (strlen(email) < 3) { return false; }
+//   if (strlen(email) > 254) { return false; }
+//
+// runs as
+//
+//   int32 $2 = strlen(email);
+//   if ($2 < 3) { return false; }
+//   if ($2 > 254) { return false; }
+//
+// when strlen is registered as a pure external returning int32 (and until
+// it no longer is; see ProcedureDecl::generalBody). Only
+// expressions of known type are shared, since the local needs one: not
+// array elements, and not calls to pure externals registered without a
+// return type. Copies are shared only
+// while nothing that runs between the first and the last writes a local
+// they read (or a map, record or array, if they read through one: a local
+// array may share an external variable's array, which scripts change in
+// place). Copies inside
+// nested statements of the block (branches, loop bodies) are shared too.
+//
+// The first copy moves to before its statement, so an expression that may
+// fail (an element read, a division by a local) is only shared when its
+// first copy would be evaluated first anyway: unconditionally, at the start
+// of the statement's own expression, after nothing but safe ones. Safe
+// expressions may be shared from anywhere. The largest shared expressions
+// are chosen first.
+class SubexpressionEliminator {
+public:
+  explicit SubexpressionEliminator(const PurityModel &purity)
+      : _purity(purity) {}
+
+  void optimize(Script &script);
+  void optimize(ProcedureDecl &proc);
+
+private:
+  // Where a candidate expression appears in a block
+  struct Occurrence {
+    ExprPtr *site;
+    size_t statement; // index in the block
+    bool nested;      // inside a statement of that statement
+    bool leading;     // evaluated first, unconditionally (see above)
+  };
+  struct Candidate {
+    std::string key;
+    size_t size;
+    std::vector<Occurrence> occurrences;
+  };
+
+  const PurityModel &_purity;
+  ProcedureDecl *_procedure = nullptr;
+  // Candidates of the block being searched, in the order first seen
+  std::vector<Candidate> _candidates;
+  std::unordered_map<std::string, size_t> _candidateIndex;
+
+  void visitStatement(Statement *stmt);
+  // Share one expression of block; false when none can be shared
+  bool shareOne(BlockStmt &block);
+  void collectStatement(Statement *stmt, size_t index, bool nested);
+  size_t collectExpression(ExprPtr &expr, size_t index, bool nested,
+                           bool leading);
+  // The array an index assignment, push or pop changes: only the indices
+  // and the record it is a field of may be shared
+  size_t collectTarget(ExprPtr &target, size_t index);
+  // The occurrences, from the first, that can share one local
+  std::vector<Occurrence> shareable(const BlockStmt &block,
+                                    const std::vector<Occurrence> &all,
+                                    size_t first) const;
+  // What stmt writes before an occurrence in it is evaluated: all of it,
+  // or only its first expression
+  void collectWrites(Statement *stmt, bool whole,
+                     PurityModel::Writes &writes) const;
+
+  // Text equal for expressions that compute the same value from the same
+  // locals, or empty if expr is not pure
+  std::string key(const Expression &expr) const;
+};
+
+} // namespace Script
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "AST.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace Script {
+
+constexpr size_t SUPEROP_COUNT = static_cast<size_t>(Superop::COUNT);
+
+// What one superoperator did during a run
+struct SuperoperatorCounter {
+  uint32_t sites = 0;    // nodes tagged when procedures were loaded
+  uint64_t hits = 0;     // evaluations that took the fused path
+  uint64_t absorbed = 0; // node evaluations those hits replaced
+};
+
+// Tags the superoperator shapes in a resolved procedure:
+//
+//   LOCAL_COMPARE      a comparison of a local with a local or a literal
+//   LOCAL_ADD_LITERAL  a local incremented or decremented by an int32 literal
+//   LOCAL_INDEX        a local array indexed by a local
+//   COMPARE_CHAIN      `&&` chains whose operands are all comparisons
+//
+// The interpreter takes the fused path when the operands have the expected
+// runtime types (int32 counters, arrays) and the generic one otherwise, so
+// tagging never changes results.
+class SuperoperatorPass {
+public:
+  void run(ProcedureDecl &proc);
+
+  // Sites tagged so far, per superoperator
+  const std::array<uint32_t, SUPEROP_COUNT> &sites() const { return _sites; }
+
+  static const char *name(Superop op);
+  static bool isComparison(BinaryExpr::Operator op);
+
+private:
+  std::array<uint32_t, SUPEROP_COUNT> _sites{};
+
+  void tag(ASTNode *node, Superop op);
+  void visitStatement(Statement *stmt);
+  void visitExpression(Expression *expr);
+  void visitChain(BinaryExpr *bin);
+  bool isCompareChain(Expression *expr) const;
+};
+
+} // namespace Script
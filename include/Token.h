@@ -85,6 +85,7 @@ enum class TokenType {
     COMMA,          // ,
     COLON,          // :
     QUESTION,       // ?
+    DOT,            // .
     
     // Special
     END_OF_FILE,
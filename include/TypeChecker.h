@@ -0,0 +1,74 @@
+#pragma once
+
+#include "AST.h"
+#include "Parser.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Script {
+
+// Runs after the Resolver and gives every expression its static type
+// (Expression::staticType, VOID when unknown: external variables and
+// functions, builtins, array elements, ...).
+//
+// A local only keeps its declared type while every assignment to it stores
+// a value of exactly that type: `int32 x = 0; x = 2.5;` leaves a double in
+// x, so reads of x are unknown. Where a value is known to already have the
+// scalar or record type it is bound as, the engines skip convertToType (see
+// VarDeclStmt::initializerTyped, ProcedureDecl::returnsTyped and
+// CallExpr::argumentsTyped). A procedure loaded later under a called name
+// can return another type, so they still compare the value's alternative
+// against the type (ValueHelper::needsConversion) before skipping.
+//
+// Conversions and operators that can only fail for the known types (a
+// string passed as an int32, string & int32, ...) are collected in
+// errors(); ScriptManager reports them when strict type checking is on.
+class TypeChecker {
+public:
+  void check(Script &script);
+  void check(ProcedureDecl &proc);
+
+  const std::vector<ParseError> &errors() const { return _errors; }
+
+  // Values of these types are bound without conversion once known to match
+  static bool trusted(const TypeInfo &type);
+
+private:
+  struct Variable {
+    TypeInfo type;
+    // Every store so far keeps the declared type
+    bool stable;
+  };
+
+  // The script's procedures, for calls that cannot resolve elsewhere
+  std::unordered_map<std::string, ProcedureDeclPtr> _procedures;
+  // Declarations of the current procedure, numbered in source order; the
+  // procedure is checked again until no local loses its declared type
+  std::vector<Variable> _variables;
+  size_t _nextVariable = 0;
+  std::vector<std::unordered_map<std::string, size_t>> _scopes;
+  const ProcedureDecl *_procedure = nullptr;
+  bool _changed = false;
+  bool _returnsTyped = false;
+  std::vector<ParseError> _procedureErrors;
+  std::vector<ParseError> _errors;
+
+  void declare(const std::string &name, const TypeInfo &type, bool stable);
+  Variable *lookup(const std::string &name);
+  void assigned(Variable &variable, const TypeInfo &stored);
+  void report(const std::string &message, const ASTNode &node);
+  void expectConvertible(const TypeInfo &from, const TypeInfo &to,
+                         const ASTNode &node);
+  TypeInfo binaryType(BinaryExpr::Operator op, const TypeInfo &left,
+                      const TypeInfo &right, const ASTNode &node);
+
+  // sequenced: a direct child of a block, so the declaration it may be
+  // runs before anything that reads the name
+  void checkStatement(Statement *stmt, bool sequenced = false);
+  TypeInfo checkExpression(Expression *expr);
+  TypeInfo checkUnary(UnaryExpr *expr);
+  TypeInfo checkCall(CallExpr *expr);
+};
+
+} // namespace Script
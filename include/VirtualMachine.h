@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "CompactValue.h"
+#include "DataTypes.h"
+#include <vector>
+
+namespace Script {
+
+class Interpreter;
+
+// Executes procedures lowered by BytecodeCompiler. Procedure, external
+// function and external variable lookups go through the owning
+// interpreter, so both engines see the same registrations.
+class VirtualMachine {
+public:
+  explicit VirtualMachine(Interpreter &interpreter)
+      : _interpreter(interpreter) {}
+
+  Value execute(const ProcedureDecl &proc, BytecodeProcedure &code,
+                const std::vector<CompactValue> &arguments,
+                bool argumentsTyped = false);
+
+private:
+  Interpreter &_interpreter;
+
+  // Moves the arguments out of their registers, so an array passed along
+  // is not left shared with a dead temporary
+  Value call(CallSite &site, CompactValue *arguments,
+             const SourcePosition &position);
+  // Refresh site's cached target if registrations changed since
+  void resolve(CallSite &site);
+};
+
+} // namespace Script
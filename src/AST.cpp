@@ -0,0 +1,47 @@
+#include "AST.h"
+
+namespace Script {
+
+Value BinaryExpr::apply(Operator op, const Value &left, const Value &right) {
+  switch (op) {
+  case Operator::ADD:
+    return ValueHelper::add(left, right);
+  case Operator::SUBTRACT:
+    return ValueHelper::subtract(left, right);
+  case Operator::MULTIPLY:
+    return ValueHelper::multiply(left, right);
+  case Operator::DIVIDE:
+    return ValueHelper::divide(left, right);
+  case Operator::MODULO:
+    return ValueHelper::modulo(left, right);
+  case Operator::EQUAL:
+    return ValueHelper::equals(left, right);
+  case Operator::NOT_EQUAL:
+    return ValueHelper::notEquals(left, right);
+  case Operator::LESS_THAN:
+    return ValueHelper::lessThan(left, right);
+  case Operator::GREATER_THAN:
+    return ValueHelper::greaterThan(left, right);
+  case Operator::LESS_EQUAL:
+    return ValueHelper::lessOrEqual(left, right);
+  case Operator::GREATER_EQUAL:
+    return ValueHelper::greaterOrEqual(left, right);
+  case Operator::LOGICAL_AND:
+    return ValueHelper::logicalAnd(left, right);
+  case Operator::LOGICAL_OR:
+    return ValueHelper::logicalOr(left, right);
+  case Operator::BIT_AND:
+    return ValueHelper::bitAnd(left, right);
+  case Operator::BIT_OR:
+    return ValueHelper::bitOr(left, right);
+  case Operator::BIT_XOR:
+    return ValueHelper::bitXor(left, right);
+  case Operator::LSHIFT:
+    return ValueHelper::lshift(left, right);
+  case Operator::RSHIFT:
+    return ValueHelper::rshift(left, right);
+  }
+  throw std::runtime_error("Unknown binary operator");
+}
+
+} // namespace Script
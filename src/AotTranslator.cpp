@@ -0,0 +1,1002 @@
+#include "AotTranslator.h"
+#include "ScalarTypes.h"
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Script {
+
+namespace {
+
+// Thrown while translating a construct native modules do not handle
+struct Declined {
+  std::string reason;
+};
+
+[[noreturn]] void decline(const std::string &reason) { throw Declined{reason}; }
+
+// Helpers every module starts with. Integer arithmetic goes through
+// uint64_t so overflow wraps like the interpreter, and shift counts are
+// masked the way x86 masks them.
+const char *const PRELUDE = R"(#include "NativeModule.h"
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+struct ScriptError {
+  const char *message;
+  int32_t line;
+  int32_t column;
+};
+
+inline int64_t rt_add(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) +
+                              static_cast<uint64_t>(b));
+}
+
+inline int64_t rt_sub(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) -
+                              static_cast<uint64_t>(b));
+}
+
+inline int64_t rt_mul(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) *
+                              static_cast<uint64_t>(b));
+}
+
+inline int64_t rt_div(int64_t a, int64_t b) {
+  if (b == 0) {
+    throw ScriptError{"Division by zero", -1, -1};
+  }
+  return b == -1 ? rt_sub(0, a) : a / b;
+}
+
+inline int64_t rt_mod(int64_t a, int64_t b) {
+  if (b == 0) {
+    throw ScriptError{"Modulo by zero", -1, -1};
+  }
+  return b == -1 ? 0 : a % b;
+}
+
+inline double rt_fdiv(double a, double b) {
+  if (b == 0.0) {
+    throw ScriptError{"Division by zero", -1, -1};
+  }
+  return a / b;
+}
+
+inline int64_t rt_shl(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) << (b & 63));
+}
+
+inline int64_t rt_shr(int64_t a, int64_t b) { return a >> (b & 63); }
+
+inline int32_t rt_narrow(int64_t v) { return static_cast<int32_t>(v); }
+
+inline double rt_double(uint64_t bits) {
+  double d;
+  std::memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+template <typename T> T rt_arg(uint64_t cell);
+template <> inline int32_t rt_arg<int32_t>(uint64_t cell) {
+  return static_cast<int32_t>(cell);
+}
+template <> inline int64_t rt_arg<int64_t>(uint64_t cell) {
+  return static_cast<int64_t>(cell);
+}
+template <> inline double rt_arg<double>(uint64_t cell) {
+  return rt_double(cell);
+}
+template <> inline bool rt_arg<bool>(uint64_t cell) { return cell != 0; }
+
+inline uint64_t rt_cell(int32_t v) {
+  return static_cast<uint64_t>(static_cast<int64_t>(v));
+}
+inline uint64_t rt_cell(int64_t v) { return static_cast<uint64_t>(v); }
+inline uint64_t rt_cell(double v) {
+  uint64_t cell;
+  std::memcpy(&cell, &v, sizeof(cell));
+  return cell;
+}
+inline uint64_t rt_cell(bool v) { return v ? 1 : 0; }
+
+inline int rt_fail(const ScriptError &e, CxxScriptNativeError *error) {
+  error->message = e.message;
+  error->line = e.line;
+  error->column = e.column;
+  return 1;
+}
+
+} // namespace
+)";
+
+const char *cppType(DataType type) {
+  switch (type) {
+  case DataType::INT32:
+    return "int32_t";
+  case DataType::INT64:
+    return "int64_t";
+  case DataType::DOUBLE:
+    return "double";
+  case DataType::BOOL:
+    return "bool";
+  default:
+    break;
+  }
+  return "void";
+}
+
+std::string functionName(const std::string &proc) { return "proc_" + proc; }
+
+DataType scalarType(const TypeInfo &type, const std::string &what) {
+  if (ScalarTypes::isSupported(type)) {
+    return type.baseType;
+  }
+  decline(what + " of type " + ValueHelper::typeToString(type));
+}
+
+bool isVoid(const TypeInfo &type) {
+  return type.baseType == DataType::VOID && !type.isArray;
+}
+
+// An evaluated expression: a C++ expression that is cheap to repeat
+// (a literal, a local or a temporary) and its script type
+struct Operand {
+  std::string text;
+  DataType type;
+  bool temporary;
+};
+
+// Translates one procedure. Like the JIT, every local keeps one type for
+// the whole procedure, so locals are declared once at the top and
+// statements only assign them.
+class FunctionGen {
+public:
+  FunctionGen(const ProcedureDecl &proc,
+              const std::unordered_map<std::string, const ProcedureDecl *>
+                  &callable)
+      : _proc(proc), _callable(callable),
+        _slotTypes(proc.frameSize, DataType::VOID),
+        _slotNames(proc.frameSize) {}
+
+  // Returns the C++ definition of the procedure
+  std::string run() {
+    std::ostringstream params;
+    for (size_t i = 0; i < _proc.parameters.size(); ++i) {
+      const Parameter &param = _proc.parameters[i];
+      _slotTypes[i] = scalarType(param.type, "parameter '" + param.name + "'");
+      _slotNames[i] = param.name;
+      params << (i ? ", " : "") << "[[maybe_unused]] "
+             << cppType(_slotTypes[i]) << " s" << i;
+    }
+
+    _isVoid = isVoid(_proc.returnType);
+    if (!_isVoid) {
+      _returnType = scalarType(_proc.returnType, "return value");
+    }
+
+    _indent = 1;
+    emitStatement(_proc.body.get());
+    if (!_isVoid) {
+      line("throw ScriptError{\"Non-void procedure must return a value\", " +
+           std::to_string(_proc.line) + ", " + std::to_string(_proc.column) +
+           "};");
+    }
+
+    std::ostringstream out;
+    out << (_isVoid ? "void" : cppType(_returnType)) << " "
+        << functionName(_proc.name) << "(" << params.str() << ") {\n";
+    for (size_t i = _proc.parameters.size(); i < _slotTypes.size(); ++i) {
+      if (_slotTypes[i] != DataType::VOID) {
+        out << "  [[maybe_unused]] " << cppType(_slotTypes[i]) << " s" << i
+            << " = 0; // " << _slotNames[i] << "\n";
+      }
+    }
+    out << _body << "}\n";
+    return out.str();
+  }
+
+private:
+  struct Target {
+    bool isSwitch;
+    int id;              // switch id, or loop id for continue labels
+    bool continueByJump; // continue needs `goto continue_<id>`
+    bool *continueUsed;
+    bool *breakUsed;
+  };
+
+  const ProcedureDecl &_proc;
+  const std::unordered_map<std::string, const ProcedureDecl *> &_callable;
+  std::vector<DataType> _slotTypes;
+  std::vector<std::string> _slotNames;
+  std::vector<Target> _targets;
+  std::string _body;
+  int _indent = 0;
+  int _temporaries = 0;
+  int _labels = 0;
+  bool _isVoid = true;
+  DataType _returnType = DataType::VOID;
+
+  void line(const std::string &text) {
+    _body.append(static_cast<size_t>(_indent) * 2, ' ');
+    _body += text;
+    _body += '\n';
+  }
+
+  void open(const std::string &text) {
+    line(text);
+    ++_indent;
+  }
+
+  void close(const std::string &text = "}") {
+    --_indent;
+    line(text);
+  }
+
+  Operand temporary(DataType type, const std::string &value) {
+    std::string name = "t" + std::to_string(_temporaries++);
+    line("const " + std::string(cppType(type)) + " " + name + " = " + value +
+         ";");
+    return {name, type, true};
+  }
+
+  // --- Conversions (same results as ValueHelper) ---
+
+  static std::string asInt64(const Operand &o) {
+    return o.type == DataType::INT64 ? o.text
+                                     : "static_cast<int64_t>(" + o.text + ")";
+  }
+
+  static std::string asDouble(const Operand &o) {
+    return o.type == DataType::DOUBLE ? o.text
+                                      : "static_cast<double>(" + o.text + ")";
+  }
+
+  static std::string asBool(const Operand &o) {
+    switch (o.type) {
+    case DataType::BOOL:
+      return o.text;
+    case DataType::DOUBLE:
+      return "(" + o.text + " != 0.0)"; // NaN is truthy
+    default:
+      return "(" + o.text + " != 0)";
+    }
+  }
+
+  // Same result as Interpreter::convertToType between supported scalars
+  static std::string convert(const Operand &o, DataType to) {
+    if (o.type == to) {
+      return o.text;
+    }
+    switch (to) {
+    case DataType::INT32:
+      return "static_cast<int32_t>(" + asInt64(o) + ")";
+    case DataType::INT64:
+      return asInt64(o);
+    case DataType::DOUBLE:
+      return asDouble(o);
+    case DataType::BOOL:
+      return asBool(o);
+    default:
+      break;
+    }
+    decline("unsupported conversion");
+  }
+
+  // --- Expressions ---
+
+  static std::string literalText(const Value &value, DataType type) {
+    switch (type) {
+    case DataType::INT32: {
+      int32_t v = std::get<int32_t>(value);
+      return v < 0 ? "static_cast<int32_t>(" + std::to_string(v) + "LL)"
+                   : std::to_string(v);
+    }
+    case DataType::INT64: {
+      int64_t v = std::get<int64_t>(value);
+      return v == INT64_MIN ? "INT64_MIN"
+                            : "INT64_C(" + std::to_string(v) + ")";
+    }
+    case DataType::DOUBLE: {
+      double d = std::get<double>(value);
+      if (!std::isfinite(d)) {
+        return "rt_double(" + std::to_string(ScalarTypes::toCell(value, type)) +
+               "ULL)";
+      }
+      char buffer[40];
+      std::snprintf(buffer, sizeof(buffer), "%.17g", d);
+      std::string text(buffer);
+      if (text.find_first_of(".en") == std::string::npos) {
+        text += ".0";
+      }
+      return text;
+    }
+    default:
+      return std::get<bool>(value) ? "true" : "false";
+    }
+  }
+
+  DataType localType(int32_t slot, const std::string &name) {
+    if (slot < 0) {
+      decline("external variable '" + name + "'");
+    }
+    DataType type = _slotTypes[slot];
+    if (type == DataType::VOID) {
+      decline("local used before its declaration");
+    }
+    return type;
+  }
+
+  Operand emitExpression(Expression *expr) {
+    switch (expr->kind) {
+    case NodeKind::LITERAL: {
+      const Value &value = static_cast<LiteralExpr *>(expr)->value;
+      DataType type = ScalarTypes::literalType(value);
+      if (type == DataType::VOID) {
+        decline("literal of type " +
+                ValueHelper::typeToString(ValueHelper::getType(value)));
+      }
+      return {literalText(value, type), type, false};
+    }
+    case NodeKind::VARIABLE: {
+      auto *var = static_cast<VariableExpr *>(expr);
+      DataType type = localType(var->slot, var->name);
+      return {"s" + std::to_string(var->slot), type, false};
+    }
+    case NodeKind::BINARY:
+      return emitBinary(static_cast<BinaryExpr *>(expr));
+    case NodeKind::UNARY:
+      return emitUnary(static_cast<UnaryExpr *>(expr));
+    case NodeKind::CONDITIONAL:
+      return emitConditional(static_cast<ConditionalExpr *>(expr));
+    case NodeKind::CALL:
+      return emitCall(static_cast<CallExpr *>(expr));
+    case NodeKind::ARRAY_LITERAL:
+    case NodeKind::INDEX:
+      decline("array access");
+    default:
+      break;
+    }
+    decline("unsupported expression");
+  }
+
+  Operand emitBinary(BinaryExpr *expr) {
+    if (expr->op == BinaryExpr::Operator::LOGICAL_AND ||
+        expr->op == BinaryExpr::Operator::LOGICAL_OR) {
+      bool isAnd = expr->op == BinaryExpr::Operator::LOGICAL_AND;
+      std::string name = "t" + std::to_string(_temporaries++);
+
+      Operand left = emitExpression(expr->left.get());
+      line("bool " + name + " = " + asBool(left) + ";");
+      open(isAnd ? "if (" + name + ") {" : "if (!" + name + ") {");
+      Operand right = emitExpression(expr->right.get());
+      line(name + " = " + asBool(right) + ";");
+      close();
+      return {name, DataType::BOOL, true};
+    }
+
+    Operand left = emitExpression(expr->left.get());
+    Operand right = emitExpression(expr->right.get());
+    DataType result = DataType::VOID;
+    std::string text = binaryText(expr->op, left, right, result);
+    return temporary(result, text);
+  }
+
+  // C++ for `left op right` following ScalarTypes::binaryResult
+  std::string binaryText(BinaryExpr::Operator op, const Operand &left,
+                         const Operand &right, DataType &result) {
+    result = ScalarTypes::binaryResult(op, left.type, right.type);
+    bool anyDouble =
+        left.type == DataType::DOUBLE || right.type == DataType::DOUBLE;
+
+    switch (op) {
+    case BinaryExpr::Operator::ADD:
+    case BinaryExpr::Operator::SUBTRACT:
+    case BinaryExpr::Operator::MULTIPLY:
+    case BinaryExpr::Operator::DIVIDE:
+    case BinaryExpr::Operator::MODULO: {
+      if (result == DataType::VOID) {
+        decline(anyDouble ? "modulo on double" : "arithmetic on bool");
+      }
+      if (result == DataType::DOUBLE) {
+        std::string l = asDouble(left);
+        std::string r = asDouble(right);
+        switch (op) {
+        case BinaryExpr::Operator::ADD:
+          return l + " + " + r;
+        case BinaryExpr::Operator::SUBTRACT:
+          return l + " - " + r;
+        case BinaryExpr::Operator::MULTIPLY:
+          return l + " * " + r;
+        default:
+          return "rt_fdiv(" + l + ", " + r + ")";
+        }
+      }
+
+      const char *helper = "rt_add";
+      switch (op) {
+      case BinaryExpr::Operator::SUBTRACT:
+        helper = "rt_sub";
+        break;
+      case BinaryExpr::Operator::MULTIPLY:
+        helper = "rt_mul";
+        break;
+      case BinaryExpr::Operator::DIVIDE:
+        helper = "rt_div";
+        break;
+      case BinaryExpr::Operator::MODULO:
+        helper = "rt_mod";
+        break;
+      default:
+        break;
+      }
+      std::string call =
+          std::string(helper) + "(" + left.text + ", " + right.text + ")";
+      return result == DataType::INT32 ? "rt_narrow(" + call + ")" : call;
+    }
+
+    case BinaryExpr::Operator::EQUAL:
+    case BinaryExpr::Operator::NOT_EQUAL:
+    case BinaryExpr::Operator::LESS_THAN:
+    case BinaryExpr::Operator::GREATER_THAN:
+    case BinaryExpr::Operator::LESS_EQUAL:
+    case BinaryExpr::Operator::GREATER_EQUAL: {
+      bool equality = op == BinaryExpr::Operator::EQUAL ||
+                      op == BinaryExpr::Operator::NOT_EQUAL;
+      const char *symbol = "==";
+      switch (op) {
+      case BinaryExpr::Operator::NOT_EQUAL:
+        symbol = "!=";
+        break;
+      case BinaryExpr::Operator::LESS_THAN:
+        symbol = "<";
+        break;
+      case BinaryExpr::Operator::GREATER_THAN:
+        symbol = ">";
+        break;
+      case BinaryExpr::Operator::LESS_EQUAL:
+        symbol = "<=";
+        break;
+      case BinaryExpr::Operator::GREATER_EQUAL:
+        symbol = ">=";
+        break;
+      default:
+        break;
+      }
+      if (anyDouble) {
+        return asDouble(left) + " " + symbol + " " + asDouble(right);
+      }
+      if (equality &&
+          (left.type == DataType::BOOL) != (right.type == DataType::BOOL)) {
+        // A bool never equals a number
+        return op == BinaryExpr::Operator::EQUAL ? "false" : "true";
+      }
+      return asInt64(left) + " " + symbol + " " + asInt64(right);
+    }
+
+    case BinaryExpr::Operator::BIT_AND:
+    case BinaryExpr::Operator::BIT_OR:
+    case BinaryExpr::Operator::BIT_XOR:
+    case BinaryExpr::Operator::LSHIFT:
+    case BinaryExpr::Operator::RSHIFT: {
+      if (result == DataType::VOID) {
+        decline("bitwise operator on non-integers");
+      }
+      std::string l = asInt64(left);
+      std::string r = asInt64(right);
+      switch (op) {
+      case BinaryExpr::Operator::BIT_AND:
+        return l + " & " + r;
+      case BinaryExpr::Operator::BIT_OR:
+        return l + " | " + r;
+      case BinaryExpr::Operator::BIT_XOR:
+        return l + " ^ " + r;
+      case BinaryExpr::Operator::LSHIFT:
+        return "rt_shl(" + l + ", " + r + ")";
+      default:
+        return "rt_shr(" + l + ", " + r + ")";
+      }
+    }
+
+    case BinaryExpr::Operator::LOGICAL_AND:
+    case BinaryExpr::Operator::LOGICAL_OR:
+      break;
+    }
+    decline("unsupported binary operator");
+  }
+
+  Operand emitUnary(UnaryExpr *expr) {
+    Operand operand = emitExpression(expr->operand.get());
+    DataType result = ScalarTypes::unaryResult(expr->op, operand.type);
+
+    switch (expr->op) {
+    case UnaryExpr::Operator::NEGATE:
+      if (result == DataType::DOUBLE) {
+        return temporary(result, "-(" + operand.text + ")");
+      }
+      return temporary(result,
+                       "rt_narrow(rt_sub(0, " + asInt64(operand) + "))");
+    case UnaryExpr::Operator::LOGICAL_NOT:
+      return temporary(result, "!" + asBool(operand));
+    case UnaryExpr::Operator::BIT_NOT:
+      if (result == DataType::VOID) {
+        decline("bitwise operator on non-integers");
+      }
+      return temporary(result, "~" + asInt64(operand));
+    }
+    decline("unsupported unary operator");
+  }
+
+  Operand emitConditional(ConditionalExpr *expr) {
+    std::string name = "t" + std::to_string(_temporaries++);
+    size_t declaration = _body.size();
+    line(""); // filled in once the branch type is known
+
+    Operand condition = emitExpression(expr->condition.get());
+    open("if (" + asBool(condition) + ") {");
+    Operand thenValue = emitExpression(expr->thenExpr.get());
+    line(name + " = " + thenValue.text + ";");
+    close("} else {");
+    ++_indent;
+    Operand elseValue = emitExpression(expr->elseExpr.get());
+    line(name + " = " + elseValue.text + ";");
+    close();
+
+    if (thenValue.type != elseValue.type) {
+      decline("conditional branches of different types");
+    }
+    std::string indent(static_cast<size_t>(_indent) * 2, ' ');
+    _body.insert(declaration + indent.size(),
+                 std::string(cppType(thenValue.type)) + " " + name + "{};");
+    return {name, thenValue.type, true};
+  }
+
+  Operand emitCall(CallExpr *expr) {
+    auto it = _callable.find(expr->functionName);
+    if (expr->functionName == "len" || expr->functionName == "push" ||
+        expr->functionName == "pop" || it == _callable.end()) {
+      decline("call to '" + expr->functionName + "'");
+    }
+    const ProcedureDecl &callee = *it->second;
+    if (callee.parameters.size() != expr->arguments.size()) {
+      decline("call to '" + expr->functionName +
+              "' with the wrong number of arguments");
+    }
+
+    std::string args;
+    for (size_t i = 0; i < expr->arguments.size(); ++i) {
+      Operand arg = emitExpression(expr->arguments[i].get());
+      DataType type = callee.parameters[i].type.baseType;
+      args += (i ? ", " : "") + convert(arg, type);
+    }
+
+    std::string call = functionName(callee.name) + "(" + args + ")";
+    if (isVoid(callee.returnType)) {
+      line(call + ";");
+      return {"0", DataType::INT32, false}; // Dummy value
+    }
+    return temporary(callee.returnType.baseType, call);
+  }
+
+  // --- Statements ---
+
+  void emitStatement(Statement *stmt) {
+    switch (stmt->kind) {
+    case NodeKind::EXPRESSION_STMT: {
+      open("{");
+      Operand value =
+          emitExpression(static_cast<ExpressionStmt *>(stmt)->expression.get());
+      if (value.temporary) {
+        line("(void)" + value.text + ";");
+      }
+      close();
+      return;
+    }
+    case NodeKind::VAR_DECL:
+      emitVarDecl(static_cast<VarDeclStmt *>(stmt));
+      return;
+    case NodeKind::ASSIGN:
+      emitAssign(static_cast<AssignStmt *>(stmt));
+      return;
+    case NodeKind::BLOCK:
+      open("{");
+      for (auto &statement : static_cast<BlockStmt *>(stmt)->statements) {
+        emitStatement(statement.get());
+      }
+      close();
+      return;
+    case NodeKind::IF:
+      emitIf(static_cast<IfStmt *>(stmt));
+      return;
+    case NodeKind::WHILE:
+      emitLoop(static_cast<WhileStmt *>(stmt)->condition.get(), nullptr,
+               static_cast<WhileStmt *>(stmt)->body.get(), false);
+      return;
+    case NodeKind::FOR: {
+      auto *loop = static_cast<ForStmt *>(stmt);
+      open("{");
+      if (loop->initializer) {
+        emitStatement(loop->initializer.get());
+      }
+      emitLoop(loop->condition.get(), loop->increment.get(), loop->body.get(),
+               false);
+      close();
+      return;
+    }
+    case NodeKind::DO_WHILE:
+      emitLoop(static_cast<DoWhileStmt *>(stmt)->condition.get(), nullptr,
+               static_cast<DoWhileStmt *>(stmt)->body.get(), true);
+      return;
+    case NodeKind::SWITCH:
+      emitSwitch(static_cast<SwitchStmt *>(stmt));
+      return;
+    case NodeKind::RETURN:
+      emitReturn(static_cast<ReturnStmt *>(stmt));
+      return;
+    case NodeKind::BREAK:
+      if (_targets.empty()) {
+        decline("'break' outside of a loop or switch");
+      }
+      if (_targets.back().isSwitch) {
+        *_targets.back().breakUsed = true;
+        line("goto switch_" + std::to_string(_targets.back().id) + "_end;");
+      } else {
+        line("break;");
+      }
+      return;
+    case NodeKind::CONTINUE:
+      emitContinue();
+      return;
+    case NodeKind::INDEX_ASSIGN:
+      decline("array element assignment");
+    default:
+      break;
+    }
+    decline("unsupported statement");
+  }
+
+  void emitVarDecl(VarDeclStmt *stmt) {
+    DataType type = scalarType(stmt->type, "local '" + stmt->name + "'");
+    DataType &slotType = _slotTypes[stmt->slot];
+    if (slotType != DataType::VOID && slotType != type) {
+      decline("frame slot reused with a different type");
+    }
+
+    std::string slot = "s" + std::to_string(stmt->slot);
+    if (stmt->initializer) {
+      open("{");
+      Operand value = emitExpression(stmt->initializer.get());
+      line(slot + " = " + convert(value, type) + ";");
+      close();
+    } else {
+      line(slot + " = 0;");
+    }
+    slotType = type;
+    if (_slotNames[stmt->slot].empty()) {
+      _slotNames[stmt->slot] = stmt->name;
+    }
+  }
+
+  void emitAssign(AssignStmt *stmt) {
+    DataType target = localType(stmt->slot, stmt->variableName);
+    Operand current{"s" + std::to_string(stmt->slot), target, false};
+
+    open("{");
+    Operand value = emitExpression(stmt->value.get());
+    if (stmt->op == AssignStmt::Operator::ASSIGN) {
+      if (value.type != target) {
+        decline("assignment changes the type of '" + stmt->variableName +
+                "'");
+      }
+      line(current.text + " = " + value.text + ";");
+      close();
+      return;
+    }
+
+    BinaryExpr::Operator op = BinaryExpr::Operator::ADD;
+    switch (stmt->op) {
+    case AssignStmt::Operator::ASSIGN:
+    case AssignStmt::Operator::PLUS_ASSIGN:
+      op = BinaryExpr::Operator::ADD;
+      break;
+    case AssignStmt::Operator::MINUS_ASSIGN:
+      op = BinaryExpr::Operator::SUBTRACT;
+      break;
+    case AssignStmt::Operator::MULT_ASSIGN:
+      op = BinaryExpr::Operator::MULTIPLY;
+      break;
+    case AssignStmt::Operator::DIV_ASSIGN:
+      op = BinaryExpr::Operator::DIVIDE;
+      break;
+    }
+
+    DataType result = DataType::VOID;
+    std::string text = binaryText(op, current, value, result);
+    if (result != target) {
+      decline("compound assignment changes the type of '" +
+              stmt->variableName + "'");
+    }
+    line(current.text + " = " + text + ";");
+    close();
+  }
+
+  void emitIf(IfStmt *stmt) {
+    open("{");
+    Operand condition = emitExpression(stmt->condition.get());
+    open("if (" + asBool(condition) + ") {");
+    emitStatement(stmt->thenBranch.get());
+    if (stmt->elseBranch) {
+      close("} else {");
+      ++_indent;
+      emitStatement(stmt->elseBranch.get());
+    }
+    close();
+    close();
+  }
+
+  // while/for/do-while as `while (true)`: break maps to a C++ break, and
+  // continue to `continue` or, when an increment or a do-while condition
+  // must run first, a jump to the end of the body
+  void emitLoop(Expression *condition, Statement *increment, Statement *body,
+                bool testAfterBody) {
+    int id = _labels++;
+    bool continueUsed = false;
+    bool breakUsed = false;
+    bool continueByJump = increment || testAfterBody;
+
+    open("while (true) {");
+    if (condition && !testAfterBody) {
+      emitLoopTest(condition);
+    }
+
+    _targets.push_back({false, id, continueByJump, &continueUsed, &breakUsed});
+    emitStatement(body);
+    _targets.pop_back();
+
+    if (continueUsed && continueByJump) {
+      line("continue_" + std::to_string(id) + ":;");
+    }
+    if (increment) {
+      emitStatement(increment);
+    }
+    if (condition && testAfterBody) {
+      emitLoopTest(condition);
+    }
+    close();
+  }
+
+  void emitLoopTest(Expression *condition) {
+    open("{");
+    Operand value = emitExpression(condition);
+    open("if (!" + asBool(value) + ") {");
+    line("break;");
+    close();
+    close();
+  }
+
+  void emitContinue() {
+    for (auto it = _targets.rbegin(); it != _targets.rend(); ++it) {
+      if (it->isSwitch) {
+        continue;
+      }
+      *it->continueUsed = true;
+      line(it->continueByJump ? "goto continue_" + std::to_string(it->id) + ";"
+                              : "continue;");
+      return;
+    }
+    decline("'continue' outside of a loop");
+  }
+
+  void emitSwitch(SwitchStmt *stmt) {
+    // Case bodies share the enclosing scope, so a declaration in one case
+    // could be read uninitialized from another; leave those to the
+    // interpreter
+    for (const auto &caseEntry : stmt->cases) {
+      for (const auto &s : caseEntry.statements) {
+        if (s->kind == NodeKind::VAR_DECL) {
+          decline("declaration directly inside a switch case");
+        }
+      }
+    }
+
+    int id = _labels++;
+    std::string prefix = "switch_" + std::to_string(id) + "_";
+    bool breakUsed = false;
+
+    open("{");
+    Operand control = emitExpression(stmt->expression.get());
+    if (!control.temporary) {
+      control = temporary(control.type, control.text);
+    }
+
+    // Cases are tried in order; reaching default selects it
+    std::vector<bool> jumpedTo(stmt->cases.size(), false);
+    bool reachedDefault = false;
+    for (size_t i = 0; i < stmt->cases.size() && !reachedDefault; ++i) {
+      jumpedTo[i] = true;
+      if (stmt->cases[i].isDefault) {
+        line("goto " + prefix + std::to_string(i) + ";");
+        reachedDefault = true;
+        continue;
+      }
+      open("{");
+      Operand match = emitExpression(stmt->cases[i].matchExpr.get());
+      DataType result = DataType::VOID;
+      std::string equal =
+          binaryText(BinaryExpr::Operator::EQUAL, control, match, result);
+      open("if (" + equal + ") {");
+      line("goto " + prefix + std::to_string(i) + ";");
+      close();
+      close();
+    }
+    if (!reachedDefault) {
+      breakUsed = true;
+      line("goto " + prefix + "end;");
+    }
+
+    _targets.push_back({true, id, false, nullptr, &breakUsed});
+    for (size_t i = 0; i < stmt->cases.size(); ++i) {
+      if (jumpedTo[i]) {
+        line(prefix + std::to_string(i) + ":;");
+      }
+      for (const auto &s : stmt->cases[i].statements) {
+        emitStatement(s.get());
+      }
+    }
+    _targets.pop_back();
+
+    if (breakUsed) {
+      line(prefix + "end:;");
+    }
+    close();
+  }
+
+  void emitReturn(ReturnStmt *stmt) {
+    Operand value{"0", DataType::INT32, false};
+    open("{");
+    if (stmt->value) {
+      value = emitExpression(stmt->value.get());
+    }
+    if (_isVoid) {
+      if (value.temporary) {
+        line("(void)" + value.text + ";");
+      }
+      line("return;");
+    } else {
+      line("return " + convert(value, _returnType) + ";");
+    }
+    close();
+  }
+};
+
+// Thunk with the C calling convention used by the module descriptor
+std::string invokeThunk(const ProcedureDecl &proc) {
+  std::ostringstream out;
+  out << "int invoke_" << proc.name << "("
+      << (proc.parameters.empty() ? "const uint64_t *" : "const uint64_t *args")
+      << ", uint64_t *result,\n"
+      << "    CxxScriptNativeError *error) {\n"
+      << "  try {\n";
+
+  std::string call = functionName(proc.name) + "(";
+  for (size_t i = 0; i < proc.parameters.size(); ++i) {
+    call += (i ? ", " : "") + std::string("rt_arg<") +
+            cppType(proc.parameters[i].type.baseType) + ">(args[" +
+            std::to_string(i) + "])";
+  }
+  call += ")";
+
+  if (isVoid(proc.returnType)) {
+    out << "    " << call << ";\n"
+        << "    *result = 0;\n";
+  } else {
+    out << "    *result = rt_cell(" << call << ");\n";
+  }
+  out << "    return 0;\n"
+      << "  } catch (const ScriptError &e) {\n"
+      << "    return rt_fail(e, error);\n"
+      << "  }\n"
+      << "}\n";
+  return out.str();
+}
+
+} // namespace
+
+std::string AotTranslator::translate(const Script &script) {
+  _skipped.clear();
+  _translated.clear();
+
+  // A procedure is translated when its body is supported and everything it
+  // calls is translated too; drop failures until nothing changes
+  std::unordered_map<std::string, const ProcedureDecl *> callable;
+  for (const auto &proc : script.procedures) {
+    if (!proc->resolved) {
+      throw std::runtime_error("Procedure '" + proc->name +
+                               "' must be resolved before translation");
+    }
+    callable[proc->name] = proc.get();
+  }
+
+  std::unordered_map<std::string, std::string> definitions;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    definitions.clear();
+    for (const auto &proc : script.procedures) {
+      if (!callable.count(proc->name)) {
+        continue;
+      }
+      try {
+        FunctionGen gen(*proc, callable);
+        definitions[proc->name] = gen.run();
+      } catch (const Declined &declined) {
+        _skipped.push_back({proc->name, declined.reason});
+        callable.erase(proc->name);
+        changed = true;
+      }
+    }
+  }
+
+  std::ostringstream out;
+  out << "// Generated by cxxscript-aot from " << script.filename
+      << ". Do not edit.\n"
+      << PRELUDE << "\n";
+
+  // Declarations first so procedures can call each other in any order
+  std::vector<const ProcedureDecl *> procedures;
+  for (const auto &proc : script.procedures) {
+    if (callable.count(proc->name)) {
+      procedures.push_back(proc.get());
+      _translated.push_back(proc->name);
+    }
+  }
+
+  out << "namespace {\n\n";
+  for (const ProcedureDecl *proc : procedures) {
+    std::string definition = definitions[proc->name];
+    out << definition.substr(0, definition.find(" {\n")) << ";\n";
+  }
+  out << "\n";
+  for (const ProcedureDecl *proc : procedures) {
+    out << definitions[proc->name] << "\n" << invokeThunk(*proc) << "\n";
+  }
+  for (const ProcedureDecl *proc : procedures) {
+    if (proc->parameters.empty()) {
+      continue;
+    }
+    out << "const uint8_t params_" << proc->name << "[] = {";
+    for (size_t i = 0; i < proc->parameters.size(); ++i) {
+      out << (i ? ", " : "")
+          << static_cast<int>(proc->parameters[i].type.baseType);
+    }
+    out << "};\n";
+  }
+
+  out << "\nconst CxxScriptNativeProcedure procedures[] = {\n";
+  for (const ProcedureDecl *proc : procedures) {
+    out << "    {\"" << proc->name << "\", " << proc->parameters.size() << ", "
+        << (proc->parameters.empty() ? "nullptr" : "params_" + proc->name)
+        << ", " << static_cast<int>(proc->returnType.baseType) << ", "
+        << proc->line << ", " << proc->column << ", &invoke_" << proc->name
+        << "},\n";
+  }
+  if (procedures.empty()) {
+    out << "    {nullptr, 0, nullptr, 0, 0, 0, nullptr},\n";
+  }
+  out << "};\n\n"
+      << "const CxxScriptNativeModule module = {\n"
+      << "    CXXSCRIPT_NATIVE_ABI_VERSION, " << procedures.size()
+      << ", procedures};\n\n"
+      << "} // namespace\n\n"
+      << "extern \"C\" const CxxScriptNativeModule *cxxscript_module() {\n"
+      << "  return &module;\n"
+      << "}\n";
+  return out.str();
+}
+
+} // namespace Script
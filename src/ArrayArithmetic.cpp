@@ -0,0 +1,380 @@
+#include "ArrayArithmetic.h"
+#include <stdexcept>
+#include <type_traits>
+
+namespace Script {
+
+namespace {
+
+constexpr bool isArithmetic(ElementwiseOp op) {
+  return op == ElementwiseOp::ADD || op == ElementwiseOp::SUBTRACT ||
+         op == ElementwiseOp::MULTIPLY || op == ElementwiseOp::DIVIDE ||
+         op == ElementwiseOp::MODULO;
+}
+
+bool isNumeric(DataType type) { return type <= DataType::DOUBLE; }
+
+bool isUnsigned(DataType type) {
+  return type == DataType::UINT8 || type == DataType::UINT16 ||
+         type == DataType::UINT32 || type == DataType::UINT64;
+}
+
+std::string operatorName(ElementwiseOp op) {
+  return std::string("Operator ") + ArrayArithmetic::symbol(op);
+}
+
+// Type of `x op y` for scalars of types ta and tb, as ValueHelper computes
+// it: doubles win, then the larger type, with unsigned results stored the
+// way createValue(type, uint64_t) stores them. Bitwise operators give
+// int64 or uint64.
+DataType resultType(ElementwiseOp op, DataType ta, DataType tb) {
+  bool anyUnsigned = isUnsigned(ta) || isUnsigned(tb);
+  if (ta == DataType::DOUBLE || tb == DataType::DOUBLE) {
+    if (!isArithmetic(op)) {
+      throw std::runtime_error(operatorName(op) + " only supports integers");
+    }
+    if (op == ElementwiseOp::MODULO) {
+      throw std::runtime_error("Modulo not supported for floating point");
+    }
+    return DataType::DOUBLE;
+  }
+  if (!isArithmetic(op)) {
+    return anyUnsigned ? DataType::UINT64 : DataType::INT64;
+  }
+  DataType larger = static_cast<int>(ta) > static_cast<int>(tb) ? ta : tb;
+  if (anyUnsigned && !isUnsigned(larger)) {
+    return DataType::UINT32;
+  }
+  return larger;
+}
+
+Value scalarOp(ElementwiseOp op, const Value &a, const Value &b) {
+  switch (op) {
+  case ElementwiseOp::ADD:
+    return ValueHelper::add(a, b);
+  case ElementwiseOp::SUBTRACT:
+    return ValueHelper::subtract(a, b);
+  case ElementwiseOp::MULTIPLY:
+    return ValueHelper::multiply(a, b);
+  case ElementwiseOp::DIVIDE:
+    return ValueHelper::divide(a, b);
+  case ElementwiseOp::MODULO:
+    return ValueHelper::modulo(a, b);
+  case ElementwiseOp::BIT_AND:
+    return ValueHelper::bitAnd(a, b);
+  case ElementwiseOp::BIT_OR:
+    return ValueHelper::bitOr(a, b);
+  case ElementwiseOp::BIT_XOR:
+    return ValueHelper::bitXor(a, b);
+  case ElementwiseOp::SHIFT_LEFT:
+    return ValueHelper::lshift(a, b);
+  case ElementwiseOp::SHIFT_RIGHT:
+    return ValueHelper::rshift(a, b);
+  }
+  throw std::runtime_error("Unknown operator");
+}
+
+// ---------------------------------------------------------------------------
+// Typed loops. The element type R fixes the type the scalar operator
+// computes in (Wide<R>): double, uint64 for unsigned results and int64 for
+// signed ones. Each element is converted to Wide<R>, combined and narrowed
+// back to R, which is what the scalar kernels do one Value at a time.
+// ---------------------------------------------------------------------------
+
+template <typename R>
+using Wide = std::conditional_t<
+    std::is_floating_point_v<R>, double,
+    std::conditional_t<std::is_unsigned_v<R>, uint64_t, int64_t>>;
+
+template <ElementwiseOp Op, typename C> C compute(C x, C y) {
+  if constexpr (std::is_floating_point_v<C>) {
+    if constexpr (Op == ElementwiseOp::ADD) {
+      return x + y;
+    } else if constexpr (Op == ElementwiseOp::SUBTRACT) {
+      return x - y;
+    } else if constexpr (Op == ElementwiseOp::MULTIPLY) {
+      return x * y;
+    } else {
+      return x / y;
+    }
+  } else {
+    // Signed ring operations wrap through the unsigned type
+    using U = std::make_unsigned_t<C>;
+    if constexpr (Op == ElementwiseOp::ADD) {
+      return static_cast<C>(static_cast<U>(x) + static_cast<U>(y));
+    } else if constexpr (Op == ElementwiseOp::SUBTRACT) {
+      return static_cast<C>(static_cast<U>(x) - static_cast<U>(y));
+    } else if constexpr (Op == ElementwiseOp::MULTIPLY) {
+      return static_cast<C>(static_cast<U>(x) * static_cast<U>(y));
+    } else if constexpr (Op == ElementwiseOp::DIVIDE) {
+      return x / y;
+    } else if constexpr (Op == ElementwiseOp::MODULO) {
+      return x % y;
+    } else if constexpr (Op == ElementwiseOp::BIT_AND) {
+      return x & y;
+    } else if constexpr (Op == ElementwiseOp::BIT_OR) {
+      return x | y;
+    } else if constexpr (Op == ElementwiseOp::BIT_XOR) {
+      return x ^ y;
+    } else if constexpr (Op == ElementwiseOp::SHIFT_LEFT) {
+      return x << y;
+    } else {
+      return x >> y;
+    }
+  }
+}
+
+// A scalar operand, indexed like a buffer
+template <typename T> struct Broadcast {
+  T value;
+  T operator[](size_t) const { return value; }
+};
+
+// One side of the operation. Buffers of R are read directly, buffers of
+// Wide<R> too; other element types are widened into `converted` first.
+template <typename R> struct Operand {
+  using C = Wide<R>;
+  bool isScalar = false;
+  C scalar{};
+  const R *native = nullptr;
+  const C *wide = nullptr;
+  std::vector<C> converted;
+
+  template <typename F> void read(F &&f) const {
+    if (isScalar) {
+      f(Broadcast<C>{scalar});
+    } else if (native) {
+      f(native);
+    } else {
+      f(wide);
+    }
+  }
+};
+
+template <typename F> bool visitNumeric(const ArrayValue &array, F &&f) {
+  auto tryType = [&](auto tag) {
+    using T = decltype(tag);
+    if (auto elements = array.elements<T>()) {
+      f(elements);
+      return true;
+    }
+    return false;
+  };
+  return tryType(int8_t{}) || tryType(uint8_t{}) || tryType(int16_t{}) ||
+         tryType(uint16_t{}) || tryType(int32_t{}) || tryType(uint32_t{}) ||
+         tryType(int64_t{}) || tryType(uint64_t{}) || tryType(double{});
+}
+
+template <typename R> void prepare(const Value &value, Operand<R> &out) {
+  using C = Wide<R>;
+  if (!ValueHelper::isArray(value)) {
+    out.isScalar = true;
+    out.scalar = std::visit(
+        [](const auto &x) -> C {
+          if constexpr (std::is_arithmetic_v<std::decay_t<decltype(x)>>) {
+            return static_cast<C>(x);
+          } else {
+            return C{};
+          }
+        },
+        value);
+    return;
+  }
+
+  const ArrayValue &array = ValueHelper::arrayValue(value);
+  if (auto elements = array.template elements<R>()) {
+    out.native = elements.data();
+  } else if (auto elements = array.template elements<C>()) {
+    out.wide = elements.data();
+  } else {
+    visitNumeric(array, [&out](const auto &buffer) {
+      out.converted.resize(buffer.size());
+      for (size_t i = 0; i < buffer.size(); ++i) {
+        out.converted[i] = static_cast<C>(buffer[i]);
+      }
+    });
+    out.wide = out.converted.data();
+  }
+}
+
+template <ElementwiseOp Op, typename R>
+Value typedLoop(DataType type, const Value &a, const Value &b, size_t n) {
+  using C = Wide<R>;
+  if constexpr ((std::is_floating_point_v<R> &&
+                 (!isArithmetic(Op) || Op == ElementwiseOp::MODULO)) ||
+                (!isArithmetic(Op) && sizeof(R) != 8)) {
+    // resultType never picks R for this operator
+    throw std::logic_error("Invalid element type for operator");
+  } else {
+    Operand<R> left;
+    Operand<R> right;
+    prepare(a, left);
+    prepare(b, right);
+
+    if constexpr (Op == ElementwiseOp::DIVIDE || Op == ElementwiseOp::MODULO) {
+      right.read([&](const auto &divisors) {
+        size_t count = right.isScalar ? (n > 0 ? 1 : 0) : n;
+        for (size_t i = 0; i < count; ++i) {
+          if (static_cast<C>(divisors[i]) == 0) {
+            throw std::runtime_error(Op == ElementwiseOp::DIVIDE
+                                         ? "Division by zero"
+                                         : "Modulo by zero");
+          }
+        }
+      });
+    }
+
+    std::vector<R> out(n);
+    R *dst = out.data();
+    left.read([&](const auto &x) {
+      right.read([&](const auto &y) {
+        for (size_t i = 0; i < n; ++i) {
+          dst[i] = static_cast<R>(
+              compute<Op, C>(static_cast<C>(x[i]), static_cast<C>(y[i])));
+        }
+      });
+    });
+    return std::make_shared<ArrayValue>(type,
+                                        ArrayValue::Storage(std::move(out)));
+  }
+}
+
+template <ElementwiseOp Op>
+Value typedLoopFor(DataType type, const Value &a, const Value &b, size_t n) {
+  switch (type) {
+  case DataType::INT8:
+    return typedLoop<Op, int8_t>(type, a, b, n);
+  case DataType::UINT8:
+    return typedLoop<Op, uint8_t>(type, a, b, n);
+  case DataType::INT16:
+    return typedLoop<Op, int16_t>(type, a, b, n);
+  case DataType::UINT16:
+    return typedLoop<Op, uint16_t>(type, a, b, n);
+  case DataType::INT32:
+    return typedLoop<Op, int32_t>(type, a, b, n);
+  case DataType::UINT32:
+    return typedLoop<Op, uint32_t>(type, a, b, n);
+  case DataType::INT64:
+    return typedLoop<Op, int64_t>(type, a, b, n);
+  case DataType::UINT64:
+    return typedLoop<Op, uint64_t>(type, a, b, n);
+  case DataType::DOUBLE:
+    return typedLoop<Op, double>(type, a, b, n);
+  default:
+    throw std::logic_error("Invalid element type for operator");
+  }
+}
+
+Value typedLoopFor(ElementwiseOp op, DataType type, const Value &a,
+                   const Value &b, size_t n) {
+  switch (op) {
+  case ElementwiseOp::ADD:
+    return typedLoopFor<ElementwiseOp::ADD>(type, a, b, n);
+  case ElementwiseOp::SUBTRACT:
+    return typedLoopFor<ElementwiseOp::SUBTRACT>(type, a, b, n);
+  case ElementwiseOp::MULTIPLY:
+    return typedLoopFor<ElementwiseOp::MULTIPLY>(type, a, b, n);
+  case ElementwiseOp::DIVIDE:
+    return typedLoopFor<ElementwiseOp::DIVIDE>(type, a, b, n);
+  case ElementwiseOp::MODULO:
+    return typedLoopFor<ElementwiseOp::MODULO>(type, a, b, n);
+  case ElementwiseOp::BIT_AND:
+    return typedLoopFor<ElementwiseOp::BIT_AND>(type, a, b, n);
+  case ElementwiseOp::BIT_OR:
+    return typedLoopFor<ElementwiseOp::BIT_OR>(type, a, b, n);
+  case ElementwiseOp::BIT_XOR:
+    return typedLoopFor<ElementwiseOp::BIT_XOR>(type, a, b, n);
+  case ElementwiseOp::SHIFT_LEFT:
+    return typedLoopFor<ElementwiseOp::SHIFT_LEFT>(type, a, b, n);
+  case ElementwiseOp::SHIFT_RIGHT:
+    return typedLoopFor<ElementwiseOp::SHIFT_RIGHT>(type, a, b, n);
+  }
+  throw std::logic_error("Unknown operator");
+}
+
+} // namespace
+
+Value ArrayArithmetic::apply(ElementwiseOp op, const Value &a, const Value &b) {
+  const ArrayValue *left =
+      ValueHelper::isArray(a) ? &ValueHelper::arrayValue(a) : nullptr;
+  const ArrayValue *right =
+      ValueHelper::isArray(b) ? &ValueHelper::arrayValue(b) : nullptr;
+  if (left && right &&
+      (left->size() != right->size() || left->rank() != right->rank() ||
+       (left->rank() > 1 && left->shape() != right->shape()))) {
+    throw std::runtime_error(operatorName(op) +
+                             (left->rank() == 1 && right->rank() == 1
+                                  ? " needs arrays of the same length"
+                                  : " needs arrays of the same shape"));
+  }
+
+  // Scalars' variant indices are their DataType; `[]` arrays report VOID
+  DataType ta = left ? left->elementType() : static_cast<DataType>(a.index());
+  DataType tb = right ? right->elementType() : static_cast<DataType>(b.index());
+  auto supported = [](const ArrayValue *array, DataType type) {
+    return isNumeric(type) || (array && type == DataType::VOID);
+  };
+  if (!supported(left, ta) || !supported(right, tb)) {
+    throw std::runtime_error(operatorName(op) + " only supports numeric arrays");
+  }
+
+  size_t n = left ? left->size() : right->size();
+  bool typed = isNumeric(ta) && isNumeric(tb) && (!left || left->isTyped()) &&
+               (!right || right->isTyped());
+  // Element positions line up across equal shapes, so the loops below see
+  // flat buffers and the result takes the operands' shape afterwards
+  const ArrayValue &shaped = left ? *left : *right;
+  if (typed) {
+    Value result = typedLoopFor(op, resultType(op, ta, tb), a, b, n);
+    if (shaped.rank() > 1) {
+      std::get<ArrayPtr>(result)->setShape(shaped.shape());
+    }
+    return result;
+  }
+
+  // Mixed arrays go element by element, each pair promoted on its own
+  std::vector<Value> elements;
+  elements.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    Value x = left ? left->get(i) : a;
+    Value y = right ? right->get(i) : b;
+    if (!isNumeric(static_cast<DataType>(x.index())) ||
+        !isNumeric(static_cast<DataType>(y.index()))) {
+      throw std::runtime_error(operatorName(op) +
+                               " only supports numeric arrays");
+    }
+    elements.push_back(scalarOp(op, x, y));
+  }
+  DataType elementType = isNumeric(ta) && isNumeric(tb)
+                             ? resultType(op, ta, tb)
+                             : DataType::VOID;
+  return std::make_shared<ArrayValue>(elementType, elements, shaped.shape());
+}
+
+const char *ArrayArithmetic::symbol(ElementwiseOp op) {
+  switch (op) {
+  case ElementwiseOp::ADD:
+    return "+";
+  case ElementwiseOp::SUBTRACT:
+    return "-";
+  case ElementwiseOp::MULTIPLY:
+    return "*";
+  case ElementwiseOp::DIVIDE:
+    return "/";
+  case ElementwiseOp::MODULO:
+    return "%";
+  case ElementwiseOp::BIT_AND:
+    return "&";
+  case ElementwiseOp::BIT_OR:
+    return "|";
+  case ElementwiseOp::BIT_XOR:
+    return "^";
+  case ElementwiseOp::SHIFT_LEFT:
+    return "<<";
+  case ElementwiseOp::SHIFT_RIGHT:
+    return ">>";
+  }
+  return "?";
+}
+
+} // namespace Script
@@ -0,0 +1,1186 @@
+#include "ArrayBuiltins.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CXXSCRIPT_SIMD_X86 1
+#include <immintrin.h>
+#define CXXSCRIPT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace Script {
+
+namespace {
+
+// ---------------------------------------------------------------------------
+// Scalar kernels. Integer elements are ordered and compared through int64,
+// as the script operators do (so uint64 values above INT64_MAX order below
+// zero), and integer sums wrap in uint64.
+// ---------------------------------------------------------------------------
+
+template <typename T> bool lessThan(T a, T b) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return a < b;
+  } else {
+    return static_cast<int64_t>(a) < static_cast<int64_t>(b);
+  }
+}
+
+template <typename T> uint64_t sumScalar(const T *p, size_t n) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; ++i) {
+    total += static_cast<uint64_t>(static_cast<int64_t>(p[i]));
+  }
+  return total;
+}
+
+double sumScalar(const double *p, size_t n) {
+  double total = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    total += p[i];
+  }
+  return total;
+}
+
+// Keeps the current extreme on ties and NaNs, like `if (x < m) m = x`
+template <bool Max, typename T> T extremeScalar(T m, const T *p, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (Max ? lessThan(m, p[i]) : lessThan(p[i], m)) {
+      m = p[i];
+    }
+  }
+  return m;
+}
+
+template <typename T> size_t countScalar(const T *p, size_t n, T needle) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    count += p[i] == needle;
+  }
+  return count;
+}
+
+template <typename T> int64_t indexScalar(const T *p, size_t n, T needle) {
+  for (size_t i = 0; i < n; ++i) {
+    if (p[i] == needle) {
+      return static_cast<int64_t>(i);
+    }
+  }
+  return -1;
+}
+
+uint64_t dotScalar(const int32_t *a, const int32_t *b, size_t n) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; ++i) {
+    total += static_cast<uint64_t>(static_cast<int64_t>(a[i]) * b[i]);
+  }
+  return total;
+}
+
+double dotScalar(const double *a, const double *b, size_t n) {
+  double total = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    total += a[i] * b[i];
+  }
+  return total;
+}
+
+#ifdef CXXSCRIPT_SIMD_X86
+
+// ---------------------------------------------------------------------------
+// SSE2 kernels. SSE2 has no signed 32-bit min/max, 64-bit compares or
+// signed 32x32->64 multiplies, so those operations stay scalar here.
+// ---------------------------------------------------------------------------
+
+CXXSCRIPT_TARGET("sse2")
+uint64_t lanesTotal(__m128i acc) {
+  alignas(16) uint64_t lanes[2];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+  return lanes[0] + lanes[1];
+}
+
+CXXSCRIPT_TARGET("sse2")
+uint64_t sumSse2(const int32_t *p, size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i sign = _mm_srai_epi32(v, 31);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+  }
+  return lanesTotal(acc) + sumScalar(p + i, n - i);
+}
+
+CXXSCRIPT_TARGET("sse2")
+uint64_t sumSse2(const int64_t *p, size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_epi64(
+        acc, _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i)));
+  }
+  return lanesTotal(acc) + sumScalar(p + i, n - i);
+}
+
+CXXSCRIPT_TARGET("sse2")
+double sumSse2(const double *p, size_t n) {
+  __m128d acc = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_loadu_pd(p + i));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, acc);
+  return lanes[0] + lanes[1] + sumScalar(p + i, n - i);
+}
+
+template <bool Max>
+CXXSCRIPT_TARGET("sse2")
+int32_t extremeSse2(const int32_t *p, size_t n) {
+  __m128i m = _mm_set1_epi32(p[0]);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i take = Max ? _mm_cmpgt_epi32(v, m) : _mm_cmpgt_epi32(m, v);
+    m = _mm_or_si128(_mm_and_si128(take, v), _mm_andnot_si128(take, m));
+  }
+  alignas(16) int32_t lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), m);
+  return extremeScalar<Max>(extremeScalar<Max>(p[0], lanes, 4), p + i, n - i);
+}
+
+// min_pd/max_pd return their second operand on ties and NaNs, which keeps
+// the current extreme exactly like the scalar loop
+template <bool Max>
+CXXSCRIPT_TARGET("sse2")
+double extremeSse2(const double *p, size_t n) {
+  __m128d m = _mm_set1_pd(p[0]);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d v = _mm_loadu_pd(p + i);
+    m = Max ? _mm_max_pd(v, m) : _mm_min_pd(v, m);
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, m);
+  return extremeScalar<Max>(extremeScalar<Max>(p[0], lanes, 2), p + i, n - i);
+}
+
+CXXSCRIPT_TARGET("sse2")
+size_t countSse2(const int32_t *p, size_t n, int32_t needle) {
+  __m128i want = _mm_set1_epi32(needle);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, want)));
+    count += static_cast<size_t>(__builtin_popcount(mask));
+  }
+  return count + countScalar(p + i, n - i, needle);
+}
+
+CXXSCRIPT_TARGET("sse2")
+size_t countSse2(const double *p, size_t n, double needle) {
+  __m128d want = _mm_set1_pd(needle);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    int mask = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(p + i), want));
+    count += static_cast<size_t>(__builtin_popcount(mask));
+  }
+  return count + countScalar(p + i, n - i, needle);
+}
+
+CXXSCRIPT_TARGET("sse2")
+int64_t indexSse2(const int32_t *p, size_t n, int32_t needle) {
+  __m128i want = _mm_set1_epi32(needle);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, want)));
+    if (mask) {
+      return static_cast<int64_t>(i) + __builtin_ctz(mask);
+    }
+  }
+  int64_t tail = indexScalar(p + i, n - i, needle);
+  return tail < 0 ? tail : static_cast<int64_t>(i) + tail;
+}
+
+CXXSCRIPT_TARGET("sse2")
+int64_t indexSse2(const double *p, size_t n, double needle) {
+  __m128d want = _mm_set1_pd(needle);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    int mask = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(p + i), want));
+    if (mask) {
+      return static_cast<int64_t>(i) + __builtin_ctz(mask);
+    }
+  }
+  int64_t tail = indexScalar(p + i, n - i, needle);
+  return tail < 0 ? tail : static_cast<int64_t>(i) + tail;
+}
+
+CXXSCRIPT_TARGET("sse2")
+double dotSse2(const double *a, const double *b, size_t n) {
+  __m128d acc = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, acc);
+  return lanes[0] + lanes[1] + dotScalar(a + i, b + i, n - i);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels
+// ---------------------------------------------------------------------------
+
+CXXSCRIPT_TARGET("avx2")
+uint64_t lanesTotal(__m256i acc) {
+  alignas(32) uint64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+CXXSCRIPT_TARGET("avx2")
+double lanesTotal(__m256d acc) {
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, acc);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+CXXSCRIPT_TARGET("avx2")
+uint64_t sumAvx2(const int32_t *p, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    acc = _mm256_add_epi64(
+        acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    acc = _mm256_add_epi64(
+        acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  }
+  return lanesTotal(acc) + sumScalar(p + i, n - i);
+}
+
+CXXSCRIPT_TARGET("avx2")
+uint64_t sumAvx2(const int64_t *p, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_epi64(
+        acc, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)));
+  }
+  return lanesTotal(acc) + sumScalar(p + i, n - i);
+}
+
+CXXSCRIPT_TARGET("avx2")
+double sumAvx2(const double *p, size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(acc, _mm256_loadu_pd(p + i));
+  }
+  return lanesTotal(acc) + sumScalar(p + i, n - i);
+}
+
+template <bool Max>
+CXXSCRIPT_TARGET("avx2")
+int32_t extremeAvx2(const int32_t *p, size_t n) {
+  __m256i m = _mm256_set1_epi32(p[0]);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    m = Max ? _mm256_max_epi32(v, m) : _mm256_min_epi32(v, m);
+  }
+  alignas(32) int32_t lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), m);
+  return extremeScalar<Max>(extremeScalar<Max>(p[0], lanes, 8), p + i, n - i);
+}
+
+template <bool Max>
+CXXSCRIPT_TARGET("avx2")
+int64_t extremeAvx2(const int64_t *p, size_t n) {
+  __m256i m = _mm256_set1_epi64x(p[0]);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i take = Max ? _mm256_cmpgt_epi64(v, m) : _mm256_cmpgt_epi64(m, v);
+    m = _mm256_blendv_epi8(m, v, take);
+  }
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), m);
+  return extremeScalar<Max>(extremeScalar<Max>(p[0], lanes, 4), p + i, n - i);
+}
+
+template <bool Max>
+CXXSCRIPT_TARGET("avx2")
+double extremeAvx2(const double *p, size_t n) {
+  __m256d m = _mm256_set1_pd(p[0]);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(p + i);
+    m = Max ? _mm256_max_pd(v, m) : _mm256_min_pd(v, m);
+  }
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, m);
+  return extremeScalar<Max>(extremeScalar<Max>(p[0], lanes, 4), p + i, n - i);
+}
+
+CXXSCRIPT_TARGET("avx2")
+int equalMask(const int32_t *p, __m256i want) {
+  __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, want)));
+}
+
+CXXSCRIPT_TARGET("avx2")
+int equalMask(const int64_t *p, __m256i want) {
+  __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, want)));
+}
+
+CXXSCRIPT_TARGET("avx2")
+int equalMask(const double *p, __m256d want) {
+  return _mm256_movemask_pd(
+      _mm256_cmp_pd(_mm256_loadu_pd(p), want, _CMP_EQ_OQ));
+}
+
+CXXSCRIPT_TARGET("avx2") __m256i broadcast(int32_t x) {
+  return _mm256_set1_epi32(x);
+}
+CXXSCRIPT_TARGET("avx2") __m256i broadcast(int64_t x) {
+  return _mm256_set1_epi64x(x);
+}
+CXXSCRIPT_TARGET("avx2") __m256d broadcast(double x) {
+  return _mm256_set1_pd(x);
+}
+
+template <typename T>
+CXXSCRIPT_TARGET("avx2")
+size_t countAvx2(const T *p, size_t n, T needle) {
+  constexpr size_t width = 32 / sizeof(T);
+  auto want = broadcast(needle);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + width <= n; i += width) {
+    count += static_cast<size_t>(__builtin_popcount(equalMask(p + i, want)));
+  }
+  return count + countScalar(p + i, n - i, needle);
+}
+
+template <typename T>
+CXXSCRIPT_TARGET("avx2")
+int64_t indexAvx2(const T *p, size_t n, T needle) {
+  constexpr size_t width = 32 / sizeof(T);
+  auto want = broadcast(needle);
+  size_t i = 0;
+  for (; i + width <= n; i += width) {
+    if (int mask = equalMask(p + i, want)) {
+      return static_cast<int64_t>(i) + __builtin_ctz(mask);
+    }
+  }
+  int64_t tail = indexScalar(p + i, n - i, needle);
+  return tail < 0 ? tail : static_cast<int64_t>(i) + tail;
+}
+
+CXXSCRIPT_TARGET("avx2")
+uint64_t dotAvx2(const int32_t *a, const int32_t *b, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    // Sign-extended to 64 bits, so mul_epi32 multiplies whole elements
+    __m256i x = _mm256_cvtepi32_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    __m256i y = _mm256_cvtepi32_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, y));
+  }
+  return lanesTotal(acc) + dotScalar(a + i, b + i, n - i);
+}
+
+CXXSCRIPT_TARGET("avx2")
+double dotAvx2(const double *a, const double *b, size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(
+        acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  return lanesTotal(acc) + dotScalar(a + i, b + i, n - i);
+}
+
+#endif // CXXSCRIPT_SIMD_X86
+
+// ---------------------------------------------------------------------------
+// Dispatch on the selected level
+// ---------------------------------------------------------------------------
+
+SimdLevel detect() {
+#ifdef CXXSCRIPT_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SimdLevel::SSE2;
+  }
+#endif
+  return SimdLevel::SCALAR;
+}
+
+// Atomic so that setSimdLevel may run while other threads call the kernels
+std::atomic<SimdLevel> &selectedLevel() {
+  static std::atomic<SimdLevel> level = [] {
+    SimdLevel detected = ArrayBuiltins::detectedSimdLevel();
+    SimdLevel cap = detected;
+    if (const char *simd = std::getenv("CXXSCRIPT_SIMD")) {
+      std::string name(simd);
+      if (name == "scalar") {
+        cap = SimdLevel::SCALAR;
+      } else if (name == "sse2") {
+        cap = SimdLevel::SSE2;
+      }
+    }
+    return cap < detected ? cap : detected;
+  }();
+  return level;
+}
+
+// Whether the kernels for T have SIMD versions at the selected level
+template <typename T> constexpr bool hasKernels() {
+  return std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t> ||
+         std::is_same_v<T, double>;
+}
+
+template <typename T> auto sum(const T *p, size_t n) {
+#ifdef CXXSCRIPT_SIMD_X86
+  if constexpr (hasKernels<T>()) {
+    SimdLevel level = selectedLevel().load(std::memory_order_relaxed);
+    if (level >= SimdLevel::AVX2) {
+      return sumAvx2(p, n);
+    }
+    if (level >= SimdLevel::SSE2) {
+      return sumSse2(p, n);
+    }
+  }
+#endif
+  return sumScalar(p, n);
+}
+
+template <bool Max, typename T> T extreme(const T *p, size_t n) {
+#ifdef CXXSCRIPT_SIMD_X86
+  if constexpr (hasKernels<T>()) {
+    SimdLevel level = selectedLevel().load(std::memory_order_relaxed);
+    if (level >= SimdLevel::AVX2) {
+      return extremeAvx2<Max>(p, n);
+    }
+    if constexpr (!std::is_same_v<T, int64_t>) {
+      if (level >= SimdLevel::SSE2) {
+        return extremeSse2<Max>(p, n);
+      }
+    }
+  }
+#endif
+  return extremeScalar<Max>(p[0], p + 1, n - 1);
+}
+
+template <typename T> size_t count(const T *p, size_t n, T needle) {
+#ifdef CXXSCRIPT_SIMD_X86
+  if constexpr (hasKernels<T>()) {
+    SimdLevel level = selectedLevel().load(std::memory_order_relaxed);
+    if (level >= SimdLevel::AVX2) {
+      return countAvx2(p, n, needle);
+    }
+    if constexpr (!std::is_same_v<T, int64_t>) {
+      if (level >= SimdLevel::SSE2) {
+        return countSse2(p, n, needle);
+      }
+    }
+  }
+#endif
+  return countScalar(p, n, needle);
+}
+
+template <typename T> int64_t indexOf(const T *p, size_t n, T needle) {
+#ifdef CXXSCRIPT_SIMD_X86
+  if constexpr (hasKernels<T>()) {
+    SimdLevel level = selectedLevel().load(std::memory_order_relaxed);
+    if (level >= SimdLevel::AVX2) {
+      return indexAvx2(p, n, needle);
+    }
+    if constexpr (!std::is_same_v<T, int64_t>) {
+      if (level >= SimdLevel::SSE2) {
+        return indexSse2(p, n, needle);
+      }
+    }
+  }
+#endif
+  return indexScalar(p, n, needle);
+}
+
+template <typename T> auto dot(const T *a, const T *b, size_t n) {
+#ifdef CXXSCRIPT_SIMD_X86
+  SimdLevel level = selectedLevel().load(std::memory_order_relaxed);
+  if (level >= SimdLevel::AVX2) {
+    return dotAvx2(a, b, n);
+  }
+  if constexpr (std::is_same_v<T, double>) {
+    if (level >= SimdLevel::SSE2) {
+      return dotSse2(a, b, n);
+    }
+  }
+#endif
+  return dotScalar(a, b, n);
+}
+
+// ---------------------------------------------------------------------------
+// Builtins
+// ---------------------------------------------------------------------------
+
+// Calls f with the array's native elements if they are one of Ts
+template <typename... Ts, typename F>
+bool visitBuffer(const ArrayValue &array, F &&f) {
+  return ((array.elements<Ts>() ? (f(array.elements<Ts>()), true) : false) ||
+          ...);
+}
+
+template <typename F> bool visitNumeric(const ArrayValue &array, F &&f) {
+  return visitBuffer<int8_t, uint8_t, int16_t, uint16_t, int32_t, uint32_t,
+                     int64_t, uint64_t, double>(array, f);
+}
+
+bool isNumeric(const Value &value) {
+  return value.index() <= static_cast<size_t>(DataType::DOUBLE);
+}
+
+bool isNumericType(DataType type) {
+  return type != DataType::STRING && type != DataType::BOOL;
+}
+
+bool isUnsignedType(DataType type) {
+  return type == DataType::UINT8 || type == DataType::UINT16 ||
+         type == DataType::UINT32 || type == DataType::UINT64;
+}
+
+const ArrayValue &arrayArgument(const Value &value, const std::string &message) {
+  if (!ValueHelper::isArray(value)) {
+    throw std::runtime_error(message);
+  }
+  return ValueHelper::arrayValue(value);
+}
+
+void expectArguments(const std::string &name, const BuiltinArguments &args,
+                     size_t expected) {
+  if (args.size() != expected) {
+    throw std::runtime_error(name + " expects " + std::to_string(expected) +
+                             (expected == 1 ? " argument" : " arguments"));
+  }
+}
+
+template <typename T> Value integerTotal(uint64_t total) {
+  if constexpr (std::is_signed_v<T>) {
+    return static_cast<int64_t>(total);
+  } else {
+    return total;
+  }
+}
+
+Value sumOf(const Value &value) {
+  const ArrayValue &array = arrayArgument(value, "sum expects an array");
+  DataType type = array.elementType();
+  if (!isNumericType(type)) {
+    throw std::runtime_error("sum expects a numeric array");
+  }
+
+  Value result;
+  if (visitNumeric(array, [&](const auto &buffer) {
+        using T = typename std::decay_t<decltype(buffer)>::value_type;
+        if constexpr (std::is_same_v<T, double>) {
+          result = sum(buffer.data(), buffer.size());
+        } else {
+          result = integerTotal<T>(sum(buffer.data(), buffer.size()));
+        }
+      })) {
+    return result;
+  }
+
+  // Mixed elements add up with the usual promotion rules
+  if (type == DataType::DOUBLE) {
+    result = 0.0;
+  } else if (isUnsignedType(type)) {
+    result = uint64_t{0};
+  } else {
+    result = int64_t{0};
+  }
+  for (size_t i = 0; i < array.size(); ++i) {
+    Value element = array.get(i);
+    if (!isNumeric(element)) {
+      throw std::runtime_error("sum expects a numeric array");
+    }
+    result = ValueHelper::add(result, element);
+  }
+  return result;
+}
+
+template <bool Max> Value extremeOf(const Value &value) {
+  const char *name = Max ? "max" : "min";
+  const ArrayValue &array =
+      arrayArgument(value, std::string(name) + " expects an array");
+  if (array.empty()) {
+    throw std::runtime_error(std::string(name) + " of an empty array");
+  }
+
+  Value result;
+  if (visitNumeric(array, [&](const auto &buffer) {
+        result = extreme<Max>(buffer.data(), buffer.size());
+      })) {
+    return result;
+  }
+
+  result = array.get(0);
+  for (size_t i = 1; i < array.size(); ++i) {
+    Value element = array.get(i);
+    if (Max ? ValueHelper::greaterThan(element, result)
+            : ValueHelper::lessThan(element, result)) {
+      result = std::move(element);
+    }
+  }
+  return result;
+}
+
+// A reduction along one axis sees the array as `outer` blocks, each `n`
+// rows of `inner` contiguous elements, and gives one result per block
+// column
+struct AxisSplit {
+  size_t outer = 1;
+  size_t n = 0;
+  size_t inner = 1;
+  std::vector<size_t> shape; // of the result: the array's without the axis
+};
+
+AxisSplit splitAxis(const std::string &name, const ArrayValue &array,
+                    const Value &axisArg) {
+  if (!isNumeric(axisArg) || std::holds_alternative<double>(axisArg)) {
+    throw std::runtime_error(name + " expects an integer axis");
+  }
+  int64_t axis = ValueHelper::toInt64(axisArg);
+  if (axis < 0 || axis >= static_cast<int64_t>(array.rank())) {
+    throw std::runtime_error(name + " axis " + std::to_string(axis) +
+                             " out of range for rank " +
+                             std::to_string(array.rank()));
+  }
+
+  AxisSplit split;
+  std::vector<size_t> shape = array.shape();
+  for (size_t i = 0; i < shape.size(); ++i) {
+    if (i == static_cast<size_t>(axis)) {
+      split.n = shape[i];
+      continue;
+    }
+    (i < static_cast<size_t>(axis) ? split.outer : split.inner) *= shape[i];
+    split.shape.push_back(shape[i]);
+  }
+  return split;
+}
+
+// Type of sum's result for elements of type T
+template <typename T>
+using Total = std::conditional_t<
+    std::is_same_v<T, double>, double,
+    std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>>;
+
+template <typename T>
+Value sumAlong(ElementSpan<T> buffer, DataType type, const AxisSplit &split) {
+  using R = Total<T>;
+  std::vector<R> out(split.outer * split.inner);
+  for (size_t o = 0; o < split.outer; ++o) {
+    const T *block = buffer.data() + o * split.n * split.inner;
+    R *row = out.data() + o * split.inner;
+    if (split.inner == 1) {
+      // Reducing the last axis: each result is one contiguous run
+      row[0] = static_cast<R>(sum(block, split.n));
+      continue;
+    }
+    // Otherwise whole rows add into the results at once
+    for (size_t k = 0; k < split.n; ++k) {
+      const T *src = block + k * split.inner;
+      for (size_t j = 0; j < split.inner; ++j) {
+        if constexpr (std::is_same_v<T, double>) {
+          row[j] += src[j];
+        } else {
+          row[j] = static_cast<R>(
+              static_cast<uint64_t>(row[j]) +
+              static_cast<uint64_t>(static_cast<int64_t>(src[j])));
+        }
+      }
+    }
+  }
+  DataType resultType = type == DataType::DOUBLE ? DataType::DOUBLE
+                        : isUnsignedType(type)   ? DataType::UINT64
+                                                 : DataType::INT64;
+  return std::make_shared<ArrayValue>(
+      resultType, ArrayValue::Storage(std::move(out)), split.shape);
+}
+
+template <bool Max, typename T>
+Value extremeAlong(ElementSpan<T> buffer, DataType type,
+                   const AxisSplit &split) {
+  std::vector<T> out(split.outer * split.inner);
+  for (size_t o = 0; o < split.outer; ++o) {
+    const T *block = buffer.data() + o * split.n * split.inner;
+    T *row = out.data() + o * split.inner;
+    if (split.inner == 1) {
+      row[0] = extreme<Max>(block, split.n);
+      continue;
+    }
+    std::copy(block, block + split.inner, row);
+    for (size_t k = 1; k < split.n; ++k) {
+      const T *src = block + k * split.inner;
+      for (size_t j = 0; j < split.inner; ++j) {
+        if (Max ? lessThan(row[j], src[j]) : lessThan(src[j], row[j])) {
+          row[j] = src[j];
+        }
+      }
+    }
+  }
+  return std::make_shared<ArrayValue>(
+      type, ArrayValue::Storage(std::move(out)), split.shape);
+}
+
+// Reduces arrays that fell back to Values with a ValueHelper operation,
+// starting from `zero` if given and otherwise from the first element
+template <typename F>
+Value reduceAlongGeneric(const ArrayValue &array, const AxisSplit &split,
+                         DataType resultType, const Value *zero,
+                         F &&combine) {
+  std::vector<Value> out;
+  out.reserve(split.outer * split.inner);
+  for (size_t o = 0; o < split.outer; ++o) {
+    for (size_t j = 0; j < split.inner; ++j) {
+      size_t first = o * split.n * split.inner + j;
+      Value result = zero ? *zero : array.get(first);
+      for (size_t k = zero ? 0 : 1; k < split.n; ++k) {
+        result = combine(std::move(result), array.get(first + k * split.inner));
+      }
+      out.push_back(std::move(result));
+    }
+  }
+  return std::make_shared<ArrayValue>(resultType, out, split.shape);
+}
+
+Value sumAlongBuiltin(const BuiltinArguments &args) {
+  const ArrayValue &array = arrayArgument(args[0], "sum expects an array");
+  DataType type = array.elementType();
+  if (!isNumericType(type)) {
+    throw std::runtime_error("sum expects a numeric array");
+  }
+  AxisSplit split = splitAxis("sum", array, args[1]);
+  if (split.shape.empty()) {
+    return sumOf(args[0]);
+  }
+
+  Value result;
+  if (visitNumeric(array, [&](const auto &buffer) {
+        result = sumAlong(buffer, type, split);
+      })) {
+    return result;
+  }
+
+  DataType resultType = type == DataType::DOUBLE ? DataType::DOUBLE
+                        : isUnsignedType(type)   ? DataType::UINT64
+                                                 : DataType::INT64;
+  // Mixed elements add up with the usual promotion rules
+  Value zero = ValueHelper::convertElement(int64_t{0}, TypeInfo(resultType));
+  return reduceAlongGeneric(array, split, resultType, &zero,
+                            [](Value total, const Value &element) {
+                              if (!isNumeric(total) || !isNumeric(element)) {
+                                throw std::runtime_error(
+                                    "sum expects a numeric array");
+                              }
+                              return ValueHelper::add(total, element);
+                            });
+}
+
+template <bool Max> Value extremeAlongBuiltin(const BuiltinArguments &args) {
+  const char *name = Max ? "max" : "min";
+  const ArrayValue &array =
+      arrayArgument(args[0], std::string(name) + " expects an array");
+  AxisSplit split = splitAxis(name, array, args[1]);
+  if (split.n == 0 && split.outer * split.inner > 0) {
+    throw std::runtime_error(std::string(name) + " along an empty axis");
+  }
+  if (split.shape.empty()) {
+    return extremeOf<Max>(args[0]);
+  }
+
+  Value result;
+  if (visitNumeric(array, [&](const auto &buffer) {
+        result = extremeAlong<Max>(buffer, array.elementType(), split);
+      })) {
+    return result;
+  }
+  return reduceAlongGeneric(array, split, array.elementType(), nullptr,
+                            [](Value m, Value element) {
+                              bool better =
+                                  Max ? ValueHelper::greaterThan(element, m)
+                                      : ValueHelper::lessThan(element, m);
+                              return better ? element : m;
+                            });
+}
+
+Value sumBuiltin(const BuiltinArguments &args) {
+  if (args.size() == 2) {
+    return sumAlongBuiltin(args);
+  }
+  expectArguments("sum", args, 1);
+  return sumOf(args[0]);
+}
+
+template <bool Max> Value extremeBuiltin(const BuiltinArguments &args) {
+  if (args.size() == 2) {
+    return extremeAlongBuiltin<Max>(args);
+  }
+  expectArguments(Max ? "max" : "min", args, 1);
+  return extremeOf<Max>(args[0]);
+}
+
+Value dotBuiltin(const BuiltinArguments &args) {
+  expectArguments("dot", args, 2);
+  const ArrayValue &a = arrayArgument(args[0], "dot expects two arrays");
+  const ArrayValue &b = arrayArgument(args[1], "dot expects two arrays");
+  if (!isNumericType(a.elementType()) || !isNumericType(b.elementType())) {
+    throw std::runtime_error("dot expects numeric arrays");
+  }
+  if (a.size() != b.size()) {
+    throw std::runtime_error("dot expects arrays of the same length");
+  }
+
+  auto ai = a.elements<int32_t>();
+  auto bi = b.elements<int32_t>();
+  if (ai && bi) {
+    return static_cast<int64_t>(dot(ai.data(), bi.data(), ai.size()));
+  }
+  auto ad = a.elements<double>();
+  auto bd = b.elements<double>();
+  if (ad && bd) {
+    return dot(ad.data(), bd.data(), ad.size());
+  }
+
+  // Other combinations multiply element by element, in double if either
+  // side has doubles, otherwise in wrapping 64-bit integers
+  std::vector<Value> left = a.toValues();
+  std::vector<Value> right = b.toValues();
+  bool anyDouble = a.elementType() == DataType::DOUBLE ||
+                   b.elementType() == DataType::DOUBLE;
+  for (size_t i = 0; i < left.size(); ++i) {
+    if (!isNumeric(left[i]) || !isNumeric(right[i])) {
+      throw std::runtime_error("dot expects numeric arrays");
+    }
+    anyDouble = anyDouble || std::holds_alternative<double>(left[i]) ||
+                std::holds_alternative<double>(right[i]);
+  }
+  if (anyDouble) {
+    double total = 0.0;
+    for (size_t i = 0; i < left.size(); ++i) {
+      total += ValueHelper::toDouble(left[i]) * ValueHelper::toDouble(right[i]);
+    }
+    return total;
+  }
+  uint64_t total = 0;
+  for (size_t i = 0; i < left.size(); ++i) {
+    total += static_cast<uint64_t>(ValueHelper::toInt64(left[i])) *
+             static_cast<uint64_t>(ValueHelper::toInt64(right[i]));
+  }
+  if (isUnsignedType(a.elementType()) || isUnsignedType(b.elementType())) {
+    return total;
+  }
+  return static_cast<int64_t>(total);
+}
+
+// How elements of type T compare against a numeric needle
+enum class Needle {
+  EXACT,   // an element matches iff it equals the converted needle
+  NONE,    // no element of type T can match
+  GENERIC, // needs ValueHelper::equals per element
+};
+
+// Converts needle to the T that elements must hold to compare equal to it
+// under ValueHelper::equals
+template <typename T> Needle convertNeedle(const Value &needle, T &out) {
+  if constexpr (std::is_same_v<T, double>) {
+    out = ValueHelper::toDouble(needle);
+    return Needle::EXACT;
+  } else {
+    if (std::holds_alternative<double>(needle)) {
+      // Only elements below 2^53 convert to double exactly
+      if constexpr (sizeof(T) == 8) {
+        return Needle::GENERIC;
+      } else {
+        double d = std::get<double>(needle);
+        if (!(d >= static_cast<double>(std::numeric_limits<T>::min()) &&
+              d <= static_cast<double>(std::numeric_limits<T>::max())) ||
+            std::trunc(d) != d) {
+          return Needle::NONE;
+        }
+        out = static_cast<T>(d);
+        return Needle::EXACT;
+      }
+    }
+    // Integers compare as int64
+    int64_t n = ValueHelper::toInt64(needle);
+    if constexpr (sizeof(T) < 8) {
+      if (n < static_cast<int64_t>(std::numeric_limits<T>::min()) ||
+          n > static_cast<int64_t>(std::numeric_limits<T>::max())) {
+        return Needle::NONE;
+      }
+    }
+    out = static_cast<T>(n);
+    return Needle::EXACT;
+  }
+}
+
+// Counts matches, or finds the first one when first is set
+int64_t search(const ArrayValue &array, const Value &needle, bool first) {
+  if (isNumeric(needle)) {
+    int64_t result = 0;
+    Needle kind = Needle::GENERIC;
+    visitNumeric(array, [&](const auto &buffer) {
+      using T = typename std::decay_t<decltype(buffer)>::value_type;
+      T want{};
+      kind = convertNeedle(needle, want);
+      if (kind == Needle::EXACT) {
+        result = first ? indexOf(buffer.data(), buffer.size(), want)
+                       : static_cast<int64_t>(
+                             count(buffer.data(), buffer.size(), want));
+      }
+    });
+    if (kind == Needle::EXACT) {
+      return result;
+    }
+    if (kind == Needle::NONE) {
+      return first ? -1 : 0;
+    }
+  }
+
+  int64_t matches = 0;
+  for (size_t i = 0; i < array.size(); ++i) {
+    if (ValueHelper::equals(array.get(i), needle)) {
+      if (first) {
+        return static_cast<int64_t>(i);
+      }
+      ++matches;
+    }
+  }
+  return first ? -1 : matches;
+}
+
+// count_if_eq, or index_of when First is set
+template <bool First> Value searchBuiltin(const BuiltinArguments &args) {
+  std::string name = First ? "index_of" : "count_if_eq";
+  expectArguments(name, args, 2);
+  const ArrayValue &array =
+      arrayArgument(args[0], name + " expects an array as first argument");
+  if (ValueHelper::isArray(args[1])) {
+    throw std::runtime_error(name + " expects a scalar to search for");
+  }
+  return ValueHelper::createValue(DataType::INT32,
+                                  search(array, args[1], First));
+}
+
+int64_t sliceBound(const Value &value) {
+  if (!isNumeric(value) || std::holds_alternative<double>(value)) {
+    throw std::runtime_error("slice expects integer bounds");
+  }
+  // Huge uint64 bounds stay out of range rather than wrapping negative
+  if (const auto *big = std::get_if<uint64_t>(&value)) {
+    return static_cast<int64_t>(
+        std::min<uint64_t>(*big, std::numeric_limits<int64_t>::max()));
+  }
+  return ValueHelper::toInt64(value);
+}
+
+Value sliceBuiltin(const BuiltinArguments &args) {
+  expectArguments("slice", args, 3);
+  const ArrayValue &array =
+      arrayArgument(args[0], "slice expects an array as first argument");
+  int64_t start = sliceBound(args[1]);
+  int64_t end = sliceBound(args[2]);
+  auto size = static_cast<int64_t>(array.length());
+  if (start < 0 || start > end || end > size) {
+    throw std::runtime_error("slice range [" + std::to_string(start) + ", " +
+                             std::to_string(end) +
+                             ") out of bounds for length " +
+                             std::to_string(size));
+  }
+  return ArrayValue::slice(std::get<ArrayPtr>(args[0]),
+                           static_cast<size_t>(start),
+                           static_cast<size_t>(end));
+}
+
+// Extents args[first...], which must hold `count` elements between them
+std::vector<size_t> shapeArguments(const std::string &name,
+                                   const BuiltinArguments &args,
+                                   size_t first, size_t &count) {
+  std::vector<size_t> shape;
+  count = 1;
+  for (size_t i = first; i < args.size(); ++i) {
+    if (!isNumeric(args[i]) || std::holds_alternative<double>(args[i])) {
+      throw std::runtime_error(name + " expects integer extents");
+    }
+    int64_t extent = ValueHelper::toInt64(args[i]);
+    if (extent < 0) {
+      throw std::runtime_error(name + " expects non-negative extents");
+    }
+    auto e = static_cast<size_t>(extent);
+    if (e != 0 && count > std::numeric_limits<size_t>::max() / e) {
+      throw std::runtime_error(name + " shape is too large");
+    }
+    count *= e;
+    shape.push_back(e);
+  }
+  return shape;
+}
+
+Value reshapeBuiltin(const BuiltinArguments &args) {
+  if (args.size() < 2) {
+    throw std::runtime_error("reshape expects an array and its new extents");
+  }
+  const ArrayValue &array =
+      arrayArgument(args[0], "reshape expects an array as first argument");
+  size_t count = 0;
+  std::vector<size_t> shape = shapeArguments("reshape", args, 1, count);
+  if (count != array.size()) {
+    throw std::runtime_error("reshape of " + std::to_string(array.size()) +
+                             " elements to a shape of " +
+                             std::to_string(count));
+  }
+  return ArrayValue::view(std::get<ArrayPtr>(args[0]), 0, count,
+                          std::move(shape));
+}
+
+Value fullBuiltin(const BuiltinArguments &args) {
+  if (args.size() < 2) {
+    throw std::runtime_error("full expects a value and at least one extent");
+  }
+  size_t count = 0;
+  std::vector<size_t> shape = shapeArguments("full", args, 1, count);
+  auto type = static_cast<DataType>(args[0].index());
+  ArrayValue::Storage storage = std::visit(
+      [&](const auto &value) -> ArrayValue::Storage {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_arithmetic_v<T> ||
+                      std::is_same_v<T, std::string>) {
+          return std::vector<T>(count, value);
+        } else {
+          throw std::runtime_error("full expects a scalar value");
+        }
+      },
+      args[0]);
+  return std::make_shared<ArrayValue>(type, std::move(storage),
+                                      std::move(shape));
+}
+
+Value rankBuiltin(const BuiltinArguments &args) {
+  expectArguments("rank", args, 1);
+  const ArrayValue &array = arrayArgument(args[0], "rank expects an array");
+  return ValueHelper::createValue(DataType::INT32,
+                                  static_cast<int64_t>(array.rank()));
+}
+
+Value shapeBuiltin(const BuiltinArguments &args) {
+  expectArguments("shape", args, 1);
+  const ArrayValue &array = arrayArgument(args[0], "shape expects an array");
+  std::vector<int32_t> extents;
+  for (size_t extent : array.shape()) {
+    extents.push_back(static_cast<int32_t>(extent));
+  }
+  return std::make_shared<ArrayValue>(DataType::INT32,
+                                      ArrayValue::Storage(std::move(extents)));
+}
+
+} // namespace
+
+bool ArrayBuiltins::isBuiltin(const std::string &name) {
+  return find(name) != nullptr;
+}
+
+BuiltinFunction ArrayBuiltins::find(const std::string &name) {
+  if (name == "sum") {
+    return sumBuiltin;
+  }
+  if (name == "min") {
+    return extremeBuiltin<false>;
+  }
+  if (name == "max") {
+    return extremeBuiltin<true>;
+  }
+  if (name == "dot") {
+    return dotBuiltin;
+  }
+  if (name == "count_if_eq") {
+    return searchBuiltin<false>;
+  }
+  if (name == "index_of") {
+    return searchBuiltin<true>;
+  }
+  if (name == "slice") {
+    return sliceBuiltin;
+  }
+  if (name == "reshape") {
+    return reshapeBuiltin;
+  }
+  if (name == "full") {
+    return fullBuiltin;
+  }
+  if (name == "rank") {
+    return rankBuiltin;
+  }
+  if (name == "shape") {
+    return shapeBuiltin;
+  }
+  return nullptr;
+}
+
+Value ArrayBuiltins::call(const std::string &name,
+                          const std::vector<Value> &args) {
+  BuiltinFunction builtin = find(name);
+  if (!builtin) {
+    throw std::runtime_error("Undefined function: " + name);
+  }
+  return builtin(BuiltinArguments(args));
+}
+
+SimdLevel ArrayBuiltins::detectedSimdLevel() {
+  static const SimdLevel level = detect();
+  return level;
+}
+
+SimdLevel ArrayBuiltins::simdLevel() {
+  return selectedLevel().load(std::memory_order_relaxed);
+}
+
+void ArrayBuiltins::setSimdLevel(SimdLevel level) {
+  SimdLevel detected = detectedSimdLevel();
+  selectedLevel().store(level < detected ? level : detected,
+                        std::memory_order_relaxed);
+}
+
+const char *ArrayBuiltins::simdLevelName(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::SCALAR:
+    return "scalar";
+  case SimdLevel::SSE2:
+    return "sse2";
+  case SimdLevel::AVX2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+} // namespace Script
@@ -0,0 +1,176 @@
+#include "AstCloner.h"
+
+namespace Script {
+
+namespace {
+
+// A copy of node sharing its children, which the caller replaces
+template <typename T, typename Base>
+std::shared_ptr<T> copy(const std::shared_ptr<Base> &node) {
+  return std::make_shared<T>(static_cast<const T &>(*node));
+}
+
+void cloneAll(std::vector<ExprPtr> &exprs) {
+  for (auto &expr : exprs) {
+    expr = AstCloner::clone(expr);
+  }
+}
+
+void cloneAll(std::vector<StmtPtr> &stmts) {
+  for (auto &stmt : stmts) {
+    stmt = AstCloner::clone(stmt);
+  }
+}
+
+} // namespace
+
+ExprPtr AstCloner::clone(const ExprPtr &expr) {
+  if (!expr) {
+    return expr;
+  }
+
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+    return copy<LiteralExpr>(expr);
+  case NodeKind::VARIABLE:
+    return copy<VariableExpr>(expr);
+  case NodeKind::BINARY: {
+    auto binary = copy<BinaryExpr>(expr);
+    binary->left = clone(binary->left);
+    binary->right = clone(binary->right);
+    return binary;
+  }
+  case NodeKind::UNARY: {
+    auto unary = copy<UnaryExpr>(expr);
+    unary->operand = clone(unary->operand);
+    return unary;
+  }
+  case NodeKind::CALL: {
+    auto call = copy<CallExpr>(expr);
+    cloneAll(call->arguments);
+    call->inlined = clone(call->inlined);
+    return call;
+  }
+  case NodeKind::CONDITIONAL: {
+    auto cond = copy<ConditionalExpr>(expr);
+    cond->condition = clone(cond->condition);
+    cond->thenExpr = clone(cond->thenExpr);
+    cond->elseExpr = clone(cond->elseExpr);
+    return cond;
+  }
+  case NodeKind::ARRAY_LITERAL: {
+    auto array = copy<ArrayLiteralExpr>(expr);
+    cloneAll(array->elements);
+    return array;
+  }
+  case NodeKind::INDEX: {
+    auto index = copy<IndexExpr>(expr);
+    index->arrayExpr = clone(index->arrayExpr);
+    index->indexExpr = clone(index->indexExpr);
+    return index;
+  }
+  case NodeKind::FIELD: {
+    auto field = copy<FieldExpr>(expr);
+    field->object = clone(field->object);
+    return field;
+  }
+  case NodeKind::RECORD: {
+    auto record = copy<RecordExpr>(expr);
+    cloneAll(record->fields);
+    return record;
+  }
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+}
+
+StmtPtr AstCloner::clone(const StmtPtr &stmt) {
+  if (!stmt) {
+    return stmt;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT: {
+    auto exprStmt = copy<ExpressionStmt>(stmt);
+    exprStmt->expression = clone(exprStmt->expression);
+    return exprStmt;
+  }
+  case NodeKind::VAR_DECL: {
+    auto decl = copy<VarDeclStmt>(stmt);
+    decl->initializer = clone(decl->initializer);
+    return decl;
+  }
+  case NodeKind::ASSIGN: {
+    auto assign = copy<AssignStmt>(stmt);
+    assign->value = clone(assign->value);
+    return assign;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    auto assign = copy<IndexAssignStmt>(stmt);
+    assign->arrayExpr = clone(assign->arrayExpr);
+    assign->indexExpr = clone(assign->indexExpr);
+    assign->value = clone(assign->value);
+    return assign;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto assign = copy<FieldAssignStmt>(stmt);
+    assign->object = clone(assign->object);
+    assign->value = clone(assign->value);
+    return assign;
+  }
+  case NodeKind::BLOCK: {
+    auto block = copy<BlockStmt>(stmt);
+    cloneAll(block->statements);
+    return block;
+  }
+  case NodeKind::IF: {
+    auto ifStmt = copy<IfStmt>(stmt);
+    ifStmt->condition = clone(ifStmt->condition);
+    ifStmt->thenBranch = clone(ifStmt->thenBranch);
+    ifStmt->elseBranch = clone(ifStmt->elseBranch);
+    return ifStmt;
+  }
+  case NodeKind::WHILE: {
+    auto loop = copy<WhileStmt>(stmt);
+    loop->condition = clone(loop->condition);
+    loop->body = clone(loop->body);
+    return loop;
+  }
+  case NodeKind::FOR: {
+    auto loop = copy<ForStmt>(stmt);
+    loop->initializer = clone(loop->initializer);
+    loop->condition = clone(loop->condition);
+    loop->increment = clone(loop->increment);
+    loop->body = clone(loop->body);
+    return loop;
+  }
+  case NodeKind::DO_WHILE: {
+    auto loop = copy<DoWhileStmt>(stmt);
+    loop->body = clone(loop->body);
+    loop->condition = clone(loop->condition);
+    return loop;
+  }
+  case NodeKind::SWITCH: {
+    auto switchStmt = copy<SwitchStmt>(stmt);
+    switchStmt->expression = clone(switchStmt->expression);
+    for (auto &switchCase : switchStmt->cases) {
+      switchCase.matchExpr = clone(switchCase.matchExpr);
+      cloneAll(switchCase.statements);
+    }
+    return switchStmt;
+  }
+  case NodeKind::RETURN: {
+    auto ret = copy<ReturnStmt>(stmt);
+    ret->value = clone(ret->value);
+    return ret;
+  }
+  case NodeKind::BREAK:
+    return copy<BreakStmt>(stmt);
+  case NodeKind::CONTINUE:
+    return copy<ContinueStmt>(stmt);
+  default:
+    throw std::runtime_error("Unknown statement type");
+  }
+}
+
+} // namespace Script
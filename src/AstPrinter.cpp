@@ -0,0 +1,442 @@
+#include "AstPrinter.h"
+#include <cstdio>
+
+namespace Script {
+
+namespace {
+
+const char *binaryOperator(BinaryExpr::Operator op) {
+  switch (op) {
+  case BinaryExpr::Operator::ADD:
+    return "+";
+  case BinaryExpr::Operator::SUBTRACT:
+    return "-";
+  case BinaryExpr::Operator::MULTIPLY:
+    return "*";
+  case BinaryExpr::Operator::DIVIDE:
+    return "/";
+  case BinaryExpr::Operator::MODULO:
+    return "%";
+  case BinaryExpr::Operator::EQUAL:
+    return "==";
+  case BinaryExpr::Operator::NOT_EQUAL:
+    return "!=";
+  case BinaryExpr::Operator::LESS_THAN:
+    return "<";
+  case BinaryExpr::Operator::GREATER_THAN:
+    return ">";
+  case BinaryExpr::Operator::LESS_EQUAL:
+    return "<=";
+  case BinaryExpr::Operator::GREATER_EQUAL:
+    return ">=";
+  case BinaryExpr::Operator::LOGICAL_AND:
+    return "&&";
+  case BinaryExpr::Operator::LOGICAL_OR:
+    return "||";
+  case BinaryExpr::Operator::BIT_AND:
+    return "&";
+  case BinaryExpr::Operator::BIT_OR:
+    return "|";
+  case BinaryExpr::Operator::BIT_XOR:
+    return "^";
+  case BinaryExpr::Operator::LSHIFT:
+    return "<<";
+  case BinaryExpr::Operator::RSHIFT:
+    return ">>";
+  }
+  return "?";
+}
+
+const char *assignOperator(AssignStmt::Operator op) {
+  switch (op) {
+  case AssignStmt::Operator::ASSIGN:
+    return "=";
+  case AssignStmt::Operator::PLUS_ASSIGN:
+    return "+=";
+  case AssignStmt::Operator::MINUS_ASSIGN:
+    return "-=";
+  case AssignStmt::Operator::MULT_ASSIGN:
+    return "*=";
+  case AssignStmt::Operator::DIV_ASSIGN:
+    return "/=";
+  }
+  return "?";
+}
+
+// A literal as the Lexer would read it back
+std::string literal(const Value &value) {
+  if (auto *s = std::get_if<std::string>(&value)) {
+    std::string out = "\"";
+    for (char c : *s) {
+      switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\0':
+        out += "\\0";
+        break;
+      default:
+        out += c;
+      }
+    }
+    return out + "\"";
+  }
+  if (auto *d = std::get_if<double>(&value)) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", *d);
+    std::string out = buffer;
+    if (out.find_first_of(".eni") == std::string::npos) {
+      out += ".0";
+    }
+    return out;
+  }
+  return ValueHelper::toString(value);
+}
+
+} // namespace
+
+std::string AstPrinter::print(const Script &script) {
+  AstPrinter printer;
+  std::ostringstream &out = printer._out;
+  for (const auto &type : script.structs) {
+    out << "struct " << type->name << " {";
+    for (size_t i = 0; i < type->fieldNames.size(); ++i) {
+      out << "\n    " << ValueHelper::typeToString(type->fieldTypes[i]) << " "
+          << type->fieldNames[i] << ";";
+    }
+    out << "\n}\n";
+  }
+  for (const auto &proc : script.procedures) {
+    printer.procedure(*proc);
+  }
+  return printer._out.str();
+}
+
+std::string AstPrinter::print(const ProcedureDecl &proc) {
+  AstPrinter printer;
+  printer.procedure(proc);
+  return printer._out.str();
+}
+
+std::string AstPrinter::print(const Expression &expr) {
+  AstPrinter printer;
+  printer.expression(expr);
+  return printer._out.str();
+}
+
+void AstPrinter::procedure(const ProcedureDecl &proc) {
+  _out << ValueHelper::typeToString(proc.returnType) << " " << proc.name
+       << "(";
+  for (size_t i = 0; i < proc.parameters.size(); ++i) {
+    _out << (i ? ", " : "")
+         << ValueHelper::typeToString(proc.parameters[i].type) << " "
+         << proc.parameters[i].name;
+  }
+  _out << ")";
+  if (!proc.body) {
+    // Native procedures have no body
+    _out << ";\n";
+    return;
+  }
+  body(*proc.body);
+  _out << "\n";
+}
+
+void AstPrinter::line() {
+  _out << "\n" << std::string(static_cast<size_t>(_indent) * 4, ' ');
+}
+
+void AstPrinter::body(const Statement &stmt) {
+  if (stmt.kind == NodeKind::BLOCK) {
+    _out << " ";
+    statement(stmt);
+    return;
+  }
+  ++_indent;
+  line();
+  statement(stmt);
+  --_indent;
+}
+
+void AstPrinter::simple(const Statement &stmt) {
+  switch (stmt.kind) {
+  case NodeKind::EXPRESSION_STMT:
+    expression(*static_cast<const ExpressionStmt &>(stmt).expression);
+    break;
+  case NodeKind::VAR_DECL: {
+    const auto &varDecl = static_cast<const VarDeclStmt &>(stmt);
+    _out << ValueHelper::typeToString(varDecl.type) << " " << varDecl.name;
+    if (varDecl.initializer) {
+      _out << " = ";
+      expression(*varDecl.initializer);
+    }
+    break;
+  }
+  case NodeKind::ASSIGN: {
+    const auto &assign = static_cast<const AssignStmt &>(stmt);
+    _out << assign.variableName << " " << assignOperator(assign.op) << " ";
+    expression(*assign.value);
+    break;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    const auto &idxAssign = static_cast<const IndexAssignStmt &>(stmt);
+    operand(*idxAssign.arrayExpr);
+    _out << "[";
+    expression(*idxAssign.indexExpr);
+    _out << "] = ";
+    expression(*idxAssign.value);
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    const auto &fieldAssign = static_cast<const FieldAssignStmt &>(stmt);
+    operand(*fieldAssign.object);
+    _out << "." << fieldAssign.field << " = ";
+    expression(*fieldAssign.value);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void AstPrinter::statement(const Statement &stmt) {
+  switch (stmt.kind) {
+  case NodeKind::EXPRESSION_STMT:
+  case NodeKind::VAR_DECL:
+  case NodeKind::ASSIGN:
+  case NodeKind::INDEX_ASSIGN:
+  case NodeKind::FIELD_ASSIGN:
+    simple(stmt);
+    _out << ";";
+    break;
+  case NodeKind::BLOCK: {
+    _out << "{";
+    ++_indent;
+    for (const auto &s : static_cast<const BlockStmt &>(stmt).statements) {
+      line();
+      statement(*s);
+    }
+    --_indent;
+    line();
+    _out << "}";
+    break;
+  }
+  case NodeKind::IF: {
+    const auto &ifStmt = static_cast<const IfStmt &>(stmt);
+    _out << "if (";
+    expression(*ifStmt.condition);
+    _out << ")";
+    body(*ifStmt.thenBranch);
+    if (ifStmt.elseBranch) {
+      if (ifStmt.thenBranch->kind == NodeKind::BLOCK) {
+        _out << " ";
+      } else {
+        line();
+      }
+      _out << "else";
+      body(*ifStmt.elseBranch);
+    }
+    break;
+  }
+  case NodeKind::WHILE: {
+    const auto &whileStmt = static_cast<const WhileStmt &>(stmt);
+    _out << "while (";
+    expression(*whileStmt.condition);
+    _out << ")";
+    body(*whileStmt.body);
+    break;
+  }
+  case NodeKind::FOR: {
+    const auto &forStmt = static_cast<const ForStmt &>(stmt);
+    _out << "for (";
+    if (forStmt.initializer) {
+      simple(*forStmt.initializer);
+    }
+    _out << ";";
+    if (forStmt.condition) {
+      _out << " ";
+      expression(*forStmt.condition);
+    }
+    _out << ";";
+    if (forStmt.increment) {
+      _out << " ";
+      simple(*forStmt.increment);
+    }
+    _out << ")";
+    body(*forStmt.body);
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    const auto &doWhile = static_cast<const DoWhileStmt &>(stmt);
+    _out << "do";
+    body(*doWhile.body);
+    if (doWhile.body->kind == NodeKind::BLOCK) {
+      _out << " ";
+    } else {
+      line();
+    }
+    _out << "while (";
+    expression(*doWhile.condition);
+    _out << ");";
+    break;
+  }
+  case NodeKind::SWITCH: {
+    const auto &switchStmt = static_cast<const SwitchStmt &>(stmt);
+    _out << "switch (";
+    expression(*switchStmt.expression);
+    _out << ") {";
+    ++_indent;
+    for (const auto &caseEntry : switchStmt.cases) {
+      line();
+      if (caseEntry.isDefault) {
+        _out << "default:";
+      } else {
+        _out << "case ";
+        expression(*caseEntry.matchExpr);
+        _out << ":";
+      }
+      ++_indent;
+      for (const auto &s : caseEntry.statements) {
+        line();
+        statement(*s);
+      }
+      --_indent;
+    }
+    --_indent;
+    line();
+    _out << "}";
+    break;
+  }
+  case NodeKind::RETURN: {
+    const auto &ret = static_cast<const ReturnStmt &>(stmt);
+    _out << "return";
+    if (ret.value) {
+      _out << " ";
+      expression(*ret.value);
+    }
+    _out << ";";
+    break;
+  }
+  case NodeKind::BREAK:
+    _out << "break;";
+    break;
+  case NodeKind::CONTINUE:
+    _out << "continue;";
+    break;
+  default:
+    break;
+  }
+}
+
+void AstPrinter::operand(const Expression &expr) {
+  if (expr.kind == NodeKind::BINARY || expr.kind == NodeKind::CONDITIONAL) {
+    _out << "(";
+    expression(expr);
+    _out << ")";
+    return;
+  }
+  expression(expr);
+}
+
+void AstPrinter::expression(const Expression &expr) {
+  switch (expr.kind) {
+  case NodeKind::LITERAL:
+    _out << literal(static_cast<const LiteralExpr &>(expr).value);
+    break;
+  case NodeKind::VARIABLE:
+    _out << static_cast<const VariableExpr &>(expr).name;
+    break;
+  case NodeKind::BINARY: {
+    const auto &bin = static_cast<const BinaryExpr &>(expr);
+    operand(*bin.left);
+    _out << " " << binaryOperator(bin.op) << " ";
+    operand(*bin.right);
+    break;
+  }
+  case NodeKind::UNARY: {
+    const auto &unary = static_cast<const UnaryExpr &>(expr);
+    switch (unary.op) {
+    case UnaryExpr::Operator::NEGATE:
+      _out << "-";
+      break;
+    case UnaryExpr::Operator::LOGICAL_NOT:
+      _out << "!";
+      break;
+    case UnaryExpr::Operator::BIT_NOT:
+      _out << "~";
+      break;
+    }
+    operand(*unary.operand);
+    break;
+  }
+  case NodeKind::CALL: {
+    const auto &call = static_cast<const CallExpr &>(expr);
+    _out << call.functionName << "(";
+    for (size_t i = 0; i < call.arguments.size(); ++i) {
+      _out << (i ? ", " : "");
+      expression(*call.arguments[i]);
+    }
+    _out << ")";
+    break;
+  }
+  case NodeKind::CONDITIONAL: {
+    const auto &cond = static_cast<const ConditionalExpr &>(expr);
+    operand(*cond.condition);
+    _out << " ? ";
+    operand(*cond.thenExpr);
+    _out << " : ";
+    operand(*cond.elseExpr);
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL: {
+    const auto &array = static_cast<const ArrayLiteralExpr &>(expr);
+    _out << "[";
+    for (size_t i = 0; i < array.elements.size(); ++i) {
+      _out << (i ? ", " : "");
+      expression(*array.elements[i]);
+    }
+    _out << "]";
+    break;
+  }
+  case NodeKind::INDEX: {
+    const auto &idx = static_cast<const IndexExpr &>(expr);
+    operand(*idx.arrayExpr);
+    _out << "[";
+    expression(*idx.indexExpr);
+    _out << "]";
+    break;
+  }
+  case NodeKind::FIELD: {
+    const auto &field = static_cast<const FieldExpr &>(expr);
+    operand(*field.object);
+    _out << "." << field.field;
+    break;
+  }
+  case NodeKind::RECORD: {
+    const auto &record = static_cast<const RecordExpr &>(expr);
+    _out << record.type->name << "(";
+    for (size_t i = 0; i < record.fields.size(); ++i) {
+      _out << (i ? ", " : "");
+      expression(*record.fields[i]);
+    }
+    _out << ")";
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+} // namespace Script
@@ -0,0 +1,901 @@
+#include "Bytecode.h"
+#include "TypeChecker.h"
+#include <sstream>
+
+namespace Script {
+
+namespace {
+
+const char *opCodeName(OpCode op) {
+  switch (op) {
+  case OpCode::LOAD_CONST:
+    return "LOAD_CONST";
+  case OpCode::MOVE:
+    return "MOVE";
+  case OpCode::LOAD_EXTERNAL:
+    return "LOAD_EXTERNAL";
+  case OpCode::STORE_EXTERNAL:
+    return "STORE_EXTERNAL";
+  case OpCode::NEW_ARRAY:
+    return "NEW_ARRAY";
+  case OpCode::NEW_MAP:
+    return "NEW_MAP";
+  case OpCode::NEW_STRING_BUILDER:
+    return "NEW_STRING_BUILDER";
+  case OpCode::NEW_RECORD:
+    return "NEW_RECORD";
+  case OpCode::ARRAY_LITERAL:
+    return "ARRAY_LITERAL";
+  case OpCode::CONVERT:
+    return "CONVERT";
+  case OpCode::CHECK_TYPE:
+    return "CHECK_TYPE";
+  case OpCode::OWN_ARRAY:
+    return "OWN_ARRAY";
+  case OpCode::ADD:
+    return "ADD";
+  case OpCode::SUBTRACT:
+    return "SUBTRACT";
+  case OpCode::MULTIPLY:
+    return "MULTIPLY";
+  case OpCode::DIVIDE:
+    return "DIVIDE";
+  case OpCode::MODULO:
+    return "MODULO";
+  case OpCode::EQUAL:
+    return "EQUAL";
+  case OpCode::NOT_EQUAL:
+    return "NOT_EQUAL";
+  case OpCode::LESS_THAN:
+    return "LESS_THAN";
+  case OpCode::GREATER_THAN:
+    return "GREATER_THAN";
+  case OpCode::LESS_EQUAL:
+    return "LESS_EQUAL";
+  case OpCode::GREATER_EQUAL:
+    return "GREATER_EQUAL";
+  case OpCode::BIT_AND:
+    return "BIT_AND";
+  case OpCode::BIT_OR:
+    return "BIT_OR";
+  case OpCode::BIT_XOR:
+    return "BIT_XOR";
+  case OpCode::LSHIFT:
+    return "LSHIFT";
+  case OpCode::RSHIFT:
+    return "RSHIFT";
+  case OpCode::NEGATE:
+    return "NEGATE";
+  case OpCode::LOGICAL_NOT:
+    return "LOGICAL_NOT";
+  case OpCode::BIT_NOT:
+    return "BIT_NOT";
+  case OpCode::TO_BOOL:
+    return "TO_BOOL";
+  case OpCode::JUMP:
+    return "JUMP";
+  case OpCode::JUMP_IF_FALSE:
+    return "JUMP_IF_FALSE";
+  case OpCode::JUMP_IF_TRUE:
+    return "JUMP_IF_TRUE";
+  case OpCode::CHECK_ARRAY:
+    return "CHECK_ARRAY";
+  case OpCode::INDEX:
+    return "INDEX";
+  case OpCode::CHECK_INDEX:
+    return "CHECK_INDEX";
+  case OpCode::STORE_INDEX:
+    return "STORE_INDEX";
+  case OpCode::INDEX_ND:
+    return "INDEX_ND";
+  case OpCode::STORE_INDEX_ND:
+    return "STORE_INDEX_ND";
+  case OpCode::LEN:
+    return "LEN";
+  case OpCode::PUSH:
+    return "PUSH";
+  case OpCode::POP:
+    return "POP";
+  case OpCode::GET_FIELD:
+    return "GET_FIELD";
+  case OpCode::UNSHARE_FIELD:
+    return "UNSHARE_FIELD";
+  case OpCode::SET_FIELD:
+    return "SET_FIELD";
+  case OpCode::CALL:
+    return "CALL";
+  case OpCode::INLINED:
+    return "INLINED";
+  case OpCode::RETURN:
+    return "RETURN";
+  case OpCode::RETURN_NONE:
+    return "RETURN_NONE";
+  case OpCode::RAISE:
+    return "RAISE";
+  }
+  return "?";
+}
+
+OpCode binaryOpCode(BinaryExpr::Operator op) {
+  switch (op) {
+  case BinaryExpr::Operator::ADD:
+    return OpCode::ADD;
+  case BinaryExpr::Operator::SUBTRACT:
+    return OpCode::SUBTRACT;
+  case BinaryExpr::Operator::MULTIPLY:
+    return OpCode::MULTIPLY;
+  case BinaryExpr::Operator::DIVIDE:
+    return OpCode::DIVIDE;
+  case BinaryExpr::Operator::MODULO:
+    return OpCode::MODULO;
+  case BinaryExpr::Operator::EQUAL:
+    return OpCode::EQUAL;
+  case BinaryExpr::Operator::NOT_EQUAL:
+    return OpCode::NOT_EQUAL;
+  case BinaryExpr::Operator::LESS_THAN:
+    return OpCode::LESS_THAN;
+  case BinaryExpr::Operator::GREATER_THAN:
+    return OpCode::GREATER_THAN;
+  case BinaryExpr::Operator::LESS_EQUAL:
+    return OpCode::LESS_EQUAL;
+  case BinaryExpr::Operator::GREATER_EQUAL:
+    return OpCode::GREATER_EQUAL;
+  case BinaryExpr::Operator::BIT_AND:
+    return OpCode::BIT_AND;
+  case BinaryExpr::Operator::BIT_OR:
+    return OpCode::BIT_OR;
+  case BinaryExpr::Operator::BIT_XOR:
+    return OpCode::BIT_XOR;
+  case BinaryExpr::Operator::LSHIFT:
+    return OpCode::LSHIFT;
+  case BinaryExpr::Operator::RSHIFT:
+    return OpCode::RSHIFT;
+  case BinaryExpr::Operator::LOGICAL_AND:
+  case BinaryExpr::Operator::LOGICAL_OR:
+    break;
+  }
+  throw std::runtime_error("Logical operators have no direct opcode");
+}
+
+} // namespace
+
+std::string BytecodeProcedure::disassemble() const {
+  std::stringstream ss;
+  ss << "registers: " << registerCount << "\n";
+  for (size_t i = 0; i < code.size(); ++i) {
+    const auto &in = code[i];
+    ss << i << ": " << opCodeName(in.op) << " " << in.a << " " << in.b << " "
+       << in.c << "\n";
+  }
+  return ss.str();
+}
+
+BytecodePtr BytecodeCompiler::compile(const ProcedureDecl &proc) {
+  if (!proc.resolved) {
+    throw std::runtime_error("Procedure '" + proc.name +
+                             "' must be resolved before compilation");
+  }
+
+  auto result = std::make_shared<BytecodeProcedure>();
+  _out = result.get();
+  _jumps.clear();
+
+  // Frame slots from the resolver double as registers; temporaries go above
+  _nextRegister = static_cast<int32_t>(proc.frameSize);
+  _out->registerCount = proc.frameSize;
+
+  compileStatement(proc.body.get());
+
+  setPosition(&proc);
+  emit(OpCode::RETURN_NONE);
+
+  _out = nullptr;
+  return result;
+}
+
+size_t BytecodeCompiler::emit(OpCode op, int32_t a, int32_t b, int32_t c) {
+  _out->code.push_back(Instruction{op, a, b, c});
+  _out->positions.push_back(SourcePosition{_line, _column});
+  return _out->code.size() - 1;
+}
+
+void BytecodeCompiler::patch(size_t at, size_t target) {
+  Instruction &in = _out->code[at];
+  if (in.op == OpCode::JUMP) {
+    in.a = static_cast<int32_t>(target);
+  } else {
+    in.b = static_cast<int32_t>(target);
+  }
+}
+
+void BytecodeCompiler::setPosition(const ASTNode *node) {
+  _line = node->line;
+  _column = node->column;
+}
+
+int32_t BytecodeCompiler::allocRegister() {
+  int32_t reg = _nextRegister++;
+  if (static_cast<uint32_t>(_nextRegister) > _out->registerCount) {
+    _out->registerCount = static_cast<uint32_t>(_nextRegister);
+  }
+  return reg;
+}
+
+int32_t BytecodeCompiler::constant(const Value &value) {
+  _out->constants.push_back(value);
+  return static_cast<int32_t>(_out->constants.size() - 1);
+}
+
+int32_t BytecodeCompiler::type(const TypeInfo &info) {
+  for (size_t i = 0; i < _out->types.size(); ++i) {
+    if (_out->types[i] == info) {
+      return static_cast<int32_t>(i);
+    }
+  }
+  _out->types.push_back(info);
+  return static_cast<int32_t>(_out->types.size() - 1);
+}
+
+int32_t BytecodeCompiler::name(const std::string &text) {
+  for (size_t i = 0; i < _out->names.size(); ++i) {
+    if (_out->names[i] == text) {
+      return static_cast<int32_t>(i);
+    }
+  }
+  _out->names.push_back(text);
+  return static_cast<int32_t>(_out->names.size() - 1);
+}
+
+int32_t BytecodeCompiler::field(const std::string &name,
+                                std::shared_ptr<const StructType> structType,
+                                int32_t index) {
+  _out->fields.push_back(FieldSite{std::move(structType), index, name});
+  return static_cast<int32_t>(_out->fields.size() - 1);
+}
+
+void BytecodeCompiler::compileStatement(Statement *stmt) {
+  int32_t mark = _nextRegister;
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    compileOperand(static_cast<ExpressionStmt *>(stmt)->expression.get());
+    break;
+  case NodeKind::VAR_DECL:
+    compileVarDecl(static_cast<VarDeclStmt *>(stmt));
+    break;
+  case NodeKind::ASSIGN:
+    compileAssign(static_cast<AssignStmt *>(stmt));
+    break;
+  case NodeKind::INDEX_ASSIGN:
+    compileIndexAssign(static_cast<IndexAssignStmt *>(stmt));
+    break;
+  case NodeKind::FIELD_ASSIGN:
+    compileFieldAssign(static_cast<FieldAssignStmt *>(stmt));
+    break;
+  case NodeKind::BLOCK:
+    compileBlock(static_cast<BlockStmt *>(stmt));
+    break;
+  case NodeKind::IF:
+    compileIf(static_cast<IfStmt *>(stmt));
+    break;
+  case NodeKind::WHILE:
+    compileWhile(static_cast<WhileStmt *>(stmt));
+    break;
+  case NodeKind::FOR:
+    compileFor(static_cast<ForStmt *>(stmt));
+    break;
+  case NodeKind::DO_WHILE:
+    compileDoWhile(static_cast<DoWhileStmt *>(stmt));
+    break;
+  case NodeKind::SWITCH:
+    compileSwitch(static_cast<SwitchStmt *>(stmt));
+    break;
+  case NodeKind::RETURN:
+    compileReturn(static_cast<ReturnStmt *>(stmt));
+    break;
+  case NodeKind::BREAK:
+    compileBreak(static_cast<BreakStmt *>(stmt));
+    break;
+  case NodeKind::CONTINUE:
+    compileContinue(static_cast<ContinueStmt *>(stmt));
+    break;
+  default:
+    throw std::runtime_error("Unknown statement type");
+  }
+
+  freeRegisters(mark);
+}
+
+void BytecodeCompiler::compileVarDecl(VarDeclStmt *stmt) {
+  int32_t reg = stmt->slot;
+
+  setPosition(stmt);
+  if (stmt->initializer) {
+    compileExpression(stmt->initializer.get(), reg);
+    if (!stmt->initializerTyped) {
+      emit(OpCode::CONVERT, reg, reg, type(stmt->type));
+    } else if (TypeChecker::trusted(stmt->type)) {
+      emit(OpCode::CHECK_TYPE, reg, type(stmt->type));
+    }
+  } else if (stmt->type.isArray) {
+    TypeInfo element = stmt->type;
+    element.isArray = false;
+    emit(OpCode::NEW_ARRAY, reg, type(element));
+  } else if (stmt->type.isMap()) {
+    emit(OpCode::NEW_MAP, reg, type(stmt->type));
+  } else if (stmt->type.isStringBuilder()) {
+    emit(OpCode::NEW_STRING_BUILDER, reg);
+  } else if (stmt->type.isRecord()) {
+    emit(OpCode::NEW_RECORD, reg, type(stmt->type), -1);
+  } else {
+    emit(OpCode::LOAD_CONST, reg,
+         constant(ValueHelper::defaultValue(stmt->type)));
+  }
+}
+
+void BytecodeCompiler::compileAssign(AssignStmt *stmt) {
+  int32_t reg = stmt->slot;
+
+  if (reg >= 0 && stmt->op == AssignStmt::Operator::ASSIGN) {
+    compileExpression(stmt->value.get(), reg);
+    // Only arrays, or values of unknown type, may be arrays the host owns
+    const TypeInfo &type = stmt->value->staticType;
+    if (type.isArray || type.baseType == DataType::VOID) {
+      emit(OpCode::OWN_ARRAY, reg);
+    }
+    return;
+  }
+
+  int32_t value = compileOperand(stmt->value.get());
+  setPosition(stmt);
+
+  if (reg < 0) {
+    emit(OpCode::STORE_EXTERNAL, name(stmt->variableName), value,
+         static_cast<int32_t>(stmt->op));
+    return;
+  }
+
+  switch (stmt->op) {
+  case AssignStmt::Operator::ASSIGN:
+    break;
+  case AssignStmt::Operator::PLUS_ASSIGN:
+    emit(OpCode::ADD, reg, reg, value);
+    break;
+  case AssignStmt::Operator::MINUS_ASSIGN:
+    emit(OpCode::SUBTRACT, reg, reg, value);
+    break;
+  case AssignStmt::Operator::MULT_ASSIGN:
+    emit(OpCode::MULTIPLY, reg, reg, value);
+    break;
+  case AssignStmt::Operator::DIV_ASSIGN:
+    emit(OpCode::DIVIDE, reg, reg, value);
+    break;
+  }
+}
+
+void BytecodeCompiler::compileIndexAssign(IndexAssignStmt *stmt) {
+  if (stmt->arrayExpr->kind == NodeKind::INDEX) {
+    compileNestedIndexAssign(stmt);
+    return;
+  }
+  ArrayTarget target = compileArrayTarget(stmt->arrayExpr.get());
+  int32_t array = target.array;
+  setPosition(stmt);
+  emit(OpCode::CHECK_ARRAY, array, name("Index assignment on non-array value"),
+       unshare(stmt->arrayExpr.get()));
+
+  int32_t index = compileOperand(stmt->indexExpr.get());
+  setPosition(stmt);
+  emit(OpCode::CHECK_INDEX, array, index);
+
+  int32_t value = compileOperand(stmt->value.get());
+  setPosition(stmt);
+  unshareField(target);
+  emit(OpCode::STORE_INDEX, array, index, value);
+}
+
+void BytecodeCompiler::compileNestedIndexAssign(IndexAssignStmt *stmt) {
+  // m[i][j] = v writes into m itself; the indices and then the value go in
+  // consecutive registers
+  std::vector<ExprPtr> indices;
+  Expression *root = static_cast<IndexExpr *>(stmt->arrayExpr.get())
+                         ->indexChain(indices)
+                         .get();
+  indices.push_back(stmt->indexExpr);
+  ArrayTarget target = compileArrayTarget(root);
+  int32_t array = target.array;
+  setPosition(stmt);
+  emit(OpCode::CHECK_ARRAY, array, name("Index assignment on non-array value"),
+       unshare(root));
+
+  int32_t base = _nextRegister;
+  for (size_t i = 0; i <= indices.size(); ++i) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < indices.size(); ++i) {
+    compileExpression(indices[i].get(), base + static_cast<int32_t>(i));
+  }
+  int32_t value = base + static_cast<int32_t>(indices.size());
+  compileExpression(stmt->value.get(), value);
+  setPosition(stmt);
+  unshareField(target);
+  emit(OpCode::STORE_INDEX_ND, array, base, value);
+}
+
+void BytecodeCompiler::compileFieldAssign(FieldAssignStmt *stmt) {
+  int32_t record = compileOperand(stmt->object.get());
+  int32_t value = compileOperand(stmt->value.get());
+  setPosition(stmt);
+  emit(OpCode::SET_FIELD, record,
+       field(stmt->field, stmt->structType, stmt->index), value);
+}
+
+void BytecodeCompiler::compileBlock(BlockStmt *stmt) {
+  for (auto &statement : stmt->statements) {
+    compileStatement(statement.get());
+  }
+}
+
+void BytecodeCompiler::compileIf(IfStmt *stmt) {
+  int32_t cond = compileOperand(stmt->condition.get());
+  size_t elseJump = emit(OpCode::JUMP_IF_FALSE, cond);
+
+  compileStatement(stmt->thenBranch.get());
+
+  if (stmt->elseBranch) {
+    size_t endJump = emit(OpCode::JUMP);
+    patch(elseJump, here());
+    compileStatement(stmt->elseBranch.get());
+    patch(endJump, here());
+  } else {
+    patch(elseJump, here());
+  }
+}
+
+void BytecodeCompiler::compileWhile(WhileStmt *stmt) {
+  size_t loopStart = here();
+  int32_t mark = _nextRegister;
+  int32_t cond = compileOperand(stmt->condition.get());
+  size_t exitJump = emit(OpCode::JUMP_IF_FALSE, cond);
+  freeRegisters(mark);
+
+  _jumps.push_back(JumpContext{false, {}, {}});
+  compileStatement(stmt->body.get());
+  emit(OpCode::JUMP, static_cast<int32_t>(loopStart));
+
+  JumpContext context = std::move(_jumps.back());
+  _jumps.pop_back();
+  patch(exitJump, here());
+  patchLoopJumps(context, loopStart, here());
+}
+
+void BytecodeCompiler::compileFor(ForStmt *stmt) {
+  if (stmt->initializer) {
+    compileStatement(stmt->initializer.get());
+  }
+
+  size_t loopStart = here();
+  size_t exitJump = 0;
+  bool hasCondition = static_cast<bool>(stmt->condition);
+  if (hasCondition) {
+    int32_t mark = _nextRegister;
+    int32_t cond = compileOperand(stmt->condition.get());
+    exitJump = emit(OpCode::JUMP_IF_FALSE, cond);
+    freeRegisters(mark);
+  }
+
+  _jumps.push_back(JumpContext{false, {}, {}});
+  compileStatement(stmt->body.get());
+
+  size_t continueTarget = here();
+  if (stmt->increment) {
+    compileStatement(stmt->increment.get());
+  }
+  emit(OpCode::JUMP, static_cast<int32_t>(loopStart));
+
+  JumpContext context = std::move(_jumps.back());
+  _jumps.pop_back();
+  if (hasCondition) {
+    patch(exitJump, here());
+  }
+  patchLoopJumps(context, continueTarget, here());
+}
+
+void BytecodeCompiler::compileDoWhile(DoWhileStmt *stmt) {
+  size_t loopStart = here();
+
+  _jumps.push_back(JumpContext{false, {}, {}});
+  compileStatement(stmt->body.get());
+
+  size_t continueTarget = here();
+  int32_t mark = _nextRegister;
+  int32_t cond = compileOperand(stmt->condition.get());
+  emit(OpCode::JUMP_IF_TRUE, cond, static_cast<int32_t>(loopStart));
+  freeRegisters(mark);
+
+  JumpContext context = std::move(_jumps.back());
+  _jumps.pop_back();
+  patchLoopJumps(context, continueTarget, here());
+}
+
+void BytecodeCompiler::compileSwitch(SwitchStmt *stmt) {
+  // The control value is copied so case bodies cannot change it
+  int32_t control = allocRegister();
+  compileExpression(stmt->expression.get(), control);
+
+  _jumps.push_back(JumpContext{true, {}, {}});
+
+  bool hasPendingTest = false;
+  size_t pendingTest = 0;
+  bool hasPendingBody = false;
+  size_t pendingBody = 0;
+
+  // Cases are tested in source order; a matched body falls through into the
+  // following bodies, skipping their tests.
+  for (auto &caseEntry : stmt->cases) {
+    if (hasPendingTest) {
+      patch(pendingTest, here());
+      hasPendingTest = false;
+    }
+
+    if (!caseEntry.isDefault) {
+      int32_t mark = _nextRegister;
+      int32_t match = compileOperand(caseEntry.matchExpr.get());
+      int32_t equal = allocRegister();
+      emit(OpCode::EQUAL, equal, control, match);
+      pendingTest = emit(OpCode::JUMP_IF_FALSE, equal);
+      hasPendingTest = true;
+      freeRegisters(mark);
+    }
+
+    if (hasPendingBody) {
+      patch(pendingBody, here());
+    }
+
+    for (auto &s : caseEntry.statements) {
+      compileStatement(s.get());
+    }
+
+    pendingBody = emit(OpCode::JUMP);
+    hasPendingBody = true;
+  }
+
+  size_t end = here();
+  if (hasPendingTest) {
+    patch(pendingTest, end);
+  }
+  if (hasPendingBody) {
+    patch(pendingBody, end);
+  }
+
+  JumpContext context = std::move(_jumps.back());
+  _jumps.pop_back();
+  for (size_t jump : context.breakJumps) {
+    patch(jump, end);
+  }
+
+  // Continue inside a switch belongs to the enclosing loop
+  if (!context.continueJumps.empty()) {
+    if (_jumps.empty()) {
+      for (size_t jump : context.continueJumps) {
+        _out->code[jump] = Instruction{
+            OpCode::RAISE, name("'continue' outside of a loop"), 0, 0};
+      }
+    } else {
+      auto &outer = _jumps.back().continueJumps;
+      outer.insert(outer.end(), context.continueJumps.begin(),
+                   context.continueJumps.end());
+    }
+  }
+}
+
+void BytecodeCompiler::compileReturn(ReturnStmt *stmt) {
+  int32_t value;
+  if (stmt->value) {
+    value = compileOperand(stmt->value.get());
+  } else {
+    value = allocRegister();
+    emit(OpCode::LOAD_CONST, value, constant(static_cast<int32_t>(0)));
+  }
+  emit(OpCode::RETURN, value);
+}
+
+void BytecodeCompiler::compileBreak(BreakStmt *stmt) {
+  setPosition(stmt);
+  if (_jumps.empty()) {
+    emit(OpCode::RAISE, name("'break' outside of a loop or switch"));
+    return;
+  }
+  _jumps.back().breakJumps.push_back(emit(OpCode::JUMP));
+}
+
+void BytecodeCompiler::compileContinue(ContinueStmt *stmt) {
+  setPosition(stmt);
+  if (_jumps.empty()) {
+    emit(OpCode::RAISE, name("'continue' outside of a loop"));
+    return;
+  }
+  _jumps.back().continueJumps.push_back(emit(OpCode::JUMP));
+}
+
+void BytecodeCompiler::patchLoopJumps(JumpContext &context,
+                                      size_t continueTarget,
+                                      size_t breakTarget) {
+  for (size_t jump : context.continueJumps) {
+    patch(jump, continueTarget);
+  }
+  for (size_t jump : context.breakJumps) {
+    patch(jump, breakTarget);
+  }
+}
+
+int32_t BytecodeCompiler::unshare(Expression *array) {
+  // An external variable's array belongs to the host and is written in
+  // place; a record field's is copied in the record by UNSHARE_FIELD
+  bool external = array->kind == NodeKind::VARIABLE &&
+                  static_cast<VariableExpr *>(array)->slot < 0;
+  return external || array->kind == NodeKind::FIELD ? 0 : 1;
+}
+
+BytecodeCompiler::ArrayTarget
+BytecodeCompiler::compileArrayTarget(Expression *array) {
+  if (array->kind != NodeKind::FIELD) {
+    return ArrayTarget{compileOperand(array)};
+  }
+  auto *access = static_cast<FieldExpr *>(array);
+  ArrayTarget target;
+  target.record = compileOperand(access->object.get());
+  target.site = field(access->field, access->structType, access->index);
+  target.array = allocRegister();
+  setPosition(access);
+  emit(OpCode::GET_FIELD, target.array, target.record, target.site);
+  return target;
+}
+
+void BytecodeCompiler::unshareField(const ArrayTarget &target) {
+  if (target.record >= 0) {
+    emit(OpCode::UNSHARE_FIELD, target.array, target.record, target.site);
+  }
+}
+
+int32_t BytecodeCompiler::compileOperand(Expression *expr) {
+  if (expr->kind == NodeKind::VARIABLE) {
+    int32_t slot = static_cast<VariableExpr *>(expr)->slot;
+    if (slot >= 0) {
+      return slot;
+    }
+  }
+
+  int32_t reg = allocRegister();
+  compileExpression(expr, reg);
+  return reg;
+}
+
+void BytecodeCompiler::compileExpression(Expression *expr, int32_t dst) {
+  int32_t mark = _nextRegister;
+
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+    emit(OpCode::LOAD_CONST, dst,
+         constant(static_cast<LiteralExpr *>(expr)->value));
+    break;
+  case NodeKind::VARIABLE: {
+    auto *var = static_cast<VariableExpr *>(expr);
+    if (var->slot < 0) {
+      setPosition(var);
+      emit(OpCode::LOAD_EXTERNAL, dst, name(var->name));
+    } else if (var->slot != dst) {
+      emit(OpCode::MOVE, dst, var->slot);
+    }
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL:
+    compileArrayLiteral(static_cast<ArrayLiteralExpr *>(expr), dst);
+    break;
+  case NodeKind::INDEX:
+    compileIndex(static_cast<IndexExpr *>(expr), dst);
+    break;
+  case NodeKind::BINARY:
+    compileBinary(static_cast<BinaryExpr *>(expr), dst);
+    break;
+  case NodeKind::UNARY: {
+    auto *un = static_cast<UnaryExpr *>(expr);
+    int32_t operand = compileOperand(un->operand.get());
+    switch (un->op) {
+    case UnaryExpr::Operator::NEGATE:
+      emit(OpCode::NEGATE, dst, operand);
+      break;
+    case UnaryExpr::Operator::LOGICAL_NOT:
+      emit(OpCode::LOGICAL_NOT, dst, operand);
+      break;
+    case UnaryExpr::Operator::BIT_NOT:
+      emit(OpCode::BIT_NOT, dst, operand);
+      break;
+    }
+    break;
+  }
+  case NodeKind::CALL:
+    compileCall(static_cast<CallExpr *>(expr), dst);
+    break;
+  case NodeKind::FIELD: {
+    auto *access = static_cast<FieldExpr *>(expr);
+    int32_t record = compileOperand(access->object.get());
+    setPosition(access);
+    emit(OpCode::GET_FIELD, dst, record,
+         field(access->field, access->structType, access->index));
+    break;
+  }
+  case NodeKind::RECORD:
+    compileRecord(static_cast<RecordExpr *>(expr), dst);
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr);
+    int32_t test = compileOperand(cond->condition.get());
+    size_t elseJump = emit(OpCode::JUMP_IF_FALSE, test);
+    compileExpression(cond->thenExpr.get(), dst);
+    size_t endJump = emit(OpCode::JUMP);
+    patch(elseJump, here());
+    compileExpression(cond->elseExpr.get(), dst);
+    patch(endJump, here());
+    break;
+  }
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+
+  freeRegisters(mark);
+}
+
+void BytecodeCompiler::compileBinary(BinaryExpr *expr, int32_t dst) {
+  if (expr->op == BinaryExpr::Operator::LOGICAL_AND ||
+      expr->op == BinaryExpr::Operator::LOGICAL_OR) {
+    // Short-circuit: the result is always a bool
+    bool isAnd = expr->op == BinaryExpr::Operator::LOGICAL_AND;
+    int32_t left = compileOperand(expr->left.get());
+    size_t shortJump =
+        emit(isAnd ? OpCode::JUMP_IF_FALSE : OpCode::JUMP_IF_TRUE, left);
+    int32_t right = compileOperand(expr->right.get());
+    emit(OpCode::TO_BOOL, dst, right);
+    size_t endJump = emit(OpCode::JUMP);
+    patch(shortJump, here());
+    emit(OpCode::LOAD_CONST, dst, constant(!isAnd));
+    patch(endJump, here());
+    return;
+  }
+
+  int32_t left = compileOperand(expr->left.get());
+  int32_t right = compileOperand(expr->right.get());
+  emit(binaryOpCode(expr->op), dst, left, right);
+}
+
+void BytecodeCompiler::compileCall(CallExpr *expr, int32_t dst) {
+  const std::string &fn = expr->functionName;
+  size_t argc = expr->arguments.size();
+
+  // Built-ins take precedence over procedures and externals
+  if (fn == "len" || fn == "push" || fn == "pop") {
+    size_t expected = fn == "push" ? 2 : 1;
+    if (argc != expected) {
+      setPosition(expr);
+      emit(OpCode::RAISE, name(fn + (expected == 1 ? " expects 1 argument"
+                                                    : " expects 2 arguments")));
+      return;
+    }
+
+    if (fn == "len") {
+      int32_t array = compileOperand(expr->arguments[0].get());
+      setPosition(expr);
+      emit(OpCode::LEN, dst, array);
+      return;
+    }
+    ArrayTarget target = compileArrayTarget(expr->arguments[0].get());
+    int32_t array = target.array;
+    setPosition(expr);
+    if (fn == "pop") {
+      emit(OpCode::CHECK_ARRAY, array, name("pop expects an array"),
+           unshare(expr->arguments[0].get()));
+      unshareField(target);
+      emit(OpCode::POP, dst, array);
+    } else {
+      emit(OpCode::CHECK_ARRAY, array,
+           name("push expects an array as first argument"),
+           unshare(expr->arguments[0].get()));
+      int32_t value = compileOperand(expr->arguments[1].get());
+      setPosition(expr);
+      unshareField(target);
+      emit(OpCode::PUSH, dst, array, value);
+    }
+    return;
+  }
+
+  CallSite site;
+  site.name = fn;
+  site.argumentCount = static_cast<uint32_t>(argc);
+  site.checkedProcedure = expr->checkedProcedure;
+  site.argumentsTyped = expr->argumentsTyped;
+  site.inlinedProcedure = expr->inlinedProcedure;
+  _out->callSites.push_back(std::move(site));
+  auto siteIndex = static_cast<int32_t>(_out->callSites.size() - 1);
+
+  // The inlined copy of the callee, skipped once it is out of date
+  size_t callJump = 0;
+  size_t endJump = 0;
+  if (expr->inlined) {
+    setPosition(expr);
+    callJump = emit(OpCode::INLINED, siteIndex);
+    compileExpression(expr->inlined.get(), dst);
+    endJump = emit(OpCode::JUMP);
+    patch(callJump, here());
+  }
+
+  int32_t base = _nextRegister;
+  for (size_t i = 0; i < argc; ++i) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < argc; ++i) {
+    compileExpression(expr->arguments[i].get(),
+                      base + static_cast<int32_t>(i));
+  }
+
+  setPosition(expr);
+  emit(OpCode::CALL, dst, siteIndex, base);
+  if (expr->inlined) {
+    patch(endJump, here());
+  }
+}
+
+void BytecodeCompiler::compileIndex(IndexExpr *expr, int32_t dst) {
+  if (expr->arrayExpr->kind == NodeKind::INDEX) {
+    // m[i][j] is one offset computation over m and its indices, which go
+    // in consecutive registers
+    std::vector<ExprPtr> indices;
+    Expression *root = expr->indexChain(indices).get();
+    int32_t base = _nextRegister;
+    for (size_t i = 0; i <= indices.size(); ++i) {
+      allocRegister();
+    }
+    compileExpression(root, base);
+    setPosition(expr);
+    emit(OpCode::CHECK_ARRAY, base, name("Indexing non-array value"));
+    for (size_t i = 0; i < indices.size(); ++i) {
+      compileExpression(indices[i].get(), base + 1 + static_cast<int32_t>(i));
+    }
+    setPosition(expr);
+    emit(OpCode::INDEX_ND, dst, base, static_cast<int32_t>(indices.size()));
+    return;
+  }
+  int32_t array = compileOperand(expr->arrayExpr.get());
+  setPosition(expr);
+  emit(OpCode::CHECK_ARRAY, array, name("Indexing non-array value"));
+  int32_t index = compileOperand(expr->indexExpr.get());
+  setPosition(expr);
+  emit(OpCode::INDEX, dst, array, index);
+}
+
+void BytecodeCompiler::compileArrayLiteral(ArrayLiteralExpr *expr,
+                                           int32_t dst) {
+  int32_t base = _nextRegister;
+  size_t count = expr->elements.size();
+  for (size_t i = 0; i < count; ++i) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < count; ++i) {
+    compileExpression(expr->elements[i].get(), base + static_cast<int32_t>(i));
+  }
+  emit(OpCode::ARRAY_LITERAL, dst, base, static_cast<int32_t>(count));
+}
+
+void BytecodeCompiler::compileRecord(RecordExpr *expr, int32_t dst) {
+  int32_t base = _nextRegister;
+  size_t count = expr->fields.size();
+  for (size_t i = 0; i < count; ++i) {
+    allocRegister();
+  }
+  for (size_t i = 0; i < count; ++i) {
+    compileExpression(expr->fields[i].get(), base + static_cast<int32_t>(i));
+  }
+  setPosition(expr);
+  emit(OpCode::NEW_RECORD, dst, type(TypeInfo::record(expr->type)), base);
+}
+
+} // namespace Script
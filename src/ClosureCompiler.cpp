@@ -0,0 +1,1423 @@
+#include "ClosureCompiler.h"
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace Script {
+
+namespace {
+
+inline bool bothInt32(const Value &a, const Value &b) {
+  return std::holds_alternative<int32_t>(a) &&
+         std::holds_alternative<int32_t>(b);
+}
+
+inline bool bothDouble(const Value &a, const Value &b) {
+  return std::holds_alternative<double>(a) && std::holds_alternative<double>(b);
+}
+
+inline int64_t int32Of(const Value &v) { return *std::get_if<int32_t>(&v); }
+
+inline double doubleOf(const Value &v) { return *std::get_if<double>(&v); }
+
+// Operand shapes a binary closure is specialized for. Locals and constants
+// are read in place; anything else is evaluated by its own closure into
+// `scratch`.
+struct LocalOperand {
+  int32_t slot;
+  const Value &get(ClosureFrame &frame, Value &scratch) const {
+    return frame.slots[slot].view(scratch);
+  }
+};
+
+struct ConstOperand {
+  Value value;
+  const Value &get(ClosureFrame &, Value &) const { return value; }
+};
+
+struct ExprOperand {
+  ExprClosure eval;
+  const Value &get(ClosureFrame &frame, Value &scratch) const {
+    scratch = eval(frame);
+    return scratch;
+  }
+};
+
+// Operators with int32/double fast paths; other operand types take the
+// generic ValueHelper route so promotion rules stay identical
+struct AddOp {
+  static Value typed(int32_t l, int32_t r) { return static_cast<int32_t>(int64_t{l} + r); }
+  static Value typed(double l, double r) { return l + r; }
+  static Value apply(const Value &l, const Value &r) {
+    if (bothInt32(l, r)) {
+      return static_cast<int32_t>(int32Of(l) + int32Of(r));
+    }
+    if (bothDouble(l, r)) {
+      return doubleOf(l) + doubleOf(r);
+    }
+    return ValueHelper::add(l, r);
+  }
+};
+
+struct SubtractOp {
+  static Value typed(int32_t l, int32_t r) { return static_cast<int32_t>(int64_t{l} - r); }
+  static Value typed(double l, double r) { return l - r; }
+  static Value apply(const Value &l, const Value &r) {
+    if (bothInt32(l, r)) {
+      return static_cast<int32_t>(int32Of(l) - int32Of(r));
+    }
+    if (bothDouble(l, r)) {
+      return doubleOf(l) - doubleOf(r);
+    }
+    return ValueHelper::subtract(l, r);
+  }
+};
+
+struct MultiplyOp {
+  static Value typed(int32_t l, int32_t r) { return static_cast<int32_t>(int64_t{l} * r); }
+  static Value typed(double l, double r) { return l * r; }
+  static Value apply(const Value &l, const Value &r) {
+    if (bothInt32(l, r)) {
+      return static_cast<int32_t>(int32Of(l) * int32Of(r));
+    }
+    if (bothDouble(l, r)) {
+      return doubleOf(l) * doubleOf(r);
+    }
+    return ValueHelper::multiply(l, r);
+  }
+};
+
+struct DivideOp {
+  // Division by zero takes the generic route for its error
+  static Value typed(int32_t l, int32_t r) {
+    if (r == 0) {
+      return ValueHelper::divide(l, r);
+    }
+    return static_cast<int32_t>(int64_t{l} / r);
+  }
+  static Value typed(double l, double r) {
+    if (r == 0.0) {
+      return ValueHelper::divide(l, r);
+    }
+    return l / r;
+  }
+  static Value apply(const Value &l, const Value &r) {
+    if (bothInt32(l, r) && int32Of(r) != 0) {
+      return static_cast<int32_t>(int32Of(l) / int32Of(r));
+    }
+    return ValueHelper::divide(l, r);
+  }
+};
+
+struct ModuloOp {
+  static Value typed(int32_t l, int32_t r) {
+    if (r == 0) {
+      return ValueHelper::modulo(l, r);
+    }
+    return static_cast<int32_t>(int64_t{l} % r);
+  }
+  static Value typed(double l, double r) { return ValueHelper::modulo(l, r); }
+  static Value apply(const Value &l, const Value &r) {
+    if (bothInt32(l, r) && int32Of(r) != 0) {
+      return static_cast<int32_t>(int32Of(l) % int32Of(r));
+    }
+    return ValueHelper::modulo(l, r);
+  }
+};
+
+struct EqualOp {
+  template <typename T> static Value typed(T l, T r) { return l == r; }
+  static Value apply(const Value &l, const Value &r) {
+    return bothInt32(l, r) ? int32Of(l) == int32Of(r)
+                           : ValueHelper::equals(l, r);
+  }
+};
+
+struct NotEqualOp {
+  template <typename T> static Value typed(T l, T r) { return l != r; }
+  static Value apply(const Value &l, const Value &r) {
+    return bothInt32(l, r) ? int32Of(l) != int32Of(r)
+                           : ValueHelper::notEquals(l, r);
+  }
+};
+
+struct LessThanOp {
+  template <typename T> static Value typed(T l, T r) { return l < r; }
+  static Value apply(const Value &l, const Value &r) {
+    return bothInt32(l, r) ? int32Of(l) < int32Of(r)
+                           : ValueHelper::lessThan(l, r);
+  }
+};
+
+struct GreaterThanOp {
+  template <typename T> static Value typed(T l, T r) { return l > r; }
+  static Value apply(const Value &l, const Value &r) {
+    return bothInt32(l, r) ? int32Of(l) > int32Of(r)
+                           : ValueHelper::greaterThan(l, r);
+  }
+};
+
+struct LessEqualOp {
+  template <typename T> static Value typed(T l, T r) { return l <= r; }
+  static Value apply(const Value &l, const Value &r) {
+    return bothInt32(l, r) ? int32Of(l) <= int32Of(r)
+                           : ValueHelper::lessOrEqual(l, r);
+  }
+};
+
+struct GreaterEqualOp {
+  template <typename T> static Value typed(T l, T r) { return l >= r; }
+  static Value apply(const Value &l, const Value &r) {
+    return bothInt32(l, r) ? int32Of(l) >= int32Of(r)
+                           : ValueHelper::greaterOrEqual(l, r);
+  }
+};
+
+struct BitAndOp {
+  static Value apply(const Value &l, const Value &r) {
+    return ValueHelper::bitAnd(l, r);
+  }
+};
+
+struct BitOrOp {
+  static Value apply(const Value &l, const Value &r) {
+    return ValueHelper::bitOr(l, r);
+  }
+};
+
+struct BitXorOp {
+  static Value apply(const Value &l, const Value &r) {
+    return ValueHelper::bitXor(l, r);
+  }
+};
+
+struct LShiftOp {
+  static Value apply(const Value &l, const Value &r) {
+    return ValueHelper::lshift(l, r);
+  }
+};
+
+struct RShiftOp {
+  static Value apply(const Value &l, const Value &r) {
+    return ValueHelper::rshift(l, r);
+  }
+};
+
+template <typename Op, typename L, typename R>
+ExprClosure bindBinary(L left, R right) {
+  return [left, right](ClosureFrame &frame) -> Value {
+    Value leftScratch, rightScratch;
+    const Value &l = left.get(frame, leftScratch);
+    const Value &r = right.get(frame, rightScratch);
+    return Op::apply(l, r);
+  };
+}
+
+int32_t localSlot(Expression *expr) {
+  if (expr->kind == NodeKind::VARIABLE) {
+    return static_cast<VariableExpr *>(expr)->slot;
+  }
+  return -1;
+}
+
+// What an ArrayTarget evaluates: the record for a field of one, otherwise
+// the array itself
+Expression *targetOperand(Expression *expr) {
+  if (expr->kind == NodeKind::FIELD) {
+    return static_cast<FieldExpr *>(expr)->object.get();
+  }
+  return expr;
+}
+
+template <typename Op, typename L>
+ExprClosure bindRight(L left, Expression *right, ExprClosure rightEval) {
+  int32_t slot = localSlot(right);
+  if (slot >= 0) {
+    return bindBinary<Op>(std::move(left), LocalOperand{slot});
+  }
+  if (right->kind == NodeKind::LITERAL) {
+    auto *literal = static_cast<LiteralExpr *>(right);
+    return bindBinary<Op>(std::move(left), ConstOperand{literal->value});
+  }
+  return bindBinary<Op>(std::move(left), ExprOperand{std::move(rightEval)});
+}
+
+template <typename Op>
+ExprClosure bindOperands(Expression *left, ExprClosure leftEval,
+                         Expression *right, ExprClosure rightEval) {
+  int32_t slot = localSlot(left);
+  if (slot >= 0) {
+    return bindRight<Op>(LocalOperand{slot}, right, std::move(rightEval));
+  }
+  if (left->kind == NodeKind::LITERAL) {
+    return bindRight<Op>(
+        ConstOperand{static_cast<LiteralExpr *>(left)->value}, right,
+        std::move(rightEval));
+  }
+  return bindRight<Op>(ExprOperand{std::move(leftEval)}, right,
+                       std::move(rightEval));
+}
+
+// Operands of a binary closure the TypeChecker knows to be T, read without
+// building a Value: locals straight from their slots, literals unboxed
+// once. A local can still hold another type after a procedure loaded
+// later returned one (see TypeChecker.h), so read() reports whether the
+// operand had T, and value() gives it for the generic operator otherwise.
+template <typename T> bool readSlot(const CompactValue &slot, T &out) {
+  if constexpr (std::is_same_v<T, int32_t>) {
+    if (slot.isInt32()) {
+      out = slot.int32();
+      return true;
+    }
+  } else {
+    if (slot.isDouble()) {
+      out = slot.doubleValue();
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T> struct TypedLocal {
+  int32_t slot;
+  bool read(ClosureFrame &frame, T &out, Value &) const {
+    return readSlot(frame.slots[slot], out);
+  }
+  const Value &value(ClosureFrame &frame, Value &scratch) const {
+    return frame.slots[slot].view(scratch);
+  }
+};
+
+template <typename T> struct TypedConst {
+  T raw;
+  Value boxed;
+  bool read(ClosureFrame &, T &out, Value &) const {
+    out = raw;
+    return true;
+  }
+  const Value &value(ClosureFrame &, Value &) const { return boxed; }
+};
+
+// Evaluated once, into the scratch value() then returns
+template <typename T> struct TypedExpr {
+  ExprClosure eval;
+  bool read(ClosureFrame &frame, T &out, Value &scratch) const {
+    scratch = eval(frame);
+    if (const T *typed = std::get_if<T>(&scratch)) {
+      out = *typed;
+      return true;
+    }
+    return false;
+  }
+  const Value &value(ClosureFrame &, Value &scratch) const { return scratch; }
+};
+
+template <typename Op, typename T, typename L, typename R>
+ExprClosure bindTypedBinary(L left, R right) {
+  return [left, right](ClosureFrame &frame) -> Value {
+    Value leftScratch, rightScratch;
+    T l{}, r{};
+    bool typed = left.read(frame, l, leftScratch);
+    typed = right.read(frame, r, rightScratch) && typed;
+    if (typed) {
+      return Op::typed(l, r);
+    }
+    return Op::apply(left.value(frame, leftScratch),
+                     right.value(frame, rightScratch));
+  };
+}
+
+template <typename T> TypedConst<T> typedConst(Expression *literal) {
+  const Value &value = static_cast<LiteralExpr *>(literal)->value;
+  return TypedConst<T>{std::get<T>(value), value};
+}
+
+template <typename Op, typename T, typename L>
+ExprClosure bindTypedRight(L left, Expression *right, ExprClosure rightEval) {
+  int32_t slot = localSlot(right);
+  if (slot >= 0) {
+    return bindTypedBinary<Op, T>(std::move(left), TypedLocal<T>{slot});
+  }
+  if (right->kind == NodeKind::LITERAL) {
+    return bindTypedBinary<Op, T>(std::move(left), typedConst<T>(right));
+  }
+  return bindTypedBinary<Op, T>(std::move(left),
+                                TypedExpr<T>{std::move(rightEval)});
+}
+
+template <typename Op, typename T>
+ExprClosure bindTypedOperands(Expression *left, ExprClosure leftEval,
+                              Expression *right, ExprClosure rightEval) {
+  int32_t slot = localSlot(left);
+  if (slot >= 0) {
+    return bindTypedRight<Op, T>(TypedLocal<T>{slot}, right,
+                                 std::move(rightEval));
+  }
+  if (left->kind == NodeKind::LITERAL) {
+    return bindTypedRight<Op, T>(typedConst<T>(left), right,
+                                 std::move(rightEval));
+  }
+  return bindTypedRight<Op, T>(TypedExpr<T>{std::move(leftEval)}, right,
+                               std::move(rightEval));
+}
+
+bool hasStaticType(const Expression *expr, DataType type) {
+  return expr->staticType == TypeInfo(type);
+}
+
+// Arithmetic and comparisons take typed kernels when both operands are
+// statically int32 or both double
+template <typename Op>
+ExprClosure bindNumeric(Expression *left, ExprClosure leftEval,
+                        Expression *right, ExprClosure rightEval) {
+  if (hasStaticType(left, DataType::INT32) &&
+      hasStaticType(right, DataType::INT32)) {
+    return bindTypedOperands<Op, int32_t>(left, std::move(leftEval), right,
+                                          std::move(rightEval));
+  }
+  if (hasStaticType(left, DataType::DOUBLE) &&
+      hasStaticType(right, DataType::DOUBLE)) {
+    return bindTypedOperands<Op, double>(left, std::move(leftEval), right,
+                                         std::move(rightEval));
+  }
+  return bindOperands<Op>(left, std::move(leftEval), right,
+                          std::move(rightEval));
+}
+
+template <typename Op> Value applyCompound(const Value &l, const Value &r) {
+  return Op::apply(l, r);
+}
+
+} // namespace
+
+// The array push, pop or an index assignment writes to. A local is copied
+// in its slot if anything else shares it, and a record field in the
+// record; an external variable's array belongs to the host and is changed
+// in place.
+struct ClosureCompiler::ArrayTarget {
+  ExprClosure operand; // compiled targetOperand
+  FieldExpr *field;
+  int32_t slot;
+  bool external;
+
+  ArrayTarget(Expression *expr, ExprClosure operand)
+      : operand(std::move(operand)),
+        field(expr->kind == NodeKind::FIELD ? static_cast<FieldExpr *>(expr)
+                                            : nullptr),
+        slot(localSlot(expr)),
+        external(expr->kind == NodeKind::VARIABLE && slot < 0) {}
+
+  // The array's value; `owner` receives the record a field belongs to
+  Value evaluate(ClosureFrame &frame, RecordPtr &owner) const {
+    if (!field) {
+      return operand(frame);
+    }
+    Value object = operand(frame);
+    Value value = frame.interpreter.fieldOf(field, object);
+    owner = std::get<RecordPtr>(object);
+    return value;
+  }
+
+  ArrayValue &get(ClosureFrame &frame, Value &evaluated,
+                  RecordValue *owner) const {
+    if (owner) {
+      return frame.interpreter.arrayToModify(field, evaluated, owner);
+    }
+    if (slot >= 0) {
+      evaluated = Value(); // so an unshared local is not copied
+      return frame.slots[slot].mutableArray();
+    }
+    if (external) {
+      return ValueHelper::arrayValue(evaluated);
+    }
+    return ValueHelper::mutableArray(evaluated);
+  }
+};
+
+ClosureProcedurePtr ClosureCompiler::compile(const ProcedureDecl &proc) {
+  if (!proc.resolved) {
+    throw std::runtime_error("Procedure '" + proc.name +
+                             "' must be resolved before compilation");
+  }
+
+  auto result = std::make_shared<ClosureProcedure>();
+  result->body = compileStatement(proc.body.get());
+  return result;
+}
+
+StmtClosure ClosureCompiler::compileStatement(Statement *stmt) {
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT: {
+    auto *exprStmt = static_cast<ExpressionStmt *>(stmt);
+    ExprClosure expr = compileExpression(exprStmt->expression.get());
+    return [expr](ClosureFrame &frame) {
+      expr(frame);
+      return ExecStatus::NORMAL;
+    };
+  }
+  case NodeKind::VAR_DECL:
+    return compileVarDecl(static_cast<VarDeclStmt *>(stmt));
+  case NodeKind::ASSIGN:
+    return compileAssign(static_cast<AssignStmt *>(stmt));
+  case NodeKind::INDEX_ASSIGN:
+    return compileIndexAssign(static_cast<IndexAssignStmt *>(stmt));
+  case NodeKind::FIELD_ASSIGN:
+    return compileFieldAssign(static_cast<FieldAssignStmt *>(stmt));
+  case NodeKind::BLOCK:
+    return compileBlock(static_cast<BlockStmt *>(stmt));
+  case NodeKind::IF:
+    return compileIf(static_cast<IfStmt *>(stmt));
+  case NodeKind::WHILE:
+    return compileWhile(static_cast<WhileStmt *>(stmt));
+  case NodeKind::FOR:
+    return compileFor(static_cast<ForStmt *>(stmt));
+  case NodeKind::DO_WHILE:
+    return compileDoWhile(static_cast<DoWhileStmt *>(stmt));
+  case NodeKind::SWITCH:
+    return compileSwitch(static_cast<SwitchStmt *>(stmt));
+  case NodeKind::RETURN:
+    return compileReturn(static_cast<ReturnStmt *>(stmt));
+  case NodeKind::BREAK:
+    return [](ClosureFrame &) { return ExecStatus::BREAK; };
+  case NodeKind::CONTINUE:
+    return [](ClosureFrame &) { return ExecStatus::CONTINUE; };
+  default:
+    break;
+  }
+
+  throw std::runtime_error("Unknown statement type");
+}
+
+StmtClosure ClosureCompiler::compileVarDecl(VarDeclStmt *stmt) {
+  int32_t slot = stmt->slot;
+  TypeInfo type = stmt->type;
+
+  if (stmt->initializer) {
+    ExprClosure init = compileExpression(stmt->initializer.get());
+    int32_t source = localSlot(stmt->initializer.get());
+    if (stmt->initializerTyped && source >= 0) {
+      // A local of the declared type is shared rather than copied out
+      return [slot, type, source](ClosureFrame &frame) {
+        CompactValue initial = frame.slots[source];
+        Value scratch;
+        const Value &current = initial.view(scratch);
+        if (ValueHelper::needsConversion(current, type)) {
+          initial = frame.interpreter.convertToType(current, type);
+        }
+        frame.slots[slot] = std::move(initial);
+        return ExecStatus::NORMAL;
+      };
+    }
+    if (stmt->initializerTyped) {
+      return [slot, type, init](ClosureFrame &frame) {
+        Value value = init(frame);
+        if (ValueHelper::needsConversion(value, type)) {
+          value = frame.interpreter.convertToType(value, type);
+        }
+        frame.slots[slot] = std::move(value);
+        return ExecStatus::NORMAL;
+      };
+    }
+    return [slot, type, init](ClosureFrame &frame) {
+      frame.slots[slot] = frame.interpreter.convertToType(init(frame), type);
+      return ExecStatus::NORMAL;
+    };
+  }
+
+  if (type.isArray || type.isMap() || type.isRecord() ||
+      type.isStringBuilder()) {
+    // Every execution gets a fresh array, map, record or builder
+    return [slot, type](ClosureFrame &frame) {
+      frame.slots[slot] = ValueHelper::defaultValue(type);
+      return ExecStatus::NORMAL;
+    };
+  }
+
+  CompactValue initial = ValueHelper::defaultValue(type);
+  return [slot, initial](ClosureFrame &frame) {
+    frame.slots[slot] = initial;
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileAssign(AssignStmt *stmt) {
+  ExprClosure value = compileExpression(stmt->value.get());
+  int32_t slot = stmt->slot;
+
+  if (slot >= 0) {
+    using Apply = Value (*)(const Value &, const Value &);
+    Apply apply = nullptr;
+    switch (stmt->op) {
+    case AssignStmt::Operator::ASSIGN: {
+      int32_t source = localSlot(stmt->value.get());
+      if (source >= 0) {
+        // Local to local shares the slot; host arrays still get copied
+        return [slot, source](ClosureFrame &frame) {
+          const CompactValue &from = frame.slots[source];
+          if (from.isArray() && from.array() && from.array()->hostOwned()) {
+            frame.slots[slot] = ValueHelper::ownedByScript(from.toValue());
+          } else {
+            frame.slots[slot] = from;
+          }
+          return ExecStatus::NORMAL;
+        };
+      }
+      return [slot, value](ClosureFrame &frame) {
+        frame.slots[slot] = ValueHelper::ownedByScript(value(frame));
+        return ExecStatus::NORMAL;
+      };
+    }
+    case AssignStmt::Operator::PLUS_ASSIGN:
+      return [slot, value](ClosureFrame &frame) {
+        Value rhs = value(frame);
+        CompactValue &target = frame.slots[slot];
+        // s += x appends to the string in place, reusing its capacity
+        if (!target.isString() ||
+            !ValueHelper::appendString(target.mutableString(), rhs)) {
+          Value scratch;
+          target = applyCompound<AddOp>(target.view(scratch), rhs);
+        }
+        return ExecStatus::NORMAL;
+      };
+    case AssignStmt::Operator::MINUS_ASSIGN:
+      apply = applyCompound<SubtractOp>;
+      break;
+    case AssignStmt::Operator::MULT_ASSIGN:
+      apply = applyCompound<MultiplyOp>;
+      break;
+    case AssignStmt::Operator::DIV_ASSIGN:
+      apply = applyCompound<DivideOp>;
+      break;
+    }
+
+    return [slot, value, apply](ClosureFrame &frame) {
+      Value rhs = value(frame);
+      CompactValue &target = frame.slots[slot];
+      Value scratch;
+      target = apply(target.view(scratch), rhs);
+      return ExecStatus::NORMAL;
+    };
+  }
+
+  std::string name = stmt->variableName;
+  AssignStmt::Operator op = stmt->op;
+  int line = stmt->line;
+  int column = stmt->column;
+
+  return [name, op, line, column, value](ClosureFrame &frame) {
+    Value rhs = value(frame);
+    Interpreter &interp = frame.interpreter;
+
+    auto extIt = interp._externalVariables.find(name);
+    if (extIt == interp._externalVariables.end()) {
+      throw interp.runtimeError("Undefined variable: " + name, line, column);
+    }
+
+    auto &extVar = extIt->second;
+    if (!extVar.setter) {
+      throw interp.runtimeError("External variable '" + name + "' is read-only",
+                                line, column);
+    }
+
+    if (op == AssignStmt::Operator::ASSIGN) {
+      extVar.setter(rhs);
+      return ExecStatus::NORMAL;
+    }
+
+    if (!extVar.getter) {
+      throw interp.runtimeError(
+          "External variable '" + name + "' cannot be read", line, column);
+    }
+
+    Value currentValue = extVar.getter();
+    switch (op) {
+    case AssignStmt::Operator::ASSIGN:
+      break;
+    case AssignStmt::Operator::PLUS_ASSIGN:
+      currentValue = ValueHelper::add(currentValue, rhs);
+      break;
+    case AssignStmt::Operator::MINUS_ASSIGN:
+      currentValue = ValueHelper::subtract(currentValue, rhs);
+      break;
+    case AssignStmt::Operator::MULT_ASSIGN:
+      currentValue = ValueHelper::multiply(currentValue, rhs);
+      break;
+    case AssignStmt::Operator::DIV_ASSIGN:
+      currentValue = ValueHelper::divide(currentValue, rhs);
+      break;
+    }
+    extVar.setter(currentValue);
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileIndexAssign(IndexAssignStmt *stmt) {
+  if (stmt->arrayExpr->kind == NodeKind::INDEX) {
+    return compileNestedIndexAssign(stmt);
+  }
+  ArrayTarget target(stmt->arrayExpr.get(),
+                     compileExpression(targetOperand(stmt->arrayExpr.get())));
+  ExprClosure index = compileExpression(stmt->indexExpr.get());
+  ExprClosure value = compileExpression(stmt->value.get());
+  int line = stmt->line;
+  int column = stmt->column;
+
+  return [index, value, target, line, column](ClosureFrame &frame) {
+    Interpreter &interp = frame.interpreter;
+    RecordPtr owner;
+    Value arrayVal = target.evaluate(frame, owner);
+    if (!ValueHelper::isArray(arrayVal)) {
+      throw interp.runtimeError("Index assignment on non-array value", line,
+                                column);
+    }
+
+    size_t rank = ValueHelper::arrayValue(arrayVal).rank();
+    if (rank > 1) {
+      throw interp.runtimeError(
+          "Index assignment needs " + std::to_string(rank) + " indices", line,
+          column);
+    }
+
+    uint64_t idx = ValueHelper::toUInt64(index(frame));
+    if (idx >= ValueHelper::arrayValue(arrayVal).size()) {
+      throw interp.runtimeError("Array index out of bounds", line, column);
+    }
+
+    TypeInfo elementType = ValueHelper::arrayElementType(arrayVal);
+    Value converted = interp.convertToType(value(frame), elementType);
+
+    // Re-check: evaluating the value may have shrunk the array
+    ArrayValue &elems = target.get(frame, arrayVal, owner.get());
+    if (idx >= elems.size()) {
+      throw interp.runtimeError("Array index out of bounds", line, column);
+    }
+    elems.set(idx, std::move(converted));
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileNestedIndexAssign(IndexAssignStmt *stmt) {
+  // m[i][j] = v writes into m itself, not into a view of row i
+  std::vector<ExprPtr> indexExprs;
+  Expression *root = static_cast<IndexExpr *>(stmt->arrayExpr.get())
+                         ->indexChain(indexExprs)
+                         .get();
+  indexExprs.push_back(stmt->indexExpr);
+  ArrayTarget target(root, compileExpression(targetOperand(root)));
+  std::vector<ExprClosure> indices;
+  for (const auto &indexExpr : indexExprs) {
+    indices.push_back(compileExpression(indexExpr.get()));
+  }
+  ExprClosure value = compileExpression(stmt->value.get());
+  int line = stmt->line;
+  int column = stmt->column;
+
+  return [indices, value, target, line, column](ClosureFrame &frame) {
+    Interpreter &interp = frame.interpreter;
+    RecordPtr owner;
+    Value arrayVal = target.evaluate(frame, owner);
+    if (!ValueHelper::isArray(arrayVal)) {
+      throw interp.runtimeError("Index assignment on non-array value", line,
+                                column);
+    }
+
+    std::vector<Value> position;
+    position.reserve(indices.size());
+    for (const auto &index : indices) {
+      position.push_back(index(frame));
+    }
+    TypeInfo elementType = ValueHelper::arrayElementType(arrayVal);
+    Value converted = interp.convertToType(value(frame), elementType);
+
+    try {
+      ArrayValue &elems = target.get(frame, arrayVal, owner.get());
+      elems.set(ValueHelper::elementOffset(elems, position.data(),
+                                           position.size()),
+                std::move(converted));
+    } catch (const std::runtime_error &e) {
+      throw interp.runtimeError(e.what(), line, column);
+    }
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileFieldAssign(FieldAssignStmt *stmt) {
+  ExprClosure object = compileExpression(stmt->object.get());
+  ExprClosure value = compileExpression(stmt->value.get());
+  std::string field = stmt->field;
+  std::shared_ptr<const StructType> structType = stmt->structType;
+  int32_t index = stmt->index;
+  int line = stmt->line;
+  int column = stmt->column;
+
+  return [object, value, field, structType, index, line,
+          column](ClosureFrame &frame) {
+    Interpreter &interp = frame.interpreter;
+    Value recordVal = object(frame);
+    if (!ValueHelper::isRecord(recordVal)) {
+      throw interp.runtimeError("Field assignment on non-record value", line,
+                                column);
+    }
+    RecordValue &record = ValueHelper::recordValue(recordVal);
+    size_t slot;
+    try {
+      slot = record.fieldIndex(field, structType.get(), index);
+    } catch (const std::runtime_error &e) {
+      throw interp.runtimeError(e.what(), line, column);
+    }
+    record.setField(slot, interp.convertToType(
+                              value(frame), record.type()->fieldTypes[slot]));
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileBlock(BlockStmt *stmt) {
+  std::vector<StmtClosure> statements;
+  statements.reserve(stmt->statements.size());
+  for (auto &statement : stmt->statements) {
+    statements.push_back(compileStatement(statement.get()));
+  }
+
+  return [statements](ClosureFrame &frame) {
+    for (const auto &statement : statements) {
+      ExecStatus status = statement(frame);
+      if (status != ExecStatus::NORMAL) {
+        return status;
+      }
+    }
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileIf(IfStmt *stmt) {
+  ExprClosure condition = compileExpression(stmt->condition.get());
+  StmtClosure thenBranch = compileStatement(stmt->thenBranch.get());
+
+  if (!stmt->elseBranch) {
+    return [condition, thenBranch](ClosureFrame &frame) {
+      if (ValueHelper::toBool(condition(frame))) {
+        return thenBranch(frame);
+      }
+      return ExecStatus::NORMAL;
+    };
+  }
+
+  StmtClosure elseBranch = compileStatement(stmt->elseBranch.get());
+  return [condition, thenBranch, elseBranch](ClosureFrame &frame) {
+    if (ValueHelper::toBool(condition(frame))) {
+      return thenBranch(frame);
+    }
+    return elseBranch(frame);
+  };
+}
+
+StmtClosure ClosureCompiler::compileWhile(WhileStmt *stmt) {
+  ExprClosure condition = compileExpression(stmt->condition.get());
+  StmtClosure body = compileStatement(stmt->body.get());
+
+  return [condition, body](ClosureFrame &frame) {
+    while (ValueHelper::toBool(condition(frame))) {
+      ExecStatus status = body(frame);
+      if (status == ExecStatus::BREAK) {
+        break;
+      }
+      if (status == ExecStatus::RETURN) {
+        return status;
+      }
+    }
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileFor(ForStmt *stmt) {
+  StmtClosure initializer;
+  if (stmt->initializer) {
+    initializer = compileStatement(stmt->initializer.get());
+  }
+  ExprClosure condition;
+  if (stmt->condition) {
+    condition = compileExpression(stmt->condition.get());
+  }
+  StmtClosure increment;
+  if (stmt->increment) {
+    increment = compileStatement(stmt->increment.get());
+  }
+  StmtClosure body = compileStatement(stmt->body.get());
+
+  return [initializer, condition, increment, body](ClosureFrame &frame) {
+    if (initializer) {
+      initializer(frame);
+    }
+
+    while (true) {
+      if (condition && !ValueHelper::toBool(condition(frame))) {
+        break;
+      }
+
+      // Continue falls through to the increment
+      ExecStatus status = body(frame);
+      if (status == ExecStatus::BREAK) {
+        break;
+      }
+      if (status == ExecStatus::RETURN) {
+        return status;
+      }
+
+      if (increment) {
+        increment(frame);
+      }
+    }
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileDoWhile(DoWhileStmt *stmt) {
+  StmtClosure body = compileStatement(stmt->body.get());
+  ExprClosure condition = compileExpression(stmt->condition.get());
+
+  return [body, condition](ClosureFrame &frame) {
+    while (true) {
+      ExecStatus status = body(frame);
+      if (status == ExecStatus::BREAK) {
+        break;
+      }
+      if (status == ExecStatus::RETURN) {
+        return status;
+      }
+
+      if (!ValueHelper::toBool(condition(frame))) {
+        break;
+      }
+    }
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileSwitch(SwitchStmt *stmt) {
+  struct Case {
+    ExprClosure match; // empty for default
+    std::vector<StmtClosure> statements;
+  };
+
+  ExprClosure control = compileExpression(stmt->expression.get());
+  std::vector<Case> cases;
+  for (auto &caseEntry : stmt->cases) {
+    Case compiled;
+    if (!caseEntry.isDefault) {
+      compiled.match = compileExpression(caseEntry.matchExpr.get());
+    }
+    for (auto &s : caseEntry.statements) {
+      compiled.statements.push_back(compileStatement(s.get()));
+    }
+    cases.push_back(std::move(compiled));
+  }
+
+  return [control, cases](ClosureFrame &frame) {
+    Value controlValue = control(frame);
+    bool matched = false;
+
+    for (const auto &caseEntry : cases) {
+      if (!matched) {
+        matched = !caseEntry.match ||
+                  ValueHelper::equals(controlValue, caseEntry.match(frame));
+      }
+
+      if (matched) {
+        for (const auto &statement : caseEntry.statements) {
+          ExecStatus status = statement(frame);
+          if (status == ExecStatus::BREAK) {
+            return ExecStatus::NORMAL;
+          }
+          // Continue belongs to the enclosing loop
+          if (status != ExecStatus::NORMAL) {
+            return status;
+          }
+        }
+      }
+    }
+    return ExecStatus::NORMAL;
+  };
+}
+
+StmtClosure ClosureCompiler::compileReturn(ReturnStmt *stmt) {
+  if (!stmt->value) {
+    return [](ClosureFrame &frame) {
+      frame.returnValue = static_cast<int32_t>(0); // Dummy value
+      return ExecStatus::RETURN;
+    };
+  }
+
+  int32_t slot = localSlot(stmt->value.get());
+  if (slot >= 0) {
+    // The frame is discarded on return, so the local is moved out
+    return [slot](ClosureFrame &frame) {
+      frame.returnValue = frame.slots[slot].take();
+      return ExecStatus::RETURN;
+    };
+  }
+
+  ExprClosure value = compileExpression(stmt->value.get());
+  return [value](ClosureFrame &frame) {
+    frame.returnValue = value(frame);
+    return ExecStatus::RETURN;
+  };
+}
+
+ExprClosure ClosureCompiler::compileExpression(Expression *expr) {
+  switch (expr->kind) {
+  case NodeKind::LITERAL: {
+    Value value = static_cast<LiteralExpr *>(expr)->value;
+    return [value](ClosureFrame &) { return value; };
+  }
+  case NodeKind::VARIABLE:
+    return compileVariable(static_cast<VariableExpr *>(expr));
+  case NodeKind::ARRAY_LITERAL:
+    return compileArrayLiteral(static_cast<ArrayLiteralExpr *>(expr));
+  case NodeKind::INDEX:
+    return compileIndex(static_cast<IndexExpr *>(expr));
+  case NodeKind::BINARY:
+    return compileBinary(static_cast<BinaryExpr *>(expr));
+  case NodeKind::UNARY:
+    return compileUnary(static_cast<UnaryExpr *>(expr));
+  case NodeKind::CALL:
+    return compileCall(static_cast<CallExpr *>(expr));
+  case NodeKind::FIELD:
+    return compileField(static_cast<FieldExpr *>(expr));
+  case NodeKind::RECORD:
+    return compileRecord(static_cast<RecordExpr *>(expr));
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr);
+    ExprClosure test = compileExpression(cond->condition.get());
+    ExprClosure thenExpr = compileExpression(cond->thenExpr.get());
+    ExprClosure elseExpr = compileExpression(cond->elseExpr.get());
+    return [test, thenExpr, elseExpr](ClosureFrame &frame) {
+      return ValueHelper::toBool(test(frame)) ? thenExpr(frame)
+                                              : elseExpr(frame);
+    };
+  }
+  default:
+    break;
+  }
+
+  throw std::runtime_error("Unknown expression type");
+}
+
+ExprClosure ClosureCompiler::compileVariable(VariableExpr *expr) {
+  int32_t slot = expr->slot;
+  if (slot >= 0) {
+    return [slot](ClosureFrame &frame) { return frame.slots[slot].toValue(); };
+  }
+
+  std::string name = expr->name;
+  int line = expr->line;
+  int column = expr->column;
+  return [name, line, column](ClosureFrame &frame) -> Value {
+    Interpreter &interp = frame.interpreter;
+    auto extIt = interp._externalVariables.find(name);
+    if (extIt != interp._externalVariables.end()) {
+      if (!extIt->second.getter) {
+        throw interp.runtimeError("External variable '" + name +
+                                      "' has no getter",
+                                  line, column);
+      }
+      return extIt->second.get();
+    }
+    throw interp.runtimeError("Undefined variable: " + name, line, column);
+  };
+}
+
+ExprClosure ClosureCompiler::compileBinary(BinaryExpr *expr) {
+  Expression *left = expr->left.get();
+  Expression *right = expr->right.get();
+  ExprClosure leftEval = compileExpression(left);
+  ExprClosure rightEval = compileExpression(right);
+
+  switch (expr->op) {
+  case BinaryExpr::Operator::LOGICAL_AND:
+    return [leftEval, rightEval](ClosureFrame &frame) -> Value {
+      Value l = leftEval(frame);
+      if (!ValueHelper::toBool(l)) {
+        return false;
+      }
+      return ValueHelper::logicalAnd(l, rightEval(frame));
+    };
+  case BinaryExpr::Operator::LOGICAL_OR:
+    return [leftEval, rightEval](ClosureFrame &frame) -> Value {
+      Value l = leftEval(frame);
+      if (ValueHelper::toBool(l)) {
+        return true;
+      }
+      return ValueHelper::logicalOr(l, rightEval(frame));
+    };
+  case BinaryExpr::Operator::ADD:
+    return bindNumeric<AddOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::SUBTRACT:
+    return bindNumeric<SubtractOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::MULTIPLY:
+    return bindNumeric<MultiplyOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::DIVIDE:
+    return bindNumeric<DivideOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::MODULO:
+    return bindNumeric<ModuloOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::EQUAL:
+    return bindNumeric<EqualOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::NOT_EQUAL:
+    return bindNumeric<NotEqualOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::LESS_THAN:
+    return bindNumeric<LessThanOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::GREATER_THAN:
+    return bindNumeric<GreaterThanOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::LESS_EQUAL:
+    return bindNumeric<LessEqualOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::GREATER_EQUAL:
+    return bindNumeric<GreaterEqualOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::BIT_AND:
+    return bindOperands<BitAndOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::BIT_OR:
+    return bindOperands<BitOrOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::BIT_XOR:
+    return bindOperands<BitXorOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::LSHIFT:
+    return bindOperands<LShiftOp>(left, leftEval, right, rightEval);
+  case BinaryExpr::Operator::RSHIFT:
+    return bindOperands<RShiftOp>(left, leftEval, right, rightEval);
+  }
+
+  throw std::runtime_error("Unknown binary operator");
+}
+
+ExprClosure ClosureCompiler::compileUnary(UnaryExpr *expr) {
+  ExprClosure operand = compileExpression(expr->operand.get());
+
+  switch (expr->op) {
+  case UnaryExpr::Operator::NEGATE:
+    return [operand](ClosureFrame &frame) -> Value {
+      return ValueHelper::negate(operand(frame));
+    };
+  case UnaryExpr::Operator::LOGICAL_NOT:
+    return [operand](ClosureFrame &frame) -> Value {
+      return ValueHelper::logicalNot(operand(frame));
+    };
+  case UnaryExpr::Operator::BIT_NOT:
+    return [operand](ClosureFrame &frame) {
+      return ValueHelper::bitNot(operand(frame));
+    };
+  }
+
+  throw std::runtime_error("Unknown unary operator");
+}
+
+ExprClosure ClosureCompiler::compileCall(CallExpr *expr) {
+  const std::string &fn = expr->functionName;
+  int line = expr->line;
+  int column = expr->column;
+
+  std::vector<ExprClosure> args;
+  args.reserve(expr->arguments.size());
+  for (auto &arg : expr->arguments) {
+    args.push_back(compileExpression(arg.get()));
+  }
+
+  // Built-in functions for arrays take precedence over procedures
+  if (fn == "len" || fn == "pop") {
+    bool isLen = fn == "len";
+    if (args.size() != 1) {
+      std::string message = fn + " expects 1 argument";
+      return [message, line, column](ClosureFrame &frame) -> Value {
+        throw frame.interpreter.runtimeError(message, line, column);
+      };
+    }
+
+    Expression *arrayExpr = expr->arguments[0].get();
+    ArrayTarget target(arrayExpr,
+                       arrayExpr->kind == NodeKind::FIELD
+                           ? compileExpression(targetOperand(arrayExpr))
+                           : args[0]);
+    return [isLen, target, line, column](ClosureFrame &frame) -> Value {
+      RecordPtr owner;
+      Value arrayVal = target.evaluate(frame, owner);
+      if (isLen && ValueHelper::isMap(arrayVal)) {
+        return ValueHelper::createValue(
+            DataType::INT32,
+            static_cast<int64_t>(ValueHelper::mapValue(arrayVal).size()));
+      }
+      if (!ValueHelper::isArray(arrayVal)) {
+        throw frame.interpreter.runtimeError(
+            isLen ? "len expects an array or map" : "pop expects an array",
+            line, column);
+      }
+      if (isLen) {
+        return ValueHelper::createValue(
+            DataType::INT32,
+            static_cast<int64_t>(ValueHelper::arrayValue(arrayVal).length()));
+      }
+      ArrayValue &elems = target.get(frame, arrayVal, owner.get());
+      if (elems.empty()) {
+        throw frame.interpreter.runtimeError("Cannot pop from empty array",
+                                             line, column);
+      }
+      return elems.pop();
+    };
+  }
+
+  if (fn == "push") {
+    if (args.size() != 2) {
+      return [line, column](ClosureFrame &frame) -> Value {
+        throw frame.interpreter.runtimeError("push expects 2 arguments", line,
+                                             column);
+      };
+    }
+
+    Expression *arrayExpr = expr->arguments[0].get();
+    ArrayTarget target(arrayExpr,
+                       arrayExpr->kind == NodeKind::FIELD
+                           ? compileExpression(targetOperand(arrayExpr))
+                           : args[0]);
+    ExprClosure value = args[1];
+    return [target, value, line, column](ClosureFrame &frame) -> Value {
+      RecordPtr owner;
+      Value arrayVal = target.evaluate(frame, owner);
+      if (!ValueHelper::isArray(arrayVal)) {
+        throw frame.interpreter.runtimeError(
+            "push expects an array as first argument", line, column);
+      }
+      TypeInfo elementType = ValueHelper::arrayElementType(arrayVal);
+      Value converted =
+          frame.interpreter.convertToType(value(frame), elementType);
+      ArrayValue &elems = target.get(frame, arrayVal, owner.get());
+      elems.push(std::move(converted));
+      return ValueHelper::createValue(DataType::INT32,
+                                      static_cast<int64_t>(elems.size()));
+    };
+  }
+
+  // Locals are passed shared with their slots rather than copied out, and
+  // literals shared with their compact values
+  std::vector<int32_t> argSlots;
+  std::vector<const CompactValue *> argConstants;
+  argSlots.reserve(expr->arguments.size());
+  argConstants.reserve(expr->arguments.size());
+  for (auto &arg : expr->arguments) {
+    argSlots.push_back(localSlot(arg.get()));
+    argConstants.push_back(
+        arg->kind == NodeKind::LITERAL
+            ? &static_cast<LiteralExpr *>(arg.get())->compact
+            : nullptr);
+  }
+
+  // The inlined copy of the callee runs in this frame while it is current
+  ExprClosure inlined;
+  if (expr->inlined) {
+    inlined = compileExpression(expr->inlined.get());
+  }
+
+  // Procedures and externals go through the CallExpr inline cache, which is
+  // refreshed whenever the interpreter's registrations change
+  return [expr, args, argSlots, argConstants, inlined, line,
+          column](ClosureFrame &frame) -> Value {
+    Interpreter &interp = frame.interpreter;
+
+    if (expr->cacheVersion != interp._callCacheVersion) {
+      expr->cachedIsProcedure = false;
+      expr->cachedIsInlined = false;
+      expr->cachedIsExternal = false;
+      expr->cachedProcedure.reset();
+      expr->cachedExternal = nullptr;
+      expr->cachedBuiltin = nullptr;
+
+      auto procIt = interp._procedures.find(expr->functionName);
+      if (procIt != interp._procedures.end()) {
+        expr->cachedIsProcedure = true;
+        expr->cachedProcedure = procIt->second;
+        expr->cachedIsChecked =
+            expr->checkedProcedure.lock() == procIt->second;
+        expr->cachedIsInlined =
+            inlined && expr->inlinedProcedure.lock() == procIt->second;
+      } else {
+        auto extIt = interp._externalFunctions.find(expr->functionName);
+        if (extIt != interp._externalFunctions.end()) {
+          expr->cachedIsExternal = true;
+          expr->cachedExternal = extIt->second;
+        } else if (BuiltinFunction builtin =
+                       Interpreter::findBuiltin(expr->functionName)) {
+          expr->cachedBuiltin = builtin;
+        } else {
+          throw interp.runtimeError("Undefined function: " + expr->functionName,
+                                    line, column);
+        }
+      }
+      expr->cacheVersion = interp._callCacheVersion;
+    }
+
+    if (expr->cachedIsInlined) {
+      return inlined(frame);
+    }
+
+    if (expr->cachedBuiltin) {
+      Interpreter::ArgumentSlots values(interp, args.size());
+      for (size_t i = 0; i < args.size(); ++i) {
+        if (argSlots[i] >= 0) {
+          values[i] = frame.slots[argSlots[i]];
+        } else if (argConstants[i]) {
+          values[i] = *argConstants[i];
+        } else {
+          Value value = args[i](frame);
+          values[i] = std::move(value);
+        }
+      }
+      return interp.callBuiltin(expr->cachedBuiltin, values.data(),
+                                args.size(), line, column);
+    }
+
+    std::vector<CompactValue> values;
+    values.reserve(args.size());
+    for (size_t i = 0; i < args.size(); ++i) {
+      if (argSlots[i] >= 0) {
+        values.push_back(frame.slots[argSlots[i]]);
+      } else if (argConstants[i]) {
+        values.push_back(*argConstants[i]);
+      } else {
+        values.emplace_back(args[i](frame));
+      }
+    }
+
+    if (expr->cachedIsProcedure) {
+      if (auto proc = expr->cachedProcedure.lock()) {
+        return interp.executeChecked(proc, values, expr->cachedIsChecked,
+                                     expr->argumentsTyped);
+      }
+    } else if (expr->cachedIsExternal && expr->cachedExternal) {
+      return expr->cachedExternal(CompactValue::toValues(values));
+    }
+
+    throw interp.runtimeError("Undefined function: " + expr->functionName,
+                              line, column);
+  };
+}
+
+ExprClosure ClosureCompiler::compileIndex(IndexExpr *expr) {
+  if (expr->arrayExpr->kind == NodeKind::INDEX) {
+    return compileNestedIndex(expr);
+  }
+  ExprClosure array = compileExpression(expr->arrayExpr.get());
+  ExprClosure index = compileExpression(expr->indexExpr.get());
+  int line = expr->line;
+  int column = expr->column;
+
+  return [array, index, line, column](ClosureFrame &frame) -> Value {
+    Value arrayVal = array(frame);
+    if (!ValueHelper::isArray(arrayVal)) {
+      throw frame.interpreter.runtimeError("Indexing non-array value", line,
+                                           column);
+    }
+
+    Value indexVal = index(frame);
+    uint64_t idx = ValueHelper::toUInt64(indexVal);
+    const ArrayValue &elems = ValueHelper::arrayValue(arrayVal);
+    if (idx >= elems.length()) {
+      throw frame.interpreter.runtimeError("Array index out of bounds", line,
+                                           column);
+    }
+    if (elems.rank() > 1) {
+      return ValueHelper::indexArray(arrayVal, &indexVal, 1);
+    }
+    return elems.get(idx);
+  };
+}
+
+ExprClosure ClosureCompiler::compileNestedIndex(IndexExpr *expr) {
+  // m[i][j] finds the element with one offset computation rather than
+  // through a view of row i
+  std::vector<ExprPtr> indexExprs;
+  ExprClosure array = compileExpression(expr->indexChain(indexExprs).get());
+  std::vector<ExprClosure> indices;
+  for (const auto &indexExpr : indexExprs) {
+    indices.push_back(compileExpression(indexExpr.get()));
+  }
+  int line = expr->line;
+  int column = expr->column;
+
+  return [array, indices, line, column](ClosureFrame &frame) -> Value {
+    Value arrayVal = array(frame);
+    if (!ValueHelper::isArray(arrayVal)) {
+      throw frame.interpreter.runtimeError("Indexing non-array value", line,
+                                           column);
+    }
+
+    std::vector<Value> position;
+    position.reserve(indices.size());
+    for (const auto &index : indices) {
+      position.push_back(index(frame));
+    }
+    try {
+      return ValueHelper::indexArray(arrayVal, position.data(),
+                                     position.size());
+    } catch (const std::runtime_error &e) {
+      throw frame.interpreter.runtimeError(e.what(), line, column);
+    }
+  };
+}
+
+ExprClosure ClosureCompiler::compileArrayLiteral(ArrayLiteralExpr *expr) {
+  std::vector<ExprClosure> elements;
+  elements.reserve(expr->elements.size());
+  for (auto &e : expr->elements) {
+    elements.push_back(compileExpression(e.get()));
+  }
+
+  return [elements](ClosureFrame &frame) -> Value {
+    std::vector<Value> values;
+    values.reserve(elements.size());
+    for (const auto &element : elements) {
+      values.push_back(element(frame));
+    }
+    TypeInfo elemType = values.empty() ? TypeInfo(DataType::VOID)
+                                       : ValueHelper::getType(values[0]);
+    return ValueHelper::createArray(elemType, values);
+  };
+}
+
+ExprClosure ClosureCompiler::compileField(FieldExpr *expr) {
+  ExprClosure object = compileExpression(expr->object.get());
+  std::string field = expr->field;
+  std::shared_ptr<const StructType> structType = expr->structType;
+  int32_t index = expr->index;
+  int line = expr->line;
+  int column = expr->column;
+
+  return [object, field, structType, index, line,
+          column](ClosureFrame &frame) -> Value {
+    Value recordVal = object(frame);
+    if (!ValueHelper::isRecord(recordVal)) {
+      throw frame.interpreter.runtimeError("Field access on non-record value",
+                                           line, column);
+    }
+    const RecordValue &record = ValueHelper::recordValue(recordVal);
+    try {
+      return record.field(record.fieldIndex(field, structType.get(), index));
+    } catch (const std::runtime_error &e) {
+      throw frame.interpreter.runtimeError(e.what(), line, column);
+    }
+  };
+}
+
+ExprClosure ClosureCompiler::compileRecord(RecordExpr *expr) {
+  std::vector<ExprClosure> fields;
+  fields.reserve(expr->fields.size());
+  for (auto &e : expr->fields) {
+    fields.push_back(compileExpression(e.get()));
+  }
+  std::shared_ptr<const StructType> type = expr->type;
+
+  return [fields, type](ClosureFrame &frame) -> Value {
+    std::vector<Value> values;
+    values.reserve(fields.size());
+    for (size_t i = 0; i < fields.size(); ++i) {
+      values.push_back(frame.interpreter.convertToType(fields[i](frame),
+                                                       type->fieldTypes[i]));
+    }
+    return std::make_shared<RecordValue>(type, std::move(values));
+  };
+}
+
+} // namespace Script
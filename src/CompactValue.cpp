@@ -0,0 +1,174 @@
+#include "CompactValue.h"
+#include <utility>
+
+namespace Script {
+
+CompactValue::CompactValue(const Value &value) : CompactValue(Value(value)) {}
+
+CompactValue::CompactValue(Value &&value)
+    : _tag(static_cast<uint8_t>(value.index())) {
+  if (isHeap()) {
+    _payload.heap = new Heap{1, std::move(value)};
+    return;
+  }
+  std::visit(
+      [this](auto &&arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, double>) {
+          _payload.d = arg;
+        } else if constexpr (std::is_same_v<T, bool>) {
+          _payload.i = 0;
+          _payload.b = arg;
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+          _payload.i = arg;
+        } else if constexpr (std::is_integral_v<T>) {
+          _payload.u = arg;
+        }
+      },
+      value);
+}
+
+CompactValue::CompactValue(const CompactValue &other)
+    : _payload(other._payload), _tag(other._tag) {
+  retain();
+}
+
+CompactValue::CompactValue(CompactValue &&other) noexcept
+    : _payload(other._payload), _tag(other._tag) {
+  other._tag = 0;
+  other._payload.i = 0;
+}
+
+CompactValue &CompactValue::operator=(const CompactValue &other) {
+  // Taken before releasing, which also covers self-assignment
+  Payload payload = other._payload;
+  uint8_t tag = other._tag;
+  other.retain();
+  release();
+  _payload = payload;
+  _tag = tag;
+  return *this;
+}
+
+CompactValue &CompactValue::operator=(CompactValue &&other) noexcept {
+  if (this != &other) {
+    release();
+    _payload = other._payload;
+    _tag = other._tag;
+    other._tag = 0;
+    other._payload.i = 0;
+  }
+  return *this;
+}
+
+CompactValue &CompactValue::operator=(Value &&value) {
+  size_t tag = value.index();
+  if (isHeap() && isHeap(tag) && _payload.heap->refs == 1) {
+    _payload.heap->value = std::move(value);
+    _tag = static_cast<uint8_t>(tag);
+    return *this;
+  }
+  return *this = CompactValue(std::move(value));
+}
+
+Value CompactValue::toValue() const {
+  switch (_tag) {
+  case indexOf<int8_t>():
+    return static_cast<int8_t>(_payload.i);
+  case indexOf<uint8_t>():
+    return static_cast<uint8_t>(_payload.u);
+  case indexOf<int16_t>():
+    return static_cast<int16_t>(_payload.i);
+  case indexOf<uint16_t>():
+    return static_cast<uint16_t>(_payload.u);
+  case indexOf<int32_t>():
+    return static_cast<int32_t>(_payload.i);
+  case indexOf<uint32_t>():
+    return static_cast<uint32_t>(_payload.u);
+  case indexOf<int64_t>():
+    return _payload.i;
+  case indexOf<uint64_t>():
+    return _payload.u;
+  case indexOf<double>():
+    return _payload.d;
+  case indexOf<bool>():
+    return _payload.b;
+  case indexOf<std::string>():
+  case indexOf<ArrayPtr>():
+  case indexOf<MapPtr>():
+  case indexOf<RecordPtr>():
+  case indexOf<StringBuilderPtr>():
+    return _payload.heap->value;
+  }
+  throw std::runtime_error("Invalid compact value");
+}
+
+const Value &CompactValue::view(Value &scratch) const {
+  if (isHeap()) {
+    return _payload.heap->value;
+  }
+  scratch = toValue();
+  return scratch;
+}
+
+Value CompactValue::take() {
+  if (isHeap() && _payload.heap->refs == 1) {
+    return std::move(_payload.heap->value);
+  }
+  return toValue();
+}
+
+std::vector<Value>
+CompactValue::toValues(const std::vector<CompactValue> &values) {
+  std::vector<Value> out;
+  out.reserve(values.size());
+  for (const auto &value : values) {
+    out.push_back(value.toValue());
+  }
+  return out;
+}
+
+std::string &CompactValue::mutableString() {
+  if (_payload.heap->refs > 1) {
+    Heap *copy = new Heap{1, _payload.heap->value};
+    --_payload.heap->refs;
+    _payload.heap = copy;
+  }
+  return *std::get_if<std::string>(&_payload.heap->value);
+}
+
+const ArrayPtr &CompactValue::array() const {
+  return *std::get_if<ArrayPtr>(&_payload.heap->value);
+}
+
+ArrayValue &CompactValue::mutableArray() {
+  const ArrayPtr *array =
+      isArray() ? std::get_if<ArrayPtr>(&_payload.heap->value) : nullptr;
+  if (!array || !*array) {
+    throw std::runtime_error("Value is not an array");
+  }
+  if (_payload.heap->refs > 1) {
+    Heap *copy = new Heap{1, std::make_shared<ArrayValue>(**array)};
+    --_payload.heap->refs;
+    _payload.heap = copy;
+  } else if (array->use_count() > 1) {
+    _payload.heap->value = std::make_shared<ArrayValue>(**array);
+  }
+  return **std::get_if<ArrayPtr>(&_payload.heap->value);
+}
+
+void CompactValue::retain() const {
+  if (isHeap()) {
+    ++_payload.heap->refs;
+  }
+}
+
+void CompactValue::releaseHeap() {
+  if (--_payload.heap->refs == 0) {
+    delete _payload.heap;
+  }
+  _tag = 0;
+  _payload.i = 0;
+}
+
+} // namespace Script
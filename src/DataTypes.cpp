@@ -1,15 +1,410 @@
 #include "DataTypes.h"
+#include "ArrayArithmetic.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
 #include <stdexcept>
+#include <utility>
 
 namespace Script {
 
+namespace {
+
+template <size_t... I>
+ArrayValue::Storage emptyStorage(size_t index, std::index_sequence<I...>) {
+  ArrayValue::Storage storage;
+  ((I == index ? (storage.emplace<I>(), true) : false) || ...);
+  return storage;
+}
+
+} // namespace
+
+ArrayValue::ArrayValue(DataType elementType)
+    : _elementType(elementType),
+      // Types past VOID, which hold handles, share its vector of Values
+      _storage(emptyStorage(
+          std::min(static_cast<size_t>(elementType),
+                   static_cast<size_t>(DataType::VOID)),
+          std::make_index_sequence<std::variant_size_v<Storage>>{})) {}
+
+ArrayValue::ArrayValue(DataType elementType, const std::vector<Value> &elements,
+                       std::vector<size_t> shape)
+    : ArrayValue(elementType) {
+  _shape = normalized(std::move(shape));
+  for (const auto &element : elements) {
+    if (element.index() != _storage.index()) {
+      _storage = elements;
+      return;
+    }
+  }
+  std::visit(
+      [&elements](auto &buffer) {
+        using E = typename std::decay_t<decltype(buffer)>::value_type;
+        buffer.reserve(elements.size());
+        for (const auto &element : elements) {
+          if constexpr (std::is_same_v<E, Value>) {
+            buffer.push_back(element);
+          } else {
+            buffer.push_back(std::get<E>(element));
+          }
+        }
+      },
+      _storage);
+}
+
+ArrayPtr ArrayValue::view(const ArrayPtr &array, size_t offset, size_t length,
+                          std::vector<size_t> shape) {
+  auto view = std::make_shared<ArrayValue>(array->_elementType);
+  view->_recordType = array->_recordType;
+  view->_viewOf = array->_viewOf ? array->_viewOf : array;
+  view->_offset = array->_offset + offset;
+  view->_length = length;
+  view->_shape = normalized(std::move(shape));
+  if (array->_hostOwned || view->_viewOf->_hostOwned) {
+    view->detach();
+  }
+  return view;
+}
+
+ArrayPtr ArrayValue::slice(const ArrayPtr &array, size_t start, size_t end) {
+  if (array->_shape.empty()) {
+    return view(array, start, end - start);
+  }
+  std::vector<size_t> shape = array->_shape;
+  size_t stride = array->size() / shape[0];
+  shape[0] = end - start;
+  return view(array, start * stride, (end - start) * stride, std::move(shape));
+}
+
+size_t ArrayValue::size() const {
+  if (_viewOf) {
+    return _length;
+  }
+  return std::visit([](const auto &buffer) { return buffer.size(); },
+                    _storage);
+}
+
+Value ArrayValue::get(size_t index) const {
+  if (_viewOf) {
+    return _viewOf->get(_offset + index);
+  }
+  return std::visit(
+      [index](const auto &buffer) -> Value {
+        using E = typename std::decay_t<decltype(buffer)>::value_type;
+        return static_cast<E>(buffer[index]);
+      },
+      _storage);
+}
+
+void ArrayValue::set(size_t index, Value value) {
+  detach();
+  if (value.index() != _storage.index()) {
+    fallBackToValues()[index] = std::move(value);
+    return;
+  }
+  std::visit(
+      [&](auto &buffer) {
+        using E = typename std::decay_t<decltype(buffer)>::value_type;
+        if constexpr (std::is_same_v<E, Value>) {
+          buffer[index] = std::move(value);
+        } else {
+          buffer[index] = std::get<E>(std::move(value));
+        }
+      },
+      _storage);
+}
+
+void ArrayValue::push(Value value) {
+  if (!_shape.empty()) {
+    throw std::runtime_error("push needs a one-dimensional array");
+  }
+  detach();
+  if (value.index() != _storage.index()) {
+    fallBackToValues().push_back(std::move(value));
+    return;
+  }
+  std::visit(
+      [&](auto &buffer) {
+        using E = typename std::decay_t<decltype(buffer)>::value_type;
+        if constexpr (std::is_same_v<E, Value>) {
+          buffer.push_back(std::move(value));
+        } else {
+          buffer.push_back(std::get<E>(std::move(value)));
+        }
+      },
+      _storage);
+}
+
+Value ArrayValue::pop() {
+  if (!_shape.empty()) {
+    throw std::runtime_error("pop needs a one-dimensional array");
+  }
+  detach();
+  return std::visit(
+      [](auto &buffer) -> Value {
+        using E = typename std::decay_t<decltype(buffer)>::value_type;
+        E last = std::move(buffer.back());
+        buffer.pop_back();
+        return last;
+      },
+      _storage);
+}
+
+std::vector<Value> ArrayValue::toValues() const {
+  const Storage &storage = _viewOf ? _viewOf->_storage : _storage;
+  size_t first = _viewOf ? _offset : 0;
+  return std::visit(
+      [&](const auto &buffer) {
+        size_t last = _viewOf ? first + _length : buffer.size();
+        return std::vector<Value>(buffer.begin() + first,
+                                  buffer.begin() + last);
+      },
+      storage);
+}
+
+void ArrayValue::detach() {
+  if (!_viewOf) {
+    return;
+  }
+  _storage = std::visit(
+      [this](const auto &buffer) -> Storage {
+        using Buffer = std::decay_t<decltype(buffer)>;
+        return Buffer(buffer.begin() + _offset,
+                      buffer.begin() + _offset + _length);
+      },
+      _viewOf->_storage);
+  _viewOf.reset();
+  _offset = 0;
+  _length = 0;
+}
+
+std::vector<Value> &ArrayValue::fallBackToValues() {
+  if (!isTyped()) {
+    return std::get<std::vector<Value>>(_storage);
+  }
+  _storage = toValues();
+  return std::get<std::vector<Value>>(_storage);
+}
+
+namespace {
+
+// splitmix64's finalizer, so keys differing in a few low bits spread out
+uint64_t mixBits(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+uint64_t hashKey(const Value &key) {
+  return std::visit(
+      [](const auto &k) -> uint64_t {
+        using K = std::decay_t<decltype(k)>;
+        if constexpr (std::is_same_v<K, std::string>) {
+          return mixBits(std::hash<std::string>()(k));
+        } else if constexpr (std::is_same_v<K, double>) {
+          double d = k == 0.0 ? 0.0 : k; // -0.0 == 0.0
+          uint64_t bits;
+          std::memcpy(&bits, &d, sizeof bits);
+          return mixBits(bits);
+        } else if constexpr (std::is_arithmetic_v<K>) {
+          return mixBits(static_cast<uint64_t>(k));
+        } else {
+          throw std::runtime_error("Map keys must be scalars");
+        }
+      },
+      key);
+}
+
+} // namespace
+
+MapValue::MapValue(DataType keyType, DataType valueType)
+    : _keys(std::make_shared<ArrayValue>(keyType)),
+      _values(std::make_shared<ArrayValue>(valueType)), _slots(8, EMPTY) {
+  if (keyType > DataType::BOOL || valueType > DataType::BOOL ||
+      keyType == DataType::VOID || valueType == DataType::VOID) {
+    throw std::runtime_error("Map keys and values must be scalars");
+  }
+}
+
+int64_t MapValue::findSlot(const Value &key, uint64_t hash,
+                           bool &found) const {
+  if (key.index() != static_cast<size_t>(keyType())) {
+    throw std::runtime_error("Map key must be " +
+                             ValueHelper::typeToString(TypeInfo(keyType())));
+  }
+  return std::visit(
+      [&](const auto &k) -> int64_t {
+        using K = std::decay_t<decltype(k)>;
+        if constexpr (!std::is_arithmetic_v<K> &&
+                      !std::is_same_v<K, std::string>) {
+          throw std::runtime_error("Map keys must be scalars");
+        } else {
+          const std::vector<K> &keys = *_keys->buffer<K>();
+          size_t mask = _slots.size() - 1;
+          int64_t removed = -1;
+          for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            uint32_t slot = _slots[i];
+            if (slot == EMPTY) {
+              found = false;
+              return removed >= 0 ? removed : static_cast<int64_t>(i);
+            }
+            if (slot == REMOVED) {
+              if (removed < 0) {
+                removed = static_cast<int64_t>(i);
+              }
+            } else if (keys[slot - 1] == k) {
+              found = true;
+              return static_cast<int64_t>(i);
+            }
+          }
+        }
+      },
+      key);
+}
+
+bool MapValue::has(const Value &key) const {
+  bool found;
+  findSlot(key, hashKey(key), found);
+  return found;
+}
+
+bool MapValue::get(const Value &key, Value &value) const {
+  int64_t entry = find(key);
+  if (entry >= 0) {
+    value = valueAt(static_cast<size_t>(entry));
+  }
+  return entry >= 0;
+}
+
+int64_t MapValue::find(const Value &key) const {
+  bool found;
+  int64_t slot = findSlot(key, hashKey(key), found);
+  return found ? static_cast<int64_t>(_slots[slot]) - 1 : -1;
+}
+
+void MapValue::put(Value key, Value value) {
+  if (value.index() != static_cast<size_t>(valueType())) {
+    throw std::runtime_error("Map value must be " +
+                             ValueHelper::typeToString(TypeInfo(valueType())));
+  }
+  uint64_t hash = hashKey(key);
+  bool found;
+  int64_t slot = findSlot(key, hash, found);
+  unshare();
+  if (found) {
+    _values->set(_slots[slot] - 1, std::move(value));
+    return;
+  }
+  // Keep at least a quarter of the slots empty, tombstones included
+  if (_slots[slot] == EMPTY && (_used + 1) * 4 > _slots.size() * 3) {
+    rehash(size() + 1);
+    slot = findSlot(key, hash, found);
+  }
+  if (_slots[slot] == EMPTY) {
+    ++_used;
+  }
+  _slots[slot] = static_cast<uint32_t>(size() + 1);
+  _keys->push(std::move(key));
+  _values->push(std::move(value));
+}
+
+bool MapValue::remove(const Value &key) {
+  bool found;
+  int64_t slot = findSlot(key, hashKey(key), found);
+  if (!found) {
+    return false;
+  }
+  unshare();
+  size_t position = _slots[slot] - 1;
+  size_t last = size() - 1;
+  _slots[slot] = REMOVED;
+  if (position != last) {
+    Value moved = _keys->get(last);
+    int64_t movedSlot = findSlot(moved, hashKey(moved), found);
+    _slots[movedSlot] = static_cast<uint32_t>(position + 1);
+    _keys->set(position, std::move(moved));
+    _values->set(position, _values->get(last));
+  }
+  _keys->pop();
+  _values->pop();
+  return true;
+}
+
+void MapValue::rehash(size_t entries) {
+  size_t capacity = 8;
+  while (entries * 2 > capacity) {
+    capacity *= 2;
+  }
+  _slots.assign(capacity, EMPTY);
+  _used = size();
+  for (size_t i = 0; i < size(); ++i) {
+    Value key = _keys->get(i);
+    bool found;
+    _slots[findSlot(key, hashKey(key), found)] = static_cast<uint32_t>(i + 1);
+  }
+}
+
+void MapValue::unshare() {
+  if (_keys.use_count() > 1) {
+    _keys = std::make_shared<ArrayValue>(*_keys);
+  }
+}
+
+RecordValue::RecordValue(std::shared_ptr<const StructType> type)
+    : _type(std::move(type)) {
+  _fields.reserve(_type->fieldTypes.size());
+  for (const auto &fieldType : _type->fieldTypes) {
+    _fields.push_back(ValueHelper::defaultValue(fieldType));
+  }
+}
+
+size_t RecordValue::lookupField(const std::string &name) const {
+  int32_t index = _type->fieldIndex(name);
+  if (index < 0) {
+    throw std::runtime_error(_type->name + " has no field " + name);
+  }
+  return static_cast<size_t>(index);
+}
+
+void StringBuilderValue::append(const Value &value) {
+  if (const std::string *text = std::get_if<std::string>(&value)) {
+    append(*text);
+  } else {
+    append(ValueHelper::toString(value));
+  }
+}
+
+bool ValueHelper::needsConversion(const Value &val, const TypeInfo &type) {
+  if (type.isRecord()) {
+    const RecordPtr *record = std::get_if<RecordPtr>(&val);
+    return !record || !*record || (*record)->type() != type.structType;
+  }
+  // Scalar alternatives of Value are in DataType order
+  return !type.isArray && type.baseType <= DataType::BOOL &&
+         val.index() != static_cast<size_t>(type.baseType);
+}
+
 TypeInfo ValueHelper::getType(const Value &val) {
+  if (const MapPtr *map = std::get_if<MapPtr>(&val)) {
+    return *map ? TypeInfo::map((*map)->keyType(), (*map)->valueType())
+                : TypeInfo::map(DataType::VOID, DataType::VOID);
+  }
+  if (const RecordPtr *record = std::get_if<RecordPtr>(&val)) {
+    return *record ? TypeInfo::record((*record)->type())
+                   : TypeInfo(DataType::STRUCT);
+  }
+  if (std::holds_alternative<StringBuilderPtr>(val)) {
+    return TypeInfo(DataType::STRING_BUILDER);
+  }
   if (std::holds_alternative<ArrayPtr>(val)) {
-    ArrayPtr arr = std::get<ArrayPtr>(val);
+    const ArrayPtr &arr = std::get<ArrayPtr>(val);
     if (!arr) {
       return TypeInfo(DataType::VOID, true);
     }
-    return TypeInfo(arr->elementType, true);
+    TypeInfo type(arr->elementType(), true);
+    type.structType = arr->recordType();
+    return type;
   }
   if (std::holds_alternative<int8_t>(val))
     return TypeInfo(DataType::INT8);
@@ -75,6 +470,16 @@ std::string ValueHelper::typeToString(const TypeInfo &type) {
   case DataType::VOID:
     base = "void";
     break;
+  case DataType::MAP:
+    base = "map<" + typeToString(TypeInfo(type.keyType)) + ", " +
+           typeToString(TypeInfo(type.valueType)) + ">";
+    break;
+  case DataType::STRUCT:
+    base = type.structType ? type.structType->name : "struct";
+    break;
+  case DataType::STRING_BUILDER:
+    base = "stringbuilder";
+    break;
   }
   if (type.isArray) {
     base += "[]";
@@ -107,6 +512,8 @@ TypeInfo ValueHelper::stringToType(const std::string &str) {
     return TypeInfo(DataType::BOOL);
   if (str == "void")
     return TypeInfo(DataType::VOID);
+  if (str == "stringbuilder")
+    return TypeInfo(DataType::STRING_BUILDER);
   throw std::runtime_error("Unknown type: " + str);
 }
 
@@ -125,6 +532,12 @@ int64_t ValueHelper::toInt64(const Value &val) {
           return static_cast<int64_t>(arg);
         } else if constexpr (std::is_same_v<T, ArrayPtr>) {
           throw std::runtime_error("Cannot convert array to int64");
+        } else if constexpr (std::is_same_v<T, MapPtr>) {
+          throw std::runtime_error("Cannot convert map to int64");
+        } else if constexpr (std::is_same_v<T, RecordPtr>) {
+          throw std::runtime_error("Cannot convert record to int64");
+        } else if constexpr (std::is_same_v<T, StringBuilderPtr>) {
+          throw std::runtime_error("Cannot convert stringbuilder to int64");
         } else {
           return static_cast<int64_t>(arg);
         }
@@ -147,6 +560,12 @@ uint64_t ValueHelper::toUInt64(const Value &val) {
           return static_cast<uint64_t>(arg);
         } else if constexpr (std::is_same_v<T, ArrayPtr>) {
           throw std::runtime_error("Cannot convert array to uint64");
+        } else if constexpr (std::is_same_v<T, MapPtr>) {
+          throw std::runtime_error("Cannot convert map to uint64");
+        } else if constexpr (std::is_same_v<T, RecordPtr>) {
+          throw std::runtime_error("Cannot convert record to uint64");
+        } else if constexpr (std::is_same_v<T, StringBuilderPtr>) {
+          throw std::runtime_error("Cannot convert stringbuilder to uint64");
         } else {
           return static_cast<uint64_t>(arg);
         }
@@ -167,6 +586,12 @@ double ValueHelper::toDouble(const Value &val) {
           return arg ? 1.0 : 0.0;
         } else if constexpr (std::is_same_v<T, ArrayPtr>) {
           throw std::runtime_error("Cannot convert array to double");
+        } else if constexpr (std::is_same_v<T, MapPtr>) {
+          throw std::runtime_error("Cannot convert map to double");
+        } else if constexpr (std::is_same_v<T, RecordPtr>) {
+          throw std::runtime_error("Cannot convert record to double");
+        } else if constexpr (std::is_same_v<T, StringBuilderPtr>) {
+          throw std::runtime_error("Cannot convert stringbuilder to double");
         } else {
           return static_cast<double>(arg);
         }
@@ -175,8 +600,11 @@ double ValueHelper::toDouble(const Value &val) {
 }
 
 bool ValueHelper::toBool(const Value &val) {
-  if (std::holds_alternative<ArrayPtr>(val)) {
-    return true; // non-null arrays are truthy
+  if (std::holds_alternative<ArrayPtr>(val) ||
+      std::holds_alternative<MapPtr>(val) ||
+      std::holds_alternative<RecordPtr>(val) ||
+      std::holds_alternative<StringBuilderPtr>(val)) {
+    return true; // non-null arrays, maps, records and builders are truthy
   }
   return std::visit(
       [](auto &&arg) -> bool {
@@ -187,6 +615,10 @@ bool ValueHelper::toBool(const Value &val) {
           return arg;
         } else if constexpr (std::is_same_v<T, double>) {
           return arg != 0.0;
+        } else if constexpr (std::is_same_v<T, MapPtr> ||
+                             std::is_same_v<T, RecordPtr> ||
+                             std::is_same_v<T, StringBuilderPtr>) {
+          return true;
         } else {
           return arg != 0;
         }
@@ -198,6 +630,15 @@ std::string ValueHelper::toString(const Value &val) {
   if (std::holds_alternative<ArrayPtr>(val)) {
     return "[array]";
   }
+  if (std::holds_alternative<MapPtr>(val)) {
+    return "[map]";
+  }
+  if (std::holds_alternative<RecordPtr>(val)) {
+    return "[record]";
+  }
+  if (const StringBuilderPtr *builder = std::get_if<StringBuilderPtr>(&val)) {
+    return *builder ? (*builder)->contents() : std::string();
+  }
   return std::visit(
       [](auto &&arg) -> std::string {
         using T = std::decay_t<decltype(arg)>;
@@ -209,6 +650,12 @@ std::string ValueHelper::toString(const Value &val) {
           return std::to_string(arg);
         } else if constexpr (std::is_same_v<T, ArrayPtr>) {
           return std::string("[array]");
+        } else if constexpr (std::is_same_v<T, MapPtr>) {
+          return std::string("[map]");
+        } else if constexpr (std::is_same_v<T, RecordPtr>) {
+          return std::string("[record]");
+        } else if constexpr (std::is_same_v<T, StringBuilderPtr>) {
+          return arg ? arg->contents() : std::string();
         } else {
           return std::to_string(arg);
         }
@@ -216,21 +663,25 @@ std::string ValueHelper::toString(const Value &val) {
       val);
 }
 
-Value ValueHelper::add(const Value &a, const Value &b) {
-  TypeInfo aType = getType(a);
-  TypeInfo bType = getType(b);
+namespace {
+
+// Arithmetic with a string or array operand, and the reference for the
+// promotion rules the kernels below bake in
+Value genericAdd(const Value &a, const Value &b) {
+  TypeInfo aType = ValueHelper::getType(a);
+  TypeInfo bType = ValueHelper::getType(b);
   if (aType.isArray || bType.isArray) {
-    throw std::runtime_error("Operator + does not support arrays");
+    return ArrayArithmetic::apply(ElementwiseOp::ADD, a, b);
   }
 
   if (std::holds_alternative<std::string>(a) ||
       std::holds_alternative<std::string>(b)) {
-    return toString(a) + toString(b);
+    return ValueHelper::toString(a) + ValueHelper::toString(b);
   }
 
   if (aType.baseType == DataType::DOUBLE || bType.baseType == DataType::DOUBLE) {
-    double result = toDouble(a) + toDouble(b);
-    return createValue(DataType::DOUBLE, result);
+    double result = ValueHelper::toDouble(a) + ValueHelper::toDouble(b);
+    return ValueHelper::createValue(DataType::DOUBLE, result);
   }
 
   // Unsigned operations
@@ -238,120 +689,120 @@ Value ValueHelper::add(const Value &a, const Value &b) {
       aType.baseType == DataType::UINT32 || aType.baseType == DataType::UINT64 ||
       bType.baseType == DataType::UINT8 || bType.baseType == DataType::UINT16 ||
       bType.baseType == DataType::UINT32 || bType.baseType == DataType::UINT64) {
-    uint64_t result = toUInt64(a) + toUInt64(b);
+    uint64_t result = ValueHelper::toUInt64(a) + ValueHelper::toUInt64(b);
     DataType resultType =
         (static_cast<int>(aType.baseType) > static_cast<int>(bType.baseType)) ? aType.baseType : bType.baseType;
-    return createValue(resultType, result);
+    return ValueHelper::createValue(resultType, result);
   }
 
   // Signed operations
-  int64_t result = toInt64(a) + toInt64(b);
+  int64_t result = ValueHelper::toInt64(a) + ValueHelper::toInt64(b);
   DataType resultType =
       (static_cast<int>(aType.baseType) > static_cast<int>(bType.baseType)) ? aType.baseType : bType.baseType;
-  return createValue(resultType, result);
+  return ValueHelper::createValue(resultType, result);
 }
 
-Value ValueHelper::subtract(const Value &a, const Value &b) {
-  TypeInfo aType = getType(a);
-  TypeInfo bType = getType(b);
+Value genericSubtract(const Value &a, const Value &b) {
+  TypeInfo aType = ValueHelper::getType(a);
+  TypeInfo bType = ValueHelper::getType(b);
   if (aType.isArray || bType.isArray) {
-    throw std::runtime_error("Operator - does not support arrays");
+    return ArrayArithmetic::apply(ElementwiseOp::SUBTRACT, a, b);
   }
 
   if (aType.baseType == DataType::DOUBLE || bType.baseType == DataType::DOUBLE) {
-    double result = toDouble(a) - toDouble(b);
-    return createValue(DataType::DOUBLE, result);
+    double result = ValueHelper::toDouble(a) - ValueHelper::toDouble(b);
+    return ValueHelper::createValue(DataType::DOUBLE, result);
   }
 
   if (aType.baseType == DataType::UINT8 || aType.baseType == DataType::UINT16 ||
       aType.baseType == DataType::UINT32 || aType.baseType == DataType::UINT64 ||
       bType.baseType == DataType::UINT8 || bType.baseType == DataType::UINT16 ||
       bType.baseType == DataType::UINT32 || bType.baseType == DataType::UINT64) {
-    uint64_t result = toUInt64(a) - toUInt64(b);
+    uint64_t result = ValueHelper::toUInt64(a) - ValueHelper::toUInt64(b);
     DataType resultType =
         (static_cast<int>(aType.baseType) > static_cast<int>(bType.baseType)) ? aType.baseType : bType.baseType;
-    return createValue(resultType, result);
+    return ValueHelper::createValue(resultType, result);
   }
 
-  int64_t result = toInt64(a) - toInt64(b);
+  int64_t result = ValueHelper::toInt64(a) - ValueHelper::toInt64(b);
   DataType resultType =
       (static_cast<int>(aType.baseType) > static_cast<int>(bType.baseType)) ? aType.baseType : bType.baseType;
-  return createValue(resultType, result);
+  return ValueHelper::createValue(resultType, result);
 }
 
-Value ValueHelper::multiply(const Value &a, const Value &b) {
-  TypeInfo aType = getType(a);
-  TypeInfo bType = getType(b);
+Value genericMultiply(const Value &a, const Value &b) {
+  TypeInfo aType = ValueHelper::getType(a);
+  TypeInfo bType = ValueHelper::getType(b);
   if (aType.isArray || bType.isArray) {
-    throw std::runtime_error("Operator * does not support arrays");
+    return ArrayArithmetic::apply(ElementwiseOp::MULTIPLY, a, b);
   }
 
   if (aType.baseType == DataType::DOUBLE || bType.baseType == DataType::DOUBLE) {
-    double result = toDouble(a) * toDouble(b);
-    return createValue(DataType::DOUBLE, result);
+    double result = ValueHelper::toDouble(a) * ValueHelper::toDouble(b);
+    return ValueHelper::createValue(DataType::DOUBLE, result);
   }
 
   if (aType.baseType == DataType::UINT8 || aType.baseType == DataType::UINT16 ||
       aType.baseType == DataType::UINT32 || aType.baseType == DataType::UINT64 ||
       bType.baseType == DataType::UINT8 || bType.baseType == DataType::UINT16 ||
       bType.baseType == DataType::UINT32 || bType.baseType == DataType::UINT64) {
-    uint64_t result = toUInt64(a) * toUInt64(b);
+    uint64_t result = ValueHelper::toUInt64(a) * ValueHelper::toUInt64(b);
     DataType resultType =
         (static_cast<int>(aType.baseType) > static_cast<int>(bType.baseType)) ? aType.baseType : bType.baseType;
-    return createValue(resultType, result);
+    return ValueHelper::createValue(resultType, result);
   }
 
-  int64_t result = toInt64(a) * toInt64(b);
+  int64_t result = ValueHelper::toInt64(a) * ValueHelper::toInt64(b);
   DataType resultType =
       (static_cast<int>(aType.baseType) > static_cast<int>(bType.baseType)) ? aType.baseType : bType.baseType;
-  return createValue(resultType, result);
+  return ValueHelper::createValue(resultType, result);
 }
 
-Value ValueHelper::divide(const Value &a, const Value &b) {
-  TypeInfo ta = getType(a);
-  TypeInfo tb = getType(b);
+Value genericDivide(const Value &a, const Value &b) {
+  TypeInfo ta = ValueHelper::getType(a);
+  TypeInfo tb = ValueHelper::getType(b);
   if (ta.isArray || tb.isArray) {
-    throw std::runtime_error("Operator / does not support arrays");
+    return ArrayArithmetic::apply(ElementwiseOp::DIVIDE, a, b);
   }
 
   if (ta.baseType == DataType::DOUBLE || tb.baseType == DataType::DOUBLE) {
-    double divisor = toDouble(b);
+    double divisor = ValueHelper::toDouble(b);
     if (divisor == 0.0) {
       throw std::runtime_error("Division by zero");
     }
-    double result = toDouble(a) / divisor;
-    return createValue(DataType::DOUBLE, result);
+    double result = ValueHelper::toDouble(a) / divisor;
+    return ValueHelper::createValue(DataType::DOUBLE, result);
   }
 
   if (ta.baseType == DataType::UINT8 || ta.baseType == DataType::UINT16 ||
       ta.baseType == DataType::UINT32 || ta.baseType == DataType::UINT64 ||
       tb.baseType == DataType::UINT8 || tb.baseType == DataType::UINT16 ||
       tb.baseType == DataType::UINT32 || tb.baseType == DataType::UINT64) {
-    uint64_t divisor = toUInt64(b);
+    uint64_t divisor = ValueHelper::toUInt64(b);
     if (divisor == 0) {
       throw std::runtime_error("Division by zero");
     }
-    uint64_t result = toUInt64(a) / divisor;
+    uint64_t result = ValueHelper::toUInt64(a) / divisor;
     DataType resultType =
         (static_cast<int>(ta.baseType) > static_cast<int>(tb.baseType)) ? ta.baseType : tb.baseType;
-    return createValue(resultType, result);
+    return ValueHelper::createValue(resultType, result);
   }
 
-  int64_t divisor = toInt64(b);
+  int64_t divisor = ValueHelper::toInt64(b);
   if (divisor == 0) {
     throw std::runtime_error("Division by zero");
   }
-  int64_t result = toInt64(a) / divisor;
+  int64_t result = ValueHelper::toInt64(a) / divisor;
   DataType resultType =
       (static_cast<int>(ta.baseType) > static_cast<int>(tb.baseType)) ? ta.baseType : tb.baseType;
-  return createValue(resultType, result);
+  return ValueHelper::createValue(resultType, result);
 }
 
-Value ValueHelper::modulo(const Value &a, const Value &b) {
-  TypeInfo ta = getType(a);
-  TypeInfo tb = getType(b);
+Value genericModulo(const Value &a, const Value &b) {
+  TypeInfo ta = ValueHelper::getType(a);
+  TypeInfo tb = ValueHelper::getType(b);
   if (ta.isArray || tb.isArray) {
-    throw std::runtime_error("Operator % does not support arrays");
+    return ArrayArithmetic::apply(ElementwiseOp::MODULO, a, b);
   }
 
   if (ta.baseType == DataType::DOUBLE || tb.baseType == DataType::DOUBLE) {
@@ -362,24 +813,196 @@ Value ValueHelper::modulo(const Value &a, const Value &b) {
       ta.baseType == DataType::UINT32 || ta.baseType == DataType::UINT64 ||
       tb.baseType == DataType::UINT8 || tb.baseType == DataType::UINT16 ||
       tb.baseType == DataType::UINT32 || tb.baseType == DataType::UINT64) {
-    uint64_t divisor = toUInt64(b);
+    uint64_t divisor = ValueHelper::toUInt64(b);
     if (divisor == 0) {
       throw std::runtime_error("Modulo by zero");
     }
-    uint64_t result = toUInt64(a) % divisor;
+    uint64_t result = ValueHelper::toUInt64(a) % divisor;
     DataType resultType =
         (static_cast<int>(ta.baseType) > static_cast<int>(tb.baseType)) ? ta.baseType : tb.baseType;
-    return createValue(resultType, result);
+    return ValueHelper::createValue(resultType, result);
   }
 
-  int64_t divisor = toInt64(b);
+  int64_t divisor = ValueHelper::toInt64(b);
   if (divisor == 0) {
     throw std::runtime_error("Modulo by zero");
   }
-  int64_t result = toInt64(a) % divisor;
+  int64_t result = ValueHelper::toInt64(a) % divisor;
   DataType resultType =
       (static_cast<int>(ta.baseType) > static_cast<int>(tb.baseType)) ? ta.baseType : tb.baseType;
-  return createValue(resultType, result);
+  return ValueHelper::createValue(resultType, result);
+}
+
+// Binary arithmetic is dispatched through tables indexed by the variant
+// indices of both operands. Every numeric (and bool) pair gets a kernel with
+// its promotion baked in at compile time; pairs with a string or array
+// operand go to the generic implementations above.
+
+enum class ArithOp { ADD, SUBTRACT, MULTIPLY, DIVIDE, MODULO };
+
+using ArithKernel = Value (*)(const Value &, const Value &);
+
+constexpr size_t VALUE_TYPES = std::variant_size_v<Value>;
+
+// Variant indices line up with DataType up to BOOL
+constexpr DataType typeAt(size_t index) { return static_cast<DataType>(index); }
+
+constexpr bool isNumericIndex(size_t index) {
+  return index < VALUE_TYPES &&
+         (typeAt(index) <= DataType::DOUBLE || typeAt(index) == DataType::BOOL);
+}
+
+constexpr bool isUnsigned(DataType type) {
+  return type == DataType::UINT8 || type == DataType::UINT16 ||
+         type == DataType::UINT32 || type == DataType::UINT64;
+}
+
+// The larger of the two types, as the generic path picks it
+constexpr DataType promoted(DataType a, DataType b) {
+  return static_cast<int>(a) > static_cast<int>(b) ? a : b;
+}
+
+// Mirrors ValueHelper::createValue(type, int64_t) for a fixed type
+template <DataType R> Value fromSigned(int64_t v) {
+  if constexpr (R == DataType::INT8) {
+    return static_cast<int8_t>(v);
+  } else if constexpr (R == DataType::INT16) {
+    return static_cast<int16_t>(v);
+  } else if constexpr (R == DataType::INT64) {
+    return v;
+  } else if constexpr (R == DataType::BOOL) {
+    return v != 0;
+  } else {
+    return static_cast<int32_t>(v);
+  }
+}
+
+// Mirrors ValueHelper::createValue(type, uint64_t) for a fixed type
+template <DataType R> Value fromUnsigned(uint64_t v) {
+  if constexpr (R == DataType::UINT8) {
+    return static_cast<uint8_t>(v);
+  } else if constexpr (R == DataType::UINT16) {
+    return static_cast<uint16_t>(v);
+  } else if constexpr (R == DataType::UINT64) {
+    return v;
+  } else {
+    return static_cast<uint32_t>(v);
+  }
+}
+
+template <ArithOp Op> Value genericArith(const Value &a, const Value &b) {
+  if constexpr (Op == ArithOp::ADD) {
+    return genericAdd(a, b);
+  } else if constexpr (Op == ArithOp::SUBTRACT) {
+    return genericSubtract(a, b);
+  } else if constexpr (Op == ArithOp::MULTIPLY) {
+    return genericMultiply(a, b);
+  } else if constexpr (Op == ArithOp::DIVIDE) {
+    return genericDivide(a, b);
+  } else {
+    return genericModulo(a, b);
+  }
+}
+
+template <ArithOp Op, typename T> T integerArith(T x, T y) {
+  if constexpr (Op == ArithOp::ADD) {
+    return x + y;
+  } else if constexpr (Op == ArithOp::SUBTRACT) {
+    return x - y;
+  } else if constexpr (Op == ArithOp::MULTIPLY) {
+    return x * y;
+  } else {
+    if (y == 0) {
+      throw std::runtime_error(Op == ArithOp::DIVIDE ? "Division by zero"
+                                                     : "Modulo by zero");
+    }
+    return Op == ArithOp::DIVIDE ? x / y : x % y;
+  }
+}
+
+template <ArithOp Op, size_t I, size_t J>
+Value arithKernel(const Value &a, const Value &b) {
+  if constexpr (!isNumericIndex(I) || !isNumericIndex(J)) {
+    return genericArith<Op>(a, b);
+  } else {
+    constexpr DataType ta = typeAt(I);
+    constexpr DataType tb = typeAt(J);
+    const auto x = *std::get_if<I>(&a);
+    const auto y = *std::get_if<J>(&b);
+
+    if constexpr (ta == DataType::DOUBLE || tb == DataType::DOUBLE) {
+      double dx = static_cast<double>(x);
+      double dy = static_cast<double>(y);
+      if constexpr (Op == ArithOp::ADD) {
+        return dx + dy;
+      } else if constexpr (Op == ArithOp::SUBTRACT) {
+        return dx - dy;
+      } else if constexpr (Op == ArithOp::MULTIPLY) {
+        return dx * dy;
+      } else if constexpr (Op == ArithOp::DIVIDE) {
+        if (dy == 0.0) {
+          throw std::runtime_error("Division by zero");
+        }
+        return dx / dy;
+      } else {
+        throw std::runtime_error("Modulo not supported for floating point");
+      }
+    } else if constexpr (isUnsigned(ta) || isUnsigned(tb)) {
+      return fromUnsigned<promoted(ta, tb)>(integerArith<Op>(
+          static_cast<uint64_t>(x), static_cast<uint64_t>(y)));
+    } else {
+      return fromSigned<promoted(ta, tb)>(integerArith<Op>(
+          static_cast<int64_t>(x), static_cast<int64_t>(y)));
+    }
+  }
+}
+
+template <ArithOp Op, size_t... K>
+constexpr std::array<ArithKernel, sizeof...(K)>
+makeArithTable(std::index_sequence<K...>) {
+  return {{&arithKernel<Op, K / VALUE_TYPES, K % VALUE_TYPES>...}};
+}
+
+template <ArithOp Op>
+constexpr std::array<ArithKernel, VALUE_TYPES * VALUE_TYPES> ARITH_TABLE =
+    makeArithTable<Op>(std::make_index_sequence<VALUE_TYPES * VALUE_TYPES>{});
+
+template <ArithOp Op> Value dispatchArith(const Value &a, const Value &b) {
+  return ARITH_TABLE<Op>[a.index() * VALUE_TYPES + b.index()](a, b);
+}
+
+} // namespace
+
+Value ValueHelper::add(const Value &a, const Value &b) {
+  return dispatchArith<ArithOp::ADD>(a, b);
+}
+
+Value ValueHelper::subtract(const Value &a, const Value &b) {
+  return dispatchArith<ArithOp::SUBTRACT>(a, b);
+}
+
+Value ValueHelper::multiply(const Value &a, const Value &b) {
+  return dispatchArith<ArithOp::MULTIPLY>(a, b);
+}
+
+Value ValueHelper::divide(const Value &a, const Value &b) {
+  return dispatchArith<ArithOp::DIVIDE>(a, b);
+}
+
+Value ValueHelper::modulo(const Value &a, const Value &b) {
+  return dispatchArith<ArithOp::MODULO>(a, b);
+}
+
+bool ValueHelper::appendString(std::string &target, const Value &b) {
+  if (std::holds_alternative<ArrayPtr>(b)) {
+    return false;
+  }
+  if (const std::string *text = std::get_if<std::string>(&b)) {
+    target.append(*text);
+  } else {
+    target.append(toString(b));
+  }
+  return true;
 }
 
 bool ValueHelper::greaterThan(const Value &a, const Value &b) {
@@ -451,14 +1074,49 @@ bool arraysEqual(const ArrayPtr &lhs, const ArrayPtr &rhs) {
   if (!lhs || !rhs) {
     return lhs == rhs;
   }
-  if (lhs->elementType != rhs->elementType) {
+  if (lhs->elementType() != rhs->elementType()) {
     return false;
   }
-  if (lhs->elements.size() != rhs->elements.size()) {
+  if (lhs->size() != rhs->size() || lhs->shape() != rhs->shape()) {
     return false;
   }
-  for (size_t i = 0; i < lhs->elements.size(); ++i) {
-    if (!ValueHelper::equals(lhs->elements[i], rhs->elements[i])) {
+  for (size_t i = 0; i < lhs->size(); ++i) {
+    if (!ValueHelper::equals(lhs->get(i), rhs->get(i))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool mapsEqual(const MapPtr &lhs, const MapPtr &rhs) {
+  if (!lhs || !rhs || lhs == rhs) {
+    return lhs == rhs;
+  }
+  if (lhs->keyType() != rhs->keyType() ||
+      lhs->valueType() != rhs->valueType() || lhs->size() != rhs->size()) {
+    return false;
+  }
+  const ArrayValue &keys = *lhs->keys();
+  for (size_t i = 0; i < keys.size(); ++i) {
+    Value key = keys.get(i);
+    Value left, right;
+    lhs->get(key, left);
+    if (!rhs->get(key, right) || !ValueHelper::equals(left, right)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool recordsEqual(const RecordPtr &lhs, const RecordPtr &rhs) {
+  if (!lhs || !rhs || lhs == rhs) {
+    return lhs == rhs;
+  }
+  if (lhs->type() != rhs->type()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs->fieldCount(); ++i) {
+    if (!ValueHelper::equals(lhs->field(i), rhs->field(i))) {
       return false;
     }
   }
@@ -467,6 +1125,18 @@ bool arraysEqual(const ArrayPtr &lhs, const ArrayPtr &rhs) {
 } // namespace
 
 bool ValueHelper::equals(const Value &a, const Value &b) {
+  if (isMap(a) || isMap(b)) {
+    return isMap(a) && isMap(b) &&
+           mapsEqual(std::get<MapPtr>(a), std::get<MapPtr>(b));
+  }
+  if (isRecord(a) || isRecord(b)) {
+    return isRecord(a) && isRecord(b) &&
+           recordsEqual(std::get<RecordPtr>(a), std::get<RecordPtr>(b));
+  }
+  if (isStringBuilder(a) || isStringBuilder(b)) {
+    return isStringBuilder(a) && isStringBuilder(b) &&
+           std::get<StringBuilderPtr>(a) == std::get<StringBuilderPtr>(b);
+  }
   TypeInfo ta = getType(a);
   TypeInfo tb = getType(b);
   if (ta.isArray || tb.isArray) {
@@ -522,14 +1192,16 @@ bool ValueHelper::logicalNot(const Value &a) { return !toBool(a); }
 
 namespace {
 template <typename Func>
-Value applyIntBinary(const Value &a, const Value &b, Func fn, const char *opName) {
+Value applyIntBinary(const Value &a, const Value &b, Func fn, ElementwiseOp op) {
   TypeInfo aType = ValueHelper::getType(a);
   TypeInfo bType = ValueHelper::getType(b);
 
   if (aType.isArray || bType.isArray) {
-    throw std::runtime_error(std::string("Operator ") + opName + " does not support arrays");
+    return ArrayArithmetic::apply(op, a, b);
   }
 
+  const char *opName = ArrayArithmetic::symbol(op);
+
   auto ensureInt = [&](DataType t) {
     switch (t) {
     case DataType::INT8:
@@ -564,6 +1236,13 @@ Value applyIntBinary(const Value &a, const Value &b, Func fn, const char *opName
 }
 } // namespace
 
+Value ValueHelper::negate(const Value &a) {
+  if (getType(a).baseType == DataType::DOUBLE) {
+    return createValue(DataType::DOUBLE, -toDouble(a));
+  }
+  return createValue(DataType::INT32, -toInt64(a));
+}
+
 Value ValueHelper::bitNot(const Value &a) {
   TypeInfo aType = getType(a);
   if (aType.isArray) {
@@ -601,33 +1280,60 @@ Value ValueHelper::bitNot(const Value &a) {
 }
 
 Value ValueHelper::bitAnd(const Value &a, const Value &b) {
-  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs & rhs; }, "&");
+  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs & rhs; },
+                        ElementwiseOp::BIT_AND);
 }
 
 Value ValueHelper::bitOr(const Value &a, const Value &b) {
-  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs | rhs; }, "|");
+  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs | rhs; },
+                        ElementwiseOp::BIT_OR);
 }
 
 Value ValueHelper::bitXor(const Value &a, const Value &b) {
-  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs ^ rhs; }, "^");
+  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs ^ rhs; },
+                        ElementwiseOp::BIT_XOR);
 }
 
 Value ValueHelper::lshift(const Value &a, const Value &b) {
-  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs << rhs; }, "<<");
+  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs << rhs; },
+                        ElementwiseOp::SHIFT_LEFT);
 }
 
 Value ValueHelper::rshift(const Value &a, const Value &b) {
-  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs >> rhs; }, ">>");
+  return applyIntBinary(a, b, [](auto lhs, auto rhs) { return lhs >> rhs; },
+                        ElementwiseOp::SHIFT_RIGHT);
 }
 
 ArrayPtr ValueHelper::createArray(const TypeInfo &elementType, const std::vector<Value> &elements) {
-  if (elementType.isArray) {
-    throw std::runtime_error("Nested arrays are not supported");
+  if (!elementType.isArray) {
+    auto array = std::make_shared<ArrayValue>(elementType.baseType, elements);
+    array->setRecordType(elementType.structType);
+    return array;
   }
-  auto arr = std::make_shared<ArrayValue>();
-  arr->elementType = elementType.baseType;
-  arr->elements = elements;
-  return arr;
+
+  // Arrays of equally shaped arrays stack into one more dimension
+  std::vector<Value> flat;
+  std::vector<size_t> inner;
+  for (const auto &element : elements) {
+    const auto *array = std::get_if<ArrayPtr>(&element);
+    if (!array) {
+      throw std::runtime_error("Nested array elements must all be arrays");
+    }
+    if (&element == &elements[0]) {
+      inner = (*array)->shape();
+    } else if ((*array)->shape() != inner) {
+      throw std::runtime_error("Nested arrays must all have the same shape");
+    }
+    std::vector<Value> values = (*array)->toValues();
+    flat.insert(flat.end(), values.begin(), values.end());
+  }
+  std::vector<size_t> shape = {elements.size()};
+  shape.insert(shape.end(), inner.begin(), inner.end());
+
+  auto array = std::make_shared<ArrayValue>(elementType.baseType, flat,
+                                            std::move(shape));
+  array->setRecordType(elementType.structType);
+  return array;
 }
 
 bool ValueHelper::isArray(const Value &val) { return std::holds_alternative<ArrayPtr>(val); }
@@ -640,21 +1346,132 @@ TypeInfo ValueHelper::arrayElementType(const Value &val) {
   if (!arr) {
     return TypeInfo(DataType::VOID);
   }
-  return TypeInfo(arr->elementType);
+  TypeInfo type(arr->elementType());
+  type.structType = arr->recordType();
+  return type;
 }
 
-std::vector<Value> &ValueHelper::arrayElements(Value &val) {
-  if (!isArray(val)) {
+ArrayValue &ValueHelper::arrayValue(const Value &val) {
+  const ArrayPtr *arr = std::get_if<ArrayPtr>(&val);
+  if (!arr || !*arr) {
     throw std::runtime_error("Value is not an array");
   }
-  return std::get<ArrayPtr>(val)->elements;
+  return **arr;
 }
 
-const std::vector<Value> &ValueHelper::arrayElements(const Value &val) {
-  if (!isArray(val)) {
+ArrayValue &ValueHelper::mutableArray(Value &val) {
+  ArrayPtr *arr = std::get_if<ArrayPtr>(&val);
+  if (!arr || !*arr) {
     throw std::runtime_error("Value is not an array");
   }
-  return std::get<ArrayPtr>(val)->elements;
+  if (arr->use_count() > 1) {
+    *arr = std::make_shared<ArrayValue>(**arr);
+  }
+  return **arr;
+}
+
+Value ValueHelper::ownedByScript(Value val) {
+  const ArrayPtr *arr = std::get_if<ArrayPtr>(&val);
+  if (!arr || !*arr || !(*arr)->hostOwned()) {
+    return val;
+  }
+  auto copy = std::make_shared<ArrayValue>(**arr);
+  copy->setHostOwned(false);
+  return copy;
+}
+
+Value ValueHelper::indexArray(const Value &val, const Value *indices,
+                              size_t count) {
+  const ArrayPtr &array = std::get<ArrayPtr>(val);
+  if (count > array->rank()) {
+    throw std::runtime_error("Indexing non-array value");
+  }
+  size_t position = 0;
+  for (size_t axis = 0; axis < count; ++axis) {
+    uint64_t index = toUInt64(indices[axis]);
+    if (index >= array->extent(axis)) {
+      throw std::runtime_error("Array index out of bounds");
+    }
+    position = position * array->extent(axis) + index;
+  }
+  if (count == array->rank()) {
+    return array->get(position);
+  }
+
+  std::vector<size_t> shape = array->shape();
+  shape.erase(shape.begin(), shape.begin() + count);
+  size_t length = 1;
+  for (size_t extent : shape) {
+    length *= extent;
+  }
+  return ArrayValue::view(array, position * length, length, std::move(shape));
+}
+
+size_t ValueHelper::elementOffset(const ArrayValue &array,
+                                  const Value *indices, size_t count) {
+  if (count > array.rank()) {
+    throw std::runtime_error("Index assignment on non-array value");
+  }
+  if (count < array.rank()) {
+    throw std::runtime_error("Index assignment needs " +
+                             std::to_string(array.rank()) + " indices");
+  }
+  size_t position = 0;
+  for (size_t axis = 0; axis < count; ++axis) {
+    uint64_t index = toUInt64(indices[axis]);
+    if (index >= array.extent(axis)) {
+      throw std::runtime_error("Array index out of bounds");
+    }
+    position = position * array.extent(axis) + index;
+  }
+  return position;
+}
+
+MapPtr ValueHelper::createMap(const TypeInfo &type) {
+  if (!type.isMap()) {
+    throw std::runtime_error("Expected a map type");
+  }
+  return std::make_shared<MapValue>(type.keyType, type.valueType);
+}
+
+bool ValueHelper::isMap(const Value &val) {
+  return std::holds_alternative<MapPtr>(val);
+}
+
+MapValue &ValueHelper::mapValue(const Value &val) {
+  const MapPtr *map = std::get_if<MapPtr>(&val);
+  if (!map || !*map) {
+    throw std::runtime_error("Value is not a map");
+  }
+  return **map;
+}
+
+bool ValueHelper::isRecord(const Value &val) {
+  return std::holds_alternative<RecordPtr>(val);
+}
+
+RecordValue &ValueHelper::recordValue(const Value &val) {
+  const RecordPtr *record = std::get_if<RecordPtr>(&val);
+  if (!record || !*record) {
+    throw std::runtime_error("Value is not a record");
+  }
+  return **record;
+}
+
+bool ValueHelper::isStringBuilder(const Value &val) {
+  return std::holds_alternative<StringBuilderPtr>(val);
+}
+
+StringBuilderValue &ValueHelper::stringBuilderValue(const Value &val) {
+  const StringBuilderPtr *builder = std::get_if<StringBuilderPtr>(&val);
+  if (!builder || !*builder) {
+    throw std::runtime_error("Value is not a stringbuilder");
+  }
+  return **builder;
+}
+
+std::vector<Value> ValueHelper::arrayElements(const Value &val) {
+  return arrayValue(val).toValues();
 }
 
 Value ValueHelper::convertElement(const Value &val, const TypeInfo &target) {
@@ -681,6 +1498,16 @@ Value ValueHelper::convertElement(const Value &val, const TypeInfo &target) {
     return createValue(t, toBool(val));
   case DataType::VOID:
     throw std::runtime_error("Cannot store void elements in array");
+  case DataType::MAP:
+    throw std::runtime_error("Cannot store maps in an array or map");
+  case DataType::STRUCT:
+    if (!isRecord(val) || recordValue(val).type() != target.structType) {
+      throw std::runtime_error("Cannot convert " + typeToString(getType(val)) +
+                               " to " + typeToString(target));
+    }
+    return val;
+  case DataType::STRING_BUILDER:
+    throw std::runtime_error("Cannot store stringbuilders in an array or map");
   }
   throw std::runtime_error("Unsupported element conversion");
 }
@@ -754,4 +1581,52 @@ Value ValueHelper::createValue(DataType type, bool boolVal) {
   throw std::runtime_error("Cannot create non-bool value from bool");
 }
 
+Value ValueHelper::defaultValue(const TypeInfo &type) {
+  if (type.isArray) {
+    TypeInfo elementType(type.baseType);
+    elementType.structType = type.structType;
+    return createArray(elementType, {});
+  }
+  if (type.isMap()) {
+    return createMap(type);
+  }
+  if (type.isRecord()) {
+    return std::make_shared<RecordValue>(type.structType);
+  }
+  if (type.isStringBuilder()) {
+    return std::make_shared<StringBuilderValue>();
+  }
+
+  switch (type.baseType) {
+  case DataType::INT8:
+    return static_cast<int8_t>(0);
+  case DataType::UINT8:
+    return static_cast<uint8_t>(0);
+  case DataType::INT16:
+    return static_cast<int16_t>(0);
+  case DataType::UINT16:
+    return static_cast<uint16_t>(0);
+  case DataType::INT32:
+    return static_cast<int32_t>(0);
+  case DataType::UINT32:
+    return static_cast<uint32_t>(0);
+  case DataType::INT64:
+    return static_cast<int64_t>(0);
+  case DataType::UINT64:
+    return static_cast<uint64_t>(0);
+  case DataType::DOUBLE:
+    return 0.0;
+  case DataType::STRING:
+    return std::string("");
+  case DataType::BOOL:
+    return false;
+  case DataType::VOID:
+  case DataType::MAP:
+  case DataType::STRUCT:
+  case DataType::STRING_BUILDER:
+    break;
+  }
+  return static_cast<int32_t>(0);
+}
+
 } // namespace Script
@@ -0,0 +1,425 @@
+#include "Inliner.h"
+#include "TypeChecker.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Script {
+
+namespace {
+
+// Counts the nodes of proc's expr, or returns limit + 1 once it has more
+// than limit, a local other than a parameter, a push or pop, or a call to
+// proc itself
+size_t measure(const ProcedureDecl &proc, const Expression *expr,
+               size_t limit) {
+  size_t size = 1;
+  auto add = [&](const ExprPtr &child) {
+    if (size <= limit) {
+      size += measure(proc, child.get(), limit - size);
+    }
+  };
+
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+    break;
+  case NodeKind::VARIABLE: {
+    int32_t slot = static_cast<const VariableExpr *>(expr)->slot;
+    if (slot >= static_cast<int32_t>(proc.parameters.size())) {
+      return limit + 1;
+    }
+    break;
+  }
+  case NodeKind::BINARY: {
+    auto *bin = static_cast<const BinaryExpr *>(expr);
+    add(bin->left);
+    add(bin->right);
+    break;
+  }
+  case NodeKind::UNARY:
+    add(static_cast<const UnaryExpr *>(expr)->operand);
+    break;
+  case NodeKind::CALL: {
+    auto *call = static_cast<const CallExpr *>(expr);
+    if (call->functionName == "push" || call->functionName == "pop" ||
+        call->functionName == proc.name) {
+      return limit + 1;
+    }
+    for (const auto &arg : call->arguments) {
+      add(arg);
+    }
+    break;
+  }
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<const ConditionalExpr *>(expr);
+    add(cond->condition);
+    add(cond->thenExpr);
+    add(cond->elseExpr);
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL:
+    for (const auto &e :
+         static_cast<const ArrayLiteralExpr *>(expr)->elements) {
+      add(e);
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *idx = static_cast<const IndexExpr *>(expr);
+    add(idx->arrayExpr);
+    add(idx->indexExpr);
+    break;
+  }
+  case NodeKind::FIELD:
+    add(static_cast<const FieldExpr *>(expr)->object);
+    break;
+  case NodeKind::RECORD:
+    for (const auto &e : static_cast<const RecordExpr *>(expr)->fields) {
+      add(e);
+    }
+    break;
+  default:
+    return limit + 1;
+  }
+  return size;
+}
+
+bool isLocalOrLiteral(const Expression &expr) {
+  return expr.kind == NodeKind::LITERAL ||
+         (expr.kind == NodeKind::VARIABLE &&
+          static_cast<const VariableExpr &>(expr).slot >= 0);
+}
+
+} // namespace
+
+const Expression *Inliner::inlinableBody(const ProcedureDecl &proc) {
+  if (proc.native || !proc.body || proc.body->kind != NodeKind::BLOCK ||
+      !proc.returnsTyped ||
+      (proc.returnType.baseType == DataType::VOID &&
+       !proc.returnType.isArray)) {
+    return nullptr;
+  }
+
+  // Locals that cannot fail to initialize may come first
+  const auto &statements =
+      static_cast<const BlockStmt *>(proc.body.get())->statements;
+  if (statements.empty()) {
+    return nullptr;
+  }
+  for (size_t i = 0; i + 1 < statements.size(); ++i) {
+    if (statements[i]->kind != NodeKind::VAR_DECL) {
+      return nullptr;
+    }
+    auto *decl = static_cast<const VarDeclStmt *>(statements[i].get());
+    if (!decl->initializer || decl->initializer->kind != NodeKind::LITERAL ||
+        ValueHelper::getType(
+            static_cast<const LiteralExpr *>(decl->initializer.get())
+                ->value) != decl->type) {
+      return nullptr;
+    }
+  }
+
+  if (statements.back()->kind != NodeKind::RETURN) {
+    return nullptr;
+  }
+  const Expression *value =
+      static_cast<const ReturnStmt *>(statements.back().get())->value.get();
+  if (!value || measure(proc, value, MAX_NODES) > MAX_NODES) {
+    return nullptr;
+  }
+  return value;
+}
+
+void Inliner::run(ProcedureDecl &proc) {
+  if (!proc.body) {
+    return;
+  }
+  _expanding.assign(1, &proc);
+  _callees.clear();
+  visitStatement(proc.body.get());
+  _expanding.clear();
+}
+
+void Inliner::visitStatement(Statement *stmt) {
+  if (!stmt) {
+    return;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    visitExpression(static_cast<ExpressionStmt *>(stmt)->expression.get());
+    break;
+  case NodeKind::VAR_DECL:
+    visitExpression(static_cast<VarDeclStmt *>(stmt)->initializer.get());
+    break;
+  case NodeKind::ASSIGN:
+    visitExpression(static_cast<AssignStmt *>(stmt)->value.get());
+    break;
+  case NodeKind::INDEX_ASSIGN: {
+    auto *idxAssign = static_cast<IndexAssignStmt *>(stmt);
+    visitExpression(idxAssign->arrayExpr.get());
+    visitExpression(idxAssign->indexExpr.get());
+    visitExpression(idxAssign->value.get());
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *fieldAssign = static_cast<FieldAssignStmt *>(stmt);
+    visitExpression(fieldAssign->object.get());
+    visitExpression(fieldAssign->value.get());
+    break;
+  }
+  case NodeKind::BLOCK:
+    for (auto &s : static_cast<BlockStmt *>(stmt)->statements) {
+      visitStatement(s.get());
+    }
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    visitExpression(ifStmt->condition.get());
+    visitStatement(ifStmt->thenBranch.get());
+    visitStatement(ifStmt->elseBranch.get());
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *whileStmt = static_cast<WhileStmt *>(stmt);
+    visitExpression(whileStmt->condition.get());
+    visitStatement(whileStmt->body.get());
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *forStmt = static_cast<ForStmt *>(stmt);
+    visitStatement(forStmt->initializer.get());
+    visitExpression(forStmt->condition.get());
+    visitStatement(forStmt->increment.get());
+    visitStatement(forStmt->body.get());
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *doWhile = static_cast<DoWhileStmt *>(stmt);
+    visitStatement(doWhile->body.get());
+    visitExpression(doWhile->condition.get());
+    break;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt);
+    visitExpression(switchStmt->expression.get());
+    for (auto &caseEntry : switchStmt->cases) {
+      visitExpression(caseEntry.matchExpr.get());
+      for (auto &s : caseEntry.statements) {
+        visitStatement(s.get());
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN:
+    visitExpression(static_cast<ReturnStmt *>(stmt)->value.get());
+    break;
+  case NodeKind::BREAK:
+  case NodeKind::CONTINUE:
+    break;
+  default:
+    throw std::runtime_error("Unknown statement type");
+  }
+}
+
+void Inliner::visitExpression(Expression *expr) {
+  if (!expr) {
+    return;
+  }
+
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+  case NodeKind::VARIABLE:
+    break;
+  case NodeKind::BINARY: {
+    auto *bin = static_cast<BinaryExpr *>(expr);
+    visitExpression(bin->left.get());
+    visitExpression(bin->right.get());
+    break;
+  }
+  case NodeKind::UNARY:
+    visitExpression(static_cast<UnaryExpr *>(expr)->operand.get());
+    break;
+  case NodeKind::CALL: {
+    auto *call = static_cast<CallExpr *>(expr);
+    for (auto &arg : call->arguments) {
+      visitExpression(arg.get());
+    }
+    inlineCall(*call);
+    break;
+  }
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr);
+    visitExpression(cond->condition.get());
+    visitExpression(cond->thenExpr.get());
+    visitExpression(cond->elseExpr.get());
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL:
+    for (auto &e : static_cast<ArrayLiteralExpr *>(expr)->elements) {
+      visitExpression(e.get());
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    visitExpression(idx->arrayExpr.get());
+    visitExpression(idx->indexExpr.get());
+    break;
+  }
+  case NodeKind::FIELD:
+    visitExpression(static_cast<FieldExpr *>(expr)->object.get());
+    break;
+  case NodeKind::RECORD:
+    for (auto &e : static_cast<RecordExpr *>(expr)->fields) {
+      visitExpression(e.get());
+    }
+    break;
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+}
+
+void Inliner::inlineCall(CallExpr &call) {
+  call.inlined.reset();
+  call.inlinedProcedure.reset();
+
+  // len, push and pop are built in ahead of procedures
+  const std::string &fn = call.functionName;
+  if (fn == "len" || fn == "push" || fn == "pop") {
+    return;
+  }
+  _callees.insert(fn);
+  auto it = _procedures.find(fn);
+  if (it == _procedures.end() || _expanding.size() > MAX_DEPTH) {
+    return;
+  }
+  const ProcedureDeclPtr &callee = it->second;
+  if (std::find(_expanding.begin(), _expanding.end(), callee.get()) !=
+      _expanding.end()) {
+    return;
+  }
+  const Expression *body = inlinableBody(*callee);
+  if (!body || call.arguments.size() != callee->parameters.size()) {
+    return;
+  }
+
+  for (size_t i = 0; i < call.arguments.size(); ++i) {
+    const TypeInfo &paramType = callee->parameters[i].type;
+    const Expression &arg = *call.arguments[i];
+    if (!isLocalOrLiteral(arg) || !TypeChecker::trusted(paramType) ||
+        !(arg.staticType == paramType)) {
+      return;
+    }
+  }
+
+  _expanding.push_back(callee.get());
+  call.inlined = copy(*body, call.arguments);
+  _expanding.pop_back();
+  call.inlinedProcedure = callee;
+}
+
+ExprPtr Inliner::copy(const Expression &expr,
+                      const std::vector<ExprPtr> &arguments) {
+  ExprPtr result;
+
+  switch (expr.kind) {
+  case NodeKind::LITERAL: {
+    auto &lit = static_cast<const LiteralExpr &>(expr);
+    result = std::make_shared<LiteralExpr>(lit.value, lit.type, lit.line,
+                                           lit.column);
+    break;
+  }
+  case NodeKind::VARIABLE: {
+    auto &var = static_cast<const VariableExpr &>(expr);
+    if (var.slot >= 0 && !arguments.empty()) {
+      // A parameter (the only locals inlinableBody lets through)
+      return copy(*arguments[static_cast<size_t>(var.slot)], {});
+    }
+    // An external variable, or a caller's local passed as an argument
+    auto copied =
+        std::make_shared<VariableExpr>(var.name, var.line, var.column);
+    copied->slot = var.slot;
+    result = copied;
+    break;
+  }
+  case NodeKind::BINARY: {
+    auto &bin = static_cast<const BinaryExpr &>(expr);
+    result = std::make_shared<BinaryExpr>(copy(*bin.left, arguments),
+                                          copy(*bin.right, arguments), bin.op,
+                                          bin.line, bin.column);
+    break;
+  }
+  case NodeKind::UNARY: {
+    auto &un = static_cast<const UnaryExpr &>(expr);
+    result = std::make_shared<UnaryExpr>(copy(*un.operand, arguments), un.op,
+                                         un.line, un.column);
+    break;
+  }
+  case NodeKind::CALL: {
+    auto &call = static_cast<const CallExpr &>(expr);
+    std::vector<ExprPtr> args;
+    args.reserve(call.arguments.size());
+    for (const auto &arg : call.arguments) {
+      args.push_back(copy(*arg, arguments));
+    }
+    auto inner = std::make_shared<CallExpr>(call.functionName, args,
+                                            call.line, call.column);
+    inner->checkedProcedure = call.checkedProcedure;
+    inner->argumentsTyped = call.argumentsTyped;
+    inner->staticType = call.staticType;
+    inlineCall(*inner);
+    return inner;
+  }
+  case NodeKind::CONDITIONAL: {
+    auto &cond = static_cast<const ConditionalExpr &>(expr);
+    result = std::make_shared<ConditionalExpr>(
+        copy(*cond.condition, arguments), copy(*cond.thenExpr, arguments),
+        copy(*cond.elseExpr, arguments), cond.line, cond.column);
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL: {
+    auto &array = static_cast<const ArrayLiteralExpr &>(expr);
+    std::vector<ExprPtr> elements;
+    elements.reserve(array.elements.size());
+    for (const auto &e : array.elements) {
+      elements.push_back(copy(*e, arguments));
+    }
+    result = std::make_shared<ArrayLiteralExpr>(elements, array.line,
+                                                array.column);
+    break;
+  }
+  case NodeKind::INDEX: {
+    auto &idx = static_cast<const IndexExpr &>(expr);
+    result = std::make_shared<IndexExpr>(copy(*idx.arrayExpr, arguments),
+                                         copy(*idx.indexExpr, arguments),
+                                         idx.line, idx.column);
+    break;
+  }
+  case NodeKind::FIELD: {
+    auto &access = static_cast<const FieldExpr &>(expr);
+    auto field = std::make_shared<FieldExpr>(copy(*access.object, arguments),
+                                             access.field, access.line,
+                                             access.column);
+    field->structType = access.structType;
+    field->index = access.index;
+    result = field;
+    break;
+  }
+  case NodeKind::RECORD: {
+    auto &record = static_cast<const RecordExpr &>(expr);
+    std::vector<ExprPtr> fields;
+    fields.reserve(record.fields.size());
+    for (const auto &e : record.fields) {
+      fields.push_back(copy(*e, arguments));
+    }
+    result = std::make_shared<RecordExpr>(record.type, fields, record.line,
+                                          record.column);
+    break;
+  }
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+
+  result->staticType = expr.staticType;
+  return result;
+}
+
+} // namespace Script
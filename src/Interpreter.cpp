@@ -1,181 +1,67 @@
 #include "Interpreter.h"
-#include <limits>
+#include "ArrayBuiltins.h"
+#include "ClosureCompiler.h"
+#include "Inliner.h"
+#include "JitCompiler.h"
+#include "MapBuiltins.h"
+#include "NativeModule.h"
+#include "Resolver.h"
+#include "ScalarTypes.h"
+#include "StringBuilderBuiltins.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <iomanip>
 #include <sstream>
 #include <utility>
 
 namespace Script {
 
-// Environment Implementation
-void Interpreter::Environment::define(const std::string &name,
-                                      const Value &value) {
-  if (!_scopes.empty()) {
-    auto &scope = _scopes.back();
-    auto inserted = scope.emplace(name, value);
-    if (!inserted.second) {
-      inserted.first->second = value;
-    } else {
-      _scopeNames.back().push_back(name);
-    }
-    _lookupCache[name] = _scopes.size() - 1;
-  } else {
-    _globals[name] = value;
-    _lookupCache[name] = GLOBAL;
-  }
-}
-
-Value Interpreter::Environment::get(const std::string &name) const {
-  auto cacheIt = _lookupCache.find(name);
-  if (cacheIt != _lookupCache.end()) {
-    size_t idx = cacheIt->second;
-    if (idx == GLOBAL) {
-      auto gIt = _globals.find(name);
-      if (gIt != _globals.end()) {
-        return gIt->second;
-      }
-      _lookupCache.erase(cacheIt);
-    } else if (idx < _scopes.size()) {
-      const auto &scope = _scopes[idx];
-      auto sIt = scope.find(name);
-      if (sIt != scope.end()) {
-        return sIt->second;
-      }
-      _lookupCache.erase(cacheIt);
-    }
-  }
-
-  // Search from innermost to outermost scope
-  for (size_t i = _scopes.size(); i-- > 0;) {
-    auto found = _scopes[i].find(name);
-    if (found != _scopes[i].end()) {
-      _lookupCache[name] = i;
-      return found->second;
-    }
-  }
-
-  // Check globals
-  auto found = _globals.find(name);
-  if (found != _globals.end()) {
-    _lookupCache[name] = GLOBAL;
-    return found->second;
-  }
+// Interpreter Implementation
+Interpreter::Interpreter()
+    : _currentProcedure(""), _callCacheVersion(1),
+      _vm(std::make_unique<VirtualMachine>(*this)) {}
 
-  // Check parent environment
-  if (_parent) {
-    return _parent->get(name);
-  }
+Interpreter::~Interpreter() = default;
 
-  throw std::runtime_error("Undefined variable: " + name);
+void Interpreter::setExecutionEngine(ExecutionEngine engine) {
+  _engine = engine;
 }
 
-void Interpreter::Environment::assign(const std::string &name,
-                                      const Value &value) {
-  // Cache-aware fast path
-  auto cacheIt = _lookupCache.find(name);
-  if (cacheIt != _lookupCache.end()) {
-    size_t idx = cacheIt->second;
-    if (idx == GLOBAL) {
-      auto gIt = _globals.find(name);
-      if (gIt != _globals.end()) {
-        gIt->second = value;
-        return;
-      }
-      _lookupCache.erase(cacheIt);
-    } else if (idx < _scopes.size()) {
-      auto &scope = _scopes[idx];
-      auto sIt = scope.find(name);
-      if (sIt != scope.end()) {
-        sIt->second = value;
-        return;
-      }
-      _lookupCache.erase(cacheIt);
-    }
-  }
-
-  // Search from innermost to outermost scope
-  for (size_t i = _scopes.size(); i-- > 0;) {
-    auto found = _scopes[i].find(name);
-    if (found != _scopes[i].end()) {
-      _lookupCache[name] = i;
-      found->second = value;
-      return;
-    }
+BytecodeProcedure &Interpreter::bytecodeFor(const ProcedureDecl &proc) {
+  if (!proc.bytecode) {
+    BytecodeCompiler compiler;
+    proc.bytecode = compiler.compile(proc);
   }
-
-  // Check globals
-  auto found = _globals.find(name);
-  if (found != _globals.end()) {
-    _lookupCache[name] = GLOBAL;
-    found->second = value;
-    return;
-  }
-
-  // Check parent environment
-  if (_parent) {
-    _parent->assign(name, value);
-    return;
-  }
-
-  throw std::runtime_error("Undefined variable: " + name);
+  return *proc.bytecode;
 }
 
-bool Interpreter::Environment::has(const std::string &name) const {
-  auto cacheIt = _lookupCache.find(name);
-  if (cacheIt != _lookupCache.end()) {
-    size_t idx = cacheIt->second;
-    if (idx == GLOBAL) {
-      if (_globals.find(name) != _globals.end()) {
-        return true;
-      }
-    } else if (idx < _scopes.size() && _scopes[idx].find(name) != _scopes[idx].end()) {
-      return true;
-    }
-  }
-
-  for (auto it = _scopes.rbegin(); it != _scopes.rend(); ++it) {
-    if (it->find(name) != it->end()) {
-      size_t idx = static_cast<size_t>(_scopes.size() - 1 - (it - _scopes.rbegin()));
-      _lookupCache[name] = idx;
-      return true;
-    }
-  }
-
-  if (_globals.find(name) != _globals.end()) {
-    _lookupCache[name] = GLOBAL;
-    return true;
+ClosureProcedure &Interpreter::closureFor(const ProcedureDecl &proc) {
+  if (!proc.closure) {
+    ClosureCompiler compiler;
+    proc.closure = compiler.compile(proc);
   }
-
-  if (_parent) {
-    return _parent->has(name);
-  }
-
-  return false;
+  return *proc.closure;
 }
 
-void Interpreter::Environment::enterScope() {
-  _scopes.emplace_back();
-  _scopeNames.emplace_back();
-}
-
-void Interpreter::Environment::exitScope() {
-  if (!_scopes.empty()) {
-    if (!_scopeNames.empty()) {
-      for (const auto &name : _scopeNames.back()) {
-        _lookupCache.erase(name);
-      }
-      _scopeNames.pop_back();
-    }
-    _scopes.pop_back();
+const JitProcedure &Interpreter::jitFor(const ProcedureDecl &proc) {
+  if (!proc.jit) {
+    JitCompiler compiler;
+    proc.jit = compiler.compile(proc);
   }
+  return *proc.jit;
 }
 
-// Interpreter Implementation
-Interpreter::Interpreter()
-    : _currentEnv(new Environment()), _currentProcedure(""),
-      _callCacheVersion(1) {}
-
 void Interpreter::registerExternalFunction(const std::string &name,
-                                           ExternalFunctionCallback callback) {
+                                           ExternalFunctionCallback callback,
+                                           bool pure,
+                                           const TypeInfo &returnType) {
   _externalFunctions[name] = callback;
+  if (pure) {
+    _pureExternalFunctions[name] = returnType;
+  } else {
+    _pureExternalFunctions.erase(name);
+  }
+  dropStalePurityAssumptions();
   ++_callCacheVersion;
 }
 
@@ -183,7 +69,13 @@ void Interpreter::registerExternalFunctions(
     const std::vector<ExternalBinding> &bindings) {
   for (const auto &b : bindings) {
     _externalFunctions[b.name] = b.callback;
+    if (b.pure) {
+      _pureExternalFunctions[b.name] = b.returnType;
+    } else {
+      _pureExternalFunctions.erase(b.name);
+    }
   }
+  dropStalePurityAssumptions();
   ++_callCacheVersion;
 }
 
@@ -195,6 +87,8 @@ void Interpreter::registerExternalFunctions(
 
 void Interpreter::unregisterExternalFunction(const std::string &name) {
   _externalFunctions.erase(name);
+  _pureExternalFunctions.erase(name);
+  dropStalePurityAssumptions();
   ++_callCacheVersion;
 }
 
@@ -202,6 +96,16 @@ bool Interpreter::hasExternalFunction(const std::string &name) const {
   return _externalFunctions.find(name) != _externalFunctions.end();
 }
 
+bool Interpreter::isPureExternalFunction(const std::string &name) const {
+  return _pureExternalFunctions.count(name) != 0;
+}
+
+TypeInfo Interpreter::pureExternalReturnType(const std::string &name) const {
+  auto found = _pureExternalFunctions.find(name);
+  return found == _pureExternalFunctions.end() ? TypeInfo(DataType::VOID)
+                                               : found->second;
+}
+
 void Interpreter::registerExternalVariable(const std::string &name,
                                            ExternalVariableGetter getter,
                                            ExternalVariableSetter setter) {
@@ -225,23 +129,136 @@ bool Interpreter::hasExternalVariable(const std::string &name) const {
 }
 
 void Interpreter::loadScript(ScriptPtr script) {
+  // Register the whole script first, so calls between its procedures can
+  // be inlined in either direction
   for (auto &proc : script->procedures) {
+    if (!proc->resolved) {
+      Resolver resolver;
+      resolver.resolve(*proc);
+    }
     _procedures[proc->name] = proc;
+    _superopSites.erase(proc->name);
   }
+
+  std::unordered_set<std::string> loaded;
+  for (auto &proc : script->procedures) {
+    loaded.insert(proc->name);
+    _callees.erase(proc->name);
+    if (!proc->native) {
+      prepare(*proc);
+    }
+  }
+
+  // Callers loaded before inline what this script declares under the names
+  // they call, as they would had they been loaded with it
+  std::vector<ProcedureDeclPtr> callers;
+  for (const auto &entry : _callees) {
+    auto caller = _procedures.find(entry.first);
+    if (loaded.count(entry.first) || caller == _procedures.end()) {
+      continue;
+    }
+    for (const auto &callee : entry.second) {
+      if (loaded.count(callee)) {
+        callers.push_back(caller->second);
+        break;
+      }
+    }
+  }
+  for (const auto &caller : callers) {
+    caller->bytecode.reset();
+    caller->closure.reset();
+    caller->jit.reset();
+    prepare(*caller);
+  }
+  dropStalePurityAssumptions();
   ++_callCacheVersion;
 }
 
+void Interpreter::prepare(ProcedureDecl &proc) {
+  if (_inliningEnabled) {
+    Inliner inliner(_procedures);
+    inliner.run(proc);
+    _callees[proc.name] = inliner.callees();
+  }
+  if (_superoperatorsEnabled) {
+    SuperoperatorPass pass;
+    pass.run(proc);
+    _superopSites[proc.name] = pass.sites();
+  }
+  if (_engine == ExecutionEngine::BYTECODE) {
+    bytecodeFor(proc);
+  } else if (_engine == ExecutionEngine::CLOSURE) {
+    closureFor(proc);
+  }
+}
+
+void Interpreter::dropStalePurityAssumptions() {
+  std::vector<ProcedureDeclPtr> stale;
+  for (const auto &entry : _procedures) {
+    for (const auto &external : entry.second->pureExternals) {
+      const std::string &name = external.first;
+      if (_procedures.count(name) || !isPureExternalFunction(name) ||
+          !(pureExternalReturnType(name) == external.second)) {
+        stale.push_back(entry.second);
+        break;
+      }
+    }
+  }
+
+  // A copy, so callers' checked and inlined calls stop reaching the
+  // procedure that made the assumptions
+  for (const auto &proc : stale) {
+    auto general = std::make_shared<ProcedureDecl>(
+        proc->returnType, proc->name, proc->parameters, proc->generalBody,
+        proc->line, proc->column);
+    general->frameSize = proc->frameSize;
+    general->resolved = true;
+    general->returnsTyped = proc->returnsTyped;
+    _procedures[proc->name] = general;
+    prepare(*general);
+  }
+}
+
+std::array<SuperoperatorCounter, SUPEROP_COUNT>
+Interpreter::superoperatorCounters() const {
+  std::array<SuperoperatorCounter, SUPEROP_COUNT> counters = _superopCounters;
+  for (const auto &entry : _superopSites) {
+    for (size_t i = 0; i < SUPEROP_COUNT; ++i) {
+      counters[i].sites += entry.second[i];
+    }
+  }
+  return counters;
+}
+
+std::string Interpreter::superoperatorReport() const {
+  auto counters = superoperatorCounters();
+  std::ostringstream out;
+  out << std::left << std::setw(20) << "superoperator" << std::right
+      << std::setw(8) << "sites" << std::setw(14) << "hits" << std::setw(14)
+      << "absorbed" << "\n";
+  for (size_t i = 1; i < SUPEROP_COUNT; ++i) {
+    out << std::left << std::setw(20)
+        << SuperoperatorPass::name(static_cast<Superop>(i)) << std::right
+        << std::setw(8) << counters[i].sites << std::setw(14)
+        << counters[i].hits << std::setw(14) << counters[i].absorbed << "\n";
+  }
+  return out.str();
+}
+
 Value Interpreter::executeProcedure(const std::string &name,
                                     const std::vector<Value> &arguments) {
   auto it = _procedures.find(name);
   if (it == _procedures.end()) {
     throw std::runtime_error("Procedure not found: " + name);
   }
-  return executeProcedure(it->second, arguments);
+  return executeProcedure(
+      it->second,
+      std::vector<CompactValue>(arguments.begin(), arguments.end()));
 }
 
 Value Interpreter::executeProcedure(ProcedureDeclPtr proc,
-                                    const std::vector<Value> &arguments) {
+                                    const std::vector<CompactValue> &arguments,
+                                    bool argumentsTyped) {
   _currentProcedure = proc->name;
 
   // Check argument count
@@ -252,43 +269,177 @@ Value Interpreter::executeProcedure(ProcedureDeclPtr proc,
     throw runtimeError(ss.str(), proc->line, proc->column);
   }
 
-  // Create new environment for procedure
-  Environment procEnv(_currentEnv);
-  Environment *previousEnv = _currentEnv;
-  _currentEnv = &procEnv;
+  if (proc->native) {
+    return executeNative(*proc, arguments);
+  }
+
+  if (_jitEnabled) {
+    const JitProcedure &native = jitFor(*proc);
+    Value result;
+    if (native.entry && native.invoke(arguments, result)) {
+      _currentProcedure = "";
+      return result;
+    }
+    // Not compiled, or bailed out: compiled code only touches its own
+    // locals, so running the engine from the start gives the same outcome
+  }
+
+  if (_engine == ExecutionEngine::BYTECODE) {
+    return _vm->execute(*proc, bytecodeFor(*proc), arguments,
+                        argumentsTyped);
+  }
+
+  if (_engine == ExecutionEngine::CLOSURE) {
+    ClosureProcedure &compiled = closureFor(*proc);
+    FrameStack::Frame slots(_closureFrames, proc->frameSize);
+    for (size_t i = 0; i < proc->parameters.size(); ++i) {
+      slots[i] = bindParameter(proc->parameters[i].type, arguments[i],
+                               argumentsTyped);
+    }
+
+    ClosureFrame frame{*this, slots.data(), Value()};
+    ExecStatus status = compiled.body(frame);
+    return finishProcedure(*proc, status, frame.returnValue);
+  }
+
+  // Claim a frame for parameters and locals; released on every exit path
+  struct Frame {
+    Interpreter &interp;
+    size_t previousBase;
+    size_t base;
+    ~Frame() {
+      interp._stack.resize(base);
+      interp._frameBase = previousBase;
+    }
+  } frame{*this, _frameBase, _stack.size()};
+
+  _stack.resize(frame.base + proc->frameSize);
+  _frameBase = frame.base;
 
   // Bind parameters
   for (size_t i = 0; i < proc->parameters.size(); ++i) {
-    Value convertedArg = convertToType(arguments[i], proc->parameters[i].type);
-    _currentEnv->define(proc->parameters[i].name, convertedArg);
+    _stack[frame.base + i] = bindParameter(proc->parameters[i].type,
+                                           arguments[i], argumentsTyped);
   }
 
-  try {
-    execute(proc->body);
+  ExecStatus status = execute(proc->body);
+  // Moved out so the caller's copy of a returned array is not shared
+  Value returnValue = std::move(_returnValue);
+  return finishProcedure(*proc, status, returnValue);
+}
 
-    // If we reach here, no return statement was executed
-    if (proc->returnType.baseType == DataType::VOID && !proc->returnType.isArray) {
-      _currentEnv = previousEnv;
-      _currentProcedure = "";
-      return static_cast<int32_t>(0); // Dummy value
+CompactValue *Interpreter::FrameStack::claim(size_t count) {
+  if (!_blocks.empty()) {
+    Block &block = _blocks[_current];
+    if (block.size - block.used >= count) {
+      CompactValue *slots = block.slots.get() + block.used;
+      block.used += count;
+      return slots;
     }
+    ++_current;
+  }
+  // Blocks above the current one are unused; one too small is replaced
+  if (_current == _blocks.size()) {
+    _blocks.emplace_back();
+  }
+  Block &block = _blocks[_current];
+  if (block.size < count) {
+    block.size = std::max(count, BLOCK_SLOTS);
+    block.slots = std::make_unique<CompactValue[]>(block.size);
+  }
+  block.used = count;
+  return block.slots.get();
+}
 
-    // Non-void procedure without return
-    _currentEnv = previousEnv;
-    _currentProcedure = "";
-    throw runtimeError("Non-void procedure must return a value", proc->line,
-                       proc->column);
+void Interpreter::FrameStack::release(CompactValue *slots, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    slots[i] = CompactValue();
+  }
+  Block &block = _blocks[_current];
+  block.used -= count;
+  if (block.used == 0 && _current > 0) {
+    --_current;
+  }
+}
 
-  } catch (const ReturnException &ret) {
-    _currentEnv = previousEnv;
-    _currentProcedure = "";
+Value Interpreter::executeNative(const ProcedureDecl &proc,
+                                 const std::vector<CompactValue> &arguments) {
+  const CxxScriptNativeProcedure &native = *proc.native->procedure;
+
+  // Bind parameters with the usual conversions
+  uint64_t inlineArgs[8];
+  std::vector<uint64_t> heapArgs;
+  uint64_t *args = inlineArgs;
+  if (arguments.size() > 8) {
+    heapArgs.resize(arguments.size());
+    args = heapArgs.data();
+  }
+  Value scratch;
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    args[i] = ScalarTypes::toCell(arguments[i].view(scratch),
+                                  proc.parameters[i].type.baseType);
+  }
 
-    if (proc->returnType.baseType == DataType::VOID && !proc->returnType.isArray) {
-      return static_cast<int32_t>(0); // Dummy value
+  uint64_t result = 0;
+  CxxScriptNativeError error{nullptr, -1, -1};
+  int failed = native.invoke(args, &result, &error);
+  _currentProcedure = "";
+
+  if (failed) {
+    std::string message = error.message ? error.message : "Native call failed";
+    if (error.line < 0) {
+      throw std::runtime_error(message);
     }
+    throw runtimeError(message, error.line, error.column);
+  }
+  return ScalarTypes::fromCell(result, proc.returnType.baseType);
+}
 
-    return convertToType(ret.value, proc->returnType);
+Value Interpreter::executeChecked(const ProcedureDeclPtr &proc,
+                                  const std::vector<CompactValue> &arguments,
+                                  bool checked, bool argumentsTyped) {
+  if (checked) {
+    return executeProcedure(proc, arguments, argumentsTyped);
   }
+  return executeProcedure(proc, arguments);
+}
+
+CompactValue Interpreter::bindParameter(const TypeInfo &type,
+                                        const CompactValue &argument,
+                                        bool typed) {
+  Value scratch;
+  const Value &value = argument.view(scratch);
+  if (typed && !ValueHelper::needsConversion(value, type)) {
+    return argument;
+  }
+  return convertToType(value, type);
+}
+
+Value Interpreter::finishProcedure(const ProcedureDecl &proc, ExecStatus status,
+                                   const Value &returnValue) {
+  _currentProcedure = "";
+
+  if (status == ExecStatus::BREAK || status == ExecStatus::CONTINUE) {
+    throw runtimeError(status == ExecStatus::BREAK
+                           ? "'break' outside of a loop or switch"
+                           : "'continue' outside of a loop",
+                       proc.line, proc.column);
+  }
+
+  if (proc.returnType.baseType == DataType::VOID && !proc.returnType.isArray) {
+    return static_cast<int32_t>(0); // Dummy value
+  }
+
+  if (status != ExecStatus::RETURN) {
+    throw runtimeError("Non-void procedure must return a value", proc.line,
+                       proc.column);
+  }
+
+  if (proc.returnsTyped &&
+      !ValueHelper::needsConversion(returnValue, proc.returnType)) {
+    return returnValue;
+  }
+  return convertToType(returnValue, proc.returnType);
 }
 
 bool Interpreter::hasProcedure(const std::string &name) const {
@@ -304,85 +455,144 @@ ProcedureDeclPtr Interpreter::getProcedure(const std::string &name) const {
 }
 
 Value Interpreter::evaluate(ExprPtr expr) {
-  if (auto *lit = dynamic_cast<LiteralExpr *>(expr.get())) {
-    return evaluateLiteral(lit);
-  }
-  if (auto *var = dynamic_cast<VariableExpr *>(expr.get())) {
-    return evaluateVariable(var);
-  }
-  if (auto *arr = dynamic_cast<ArrayLiteralExpr *>(expr.get())) {
-    return evaluateArrayLiteral(arr);
-  }
-  if (auto *idx = dynamic_cast<IndexExpr *>(expr.get())) {
-    return evaluateIndex(idx);
-  }
-  if (auto *bin = dynamic_cast<BinaryExpr *>(expr.get())) {
-    return evaluateBinary(bin);
-  }
-  if (auto *un = dynamic_cast<UnaryExpr *>(expr.get())) {
-    return evaluateUnary(un);
-  }
-  if (auto *call = dynamic_cast<CallExpr *>(expr.get())) {
-    return evaluateCall(call);
-  }
-  if (auto *cond = dynamic_cast<ConditionalExpr *>(expr.get())) {
-    return evaluateConditional(cond);
+  Expression *node = expr.get();
+
+  switch (node->kind) {
+  case NodeKind::LITERAL:
+    return evaluateLiteral(static_cast<LiteralExpr *>(node));
+  case NodeKind::VARIABLE:
+    return evaluateVariable(static_cast<VariableExpr *>(node));
+  case NodeKind::ARRAY_LITERAL:
+    return evaluateArrayLiteral(static_cast<ArrayLiteralExpr *>(node));
+  case NodeKind::INDEX:
+    if (node->superop == Superop::LOCAL_INDEX) {
+      return evaluateLocalIndex(static_cast<IndexExpr *>(node));
+    }
+    return evaluateIndex(static_cast<IndexExpr *>(node));
+  case NodeKind::BINARY:
+    if (node->superop == Superop::LOCAL_COMPARE) {
+      return evaluateLocalCompare(static_cast<BinaryExpr *>(node));
+    }
+    if (node->superop == Superop::COMPARE_CHAIN) {
+      return evaluateCompareChain(static_cast<BinaryExpr *>(node));
+    }
+    return evaluateBinary(static_cast<BinaryExpr *>(node));
+  case NodeKind::UNARY:
+    return evaluateUnary(static_cast<UnaryExpr *>(node));
+  case NodeKind::CALL:
+    return evaluateCall(static_cast<CallExpr *>(node));
+  case NodeKind::CONDITIONAL:
+    return evaluateConditional(static_cast<ConditionalExpr *>(node));
+  case NodeKind::FIELD:
+    return evaluateField(static_cast<FieldExpr *>(node));
+  case NodeKind::RECORD:
+    return evaluateRecord(static_cast<RecordExpr *>(node));
+  default:
+    break;
   }
 
   throw runtimeError("Unknown expression type", expr->line, expr->column);
 }
 
-void Interpreter::execute(StmtPtr stmt) {
-  if (auto *exprStmt = dynamic_cast<ExpressionStmt *>(stmt.get())) {
-    executeExpression(exprStmt);
-  } else if (auto *varDecl = dynamic_cast<VarDeclStmt *>(stmt.get())) {
-    executeVarDecl(varDecl);
-  } else if (auto *assign = dynamic_cast<AssignStmt *>(stmt.get())) {
-    executeAssign(assign);
-  } else if (auto *block = dynamic_cast<BlockStmt *>(stmt.get())) {
-    executeBlock(block);
-  } else if (auto *ifStmt = dynamic_cast<IfStmt *>(stmt.get())) {
-    executeIf(ifStmt);
-  } else if (auto *whileStmt = dynamic_cast<WhileStmt *>(stmt.get())) {
-    executeWhile(whileStmt);
-  } else if (auto *forStmt = dynamic_cast<ForStmt *>(stmt.get())) {
-    executeFor(forStmt);
-  } else if (auto *doWhile = dynamic_cast<DoWhileStmt *>(stmt.get())) {
-    executeDoWhile(doWhile);
-  } else if (auto *switchStmt = dynamic_cast<SwitchStmt *>(stmt.get())) {
-    executeSwitch(switchStmt);
-  } else if (auto *retStmt = dynamic_cast<ReturnStmt *>(stmt.get())) {
-    executeReturn(retStmt);
-  } else if (auto *brk = dynamic_cast<BreakStmt *>(stmt.get())) {
-    executeBreak(brk);
-  } else if (auto *cont = dynamic_cast<ContinueStmt *>(stmt.get())) {
-    executeContinue(cont);
-  } else if (auto *idxAssign = dynamic_cast<IndexAssignStmt *>(stmt.get())) {
-    executeIndexAssign(idxAssign);
-  } else {
-    throw runtimeError("Unknown statement type", stmt->line, stmt->column);
+ExecStatus Interpreter::execute(StmtPtr stmt) {
+  Statement *node = stmt.get();
+
+  switch (node->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    executeExpression(static_cast<ExpressionStmt *>(node));
+    return ExecStatus::NORMAL;
+  case NodeKind::VAR_DECL:
+    executeVarDecl(static_cast<VarDeclStmt *>(node));
+    return ExecStatus::NORMAL;
+  case NodeKind::ASSIGN:
+    if (node->superop == Superop::LOCAL_ADD_LITERAL) {
+      executeLocalAddLiteral(static_cast<AssignStmt *>(node));
+      return ExecStatus::NORMAL;
+    }
+    executeAssign(static_cast<AssignStmt *>(node));
+    return ExecStatus::NORMAL;
+  case NodeKind::INDEX_ASSIGN:
+    executeIndexAssign(static_cast<IndexAssignStmt *>(node));
+    return ExecStatus::NORMAL;
+  case NodeKind::FIELD_ASSIGN:
+    executeFieldAssign(static_cast<FieldAssignStmt *>(node));
+    return ExecStatus::NORMAL;
+  case NodeKind::BLOCK:
+    return executeBlock(static_cast<BlockStmt *>(node));
+  case NodeKind::IF:
+    return executeIf(static_cast<IfStmt *>(node));
+  case NodeKind::WHILE:
+    return executeWhile(static_cast<WhileStmt *>(node));
+  case NodeKind::FOR:
+    return executeFor(static_cast<ForStmt *>(node));
+  case NodeKind::DO_WHILE:
+    return executeDoWhile(static_cast<DoWhileStmt *>(node));
+  case NodeKind::SWITCH:
+    return executeSwitch(static_cast<SwitchStmt *>(node));
+  case NodeKind::RETURN:
+    return executeReturn(static_cast<ReturnStmt *>(node));
+  case NodeKind::BREAK:
+    return ExecStatus::BREAK;
+  case NodeKind::CONTINUE:
+    return ExecStatus::CONTINUE;
+  default:
+    break;
   }
+
+  throw runtimeError("Unknown statement type", stmt->line, stmt->column);
 }
 
 Value Interpreter::evaluateLiteral(LiteralExpr *expr) { return expr->value; }
 
 Value Interpreter::evaluateVariable(VariableExpr *expr) {
-  try {
-    return _currentEnv->get(expr->name);
-  } catch (const std::runtime_error &) {
-    auto extIt = _externalVariables.find(expr->name);
-    if (extIt != _externalVariables.end()) {
-      if (!extIt->second.getter) {
-        throw runtimeError(
-            "External variable '" + expr->name + "' has no getter",
-            expr->line, expr->column);
-      }
-      return extIt->second.getter();
+  if (expr->slot >= 0) {
+    return _stack[_frameBase + expr->slot].toValue();
+  }
+
+  auto extIt = _externalVariables.find(expr->name);
+  if (extIt != _externalVariables.end()) {
+    if (!extIt->second.getter) {
+      throw runtimeError("External variable '" + expr->name + "' has no getter",
+                         expr->line, expr->column);
     }
+    return extIt->second.get();
+  }
 
-    throw runtimeError("Undefined variable: " + expr->name, expr->line,
-                       expr->column);
+  throw runtimeError("Undefined variable: " + expr->name, expr->line,
+                     expr->column);
+}
+
+CompactValue *Interpreter::localSlot(Expression *expr) {
+  if (expr->kind != NodeKind::VARIABLE) {
+    return nullptr;
+  }
+  int32_t slot = static_cast<VariableExpr *>(expr)->slot;
+  return slot >= 0 ? &_stack[_frameBase + slot] : nullptr;
+}
+
+const Value &Interpreter::evaluateInPlace(const ExprPtr &expr,
+                                          Value &scratch) {
+  if (const CompactValue *local = localSlot(expr.get())) {
+    return local->view(scratch);
+  }
+  scratch = evaluate(expr);
+  return scratch;
+}
+
+std::vector<CompactValue>
+Interpreter::evaluateArguments(const CallExpr *expr) {
+  std::vector<CompactValue> args;
+  args.reserve(expr->arguments.size());
+  for (const auto &argExpr : expr->arguments) {
+    if (const CompactValue *local = localSlot(argExpr.get())) {
+      args.push_back(*local);
+    } else if (argExpr->kind == NodeKind::LITERAL) {
+      args.push_back(static_cast<LiteralExpr *>(argExpr.get())->compact);
+    } else {
+      args.emplace_back(evaluate(argExpr));
+    }
   }
+  return args;
 }
 
 Value Interpreter::evaluateArrayLiteral(ArrayLiteralExpr *expr) {
@@ -397,7 +607,38 @@ Value Interpreter::evaluateArrayLiteral(ArrayLiteralExpr *expr) {
   return ValueHelper::createArray(elemType, elements);
 }
 
+Value Interpreter::evaluateField(FieldExpr *expr) {
+  return fieldOf(expr, evaluate(expr->object));
+}
+
+Value Interpreter::fieldOf(FieldExpr *expr, const Value &object) {
+  if (!ValueHelper::isRecord(object)) {
+    throw runtimeError("Field access on non-record value", expr->line,
+                       expr->column);
+  }
+  const RecordValue &record = ValueHelper::recordValue(object);
+  try {
+    return record.field(
+        record.fieldIndex(expr->field, expr->structType.get(), expr->index));
+  } catch (const std::runtime_error &e) {
+    throw runtimeError(e.what(), expr->line, expr->column);
+  }
+}
+
+Value Interpreter::evaluateRecord(RecordExpr *expr) {
+  std::vector<Value> fields;
+  fields.reserve(expr->fields.size());
+  for (size_t i = 0; i < expr->fields.size(); ++i) {
+    fields.push_back(
+        convertToType(evaluate(expr->fields[i]), expr->type->fieldTypes[i]));
+  }
+  return std::make_shared<RecordValue>(expr->type, std::move(fields));
+}
+
 Value Interpreter::evaluateIndex(IndexExpr *expr) {
+  if (expr->arrayExpr->kind == NodeKind::INDEX) {
+    return evaluateNestedIndex(expr);
+  }
   Value arrayVal = evaluate(expr->arrayExpr);
   if (!ValueHelper::isArray(arrayVal)) {
     throw runtimeError("Indexing non-array value", expr->line, expr->column);
@@ -406,19 +647,43 @@ Value Interpreter::evaluateIndex(IndexExpr *expr) {
   Value indexVal = evaluate(expr->indexExpr);
   uint64_t idx = ValueHelper::toUInt64(indexVal);
 
-  const auto &elems = ValueHelper::arrayElements(arrayVal);
-  if (idx >= elems.size()) {
+  const ArrayValue &elems = ValueHelper::arrayValue(arrayVal);
+  if (idx >= elems.length()) {
     throw runtimeError("Array index out of bounds", expr->line, expr->column);
   }
+  if (elems.rank() > 1) {
+    return ValueHelper::indexArray(arrayVal, &indexVal, 1);
+  }
 
-  return elems[idx];
+  return elems.get(idx);
+}
+
+Value Interpreter::evaluateNestedIndex(IndexExpr *expr) {
+  // m[i][j] finds the element with one offset computation rather than
+  // through a view of row i
+  std::vector<ExprPtr> indexExprs;
+  Value arrayVal = evaluate(expr->indexChain(indexExprs));
+  if (!ValueHelper::isArray(arrayVal)) {
+    throw runtimeError("Indexing non-array value", expr->line, expr->column);
+  }
+
+  std::vector<Value> indices;
+  indices.reserve(indexExprs.size());
+  for (const auto &indexExpr : indexExprs) {
+    indices.push_back(evaluate(indexExpr));
+  }
+  try {
+    return ValueHelper::indexArray(arrayVal, indices.data(), indices.size());
+  } catch (const std::runtime_error &e) {
+    throw runtimeError(e.what(), expr->line, expr->column);
+  }
 }
 
 Value Interpreter::evaluateBinary(BinaryExpr *expr) {
-  Value left = evaluate(expr->left);
   // Short-circuit for logical operators at interpreter level to avoid
   // evaluating right operand when not needed
   if (expr->op == BinaryExpr::Operator::LOGICAL_AND) {
+    Value left = evaluate(expr->left);
     if (!ValueHelper::toBool(left)) {
       return false;
     }
@@ -427,6 +692,7 @@ Value Interpreter::evaluateBinary(BinaryExpr *expr) {
   }
 
   if (expr->op == BinaryExpr::Operator::LOGICAL_OR) {
+    Value left = evaluate(expr->left);
     if (ValueHelper::toBool(left)) {
       return true;
     }
@@ -434,19 +700,151 @@ Value Interpreter::evaluateBinary(BinaryExpr *expr) {
     return ValueHelper::logicalOr(left, right);
   }
 
-  Value right = evaluate(expr->right);
+  // The left operand is viewed in place only when evaluating the right one
+  // cannot change it
+  Value leftScratch, rightScratch;
+  NodeKind rightKind = expr->right->kind;
+  const Value &left =
+      rightKind == NodeKind::LITERAL || rightKind == NodeKind::VARIABLE
+          ? evaluateInPlace(expr->left, leftScratch)
+          : (leftScratch = evaluate(expr->left));
+  return BinaryExpr::apply(expr->op, left,
+                           evaluateInPlace(expr->right, rightScratch));
+}
+
+Value Interpreter::evaluateUnary(UnaryExpr *expr) {
+  Value scratch;
+  const Value &operand = evaluateInPlace(expr->operand, scratch);
+
+  switch (expr->op) {
+  case UnaryExpr::Operator::NEGATE:
+    return ValueHelper::negate(operand);
+  case UnaryExpr::Operator::LOGICAL_NOT:
+    return ValueHelper::logicalNot(operand);
+  case UnaryExpr::Operator::BIT_NOT:
+    return ValueHelper::bitNot(operand);
+  }
+
+  throw runtimeError("Unknown unary operator", expr->line, expr->column);
+}
+
+Value Interpreter::ExternalVariable::get() const {
+  Value value = getter();
+  auto *array = std::get_if<ArrayPtr>(&value);
+  if (array && *array) {
+    (*array)->setHostOwned();
+  }
+  return value;
+}
+
+Value Interpreter::evaluateArrayTarget(const ExprPtr &target,
+                                       RecordPtr &owner) {
+  if (target->kind != NodeKind::FIELD) {
+    return evaluate(target);
+  }
+  auto *access = static_cast<FieldExpr *>(target.get());
+  Value object = evaluate(access->object);
+  Value field = fieldOf(access, object);
+  owner = std::get<RecordPtr>(object);
+  return field;
+}
+
+ArrayValue &Interpreter::arrayToModify(Expression *target, Value &evaluated,
+                                       RecordValue *owner) {
+  if (owner) {
+    // Copy the field's array in the record if anything else shares it
+    auto *access = static_cast<FieldExpr *>(target);
+    evaluated = Value();
+    return ValueHelper::mutableArray(owner->fieldSlot(owner->fieldIndex(
+        access->field, access->structType.get(), access->index)));
+  }
+  if (target->kind == NodeKind::VARIABLE) {
+    int32_t slot = static_cast<VariableExpr *>(target)->slot;
+    if (slot < 0) {
+      // An external variable's array belongs to the host; change it in place
+      return ValueHelper::arrayValue(evaluated);
+    }
+    // Drop the evaluated handle first so an unshared local is not copied.
+    // The slot is looked up only now since evaluating the value may have
+    // reallocated the stack.
+    evaluated = Value();
+    return _stack[_frameBase + slot].mutableArray();
+  }
+  return ValueHelper::mutableArray(evaluated);
+}
+
+Value Interpreter::evaluateConditional(ConditionalExpr *expr) {
+  if (evaluateCondition(expr->condition)) {
+    return evaluate(expr->thenExpr);
+  }
+  return evaluate(expr->elseExpr);
+}
+
+bool Interpreter::evaluateCondition(const ExprPtr &expr) {
+  switch (expr->superop) {
+  case Superop::LOCAL_COMPARE:
+    return evaluateLocalCompare(static_cast<BinaryExpr *>(expr.get()));
+  case Superop::COMPARE_CHAIN:
+    return evaluateCompareChain(static_cast<BinaryExpr *>(expr.get()));
+  default:
+    return ValueHelper::toBool(evaluate(expr));
+  }
+}
+
+bool Interpreter::int32Operand(Expression *expr, int32_t &out) const {
+  if (expr->kind == NodeKind::LITERAL) {
+    const auto *value =
+        std::get_if<int32_t>(&static_cast<LiteralExpr *>(expr)->value);
+    if (value) {
+      out = *value;
+    }
+    return value != nullptr;
+  }
+  const CompactValue &slot =
+      _stack[_frameBase + static_cast<VariableExpr *>(expr)->slot];
+  if (slot.isInt32()) {
+    out = slot.int32();
+  }
+  return slot.isInt32();
+}
+
+const Value &Interpreter::operandValue(Expression *expr,
+                                       Value &scratch) const {
+  if (expr->kind == NodeKind::LITERAL) {
+    return static_cast<LiteralExpr *>(expr)->value;
+  }
+  return _stack[_frameBase + static_cast<VariableExpr *>(expr)->slot].view(
+      scratch);
+}
+
+bool Interpreter::evaluateLocalCompare(BinaryExpr *expr) {
+  // int32 counters compare directly; anything else keeps the generic rules
+  int32_t l, r;
+  if (int32Operand(expr->left.get(), l) && int32Operand(expr->right.get(), r)) {
+    countSuperop(Superop::LOCAL_COMPARE, 3);
+    switch (expr->op) {
+    case BinaryExpr::Operator::EQUAL:
+      return l == r;
+    case BinaryExpr::Operator::NOT_EQUAL:
+      return l != r;
+    case BinaryExpr::Operator::LESS_THAN:
+      return l < r;
+    case BinaryExpr::Operator::GREATER_THAN:
+      return l > r;
+    case BinaryExpr::Operator::LESS_EQUAL:
+      return l <= r;
+    case BinaryExpr::Operator::GREATER_EQUAL:
+      return l >= r;
+    default:
+      break;
+    }
+  }
+
+  Value leftScratch, rightScratch;
+  const Value &left = operandValue(expr->left.get(), leftScratch);
+  const Value &right = operandValue(expr->right.get(), rightScratch);
 
   switch (expr->op) {
-  case BinaryExpr::Operator::ADD:
-    return ValueHelper::add(left, right);
-  case BinaryExpr::Operator::SUBTRACT:
-    return ValueHelper::subtract(left, right);
-  case BinaryExpr::Operator::MULTIPLY:
-    return ValueHelper::multiply(left, right);
-  case BinaryExpr::Operator::DIVIDE:
-    return ValueHelper::divide(left, right);
-  case BinaryExpr::Operator::MODULO:
-    return ValueHelper::modulo(left, right);
   case BinaryExpr::Operator::EQUAL:
     return ValueHelper::equals(left, right);
   case BinaryExpr::Operator::NOT_EQUAL:
@@ -459,64 +857,109 @@ Value Interpreter::evaluateBinary(BinaryExpr *expr) {
     return ValueHelper::lessOrEqual(left, right);
   case BinaryExpr::Operator::GREATER_EQUAL:
     return ValueHelper::greaterOrEqual(left, right);
-  case BinaryExpr::Operator::LOGICAL_AND:
-    return ValueHelper::logicalAnd(left, right);
-  case BinaryExpr::Operator::LOGICAL_OR:
-    return ValueHelper::logicalOr(left, right);
-  case BinaryExpr::Operator::BIT_AND:
-    return ValueHelper::bitAnd(left, right);
-  case BinaryExpr::Operator::BIT_OR:
-    return ValueHelper::bitOr(left, right);
-  case BinaryExpr::Operator::BIT_XOR:
-    return ValueHelper::bitXor(left, right);
-  case BinaryExpr::Operator::LSHIFT:
-    return ValueHelper::lshift(left, right);
-  case BinaryExpr::Operator::RSHIFT:
-    return ValueHelper::rshift(left, right);
+  default:
+    break;
   }
 
   throw runtimeError("Unknown binary operator", expr->line, expr->column);
 }
 
-Value Interpreter::evaluateUnary(UnaryExpr *expr) {
-  Value operand = evaluate(expr->operand);
+bool Interpreter::evaluateCompareChain(BinaryExpr *expr) {
+  // Short-circuits like `&&`, but the operands' truth values never become
+  // Values; each `&&` and comparison visited is one absorbed evaluation
+  uint64_t absorbed = 0;
+  bool result = evaluateChainOperand(expr, absorbed);
+  countSuperop(Superop::COMPARE_CHAIN, absorbed);
+  return result;
+}
 
-  switch (expr->op) {
-  case UnaryExpr::Operator::NEGATE:
-    if (ValueHelper::getType(operand).baseType == DataType::DOUBLE) {
-      return ValueHelper::createValue(DataType::DOUBLE,
-                                      -ValueHelper::toDouble(operand));
-    }
-    return ValueHelper::createValue(DataType::INT32,
-                                    -ValueHelper::toInt64(operand));
-  case UnaryExpr::Operator::LOGICAL_NOT:
-    return ValueHelper::logicalNot(operand);
-  case UnaryExpr::Operator::BIT_NOT:
-    return ValueHelper::bitNot(operand);
+bool Interpreter::evaluateChainOperand(BinaryExpr *expr, uint64_t &absorbed) {
+  ++absorbed;
+  if (expr->op == BinaryExpr::Operator::LOGICAL_AND) {
+    return evaluateChainOperand(static_cast<BinaryExpr *>(expr->left.get()),
+                                absorbed) &&
+           evaluateChainOperand(static_cast<BinaryExpr *>(expr->right.get()),
+                                absorbed);
   }
-
-  throw runtimeError("Unknown unary operator", expr->line, expr->column);
+  if (expr->superop == Superop::LOCAL_COMPARE) {
+    return evaluateLocalCompare(expr);
+  }
+  return ValueHelper::toBool(evaluateBinary(expr));
 }
 
-Value Interpreter::evaluateConditional(ConditionalExpr *expr) {
-  Value cond = evaluate(expr->condition);
-  if (ValueHelper::toBool(cond)) {
-    return evaluate(expr->thenExpr);
+Value Interpreter::evaluateLocalIndex(IndexExpr *expr) {
+  auto *arrayVar = static_cast<VariableExpr *>(expr->arrayExpr.get());
+  auto *indexVar = static_cast<VariableExpr *>(expr->indexExpr.get());
+  const CompactValue &arrayVal = _stack[_frameBase + arrayVar->slot];
+  if (!arrayVal.isArray()) {
+    throw runtimeError("Indexing non-array value", expr->line, expr->column);
   }
-  return evaluate(expr->elseExpr);
+
+  const CompactValue &indexVal = _stack[_frameBase + indexVar->slot];
+  const ArrayValue &elems = *arrayVal.array();
+  uint64_t idx;
+  if (indexVal.isInt32()) {
+    // Negative indices sign-extend out of range, as toUInt64 does
+    idx = static_cast<uint64_t>(static_cast<int64_t>(indexVal.int32()));
+    countSuperop(Superop::LOCAL_INDEX, 3);
+  } else {
+    idx = ValueHelper::toUInt64(indexVal.toValue());
+  }
+  if (idx >= elems.length()) {
+    throw runtimeError("Array index out of bounds", expr->line, expr->column);
+  }
+  if (elems.rank() > 1) {
+    Value index = indexVal.toValue();
+    return ValueHelper::indexArray(arrayVal.toValue(), &index, 1);
+  }
+
+  // int32 arrays, the common case, skip the dispatch on the element type
+  if (auto ints = elems.elements<int32_t>()) {
+    return ints[idx];
+  }
+  return elems.get(idx);
 }
 
 Value Interpreter::evaluateCall(CallExpr *expr) {
+  // Inline cache for procedures, externals and the other builtins; len,
+  // push and pop are never cached, so they still reach the checks below
+  if (expr->cacheVersion == _callCacheVersion) {
+    if (expr->cachedIsInlined) {
+      return evaluate(expr->inlined);
+    }
+    if (expr->cachedIsProcedure) {
+      std::vector<CompactValue> args = evaluateArguments(expr);
+      if (auto proc = expr->cachedProcedure.lock()) {
+        return executeChecked(proc, args, expr->cachedIsChecked,
+                              expr->argumentsTyped);
+      }
+    }
+    if (expr->cachedIsExternal && expr->cachedExternal) {
+      std::vector<CompactValue> args = evaluateArguments(expr);
+      return expr->cachedExternal(CompactValue::toValues(args));
+    }
+    if (expr->cachedBuiltin) {
+      return evaluateBuiltinCall(expr, expr->cachedBuiltin);
+    }
+  }
+
   // Built-in functions for arrays
   if (expr->functionName == "len") {
     if (expr->arguments.size() != 1) {
       throw runtimeError("len expects 1 argument", expr->line, expr->column);
     }
-    Value arrayVal = evaluate(expr->arguments[0]);
+    Value scratch;
+    const Value &arrayVal = evaluateInPlace(expr->arguments[0], scratch);
+    if (ValueHelper::isMap(arrayVal)) {
+      auto size = static_cast<int64_t>(ValueHelper::mapValue(arrayVal).size());
+      return ValueHelper::createValue(DataType::INT32, size);
+    }
     if (!ValueHelper::isArray(arrayVal)) {
-      throw runtimeError("len expects an array", expr->line, expr->column);
+      throw runtimeError("len expects an array or map", expr->line,
+                         expr->column);
     }
-    auto size = static_cast<int64_t>(ValueHelper::arrayElements(arrayVal).size());
+    auto size =
+        static_cast<int64_t>(ValueHelper::arrayValue(arrayVal).length());
     return ValueHelper::createValue(DataType::INT32, size);
   }
 
@@ -524,15 +967,18 @@ Value Interpreter::evaluateCall(CallExpr *expr) {
     if (expr->arguments.size() != 2) {
       throw runtimeError("push expects 2 arguments", expr->line, expr->column);
     }
-    Value arrayVal = evaluate(expr->arguments[0]);
+    RecordPtr owner;
+    Value arrayVal = evaluateArrayTarget(expr->arguments[0], owner);
     if (!ValueHelper::isArray(arrayVal)) {
       throw runtimeError("push expects an array as first argument", expr->line, expr->column);
     }
     TypeInfo elementType = ValueHelper::arrayElementType(arrayVal);
     Value raw = evaluate(expr->arguments[1]);
-    Value converted = convertToType(raw, TypeInfo(elementType.baseType));
-    ValueHelper::arrayElements(arrayVal).push_back(converted);
-    auto size = static_cast<int64_t>(ValueHelper::arrayElements(arrayVal).size());
+    Value converted = convertToType(raw, elementType);
+    ArrayValue &elems =
+        arrayToModify(expr->arguments[0].get(), arrayVal, owner.get());
+    elems.push(std::move(converted));
+    auto size = static_cast<int64_t>(elems.size());
     return ValueHelper::createValue(DataType::INT32, size);
   }
 
@@ -540,39 +986,17 @@ Value Interpreter::evaluateCall(CallExpr *expr) {
     if (expr->arguments.size() != 1) {
       throw runtimeError("pop expects 1 argument", expr->line, expr->column);
     }
-    Value arrayVal = evaluate(expr->arguments[0]);
+    RecordPtr owner;
+    Value arrayVal = evaluateArrayTarget(expr->arguments[0], owner);
     if (!ValueHelper::isArray(arrayVal)) {
       throw runtimeError("pop expects an array", expr->line, expr->column);
     }
-    auto &elems = ValueHelper::arrayElements(arrayVal);
+    ArrayValue &elems =
+        arrayToModify(expr->arguments[0].get(), arrayVal, owner.get());
     if (elems.empty()) {
       throw runtimeError("Cannot pop from empty array", expr->line, expr->column);
     }
-    Value result = elems.back();
-    elems.pop_back();
-    return result;
-  }
-
-  // Inline cache for procedures / externals
-  if (expr->cacheVersion == _callCacheVersion) {
-    if (expr->cachedIsProcedure) {
-      std::vector<Value> args;
-      args.reserve(expr->arguments.size());
-      for (auto &argExpr : expr->arguments) {
-        args.push_back(evaluate(argExpr));
-      }
-      if (auto proc = expr->cachedProcedure.lock()) {
-        return executeProcedure(proc, args);
-      }
-    }
-    if (expr->cachedIsExternal && expr->cachedExternal) {
-      std::vector<Value> args;
-      args.reserve(expr->arguments.size());
-      for (auto &argExpr : expr->arguments) {
-        args.push_back(evaluate(argExpr));
-      }
-      return expr->cachedExternal(args);
-    }
+    return elems.pop();
   }
 
   // Check if it's a procedure call
@@ -580,13 +1004,17 @@ Value Interpreter::evaluateCall(CallExpr *expr) {
     expr->cacheVersion = _callCacheVersion;
     expr->cachedIsProcedure = true;
     expr->cachedIsExternal = false;
+    expr->cachedBuiltin = nullptr;
     expr->cachedProcedure = it->second;
-    std::vector<Value> args;
-    args.reserve(expr->arguments.size());
-    for (auto &argExpr : expr->arguments) {
-      args.push_back(evaluate(argExpr));
+    expr->cachedIsChecked = expr->checkedProcedure.lock() == it->second;
+    expr->cachedIsInlined =
+        expr->inlined && expr->inlinedProcedure.lock() == it->second;
+    if (expr->cachedIsInlined) {
+      return evaluate(expr->inlined);
     }
-    return executeProcedure(it->second, args);
+    std::vector<CompactValue> args = evaluateArguments(expr);
+    return executeChecked(it->second, args, expr->cachedIsChecked,
+                          expr->argumentsTyped);
   }
 
   // Check if it's a registered external function
@@ -594,21 +1022,66 @@ Value Interpreter::evaluateCall(CallExpr *expr) {
   if (extIt != _externalFunctions.end()) {
     expr->cacheVersion = _callCacheVersion;
     expr->cachedIsProcedure = false;
+    expr->cachedIsInlined = false;
     expr->cachedIsExternal = true;
+    expr->cachedBuiltin = nullptr;
     expr->cachedExternal = extIt->second;
 
-    std::vector<Value> args;
-    args.reserve(expr->arguments.size());
-    for (auto &argExpr : expr->arguments) {
-      args.push_back(evaluate(argExpr));
-    }
-    return extIt->second(args);
+    std::vector<CompactValue> args = evaluateArguments(expr);
+    return extIt->second(CompactValue::toValues(args));
+  }
+
+  if (BuiltinFunction builtin = findBuiltin(expr->functionName)) {
+    expr->cacheVersion = _callCacheVersion;
+    expr->cachedIsProcedure = false;
+    expr->cachedIsInlined = false;
+    expr->cachedIsExternal = false;
+    expr->cachedBuiltin = builtin;
+    return evaluateBuiltinCall(expr, builtin);
   }
 
   throw runtimeError("Undefined function: " + expr->functionName, expr->line,
                      expr->column);
 }
 
+Value Interpreter::evaluateBuiltinCall(CallExpr *expr,
+                                       BuiltinFunction builtin) {
+  size_t count = expr->arguments.size();
+  ArgumentSlots args(*this, count);
+  for (size_t i = 0; i < count; ++i) {
+    const ExprPtr &argExpr = expr->arguments[i];
+    if (const CompactValue *local = localSlot(argExpr.get())) {
+      args[i] = *local;
+    } else if (argExpr->kind == NodeKind::LITERAL) {
+      args[i] = static_cast<LiteralExpr *>(argExpr.get())->compact;
+    } else {
+      Value value = evaluate(argExpr);
+      args[i] = std::move(value);
+    }
+  }
+  return callBuiltin(builtin, args.data(), count, expr->line, expr->column);
+}
+
+BuiltinFunction Interpreter::findBuiltin(const std::string &name) {
+  if (BuiltinFunction builtin = ArrayBuiltins::find(name)) {
+    return builtin;
+  }
+  if (BuiltinFunction builtin = MapBuiltins::find(name)) {
+    return builtin;
+  }
+  return StringBuilderBuiltins::find(name);
+}
+
+Value Interpreter::callBuiltin(BuiltinFunction builtin,
+                               const CompactValue *arguments, size_t count,
+                               int line, int column) {
+  try {
+    return builtin(BuiltinArguments(arguments, count));
+  } catch (const std::runtime_error &e) {
+    throw runtimeError(e.what(), line, column);
+  }
+}
+
 void Interpreter::executeExpression(ExpressionStmt *stmt) {
   evaluate(stmt->expression);
 }
@@ -617,257 +1090,331 @@ void Interpreter::executeVarDecl(VarDeclStmt *stmt) {
   Value value;
 
   if (stmt->initializer) {
-    value = evaluate(stmt->initializer);
-    value = convertToType(value, stmt->type);
-  } else {
-    // Default initialization
-    if (stmt->type.isArray) {
-      value = ValueHelper::createArray(TypeInfo(stmt->type.baseType), {});
-    } else {
-      switch (stmt->type.baseType) {
-      case DataType::INT8:
-        value = static_cast<int8_t>(0);
-        break;
-      case DataType::UINT8:
-        value = static_cast<uint8_t>(0);
-        break;
-      case DataType::INT16:
-        value = static_cast<int16_t>(0);
-        break;
-      case DataType::UINT16:
-        value = static_cast<uint16_t>(0);
-        break;
-      case DataType::INT32:
-        value = static_cast<int32_t>(0);
-        break;
-      case DataType::UINT32:
-        value = static_cast<uint32_t>(0);
-        break;
-      case DataType::INT64:
-        value = static_cast<int64_t>(0);
-        break;
-      case DataType::DOUBLE:
-        value = static_cast<double>(0.0);
-        break;
-      case DataType::UINT64:
-        value = static_cast<uint64_t>(0);
-        break;
-      case DataType::STRING:
-        value = std::string("");
-        break;
-      case DataType::BOOL:
-        value = false;
-        break;
-      case DataType::VOID:
-        value = static_cast<int32_t>(0);
-        break;
+    if (const CompactValue *local = localSlot(stmt->initializer.get())) {
+      // A local of the declared type is shared rather than copied out
+      CompactValue initial = *local;
+      Value scratch;
+      if (stmt->initializerTyped &&
+          !ValueHelper::needsConversion(initial.view(scratch), stmt->type)) {
+        _stack[_frameBase + stmt->slot] = std::move(initial);
+        return;
       }
     }
+    value = evaluate(stmt->initializer);
+    if (!stmt->initializerTyped ||
+        ValueHelper::needsConversion(value, stmt->type)) {
+      value = convertToType(value, stmt->type);
+    }
+  } else {
+    value = ValueHelper::defaultValue(stmt->type);
   }
 
-  _currentEnv->define(stmt->name, value);
+  _stack[_frameBase + stmt->slot] = std::move(value);
 }
 
 void Interpreter::executeAssign(AssignStmt *stmt) {
+  if (stmt->slot >= 0 && stmt->op == AssignStmt::Operator::ASSIGN) {
+    // Local to local shares the slot; host arrays still get copied below
+    const CompactValue *source = localSlot(stmt->value.get());
+    if (source &&
+        !(source->isArray() && source->array() &&
+          source->array()->hostOwned())) {
+      _stack[_frameBase + stmt->slot] = *source;
+      return;
+    }
+  }
+
   Value value = evaluate(stmt->value);
 
-  try {
-    Value currentValue = _currentEnv->get(stmt->variableName);
+  if (stmt->slot >= 0) {
+    CompactValue &target = _stack[_frameBase + stmt->slot];
+    Value scratch;
 
     switch (stmt->op) {
     case AssignStmt::Operator::ASSIGN:
-      _currentEnv->assign(stmt->variableName, value);
+      target = ValueHelper::ownedByScript(std::move(value));
       break;
     case AssignStmt::Operator::PLUS_ASSIGN:
-      _currentEnv->assign(stmt->variableName,
-                          ValueHelper::add(currentValue, value));
+      // s += x appends to the stored string rather than copying it twice
+      if (target.isString() &&
+          ValueHelper::appendString(target.mutableString(), value)) {
+        break;
+      }
+      target = ValueHelper::add(target.view(scratch), value);
       break;
     case AssignStmt::Operator::MINUS_ASSIGN:
-      _currentEnv->assign(stmt->variableName,
-                          ValueHelper::subtract(currentValue, value));
+      target = ValueHelper::subtract(target.view(scratch), value);
       break;
     case AssignStmt::Operator::MULT_ASSIGN:
-      _currentEnv->assign(stmt->variableName,
-                          ValueHelper::multiply(currentValue, value));
+      target = ValueHelper::multiply(target.view(scratch), value);
       break;
     case AssignStmt::Operator::DIV_ASSIGN:
-      _currentEnv->assign(stmt->variableName,
-                          ValueHelper::divide(currentValue, value));
+      target = ValueHelper::divide(target.view(scratch), value);
       break;
     }
-  } catch (const std::runtime_error &) {
-    auto extIt = _externalVariables.find(stmt->variableName);
-    if (extIt == _externalVariables.end()) {
-      throw runtimeError("Undefined variable: " + stmt->variableName,
-                         stmt->line, stmt->column);
-    }
+    return;
+  }
 
-    auto &extVar = extIt->second;
-    if (!extVar.setter) {
-      throw runtimeError("External variable '" + stmt->variableName +
-                             "' is read-only",
-                         stmt->line, stmt->column);
-    }
+  auto extIt = _externalVariables.find(stmt->variableName);
+  if (extIt == _externalVariables.end()) {
+    throw runtimeError("Undefined variable: " + stmt->variableName,
+                       stmt->line, stmt->column);
+  }
 
-    if (stmt->op == AssignStmt::Operator::ASSIGN) {
-      extVar.setter(value);
-      return;
-    }
+  auto &extVar = extIt->second;
+  if (!extVar.setter) {
+    throw runtimeError("External variable '" + stmt->variableName +
+                           "' is read-only",
+                       stmt->line, stmt->column);
+  }
 
-    if (!extVar.getter) {
-      throw runtimeError("External variable '" + stmt->variableName +
-                             "' cannot be read",
-                         stmt->line, stmt->column);
-    }
+  if (stmt->op == AssignStmt::Operator::ASSIGN) {
+    extVar.setter(value);
+    return;
+  }
 
-    Value currentValue = extVar.getter();
-    Value result;
-    switch (stmt->op) {
-    case AssignStmt::Operator::ASSIGN:
-      result = value;
-      break;
-    case AssignStmt::Operator::PLUS_ASSIGN:
-      result = ValueHelper::add(currentValue, value);
-      break;
-    case AssignStmt::Operator::MINUS_ASSIGN:
-      result = ValueHelper::subtract(currentValue, value);
-      break;
-    case AssignStmt::Operator::MULT_ASSIGN:
-      result = ValueHelper::multiply(currentValue, value);
-      break;
-    case AssignStmt::Operator::DIV_ASSIGN:
-      result = ValueHelper::divide(currentValue, value);
-      break;
-    }
+  if (!extVar.getter) {
+    throw runtimeError("External variable '" + stmt->variableName +
+                           "' cannot be read",
+                       stmt->line, stmt->column);
+  }
 
-    extVar.setter(result);
+  Value currentValue = extVar.getter();
+  Value result;
+  switch (stmt->op) {
+  case AssignStmt::Operator::ASSIGN:
+    result = value;
+    break;
+  case AssignStmt::Operator::PLUS_ASSIGN:
+    result = ValueHelper::add(currentValue, value);
+    break;
+  case AssignStmt::Operator::MINUS_ASSIGN:
+    result = ValueHelper::subtract(currentValue, value);
+    break;
+  case AssignStmt::Operator::MULT_ASSIGN:
+    result = ValueHelper::multiply(currentValue, value);
+    break;
+  case AssignStmt::Operator::DIV_ASSIGN:
+    result = ValueHelper::divide(currentValue, value);
+    break;
   }
+
+  extVar.setter(result);
+}
+
+void Interpreter::executeLocalAddLiteral(AssignStmt *stmt) {
+  CompactValue &target = _stack[_frameBase + stmt->slot];
+  if (!target.isInt32()) {
+    executeAssign(stmt);
+    return;
+  }
+
+  // x += literal and x -= literal carry the literal directly; x = x + literal
+  // and x = x - literal carry it on the right of the binary expression
+  bool subtract;
+  const LiteralExpr *literal;
+  if (stmt->op == AssignStmt::Operator::ASSIGN) {
+    auto *bin = static_cast<BinaryExpr *>(stmt->value.get());
+    subtract = bin->op == BinaryExpr::Operator::SUBTRACT;
+    literal = static_cast<LiteralExpr *>(bin->right.get());
+    countSuperop(Superop::LOCAL_ADD_LITERAL, 4);
+  } else {
+    subtract = stmt->op == AssignStmt::Operator::MINUS_ASSIGN;
+    literal = static_cast<LiteralExpr *>(stmt->value.get());
+    countSuperop(Superop::LOCAL_ADD_LITERAL, 2);
+  }
+
+  // int32 arithmetic wraps, as ValueHelper::add does
+  int64_t delta = std::get<int32_t>(literal->value);
+  int64_t current = target.int32();
+  int64_t result = subtract ? current - delta : current + delta;
+  target.setInt32(static_cast<int32_t>(result));
 }
 
 void Interpreter::executeIndexAssign(IndexAssignStmt *stmt) {
-  Value arrayVal = evaluate(stmt->arrayExpr);
+  if (stmt->arrayExpr->kind == NodeKind::INDEX) {
+    executeNestedIndexAssign(stmt);
+    return;
+  }
+  RecordPtr owner;
+  Value arrayVal = evaluateArrayTarget(stmt->arrayExpr, owner);
   if (!ValueHelper::isArray(arrayVal)) {
     throw runtimeError("Index assignment on non-array value", stmt->line, stmt->column);
   }
 
+  size_t rank = ValueHelper::arrayValue(arrayVal).rank();
+  if (rank > 1) {
+    throw runtimeError("Index assignment needs " + std::to_string(rank) +
+                           " indices",
+                       stmt->line, stmt->column);
+  }
+
   Value indexVal = evaluate(stmt->indexExpr);
   uint64_t idx = ValueHelper::toUInt64(indexVal);
 
-  std::vector<Value> &elems = ValueHelper::arrayElements(arrayVal);
-  if (idx >= elems.size()) {
+  if (idx >= ValueHelper::arrayValue(arrayVal).size()) {
     throw runtimeError("Array index out of bounds", stmt->line, stmt->column);
   }
 
   TypeInfo elementType = ValueHelper::arrayElementType(arrayVal);
   Value rawValue = evaluate(stmt->value);
-  Value converted = convertToType(rawValue, TypeInfo(elementType.baseType));
+  Value converted = convertToType(rawValue, elementType);
 
-  elems[idx] = converted;
+  // Re-check: evaluating the value may have shrunk the array
+  ArrayValue &elems =
+      arrayToModify(stmt->arrayExpr.get(), arrayVal, owner.get());
+  if (idx >= elems.size()) {
+    throw runtimeError("Array index out of bounds", stmt->line, stmt->column);
+  }
+  elems.set(idx, std::move(converted));
 }
 
-void Interpreter::executeBlock(BlockStmt *stmt) {
-  _currentEnv->enterScope();
+void Interpreter::executeNestedIndexAssign(IndexAssignStmt *stmt) {
+  // m[i][j] = v writes into m itself, not into a view of row i
+  std::vector<ExprPtr> indexExprs;
+  const ExprPtr &target =
+      static_cast<IndexExpr *>(stmt->arrayExpr.get())->indexChain(indexExprs);
+  indexExprs.push_back(stmt->indexExpr);
+  RecordPtr owner;
+  Value arrayVal = evaluateArrayTarget(target, owner);
+  if (!ValueHelper::isArray(arrayVal)) {
+    throw runtimeError("Index assignment on non-array value", stmt->line,
+                       stmt->column);
+  }
+
+  std::vector<Value> indices;
+  indices.reserve(indexExprs.size());
+  for (const auto &indexExpr : indexExprs) {
+    indices.push_back(evaluate(indexExpr));
+  }
+  TypeInfo elementType = ValueHelper::arrayElementType(arrayVal);
+  Value converted = convertToType(evaluate(stmt->value), elementType);
 
   try {
-    for (auto &statement : stmt->statements) {
-      execute(statement);
-    }
-    _currentEnv->exitScope();
-  } catch (...) {
-    _currentEnv->exitScope();
-    throw;
+    ArrayValue &elems = arrayToModify(target.get(), arrayVal, owner.get());
+    size_t position =
+        ValueHelper::elementOffset(elems, indices.data(), indices.size());
+    elems.set(position, std::move(converted));
+  } catch (const std::runtime_error &e) {
+    throw runtimeError(e.what(), stmt->line, stmt->column);
   }
 }
 
-void Interpreter::executeIf(IfStmt *stmt) {
-  Value condition = evaluate(stmt->condition);
-
-  if (ValueHelper::toBool(condition)) {
-    execute(stmt->thenBranch);
-  } else if (stmt->elseBranch) {
-    execute(stmt->elseBranch);
+void Interpreter::executeFieldAssign(FieldAssignStmt *stmt) {
+  Value object = evaluate(stmt->object);
+  if (!ValueHelper::isRecord(object)) {
+    throw runtimeError("Field assignment on non-record value", stmt->line,
+                       stmt->column);
   }
+  RecordValue &record = ValueHelper::recordValue(object);
+  size_t index;
+  try {
+    index = record.fieldIndex(stmt->field, stmt->structType.get(),
+                              stmt->index);
+  } catch (const std::runtime_error &e) {
+    throw runtimeError(e.what(), stmt->line, stmt->column);
+  }
+  Value value = evaluate(stmt->value);
+  record.setField(index,
+                  convertToType(value, record.type()->fieldTypes[index]));
 }
 
-void Interpreter::executeWhile(WhileStmt *stmt) {
-  while (ValueHelper::toBool(evaluate(stmt->condition))) {
-    try {
-      execute(stmt->body);
-    } catch (const ContinueException &) {
-      continue;
-    } catch (const BreakException &) {
-      break;
+ExecStatus Interpreter::executeBlock(BlockStmt *stmt) {
+  // Locals already have frame slots, so entering a block is free
+  for (auto &statement : stmt->statements) {
+    ExecStatus status = execute(statement);
+    if (status != ExecStatus::NORMAL) {
+      return status;
     }
   }
+  return ExecStatus::NORMAL;
 }
 
-void Interpreter::executeFor(ForStmt *stmt) {
-  _currentEnv->enterScope();
+ExecStatus Interpreter::executeIf(IfStmt *stmt) {
+  if (evaluateCondition(stmt->condition)) {
+    return execute(stmt->thenBranch);
+  }
+  if (stmt->elseBranch) {
+    return execute(stmt->elseBranch);
+  }
+  return ExecStatus::NORMAL;
+}
 
-  try {
-    // Initialize
-    if (stmt->initializer) {
-      execute(stmt->initializer);
+ExecStatus Interpreter::executeWhile(WhileStmt *stmt) {
+  while (evaluateCondition(stmt->condition)) {
+    ExecStatus status = execute(stmt->body);
+    if (status == ExecStatus::BREAK) {
+      break;
     }
+    if (status == ExecStatus::RETURN) {
+      return status;
+    }
+  }
+  return ExecStatus::NORMAL;
+}
 
-    // Loop
-    while (true) {
-      // Check condition
-      if (stmt->condition && !ValueHelper::toBool(evaluate(stmt->condition))) {
-        break;
-      }
+ExecStatus Interpreter::executeFor(ForStmt *stmt) {
+  // Initialize
+  if (stmt->initializer) {
+    execute(stmt->initializer);
+  }
 
-      // Execute body
-      try {
-        execute(stmt->body);
-      } catch (const ContinueException &) {
-        // Skip to increment
-      } catch (const BreakException &) {
-        break;
-      }
+  // Loop
+  while (true) {
+    // Check condition
+    if (stmt->condition && !evaluateCondition(stmt->condition)) {
+      break;
+    }
 
-      // Increment
-      if (stmt->increment) {
-        execute(stmt->increment);
-      }
+    // Execute body; continue falls through to the increment
+    ExecStatus status = execute(stmt->body);
+    if (status == ExecStatus::BREAK) {
+      break;
+    }
+    if (status == ExecStatus::RETURN) {
+      return status;
     }
 
-    _currentEnv->exitScope();
-  } catch (...) {
-    _currentEnv->exitScope();
-    throw;
+    // Increment
+    if (stmt->increment) {
+      execute(stmt->increment);
+    }
   }
+  return ExecStatus::NORMAL;
 }
 
-void Interpreter::executeReturn(ReturnStmt *stmt) {
-  Value value;
-
-  if (stmt->value) {
-    value = evaluate(stmt->value);
+ExecStatus Interpreter::executeReturn(ReturnStmt *stmt) {
+  CompactValue *local = stmt->value ? localSlot(stmt->value.get()) : nullptr;
+  if (local) {
+    // The frame is discarded on return, so the local is moved out
+    _returnValue = local->take();
+  } else if (stmt->value) {
+    _returnValue = evaluate(stmt->value);
   } else {
-    value = static_cast<int32_t>(0); // Dummy value for void returns
+    _returnValue = static_cast<int32_t>(0); // Dummy value for void returns
   }
-
-  throw ReturnException(value);
+  return ExecStatus::RETURN;
 }
 
-void Interpreter::executeDoWhile(DoWhileStmt *stmt) {
+ExecStatus Interpreter::executeDoWhile(DoWhileStmt *stmt) {
   while (true) {
-    try {
-      execute(stmt->body);
-    } catch (const ContinueException &) {
-      // skip to condition check
-    } catch (const BreakException &) {
+    // Continue skips to the condition check
+    ExecStatus status = execute(stmt->body);
+    if (status == ExecStatus::BREAK) {
       break;
     }
+    if (status == ExecStatus::RETURN) {
+      return status;
+    }
 
-    if (!ValueHelper::toBool(evaluate(stmt->condition))) {
+    if (!evaluateCondition(stmt->condition)) {
       break;
     }
   }
+  return ExecStatus::NORMAL;
 }
 
-void Interpreter::executeSwitch(SwitchStmt *stmt) {
+ExecStatus Interpreter::executeSwitch(SwitchStmt *stmt) {
   Value control = evaluate(stmt->expression);
   bool matched = false;
 
@@ -886,21 +1433,19 @@ void Interpreter::executeSwitch(SwitchStmt *stmt) {
     }
 
     if (matched) {
-      try {
-        for (auto &s : caseEntry.statements) {
-          execute(s);
+      for (auto &s : caseEntry.statements) {
+        ExecStatus status = execute(s);
+        if (status == ExecStatus::BREAK) {
+          return ExecStatus::NORMAL;
+        }
+        // Continue belongs to the enclosing loop
+        if (status != ExecStatus::NORMAL) {
+          return status;
         }
-      } catch (const BreakException &) {
-        return;
       }
     }
   }
-}
-
-void Interpreter::executeBreak(BreakStmt * /*stmt*/) { throw BreakException(); }
-
-void Interpreter::executeContinue(ContinueStmt * /*stmt*/) {
-  throw ContinueException();
+  return ExecStatus::NORMAL;
 }
 
 RuntimeError Interpreter::runtimeError(const std::string &message, int line,
@@ -911,21 +1456,51 @@ RuntimeError Interpreter::runtimeError(const std::string &message, int line,
 Value Interpreter::convertToType(const Value &val, const TypeInfo &targetType) {
   TypeInfo sourceType = ValueHelper::getType(val);
 
+  // Maps, records and string builders are shared, never converted
+  if (targetType.isMap() || sourceType.isMap() || targetType.isRecord() ||
+      sourceType.isRecord() || targetType.isStringBuilder() ||
+      sourceType.isStringBuilder()) {
+    if (targetType.isMap() && !sourceType.isMap()) {
+      throw std::runtime_error("Expected map value");
+    }
+    if (targetType.isStringBuilder() && !sourceType.isStringBuilder()) {
+      throw std::runtime_error("Expected stringbuilder value");
+    }
+    if (targetType.isRecord() &&
+        sourceType.structType != targetType.structType) {
+      throw std::runtime_error("Expected " +
+                               ValueHelper::typeToString(targetType) +
+                               " value");
+    }
+    if (!(sourceType == targetType)) {
+      throw std::runtime_error("Cannot convert " +
+                               ValueHelper::typeToString(sourceType) + " to " +
+                               ValueHelper::typeToString(targetType));
+    }
+    return val;
+  }
+
   if (targetType.isArray) {
     if (!ValueHelper::isArray(val)) {
       throw std::runtime_error("Expected array value");
     }
     TypeInfo elemType = ValueHelper::arrayElementType(val);
-    if (elemType.baseType == targetType.baseType) {
-      return val; // already correct element type
+    TypeInfo targetElement(targetType.baseType);
+    targetElement.structType = targetType.structType;
+    if (elemType == targetElement) {
+      // already correct element type
+      return ValueHelper::ownedByScript(val);
     }
-    const auto &elems = ValueHelper::arrayElements(val);
+    std::vector<Value> elems = ValueHelper::arrayElements(val);
     std::vector<Value> converted;
     converted.reserve(elems.size());
     for (const auto &e : elems) {
-      converted.push_back(convertToType(e, TypeInfo(targetType.baseType)));
+      converted.push_back(convertToType(e, targetElement));
     }
-    return ValueHelper::createArray(TypeInfo(targetType.baseType), converted);
+    auto array = std::make_shared<ArrayValue>(
+        targetType.baseType, converted, ValueHelper::arrayValue(val).shape());
+    array->setRecordType(targetType.structType);
+    return array;
   }
 
   if (sourceType.isArray) {
@@ -955,6 +1530,10 @@ Value Interpreter::convertToType(const Value &val, const TypeInfo &targetType) {
     return ValueHelper::createValue(targetType.baseType, ValueHelper::toBool(val));
   case DataType::VOID:
     return val;
+  case DataType::MAP:
+  case DataType::STRUCT:
+  case DataType::STRING_BUILDER:
+    break;
   }
 
   throw std::runtime_error("Unsupported conversion");
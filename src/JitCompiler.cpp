@@ -0,0 +1,1058 @@
+#include "JitCompiler.h"
+#include "ScalarTypes.h"
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define CXXSCRIPT_JIT_NATIVE 1
+#include <sys/mman.h>
+#else
+#define CXXSCRIPT_JIT_NATIVE 0
+#endif
+
+namespace Script {
+
+namespace {
+
+// Thrown while generating code for a construct the JIT does not handle
+struct Declined {
+  std::string reason;
+};
+
+[[noreturn]] void decline(const std::string &reason) { throw Declined{reason}; }
+
+// x86 condition codes as used by jcc/setcc
+enum Cond : uint8_t {
+  COND_B = 0x2,
+  COND_AE = 0x3,
+  COND_E = 0x4,
+  COND_NE = 0x5,
+  COND_A = 0x7,
+  COND_P = 0xA,
+  COND_NP = 0xB,
+  COND_L = 0xC,
+  COND_GE = 0xD,
+  COND_LE = 0xE,
+  COND_G = 0xF
+};
+
+// Minimal x86-64 encoder. Values are computed in rax/xmm0 (primary) with
+// rcx/xmm1 holding the right operand (secondary); rdi points at the slot
+// array and rsi at the result cell for the whole call.
+class Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+  }
+
+  void imm32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  void imm64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  int newLabel() {
+    _labels.push_back(-1);
+    return static_cast<int>(_labels.size() - 1);
+  }
+
+  void bind(int label) { _labels[label] = static_cast<int64_t>(code.size()); }
+
+  void jmp(int label) {
+    emit({0xE9});
+    fixup(label);
+  }
+
+  void jcc(Cond cond, int label) {
+    emit({0x0F, static_cast<uint8_t>(0x80 | cond)});
+    fixup(label);
+  }
+
+  // setcc into al (reg 0) or cl (reg 1)
+  void setcc(Cond cond, uint8_t reg = 0) {
+    emit({0x0F, static_cast<uint8_t>(0x90 | cond),
+          static_cast<uint8_t>(0xC0 | reg)});
+  }
+
+  // Integer register <-> [rdi + 8 * slot]; reg is rax (0) or rcx (1)
+  void loadInt(uint8_t reg, int32_t slot) {
+    emit({0x48, 0x8B, static_cast<uint8_t>(0x87 | (reg << 3))});
+    imm32(static_cast<uint32_t>(slot * 8));
+  }
+
+  void storeInt(int32_t slot) {
+    emit({0x48, 0x89, 0x87});
+    imm32(static_cast<uint32_t>(slot * 8));
+  }
+
+  // xmm register <-> [rdi + 8 * slot]; xmm is xmm0 or xmm1
+  void loadDouble(uint8_t xmm, int32_t slot) {
+    emit({0xF2, 0x0F, 0x10, static_cast<uint8_t>(0x87 | (xmm << 3))});
+    imm32(static_cast<uint32_t>(slot * 8));
+  }
+
+  void storeDouble(int32_t slot) {
+    emit({0xF2, 0x0F, 0x11, 0x87});
+    imm32(static_cast<uint32_t>(slot * 8));
+  }
+
+  void movImm(uint8_t reg, uint64_t value) {
+    emit({0x48, static_cast<uint8_t>(0xB8 + reg)});
+    imm64(value);
+  }
+
+  // movq xmm, gpr / movq gpr, xmm
+  void movqToXmm(uint8_t xmm, uint8_t reg) {
+    emit({0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | (xmm << 3) | reg)});
+  }
+
+  void movqFromXmm(uint8_t reg, uint8_t xmm) {
+    emit({0x66, 0x48, 0x0F, 0x7E, static_cast<uint8_t>(0xC0 | (xmm << 3) | reg)});
+  }
+
+  // cvtsi2sd xmm, gpr (64-bit source)
+  void intToDouble(uint8_t xmm, uint8_t reg) {
+    emit({0xF2, 0x48, 0x0F, 0x2A, static_cast<uint8_t>(0xC0 | (xmm << 3) | reg)});
+  }
+
+  void ucomisd(uint8_t a, uint8_t b) {
+    emit({0x66, 0x0F, 0x2E, static_cast<uint8_t>(0xC0 | (a << 3) | b)});
+  }
+
+  void finish() {
+    for (const auto &fix : _fixups) {
+      int64_t target = _labels[fix.label];
+      int32_t rel = static_cast<int32_t>(target - (fix.position + 4));
+      std::memcpy(&code[fix.position], &rel, sizeof(rel));
+    }
+  }
+
+private:
+  struct Fixup {
+    int64_t position;
+    int label;
+  };
+
+  std::vector<int64_t> _labels;
+  std::vector<Fixup> _fixups;
+
+  void fixup(int label) {
+    _fixups.push_back({static_cast<int64_t>(code.size()), label});
+    imm32(0);
+  }
+};
+
+bool isInt(DataType type) {
+  return type == DataType::INT32 || type == DataType::INT64;
+}
+
+DataType scalarType(const TypeInfo &type, const std::string &what) {
+  if (ScalarTypes::isSupported(type)) {
+    return type.baseType;
+  }
+  decline(what + " of type " + ValueHelper::typeToString(type));
+}
+
+// Per-procedure code generator. Every local keeps one runtime type for the
+// whole procedure: declarations convert to their declared type, and plain
+// assignments must already produce that type (the interpreter would store
+// the right-hand side unconverted).
+class CodeGen {
+public:
+  explicit CodeGen(const ProcedureDecl &proc)
+      : _proc(proc), _slotTypes(proc.frameSize, DataType::VOID) {}
+
+  void run(JitProcedure &out) {
+    for (size_t i = 0; i < _proc.parameters.size(); ++i) {
+      DataType type = scalarType(_proc.parameters[i].type, "parameter");
+      _slotTypes[i] = type;
+      out.parameterTypes.push_back(type);
+    }
+
+    _isVoid =
+        _proc.returnType.baseType == DataType::VOID && !_proc.returnType.isArray;
+    if (!_isVoid) {
+      _returnType = scalarType(_proc.returnType, "return value");
+    }
+    out.returnType = _isVoid ? DataType::VOID : _returnType;
+
+    _exit = _asm.newLabel();
+    _bail = _asm.newLabel();
+
+    // push rbp; mov rbp, rsp
+    _asm.emit({0x55, 0x48, 0x89, 0xE5});
+
+    emitStatement(_proc.body.get());
+
+    // Falling off the end is fine for void procedures only; otherwise let
+    // the interpreter report the missing return
+    if (_isVoid) {
+      _asm.emit({0x31, 0xC0}); // xor eax, eax
+      _asm.jmp(_exit);
+    }
+
+    _asm.bind(_bail);
+    _asm.emit({0xB8});
+    _asm.imm32(1);
+    _asm.bind(_exit);
+    _asm.emit({0x48, 0x89, 0xEC, 0x5D, 0xC3}); // mov rsp, rbp; pop rbp; ret
+    _asm.finish();
+
+    out.slotCount = _proc.frameSize + _temporaries;
+  }
+
+  const std::vector<uint8_t> &code() const { return _asm.code; }
+
+private:
+  struct Target {
+    int breakLabel;
+    int continueLabel; // -1 when continue is not allowed
+  };
+
+  const ProcedureDecl &_proc;
+  Assembler _asm;
+  std::vector<DataType> _slotTypes;
+  std::vector<Target> _targets;
+  uint32_t _temporaries = 0;
+  bool _isVoid = true;
+  DataType _returnType = DataType::VOID;
+  int _exit = -1;
+  int _bail = -1;
+
+  // --- Register helpers ---
+
+  void load(uint8_t reg, DataType type, int32_t slot) {
+    if (type == DataType::DOUBLE) {
+      _asm.loadDouble(reg, slot);
+    } else {
+      _asm.loadInt(reg, slot);
+    }
+  }
+
+  void store(DataType type, int32_t slot) {
+    if (type == DataType::DOUBLE) {
+      _asm.storeDouble(slot);
+    } else {
+      _asm.storeInt(slot);
+    }
+  }
+
+  void pushPrimary(DataType type) {
+    if (type == DataType::DOUBLE) {
+      _asm.movqFromXmm(0, 0);
+    }
+    _asm.emit({0x50}); // push rax
+  }
+
+  void popPrimary(DataType type) {
+    _asm.emit({0x58}); // pop rax
+    if (type == DataType::DOUBLE) {
+      _asm.movqToXmm(0, 0);
+    }
+  }
+
+  void moveToSecondary(DataType type) {
+    if (type == DataType::DOUBLE) {
+      _asm.emit({0x66, 0x0F, 0x28, 0xC8}); // movapd xmm1, xmm0
+    } else {
+      _asm.emit({0x48, 0x89, 0xC1}); // mov rcx, rax
+    }
+  }
+
+  // Same result as Interpreter::convertToType between supported scalars
+  void convert(DataType from, DataType to) {
+    if (from == to) {
+      return;
+    }
+    switch (to) {
+    case DataType::INT32:
+      if (from == DataType::DOUBLE) {
+        _asm.emit({0xF2, 0x48, 0x0F, 0x2C, 0xC0}); // cvttsd2si rax, xmm0
+      }
+      _asm.emit({0x48, 0x63, 0xC0}); // movsxd rax, eax
+      return;
+    case DataType::INT64:
+      if (from == DataType::DOUBLE) {
+        _asm.emit({0xF2, 0x48, 0x0F, 0x2C, 0xC0});
+      }
+      return;
+    case DataType::DOUBLE:
+      _asm.intToDouble(0, 0);
+      return;
+    case DataType::BOOL:
+      toBool(from);
+      return;
+    default:
+      break;
+    }
+    decline("unsupported conversion");
+  }
+
+  // rax = 0/1 following ValueHelper::toBool (NaN is truthy)
+  void toBool(DataType type) {
+    if (type == DataType::BOOL) {
+      return;
+    }
+    if (type == DataType::DOUBLE) {
+      _asm.emit({0x66, 0x0F, 0x57, 0xC9}); // xorpd xmm1, xmm1
+      _asm.ucomisd(0, 1);
+      _asm.setcc(COND_NE);
+      _asm.setcc(COND_P, 1);
+      _asm.emit({0x08, 0xC8}); // or al, cl
+    } else {
+      _asm.emit({0x48, 0x85, 0xC0}); // test rax, rax
+      _asm.setcc(COND_NE);
+    }
+    _asm.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+  }
+
+  void branchIfFalse(Expression *condition, int label) {
+    if (condition->kind == NodeKind::BINARY) {
+      auto *bin = static_cast<BinaryExpr *>(condition);
+      Cond inverse;
+      if (integerCompare(bin->op, inverse)) {
+        DataType left, right;
+        emitOperands(bin->left.get(), bin->right.get(), left, right);
+        bool mixedBool = (left == DataType::BOOL) != (right == DataType::BOOL);
+        bool equality = bin->op == BinaryExpr::Operator::EQUAL ||
+                        bin->op == BinaryExpr::Operator::NOT_EQUAL;
+        if (left != DataType::DOUBLE && right != DataType::DOUBLE &&
+            !(equality && mixedBool)) {
+          _asm.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+          _asm.jcc(inverse, label);
+          return;
+        }
+        emitBinaryOp(bin->op, left, right);
+        _asm.emit({0x48, 0x85, 0xC0});
+        _asm.jcc(COND_E, label);
+        return;
+      }
+    }
+
+    DataType type = emitExpression(condition);
+    toBool(type);
+    _asm.emit({0x48, 0x85, 0xC0});
+    _asm.jcc(COND_E, label);
+  }
+
+  static bool integerCompare(BinaryExpr::Operator op, Cond &inverse) {
+    switch (op) {
+    case BinaryExpr::Operator::LESS_THAN:
+      inverse = COND_GE;
+      return true;
+    case BinaryExpr::Operator::GREATER_THAN:
+      inverse = COND_LE;
+      return true;
+    case BinaryExpr::Operator::LESS_EQUAL:
+      inverse = COND_G;
+      return true;
+    case BinaryExpr::Operator::GREATER_EQUAL:
+      inverse = COND_L;
+      return true;
+    case BinaryExpr::Operator::EQUAL:
+      inverse = COND_NE;
+      return true;
+    case BinaryExpr::Operator::NOT_EQUAL:
+      inverse = COND_E;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // --- Statements ---
+
+  void emitStatement(Statement *stmt) {
+    switch (stmt->kind) {
+    case NodeKind::EXPRESSION_STMT:
+      emitExpression(static_cast<ExpressionStmt *>(stmt)->expression.get());
+      return;
+    case NodeKind::VAR_DECL:
+      emitVarDecl(static_cast<VarDeclStmt *>(stmt));
+      return;
+    case NodeKind::ASSIGN:
+      emitAssign(static_cast<AssignStmt *>(stmt));
+      return;
+    case NodeKind::BLOCK:
+      for (auto &statement : static_cast<BlockStmt *>(stmt)->statements) {
+        emitStatement(statement.get());
+      }
+      return;
+    case NodeKind::IF:
+      emitIf(static_cast<IfStmt *>(stmt));
+      return;
+    case NodeKind::WHILE:
+      emitWhile(static_cast<WhileStmt *>(stmt));
+      return;
+    case NodeKind::FOR:
+      emitFor(static_cast<ForStmt *>(stmt));
+      return;
+    case NodeKind::DO_WHILE:
+      emitDoWhile(static_cast<DoWhileStmt *>(stmt));
+      return;
+    case NodeKind::SWITCH:
+      emitSwitch(static_cast<SwitchStmt *>(stmt));
+      return;
+    case NodeKind::RETURN:
+      emitReturn(static_cast<ReturnStmt *>(stmt));
+      return;
+    case NodeKind::BREAK:
+      if (_targets.empty()) {
+        decline("'break' outside of a loop or switch");
+      }
+      _asm.jmp(_targets.back().breakLabel);
+      return;
+    case NodeKind::CONTINUE:
+      if (_targets.empty() || _targets.back().continueLabel < 0) {
+        decline("'continue' outside of a loop");
+      }
+      _asm.jmp(_targets.back().continueLabel);
+      return;
+    case NodeKind::INDEX_ASSIGN:
+      decline("array element assignment");
+    default:
+      break;
+    }
+    decline("unsupported statement");
+  }
+
+  void emitVarDecl(VarDeclStmt *stmt) {
+    DataType type = scalarType(stmt->type, "local '" + stmt->name + "'");
+    DataType &slotType = _slotTypes[stmt->slot];
+    if (slotType != DataType::VOID && slotType != type) {
+      decline("frame slot reused with a different type");
+    }
+
+    if (stmt->initializer) {
+      convert(emitExpression(stmt->initializer.get()), type);
+    } else {
+      _asm.emit({0x31, 0xC0}); // zero bits are 0, 0.0 and false alike
+      if (type == DataType::DOUBLE) {
+        _asm.movqToXmm(0, 0);
+      }
+    }
+    slotType = type;
+    store(type, stmt->slot);
+  }
+
+  void emitAssign(AssignStmt *stmt) {
+    if (stmt->slot < 0) {
+      decline("external variable '" + stmt->variableName + "'");
+    }
+    DataType target = _slotTypes[stmt->slot];
+    if (target == DataType::VOID) {
+      decline("local used before its declaration");
+    }
+
+    DataType value = emitExpression(stmt->value.get());
+    if (stmt->op == AssignStmt::Operator::ASSIGN) {
+      if (value != target) {
+        decline("assignment changes the type of '" + stmt->variableName +
+                "'");
+      }
+      store(target, stmt->slot);
+      return;
+    }
+
+    BinaryExpr::Operator op = BinaryExpr::Operator::ADD;
+    switch (stmt->op) {
+    case AssignStmt::Operator::ASSIGN:
+    case AssignStmt::Operator::PLUS_ASSIGN:
+      op = BinaryExpr::Operator::ADD;
+      break;
+    case AssignStmt::Operator::MINUS_ASSIGN:
+      op = BinaryExpr::Operator::SUBTRACT;
+      break;
+    case AssignStmt::Operator::MULT_ASSIGN:
+      op = BinaryExpr::Operator::MULTIPLY;
+      break;
+    case AssignStmt::Operator::DIV_ASSIGN:
+      op = BinaryExpr::Operator::DIVIDE;
+      break;
+    }
+
+    moveToSecondary(value);
+    load(0, target, stmt->slot);
+    if (emitBinaryOp(op, target, value) != target) {
+      decline("compound assignment changes the type of '" +
+              stmt->variableName + "'");
+    }
+    store(target, stmt->slot);
+  }
+
+  void emitIf(IfStmt *stmt) {
+    int elseLabel = _asm.newLabel();
+    branchIfFalse(stmt->condition.get(), elseLabel);
+    emitStatement(stmt->thenBranch.get());
+
+    if (!stmt->elseBranch) {
+      _asm.bind(elseLabel);
+      return;
+    }
+
+    int endLabel = _asm.newLabel();
+    _asm.jmp(endLabel);
+    _asm.bind(elseLabel);
+    emitStatement(stmt->elseBranch.get());
+    _asm.bind(endLabel);
+  }
+
+  void emitWhile(WhileStmt *stmt) {
+    int top = _asm.newLabel();
+    int end = _asm.newLabel();
+    _asm.bind(top);
+    branchIfFalse(stmt->condition.get(), end);
+    _targets.push_back({end, top});
+    emitStatement(stmt->body.get());
+    _targets.pop_back();
+    _asm.jmp(top);
+    _asm.bind(end);
+  }
+
+  void emitFor(ForStmt *stmt) {
+    if (stmt->initializer) {
+      emitStatement(stmt->initializer.get());
+    }
+
+    int top = _asm.newLabel();
+    int next = _asm.newLabel();
+    int end = _asm.newLabel();
+    _asm.bind(top);
+    if (stmt->condition) {
+      branchIfFalse(stmt->condition.get(), end);
+    }
+    _targets.push_back({end, next});
+    emitStatement(stmt->body.get());
+    _targets.pop_back();
+    _asm.bind(next);
+    if (stmt->increment) {
+      emitStatement(stmt->increment.get());
+    }
+    _asm.jmp(top);
+    _asm.bind(end);
+  }
+
+  void emitDoWhile(DoWhileStmt *stmt) {
+    int top = _asm.newLabel();
+    int check = _asm.newLabel();
+    int end = _asm.newLabel();
+    _asm.bind(top);
+    _targets.push_back({end, check});
+    emitStatement(stmt->body.get());
+    _targets.pop_back();
+    _asm.bind(check);
+    branchIfFalse(stmt->condition.get(), end);
+    _asm.jmp(top);
+    _asm.bind(end);
+  }
+
+  void emitSwitch(SwitchStmt *stmt) {
+    // Case bodies share the enclosing scope, so a declaration in one case
+    // could be read uninitialized from another; leave those to the
+    // interpreter
+    for (const auto &caseEntry : stmt->cases) {
+      for (const auto &s : caseEntry.statements) {
+        if (s->kind == NodeKind::VAR_DECL) {
+          decline("declaration directly inside a switch case");
+        }
+      }
+    }
+
+    int32_t control = static_cast<int32_t>(_proc.frameSize + _temporaries++);
+    DataType controlType = emitExpression(stmt->expression.get());
+    store(controlType, control);
+
+    int end = _asm.newLabel();
+    std::vector<int> bodies;
+    bool reachedDefault = false;
+    for (const auto &caseEntry : stmt->cases) {
+      bodies.push_back(_asm.newLabel());
+      if (reachedDefault) {
+        continue; // default already matched in case order
+      }
+      if (caseEntry.isDefault) {
+        _asm.jmp(bodies.back());
+        reachedDefault = true;
+        continue;
+      }
+
+      DataType matchType = emitExpression(caseEntry.matchExpr.get());
+      moveToSecondary(matchType);
+      load(0, controlType, control);
+      emitBinaryOp(BinaryExpr::Operator::EQUAL, controlType, matchType);
+      _asm.emit({0x48, 0x85, 0xC0});
+      _asm.jcc(COND_NE, bodies.back());
+    }
+    if (!reachedDefault) {
+      _asm.jmp(end);
+    }
+
+    int continueLabel = _targets.empty() ? -1 : _targets.back().continueLabel;
+    _targets.push_back({end, continueLabel});
+    for (size_t i = 0; i < stmt->cases.size(); ++i) {
+      _asm.bind(bodies[i]);
+      for (const auto &s : stmt->cases[i].statements) {
+        emitStatement(s.get());
+      }
+    }
+    _targets.pop_back();
+    _asm.bind(end);
+  }
+
+  void emitReturn(ReturnStmt *stmt) {
+    DataType type = DataType::INT32;
+    if (stmt->value) {
+      type = emitExpression(stmt->value.get());
+    } else {
+      _asm.emit({0x31, 0xC0}); // int32 0
+    }
+
+    if (!_isVoid) {
+      convert(type, _returnType);
+      if (_returnType == DataType::DOUBLE) {
+        _asm.emit({0xF2, 0x0F, 0x11, 0x06}); // movsd [rsi], xmm0
+      } else {
+        _asm.emit({0x48, 0x89, 0x06}); // mov [rsi], rax
+      }
+    }
+    _asm.emit({0x31, 0xC0});
+    _asm.jmp(_exit);
+  }
+
+  // --- Expressions ---
+
+  DataType literalType(LiteralExpr *expr, uint64_t &bits) {
+    const Value &value = expr->value;
+    DataType type = ScalarTypes::literalType(value);
+    if (type == DataType::VOID) {
+      decline("literal of type " +
+              ValueHelper::typeToString(ValueHelper::getType(value)));
+    }
+    bits = ScalarTypes::toCell(value, type);
+    return type;
+  }
+
+  DataType localType(VariableExpr *expr) {
+    if (expr->slot < 0) {
+      decline("external variable '" + expr->name + "'");
+    }
+    DataType type = _slotTypes[expr->slot];
+    if (type == DataType::VOID) {
+      decline("local used before its declaration");
+    }
+    return type;
+  }
+
+  DataType emitExpression(Expression *expr) {
+    switch (expr->kind) {
+    case NodeKind::LITERAL: {
+      uint64_t bits = 0;
+      DataType type = literalType(static_cast<LiteralExpr *>(expr), bits);
+      _asm.movImm(0, bits);
+      if (type == DataType::DOUBLE) {
+        _asm.movqToXmm(0, 0);
+      }
+      return type;
+    }
+    case NodeKind::VARIABLE: {
+      auto *var = static_cast<VariableExpr *>(expr);
+      DataType type = localType(var);
+      load(0, type, var->slot);
+      return type;
+    }
+    case NodeKind::BINARY:
+      return emitBinary(static_cast<BinaryExpr *>(expr));
+    case NodeKind::UNARY:
+      return emitUnary(static_cast<UnaryExpr *>(expr));
+    case NodeKind::CONDITIONAL:
+      return emitConditional(static_cast<ConditionalExpr *>(expr));
+    case NodeKind::CALL:
+      decline("call to '" + static_cast<CallExpr *>(expr)->functionName + "'");
+    case NodeKind::ARRAY_LITERAL:
+    case NodeKind::INDEX:
+      decline("array access");
+    default:
+      break;
+    }
+    decline("unsupported expression");
+  }
+
+  // Leaves the left operand in the primary and the right in the secondary
+  // registers, evaluating left first
+  void emitOperands(Expression *left, Expression *right, DataType &leftType,
+                    DataType &rightType) {
+    leftType = emitExpression(left);
+
+    if (right->kind == NodeKind::VARIABLE) {
+      auto *var = static_cast<VariableExpr *>(right);
+      rightType = localType(var);
+      load(1, rightType, var->slot);
+      return;
+    }
+    if (right->kind == NodeKind::LITERAL) {
+      uint64_t bits = 0;
+      rightType = literalType(static_cast<LiteralExpr *>(right), bits);
+      _asm.movImm(1, bits);
+      if (rightType == DataType::DOUBLE) {
+        _asm.movqToXmm(1, 1);
+      }
+      return;
+    }
+
+    pushPrimary(leftType);
+    rightType = emitExpression(right);
+    moveToSecondary(rightType);
+    popPrimary(leftType);
+  }
+
+  DataType emitBinary(BinaryExpr *expr) {
+    if (expr->op == BinaryExpr::Operator::LOGICAL_AND ||
+        expr->op == BinaryExpr::Operator::LOGICAL_OR) {
+      bool isAnd = expr->op == BinaryExpr::Operator::LOGICAL_AND;
+      int shortCircuit = _asm.newLabel();
+      int end = _asm.newLabel();
+
+      toBool(emitExpression(expr->left.get()));
+      _asm.emit({0x48, 0x85, 0xC0});
+      _asm.jcc(isAnd ? COND_E : COND_NE, shortCircuit);
+      toBool(emitExpression(expr->right.get()));
+      _asm.jmp(end);
+      _asm.bind(shortCircuit);
+      _asm.emit({0xB8});
+      _asm.imm32(isAnd ? 0 : 1);
+      _asm.bind(end);
+      return DataType::BOOL;
+    }
+
+    DataType left, right;
+    emitOperands(expr->left.get(), expr->right.get(), left, right);
+    return emitBinaryOp(expr->op, left, right);
+  }
+
+  // Applies op to primary/secondary with ValueHelper's promotion rules (see
+  // ScalarTypes::binaryResult)
+  DataType emitBinaryOp(BinaryExpr::Operator op, DataType left,
+                        DataType right) {
+    bool anyDouble = left == DataType::DOUBLE || right == DataType::DOUBLE;
+
+    switch (op) {
+    case BinaryExpr::Operator::ADD:
+    case BinaryExpr::Operator::SUBTRACT:
+    case BinaryExpr::Operator::MULTIPLY:
+    case BinaryExpr::Operator::DIVIDE:
+    case BinaryExpr::Operator::MODULO: {
+      if (left == DataType::BOOL || right == DataType::BOOL) {
+        decline("arithmetic on bool");
+      }
+      if (anyDouble) {
+        if (op == BinaryExpr::Operator::MODULO) {
+          decline("modulo on double");
+        }
+        toDoubleOperands(left, right);
+        uint8_t opcode = 0x58;
+        switch (op) {
+        case BinaryExpr::Operator::SUBTRACT:
+          opcode = 0x5C;
+          break;
+        case BinaryExpr::Operator::MULTIPLY:
+          opcode = 0x59;
+          break;
+        case BinaryExpr::Operator::DIVIDE: {
+          // Division by +/-0.0 raises in the interpreter
+          int nonZero = _asm.newLabel();
+          _asm.emit({0x66, 0x0F, 0x57, 0xD2}); // xorpd xmm2, xmm2
+          _asm.ucomisd(1, 2);
+          _asm.jcc(COND_P, nonZero);
+          _asm.jcc(COND_E, _bail);
+          _asm.bind(nonZero);
+          opcode = 0x5E;
+          break;
+        }
+        default:
+          break;
+        }
+        _asm.emit({0xF2, 0x0F, opcode, 0xC1});
+        return DataType::DOUBLE;
+      }
+
+      DataType result = ScalarTypes::binaryResult(op, left, right);
+      switch (op) {
+      case BinaryExpr::Operator::ADD:
+        _asm.emit({0x48, 0x01, 0xC8});
+        break;
+      case BinaryExpr::Operator::SUBTRACT:
+        _asm.emit({0x48, 0x29, 0xC8});
+        break;
+      case BinaryExpr::Operator::MULTIPLY:
+        _asm.emit({0x48, 0x0F, 0xAF, 0xC1});
+        break;
+      default:
+        emitDivide(op == BinaryExpr::Operator::MODULO, result);
+        break;
+      }
+      if (result == DataType::INT32) {
+        _asm.emit({0x48, 0x63, 0xC0}); // movsxd rax, eax
+      }
+      return result;
+    }
+
+    case BinaryExpr::Operator::LESS_THAN:
+    case BinaryExpr::Operator::GREATER_THAN:
+    case BinaryExpr::Operator::LESS_EQUAL:
+    case BinaryExpr::Operator::GREATER_EQUAL:
+      if (anyDouble) {
+        // Operands are swapped for < and <= so that unordered compares
+        // (NaN) come out false via the carry flag
+        toDoubleOperands(left, right);
+        bool swap = op == BinaryExpr::Operator::LESS_THAN ||
+                    op == BinaryExpr::Operator::LESS_EQUAL;
+        bool strict = op == BinaryExpr::Operator::LESS_THAN ||
+                      op == BinaryExpr::Operator::GREATER_THAN;
+        _asm.ucomisd(swap ? 1 : 0, swap ? 0 : 1);
+        _asm.setcc(strict ? COND_A : COND_AE);
+      } else {
+        _asm.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+        Cond cond = COND_L;
+        if (op == BinaryExpr::Operator::GREATER_THAN) {
+          cond = COND_G;
+        } else if (op == BinaryExpr::Operator::LESS_EQUAL) {
+          cond = COND_LE;
+        } else if (op == BinaryExpr::Operator::GREATER_EQUAL) {
+          cond = COND_GE;
+        }
+        _asm.setcc(cond);
+      }
+      _asm.emit({0x0F, 0xB6, 0xC0});
+      return DataType::BOOL;
+
+    case BinaryExpr::Operator::EQUAL:
+    case BinaryExpr::Operator::NOT_EQUAL: {
+      bool equal = op == BinaryExpr::Operator::EQUAL;
+      if (anyDouble) {
+        toDoubleOperands(left, right);
+        _asm.ucomisd(0, 1);
+        _asm.setcc(equal ? COND_E : COND_NE);
+        _asm.setcc(equal ? COND_NP : COND_P, 1);
+        _asm.emit({static_cast<uint8_t>(equal ? 0x20 : 0x08), 0xC8});
+      } else if ((left == DataType::BOOL) != (right == DataType::BOOL)) {
+        // A bool never equals a number
+        _asm.emit({0xB8});
+        _asm.imm32(equal ? 0 : 1);
+        return DataType::BOOL;
+      } else {
+        _asm.emit({0x48, 0x39, 0xC8});
+        _asm.setcc(equal ? COND_E : COND_NE);
+      }
+      _asm.emit({0x0F, 0xB6, 0xC0});
+      return DataType::BOOL;
+    }
+
+    case BinaryExpr::Operator::BIT_AND:
+    case BinaryExpr::Operator::BIT_OR:
+    case BinaryExpr::Operator::BIT_XOR:
+    case BinaryExpr::Operator::LSHIFT:
+    case BinaryExpr::Operator::RSHIFT:
+      if (!isInt(left) || !isInt(right)) {
+        decline("bitwise operator on non-integers");
+      }
+      switch (op) {
+      case BinaryExpr::Operator::BIT_AND:
+        _asm.emit({0x48, 0x21, 0xC8});
+        break;
+      case BinaryExpr::Operator::BIT_OR:
+        _asm.emit({0x48, 0x09, 0xC8});
+        break;
+      case BinaryExpr::Operator::BIT_XOR:
+        _asm.emit({0x48, 0x31, 0xC8});
+        break;
+      case BinaryExpr::Operator::LSHIFT:
+        _asm.emit({0x48, 0xD3, 0xE0}); // shl rax, cl
+        break;
+      default:
+        _asm.emit({0x48, 0xD3, 0xF8}); // sar rax, cl
+        break;
+      }
+      return DataType::INT64;
+
+    case BinaryExpr::Operator::LOGICAL_AND:
+    case BinaryExpr::Operator::LOGICAL_OR:
+      break;
+    }
+    decline("unsupported binary operator");
+  }
+
+  void toDoubleOperands(DataType left, DataType right) {
+    if (left != DataType::DOUBLE) {
+      _asm.intToDouble(0, 0);
+    }
+    if (right != DataType::DOUBLE) {
+      _asm.intToDouble(1, 1);
+    }
+  }
+
+  // rax = rax / rcx or rax % rcx with the interpreter's zero check
+  void emitDivide(bool modulo, DataType result) {
+    _asm.emit({0x48, 0x85, 0xC9}); // test rcx, rcx
+    _asm.jcc(COND_E, _bail);
+
+    int done = _asm.newLabel();
+    if (result == DataType::INT64) {
+      // INT64_MIN / -1 would trap; x / -1 is just a wrapping negation
+      int divide = _asm.newLabel();
+      _asm.emit({0x48, 0x83, 0xF9, 0xFF}); // cmp rcx, -1
+      _asm.jcc(COND_NE, divide);
+      if (modulo) {
+        _asm.emit({0x31, 0xC0});
+      } else {
+        _asm.emit({0x48, 0xF7, 0xD8}); // neg rax
+      }
+      _asm.jmp(done);
+      _asm.bind(divide);
+    }
+    _asm.emit({0x48, 0x99, 0x48, 0xF7, 0xF9}); // cqo; idiv rcx
+    if (modulo) {
+      _asm.emit({0x48, 0x89, 0xD0}); // mov rax, rdx
+    }
+    _asm.bind(done);
+  }
+
+  DataType emitUnary(UnaryExpr *expr) {
+    DataType type = emitExpression(expr->operand.get());
+
+    switch (expr->op) {
+    case UnaryExpr::Operator::NEGATE:
+      if (type == DataType::DOUBLE) {
+        _asm.movqFromXmm(0, 0);
+        _asm.emit({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); // btc rax, 63
+        _asm.movqToXmm(0, 0);
+        return DataType::DOUBLE;
+      }
+      // The interpreter negates every non-double into an int32
+      _asm.emit({0x48, 0xF7, 0xD8, 0x48, 0x63, 0xC0}); // neg rax; movsxd
+      return DataType::INT32;
+    case UnaryExpr::Operator::LOGICAL_NOT:
+      toBool(type);
+      _asm.emit({0x83, 0xF0, 0x01}); // xor eax, 1
+      return DataType::BOOL;
+    case UnaryExpr::Operator::BIT_NOT:
+      if (!isInt(type)) {
+        decline("bitwise operator on non-integers");
+      }
+      _asm.emit({0x48, 0xF7, 0xD0}); // not rax
+      return DataType::INT64;
+    }
+    decline("unsupported unary operator");
+  }
+
+  DataType emitConditional(ConditionalExpr *expr) {
+    int elseLabel = _asm.newLabel();
+    int end = _asm.newLabel();
+    branchIfFalse(expr->condition.get(), elseLabel);
+    DataType thenType = emitExpression(expr->thenExpr.get());
+    _asm.jmp(end);
+    _asm.bind(elseLabel);
+    DataType elseType = emitExpression(expr->elseExpr.get());
+    if (thenType != elseType) {
+      decline("conditional branches of different types");
+    }
+    _asm.bind(end);
+    return thenType;
+  }
+};
+
+} // namespace
+
+JitProcedure::~JitProcedure() {
+#if CXXSCRIPT_JIT_NATIVE
+  if (_code) {
+    munmap(_code, _codeSize);
+  }
+#endif
+}
+
+bool JitProcedure::invoke(const std::vector<CompactValue> &arguments,
+                          Value &result) const {
+  uint64_t inlineSlots[16] = {};
+  std::vector<uint64_t> heapSlots;
+  uint64_t *slots = inlineSlots;
+  if (slotCount > 16) {
+    heapSlots.resize(slotCount);
+    slots = heapSlots.data();
+  }
+
+  // Same conversions as binding parameters in the interpreter; strings and
+  // arrays would raise there, so leave them to it
+  Value scratch;
+  for (size_t i = 0; i < parameterTypes.size(); ++i) {
+    const Value &arg = arguments[i].view(scratch);
+    if (std::holds_alternative<std::string>(arg) || ValueHelper::isArray(arg)) {
+      return false;
+    }
+    slots[i] = ScalarTypes::toCell(arg, parameterTypes[i]);
+  }
+
+  uint64_t cell = 0;
+  if (entry(slots, &cell) != 0) {
+    return false;
+  }
+
+  result = ScalarTypes::fromCell(cell, returnType);
+  return true;
+}
+
+bool JitCompiler::isSupported() { return CXXSCRIPT_JIT_NATIVE != 0; }
+
+JitProcedurePtr JitCompiler::compile(const ProcedureDecl &proc) {
+  if (!proc.resolved) {
+    throw std::runtime_error("Procedure '" + proc.name +
+                             "' must be resolved before compilation");
+  }
+
+  auto result = std::make_shared<JitProcedure>();
+  if (!isSupported()) {
+    result->declined = "native code generation requires x86-64 Linux";
+    return result;
+  }
+
+  std::vector<uint8_t> code;
+  try {
+    CodeGen gen(proc);
+    gen.run(*result);
+    code = gen.code();
+  } catch (const Declined &declined) {
+    result->declined = declined.reason;
+    result->parameterTypes.clear();
+    return result;
+  }
+
+#if CXXSCRIPT_JIT_NATIVE
+  void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    result->declined = "could not allocate executable memory";
+    return result;
+  }
+  std::memcpy(memory, code.data(), code.size());
+  if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, code.size());
+    result->declined = "could not allocate executable memory";
+    return result;
+  }
+
+  result->_code = memory;
+  result->_codeSize = code.size();
+  result->entry = reinterpret_cast<JitProcedure::Entry>(memory);
+#endif
+  return result;
+}
+
+} // namespace Script
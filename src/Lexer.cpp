@@ -153,6 +153,8 @@ Token Lexer::nextToken() {
     return makeToken(TokenType::COLON, ":");
   case '?':
     return makeToken(TokenType::QUESTION, "?");
+  case '.':
+    return makeToken(TokenType::DOT, ".");
   }
 
   Token errorToken = makeToken(TokenType::UNKNOWN, std::string(1, c));
@@ -0,0 +1,331 @@
+#include "LoopOptimizer.h"
+#include <string>
+
+namespace Script {
+
+void LoopOptimizer::optimize(Script &script) {
+  for (auto &proc : script.procedures) {
+    if (!proc->native) {
+      optimize(*proc);
+    }
+  }
+}
+
+void LoopOptimizer::optimize(ProcedureDecl &proc) {
+  _procedure = &proc;
+  proc.body = visitStatement(proc.body);
+  _procedure = nullptr;
+}
+
+StmtPtr LoopOptimizer::visitStatement(const StmtPtr &stmt) {
+  if (!stmt) {
+    return stmt;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::BLOCK:
+    for (auto &statement : static_cast<BlockStmt *>(stmt.get())->statements) {
+      statement = visitStatement(statement);
+    }
+    return stmt;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt.get());
+    ifStmt->thenBranch = visitStatement(ifStmt->thenBranch);
+    ifStmt->elseBranch = visitStatement(ifStmt->elseBranch);
+    return stmt;
+  }
+  case NodeKind::SWITCH:
+    for (auto &switchCase : static_cast<SwitchStmt *>(stmt.get())->cases) {
+      for (auto &statement : switchCase.statements) {
+        statement = visitStatement(statement);
+      }
+    }
+    return stmt;
+  case NodeKind::WHILE: {
+    auto *loop = static_cast<WhileStmt *>(stmt.get());
+    StmtPtr result = hoist(stmt);
+    loop->body = visitStatement(loop->body);
+    return result;
+  }
+  case NodeKind::FOR: {
+    auto *loop = static_cast<ForStmt *>(stmt.get());
+    StmtPtr result = hoist(stmt);
+    loop->body = visitStatement(loop->body);
+    return result;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *loop = static_cast<DoWhileStmt *>(stmt.get());
+    StmtPtr result = hoist(stmt);
+    loop->body = visitStatement(loop->body);
+    return result;
+  }
+  default:
+    return stmt;
+  }
+}
+
+StmtPtr LoopOptimizer::hoist(const StmtPtr &loop) {
+  PurityModel::Writes writes;
+  _purity.collectWrites(loop.get(), writes);
+  std::vector<StmtPtr> temporaries;
+  std::vector<StmtPtr> entry;
+  std::vector<StmtPtr> guarded;
+  _writes = &writes;
+  _temporaries = &temporaries;
+
+  // Whatever leads the first pass through the loop may move in front of
+  // it; what leads the body of a while or for loop only behind a copy of
+  // its condition, which is only possible when that condition is safe
+  bool leading = true;
+  bool notLeading = false;
+  ExprPtr guard;
+  StmtPtr initializer;
+  switch (loop->kind) {
+  case NodeKind::WHILE: {
+    auto *whileLoop = static_cast<WhileStmt *>(loop.get());
+    _leadingTemporaries = &entry;
+    hoistExpression(whileLoop->condition, leading);
+    guard = whileLoop->condition;
+    leading = _purity.isSafe(*guard);
+    _leadingTemporaries = &guarded;
+    hoistStatement(whileLoop->body, leading);
+    break;
+  }
+  case NodeKind::FOR: {
+    // The initializer runs once, but what it writes still counts
+    auto *forLoop = static_cast<ForStmt *>(loop.get());
+    _leadingTemporaries = &entry;
+    hoistExpression(forLoop->condition, leading);
+    guard = forLoop->condition;
+    leading = !guard || _purity.isSafe(*guard);
+    _leadingTemporaries = &guarded;
+    hoistStatement(forLoop->body, leading);
+    hoistStatement(forLoop->increment, notLeading);
+    initializer = forLoop->initializer;
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *doLoop = static_cast<DoWhileStmt *>(loop.get());
+    _leadingTemporaries = &entry;
+    hoistStatement(doLoop->body, leading);
+    hoistExpression(doLoop->condition, leading);
+    break;
+  }
+  default:
+    break;
+  }
+  _writes = nullptr;
+  _temporaries = nullptr;
+  _leadingTemporaries = nullptr;
+
+  if (temporaries.empty() && entry.empty() && guarded.empty()) {
+    return loop;
+  }
+  // What leads the loop is evaluated after a for loop's initializer
+  if (initializer && (!entry.empty() || !guarded.empty())) {
+    temporaries.push_back(initializer);
+    static_cast<ForStmt *>(loop.get())->initializer = nullptr;
+  }
+  temporaries.insert(temporaries.end(), entry.begin(), entry.end());
+  if (guarded.empty()) {
+    temporaries.push_back(loop);
+  } else if (!guard) {
+    temporaries.insert(temporaries.end(), guarded.begin(), guarded.end());
+    temporaries.push_back(loop);
+  } else {
+    guarded.push_back(loop);
+    auto body =
+        std::make_shared<BlockStmt>(guarded, loop->line, loop->column);
+    temporaries.push_back(std::make_shared<IfStmt>(
+        guard, body, nullptr, loop->line, loop->column));
+  }
+  return std::make_shared<BlockStmt>(temporaries, loop->line, loop->column);
+}
+
+void LoopOptimizer::hoistStatement(StmtPtr &stmt, bool &leading) {
+  if (!stmt) {
+    return;
+  }
+
+  // What follows stays leading only after statements that cannot fail:
+  // typed declarations and plain assignments to locals of safe values
+  bool after = false;
+  bool notLeading = false;
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    hoistExpression(static_cast<ExpressionStmt *>(stmt.get())->expression,
+                    leading);
+    after = leading;
+    break;
+  case NodeKind::VAR_DECL: {
+    auto *decl = static_cast<VarDeclStmt *>(stmt.get());
+    hoistExpression(decl->initializer, leading);
+    after = leading && (!decl->initializer || decl->initializerTyped);
+    break;
+  }
+  case NodeKind::ASSIGN: {
+    auto *assign = static_cast<AssignStmt *>(stmt.get());
+    hoistExpression(assign->value, leading);
+    after = leading && assign->slot >= 0 &&
+            assign->op == AssignStmt::Operator::ASSIGN;
+    break;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    auto *assign = static_cast<IndexAssignStmt *>(stmt.get());
+    hoistExpression(assign->arrayExpr, notLeading);
+    hoistExpression(assign->indexExpr, notLeading);
+    hoistExpression(assign->value, notLeading);
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *assign = static_cast<FieldAssignStmt *>(stmt.get());
+    hoistExpression(assign->object, notLeading);
+    hoistExpression(assign->value, notLeading);
+    break;
+  }
+  case NodeKind::BLOCK:
+    for (auto &statement : static_cast<BlockStmt *>(stmt.get())->statements) {
+      hoistStatement(statement, leading);
+    }
+    after = leading;
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt.get());
+    hoistExpression(ifStmt->condition, leading);
+    hoistStatement(ifStmt->thenBranch, notLeading);
+    hoistStatement(ifStmt->elseBranch, notLeading);
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *loop = static_cast<WhileStmt *>(stmt.get());
+    hoistExpression(loop->condition, notLeading);
+    hoistStatement(loop->body, notLeading);
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *loop = static_cast<ForStmt *>(stmt.get());
+    hoistStatement(loop->initializer, notLeading);
+    hoistExpression(loop->condition, notLeading);
+    hoistStatement(loop->increment, notLeading);
+    hoistStatement(loop->body, notLeading);
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *loop = static_cast<DoWhileStmt *>(stmt.get());
+    hoistStatement(loop->body, notLeading);
+    hoistExpression(loop->condition, notLeading);
+    break;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt.get());
+    hoistExpression(switchStmt->expression, leading);
+    for (auto &switchCase : switchStmt->cases) {
+      for (auto &statement : switchCase.statements) {
+        hoistStatement(statement, notLeading);
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN:
+    hoistExpression(static_cast<ReturnStmt *>(stmt.get())->value, leading);
+    break;
+  default:
+    break;
+  }
+  leading = after;
+}
+
+void LoopOptimizer::hoistExpression(ExprPtr &expr, bool &leading) {
+  if (!expr) {
+    return;
+  }
+
+  // Only a value of known type gets a local. What may fail only moves when
+  // nothing that may fail or change anything runs before it.
+  TypeInfo type = _purity.resultType(*expr);
+  bool storable = type.isArray || type.baseType != DataType::VOID;
+  if (expr->kind != NodeKind::LITERAL && expr->kind != NodeKind::VARIABLE &&
+      storable && isInvariant(*expr)) {
+    bool safe = _purity.isSafe(*expr);
+    if (safe || leading) {
+      auto slot = static_cast<int32_t>(_procedure->frameSize++);
+      std::string name = "$" + std::to_string(slot);
+      auto decl = std::make_shared<VarDeclStmt>(type, name, expr, expr->line,
+                                                expr->column);
+      decl->slot = slot;
+      decl->initializerTyped = true;
+      (safe ? _temporaries : _leadingTemporaries)->push_back(decl);
+
+      auto read =
+          std::make_shared<VariableExpr>(name, expr->line, expr->column);
+      read->slot = slot;
+      read->staticType = type;
+      expr = read;
+      return;
+    }
+  }
+
+  // Operands run in order, except the right of && and || and the branches
+  // of ?:, which may not run at all
+  bool notLeading = false;
+  switch (expr->kind) {
+  case NodeKind::BINARY: {
+    using Op = BinaryExpr::Operator;
+    auto *binary = static_cast<BinaryExpr *>(expr.get());
+    bool shortCircuit =
+        binary->op == Op::LOGICAL_AND || binary->op == Op::LOGICAL_OR;
+    hoistExpression(binary->left, leading);
+    hoistExpression(binary->right, shortCircuit ? notLeading : leading);
+    break;
+  }
+  case NodeKind::UNARY:
+    hoistExpression(static_cast<UnaryExpr *>(expr.get())->operand, leading);
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr.get());
+    hoistExpression(cond->condition, leading);
+    hoistExpression(cond->thenExpr, notLeading);
+    hoistExpression(cond->elseExpr, notLeading);
+    break;
+  }
+  case NodeKind::CALL:
+    for (auto &arg : static_cast<CallExpr *>(expr.get())->arguments) {
+      hoistExpression(arg, leading);
+    }
+    break;
+  case NodeKind::ARRAY_LITERAL:
+    for (auto &element :
+         static_cast<ArrayLiteralExpr *>(expr.get())->elements) {
+      hoistExpression(element, leading);
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *index = static_cast<IndexExpr *>(expr.get());
+    hoistExpression(index->arrayExpr, leading);
+    hoistExpression(index->indexExpr, leading);
+    break;
+  }
+  case NodeKind::FIELD:
+    hoistExpression(static_cast<FieldExpr *>(expr.get())->object, leading);
+    break;
+  case NodeKind::RECORD:
+    for (auto &field : static_cast<RecordExpr *>(expr.get())->fields) {
+      hoistExpression(field, leading);
+    }
+    break;
+  default:
+    break;
+  }
+  leading = leading && _purity.isSafe(*expr);
+}
+
+bool LoopOptimizer::isInvariant(const Expression &expr) const {
+  if (!_purity.isPure(expr)) {
+    return false;
+  }
+  PurityModel::Reads reads;
+  PurityModel::collectReads(expr, reads);
+  return !PurityModel::overlaps(reads, *_writes);
+}
+
+} // namespace Script
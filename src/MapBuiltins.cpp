@@ -0,0 +1,108 @@
+#include "MapBuiltins.h"
+#include <stdexcept>
+
+namespace Script {
+
+namespace {
+
+MapValue &mapArgument(const char *name, const BuiltinArguments &args,
+                      size_t expected) {
+  if (args.size() != expected) {
+    throw std::runtime_error(std::string(name) + " expects " +
+                             std::to_string(expected) +
+                             (expected == 1 ? " argument" : " arguments"));
+  }
+  const MapPtr *map = std::get_if<MapPtr>(&args[0]);
+  if (!map || !*map) {
+    throw std::runtime_error(std::string(name) +
+                             " expects a map as first argument");
+  }
+  return **map;
+}
+
+// The key converted to the map's key type; a key that has it already is
+// used as it is. Key types are scalars, whose Value alternatives are in
+// DataType order.
+const Value &keyArgument(const MapValue &map, const Value &key,
+                         Value &scratch) {
+  if (key.index() == static_cast<size_t>(map.keyType())) {
+    return key;
+  }
+  scratch = ValueHelper::convertElement(key, TypeInfo(map.keyType()));
+  return scratch;
+}
+
+Value getBuiltin(const BuiltinArguments &args) {
+  MapValue &map = mapArgument("get", args, args.size() == 3 ? 3 : 2);
+  Value scratch;
+  const Value &key = keyArgument(map, args[1], scratch);
+  int64_t entry = map.find(key);
+  if (entry >= 0) {
+    return map.valueAt(static_cast<size_t>(entry));
+  }
+  if (args.size() == 3) {
+    return ValueHelper::convertElement(args[2], TypeInfo(map.valueType()));
+  }
+  throw std::runtime_error("Map has no key " + ValueHelper::toString(key));
+}
+
+Value putBuiltin(const BuiltinArguments &args) {
+  MapValue &map = mapArgument("put", args, 3);
+  Value scratch;
+  map.put(keyArgument(map, args[1], scratch),
+          ValueHelper::convertElement(args[2], TypeInfo(map.valueType())));
+  return ValueHelper::createValue(DataType::INT32,
+                                  static_cast<int64_t>(map.size()));
+}
+
+Value hasBuiltin(const BuiltinArguments &args) {
+  MapValue &map = mapArgument("has", args, 2);
+  Value scratch;
+  return map.has(keyArgument(map, args[1], scratch));
+}
+
+Value removeBuiltin(const BuiltinArguments &args) {
+  MapValue &map = mapArgument("remove", args, 2);
+  Value scratch;
+  return map.remove(keyArgument(map, args[1], scratch));
+}
+
+Value keysBuiltin(const BuiltinArguments &args) {
+  return mapArgument("keys", args, 1).keys();
+}
+
+} // namespace
+
+bool MapBuiltins::isBuiltin(const std::string &name) {
+  return find(name) != nullptr;
+}
+
+BuiltinFunction MapBuiltins::find(const std::string &name) {
+  if (name == "get") {
+    return getBuiltin;
+  }
+  if (name == "put") {
+    return putBuiltin;
+  }
+  if (name == "has") {
+    return hasBuiltin;
+  }
+  if (name == "remove") {
+    return removeBuiltin;
+  }
+  if (name == "keys") {
+    return keysBuiltin;
+  }
+  return nullptr;
+}
+
+Value MapBuiltins::call(const std::string &name,
+                        const std::vector<Value> &args) {
+  BuiltinFunction builtin = find(name);
+  if (!builtin) {
+    throw std::runtime_error("Undefined function: " + name);
+  }
+  return builtin(BuiltinArguments(args));
+}
+
+} // namespace Script
@@ -0,0 +1,53 @@
+#include "NativeModule.h"
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define CXXSCRIPT_HAS_DLOPEN 0
+#else
+#define CXXSCRIPT_HAS_DLOPEN 1
+#include <dlfcn.h>
+#endif
+
+namespace Script {
+
+std::shared_ptr<NativeModule> NativeModule::open(const std::string &path) {
+#if CXXSCRIPT_HAS_DLOPEN
+  void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    const char *reason = dlerror();
+    throw std::runtime_error("Failed to load native module: " +
+                             std::string(reason ? reason : path));
+  }
+
+  auto entry = reinterpret_cast<CxxScriptNativeModuleEntry>(
+      dlsym(handle, CXXSCRIPT_NATIVE_MODULE_ENTRY));
+  if (!entry) {
+    dlclose(handle);
+    throw std::runtime_error("Not a native module (missing " +
+                             std::string(CXXSCRIPT_NATIVE_MODULE_ENTRY) +
+                             "): " + path);
+  }
+
+  const CxxScriptNativeModule *module = entry();
+  if (!module || module->abiVersion != CXXSCRIPT_NATIVE_ABI_VERSION) {
+    dlclose(handle);
+    throw std::runtime_error("Native module was built for a different ABI "
+                             "version: " +
+                             path);
+  }
+
+  return std::shared_ptr<NativeModule>(new NativeModule(path, handle, module));
+#else
+  throw std::runtime_error("Native modules are not supported on this "
+                           "platform: " +
+                           path);
+#endif
+}
+
+NativeModule::~NativeModule() {
+#if CXXSCRIPT_HAS_DLOPEN
+  dlclose(_handle);
+#endif
+}
+
+} // namespace Script
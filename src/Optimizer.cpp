@@ -0,0 +1,392 @@
+#include "Optimizer.h"
+#include <stdexcept>
+
+namespace Script {
+
+namespace {
+
+bool isLiteral(const ExprPtr &expr) {
+  return expr && expr->kind == NodeKind::LITERAL;
+}
+
+const Value &literalValue(const ExprPtr &expr) {
+  return static_cast<LiteralExpr *>(expr.get())->value;
+}
+
+ExprPtr makeLiteral(const Value &value, const ASTNode &at) {
+  return std::make_shared<LiteralExpr>(value, ValueHelper::getType(value),
+                                       at.line, at.column);
+}
+
+bool endsFlow(const Statement &stmt) {
+  return stmt.kind == NodeKind::RETURN || stmt.kind == NodeKind::BREAK ||
+         stmt.kind == NodeKind::CONTINUE;
+}
+
+bool isBareDeclaration(const StmtPtr &stmt) {
+  return stmt && stmt->kind == NodeKind::VAR_DECL;
+}
+
+} // namespace
+
+void Optimizer::optimize(Script &script) {
+  for (auto &proc : script.procedures) {
+    optimize(*proc);
+  }
+}
+
+void Optimizer::optimize(ProcedureDecl &proc) {
+  if (!proc.body) {
+    return;
+  }
+  _assigned.clear();
+  _constants.clear();
+
+  // Parameters live in the outermost scope, as in the Resolver
+  Scope parameters;
+  for (const auto &param : proc.parameters) {
+    parameters[param.name] = nullptr;
+  }
+
+  _scopes.assign(1, parameters);
+  collectAssignments(proc.body.get());
+
+  _scopes.assign(1, parameters);
+  proc.body = optimizeBody(proc.body);
+  _scopes.clear();
+}
+
+const VarDeclStmt *Optimizer::lookup(const std::string &name) const {
+  for (auto it = _scopes.rbegin(); it != _scopes.rend(); ++it) {
+    auto found = it->find(name);
+    if (found != it->end()) {
+      return found->second;
+    }
+  }
+  return nullptr;
+}
+
+void Optimizer::collectAssignments(Statement *stmt) {
+  if (!stmt) {
+    return;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::VAR_DECL: {
+    auto *varDecl = static_cast<VarDeclStmt *>(stmt);
+    _scopes.back()[varDecl->name] = varDecl;
+    break;
+  }
+  case NodeKind::ASSIGN:
+    if (const VarDeclStmt *target =
+            lookup(static_cast<AssignStmt *>(stmt)->variableName)) {
+      _assigned.insert(target);
+    }
+    break;
+  case NodeKind::BLOCK:
+    _scopes.emplace_back();
+    for (auto &s : static_cast<BlockStmt *>(stmt)->statements) {
+      collectAssignments(s.get());
+    }
+    _scopes.pop_back();
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    collectAssignments(ifStmt->thenBranch.get());
+    collectAssignments(ifStmt->elseBranch.get());
+    break;
+  }
+  case NodeKind::WHILE:
+    collectAssignments(static_cast<WhileStmt *>(stmt)->body.get());
+    break;
+  case NodeKind::FOR: {
+    auto *forStmt = static_cast<ForStmt *>(stmt);
+    _scopes.emplace_back();
+    collectAssignments(forStmt->initializer.get());
+    collectAssignments(forStmt->body.get());
+    collectAssignments(forStmt->increment.get());
+    _scopes.pop_back();
+    break;
+  }
+  case NodeKind::DO_WHILE:
+    collectAssignments(static_cast<DoWhileStmt *>(stmt)->body.get());
+    break;
+  case NodeKind::SWITCH:
+    for (auto &caseEntry : static_cast<SwitchStmt *>(stmt)->cases) {
+      for (auto &s : caseEntry.statements) {
+        collectAssignments(s.get());
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+StmtPtr Optimizer::optimizeBody(const StmtPtr &stmt) {
+  StmtPtr optimized = optimizeStatement(stmt);
+  if (!optimized) {
+    return std::make_shared<BlockStmt>(std::vector<StmtPtr>{}, stmt->line,
+                                       stmt->column);
+  }
+  return optimized;
+}
+
+StmtPtr Optimizer::optimizeStatement(const StmtPtr &stmt, bool sequenced) {
+  if (!stmt) {
+    return nullptr;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT: {
+    // A literal statement does nothing
+    auto *exprStmt = static_cast<ExpressionStmt *>(stmt.get());
+    exprStmt->expression = fold(exprStmt->expression);
+    return isLiteral(exprStmt->expression) ? nullptr : stmt;
+  }
+  case NodeKind::VAR_DECL: {
+    // The initializer still sees an outer variable of the same name. Only
+    // a declaration that runs before every read of it (a direct child of a
+    // block) can stand for its literal; case labels can jump past others.
+    auto *varDecl = static_cast<VarDeclStmt *>(stmt.get());
+    varDecl->initializer = fold(varDecl->initializer);
+    _scopes.back()[varDecl->name] = varDecl;
+    const TypeInfo &type = varDecl->type;
+    if (sequenced && isLiteral(varDecl->initializer) && !type.isArray &&
+        type.baseType < DataType::VOID && !_assigned.count(varDecl) &&
+        ValueHelper::getType(literalValue(varDecl->initializer)) == type) {
+      _constants[varDecl] =
+          std::static_pointer_cast<LiteralExpr>(varDecl->initializer);
+    }
+    return stmt;
+  }
+  case NodeKind::ASSIGN: {
+    auto *assign = static_cast<AssignStmt *>(stmt.get());
+    assign->value = fold(assign->value);
+    return stmt;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    auto *idxAssign = static_cast<IndexAssignStmt *>(stmt.get());
+    idxAssign->arrayExpr = fold(idxAssign->arrayExpr);
+    idxAssign->indexExpr = fold(idxAssign->indexExpr);
+    idxAssign->value = fold(idxAssign->value);
+    return stmt;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *fieldAssign = static_cast<FieldAssignStmt *>(stmt.get());
+    fieldAssign->object = fold(fieldAssign->object);
+    fieldAssign->value = fold(fieldAssign->value);
+    return stmt;
+  }
+  case NodeKind::BLOCK: {
+    auto *block = static_cast<BlockStmt *>(stmt.get());
+    _scopes.emplace_back();
+    std::vector<StmtPtr> statements;
+    statements.reserve(block->statements.size());
+    for (auto &s : block->statements) {
+      StmtPtr optimized = optimizeStatement(s, true);
+      if (optimized) {
+        statements.push_back(optimized);
+        if (endsFlow(*optimized)) {
+          break; // the rest of the block is unreachable
+        }
+      }
+    }
+    _scopes.pop_back();
+    block->statements = std::move(statements);
+    return stmt;
+  }
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt.get());
+    ifStmt->condition = fold(ifStmt->condition);
+    if (isLiteral(ifStmt->condition) &&
+        !isBareDeclaration(ifStmt->thenBranch) &&
+        !isBareDeclaration(ifStmt->elseBranch)) {
+      return ValueHelper::toBool(literalValue(ifStmt->condition))
+                 ? optimizeStatement(ifStmt->thenBranch)
+                 : optimizeStatement(ifStmt->elseBranch);
+    }
+    ifStmt->thenBranch = optimizeBody(ifStmt->thenBranch);
+    if (ifStmt->elseBranch) {
+      ifStmt->elseBranch = optimizeStatement(ifStmt->elseBranch);
+    }
+    return stmt;
+  }
+  case NodeKind::WHILE: {
+    auto *whileStmt = static_cast<WhileStmt *>(stmt.get());
+    whileStmt->condition = fold(whileStmt->condition);
+    if (isLiteral(whileStmt->condition) &&
+        !ValueHelper::toBool(literalValue(whileStmt->condition)) &&
+        !isBareDeclaration(whileStmt->body)) {
+      return nullptr;
+    }
+    whileStmt->body = optimizeBody(whileStmt->body);
+    return stmt;
+  }
+  case NodeKind::FOR: {
+    // A loop that never runs still runs its initializer, in its own scope
+    auto *forStmt = static_cast<ForStmt *>(stmt.get());
+    _scopes.emplace_back();
+    forStmt->initializer = optimizeStatement(forStmt->initializer);
+    forStmt->condition = fold(forStmt->condition);
+    StmtPtr result = stmt;
+    if (isLiteral(forStmt->condition) &&
+        !ValueHelper::toBool(literalValue(forStmt->condition)) &&
+        !isBareDeclaration(forStmt->body)) {
+      result = nullptr;
+      if (forStmt->initializer) {
+        result = std::make_shared<BlockStmt>(
+            std::vector<StmtPtr>{forStmt->initializer}, forStmt->line,
+            forStmt->column);
+      }
+    } else {
+      forStmt->body = optimizeBody(forStmt->body);
+      forStmt->increment = optimizeStatement(forStmt->increment);
+    }
+    _scopes.pop_back();
+    return result;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *doWhile = static_cast<DoWhileStmt *>(stmt.get());
+    doWhile->body = optimizeBody(doWhile->body);
+    doWhile->condition = fold(doWhile->condition);
+    return stmt;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt.get());
+    switchStmt->expression = fold(switchStmt->expression);
+    for (auto &caseEntry : switchStmt->cases) {
+      caseEntry.matchExpr = fold(caseEntry.matchExpr);
+      for (auto &s : caseEntry.statements) {
+        s = optimizeBody(s);
+      }
+    }
+    return stmt;
+  }
+  case NodeKind::RETURN: {
+    auto *ret = static_cast<ReturnStmt *>(stmt.get());
+    ret->value = fold(ret->value);
+    return stmt;
+  }
+  case NodeKind::BREAK:
+  case NodeKind::CONTINUE:
+    return stmt;
+  default:
+    throw std::runtime_error("Unknown statement type");
+  }
+}
+
+ExprPtr Optimizer::fold(const ExprPtr &expr) {
+  if (!expr) {
+    return expr;
+  }
+
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+    return expr;
+  case NodeKind::VARIABLE: {
+    auto *var = static_cast<VariableExpr *>(expr.get());
+    const VarDeclStmt *decl = lookup(var->name);
+    auto constant = decl ? _constants.find(decl) : _constants.end();
+    if (constant != _constants.end()) {
+      return makeLiteral(constant->second->value, *var);
+    }
+    return expr;
+  }
+  case NodeKind::BINARY:
+    return foldBinary(static_cast<BinaryExpr *>(expr.get()), expr);
+  case NodeKind::UNARY:
+    return foldUnary(static_cast<UnaryExpr *>(expr.get()), expr);
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr.get());
+    cond->condition = fold(cond->condition);
+    cond->thenExpr = fold(cond->thenExpr);
+    cond->elseExpr = fold(cond->elseExpr);
+    if (isLiteral(cond->condition)) {
+      return ValueHelper::toBool(literalValue(cond->condition))
+                 ? cond->thenExpr
+                 : cond->elseExpr;
+    }
+    return expr;
+  }
+  case NodeKind::CALL:
+    for (auto &arg : static_cast<CallExpr *>(expr.get())->arguments) {
+      arg = fold(arg);
+    }
+    return expr;
+  case NodeKind::ARRAY_LITERAL:
+    for (auto &e : static_cast<ArrayLiteralExpr *>(expr.get())->elements) {
+      e = fold(e);
+    }
+    return expr;
+  case NodeKind::INDEX: {
+    auto *idx = static_cast<IndexExpr *>(expr.get());
+    idx->arrayExpr = fold(idx->arrayExpr);
+    idx->indexExpr = fold(idx->indexExpr);
+    return expr;
+  }
+  case NodeKind::FIELD: {
+    auto *field = static_cast<FieldExpr *>(expr.get());
+    field->object = fold(field->object);
+    return expr;
+  }
+  case NodeKind::RECORD:
+    for (auto &e : static_cast<RecordExpr *>(expr.get())->fields) {
+      e = fold(e);
+    }
+    return expr;
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+}
+
+ExprPtr Optimizer::foldBinary(BinaryExpr *expr, const ExprPtr &original) {
+  expr->left = fold(expr->left);
+  expr->right = fold(expr->right);
+
+  // && and || skip their right operand, so a literal left one decides
+  // them on its own when it short-circuits
+  if (isLiteral(expr->left)) {
+    bool left = ValueHelper::toBool(literalValue(expr->left));
+    if (expr->op == BinaryExpr::Operator::LOGICAL_AND && !left) {
+      return makeLiteral(false, *expr);
+    }
+    if (expr->op == BinaryExpr::Operator::LOGICAL_OR && left) {
+      return makeLiteral(true, *expr);
+    }
+  }
+
+  if (!isLiteral(expr->left) || !isLiteral(expr->right)) {
+    return original;
+  }
+  try {
+    return makeLiteral(BinaryExpr::apply(expr->op, literalValue(expr->left),
+                                         literalValue(expr->right)),
+                       *expr);
+  } catch (const std::runtime_error &) {
+    return original; // fails the same way when it runs
+  }
+}
+
+ExprPtr Optimizer::foldUnary(UnaryExpr *expr, const ExprPtr &original) {
+  expr->operand = fold(expr->operand);
+  if (!isLiteral(expr->operand)) {
+    return original;
+  }
+
+  const Value &operand = literalValue(expr->operand);
+  try {
+    switch (expr->op) {
+    case UnaryExpr::Operator::NEGATE:
+      return makeLiteral(ValueHelper::negate(operand), *expr);
+    case UnaryExpr::Operator::LOGICAL_NOT:
+      return makeLiteral(ValueHelper::logicalNot(operand), *expr);
+    case UnaryExpr::Operator::BIT_NOT:
+      return makeLiteral(ValueHelper::bitNot(operand), *expr);
+    }
+  } catch (const std::runtime_error &) {
+  }
+  return original;
+}
+
+} // namespace Script
@@ -12,6 +12,11 @@ ScriptPtr Parser::parse() {
 
   while (!isAtEnd()) {
     try {
+      if (checkStructKeyword()) {
+        advance();
+        script->structs.push_back(structDeclaration());
+        continue;
+      }
       auto proc = procedureDeclaration();
       if (proc) {
         script->procedures.push_back(proc);
@@ -100,6 +105,9 @@ void Parser::synchronize() {
     case TokenType::VOID:
       return;
     default:
+      if (checkMapOrBuilderType() || checkStructKeyword()) {
+        return;
+      }
       break;
     }
 
@@ -107,6 +115,68 @@ void Parser::synchronize() {
   }
 }
 
+bool Parser::checkStructDeclaration() const {
+  if (!check(TokenType::IDENTIFIER) ||
+      _structs.find(peek().lexeme) == _structs.end()) {
+    return false;
+  }
+  TokenType next = _tokens[_current + 1].type;
+  return next == TokenType::IDENTIFIER || next == TokenType::LBRACKET;
+}
+
+bool Parser::checkWord(const char *word) const {
+  return check(TokenType::IDENTIFIER) && peek().lexeme == word &&
+         _structs.find(word) == _structs.end();
+}
+
+bool Parser::checkMapOrBuilderType() const {
+  if (checkWord("map")) {
+    return _tokens[_current + 1].type == TokenType::LESS_THAN;
+  }
+  if (checkWord("stringbuilder")) {
+    TokenType next = _tokens[_current + 1].type;
+    return next == TokenType::IDENTIFIER ||
+           (next == TokenType::LBRACKET &&
+            _tokens[_current + 2].type == TokenType::RBRACKET);
+  }
+  return false;
+}
+
+bool Parser::checkStructKeyword() const {
+  return checkWord("struct") &&
+         _tokens[_current + 1].type == TokenType::IDENTIFIER;
+}
+
+std::shared_ptr<const StructType> Parser::structDeclaration() {
+  Token name = consume(TokenType::IDENTIFIER, "Expected struct name");
+  if (_structs.count(name.lexeme)) {
+    throw error("Duplicate struct name: " + name.lexeme);
+  }
+  consume(TokenType::LBRACE, "Expected '{' after struct name");
+
+  auto type = std::make_shared<StructType>();
+  type->name = name.lexeme;
+  while (!check(TokenType::RBRACE) && !isAtEnd()) {
+    TypeInfo fieldType = parseType();
+    if (fieldType.baseType == DataType::VOID && !fieldType.isArray) {
+      throw error("Struct fields cannot be void");
+    }
+    Token field = consume(TokenType::IDENTIFIER, "Expected field name");
+    if (type->fieldIndex(field.lexeme) >= 0) {
+      throw error("Duplicate field " + field.lexeme + " in struct " +
+                  name.lexeme);
+    }
+    consume(TokenType::SEMICOLON, "Expected ';' after field");
+    type->fieldNames.push_back(field.lexeme);
+    type->fieldTypes.push_back(fieldType);
+  }
+  consume(TokenType::RBRACE, "Expected '}' after struct fields");
+  match({TokenType::SEMICOLON});
+
+  _structs[name.lexeme] = type;
+  return type;
+}
+
 ProcedureDeclPtr Parser::procedureDeclaration() {
   int line = peek().line;
   int column = peek().column;
@@ -144,6 +214,47 @@ std::vector<Parameter> Parser::parameters() {
 }
 
 TypeInfo Parser::parseType() {
+  if (checkWord("map")) {
+    advance();
+    consume(TokenType::LESS_THAN, "Expected '<' after 'map'");
+    TypeInfo key = parseType();
+    consume(TokenType::COMMA, "Expected ',' after map key type");
+    TypeInfo value = parseType();
+    consume(TokenType::GREATER_THAN, "Expected '>' after map value type");
+    auto scalar = [](const TypeInfo &type) {
+      return !type.isArray && type.baseType < DataType::VOID;
+    };
+    if (!scalar(key) || !scalar(value)) {
+      throw error("Map keys and values must be scalars");
+    }
+    if (check(TokenType::LBRACKET)) {
+      throw error("Arrays of maps are not supported");
+    }
+    return TypeInfo::map(key.baseType, value.baseType);
+  }
+
+  if (checkWord("stringbuilder")) {
+    advance();
+    if (check(TokenType::LBRACKET)) {
+      throw error("Arrays of string builders are not supported");
+    }
+    return TypeInfo(DataType::STRING_BUILDER);
+  }
+
+  if (check(TokenType::IDENTIFIER)) {
+    auto it = _structs.find(peek().lexeme);
+    if (it == _structs.end()) {
+      throw error("Unknown type " + peek().lexeme);
+    }
+    advance();
+    bool isArray = false;
+    if (match({TokenType::LBRACKET})) {
+      consume(TokenType::RBRACKET, "Expected ']' after '[' in type");
+      isArray = true;
+    }
+    return TypeInfo::record(it->second, isArray);
+  }
+
   DataType base = DataType::VOID;
   if (match({TokenType::INT8}))
     base = DataType::INT8;
@@ -209,7 +320,8 @@ StmtPtr Parser::statement() {
       check(TokenType::INT32) || check(TokenType::UINT32) ||
       check(TokenType::INT64) || check(TokenType::UINT64) ||
       check(TokenType::DOUBLE) ||
-      check(TokenType::STRING) || check(TokenType::BOOL)) {
+      check(TokenType::STRING) || check(TokenType::BOOL) ||
+      checkMapOrBuilderType() || checkStructDeclaration()) {
     return varDeclaration();
   }
 
@@ -243,11 +355,16 @@ StmtPtr Parser::expressionStatement() {
   if (match({TokenType::ASSIGN})) {
     auto varExpr = std::dynamic_pointer_cast<VariableExpr>(expr);
     auto indexExpr = std::dynamic_pointer_cast<IndexExpr>(expr);
-    if (!varExpr && !indexExpr) {
+    auto fieldExpr = std::dynamic_pointer_cast<FieldExpr>(expr);
+    if (!varExpr && !indexExpr && !fieldExpr) {
       throw error("Invalid assignment target");
     }
     ExprPtr value = expression();
     consume(TokenType::SEMICOLON, "Expected ';' after expression");
+    if (fieldExpr) {
+      return std::make_shared<FieldAssignStmt>(
+          fieldExpr->object, fieldExpr->field, value, line, column);
+    }
     if (varExpr) {
       return std::make_shared<AssignStmt>(
           varExpr->name, value, AssignStmt::Operator::ASSIGN, line, column);
@@ -367,7 +484,8 @@ StmtPtr Parser::forStatement() {
              check(TokenType::INT32) || check(TokenType::UINT32) ||
              check(TokenType::INT64) || check(TokenType::UINT64) ||
              check(TokenType::DOUBLE) ||
-             check(TokenType::STRING) || check(TokenType::BOOL)) {
+             check(TokenType::STRING) || check(TokenType::BOOL) ||
+             checkMapOrBuilderType() || checkStructDeclaration()) {
     initializer = varDeclaration();
   } else {
     initializer = expressionStatement();
@@ -765,6 +883,11 @@ ExprPtr Parser::call() {
       expr = finishCall(expr);
     } else if (match({TokenType::LBRACKET})) {
       expr = finishIndex(expr);
+    } else if (match({TokenType::DOT})) {
+      Token field =
+          consume(TokenType::IDENTIFIER, "Expected field name after '.'");
+      expr = std::make_shared<FieldExpr>(expr, field.lexeme, field.line,
+                                         field.column);
     } else {
       break;
     }
@@ -791,6 +914,16 @@ ExprPtr Parser::finishCall(ExprPtr callee) {
 
   consume(TokenType::RPAREN, "Expected ')' after arguments");
 
+  auto record = _structs.find(varExpr->name);
+  if (record != _structs.end()) {
+    size_t fieldCount = record->second->fieldNames.size();
+    if (arguments.size() != fieldCount) {
+      throw error(varExpr->name + " expects " + std::to_string(fieldCount) +
+                  (fieldCount == 1 ? " field" : " fields"));
+    }
+    return std::make_shared<RecordExpr>(record->second, arguments, line,
+                                        column);
+  }
   return std::make_shared<CallExpr>(varExpr->name, arguments, line, column);
 }
 
@@ -0,0 +1,471 @@
+#include "Purity.h"
+#include "ArrayBuiltins.h"
+#include "Interpreter.h"
+#include "MapBuiltins.h"
+#include "StringBuilderBuiltins.h"
+
+namespace Script {
+
+namespace {
+
+bool isScalar(const TypeInfo &type) {
+  return !type.isArray && type.baseType < DataType::VOID;
+}
+
+bool isString(const TypeInfo &type) {
+  return !type.isArray && type.baseType == DataType::STRING;
+}
+
+// A literal operand known to keep / and % from failing, and to keep
+// INT_MIN / -1 from trapping
+bool isPositiveLiteral(const Expression &expr) {
+  if (expr.kind != NodeKind::LITERAL) {
+    return false;
+  }
+  const Value &value = static_cast<const LiteralExpr &>(expr).value;
+  if (!isScalar(ValueHelper::getType(value)) ||
+      std::holds_alternative<std::string>(value)) {
+    return false;
+  }
+  return ValueHelper::toDouble(value) > 0;
+}
+
+// A shift amount the hardware shifts by as written
+bool isShiftLiteral(const Expression &expr) {
+  if (expr.kind != NodeKind::LITERAL) {
+    return false;
+  }
+  const Value &value = static_cast<const LiteralExpr &>(expr).value;
+  if (!isScalar(ValueHelper::getType(value)) ||
+      std::holds_alternative<std::string>(value) ||
+      std::holds_alternative<double>(value)) {
+    return false;
+  }
+  int64_t amount = ValueHelper::toInt64(value);
+  return amount >= 0 && amount < 64;
+}
+
+// Builtins that change an argument in place
+bool writesArgument(const std::string &name) {
+  return name == "push" || name == "pop" || name == "put" ||
+         name == "remove" || name == "append";
+}
+
+// The local an array push, pop or index assignment changes, or -1 when it
+// changes something reached through a reference
+int32_t rootSlot(const Expression *target) {
+  while (target && target->kind == NodeKind::INDEX) {
+    target = static_cast<const IndexExpr *>(target)->arrayExpr.get();
+  }
+  if (target && target->kind == NodeKind::VARIABLE) {
+    return static_cast<const VariableExpr *>(target)->slot;
+  }
+  return -1;
+}
+
+} // namespace
+
+PurityModel::PurityModel(const Interpreter &interpreter, const Script &script)
+    : _interpreter(interpreter) {
+  for (const auto &proc : script.procedures) {
+    _scriptProcedures.insert(proc->name);
+  }
+}
+
+bool PurityModel::isProcedure(const std::string &name) const {
+  return _scriptProcedures.count(name) || _interpreter.hasProcedure(name);
+}
+
+bool PurityModel::isPureExternal(const std::string &name) const {
+  return !isProcedure(name) && _interpreter.isPureExternalFunction(name);
+}
+
+bool PurityModel::isPureCall(const CallExpr &call) const {
+  // Calls are looked up as the engines do: len, push and pop, then
+  // procedures, then externals, then the other builtins
+  const std::string &name = call.functionName;
+  if (name == "len") {
+    return true;
+  }
+  if (name == "push" || name == "pop" || isProcedure(name)) {
+    return false;
+  }
+  if (_interpreter.hasExternalFunction(name)) {
+    return _interpreter.isPureExternalFunction(name);
+  }
+  return (ArrayBuiltins::isBuiltin(name) || MapBuiltins::isBuiltin(name) ||
+          StringBuilderBuiltins::isBuiltin(name)) &&
+         !writesArgument(name);
+}
+
+bool PurityModel::isPure(const Expression &expr) const {
+  switch (expr.kind) {
+  case NodeKind::LITERAL:
+    return true;
+  case NodeKind::VARIABLE:
+    return static_cast<const VariableExpr &>(expr).slot >= 0;
+  case NodeKind::BINARY: {
+    auto &binary = static_cast<const BinaryExpr &>(expr);
+    return isPure(*binary.left) && isPure(*binary.right);
+  }
+  case NodeKind::UNARY:
+    return isPure(*static_cast<const UnaryExpr &>(expr).operand);
+  case NodeKind::CONDITIONAL: {
+    auto &cond = static_cast<const ConditionalExpr &>(expr);
+    return isPure(*cond.condition) && isPure(*cond.thenExpr) &&
+           isPure(*cond.elseExpr);
+  }
+  case NodeKind::INDEX: {
+    auto &index = static_cast<const IndexExpr &>(expr);
+    return isPure(*index.arrayExpr) && isPure(*index.indexExpr);
+  }
+  case NodeKind::FIELD:
+    return isPure(*static_cast<const FieldExpr &>(expr).object);
+  case NodeKind::CALL: {
+    auto &call = static_cast<const CallExpr &>(expr);
+    if (call.functionName != "len" && !isPureExternal(call.functionName)) {
+      return false;
+    }
+    for (const auto &arg : call.arguments) {
+      if (!isPure(*arg)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+bool PurityModel::isSafe(const Expression &expr) const {
+  switch (expr.kind) {
+  case NodeKind::LITERAL:
+    return true;
+  case NodeKind::VARIABLE:
+    return static_cast<const VariableExpr &>(expr).slot >= 0;
+  case NodeKind::BINARY: {
+    using Op = BinaryExpr::Operator;
+    auto &binary = static_cast<const BinaryExpr &>(expr);
+    const TypeInfo &left = binary.left->staticType;
+    const TypeInfo &right = binary.right->staticType;
+    if (!isScalar(expr.staticType) || !isScalar(left) || !isScalar(right) ||
+        !isSafe(*binary.left) || !isSafe(*binary.right)) {
+      return false;
+    }
+    // Strings only concatenate and compare with strings without converting
+    if (isString(left) || isString(right)) {
+      switch (binary.op) {
+      case Op::ADD:
+        return true;
+      case Op::EQUAL:
+      case Op::NOT_EQUAL:
+      case Op::LESS_THAN:
+      case Op::GREATER_THAN:
+      case Op::LESS_EQUAL:
+      case Op::GREATER_EQUAL:
+        return isString(left) && isString(right);
+      default:
+        return false;
+      }
+    }
+    switch (binary.op) {
+    case Op::DIVIDE:
+    case Op::MODULO:
+      return isPositiveLiteral(*binary.right);
+    case Op::LSHIFT:
+    case Op::RSHIFT:
+      return isShiftLiteral(*binary.right);
+    default:
+      return true;
+    }
+  }
+  case NodeKind::UNARY: {
+    auto &unary = static_cast<const UnaryExpr &>(expr);
+    const TypeInfo &operand = unary.operand->staticType;
+    return isScalar(expr.staticType) && isScalar(operand) &&
+           !isString(operand) && isSafe(*unary.operand);
+  }
+  case NodeKind::CONDITIONAL: {
+    auto &cond = static_cast<const ConditionalExpr &>(expr);
+    return isScalar(cond.condition->staticType) && isSafe(*cond.condition) &&
+           isSafe(*cond.thenExpr) && isSafe(*cond.elseExpr);
+  }
+  case NodeKind::FIELD: {
+    auto &field = static_cast<const FieldExpr &>(expr);
+    const TypeInfo &object = field.object->staticType;
+    return field.structType && field.index >= 0 && object.isRecord() &&
+           object.structType == field.structType && isSafe(*field.object);
+  }
+  case NodeKind::CALL: {
+    auto &call = static_cast<const CallExpr &>(expr);
+    if (call.functionName == "len") {
+      if (call.arguments.size() != 1) {
+        return false;
+      }
+      const TypeInfo &arg = call.arguments[0]->staticType;
+      return (arg.isArray || arg.isMap()) && isSafe(*call.arguments[0]);
+    }
+    return false;
+  }
+  default:
+    return false;
+  }
+}
+
+TypeInfo PurityModel::resultType(const Expression &expr) const {
+  if (expr.kind == NodeKind::CALL) {
+    const std::string &name = static_cast<const CallExpr &>(expr).functionName;
+    if (name == "len") {
+      return TypeInfo(DataType::INT32);
+    }
+    if (isPureExternal(name)) {
+      return _interpreter.pureExternalReturnType(name);
+    }
+  }
+  return expr.staticType;
+}
+
+void PurityModel::collectReads(const Expression &expr, Reads &reads) {
+  switch (expr.kind) {
+  case NodeKind::VARIABLE: {
+    int32_t slot = static_cast<const VariableExpr &>(expr).slot;
+    if (slot >= 0) {
+      reads.slots.insert(slot);
+    }
+    break;
+  }
+  case NodeKind::BINARY: {
+    auto &binary = static_cast<const BinaryExpr &>(expr);
+    collectReads(*binary.left, reads);
+    collectReads(*binary.right, reads);
+    break;
+  }
+  case NodeKind::UNARY:
+    collectReads(*static_cast<const UnaryExpr &>(expr).operand, reads);
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto &cond = static_cast<const ConditionalExpr &>(expr);
+    collectReads(*cond.condition, reads);
+    collectReads(*cond.thenExpr, reads);
+    collectReads(*cond.elseExpr, reads);
+    break;
+  }
+  case NodeKind::INDEX: {
+    // An element of a map changes with every local sharing the map, and
+    // one of an array with an external variable's array the local shares
+    auto &index = static_cast<const IndexExpr &>(expr);
+    reads.references = true;
+    collectReads(*index.arrayExpr, reads);
+    collectReads(*index.indexExpr, reads);
+    break;
+  }
+  case NodeKind::FIELD:
+    reads.references = true;
+    collectReads(*static_cast<const FieldExpr &>(expr).object, reads);
+    break;
+  case NodeKind::CALL: {
+    // Anything but a scalar may be a map, record or builder the call reads
+    // through, or an array shared with an external variable, which scripts
+    // change in place
+    auto &call = static_cast<const CallExpr &>(expr);
+    for (const auto &arg : call.arguments) {
+      if (!isScalar(arg->staticType)) {
+        reads.references = true;
+      }
+      collectReads(*arg, reads);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void PurityModel::collectWrites(const Expression *expr,
+                                Writes &writes) const {
+  if (!expr) {
+    return;
+  }
+  switch (expr->kind) {
+  case NodeKind::BINARY: {
+    auto *binary = static_cast<const BinaryExpr *>(expr);
+    collectWrites(binary->left.get(), writes);
+    collectWrites(binary->right.get(), writes);
+    break;
+  }
+  case NodeKind::UNARY:
+    collectWrites(static_cast<const UnaryExpr *>(expr)->operand.get(),
+                  writes);
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<const ConditionalExpr *>(expr);
+    collectWrites(cond->condition.get(), writes);
+    collectWrites(cond->thenExpr.get(), writes);
+    collectWrites(cond->elseExpr.get(), writes);
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL:
+    for (const auto &element :
+         static_cast<const ArrayLiteralExpr *>(expr)->elements) {
+      collectWrites(element.get(), writes);
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *index = static_cast<const IndexExpr *>(expr);
+    collectWrites(index->arrayExpr.get(), writes);
+    collectWrites(index->indexExpr.get(), writes);
+    break;
+  }
+  case NodeKind::FIELD:
+    collectWrites(static_cast<const FieldExpr *>(expr)->object.get(), writes);
+    break;
+  case NodeKind::RECORD:
+    for (const auto &field : static_cast<const RecordExpr *>(expr)->fields) {
+      collectWrites(field.get(), writes);
+    }
+    break;
+  case NodeKind::CALL: {
+    auto *call = static_cast<const CallExpr *>(expr);
+    for (const auto &arg : call->arguments) {
+      collectWrites(arg.get(), writes);
+    }
+    const std::string &name = call->functionName;
+    if ((name == "push" || name == "pop") && !call->arguments.empty()) {
+      int32_t slot = rootSlot(call->arguments[0].get());
+      if (slot >= 0) {
+        writes.slots.insert(slot);
+      } else {
+        writes.references = true;
+      }
+    } else if (!isPureCall(*call)) {
+      writes.references = true;
+    } else if (isPureExternal(name)) {
+      writes.pureExternals.insert(name);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void PurityModel::collectWrites(const Statement *stmt, Writes &writes) const {
+  if (!stmt) {
+    return;
+  }
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    collectWrites(static_cast<const ExpressionStmt *>(stmt)->expression.get(),
+                  writes);
+    break;
+  case NodeKind::VAR_DECL: {
+    auto *varDecl = static_cast<const VarDeclStmt *>(stmt);
+    collectWrites(varDecl->initializer.get(), writes);
+    writes.slots.insert(varDecl->slot);
+    break;
+  }
+  case NodeKind::ASSIGN: {
+    // An external variable's setter is host code and may change anything
+    auto *assign = static_cast<const AssignStmt *>(stmt);
+    collectWrites(assign->value.get(), writes);
+    if (assign->slot >= 0) {
+      writes.slots.insert(assign->slot);
+    } else {
+      writes.references = true;
+    }
+    break;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    // Arrays are copied on write, so only the local holding one changes;
+    // an element of a map changes every local sharing the map, and an
+    // external variable's array is changed in place
+    auto *assign = static_cast<const IndexAssignStmt *>(stmt);
+    collectWrites(assign->arrayExpr.get(), writes);
+    collectWrites(assign->indexExpr.get(), writes);
+    collectWrites(assign->value.get(), writes);
+    int32_t slot = rootSlot(assign->arrayExpr.get());
+    const Expression *root = assign->arrayExpr.get();
+    while (root->kind == NodeKind::INDEX) {
+      root = static_cast<const IndexExpr *>(root)->arrayExpr.get();
+    }
+    if (slot >= 0) {
+      writes.slots.insert(slot);
+    }
+    if (slot < 0 || !root->staticType.isArray) {
+      writes.references = true;
+    }
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *assign = static_cast<const FieldAssignStmt *>(stmt);
+    collectWrites(assign->object.get(), writes);
+    collectWrites(assign->value.get(), writes);
+    writes.references = true;
+    break;
+  }
+  case NodeKind::BLOCK:
+    for (const auto &statement :
+         static_cast<const BlockStmt *>(stmt)->statements) {
+      collectWrites(statement.get(), writes);
+    }
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<const IfStmt *>(stmt);
+    collectWrites(ifStmt->condition.get(), writes);
+    collectWrites(ifStmt->thenBranch.get(), writes);
+    collectWrites(ifStmt->elseBranch.get(), writes);
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *loop = static_cast<const WhileStmt *>(stmt);
+    collectWrites(loop->condition.get(), writes);
+    collectWrites(loop->body.get(), writes);
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *loop = static_cast<const ForStmt *>(stmt);
+    collectWrites(loop->initializer.get(), writes);
+    collectWrites(loop->condition.get(), writes);
+    collectWrites(loop->increment.get(), writes);
+    collectWrites(loop->body.get(), writes);
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *loop = static_cast<const DoWhileStmt *>(stmt);
+    collectWrites(loop->body.get(), writes);
+    collectWrites(loop->condition.get(), writes);
+    break;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<const SwitchStmt *>(stmt);
+    collectWrites(switchStmt->expression.get(), writes);
+    for (const auto &switchCase : switchStmt->cases) {
+      collectWrites(switchCase.matchExpr.get(), writes);
+      for (const auto &statement : switchCase.statements) {
+        collectWrites(statement.get(), writes);
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN:
+    collectWrites(static_cast<const ReturnStmt *>(stmt)->value.get(), writes);
+    break;
+  default:
+    break;
+  }
+}
+
+bool PurityModel::overlaps(const Reads &reads, const Writes &writes) {
+  if (reads.references && writes.references) {
+    return true;
+  }
+  for (int32_t slot : reads.slots) {
+    if (writes.slots.count(slot)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace Script
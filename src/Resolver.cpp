@@ -0,0 +1,296 @@
+#include "Resolver.h"
+#include "Parser.h"
+#include <stdexcept>
+
+namespace Script {
+
+void Resolver::resolve(Script &script) {
+  _returnTypes.clear();
+  for (auto &proc : script.procedures) {
+    _returnTypes[proc->name] = proc->returnType;
+  }
+  for (auto &proc : script.procedures) {
+    resolve(*proc);
+  }
+}
+
+void Resolver::resolve(ProcedureDecl &proc) {
+  _scopes.clear();
+  _nextSlot = 0;
+  _frameSize = 0;
+  _procedure = proc.name;
+
+  // Parameters live in the procedure's outermost scope; a repeated name
+  // refers to the last parameter declared with it
+  enterScope();
+  for (const auto &param : proc.parameters) {
+    int32_t slot = _nextSlot++;
+    _scopes.back().slots[param.name] = slot;
+    _scopes.back().types[param.name] = param.type;
+  }
+  if (static_cast<uint32_t>(_nextSlot) > _frameSize) {
+    _frameSize = static_cast<uint32_t>(_nextSlot);
+  }
+
+  resolveStatement(proc.body.get());
+  exitScope();
+
+  proc.frameSize = _frameSize;
+  proc.resolved = true;
+}
+
+void Resolver::enterScope() { _scopes.push_back(Scope{{}, {}, _nextSlot}); }
+
+void Resolver::exitScope() {
+  _nextSlot = _scopes.back().firstSlot;
+  _scopes.pop_back();
+}
+
+int32_t Resolver::declare(const std::string &name, const TypeInfo &type) {
+  // Redeclaring a name in the same scope overwrites the existing local
+  _scopes.back().types[name] = type;
+  auto &slots = _scopes.back().slots;
+  auto existing = slots.find(name);
+  if (existing != slots.end()) {
+    return existing->second;
+  }
+
+  int32_t slot = _nextSlot++;
+  if (static_cast<uint32_t>(_nextSlot) > _frameSize) {
+    _frameSize = static_cast<uint32_t>(_nextSlot);
+  }
+  slots[name] = slot;
+  return slot;
+}
+
+int32_t Resolver::lookup(const std::string &name) const {
+  for (auto it = _scopes.rbegin(); it != _scopes.rend(); ++it) {
+    auto found = it->slots.find(name);
+    if (found != it->slots.end()) {
+      return found->second;
+    }
+  }
+  return -1;
+}
+
+TypeInfo Resolver::staticType(Expression *expr) const {
+  switch (expr->kind) {
+  case NodeKind::VARIABLE: {
+    const std::string &name = static_cast<VariableExpr *>(expr)->name;
+    for (auto it = _scopes.rbegin(); it != _scopes.rend(); ++it) {
+      auto found = it->types.find(name);
+      if (found != it->types.end()) {
+        return found->second;
+      }
+    }
+    break;
+  }
+  case NodeKind::INDEX: {
+    auto *index = static_cast<IndexExpr *>(expr);
+    TypeInfo array = staticType(index->arrayExpr.get());
+    if (array.isArray) {
+      array.isArray = false;
+      return array;
+    }
+    break;
+  }
+  case NodeKind::FIELD: {
+    auto *field = static_cast<FieldExpr *>(expr);
+    if (field->structType) {
+      return field->structType->fieldTypes[field->index];
+    }
+    break;
+  }
+  case NodeKind::RECORD:
+    return TypeInfo::record(static_cast<RecordExpr *>(expr)->type);
+  case NodeKind::CALL: {
+    auto found = _returnTypes.find(static_cast<CallExpr *>(expr)->functionName);
+    if (found != _returnTypes.end()) {
+      return found->second;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return TypeInfo(DataType::VOID);
+}
+
+void Resolver::resolveField(Expression *object, const std::string &field,
+                            std::shared_ptr<const StructType> &structType,
+                            int32_t &index, const ASTNode &node) const {
+  TypeInfo type = staticType(object);
+  if (!type.isRecord()) {
+    return;
+  }
+  index = type.structType->fieldIndex(field);
+  if (index < 0) {
+    throw ParseError(type.structType->name + " has no field " + field +
+                         " at line " + std::to_string(node.line) +
+                         ", column " + std::to_string(node.column) +
+                         " in procedure '" + _procedure + "'",
+                     node.line, node.column, _procedure);
+  }
+  structType = type.structType;
+}
+
+void Resolver::resolveStatement(Statement *stmt) {
+  if (!stmt) {
+    return;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    resolveExpression(static_cast<ExpressionStmt *>(stmt)->expression.get());
+    break;
+  case NodeKind::VAR_DECL: {
+    // The initializer is resolved first so it still sees an outer variable
+    // of the same name
+    auto *varDecl = static_cast<VarDeclStmt *>(stmt);
+    resolveExpression(varDecl->initializer.get());
+    varDecl->slot = declare(varDecl->name, varDecl->type);
+    break;
+  }
+  case NodeKind::ASSIGN: {
+    auto *assign = static_cast<AssignStmt *>(stmt);
+    resolveExpression(assign->value.get());
+    assign->slot = lookup(assign->variableName);
+    break;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    auto *idxAssign = static_cast<IndexAssignStmt *>(stmt);
+    resolveExpression(idxAssign->arrayExpr.get());
+    resolveExpression(idxAssign->indexExpr.get());
+    resolveExpression(idxAssign->value.get());
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *fieldAssign = static_cast<FieldAssignStmt *>(stmt);
+    resolveExpression(fieldAssign->object.get());
+    resolveExpression(fieldAssign->value.get());
+    resolveField(fieldAssign->object.get(), fieldAssign->field,
+                 fieldAssign->structType, fieldAssign->index, *fieldAssign);
+    break;
+  }
+  case NodeKind::BLOCK:
+    enterScope();
+    for (auto &statement : static_cast<BlockStmt *>(stmt)->statements) {
+      resolveStatement(statement.get());
+    }
+    exitScope();
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    resolveExpression(ifStmt->condition.get());
+    resolveStatement(ifStmt->thenBranch.get());
+    resolveStatement(ifStmt->elseBranch.get());
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *whileStmt = static_cast<WhileStmt *>(stmt);
+    resolveExpression(whileStmt->condition.get());
+    resolveStatement(whileStmt->body.get());
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *forStmt = static_cast<ForStmt *>(stmt);
+    enterScope();
+    resolveStatement(forStmt->initializer.get());
+    resolveExpression(forStmt->condition.get());
+    resolveStatement(forStmt->body.get());
+    resolveStatement(forStmt->increment.get());
+    exitScope();
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *doWhile = static_cast<DoWhileStmt *>(stmt);
+    resolveStatement(doWhile->body.get());
+    resolveExpression(doWhile->condition.get());
+    break;
+  }
+  case NodeKind::SWITCH: {
+    // Case bodies share the enclosing scope
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt);
+    resolveExpression(switchStmt->expression.get());
+    for (auto &caseEntry : switchStmt->cases) {
+      resolveExpression(caseEntry.matchExpr.get());
+      for (auto &s : caseEntry.statements) {
+        resolveStatement(s.get());
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN:
+    resolveExpression(static_cast<ReturnStmt *>(stmt)->value.get());
+    break;
+  case NodeKind::BREAK:
+  case NodeKind::CONTINUE:
+    break;
+  default:
+    throw std::runtime_error("Unknown statement type");
+  }
+}
+
+void Resolver::resolveExpression(Expression *expr) {
+  if (!expr) {
+    return;
+  }
+
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+    break;
+  case NodeKind::VARIABLE: {
+    auto *var = static_cast<VariableExpr *>(expr);
+    var->slot = lookup(var->name);
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL:
+    for (auto &e : static_cast<ArrayLiteralExpr *>(expr)->elements) {
+      resolveExpression(e.get());
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    resolveExpression(idx->arrayExpr.get());
+    resolveExpression(idx->indexExpr.get());
+    break;
+  }
+  case NodeKind::FIELD: {
+    auto *field = static_cast<FieldExpr *>(expr);
+    resolveExpression(field->object.get());
+    resolveField(field->object.get(), field->field, field->structType,
+                 field->index, *field);
+    break;
+  }
+  case NodeKind::RECORD:
+    for (auto &e : static_cast<RecordExpr *>(expr)->fields) {
+      resolveExpression(e.get());
+    }
+    break;
+  case NodeKind::BINARY: {
+    auto *bin = static_cast<BinaryExpr *>(expr);
+    resolveExpression(bin->left.get());
+    resolveExpression(bin->right.get());
+    break;
+  }
+  case NodeKind::UNARY:
+    resolveExpression(static_cast<UnaryExpr *>(expr)->operand.get());
+    break;
+  case NodeKind::CALL:
+    for (auto &arg : static_cast<CallExpr *>(expr)->arguments) {
+      resolveExpression(arg.get());
+    }
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr);
+    resolveExpression(cond->condition.get());
+    resolveExpression(cond->thenExpr.get());
+    resolveExpression(cond->elseExpr.get());
+    break;
+  }
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+}
+
+} // namespace Script
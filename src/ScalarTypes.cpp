@@ -0,0 +1,136 @@
+#include "ScalarTypes.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace Script {
+
+bool ScalarTypes::isSupported(const TypeInfo &type) {
+  switch (type.isArray ? DataType::VOID : type.baseType) {
+  case DataType::INT32:
+  case DataType::INT64:
+  case DataType::DOUBLE:
+  case DataType::BOOL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+DataType ScalarTypes::binaryResult(BinaryExpr::Operator op, DataType left,
+                                   DataType right) {
+  bool anyDouble = left == DataType::DOUBLE || right == DataType::DOUBLE;
+  bool anyBool = left == DataType::BOOL || right == DataType::BOOL;
+
+  switch (op) {
+  case BinaryExpr::Operator::ADD:
+  case BinaryExpr::Operator::SUBTRACT:
+  case BinaryExpr::Operator::MULTIPLY:
+  case BinaryExpr::Operator::DIVIDE:
+  case BinaryExpr::Operator::MODULO:
+    if (anyBool) {
+      return DataType::VOID;
+    }
+    if (anyDouble) {
+      return op == BinaryExpr::Operator::MODULO ? DataType::VOID
+                                                : DataType::DOUBLE;
+    }
+    return left == DataType::INT32 && right == DataType::INT32
+               ? DataType::INT32
+               : DataType::INT64;
+
+  case BinaryExpr::Operator::EQUAL:
+  case BinaryExpr::Operator::NOT_EQUAL:
+  case BinaryExpr::Operator::LESS_THAN:
+  case BinaryExpr::Operator::GREATER_THAN:
+  case BinaryExpr::Operator::LESS_EQUAL:
+  case BinaryExpr::Operator::GREATER_EQUAL:
+  case BinaryExpr::Operator::LOGICAL_AND:
+  case BinaryExpr::Operator::LOGICAL_OR:
+    return DataType::BOOL;
+
+  case BinaryExpr::Operator::BIT_AND:
+  case BinaryExpr::Operator::BIT_OR:
+  case BinaryExpr::Operator::BIT_XOR:
+  case BinaryExpr::Operator::LSHIFT:
+  case BinaryExpr::Operator::RSHIFT:
+    return anyDouble || anyBool ? DataType::VOID : DataType::INT64;
+  }
+  return DataType::VOID;
+}
+
+DataType ScalarTypes::unaryResult(UnaryExpr::Operator op, DataType operand) {
+  switch (op) {
+  case UnaryExpr::Operator::NEGATE:
+    // The interpreter negates every non-double into an int32
+    return operand == DataType::DOUBLE ? DataType::DOUBLE : DataType::INT32;
+  case UnaryExpr::Operator::LOGICAL_NOT:
+    return DataType::BOOL;
+  case UnaryExpr::Operator::BIT_NOT:
+    return operand == DataType::INT32 || operand == DataType::INT64
+               ? DataType::INT64
+               : DataType::VOID;
+  }
+  return DataType::VOID;
+}
+
+DataType ScalarTypes::literalType(const Value &value) {
+  if (std::holds_alternative<int32_t>(value)) {
+    return DataType::INT32;
+  }
+  if (std::holds_alternative<int64_t>(value)) {
+    return DataType::INT64;
+  }
+  if (std::holds_alternative<double>(value)) {
+    return DataType::DOUBLE;
+  }
+  if (std::holds_alternative<bool>(value)) {
+    return DataType::BOOL;
+  }
+  return DataType::VOID;
+}
+
+uint64_t ScalarTypes::toCell(const Value &value, DataType type) {
+  if (ValueHelper::isArray(value)) {
+    throw std::runtime_error("Cannot convert array to scalar type");
+  }
+
+  switch (type) {
+  case DataType::INT32:
+    return static_cast<uint64_t>(static_cast<int64_t>(
+        static_cast<int32_t>(ValueHelper::toInt64(value))));
+  case DataType::INT64:
+    return static_cast<uint64_t>(ValueHelper::toInt64(value));
+  case DataType::DOUBLE: {
+    double d = ValueHelper::toDouble(value);
+    uint64_t cell;
+    std::memcpy(&cell, &d, sizeof(cell));
+    return cell;
+  }
+  case DataType::BOOL:
+    return ValueHelper::toBool(value) ? 1 : 0;
+  default:
+    break;
+  }
+  throw std::runtime_error("Unsupported native type");
+}
+
+Value ScalarTypes::fromCell(uint64_t cell, DataType type) {
+  switch (type) {
+  case DataType::INT32:
+    return static_cast<int32_t>(cell);
+  case DataType::INT64:
+    return static_cast<int64_t>(cell);
+  case DataType::DOUBLE: {
+    double d;
+    std::memcpy(&d, &cell, sizeof(d));
+    return d;
+  }
+  case DataType::BOOL:
+    return cell != 0;
+  default:
+    break;
+  }
+  return static_cast<int32_t>(0); // Dummy value for void procedures
+}
+
+} // namespace Script
@@ -1,5 +1,10 @@
 #include "ScriptManager.h"
+#include "AstCloner.h"
+#include "NativeModule.h"
+#include "ScalarTypes.h"
+#include <cstdlib>
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <utility>
 
@@ -15,7 +20,26 @@ std::string CompilationError::toString() const {
 }
 
 ScriptManager::ScriptManager()
-    : _interpreter(std::make_unique<Interpreter>()) {}
+    : _interpreter(std::make_unique<Interpreter>()) {
+  if (const char *engine = std::getenv("CXXSCRIPT_ENGINE")) {
+    std::string name(engine);
+    if (name == "bytecode") {
+      _interpreter->setExecutionEngine(ExecutionEngine::BYTECODE);
+    } else if (name == "closure") {
+      _interpreter->setExecutionEngine(ExecutionEngine::CLOSURE);
+    } else if (name == "tree") {
+      _interpreter->setExecutionEngine(ExecutionEngine::TREE_WALKER);
+    }
+  }
+  if (const char *jit = std::getenv("CXXSCRIPT_JIT")) {
+    _interpreter->setJitEnabled(std::string(jit) == "1");
+  }
+  if (const char *dump = std::getenv("CXXSCRIPT_DUMP_AST")) {
+    if (std::string(dump) == "1") {
+      _astDump = &std::cerr;
+    }
+  }
+}
 
 ScriptManager::~ScriptManager() = default;
 
@@ -133,6 +157,62 @@ bool ScriptManager::compileScript(const std::string &source,
       return false;
     }
 
+    // Assign frame slots to parameters and locals
+    try {
+      Resolver resolver;
+      resolver.resolve(*script);
+    } catch (const ParseError &e) {
+      errors.push_back(CompilationError(e.what(), filename, e.procedureName,
+                                        e.line, e.column));
+      return false;
+    }
+
+    // Fold constants and drop unreachable code; the Resolver has already
+    // reported errors in code this removes
+    if (_optimize) {
+      Optimizer optimizer;
+      optimizer.optimize(*script);
+    }
+
+    // Infer static types, which let the engines skip conversions
+    TypeChecker checker;
+    checker.check(*script);
+    if (_strictTypes && !checker.errors().empty()) {
+      for (const auto &te : checker.errors()) {
+        errors.push_back(CompilationError(te.what(), filename, te.procedureName,
+                                          te.line, te.column));
+      }
+      return false;
+    }
+
+    // Share repeated expressions and move invariant ones out of loops,
+    // which needs the types. Procedures that call pure externals keep
+    // their body as it was, in case those stop being pure.
+    if (_optimize) {
+      PurityModel purity(*_interpreter, *script);
+      SubexpressionEliminator subexpressions(purity);
+      LoopOptimizer loops(purity);
+      for (auto &proc : script->procedures) {
+        if (proc->native) {
+          continue;
+        }
+        PurityModel::Writes writes;
+        purity.collectWrites(proc->body.get(), writes);
+        if (!writes.pureExternals.empty()) {
+          proc->generalBody = AstCloner::clone(proc->body);
+          for (const auto &name : writes.pureExternals) {
+            proc->pureExternals.emplace_back(
+                name, _interpreter->pureExternalReturnType(name));
+          }
+        }
+        subexpressions.optimize(*proc);
+        loops.optimize(*proc);
+      }
+    }
+    if (_astDump) {
+      *_astDump << "// " << filename << "\n" << AstPrinter::print(*script);
+    }
+
     // Load into interpreter if requested
     if (load) {
       _interpreter->loadScript(script);
@@ -151,6 +231,80 @@ bool ScriptManager::compileScript(const std::string &source,
   }
 }
 
+bool ScriptManager::loadNativeModule(const std::string &path,
+                                     std::vector<CompilationError> &errors) {
+  errors.clear();
+
+  NativeModulePtr module;
+  try {
+    module = NativeModule::open(path);
+  } catch (const std::exception &e) {
+    errors.push_back(CompilationError(e.what(), path, "", 0, 0));
+    return false;
+  }
+
+  // Give each native procedure a declaration with an empty body so it is
+  // listed, described and called like any other procedure
+  auto script = std::make_shared<Script>(path);
+  const CxxScriptNativeModule &descriptor = module->descriptor();
+  for (uint32_t i = 0; i < descriptor.procedureCount; ++i) {
+    const CxxScriptNativeProcedure &native = descriptor.procedures[i];
+    std::string name = native.name;
+
+    TypeInfo returnType(static_cast<DataType>(native.returnType));
+    bool supported = returnType.baseType == DataType::VOID ||
+                     ScalarTypes::isSupported(returnType);
+    std::vector<Parameter> parameters;
+    for (uint32_t p = 0; p < native.parameterCount; ++p) {
+      TypeInfo type(static_cast<DataType>(native.parameterTypes[p]));
+      supported = supported && ScalarTypes::isSupported(type);
+      parameters.push_back(Parameter{type, "arg" + std::to_string(p)});
+    }
+    if (!supported) {
+      errors.push_back(CompilationError("Unsupported native procedure type",
+                                        path, name, native.line,
+                                        native.column));
+      continue;
+    }
+
+    if (auto existing = _interpreter->getProcedure(name)) {
+      bool matches = existing->returnType == returnType &&
+                     existing->parameters.size() == parameters.size();
+      for (size_t p = 0; matches && p < parameters.size(); ++p) {
+        matches = existing->parameters[p].type == parameters[p].type;
+      }
+      if (!matches) {
+        errors.push_back(CompilationError(
+            "Native procedure signature does not match loaded procedure: " +
+                name,
+            path, name, native.line, native.column));
+        continue;
+      }
+      parameters = existing->parameters; // keep the script's names
+    }
+
+    auto proc = std::make_shared<ProcedureDecl>(
+        returnType, name, parameters,
+        std::make_shared<BlockStmt>(std::vector<StmtPtr>{}), native.line,
+        native.column);
+    proc->frameSize = static_cast<uint32_t>(parameters.size());
+    proc->resolved = true;
+    proc->native = std::make_shared<NativeProcedure>(
+        NativeProcedure{module, &native});
+    script->procedures.push_back(proc);
+  }
+
+  if (!errors.empty()) {
+    return false;
+  }
+
+  _interpreter->loadScript(script);
+  for (const auto &proc : script->procedures) {
+    _procedureFiles[proc->name] = path;
+  }
+  return true;
+}
+
 bool ScriptManager::executeProcedure(const std::string &procedureName,
                                      const std::vector<Value> &arguments,
                                      Value &returnValue,
@@ -205,8 +359,9 @@ bool ScriptManager::getProcedureInfo(const std::string &name,
 }
 
 void ScriptManager::registerExternalFunction(
-    const std::string &name, ExternalFunctionCallback callback) {
-  _interpreter->registerExternalFunction(name, callback);
+    const std::string &name, ExternalFunctionCallback callback, bool pure,
+    const TypeInfo &returnType) {
+  _interpreter->registerExternalFunction(name, callback, pure, returnType);
 }
 
 void ScriptManager::registerExternalFunctions(
@@ -247,8 +402,64 @@ bool ScriptManager::hasExternalVariable(const std::string &name) const {
   return _interpreter->hasExternalVariable(name);
 }
 
+void ScriptManager::setExecutionEngine(ExecutionEngine engine) {
+  _interpreter->setExecutionEngine(engine);
+}
+
+ExecutionEngine ScriptManager::getExecutionEngine() const {
+  return _interpreter->getExecutionEngine();
+}
+
+void ScriptManager::setJitEnabled(bool enabled) {
+  _interpreter->setJitEnabled(enabled);
+}
+
+bool ScriptManager::isJitEnabled() const {
+  return _interpreter->isJitEnabled();
+}
+
+void ScriptManager::setSuperoperatorsEnabled(bool enabled) {
+  _interpreter->setSuperoperatorsEnabled(enabled);
+}
+
+bool ScriptManager::areSuperoperatorsEnabled() const {
+  return _interpreter->areSuperoperatorsEnabled();
+}
+
+void ScriptManager::setInliningEnabled(bool enabled) {
+  _interpreter->setInliningEnabled(enabled);
+}
+
+bool ScriptManager::isInliningEnabled() const {
+  return _interpreter->isInliningEnabled();
+}
+
+void ScriptManager::setStrictTypes(bool enabled) { _strictTypes = enabled; }
+
+bool ScriptManager::areStrictTypesEnabled() const { return _strictTypes; }
+
+void ScriptManager::setOptimizationsEnabled(bool enabled) {
+  _optimize = enabled;
+}
+
+bool ScriptManager::areOptimizationsEnabled() const { return _optimize; }
+
+void ScriptManager::setAstDump(std::ostream *out) { _astDump = out; }
+
+std::string ScriptManager::getSuperoperatorReport() const {
+  return _interpreter->superoperatorReport();
+}
+
 void ScriptManager::clear() {
+  ExecutionEngine engine = _interpreter->getExecutionEngine();
+  bool jitEnabled = _interpreter->isJitEnabled();
+  bool superoperators = _interpreter->areSuperoperatorsEnabled();
+  bool inlining = _interpreter->isInliningEnabled();
   _interpreter = std::make_unique<Interpreter>();
+  _interpreter->setExecutionEngine(engine);
+  _interpreter->setJitEnabled(jitEnabled);
+  _interpreter->setSuperoperatorsEnabled(superoperators);
+  _interpreter->setInliningEnabled(inlining);
   _procedureFiles.clear();
 }
 
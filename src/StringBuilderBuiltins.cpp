@@ -0,0 +1,63 @@
+#include "StringBuilderBuiltins.h"
+#include <stdexcept>
+
+namespace Script {
+
+namespace {
+
+StringBuilderValue &builderArgument(const char *name,
+                                    const BuiltinArguments &args) {
+  const StringBuilderPtr *builder =
+      args.empty() ? nullptr : std::get_if<StringBuilderPtr>(&args[0]);
+  if (!builder || !*builder) {
+    throw std::runtime_error(std::string(name) +
+                             " expects a stringbuilder as first argument");
+  }
+  return **builder;
+}
+
+Value appendBuiltin(const BuiltinArguments &args) {
+  StringBuilderValue &builder = builderArgument("append", args);
+  if (args.size() < 2) {
+    throw std::runtime_error("append expects at least 2 arguments");
+  }
+  for (size_t i = 1; i < args.size(); ++i) {
+    builder.append(args[i]);
+  }
+  return ValueHelper::createValue(DataType::INT32,
+                                  static_cast<int64_t>(builder.size()));
+}
+
+Value buildBuiltin(const BuiltinArguments &args) {
+  if (args.size() != 1) {
+    throw std::runtime_error("build expects 1 argument");
+  }
+  return builderArgument("build", args).contents();
+}
+
+} // namespace
+
+bool StringBuilderBuiltins::isBuiltin(const std::string &name) {
+  return find(name) != nullptr;
+}
+
+BuiltinFunction StringBuilderBuiltins::find(const std::string &name) {
+  if (name == "append") {
+    return appendBuiltin;
+  }
+  if (name == "build") {
+    return buildBuiltin;
+  }
+  return nullptr;
+}
+
+Value StringBuilderBuiltins::call(const std::string &name,
+                                  const std::vector<Value> &args) {
+  BuiltinFunction builtin = find(name);
+  if (!builtin) {
+    throw std::runtime_error("Undefined function: " + name);
+  }
+  return builtin(BuiltinArguments(args));
+}
+
+} // namespace Script
@@ -0,0 +1,428 @@
+#include "SubexpressionEliminator.h"
+#include <iomanip>
+#include <sstream>
+
+namespace Script {
+
+namespace {
+
+// The expression a statement evaluates before anything else it runs
+ExprPtr *headOf(Statement *stmt) {
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    return &static_cast<ExpressionStmt *>(stmt)->expression;
+  case NodeKind::VAR_DECL:
+    return &static_cast<VarDeclStmt *>(stmt)->initializer;
+  case NodeKind::ASSIGN:
+    return &static_cast<AssignStmt *>(stmt)->value;
+  case NodeKind::IF:
+    return &static_cast<IfStmt *>(stmt)->condition;
+  case NodeKind::SWITCH:
+    return &static_cast<SwitchStmt *>(stmt)->expression;
+  case NodeKind::RETURN:
+    return &static_cast<ReturnStmt *>(stmt)->value;
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace
+
+void SubexpressionEliminator::optimize(Script &script) {
+  for (auto &proc : script.procedures) {
+    if (!proc->native) {
+      optimize(*proc);
+    }
+  }
+}
+
+void SubexpressionEliminator::optimize(ProcedureDecl &proc) {
+  _procedure = &proc;
+  visitStatement(proc.body.get());
+  _procedure = nullptr;
+}
+
+void SubexpressionEliminator::visitStatement(Statement *stmt) {
+  if (!stmt) {
+    return;
+  }
+
+  // Blocks are done before the blocks inside them, so copies in a branch
+  // can share a local with copies before it
+  switch (stmt->kind) {
+  case NodeKind::BLOCK: {
+    auto *block = static_cast<BlockStmt *>(stmt);
+    while (shareOne(*block)) {
+    }
+    for (auto &statement : block->statements) {
+      visitStatement(statement.get());
+    }
+    break;
+  }
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    visitStatement(ifStmt->thenBranch.get());
+    visitStatement(ifStmt->elseBranch.get());
+    break;
+  }
+  case NodeKind::WHILE:
+    visitStatement(static_cast<WhileStmt *>(stmt)->body.get());
+    break;
+  case NodeKind::FOR:
+    visitStatement(static_cast<ForStmt *>(stmt)->body.get());
+    break;
+  case NodeKind::DO_WHILE:
+    visitStatement(static_cast<DoWhileStmt *>(stmt)->body.get());
+    break;
+  case NodeKind::SWITCH:
+    for (auto &switchCase : static_cast<SwitchStmt *>(stmt)->cases) {
+      for (auto &statement : switchCase.statements) {
+        visitStatement(statement.get());
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+bool SubexpressionEliminator::shareOne(BlockStmt &block) {
+  _candidates.clear();
+  _candidateIndex.clear();
+  for (size_t i = 0; i < block.statements.size(); ++i) {
+    collectStatement(block.statements[i].get(), i, false);
+  }
+
+  // The largest expression with copies to share, then the earliest
+  const Candidate *best = nullptr;
+  std::vector<Occurrence> bestGroup;
+  for (const auto &candidate : _candidates) {
+    if (best && candidate.size <= best->size) {
+      continue;
+    }
+    for (size_t first = 0; first + 1 < candidate.occurrences.size();
+         ++first) {
+      auto group = shareable(block, candidate.occurrences, first);
+      if (group.size() >= 2) {
+        best = &candidate;
+        bestGroup = std::move(group);
+        break;
+      }
+    }
+  }
+  if (!best) {
+    return false;
+  }
+
+  const ExprPtr &expr = *bestGroup[0].site;
+  TypeInfo type = _purity.resultType(*expr);
+  auto slot = static_cast<int32_t>(_procedure->frameSize++);
+  std::string name = "$" + std::to_string(slot);
+  auto decl = std::make_shared<VarDeclStmt>(type, name, expr, expr->line,
+                                            expr->column);
+  decl->slot = slot;
+  decl->initializerTyped = true;
+
+  for (const auto &occurrence : bestGroup) {
+    const ExprPtr &copy = *occurrence.site;
+    auto read = std::make_shared<VariableExpr>(name, copy->line, copy->column);
+    read->slot = slot;
+    read->staticType = type;
+    *occurrence.site = read;
+  }
+  block.statements.insert(block.statements.begin() + bestGroup[0].statement,
+                          decl);
+  return true;
+}
+
+void SubexpressionEliminator::collectStatement(Statement *stmt, size_t index,
+                                               bool nested) {
+  if (!stmt) {
+    return;
+  }
+
+  ExprPtr *head = nested ? nullptr : headOf(stmt);
+  auto expression = [&](ExprPtr &expr) {
+    collectExpression(expr, index, nested || &expr != head, &expr == head);
+  };
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    expression(static_cast<ExpressionStmt *>(stmt)->expression);
+    break;
+  case NodeKind::VAR_DECL:
+    expression(static_cast<VarDeclStmt *>(stmt)->initializer);
+    break;
+  case NodeKind::ASSIGN:
+    expression(static_cast<AssignStmt *>(stmt)->value);
+    break;
+  case NodeKind::INDEX_ASSIGN: {
+    auto *assign = static_cast<IndexAssignStmt *>(stmt);
+    collectTarget(assign->arrayExpr, index);
+    expression(assign->indexExpr);
+    expression(assign->value);
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *assign = static_cast<FieldAssignStmt *>(stmt);
+    expression(assign->object);
+    expression(assign->value);
+    break;
+  }
+  case NodeKind::BLOCK:
+    for (auto &statement : static_cast<BlockStmt *>(stmt)->statements) {
+      collectStatement(statement.get(), index, true);
+    }
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    expression(ifStmt->condition);
+    collectStatement(ifStmt->thenBranch.get(), index, true);
+    collectStatement(ifStmt->elseBranch.get(), index, true);
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *loop = static_cast<WhileStmt *>(stmt);
+    expression(loop->condition);
+    collectStatement(loop->body.get(), index, true);
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *loop = static_cast<ForStmt *>(stmt);
+    collectStatement(loop->initializer.get(), index, true);
+    expression(loop->condition);
+    collectStatement(loop->increment.get(), index, true);
+    collectStatement(loop->body.get(), index, true);
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *loop = static_cast<DoWhileStmt *>(stmt);
+    collectStatement(loop->body.get(), index, true);
+    expression(loop->condition);
+    break;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt);
+    expression(switchStmt->expression);
+    for (auto &switchCase : switchStmt->cases) {
+      for (auto &statement : switchCase.statements) {
+        collectStatement(statement.get(), index, true);
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN:
+    expression(static_cast<ReturnStmt *>(stmt)->value);
+    break;
+  default:
+    break;
+  }
+}
+
+size_t SubexpressionEliminator::collectExpression(ExprPtr &expr,
+                                                  size_t index, bool nested,
+                                                  bool leading) {
+  if (!expr) {
+    return 0;
+  }
+
+  // leading passes to what runs first, and to what runs next only after
+  // safe operands and never conditionally
+  size_t size = 1;
+  switch (expr->kind) {
+  case NodeKind::BINARY: {
+    using Op = BinaryExpr::Operator;
+    auto *binary = static_cast<BinaryExpr *>(expr.get());
+    bool shortCircuit =
+        binary->op == Op::LOGICAL_AND || binary->op == Op::LOGICAL_OR;
+    bool rightLeading =
+        leading && !shortCircuit && _purity.isSafe(*binary->left);
+    size += collectExpression(binary->left, index, nested, leading);
+    size += collectExpression(binary->right, index, nested, rightLeading);
+    break;
+  }
+  case NodeKind::UNARY:
+    size += collectExpression(static_cast<UnaryExpr *>(expr.get())->operand,
+                              index, nested, leading);
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr.get());
+    size += collectExpression(cond->condition, index, nested, leading);
+    size += collectExpression(cond->thenExpr, index, nested, false);
+    size += collectExpression(cond->elseExpr, index, nested, false);
+    break;
+  }
+  case NodeKind::CALL: {
+    auto *call = static_cast<CallExpr *>(expr.get());
+    bool modifies =
+        call->functionName == "push" || call->functionName == "pop";
+    bool argLeading = leading;
+    for (auto &arg : call->arguments) {
+      if (modifies && &arg == &call->arguments.front()) {
+        size += collectTarget(arg, index);
+      } else {
+        size += collectExpression(arg, index, nested, argLeading);
+      }
+      argLeading = argLeading && _purity.isSafe(*arg);
+    }
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL:
+    for (auto &element :
+         static_cast<ArrayLiteralExpr *>(expr.get())->elements) {
+      size += collectExpression(element, index, nested, false);
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *indexExpr = static_cast<IndexExpr *>(expr.get());
+    size += collectExpression(indexExpr->arrayExpr, index, nested, false);
+    size += collectExpression(indexExpr->indexExpr, index, nested, false);
+    break;
+  }
+  case NodeKind::FIELD:
+    size += collectExpression(static_cast<FieldExpr *>(expr.get())->object,
+                              index, nested, leading);
+    break;
+  case NodeKind::RECORD:
+    for (auto &field : static_cast<RecordExpr *>(expr.get())->fields) {
+      size += collectExpression(field, index, nested, false);
+    }
+    break;
+  default:
+    return size;
+  }
+
+  // The local needs a type
+  TypeInfo type = _purity.resultType(*expr);
+  bool storable = type.isArray || type.baseType != DataType::VOID;
+  if (!storable || !_purity.isPure(*expr)) {
+    return size;
+  }
+  std::string text = key(*expr);
+  auto found = _candidateIndex.find(text);
+  if (found == _candidateIndex.end()) {
+    found = _candidateIndex.emplace(text, _candidates.size()).first;
+    _candidates.push_back(Candidate{text, size, {}});
+  }
+  _candidates[found->second].occurrences.push_back(
+      Occurrence{&expr, index, nested, leading});
+  return size;
+}
+
+size_t SubexpressionEliminator::collectTarget(ExprPtr &target, size_t index) {
+  // The array itself has to stay the local or field it is changed in
+  size_t size = 1;
+  switch (target->kind) {
+  case NodeKind::INDEX: {
+    auto *indexExpr = static_cast<IndexExpr *>(target.get());
+    size += collectTarget(indexExpr->arrayExpr, index);
+    size += collectExpression(indexExpr->indexExpr, index, true, false);
+    break;
+  }
+  case NodeKind::FIELD:
+    size += collectExpression(static_cast<FieldExpr *>(target.get())->object,
+                              index, true, false);
+    break;
+  default:
+    size = collectExpression(target, index, true, false);
+    break;
+  }
+  return size;
+}
+
+std::vector<SubexpressionEliminator::Occurrence>
+SubexpressionEliminator::shareable(const BlockStmt &block,
+                                   const std::vector<Occurrence> &all,
+                                   size_t first) const {
+  const Occurrence &start = all[first];
+  const Expression &expr = **start.site;
+  if (!_purity.isSafe(expr) && (start.nested || !start.leading)) {
+    return {};
+  }
+
+  PurityModel::Reads reads;
+  PurityModel::collectReads(expr, reads);
+  std::vector<Occurrence> group{start};
+  for (size_t i = first + 1; i < all.size(); ++i) {
+    const Occurrence &next = all[i];
+    PurityModel::Writes writes;
+    for (size_t s = start.statement; s < next.statement; ++s) {
+      collectWrites(block.statements[s].get(), true, writes);
+    }
+    collectWrites(block.statements[next.statement].get(), next.nested,
+                  writes);
+    if (PurityModel::overlaps(reads, writes)) {
+      break;
+    }
+    group.push_back(next);
+  }
+  return group;
+}
+
+void SubexpressionEliminator::collectWrites(
+    Statement *stmt, bool whole, PurityModel::Writes &writes) const {
+  if (whole) {
+    _purity.collectWrites(stmt, writes);
+    return;
+  }
+  ExprPtr *head = headOf(stmt);
+  if (head) {
+    _purity.collectWrites(head->get(), writes);
+  }
+}
+
+std::string SubexpressionEliminator::key(const Expression &expr) const {
+  switch (expr.kind) {
+  case NodeKind::LITERAL: {
+    // Doubles exactly, so 0.1 and 0.1000000001 stay apart
+    auto &literal = static_cast<const LiteralExpr &>(expr);
+    std::ostringstream out;
+    out << ValueHelper::typeToString(literal.type) << ':';
+    if (std::holds_alternative<double>(literal.value)) {
+      out << std::hexfloat << std::get<double>(literal.value);
+    } else {
+      std::string text = ValueHelper::toString(literal.value);
+      out << text.size() << ':' << text;
+    }
+    return out.str();
+  }
+  case NodeKind::VARIABLE:
+    return "$" + std::to_string(static_cast<const VariableExpr &>(expr).slot);
+  case NodeKind::BINARY: {
+    auto &binary = static_cast<const BinaryExpr &>(expr);
+    return "(" + key(*binary.left) + " b" +
+           std::to_string(static_cast<int>(binary.op)) + " " +
+           key(*binary.right) + ")";
+  }
+  case NodeKind::UNARY: {
+    auto &unary = static_cast<const UnaryExpr &>(expr);
+    return "(u" + std::to_string(static_cast<int>(unary.op)) + " " +
+           key(*unary.operand) + ")";
+  }
+  case NodeKind::CONDITIONAL: {
+    auto &cond = static_cast<const ConditionalExpr &>(expr);
+    return "(" + key(*cond.condition) + " ? " + key(*cond.thenExpr) + " : " +
+           key(*cond.elseExpr) + ")";
+  }
+  case NodeKind::INDEX: {
+    auto &index = static_cast<const IndexExpr &>(expr);
+    return key(*index.arrayExpr) + "[" + key(*index.indexExpr) + "]";
+  }
+  case NodeKind::FIELD: {
+    auto &field = static_cast<const FieldExpr &>(expr);
+    return key(*field.object) + "." + field.field;
+  }
+  case NodeKind::CALL: {
+    auto &call = static_cast<const CallExpr &>(expr);
+    std::string text = call.functionName + "(";
+    for (const auto &arg : call.arguments) {
+      text += key(*arg) + ",";
+    }
+    return text + ")";
+  }
+  default:
+    return "";
+  }
+}
+
+} // namespace Script
@@ -0,0 +1,280 @@
+#include "Superoperators.h"
+
+namespace Script {
+
+namespace {
+
+bool isLocal(const Expression *expr) {
+  return expr->kind == NodeKind::VARIABLE &&
+         static_cast<const VariableExpr *>(expr)->slot >= 0;
+}
+
+bool isLocalOrLiteral(const Expression *expr) {
+  return isLocal(expr) || expr->kind == NodeKind::LITERAL;
+}
+
+bool isInt32Literal(const Expression *expr) {
+  return expr->kind == NodeKind::LITERAL &&
+         std::holds_alternative<int32_t>(
+             static_cast<const LiteralExpr *>(expr)->value);
+}
+
+bool isLocalCompare(const BinaryExpr *bin) {
+  if (!SuperoperatorPass::isComparison(bin->op)) {
+    return false;
+  }
+  // Two literals are left alone; at least one side must be a local
+  return isLocalOrLiteral(bin->left.get()) &&
+         isLocalOrLiteral(bin->right.get()) &&
+         (isLocal(bin->left.get()) || isLocal(bin->right.get()));
+}
+
+bool isLocalAddLiteral(const AssignStmt *assign) {
+  if (assign->slot < 0) {
+    return false;
+  }
+  switch (assign->op) {
+  case AssignStmt::Operator::PLUS_ASSIGN:
+  case AssignStmt::Operator::MINUS_ASSIGN:
+    return isInt32Literal(assign->value.get());
+  case AssignStmt::Operator::ASSIGN:
+    break;
+  default:
+    return false;
+  }
+
+  // x = x + literal, x = x - literal
+  if (assign->value->kind != NodeKind::BINARY) {
+    return false;
+  }
+  auto *bin = static_cast<const BinaryExpr *>(assign->value.get());
+  if (bin->op != BinaryExpr::Operator::ADD &&
+      bin->op != BinaryExpr::Operator::SUBTRACT) {
+    return false;
+  }
+  return isLocal(bin->left.get()) &&
+         static_cast<const VariableExpr *>(bin->left.get())->slot ==
+             assign->slot &&
+         isInt32Literal(bin->right.get());
+}
+
+} // namespace
+
+void SuperoperatorPass::run(ProcedureDecl &proc) {
+  visitStatement(proc.body.get());
+}
+
+const char *SuperoperatorPass::name(Superop op) {
+  switch (op) {
+  case Superop::NONE:
+    return "none";
+  case Superop::LOCAL_COMPARE:
+    return "local-compare";
+  case Superop::LOCAL_ADD_LITERAL:
+    return "local-add-literal";
+  case Superop::LOCAL_INDEX:
+    return "local-index";
+  case Superop::COMPARE_CHAIN:
+    return "compare-chain";
+  case Superop::COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+bool SuperoperatorPass::isComparison(BinaryExpr::Operator op) {
+  switch (op) {
+  case BinaryExpr::Operator::EQUAL:
+  case BinaryExpr::Operator::NOT_EQUAL:
+  case BinaryExpr::Operator::LESS_THAN:
+  case BinaryExpr::Operator::GREATER_THAN:
+  case BinaryExpr::Operator::LESS_EQUAL:
+  case BinaryExpr::Operator::GREATER_EQUAL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void SuperoperatorPass::tag(ASTNode *node, Superop op) {
+  node->superop = op;
+  ++_sites[static_cast<size_t>(op)];
+}
+
+bool SuperoperatorPass::isCompareChain(Expression *expr) const {
+  if (expr->kind != NodeKind::BINARY) {
+    return false;
+  }
+  auto *bin = static_cast<BinaryExpr *>(expr);
+  if (bin->op == BinaryExpr::Operator::LOGICAL_AND) {
+    return isCompareChain(bin->left.get()) && isCompareChain(bin->right.get());
+  }
+  return isComparison(bin->op);
+}
+
+void SuperoperatorPass::visitStatement(Statement *stmt) {
+  if (!stmt) {
+    return;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    visitExpression(static_cast<ExpressionStmt *>(stmt)->expression.get());
+    break;
+  case NodeKind::VAR_DECL:
+    visitExpression(static_cast<VarDeclStmt *>(stmt)->initializer.get());
+    break;
+  case NodeKind::ASSIGN: {
+    auto *assign = static_cast<AssignStmt *>(stmt);
+    if (isLocalAddLiteral(assign)) {
+      tag(assign, Superop::LOCAL_ADD_LITERAL);
+      break;
+    }
+    visitExpression(assign->value.get());
+    break;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    auto *idxAssign = static_cast<IndexAssignStmt *>(stmt);
+    visitExpression(idxAssign->arrayExpr.get());
+    visitExpression(idxAssign->indexExpr.get());
+    visitExpression(idxAssign->value.get());
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *fieldAssign = static_cast<FieldAssignStmt *>(stmt);
+    visitExpression(fieldAssign->object.get());
+    visitExpression(fieldAssign->value.get());
+    break;
+  }
+  case NodeKind::BLOCK:
+    for (auto &statement : static_cast<BlockStmt *>(stmt)->statements) {
+      visitStatement(statement.get());
+    }
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    visitExpression(ifStmt->condition.get());
+    visitStatement(ifStmt->thenBranch.get());
+    visitStatement(ifStmt->elseBranch.get());
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *whileStmt = static_cast<WhileStmt *>(stmt);
+    visitExpression(whileStmt->condition.get());
+    visitStatement(whileStmt->body.get());
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *forStmt = static_cast<ForStmt *>(stmt);
+    visitStatement(forStmt->initializer.get());
+    visitExpression(forStmt->condition.get());
+    visitStatement(forStmt->body.get());
+    visitStatement(forStmt->increment.get());
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *doWhile = static_cast<DoWhileStmt *>(stmt);
+    visitStatement(doWhile->body.get());
+    visitExpression(doWhile->condition.get());
+    break;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt);
+    visitExpression(switchStmt->expression.get());
+    for (auto &caseEntry : switchStmt->cases) {
+      visitExpression(caseEntry.matchExpr.get());
+      for (auto &s : caseEntry.statements) {
+        visitStatement(s.get());
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN:
+    visitExpression(static_cast<ReturnStmt *>(stmt)->value.get());
+    break;
+  default:
+    break;
+  }
+}
+
+void SuperoperatorPass::visitExpression(Expression *expr) {
+  if (!expr) {
+    return;
+  }
+
+  switch (expr->kind) {
+  case NodeKind::ARRAY_LITERAL:
+    for (auto &e : static_cast<ArrayLiteralExpr *>(expr)->elements) {
+      visitExpression(e.get());
+    }
+    break;
+  case NodeKind::INDEX: {
+    auto *idx = static_cast<IndexExpr *>(expr);
+    if (isLocal(idx->arrayExpr.get()) && isLocal(idx->indexExpr.get())) {
+      tag(idx, Superop::LOCAL_INDEX);
+      break;
+    }
+    visitExpression(idx->arrayExpr.get());
+    visitExpression(idx->indexExpr.get());
+    break;
+  }
+  case NodeKind::BINARY: {
+    auto *bin = static_cast<BinaryExpr *>(expr);
+    if (bin->op == BinaryExpr::Operator::LOGICAL_AND &&
+        isCompareChain(bin)) {
+      // Only the root is tagged; the comparisons inside can still be fused
+      tag(bin, Superop::COMPARE_CHAIN);
+      visitChain(bin);
+      break;
+    }
+    if (isLocalCompare(bin)) {
+      tag(bin, Superop::LOCAL_COMPARE);
+      break;
+    }
+    visitExpression(bin->left.get());
+    visitExpression(bin->right.get());
+    break;
+  }
+  case NodeKind::UNARY:
+    visitExpression(static_cast<UnaryExpr *>(expr)->operand.get());
+    break;
+  case NodeKind::CALL: {
+    auto *call = static_cast<CallExpr *>(expr);
+    for (auto &arg : call->arguments) {
+      visitExpression(arg.get());
+    }
+    visitExpression(call->inlined.get());
+    break;
+  }
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr);
+    visitExpression(cond->condition.get());
+    visitExpression(cond->thenExpr.get());
+    visitExpression(cond->elseExpr.get());
+    break;
+  }
+  case NodeKind::FIELD:
+    visitExpression(static_cast<FieldExpr *>(expr)->object.get());
+    break;
+  case NodeKind::RECORD:
+    for (auto &field : static_cast<RecordExpr *>(expr)->fields) {
+      visitExpression(field.get());
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void SuperoperatorPass::visitChain(BinaryExpr *bin) {
+  for (Expression *side : {bin->left.get(), bin->right.get()}) {
+    auto *operand = static_cast<BinaryExpr *>(side);
+    if (operand->op == BinaryExpr::Operator::LOGICAL_AND) {
+      visitChain(operand);
+    } else {
+      visitExpression(operand);
+    }
+  }
+}
+
+} // namespace Script
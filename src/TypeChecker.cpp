@@ -0,0 +1,533 @@
+#include "TypeChecker.h"
+#include <stdexcept>
+
+namespace Script {
+
+namespace {
+
+bool isKnown(const TypeInfo &type) {
+  return type.isArray || type.baseType != DataType::VOID;
+}
+
+bool isScalar(const TypeInfo &type) {
+  return !type.isArray && type.baseType < DataType::VOID;
+}
+
+// A value of a scalar type, to run an operator on and see what it gives
+Value sample(DataType type) {
+  if (type == DataType::STRING) {
+    return std::string("1");
+  }
+  return ValueHelper::createValue(type, 1.0);
+}
+
+TypeInfo elementOf(const TypeInfo &array) {
+  TypeInfo element(array.baseType);
+  element.structType = array.structType;
+  return element;
+}
+
+// Why Interpreter::convertToType would reject every value of type from
+// for type to, or empty if it may succeed
+std::string conversionError(const TypeInfo &from, const TypeInfo &to) {
+  if (!isKnown(from) || !isKnown(to)) {
+    return "";
+  }
+  if (to.isMap() || from.isMap() || to.isRecord() || from.isRecord() ||
+      to.isStringBuilder() || from.isStringBuilder()) {
+    if (to.isMap() && !from.isMap()) {
+      return "Expected map value";
+    }
+    if (to.isStringBuilder() && !from.isStringBuilder()) {
+      return "Expected stringbuilder value";
+    }
+    if (to.isRecord() && from.structType != to.structType) {
+      return "Expected " + ValueHelper::typeToString(to) + " value";
+    }
+    if (!(from == to)) {
+      return "Cannot convert " + ValueHelper::typeToString(from) + " to " +
+             ValueHelper::typeToString(to);
+    }
+    return "";
+  }
+  if (to.isArray) {
+    if (!from.isArray) {
+      return "Expected array value";
+    }
+    return conversionError(elementOf(from), elementOf(to));
+  }
+  if (from.isArray) {
+    return "Cannot convert array to scalar type";
+  }
+  // Anything converts to a string or a bool; strings convert to nothing else
+  if (from.baseType == DataType::STRING && to.baseType != DataType::STRING &&
+      to.baseType != DataType::BOOL) {
+    return "Cannot convert string to " + ValueHelper::typeToString(to);
+  }
+  return "";
+}
+
+} // namespace
+
+bool TypeChecker::trusted(const TypeInfo &type) {
+  return isScalar(type) || type.isRecord();
+}
+
+void TypeChecker::check(Script &script) {
+  _procedures.clear();
+  _errors.clear();
+  for (auto &proc : script.procedures) {
+    _procedures[proc->name] = proc;
+  }
+  for (auto &proc : script.procedures) {
+    check(*proc);
+  }
+}
+
+void TypeChecker::check(ProcedureDecl &proc) {
+  _procedure = &proc;
+  _variables.clear();
+
+  // Losing a local's type can lose the type of locals assigned from it, so
+  // check until nothing changes; the last pass has the final annotations
+  do {
+    _changed = false;
+    _nextVariable = 0;
+    _scopes.clear();
+    _procedureErrors.clear();
+    _returnsTyped = trusted(proc.returnType);
+
+    _scopes.emplace_back();
+    for (const auto &param : proc.parameters) {
+      declare(param.name, param.type, true);
+    }
+    checkStatement(proc.body.get());
+    _scopes.clear();
+  } while (_changed);
+
+  proc.returnsTyped = _returnsTyped;
+  _errors.insert(_errors.end(), _procedureErrors.begin(),
+                 _procedureErrors.end());
+}
+
+void TypeChecker::declare(const std::string &name, const TypeInfo &type,
+                          bool stable) {
+  size_t id = _nextVariable++;
+  if (id == _variables.size()) {
+    _variables.push_back(Variable{type, stable});
+  }
+  _scopes.back()[name] = id;
+}
+
+TypeChecker::Variable *TypeChecker::lookup(const std::string &name) {
+  for (auto it = _scopes.rbegin(); it != _scopes.rend(); ++it) {
+    auto found = it->find(name);
+    if (found != it->end()) {
+      return &_variables[found->second];
+    }
+  }
+  return nullptr;
+}
+
+void TypeChecker::assigned(Variable &variable, const TypeInfo &stored) {
+  if (variable.stable && !(stored == variable.type)) {
+    variable.stable = false;
+    _changed = true;
+  }
+}
+
+void TypeChecker::report(const std::string &message, const ASTNode &node) {
+  _procedureErrors.emplace_back(message + " at line " +
+                                    std::to_string(node.line) + ", column " +
+                                    std::to_string(node.column) +
+                                    " in procedure '" + _procedure->name + "'",
+                                node.line, node.column, _procedure->name);
+}
+
+void TypeChecker::expectConvertible(const TypeInfo &from, const TypeInfo &to,
+                                    const ASTNode &node) {
+  std::string message = conversionError(from, to);
+  if (!message.empty()) {
+    report(message, node);
+  }
+}
+
+TypeInfo TypeChecker::binaryType(BinaryExpr::Operator op,
+                                 const TypeInfo &left, const TypeInfo &right,
+                                 const ASTNode &node) {
+  using Op = BinaryExpr::Operator;
+  if (op == Op::LOGICAL_AND || op == Op::LOGICAL_OR) {
+    return TypeInfo(DataType::BOOL);
+  }
+  if (!isScalar(left) || !isScalar(right)) {
+    return TypeInfo(DataType::VOID);
+  }
+
+  // Result types depend only on the operand types, so running the
+  // operator on one value of each gives the type, or the error every
+  // evaluation would raise
+  Value a = sample(left.baseType);
+  Value b = sample(right.baseType);
+  try {
+    switch (op) {
+    case Op::ADD:
+      return ValueHelper::getType(ValueHelper::add(a, b));
+    case Op::SUBTRACT:
+      return ValueHelper::getType(ValueHelper::subtract(a, b));
+    case Op::MULTIPLY:
+      return ValueHelper::getType(ValueHelper::multiply(a, b));
+    case Op::DIVIDE:
+      return ValueHelper::getType(ValueHelper::divide(a, b));
+    case Op::MODULO:
+      return ValueHelper::getType(ValueHelper::modulo(a, b));
+    case Op::EQUAL:
+    case Op::NOT_EQUAL:
+      return TypeInfo(DataType::BOOL);
+    case Op::LESS_THAN:
+    case Op::GREATER_THAN:
+    case Op::LESS_EQUAL:
+    case Op::GREATER_EQUAL:
+      ValueHelper::lessThan(a, b);
+      return TypeInfo(DataType::BOOL);
+    case Op::BIT_AND:
+      return ValueHelper::getType(ValueHelper::bitAnd(a, b));
+    case Op::BIT_OR:
+      return ValueHelper::getType(ValueHelper::bitOr(a, b));
+    case Op::BIT_XOR:
+      return ValueHelper::getType(ValueHelper::bitXor(a, b));
+    case Op::LSHIFT:
+      return ValueHelper::getType(ValueHelper::lshift(a, b));
+    case Op::RSHIFT:
+      return ValueHelper::getType(ValueHelper::rshift(a, b));
+    default:
+      break;
+    }
+  } catch (const std::runtime_error &e) {
+    report(e.what(), node);
+  }
+  return TypeInfo(DataType::VOID);
+}
+
+void TypeChecker::checkStatement(Statement *stmt, bool sequenced) {
+  if (!stmt) {
+    return;
+  }
+
+  switch (stmt->kind) {
+  case NodeKind::EXPRESSION_STMT:
+    checkExpression(static_cast<ExpressionStmt *>(stmt)->expression.get());
+    break;
+  case NodeKind::VAR_DECL: {
+    // A declaration that may be skipped (a case label, an if without a
+    // block) can leave another value in its slot, so it is never trusted
+    auto *varDecl = static_cast<VarDeclStmt *>(stmt);
+    varDecl->initializerTyped = false;
+    if (varDecl->initializer) {
+      TypeInfo init = checkExpression(varDecl->initializer.get());
+      expectConvertible(init, varDecl->type, *varDecl);
+      varDecl->initializerTyped = trusted(varDecl->type) &&
+                                  init == varDecl->type;
+    }
+    declare(varDecl->name, varDecl->type, sequenced);
+    break;
+  }
+  case NodeKind::ASSIGN: {
+    // Plain assignment stores the value as it is, so the local keeps its
+    // type only if the value already has it
+    auto *assign = static_cast<AssignStmt *>(stmt);
+    TypeInfo value = checkExpression(assign->value.get());
+    Variable *variable =
+        assign->slot >= 0 ? lookup(assign->variableName) : nullptr;
+    if (!variable) {
+      break;
+    }
+    TypeInfo current =
+        variable->stable ? variable->type : TypeInfo(DataType::VOID);
+    TypeInfo stored = value;
+    switch (assign->op) {
+    case AssignStmt::Operator::ASSIGN:
+      break;
+    case AssignStmt::Operator::PLUS_ASSIGN:
+      stored =
+          binaryType(BinaryExpr::Operator::ADD, current, value, *assign);
+      break;
+    case AssignStmt::Operator::MINUS_ASSIGN:
+      stored = binaryType(BinaryExpr::Operator::SUBTRACT, current, value,
+                          *assign);
+      break;
+    case AssignStmt::Operator::MULT_ASSIGN:
+      stored = binaryType(BinaryExpr::Operator::MULTIPLY, current, value,
+                          *assign);
+      break;
+    case AssignStmt::Operator::DIV_ASSIGN:
+      stored =
+          binaryType(BinaryExpr::Operator::DIVIDE, current, value, *assign);
+      break;
+    }
+    expectConvertible(stored, variable->type, *assign);
+    assigned(*variable, stored);
+    break;
+  }
+  case NodeKind::INDEX_ASSIGN: {
+    auto *idxAssign = static_cast<IndexAssignStmt *>(stmt);
+    TypeInfo array = checkExpression(idxAssign->arrayExpr.get());
+    checkExpression(idxAssign->indexExpr.get());
+    checkExpression(idxAssign->value.get());
+    if (isKnown(array) && !array.isArray) {
+      report("Index assignment on non-array value", *idxAssign);
+    }
+    break;
+  }
+  case NodeKind::FIELD_ASSIGN: {
+    auto *fieldAssign = static_cast<FieldAssignStmt *>(stmt);
+    TypeInfo object = checkExpression(fieldAssign->object.get());
+    TypeInfo value = checkExpression(fieldAssign->value.get());
+    if (isKnown(object) && !object.isRecord()) {
+      report("Field assignment on non-record value", *fieldAssign);
+    } else if (fieldAssign->structType &&
+               object.structType == fieldAssign->structType) {
+      expectConvertible(
+          value, fieldAssign->structType->fieldTypes[fieldAssign->index],
+          *fieldAssign);
+    }
+    break;
+  }
+  case NodeKind::BLOCK:
+    _scopes.emplace_back();
+    for (auto &statement : static_cast<BlockStmt *>(stmt)->statements) {
+      checkStatement(statement.get(), true);
+    }
+    _scopes.pop_back();
+    break;
+  case NodeKind::IF: {
+    auto *ifStmt = static_cast<IfStmt *>(stmt);
+    checkExpression(ifStmt->condition.get());
+    checkStatement(ifStmt->thenBranch.get());
+    checkStatement(ifStmt->elseBranch.get());
+    break;
+  }
+  case NodeKind::WHILE: {
+    auto *whileStmt = static_cast<WhileStmt *>(stmt);
+    checkExpression(whileStmt->condition.get());
+    checkStatement(whileStmt->body.get());
+    break;
+  }
+  case NodeKind::FOR: {
+    auto *forStmt = static_cast<ForStmt *>(stmt);
+    _scopes.emplace_back();
+    checkStatement(forStmt->initializer.get(), true);
+    checkExpression(forStmt->condition.get());
+    checkStatement(forStmt->body.get());
+    checkStatement(forStmt->increment.get());
+    _scopes.pop_back();
+    break;
+  }
+  case NodeKind::DO_WHILE: {
+    auto *doWhile = static_cast<DoWhileStmt *>(stmt);
+    checkStatement(doWhile->body.get());
+    checkExpression(doWhile->condition.get());
+    break;
+  }
+  case NodeKind::SWITCH: {
+    auto *switchStmt = static_cast<SwitchStmt *>(stmt);
+    checkExpression(switchStmt->expression.get());
+    for (auto &caseEntry : switchStmt->cases) {
+      checkExpression(caseEntry.matchExpr.get());
+      for (auto &s : caseEntry.statements) {
+        checkStatement(s.get());
+      }
+    }
+    break;
+  }
+  case NodeKind::RETURN: {
+    auto *ret = static_cast<ReturnStmt *>(stmt);
+    if (!ret->value) {
+      _returnsTyped = false;
+      break;
+    }
+    TypeInfo value = checkExpression(ret->value.get());
+    if (!(value == _procedure->returnType)) {
+      _returnsTyped = false;
+    }
+    if (_procedure->returnType.baseType != DataType::VOID ||
+        _procedure->returnType.isArray) {
+      expectConvertible(value, _procedure->returnType, *ret);
+    }
+    break;
+  }
+  case NodeKind::BREAK:
+  case NodeKind::CONTINUE:
+    break;
+  default:
+    throw std::runtime_error("Unknown statement type");
+  }
+}
+
+TypeInfo TypeChecker::checkExpression(Expression *expr) {
+  if (!expr) {
+    return TypeInfo(DataType::VOID);
+  }
+
+  TypeInfo type(DataType::VOID);
+  switch (expr->kind) {
+  case NodeKind::LITERAL:
+    type = ValueHelper::getType(static_cast<LiteralExpr *>(expr)->value);
+    break;
+  case NodeKind::VARIABLE: {
+    auto *var = static_cast<VariableExpr *>(expr);
+    Variable *variable = var->slot >= 0 ? lookup(var->name) : nullptr;
+    if (variable && variable->stable) {
+      type = variable->type;
+    }
+    break;
+  }
+  case NodeKind::ARRAY_LITERAL: {
+    // Elements of one known type make an array of that type
+    auto &elements = static_cast<ArrayLiteralExpr *>(expr)->elements;
+    for (size_t i = 0; i < elements.size(); ++i) {
+      TypeInfo element = checkExpression(elements[i].get());
+      if (i == 0) {
+        type = element;
+      } else if (!(element == type)) {
+        type = TypeInfo(DataType::VOID);
+      }
+    }
+    if (isKnown(type)) {
+      type.isArray = true;
+    }
+    break;
+  }
+  case NodeKind::INDEX: {
+    // Elements are not tracked: rows of a matrix are arrays, and arrays
+    // may hold mixed values
+    auto *idx = static_cast<IndexExpr *>(expr);
+    TypeInfo array = checkExpression(idx->arrayExpr.get());
+    checkExpression(idx->indexExpr.get());
+    if (isKnown(array) && !array.isArray) {
+      report("Indexing non-array value", *idx);
+    }
+    break;
+  }
+  case NodeKind::FIELD: {
+    auto *field = static_cast<FieldExpr *>(expr);
+    TypeInfo object = checkExpression(field->object.get());
+    if (isKnown(object) && !object.isRecord()) {
+      report("Field access on non-record value", *field);
+    } else if (field->structType && object.structType == field->structType) {
+      type = field->structType->fieldTypes[field->index];
+    }
+    break;
+  }
+  case NodeKind::RECORD: {
+    auto *record = static_cast<RecordExpr *>(expr);
+    for (size_t i = 0; i < record->fields.size(); ++i) {
+      TypeInfo field = checkExpression(record->fields[i].get());
+      if (i < record->type->fieldTypes.size()) {
+        expectConvertible(field, record->type->fieldTypes[i],
+                          *record->fields[i]);
+      }
+    }
+    type = TypeInfo::record(record->type);
+    break;
+  }
+  case NodeKind::BINARY: {
+    auto *bin = static_cast<BinaryExpr *>(expr);
+    TypeInfo left = checkExpression(bin->left.get());
+    TypeInfo right = checkExpression(bin->right.get());
+    type = binaryType(bin->op, left, right, *bin);
+    break;
+  }
+  case NodeKind::UNARY:
+    type = checkUnary(static_cast<UnaryExpr *>(expr));
+    break;
+  case NodeKind::CALL:
+    type = checkCall(static_cast<CallExpr *>(expr));
+    break;
+  case NodeKind::CONDITIONAL: {
+    auto *cond = static_cast<ConditionalExpr *>(expr);
+    checkExpression(cond->condition.get());
+    TypeInfo thenType = checkExpression(cond->thenExpr.get());
+    TypeInfo elseType = checkExpression(cond->elseExpr.get());
+    if (thenType == elseType) {
+      type = thenType;
+    }
+    break;
+  }
+  default:
+    throw std::runtime_error("Unknown expression type");
+  }
+
+  expr->staticType = type;
+  return type;
+}
+
+TypeInfo TypeChecker::checkUnary(UnaryExpr *expr) {
+  TypeInfo operand = checkExpression(expr->operand.get());
+  switch (expr->op) {
+  case UnaryExpr::Operator::LOGICAL_NOT:
+    return TypeInfo(DataType::BOOL);
+  case UnaryExpr::Operator::NEGATE:
+    // Doubles stay doubles; everything else is negated as an int32
+    if (!isScalar(operand)) {
+      break;
+    }
+    if (operand.baseType == DataType::STRING) {
+      report("Cannot negate a string", *expr);
+      break;
+    }
+    return TypeInfo(operand.baseType == DataType::DOUBLE ? DataType::DOUBLE
+                                                         : DataType::INT32);
+  case UnaryExpr::Operator::BIT_NOT:
+    if (!isScalar(operand)) {
+      break;
+    }
+    try {
+      return ValueHelper::getType(
+          ValueHelper::bitNot(sample(operand.baseType)));
+    } catch (const std::runtime_error &e) {
+      report(e.what(), *expr);
+    }
+    break;
+  }
+  return TypeInfo(DataType::VOID);
+}
+
+TypeInfo TypeChecker::checkCall(CallExpr *expr) {
+  std::vector<TypeInfo> args;
+  args.reserve(expr->arguments.size());
+  for (auto &arg : expr->arguments) {
+    args.push_back(checkExpression(arg.get()));
+  }
+
+  expr->checkedProcedure.reset();
+  expr->argumentsTyped = false;
+
+  // len, push and pop are handled before procedures are looked up
+  const std::string &name = expr->functionName;
+  auto found = _procedures.find(name);
+  if (found == _procedures.end() || name == "len" || name == "push" ||
+      name == "pop") {
+    return TypeInfo(DataType::VOID);
+  }
+
+  const ProcedureDeclPtr &proc = found->second;
+  expr->checkedProcedure = proc;
+  if (args.size() != proc->parameters.size()) {
+    report("Procedure '" + name + "' expects " +
+               std::to_string(proc->parameters.size()) + " arguments, got " +
+               std::to_string(args.size()),
+           *expr);
+    return proc->returnType;
+  }
+
+  bool typed = true;
+  for (size_t i = 0; i < args.size(); ++i) {
+    const TypeInfo &param = proc->parameters[i].type;
+    expectConvertible(args[i], param, *expr->arguments[i]);
+    typed = typed && trusted(param) && args[i] == param;
+  }
+  expr->argumentsTyped = typed;
+  return proc->returnType;
+}
+
+} // namespace Script
@@ -0,0 +1,661 @@
+#include "VirtualMachine.h"
+#include "Interpreter.h"
+#include <iterator>
+
+namespace Script {
+
+namespace {
+
+inline bool bothInt32(const CompactValue &a, const CompactValue &b) {
+  return a.isInt32() && b.isInt32();
+}
+
+inline bool bothDouble(const CompactValue &a, const CompactValue &b) {
+  return a.isDouble() && b.isDouble();
+}
+
+inline int64_t int32Of(const CompactValue &v) { return v.int32(); }
+
+inline double doubleOf(const CompactValue &v) { return v.doubleValue(); }
+
+// s += x compiles to ADD s, s, x; append to the string in place
+inline bool appendInPlace(CompactValue &target, const Value &value) {
+  return target.isString() &&
+         ValueHelper::appendString(target.mutableString(), value);
+}
+
+inline bool truthy(const CompactValue &v) {
+  if (v.isBool()) {
+    return v.boolean();
+  }
+  Value scratch;
+  return ValueHelper::toBool(v.view(scratch));
+}
+
+// Registers first to first + count as Values, for the ValueHelper calls
+// that take a run of them
+std::vector<Value> valuesOf(const CompactValue *first, size_t count) {
+  std::vector<Value> indices;
+  indices.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    indices.push_back(first[i].toValue());
+  }
+  return indices;
+}
+
+} // namespace
+
+Value VirtualMachine::execute(const ProcedureDecl &proc,
+                              BytecodeProcedure &code,
+                              const std::vector<CompactValue> &arguments,
+                              bool argumentsTyped) {
+  Interpreter &interp = _interpreter;
+
+  std::vector<CompactValue> regs(code.registerCount);
+  for (size_t i = 0; i < proc.parameters.size(); ++i) {
+    regs[i] = interp.bindParameter(proc.parameters[i].type, arguments[i],
+                                   argumentsTyped);
+  }
+
+  const Instruction *base = code.code.data();
+  const Instruction *ip = base;
+  // Scalar registers are viewed as Values through these; boxed ones are
+  // viewed in place
+  Value lhs, rhs;
+
+  auto error = [&](const std::string &message, const Instruction &in) {
+    const SourcePosition &pos = code.positions[&in - base];
+    return interp.runtimeError(message, pos.line, pos.column);
+  };
+
+  for (;;) {
+    const Instruction &in = *ip++;
+
+    switch (in.op) {
+    case OpCode::LOAD_CONST:
+      regs[in.a] = code.constants[in.b];
+      break;
+
+    case OpCode::MOVE:
+      regs[in.a] = regs[in.b];
+      break;
+
+    case OpCode::LOAD_EXTERNAL: {
+      const std::string &name = code.names[in.b];
+      auto extIt = interp._externalVariables.find(name);
+      if (extIt == interp._externalVariables.end()) {
+        throw error("Undefined variable: " + name, in);
+      }
+      if (!extIt->second.getter) {
+        throw error("External variable '" + name + "' has no getter", in);
+      }
+      regs[in.a] = extIt->second.get();
+      break;
+    }
+
+    case OpCode::STORE_EXTERNAL: {
+      const std::string &name = code.names[in.a];
+      auto extIt = interp._externalVariables.find(name);
+      if (extIt == interp._externalVariables.end()) {
+        throw error("Undefined variable: " + name, in);
+      }
+      auto &extVar = extIt->second;
+      if (!extVar.setter) {
+        throw error("External variable '" + name + "' is read-only", in);
+      }
+
+      auto op = static_cast<AssignStmt::Operator>(in.c);
+      const Value &value = regs[in.b].view(rhs);
+      if (op == AssignStmt::Operator::ASSIGN) {
+        extVar.setter(value);
+        break;
+      }
+      if (!extVar.getter) {
+        throw error("External variable '" + name + "' cannot be read", in);
+      }
+
+      Value currentValue = extVar.getter();
+      switch (op) {
+      case AssignStmt::Operator::ASSIGN:
+        break;
+      case AssignStmt::Operator::PLUS_ASSIGN:
+        currentValue = ValueHelper::add(currentValue, value);
+        break;
+      case AssignStmt::Operator::MINUS_ASSIGN:
+        currentValue = ValueHelper::subtract(currentValue, value);
+        break;
+      case AssignStmt::Operator::MULT_ASSIGN:
+        currentValue = ValueHelper::multiply(currentValue, value);
+        break;
+      case AssignStmt::Operator::DIV_ASSIGN:
+        currentValue = ValueHelper::divide(currentValue, value);
+        break;
+      }
+      extVar.setter(currentValue);
+      break;
+    }
+
+    case OpCode::NEW_ARRAY:
+      regs[in.a] = ValueHelper::createArray(code.types[in.b], {});
+      break;
+
+    case OpCode::NEW_MAP:
+      regs[in.a] = ValueHelper::createMap(code.types[in.b]);
+      break;
+
+    case OpCode::NEW_STRING_BUILDER:
+      regs[in.a] = std::make_shared<StringBuilderValue>();
+      break;
+
+    case OpCode::NEW_RECORD: {
+      const TypeInfo &type = code.types[in.b];
+      if (in.c < 0) {
+        regs[in.a] = ValueHelper::defaultValue(type);
+        break;
+      }
+      const StructType &layout = *type.structType;
+      std::vector<Value> fields;
+      fields.reserve(layout.fieldTypes.size());
+      for (size_t i = 0; i < layout.fieldTypes.size(); ++i) {
+        fields.push_back(interp.convertToType(regs[in.c + i].view(rhs),
+                                              layout.fieldTypes[i]));
+      }
+      regs[in.a] =
+          std::make_shared<RecordValue>(type.structType, std::move(fields));
+      break;
+    }
+
+    case OpCode::ARRAY_LITERAL: {
+      std::vector<Value> elements =
+          valuesOf(&regs[in.b], static_cast<size_t>(in.c));
+      TypeInfo elemType = elements.empty() ? TypeInfo(DataType::VOID)
+                                           : ValueHelper::getType(elements[0]);
+      regs[in.a] = ValueHelper::createArray(elemType, elements);
+      break;
+    }
+
+    case OpCode::CONVERT:
+      regs[in.a] = interp.convertToType(regs[in.b].view(rhs), code.types[in.c]);
+      break;
+
+    case OpCode::CHECK_TYPE: {
+      const Value &value = regs[in.a].view(rhs);
+      if (ValueHelper::needsConversion(value, code.types[in.b])) {
+        regs[in.a] = interp.convertToType(value, code.types[in.b]);
+      }
+      break;
+    }
+
+    case OpCode::ADD: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      if (bothInt32(l, r)) {
+        regs[in.a].setInt32(static_cast<int32_t>(int32Of(l) + int32Of(r)));
+      } else if (bothDouble(l, r)) {
+        regs[in.a].setDouble(doubleOf(l) + doubleOf(r));
+      } else if (in.a != in.b || !appendInPlace(regs[in.a], r.view(rhs))) {
+        regs[in.a] = ValueHelper::add(l.view(lhs), r.view(rhs));
+      }
+      break;
+    }
+
+    case OpCode::SUBTRACT: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      if (bothInt32(l, r)) {
+        regs[in.a].setInt32(static_cast<int32_t>(int32Of(l) - int32Of(r)));
+      } else if (bothDouble(l, r)) {
+        regs[in.a].setDouble(doubleOf(l) - doubleOf(r));
+      } else {
+        regs[in.a] = ValueHelper::subtract(l.view(lhs), r.view(rhs));
+      }
+      break;
+    }
+
+    case OpCode::MULTIPLY: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      if (bothInt32(l, r)) {
+        regs[in.a].setInt32(static_cast<int32_t>(int32Of(l) * int32Of(r)));
+      } else if (bothDouble(l, r)) {
+        regs[in.a].setDouble(doubleOf(l) * doubleOf(r));
+      } else {
+        regs[in.a] = ValueHelper::multiply(l.view(lhs), r.view(rhs));
+      }
+      break;
+    }
+
+    case OpCode::DIVIDE: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      if (bothInt32(l, r) && int32Of(r) != 0) {
+        regs[in.a].setInt32(static_cast<int32_t>(int32Of(l) / int32Of(r)));
+      } else {
+        regs[in.a] = ValueHelper::divide(l.view(lhs), r.view(rhs));
+      }
+      break;
+    }
+
+    case OpCode::MODULO: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      if (bothInt32(l, r) && int32Of(r) != 0) {
+        regs[in.a].setInt32(static_cast<int32_t>(int32Of(l) % int32Of(r)));
+      } else {
+        regs[in.a] = ValueHelper::modulo(l.view(lhs), r.view(rhs));
+      }
+      break;
+    }
+
+    case OpCode::EQUAL: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      regs[in.a].setBool(
+          bothInt32(l, r)
+              ? int32Of(l) == int32Of(r)
+              : ValueHelper::equals(l.view(lhs), r.view(rhs)));
+      break;
+    }
+
+    case OpCode::NOT_EQUAL: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      regs[in.a].setBool(
+          bothInt32(l, r)
+              ? int32Of(l) != int32Of(r)
+              : ValueHelper::notEquals(l.view(lhs), r.view(rhs)));
+      break;
+    }
+
+    case OpCode::LESS_THAN: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      regs[in.a].setBool(
+          bothInt32(l, r)
+              ? int32Of(l) < int32Of(r)
+              : ValueHelper::lessThan(l.view(lhs), r.view(rhs)));
+      break;
+    }
+
+    case OpCode::GREATER_THAN: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      regs[in.a].setBool(
+          bothInt32(l, r)
+              ? int32Of(l) > int32Of(r)
+              : ValueHelper::greaterThan(l.view(lhs), r.view(rhs)));
+      break;
+    }
+
+    case OpCode::LESS_EQUAL: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      regs[in.a].setBool(
+          bothInt32(l, r)
+              ? int32Of(l) <= int32Of(r)
+              : ValueHelper::lessOrEqual(l.view(lhs), r.view(rhs)));
+      break;
+    }
+
+    case OpCode::GREATER_EQUAL: {
+      const CompactValue &l = regs[in.b];
+      const CompactValue &r = regs[in.c];
+      regs[in.a].setBool(
+          bothInt32(l, r)
+              ? int32Of(l) >= int32Of(r)
+              : ValueHelper::greaterOrEqual(l.view(lhs), r.view(rhs)));
+      break;
+    }
+
+    case OpCode::BIT_AND:
+      regs[in.a] =
+          ValueHelper::bitAnd(regs[in.b].view(lhs), regs[in.c].view(rhs));
+      break;
+
+    case OpCode::BIT_OR:
+      regs[in.a] =
+          ValueHelper::bitOr(regs[in.b].view(lhs), regs[in.c].view(rhs));
+      break;
+
+    case OpCode::BIT_XOR:
+      regs[in.a] =
+          ValueHelper::bitXor(regs[in.b].view(lhs), regs[in.c].view(rhs));
+      break;
+
+    case OpCode::LSHIFT:
+      regs[in.a] =
+          ValueHelper::lshift(regs[in.b].view(lhs), regs[in.c].view(rhs));
+      break;
+
+    case OpCode::RSHIFT:
+      regs[in.a] =
+          ValueHelper::rshift(regs[in.b].view(lhs), regs[in.c].view(rhs));
+      break;
+
+    case OpCode::NEGATE:
+      regs[in.a] = ValueHelper::negate(regs[in.b].view(rhs));
+      break;
+
+    case OpCode::LOGICAL_NOT:
+      regs[in.a].setBool(!truthy(regs[in.b]));
+      break;
+
+    case OpCode::BIT_NOT:
+      regs[in.a] = ValueHelper::bitNot(regs[in.b].view(rhs));
+      break;
+
+    case OpCode::TO_BOOL:
+      regs[in.a].setBool(truthy(regs[in.b]));
+      break;
+
+    case OpCode::JUMP:
+      ip = base + in.a;
+      break;
+
+    case OpCode::JUMP_IF_FALSE:
+      if (!truthy(regs[in.a])) {
+        ip = base + in.b;
+      }
+      break;
+
+    case OpCode::JUMP_IF_TRUE:
+      if (truthy(regs[in.a])) {
+        ip = base + in.b;
+      }
+      break;
+
+    case OpCode::OWN_ARRAY:
+      if (regs[in.a].isArray() && regs[in.a].array() &&
+          regs[in.a].array()->hostOwned()) {
+        regs[in.a] = ValueHelper::ownedByScript(regs[in.a].toValue());
+      }
+      break;
+
+    case OpCode::CHECK_ARRAY:
+      if (!ValueHelper::isArray(regs[in.a].view(rhs))) {
+        throw error(code.names[in.b], in);
+      }
+      if (in.c) {
+        regs[in.a].mutableArray();
+      }
+      break;
+
+    case OpCode::INDEX: {
+      const Value &index = regs[in.c].view(rhs);
+      uint64_t idx = ValueHelper::toUInt64(index);
+      const Value &array = regs[in.b].view(lhs);
+      const ArrayValue &elems = ValueHelper::arrayValue(array);
+      if (idx >= elems.length()) {
+        throw error("Array index out of bounds", in);
+      }
+      Value element = elems.rank() > 1
+                          ? ValueHelper::indexArray(array, &index, 1)
+                          : elems.get(idx);
+      regs[in.a] = std::move(element);
+      break;
+    }
+
+    case OpCode::CHECK_INDEX: {
+      const ArrayValue &elems = ValueHelper::arrayValue(regs[in.a].view(lhs));
+      if (elems.rank() > 1) {
+        throw error("Index assignment needs " + std::to_string(elems.rank()) +
+                        " indices",
+                    in);
+      }
+      uint64_t idx = ValueHelper::toUInt64(regs[in.b].view(rhs));
+      if (idx >= elems.size()) {
+        throw error("Array index out of bounds", in);
+      }
+      break;
+    }
+
+    case OpCode::STORE_INDEX: {
+      uint64_t idx = ValueHelper::toUInt64(regs[in.b].view(rhs));
+      const Value &array = regs[in.a].view(lhs);
+      TypeInfo elementType = ValueHelper::arrayElementType(array);
+      Value converted =
+          interp.convertToType(regs[in.c].view(rhs), elementType);
+      ArrayValue &elems = ValueHelper::arrayValue(array);
+      if (idx >= elems.size()) {
+        throw error("Array index out of bounds", in);
+      }
+      elems.set(idx, std::move(converted));
+      break;
+    }
+
+    case OpCode::INDEX_ND: {
+      std::vector<Value> indices =
+          valuesOf(&regs[in.b + 1], static_cast<size_t>(in.c));
+      Value element;
+      try {
+        element = ValueHelper::indexArray(regs[in.b].view(lhs), indices.data(),
+                                          indices.size());
+      } catch (const std::runtime_error &e) {
+        throw error(e.what(), in);
+      }
+      regs[in.a] = std::move(element);
+      break;
+    }
+
+    case OpCode::STORE_INDEX_ND: {
+      const Value &array = regs[in.a].view(lhs);
+      TypeInfo elementType = ValueHelper::arrayElementType(array);
+      Value converted =
+          interp.convertToType(regs[in.c].view(rhs), elementType);
+      ArrayValue &elems = ValueHelper::arrayValue(array);
+      std::vector<Value> indices =
+          valuesOf(&regs[in.b], static_cast<size_t>(in.c - in.b));
+      try {
+        elems.set(ValueHelper::elementOffset(elems, indices.data(),
+                                             indices.size()),
+                  std::move(converted));
+      } catch (const std::runtime_error &e) {
+        throw error(e.what(), in);
+      }
+      break;
+    }
+
+    case OpCode::LEN: {
+      const Value &value = regs[in.b].view(rhs);
+      if (ValueHelper::isMap(value)) {
+        auto size = static_cast<int64_t>(ValueHelper::mapValue(value).size());
+        regs[in.a] = ValueHelper::createValue(DataType::INT32, size);
+        break;
+      }
+      if (!ValueHelper::isArray(value)) {
+        throw error("len expects an array or map", in);
+      }
+      auto size = static_cast<int64_t>(ValueHelper::arrayValue(value).length());
+      regs[in.a] = ValueHelper::createValue(DataType::INT32, size);
+      break;
+    }
+
+    case OpCode::PUSH: {
+      const Value &array = regs[in.b].view(lhs);
+      TypeInfo elementType = ValueHelper::arrayElementType(array);
+      Value converted =
+          interp.convertToType(regs[in.c].view(rhs), elementType);
+      ArrayValue &elems = ValueHelper::arrayValue(array);
+      elems.push(std::move(converted));
+      regs[in.a] = ValueHelper::createValue(
+          DataType::INT32, static_cast<int64_t>(elems.size()));
+      break;
+    }
+
+    case OpCode::POP: {
+      const Value &array = regs[in.b].view(lhs);
+      if (!ValueHelper::isArray(array)) {
+        throw error("pop expects an array", in);
+      }
+      ArrayValue &elems = ValueHelper::arrayValue(array);
+      if (elems.empty()) {
+        throw error("Cannot pop from empty array", in);
+      }
+      regs[in.a] = elems.pop();
+      break;
+    }
+
+    case OpCode::GET_FIELD: {
+      const Value &object = regs[in.b].view(lhs);
+      if (!ValueHelper::isRecord(object)) {
+        throw error("Field access on non-record value", in);
+      }
+      const FieldSite &site = code.fields[in.c];
+      const RecordValue &record = ValueHelper::recordValue(object);
+      Value value;
+      try {
+        value = record.field(record.fieldIndex(
+            site.name, site.structType.get(), site.index));
+      } catch (const std::runtime_error &e) {
+        throw error(e.what(), in);
+      }
+      regs[in.a] = std::move(value);
+      break;
+    }
+
+    case OpCode::UNSHARE_FIELD: {
+      const FieldSite &site = code.fields[in.c];
+      RecordValue &record = ValueHelper::recordValue(regs[in.b].view(lhs));
+      Value &slot = record.fieldSlot(
+          record.fieldIndex(site.name, site.structType.get(), site.index));
+      regs[in.a] = CompactValue(); // so an unshared field is not copied
+      try {
+        ValueHelper::mutableArray(slot);
+      } catch (const std::runtime_error &e) {
+        throw error(e.what(), in);
+      }
+      regs[in.a] = slot;
+      break;
+    }
+
+    case OpCode::SET_FIELD: {
+      const Value &object = regs[in.a].view(lhs);
+      if (!ValueHelper::isRecord(object)) {
+        throw error("Field assignment on non-record value", in);
+      }
+      const FieldSite &site = code.fields[in.b];
+      RecordValue &record = ValueHelper::recordValue(object);
+      size_t slot;
+      try {
+        slot = record.fieldIndex(site.name, site.structType.get(), site.index);
+      } catch (const std::runtime_error &e) {
+        throw error(e.what(), in);
+      }
+      record.setField(slot,
+                      interp.convertToType(regs[in.c].view(rhs),
+                                           record.type()->fieldTypes[slot]));
+      break;
+    }
+
+    case OpCode::CALL: {
+      Value result =
+          call(code.callSites[in.b], &regs[in.c], code.positions[ip - 1 - base]);
+      regs[in.a] = std::move(result);
+      break;
+    }
+
+    case OpCode::INLINED: {
+      CallSite &site = code.callSites[in.a];
+      resolve(site);
+      if (!site.isInlined) {
+        ip = base + in.b;
+      }
+      break;
+    }
+
+    case OpCode::RETURN:
+      interp._currentProcedure = "";
+      if (proc.returnType.baseType == DataType::VOID &&
+          !proc.returnType.isArray) {
+        return static_cast<int32_t>(0); // Dummy value
+      }
+      if (proc.returnsTyped &&
+          !ValueHelper::needsConversion(regs[in.a].view(rhs),
+                                        proc.returnType)) {
+        return regs[in.a].take();
+      }
+      return interp.convertToType(regs[in.a].view(rhs), proc.returnType);
+
+    case OpCode::RETURN_NONE:
+      interp._currentProcedure = "";
+      if (proc.returnType.baseType == DataType::VOID &&
+          !proc.returnType.isArray) {
+        return static_cast<int32_t>(0); // Dummy value
+      }
+      throw interp.runtimeError("Non-void procedure must return a value",
+                                proc.line, proc.column);
+
+    case OpCode::RAISE:
+      throw error(code.names[in.a], in);
+    }
+  }
+}
+
+Value VirtualMachine::call(CallSite &site, CompactValue *arguments,
+                           const SourcePosition &position) {
+  Interpreter &interp = _interpreter;
+  resolve(site);
+  if (site.builtin) {
+    // Builtins read the argument registers in place; they are cleared
+    // afterwards so an array passed in is not left shared
+    struct Clear {
+      CompactValue *arguments;
+      uint32_t count;
+      ~Clear() {
+        for (uint32_t i = 0; i < count; ++i) {
+          arguments[i] = CompactValue();
+        }
+      }
+    } clear{arguments, site.argumentCount};
+    return interp.callBuiltin(site.builtin, arguments, site.argumentCount,
+                              position.line, position.column);
+  }
+
+  std::vector<CompactValue> args(
+      std::make_move_iterator(arguments),
+      std::make_move_iterator(arguments + site.argumentCount));
+  if (site.isProcedure) {
+    if (auto proc = site.procedure.lock()) {
+      return interp.executeChecked(proc, args, site.isChecked,
+                                   site.argumentsTyped);
+    }
+  } else if (site.external) {
+    return site.external(CompactValue::toValues(args));
+  }
+
+  throw interp.runtimeError("Undefined function: " + site.name, position.line,
+                            position.column);
+}
+
+void VirtualMachine::resolve(CallSite &site) {
+  Interpreter &interp = _interpreter;
+  if (site.cacheVersion == interp._callCacheVersion) {
+    return;
+  }
+  site.cacheVersion = interp._callCacheVersion;
+  site.isProcedure = false;
+  site.isChecked = false;
+  site.isInlined = false;
+  site.procedure.reset();
+  site.external = nullptr;
+  site.builtin = nullptr;
+
+  if (auto it = interp._procedures.find(site.name);
+      it != interp._procedures.end()) {
+    site.isProcedure = true;
+    site.procedure = it->second;
+    site.isChecked = site.checkedProcedure.lock() == it->second;
+    site.isInlined = site.inlinedProcedure.lock() == it->second;
+    return;
+  }
+
+  auto extIt = interp._externalFunctions.find(site.name);
+  if (extIt != interp._externalFunctions.end()) {
+    site.external = extIt->second;
+    return;
+  }
+
+  site.builtin = Interpreter::findBuiltin(site.name);
+}
+
+} // namespace Script
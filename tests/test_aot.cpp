@@ -0,0 +1,196 @@
+#include "AotTranslator.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+const char *VALIDATION_SCRIPT = "scripts/test_files/validation_rules.script";
+const char *NUMERIC_SCRIPT = "scripts/test_files/numeric_rules.script";
+
+// Runs a procedure from the script on the interpreter and from the native
+// module, and checks results (including their runtime type) and error
+// messages agree.
+void expectSameAsInterpreter(const std::string &script,
+                             const std::string &module,
+                             const std::string &proc,
+                             const std::vector<Value> &args) {
+  ScriptManager interpreted;
+  ScriptManager native;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(interpreted.loadScriptFile(script, errors));
+  ASSERT_TRUE(native.loadNativeModule(module, errors))
+      << (errors.empty() ? "" : errors[0].toString());
+
+  Value expected, actual;
+  std::string expectedError, actualError;
+  bool expectedOk =
+      interpreted.executeProcedure(proc, args, expected, expectedError);
+  bool actualOk = native.executeProcedure(proc, args, actual, actualError);
+
+  ASSERT_EQ(expectedOk, actualOk) << proc << ": " << expectedError
+                                  << actualError;
+  if (!expectedOk) {
+    EXPECT_EQ(expectedError, actualError) << proc;
+    return;
+  }
+  EXPECT_EQ(expected.index(), actual.index()) << proc;
+  EXPECT_TRUE(ValueHelper::equals(expected, actual))
+      << proc << ": " << ValueHelper::toString(expected) << " vs "
+      << ValueHelper::toString(actual);
+}
+
+ScriptPtr resolvedScript(const std::string &source) {
+  return parseAndResolve(source, "aot.script");
+}
+
+} // namespace
+
+TEST(AotTest, NativeProceduresReplaceScriptProcedures) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptFile(VALIDATION_SCRIPT, errors));
+  ASSERT_TRUE(manager.loadNativeModule(AOT_VALIDATION_MODULE, errors));
+
+  ScriptManager::ProcedureInfo info;
+  ASSERT_TRUE(manager.getProcedureInfo("isValidAge", info));
+  EXPECT_EQ(info.filename, AOT_VALIDATION_MODULE);
+  ASSERT_EQ(info.parameters.size(), 1u);
+  EXPECT_EQ(info.parameters[0].name, "age");
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("isValidAge", {static_cast<int32_t>(30)},
+                                       result, errorMsg))
+      << errorMsg;
+  EXPECT_TRUE(std::get<bool>(result));
+  ASSERT_TRUE(manager.executeProcedure("isValidAge", {static_cast<int32_t>(17)},
+                                       result, errorMsg));
+  EXPECT_FALSE(std::get<bool>(result));
+
+  // Procedures the translator skipped still run on the interpreter
+  ASSERT_TRUE(manager.getProcedureInfo("isValidUsername", info));
+  EXPECT_EQ(info.filename, VALIDATION_SCRIPT);
+  ASSERT_TRUE(manager.executeProcedure("getAgeValidationMessage",
+                                       {static_cast<int32_t>(150)}, result,
+                                       errorMsg));
+  EXPECT_EQ(std::get<std::string>(result), "Invalid age: too old");
+}
+
+TEST(AotTest, ResultsMatchInterpreter) {
+  for (int32_t age : {-5, 0, 17, 18, 64, 120, 121}) {
+    expectSameAsInterpreter(VALIDATION_SCRIPT, AOT_VALIDATION_MODULE,
+                            "isValidAge", {age});
+  }
+  // Arguments are converted to the parameter types like the interpreter does
+  expectSameAsInterpreter(VALIDATION_SCRIPT, AOT_VALIDATION_MODULE,
+                          "isValidAge", {19.9});
+  expectSameAsInterpreter(VALIDATION_SCRIPT, AOT_VALIDATION_MODULE,
+                          "isValidAge", {std::string("twenty")});
+
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "checksum",
+                          {static_cast<int32_t>(1000)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "score",
+                          {static_cast<int32_t>(25)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "mixed",
+                          {static_cast<int32_t>(-123457),
+                           static_cast<int64_t>(5000000000), 2.5, true});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "mixed",
+                          {static_cast<int32_t>(99), static_cast<int64_t>(-7),
+                           0.25, false});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "compare",
+                          {std::nan(""), 1.0});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "compare",
+                          {0.0, -1.0});
+  for (int32_t x : {-3, 5, 100}) {
+    expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "inRange",
+                            {x});
+  }
+}
+
+TEST(AotTest, RuntimeErrorsMatchInterpreter) {
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "divide",
+                          {static_cast<int32_t>(7), static_cast<int32_t>(0)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "divide",
+                          {static_cast<int32_t>(INT32_MIN),
+                           static_cast<int32_t>(-1)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "remainder",
+                          {static_cast<int64_t>(7), static_cast<int32_t>(0)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "remainder",
+                          {static_cast<int64_t>(-7), static_cast<int32_t>(3)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "sign",
+                          {static_cast<int32_t>(0)});
+  expectSameAsInterpreter(NUMERIC_SCRIPT, AOT_NUMERIC_MODULE, "sign",
+                          {static_cast<int32_t>(1), static_cast<int32_t>(2)});
+}
+
+TEST(AotTest, ScriptsCanCallNativeProcedures) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadNativeModule(AOT_NUMERIC_MODULE, errors));
+  ASSERT_TRUE(manager.loadScriptSource(R"(
+        int32 clamped(int32 x) {
+            if (inRange(x)) { return divide(x, 2); }
+            return 0;
+        }
+    )",
+                                       "caller.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("clamped", {static_cast<int32_t>(42)},
+                                       result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 21);
+}
+
+TEST(AotTest, RejectsMismatchedSignatures) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(
+      "int64 divide(int64 a, int64 b) { return a / b; }", "other.script",
+      errors));
+
+  EXPECT_FALSE(manager.loadNativeModule(AOT_NUMERIC_MODULE, errors));
+  ASSERT_FALSE(errors.empty());
+  EXPECT_EQ(errors[0].procedureName, "divide");
+
+  // Nothing from the module was registered
+  EXPECT_FALSE(manager.hasProcedure("checksum"));
+
+  EXPECT_FALSE(manager.loadNativeModule("does_not_exist.so", errors));
+  EXPECT_EQ(errors.size(), 1u);
+}
+
+TEST(AotTest, TranslatorSkipsUnsupportedProcedures) {
+  ScriptPtr script = resolvedScript(R"(
+        int32 helper(int32 x) { return x + 1; }
+        int32 calls(int32 x) { return helper(x) * 2; }
+        int32 arrays(int32 x) { int32[] a = [x, 2]; return a[0]; }
+        int32 usesArrays(int32 x) { return arrays(x); }
+        int32 external(int32 x) { return x + offset; }
+        string text(int32 x) { return "x"; }
+    )");
+
+  AotTranslator translator;
+  std::string source = translator.translate(*script);
+
+  EXPECT_EQ(translator.translated(),
+            (std::vector<std::string>{"helper", "calls"}));
+  std::vector<std::string> skipped;
+  for (const auto &entry : translator.skipped()) {
+    EXPECT_FALSE(entry.reason.empty()) << entry.procedure;
+    skipped.push_back(entry.procedure);
+  }
+  std::sort(skipped.begin(), skipped.end());
+  EXPECT_EQ(skipped, (std::vector<std::string>{"arrays", "external", "text",
+                                               "usesArrays"}));
+
+  EXPECT_NE(source.find("cxxscript_module"), std::string::npos);
+  EXPECT_NE(source.find("proc_helper("), std::string::npos);
+}
@@ -0,0 +1,220 @@
+#include "ArrayArithmetic.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+#include <limits>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+const ElementwiseOp OPS[] = {
+    ElementwiseOp::ADD,        ElementwiseOp::SUBTRACT,
+    ElementwiseOp::MULTIPLY,   ElementwiseOp::DIVIDE,
+    ElementwiseOp::MODULO,     ElementwiseOp::BIT_AND,
+    ElementwiseOp::BIT_OR,     ElementwiseOp::BIT_XOR,
+    ElementwiseOp::SHIFT_LEFT, ElementwiseOp::SHIFT_RIGHT};
+
+Value scalar(ElementwiseOp op, const Value &a, const Value &b) {
+  switch (op) {
+  case ElementwiseOp::ADD:
+    return ValueHelper::add(a, b);
+  case ElementwiseOp::SUBTRACT:
+    return ValueHelper::subtract(a, b);
+  case ElementwiseOp::MULTIPLY:
+    return ValueHelper::multiply(a, b);
+  case ElementwiseOp::DIVIDE:
+    return ValueHelper::divide(a, b);
+  case ElementwiseOp::MODULO:
+    return ValueHelper::modulo(a, b);
+  case ElementwiseOp::BIT_AND:
+    return ValueHelper::bitAnd(a, b);
+  case ElementwiseOp::BIT_OR:
+    return ValueHelper::bitOr(a, b);
+  case ElementwiseOp::BIT_XOR:
+    return ValueHelper::bitXor(a, b);
+  case ElementwiseOp::SHIFT_LEFT:
+    return ValueHelper::lshift(a, b);
+  case ElementwiseOp::SHIFT_RIGHT:
+    return ValueHelper::rshift(a, b);
+  }
+  return Value();
+}
+
+// Three elements of the type, including its extremes; shifts stay in range
+Value sampleArray(DataType type, bool forShift) {
+  bool isUnsigned = type == DataType::UINT8 || type == DataType::UINT16 ||
+                    type == DataType::UINT32 || type == DataType::UINT64;
+  // createValue(type, int64_t) only builds the signed types
+  auto make = [&](int64_t x) {
+    return isUnsigned ? ValueHelper::createValue(type, static_cast<uint64_t>(x))
+                      : ValueHelper::createValue(type, x);
+  };
+  std::vector<Value> values;
+  if (forShift) {
+    values = {make(1), make(3), make(7)};
+  } else if (type == DataType::DOUBLE) {
+    values = {-2.5, 0.5, 1e300};
+  } else {
+    values = {make(-1), make(7),
+              make(isUnsigned ? -2 : std::numeric_limits<int64_t>::min())};
+  }
+  return ValueHelper::createArray(TypeInfo(type), values);
+}
+
+// Applies the scalar operator to each pair, or returns its first error
+Value elementwiseReference(ElementwiseOp op, const Value &a, const Value &b) {
+  bool left = ValueHelper::isArray(a);
+  bool right = ValueHelper::isArray(b);
+  size_t n = left ? ValueHelper::arrayValue(a).size()
+                  : ValueHelper::arrayValue(b).size();
+  std::vector<Value> out;
+  for (size_t i = 0; i < n; ++i) {
+    out.push_back(scalar(op, left ? ValueHelper::arrayValue(a).get(i) : a,
+                         right ? ValueHelper::arrayValue(b).get(i) : b));
+  }
+  return ValueHelper::createArray(ValueHelper::getType(out[0]), out);
+}
+
+std::string describe(ElementwiseOp op, const Value &a, const Value &b) {
+  auto name = [](const Value &v) {
+    return ValueHelper::isArray(v)
+               ? ValueHelper::typeToString(ValueHelper::getType(v))
+               : ValueHelper::typeToString(ValueHelper::getType(v)) + " " +
+                     ValueHelper::toString(v);
+  };
+  return name(a) + " " + ArrayArithmetic::symbol(op) + " " + name(b);
+}
+
+void expectMatchesReference(ElementwiseOp op, const Value &a, const Value &b) {
+  std::string context = describe(op, a, b);
+  Value expected, actual;
+  std::string expectedError, actualError;
+  try {
+    expected = elementwiseReference(op, a, b);
+  } catch (const std::exception &e) {
+    expectedError = e.what();
+  }
+  try {
+    actual = ArrayArithmetic::apply(op, a, b);
+  } catch (const std::exception &e) {
+    actualError = e.what();
+  }
+  ASSERT_EQ(expectedError, actualError) << context;
+  if (!expectedError.empty()) {
+    return;
+  }
+
+  const ArrayValue &e = ValueHelper::arrayValue(expected);
+  const ArrayValue &r = ValueHelper::arrayValue(actual);
+  EXPECT_EQ(e.elementType(), r.elementType()) << context;
+  EXPECT_TRUE(r.isTyped()) << context;
+  ASSERT_EQ(e.size(), r.size()) << context;
+  for (size_t i = 0; i < e.size(); ++i) {
+    EXPECT_TRUE(e.get(i) == r.get(i))
+        << context << " [" << i << "]: " << ValueHelper::toString(e.get(i))
+        << " vs " << ValueHelper::toString(r.get(i));
+  }
+}
+
+} // namespace
+
+TEST(ArrayArithmeticTest, TypedArraysMatchScalarOperators) {
+  const DataType types[] = {DataType::INT8,   DataType::UINT8,
+                            DataType::INT16,  DataType::UINT16,
+                            DataType::INT32,  DataType::UINT32,
+                            DataType::INT64,  DataType::UINT64,
+                            DataType::DOUBLE};
+  for (ElementwiseOp op : OPS) {
+    bool shift = op == ElementwiseOp::SHIFT_LEFT ||
+                 op == ElementwiseOp::SHIFT_RIGHT;
+    for (DataType ta : types) {
+      for (DataType tb : types) {
+        Value a = sampleArray(ta, shift);
+        Value b = sampleArray(tb, shift);
+        expectMatchesReference(op, a, b);
+        // Broadcasting the first element, on either side
+        expectMatchesReference(op, a, ValueHelper::arrayValue(b).get(1));
+        expectMatchesReference(op, ValueHelper::arrayValue(a).get(1), b);
+      }
+    }
+  }
+}
+
+TEST(ArrayArithmeticTest, ReportsShapeAndTypeErrors) {
+  Value ints = ValueHelper::createArray(
+      TypeInfo(DataType::INT32),
+      {static_cast<int32_t>(4), static_cast<int32_t>(0)});
+  Value one = ValueHelper::createArray(TypeInfo(DataType::INT32),
+                                       {static_cast<int32_t>(1)});
+  Value words = ValueHelper::createArray(TypeInfo(DataType::STRING),
+                                         {std::string("a")});
+
+  EXPECT_EQ(errorOf([&] { return ValueHelper::add(ints, one); }),
+            "Operator + needs arrays of the same length");
+  EXPECT_EQ(errorOf([&] { return ValueHelper::add(words, words); }),
+            "Operator + only supports numeric arrays");
+  EXPECT_EQ(errorOf([&] { return ValueHelper::add(ints, std::string("x")); }),
+            "Operator + only supports numeric arrays");
+  EXPECT_EQ(errorOf([&] { return ValueHelper::divide(ints, ints); }),
+            "Division by zero");
+  EXPECT_EQ(errorOf([&] { return ValueHelper::bitAnd(ints, 1.5); }),
+            "Operator & only supports integers");
+
+  // Empty arrays never divide
+  Value empty = ValueHelper::createArray(TypeInfo(DataType::INT32), {});
+  EXPECT_EQ(ValueHelper::arrayValue(ValueHelper::modulo(empty, 0)).size(), 0u);
+}
+
+TEST(ArrayArithmeticTest, MixedArraysPromoteEachPair) {
+  // Typed by the first element, so the double stays a double
+  Value mixed = ValueHelper::createArray(
+      TypeInfo(DataType::INT32), {static_cast<int32_t>(3), 1.5});
+  Value result = ValueHelper::multiply(mixed, static_cast<int32_t>(2));
+  const ArrayValue &out = ValueHelper::arrayValue(result);
+  EXPECT_EQ(out.elementType(), DataType::INT32);
+  EXPECT_EQ(std::get<int32_t>(out.get(0)), 6);
+  EXPECT_DOUBLE_EQ(std::get<double>(out.get(1)), 3.0);
+
+  // Operands are never modified
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(mixed).get(0)), 3);
+}
+
+TEST(ArrayArithmeticTest, ScriptsUseWholeArrayExpressions) {
+  const char *source = R"(
+        double scaled(int32 n) {
+            double[] xs = [];
+            for (int32 i = 0; i < n; i += 1) {
+                push(xs, i);
+            }
+            double lo = min(xs);
+            double[] unit = (xs - lo) / (max(xs) - lo);
+            unit = unit * 2.0 - 1;
+            return sum(unit) + unit[0] * 10 + unit[n - 1] * 100;
+        }
+        int64 masked() {
+            int32[] values = [257, 258, 511];
+            int32[] low = values & 255;
+            int32[] total = low + [1, 2, 3];
+            total += total;
+            return total[0] * 10000 + total[1] * 100 + total[2];
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "vector.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("scaled", {static_cast<int32_t>(5)},
+                                       result, errorMsg))
+      << errorMsg;
+  // unit = [-1, -0.5, 0, 0.5, 1]
+  EXPECT_DOUBLE_EQ(std::get<double>(result), 0.0 - 10 + 100);
+
+  ASSERT_TRUE(manager.executeProcedure("masked", {}, result, errorMsg))
+      << errorMsg;
+  // low = [1, 2, 255], total = 2 * [2, 4, 258]
+  EXPECT_EQ(std::get<int64_t>(result), 4 * 10000 + 8 * 100 + 516);
+}
@@ -0,0 +1,262 @@
+#include "ArrayBuiltins.h"
+#include "ScriptManager.h"
+#include <cmath>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+using namespace Script;
+
+namespace {
+
+// Restores the process-wide SIMD level when a test ends
+class SimdLevelGuard {
+public:
+  SimdLevelGuard() : _saved(ArrayBuiltins::simdLevel()) {}
+  ~SimdLevelGuard() { ArrayBuiltins::setSimdLevel(_saved); }
+
+private:
+  SimdLevel _saved;
+};
+
+std::vector<SimdLevel> availableLevels() {
+  std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+  for (SimdLevel level : {SimdLevel::SSE2, SimdLevel::AVX2}) {
+    if (level <= ArrayBuiltins::detectedSimdLevel()) {
+      levels.push_back(level);
+    }
+  }
+  return levels;
+}
+
+Value call(const std::string &name, const std::vector<Value> &args) {
+  return ArrayBuiltins::call(name, args);
+}
+
+// Pseudo-random elements with repeats, negatives and the type's extremes
+template <typename T> Value makeArray(DataType type, size_t n, uint32_t seed) {
+  std::vector<Value> values;
+  for (size_t i = 0; i < n; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    T x;
+    if constexpr (std::is_floating_point_v<T>) {
+      x = static_cast<T>(static_cast<int32_t>(seed >> 8) % 200) / 4;
+    } else {
+      x = static_cast<T>(static_cast<int32_t>(seed >> 16) % 7 - 3);
+      if (seed % 11 == 0) {
+        x = std::numeric_limits<T>::max();
+      } else if (seed % 13 == 0) {
+        x = std::numeric_limits<T>::min();
+      }
+    }
+    values.push_back(x);
+  }
+  return ValueHelper::createArray(TypeInfo(type), values);
+}
+
+// The builtins spelled out with ValueHelper operations, one element at a time
+Value referenceSum(const std::vector<Value> &elements, const Value &zero) {
+  Value total = zero;
+  for (const auto &e : elements) {
+    total = ValueHelper::add(total, e);
+  }
+  return total;
+}
+
+Value referenceExtreme(const std::vector<Value> &elements, bool max) {
+  Value m = elements[0];
+  for (const auto &e : elements) {
+    if (max ? ValueHelper::greaterThan(e, m) : ValueHelper::lessThan(e, m)) {
+      m = e;
+    }
+  }
+  return m;
+}
+
+int32_t referenceSearch(const std::vector<Value> &elements,
+                        const Value &needle, bool first) {
+  int32_t count = 0;
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (ValueHelper::equals(elements[i], needle)) {
+      if (first) {
+        return static_cast<int32_t>(i);
+      }
+      ++count;
+    }
+  }
+  return first ? -1 : count;
+}
+
+void expectSame(const Value &expected, const Value &actual,
+                const std::string &context) {
+  ASSERT_EQ(expected.index(), actual.index()) << context;
+  if (std::holds_alternative<double>(expected)) {
+    double e = std::get<double>(expected);
+    EXPECT_NEAR(e, std::get<double>(actual), 1e-9 * (1 + std::fabs(e)))
+        << context;
+  } else {
+    EXPECT_TRUE(ValueHelper::equals(expected, actual))
+        << context << ": " << ValueHelper::toString(expected) << " vs "
+        << ValueHelper::toString(actual);
+  }
+}
+
+template <typename T> void checkKernels(DataType type, const Value &zero) {
+  for (size_t n = 0; n < 40; ++n) {
+    Value array = makeArray<T>(type, n, static_cast<uint32_t>(n) + 7);
+    Value other = makeArray<T>(type, n, static_cast<uint32_t>(n) + 99);
+    std::vector<Value> elements = ValueHelper::arrayElements(array);
+    std::string context = ValueHelper::typeToString(TypeInfo(type)) + "[" +
+                          std::to_string(n) + "] at " +
+                          ArrayBuiltins::simdLevelName(
+                              ArrayBuiltins::simdLevel());
+
+    expectSame(referenceSum(elements, zero), call("sum", {array}),
+               "sum " + context);
+    if (n > 0) {
+      expectSame(referenceExtreme(elements, false), call("min", {array}),
+                 "min " + context);
+      expectSame(referenceExtreme(elements, true), call("max", {array}),
+                 "max " + context);
+    }
+
+    std::vector<Value> needles = {static_cast<int32_t>(-3),
+                                  static_cast<int32_t>(0), 2.0, 2.5,
+                                  static_cast<int64_t>(1) << 40, true};
+    if (n > 0) {
+      needles.push_back(elements[n - 1]);
+    }
+    for (const auto &needle : needles) {
+      std::string what = context + " needle " + ValueHelper::toString(needle);
+      EXPECT_EQ(referenceSearch(elements, needle, false),
+                std::get<int32_t>(call("count_if_eq", {array, needle})))
+          << "count_if_eq " << what;
+      EXPECT_EQ(referenceSearch(elements, needle, true),
+                std::get<int32_t>(call("index_of", {array, needle})))
+          << "index_of " << what;
+    }
+
+    if constexpr (std::is_same_v<T, int32_t> || std::is_same_v<T, double>) {
+      std::vector<Value> right = ValueHelper::arrayElements(other);
+      Value expected = zero;
+      for (size_t i = 0; i < n; ++i) {
+        Value product = std::is_same_v<T, double>
+                            ? Value(ValueHelper::toDouble(elements[i]) *
+                                    ValueHelper::toDouble(right[i]))
+                            : Value(ValueHelper::toInt64(elements[i]) *
+                                    ValueHelper::toInt64(right[i]));
+        expected = ValueHelper::add(expected, product);
+      }
+      expectSame(expected, call("dot", {array, other}), "dot " + context);
+    }
+  }
+}
+
+} // namespace
+
+TEST(ArrayBuiltinsTest, KernelsMatchElementwiseSemanticsAtEveryLevel) {
+  SimdLevelGuard guard;
+  for (SimdLevel level : availableLevels()) {
+    ArrayBuiltins::setSimdLevel(level);
+    ASSERT_EQ(ArrayBuiltins::simdLevel(), level);
+    checkKernels<int32_t>(DataType::INT32, static_cast<int64_t>(0));
+    checkKernels<int64_t>(DataType::INT64, static_cast<int64_t>(0));
+    checkKernels<double>(DataType::DOUBLE, 0.0);
+    checkKernels<uint8_t>(DataType::UINT8, static_cast<uint64_t>(0));
+    checkKernels<uint64_t>(DataType::UINT64, static_cast<uint64_t>(0));
+    checkKernels<int16_t>(DataType::INT16, static_cast<int64_t>(0));
+  }
+}
+
+TEST(ArrayBuiltinsTest, SetSimdLevelClampsToTheCpu) {
+  SimdLevelGuard guard;
+  ArrayBuiltins::setSimdLevel(SimdLevel::AVX2);
+  EXPECT_EQ(ArrayBuiltins::simdLevel(), ArrayBuiltins::detectedSimdLevel());
+  ArrayBuiltins::setSimdLevel(SimdLevel::SCALAR);
+  EXPECT_EQ(ArrayBuiltins::simdLevel(), SimdLevel::SCALAR);
+  EXPECT_STREQ(ArrayBuiltins::simdLevelName(SimdLevel::SSE2), "sse2");
+}
+
+TEST(ArrayBuiltinsTest, SimdLevelChangesWhileKernelsRun) {
+  SimdLevelGuard guard;
+  Value values = makeArray<int32_t>(DataType::INT32, 1000, 7);
+  Value expected = call("sum", {values});
+
+  std::atomic<bool> done{false};
+  std::thread switcher([&] {
+    std::vector<SimdLevel> levels = availableLevels();
+    for (size_t i = 0; !done; ++i) {
+      ArrayBuiltins::setSimdLevel(levels[i % levels.size()]);
+    }
+  });
+  for (int i = 0; i < 2000; ++i) {
+    ASSERT_EQ(call("sum", {values}), expected);
+  }
+  done = true;
+  switcher.join();
+}
+
+TEST(ArrayBuiltinsTest, MixedArraysUseGenericRules) {
+  // A literal typed by its first element, holding an int64 and a string
+  Value mixed = ValueHelper::createArray(
+      TypeInfo(DataType::INT32),
+      {static_cast<int32_t>(3), static_cast<int64_t>(7), std::string("x")});
+  EXPECT_EQ(std::get<int32_t>(call("index_of", {mixed, std::string("x")})),
+            2);
+  EXPECT_EQ(std::get<int32_t>(call("count_if_eq", {mixed, 7})), 1);
+  EXPECT_THROW(call("sum", {mixed}), std::runtime_error);
+
+  Value numbers = ValueHelper::createArray(
+      TypeInfo(DataType::INT32), {static_cast<int32_t>(3), 1.5});
+  Value total = call("sum", {numbers});
+  ASSERT_TRUE(std::holds_alternative<double>(total));
+  EXPECT_DOUBLE_EQ(std::get<double>(total), 4.5);
+  EXPECT_DOUBLE_EQ(std::get<double>(call("min", {numbers})), 1.5);
+
+  Value words = ValueHelper::createArray(
+      TypeInfo(DataType::STRING), {std::string("pear"), std::string("fig")});
+  EXPECT_EQ(std::get<std::string>(call("min", {words})), "fig");
+  EXPECT_THROW(call("dot", {words, words}), std::runtime_error);
+}
+
+TEST(ArrayBuiltinsTest, ScriptsCallBuiltinsOnEveryEngine) {
+  const char *source = R"(
+        int64 stats(int32 n) {
+            int32[] values = [];
+            double[] weights = [];
+            for (int32 i = 0; i < n; i += 1) {
+                push(values, i % 10);
+                push(weights, 0.5);
+            }
+            int64 total = sum(values);
+            double weighted = dot(values, weights);
+            int32 nines = count_if_eq(values, 9);
+            int32 where = index_of(values, 7);
+            return total * 1000000 + weighted * 1000 + nines * 100 + where
+                + max(values) - min(values);
+        }
+        int32 max(int32[] values) {
+            return -1;
+        }
+        int32 empty() {
+            int32[] values = [];
+            return min(values);
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "stats.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("stats", {static_cast<int32_t>(25)},
+                                       result, errorMsg))
+      << errorMsg;
+  // sum 100, dot 50, two nines, 7 at index 7; the script's own max wins
+  EXPECT_EQ(std::get<int64_t>(result), 100000000 + 50000 + 200 + 7 - 1);
+
+  EXPECT_FALSE(manager.executeProcedure("empty", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("min of an empty array"), std::string::npos)
+      << errorMsg;
+}
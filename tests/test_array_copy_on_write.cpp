@@ -0,0 +1,178 @@
+#include "CompactValue.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+const ArrayValue *storage(const Value &array) {
+  return std::get<ArrayPtr>(array).get();
+}
+
+} // namespace
+
+TEST(ArrayCopyOnWriteTest, MutableArrayCopiesOnlyWhenShared) {
+  Value a = intArray({1, 2});
+  const ArrayValue *original = storage(a);
+  ValueHelper::mutableArray(a).push(static_cast<int32_t>(3));
+  EXPECT_EQ(storage(a), original);
+
+  Value b = a;
+  ValueHelper::mutableArray(b).set(0, static_cast<int32_t>(9));
+  EXPECT_NE(storage(b), original);
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(a).get(0)), 1);
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(b).get(0)), 9);
+  EXPECT_EQ(ValueHelper::arrayValue(b).size(), 3u);
+  EXPECT_TRUE(ValueHelper::arrayValue(b).isTyped());
+}
+
+TEST(ArrayCopyOnWriteTest, CompactValuesShareUntilWritten) {
+  CompactValue a(intArray({1, 2}));
+  CompactValue b = a;
+  b.mutableArray().pop();
+  EXPECT_EQ(a.array()->size(), 2u);
+  EXPECT_EQ(b.array()->size(), 1u);
+
+  // b now owns its array outright, so writing again keeps it
+  const ArrayValue *owned = b.array().get();
+  b.mutableArray().push(static_cast<int32_t>(5));
+  EXPECT_EQ(b.array().get(), owned);
+
+  // Shared with a Value rather than another CompactValue
+  Value handle = a.toValue();
+  a.mutableArray().set(0, static_cast<int32_t>(7));
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(handle).get(0)), 1);
+}
+
+TEST(ArrayCopyOnWriteTest, AssignmentAndArgumentsHaveValueSemantics) {
+  const char *source = R"(
+        int32[] bump(int32[] values) {
+            values[0] = values[0] + 100;
+            push(values, 7);
+            return values;
+        }
+        int64 copies() {
+            int32[] a = [1, 2, 3];
+            int32[] b = a;
+            b[0] = 10;
+            push(b, 4);
+            int32[] c = bump(a);
+            int32 last = pop(c);
+            return a[0] * 1000000 + len(a) * 100000 + b[0] * 1000
+                + len(b) * 100 + c[0] + last;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "cow.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("copies", {}, result, errorMsg))
+      << errorMsg;
+  // a untouched, b = [10, 2, 3, 4], c = [101, 2, 3] after popping 7
+  EXPECT_EQ(std::get<int64_t>(result),
+            1000000 + 3 * 100000 + 10000 + 400 + 101 + 7);
+}
+
+TEST(ArrayCopyOnWriteTest, ReadersShareAndWritersCopy) {
+  const char *source = R"(
+        int32[] identity(int32[] values) {
+            int32[] alias = values;
+            int64 total = sum(alias) + len(values);
+            return alias;
+        }
+        int32[] extend(int32[] values) {
+            push(values, 4);
+            values[1] = 20;
+            return values;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "share.script", errors));
+
+  Value host = intArray({1, 2, 3});
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("identity", {host}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(storage(result), storage(host));
+
+  ASSERT_TRUE(manager.executeProcedure("extend", {host}, result, errorMsg))
+      << errorMsg;
+  EXPECT_NE(storage(result), storage(host));
+  EXPECT_EQ(ValueHelper::arrayValue(host).size(), 3u);
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(host).get(1)), 2);
+  EXPECT_EQ(ValueHelper::arrayValue(result).size(), 4u);
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(result).get(1)), 20);
+}
+
+TEST(ArrayCopyOnWriteTest, ExternalArraysAreWrittenInPlace) {
+  const char *source = R"(
+        int32 record() {
+            push(samples, 3);
+            samples[0] = 5;
+            return len(samples);
+        }
+    )";
+  Value host = intArray({1});
+  ScriptManager manager;
+  manager.registerExternalVariable("samples", [&]() -> Value { return host; });
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "ext.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("record", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 2);
+  ASSERT_EQ(ValueHelper::arrayValue(host).size(), 2u);
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::arrayValue(host).get(0)), 5);
+}
+
+TEST(ArrayCopyOnWriteTest, VariablesKeepTheirCopyOfExternalArrays) {
+  // Writes to the host's array do not show through locals and parameters
+  // bound to it before
+  const char *source = R"(
+        int32 declared() {
+            int32[] a = samples;
+            push(samples, 5);
+            return len(a);
+        }
+        int32 assigned() {
+            int32[] a;
+            a = samples;
+            samples[0] = 9;
+            return a[0];
+        }
+        int32 first(int32[] xs) {
+            pop(samples);
+            return xs[0] * 10 + len(xs);
+        }
+        int32 passed() {
+            return first(samples);
+        }
+    )";
+  Value host = intArray({1, 2, 3});
+  ScriptManager manager;
+  manager.registerExternalVariable("samples", [&]() -> Value { return host; });
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "alias.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("declared", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 3);
+  ASSERT_TRUE(manager.executeProcedure("assigned", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 1);
+  ASSERT_TRUE(manager.executeProcedure("passed", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 94);
+  EXPECT_EQ(elementsOf<int32_t>(host), (std::vector<int32_t>{9, 2, 3}));
+}
@@ -0,0 +1,203 @@
+#include "ArrayBuiltins.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+// [[0, 1, 2], [3, 4, 5]]
+Value matrix() {
+  return ValueHelper::createArray(TypeInfo(DataType::INT32, true),
+                                  {intArray({0, 1, 2}), intArray({3, 4, 5})});
+}
+
+Value call(const std::string &name, const std::vector<Value> &args) {
+  return ArrayBuiltins::call(name, args);
+}
+
+} // namespace
+
+TEST(ArrayNdTest, NestedArraysStackIntoOneBuffer) {
+  Value m = matrix();
+  const ArrayValue &elems = ValueHelper::arrayValue(m);
+  EXPECT_EQ(elems.rank(), 2u);
+  EXPECT_EQ(elems.shape(), (std::vector<size_t>{2, 3}));
+  EXPECT_EQ(elems.length(), 2u);
+  EXPECT_EQ(elems.size(), 6u);
+  ASSERT_NE(elems.buffer<int32_t>(), nullptr);
+  EXPECT_EQ(*elems.buffer<int32_t>(), (std::vector<int32_t>{0, 1, 2, 3, 4, 5}));
+
+  // One index gives a row, viewing the matrix's buffer
+  Value index = static_cast<int32_t>(1);
+  Value row = ValueHelper::indexArray(m, &index, 1);
+  const ArrayValue &rowElems = ValueHelper::arrayValue(row);
+  EXPECT_TRUE(rowElems.isView());
+  EXPECT_EQ(rowElems.rank(), 1u);
+  EXPECT_EQ(rowElems.elements<int32_t>().data(),
+            elems.buffer<int32_t>()->data() + 3);
+
+  Value both[] = {static_cast<int32_t>(1), static_cast<int32_t>(2)};
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::indexArray(m, both, 2)), 5);
+  EXPECT_EQ(ValueHelper::elementOffset(elems, both, 2), 5u);
+
+  // Three dimensions, and arrays whose rows disagree
+  Value cube = ValueHelper::createArray(TypeInfo(DataType::INT32, true),
+                                        {matrix(), matrix()});
+  EXPECT_EQ(ValueHelper::arrayValue(cube).shape(),
+            (std::vector<size_t>{2, 2, 3}));
+  EXPECT_EQ(errorOf([] {
+              ValueHelper::createArray(TypeInfo(DataType::INT32, true),
+                                       {intArray({1}), intArray({1, 2})});
+            }),
+            "Nested arrays must all have the same shape");
+  EXPECT_EQ(errorOf([&] { ValueHelper::mutableArray(m).push(1); }),
+            "push needs a one-dimensional array");
+}
+
+TEST(ArrayNdTest, OperatorsKeepTheShape) {
+  Value m = matrix();
+  Value doubled = ValueHelper::add(m, m);
+  EXPECT_EQ(ValueHelper::arrayValue(doubled).shape(),
+            (std::vector<size_t>{2, 3}));
+  EXPECT_EQ(elementsOf<int32_t>(doubled),
+            (std::vector<int32_t>{0, 2, 4, 6, 8, 10}));
+  EXPECT_TRUE(ValueHelper::equals(ValueHelper::multiply(m, 2), doubled));
+
+  // Same element count, different shape
+  Value flat = intArray({0, 1, 2, 3, 4, 5});
+  EXPECT_FALSE(ValueHelper::equals(m, flat));
+  EXPECT_EQ(errorOf([&] { ValueHelper::add(m, flat); }),
+            "Operator + needs arrays of the same shape");
+}
+
+TEST(ArrayNdTest, ShapeBuiltins) {
+  Value flat = intArray({0, 1, 2, 3, 4, 5});
+  Value m = call("reshape", {flat, 3, 2});
+  EXPECT_EQ(std::get<int32_t>(call("rank", {m})), 2);
+  EXPECT_EQ(elementsOf<int32_t>(call("shape", {m})),
+            (std::vector<int32_t>{3, 2}));
+  EXPECT_EQ(elementsOf<int32_t>(call("shape", {flat})),
+            (std::vector<int32_t>{6}));
+  EXPECT_EQ(ValueHelper::arrayValue(m).elements<int32_t>().data(),
+            ValueHelper::arrayValue(flat).buffer<int32_t>()->data());
+
+  Value ones = call("full", {1.5, 2, 2});
+  EXPECT_EQ(ValueHelper::arrayValue(ones).elementType(), DataType::DOUBLE);
+  EXPECT_EQ(ValueHelper::arrayValue(ones).shape(),
+            (std::vector<size_t>{2, 2}));
+  EXPECT_EQ(elementsOf<double>(ones), (std::vector<double>(4, 1.5)));
+
+  // slice works on rows
+  Value rows = call("slice", {m, 1, 3});
+  EXPECT_EQ(ValueHelper::arrayValue(rows).shape(),
+            (std::vector<size_t>{2, 2}));
+  EXPECT_EQ(elementsOf<int32_t>(rows), (std::vector<int32_t>{2, 3, 4, 5}));
+
+  EXPECT_EQ(errorOf([&] { call("reshape", {flat, 4, 2}); }),
+            "reshape of 6 elements to a shape of 8");
+  EXPECT_EQ(errorOf([&] { call("full", {1, -1}); }),
+            "full expects non-negative extents");
+  EXPECT_EQ(errorOf([&] { call("full", {flat, 2}); }),
+            "full expects a scalar value");
+}
+
+TEST(ArrayNdTest, ReductionsAlongAnAxis) {
+  Value m = matrix();
+  Value columns = call("sum", {m, 0});
+  EXPECT_EQ(ValueHelper::arrayValue(columns).elementType(), DataType::INT64);
+  EXPECT_EQ(elementsOf<int64_t>(columns), (std::vector<int64_t>{3, 5, 7}));
+  EXPECT_EQ(elementsOf<int64_t>(call("sum", {m, 1})),
+            (std::vector<int64_t>{3, 12}));
+  EXPECT_EQ(elementsOf<int32_t>(call("max", {m, 0})),
+            (std::vector<int32_t>{3, 4, 5}));
+  EXPECT_EQ(elementsOf<int32_t>(call("min", {m, 1})),
+            (std::vector<int32_t>{0, 3}));
+  EXPECT_EQ(std::get<int64_t>(call("sum", {m})), 15);
+  EXPECT_EQ(std::get<int64_t>(call("sum", {intArray({1, 2}), 0})), 3);
+
+  // The middle axis of a cube, typed and mixed
+  Value cube = call("reshape", {call("full", {2.0, 24}), 2, 3, 4});
+  Value middle = call("sum", {cube, 1});
+  EXPECT_EQ(ValueHelper::arrayValue(middle).shape(),
+            (std::vector<size_t>{2, 4}));
+  EXPECT_EQ(elementsOf<double>(middle), (std::vector<double>(8, 6.0)));
+
+  Value mixed = ValueHelper::createArray(
+      TypeInfo(DataType::INT32, true),
+      {ValueHelper::createArray(TypeInfo(DataType::INT32),
+                                {static_cast<int32_t>(1), 2.5}),
+       intArray({3, 4})});
+  EXPECT_FALSE(ValueHelper::arrayValue(mixed).isTyped());
+  Value mixedSums = call("sum", {mixed, 0});
+  EXPECT_EQ(std::get<int64_t>(ValueHelper::arrayValue(mixedSums).get(0)), 4);
+  EXPECT_DOUBLE_EQ(
+      std::get<double>(ValueHelper::arrayValue(mixedSums).get(1)), 6.5);
+
+  EXPECT_EQ(errorOf([&] { call("sum", {m, 2}); }),
+            "sum axis 2 out of range for rank 2");
+  EXPECT_EQ(errorOf([&] { call("max", {call("full", {1, 2, 0}), 1}); }),
+            "max along an empty axis");
+}
+
+TEST(ArrayNdTest, ScriptsIndexMatrices) {
+  const char *source = R"(
+        int64 total(int32[] row) {
+            return sum(row);
+        }
+        int64 grid(int32 n) {
+            int32[] m = full(0, n, n);
+            for (int32 i = 0; i < len(m); i += 1) {
+                for (int32 j = 0; j < n; j += 1) {
+                    m[i][j] = i * 10 + j;
+                }
+            }
+            int32[] copy = m;
+            copy[0][0] = 99;
+            int32[] row = m[2];
+            int64[] rows = sum(m, 1);
+            return m[1][2] * 1000000 + copy[0][0] * 10000 + total(row) * 10
+                + rows[0] + m[0][0] + len(shape(m));
+        }
+        int32 literal() {
+            int32[] m = [[1, 2], [3, 4]];
+            double[] d = m * 0.5;
+            return m[1][0] * 100 + d[1][1] * 10 + rank(d);
+        }
+        int32 outside() {
+            int32[] m = [[1, 2], [3, 4]];
+            return m[1][2];
+        }
+        int32 tooFew() {
+            int32[] m = [[1, 2], [3, 4]];
+            m[0] = 5;
+            return 0;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "grid.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("grid", {static_cast<int32_t>(4)},
+                                       result, errorMsg))
+      << errorMsg;
+  // m[1][2] = 12, row 2 sums to 86, row 0 to 6; copies leave m alone
+  EXPECT_EQ(std::get<int64_t>(result),
+            12 * 1000000 + 99 * 10000 + 86 * 10 + 6 + 0 + 2);
+
+  ASSERT_TRUE(manager.executeProcedure("literal", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 300 + 20 + 2);
+
+  EXPECT_FALSE(manager.executeProcedure("outside", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Array index out of bounds"), std::string::npos)
+      << errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("tooFew", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Index assignment needs 2 indices"),
+            std::string::npos)
+      << errorMsg;
+}
@@ -0,0 +1,174 @@
+#include "ArrayBuiltins.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+Value slice(const Value &array, int32_t start, int32_t end) {
+  return ArrayBuiltins::call("slice", {array, start, end});
+}
+
+} // namespace
+
+TEST(ArraySlicesTest, ViewsShareTheUnderlyingBuffer) {
+  Value base = intArray({0, 1, 2, 3, 4, 5});
+  Value view = slice(base, 1, 5);
+  const ArrayValue &elems = ValueHelper::arrayValue(view);
+  EXPECT_TRUE(elems.isView());
+  EXPECT_TRUE(elems.isTyped());
+  EXPECT_EQ(elems.elementType(), DataType::INT32);
+  EXPECT_EQ(elems.buffer<int32_t>(), nullptr);
+  EXPECT_EQ(elems.size(), 4u);
+  EXPECT_EQ(std::get<int32_t>(elems.get(0)), 1);
+  EXPECT_EQ(elementsOf<int32_t>(view), (std::vector<int32_t>{1, 2, 3, 4}));
+
+  const int32_t *data = ValueHelper::arrayValue(base).buffer<int32_t>()->data();
+  EXPECT_EQ(elems.elements<int32_t>().data(), data + 1);
+  EXPECT_FALSE(elems.elements<double>());
+
+  // A view of a view refers to the original buffer
+  Value inner = slice(view, 2, 4);
+  EXPECT_EQ(ValueHelper::arrayValue(inner).elements<int32_t>().data(),
+            data + 3);
+  EXPECT_EQ(elementsOf<int32_t>(inner), (std::vector<int32_t>{3, 4}));
+
+  EXPECT_EQ(ValueHelper::arrayValue(slice(base, 6, 6)).size(), 0u);
+}
+
+TEST(ArraySlicesTest, WritesNeverShowThroughAView) {
+  Value base = intArray({0, 1, 2, 3});
+  Value view = slice(base, 1, 3);
+
+  // The view holds a reference, so writing to the base copies it first
+  ValueHelper::mutableArray(base).set(1, static_cast<int32_t>(10));
+  EXPECT_EQ(elementsOf<int32_t>(view), (std::vector<int32_t>{1, 2}));
+
+  // Writing to the view gives it its own buffer
+  ArrayValue &own = ValueHelper::mutableArray(view);
+  own.push(static_cast<int32_t>(7));
+  own.set(0, static_cast<int32_t>(-1));
+  EXPECT_FALSE(own.isView());
+  ASSERT_NE(own.buffer<int32_t>(), nullptr);
+  EXPECT_EQ(elementsOf<int32_t>(view), (std::vector<int32_t>{-1, 2, 7}));
+  EXPECT_EQ(elementsOf<int32_t>(base), (std::vector<int32_t>{0, 10, 2, 3}));
+
+  // Mixed arrays slice element by element
+  Value mixed = ValueHelper::createArray(
+      TypeInfo(DataType::INT32),
+      {static_cast<int32_t>(1), std::string("x"), 2.5});
+  Value tail = slice(mixed, 1, 3);
+  EXPECT_FALSE(ValueHelper::arrayValue(tail).isTyped());
+  EXPECT_EQ(std::get<std::string>(ValueHelper::arrayValue(tail).get(0)), "x");
+  EXPECT_EQ(ValueHelper::arrayValue(tail).pop(), Value(2.5));
+  EXPECT_EQ(ValueHelper::arrayValue(mixed).size(), 3u);
+}
+
+TEST(ArraySlicesTest, BuiltinsAndOperatorsReadViews) {
+  Value base = intArray({5, 1, 4, 2, 8});
+  Value window = slice(base, 1, 4);
+  EXPECT_EQ(std::get<int64_t>(ArrayBuiltins::call("sum", {window})), 7);
+  EXPECT_EQ(std::get<int32_t>(ArrayBuiltins::call("max", {window})), 4);
+  EXPECT_EQ(std::get<int32_t>(ArrayBuiltins::call("index_of", {window, 2})),
+            2);
+  EXPECT_EQ(std::get<int64_t>(ArrayBuiltins::call(
+                "dot", {window, slice(base, 2, 5)})),
+            1 * 4 + 4 * 2 + 2 * 8);
+  EXPECT_EQ(elementsOf<int32_t>(
+                ValueHelper::multiply(window, static_cast<int32_t>(10))),
+            (std::vector<int32_t>{10, 40, 20}));
+  EXPECT_TRUE(ValueHelper::equals(window, intArray({1, 4, 2})));
+}
+
+TEST(ArraySlicesTest, RejectsBadRanges) {
+  Value base = intArray({1, 2, 3});
+  auto sliceError = [](const std::vector<Value> &args) {
+    return errorOf([&] { ArrayBuiltins::call("slice", args); });
+  };
+  EXPECT_EQ(sliceError({base, 2, 4}),
+            "slice range [2, 4) out of bounds for length 3");
+  EXPECT_EQ(sliceError({base, 2, 1}),
+            "slice range [2, 1) out of bounds for length 3");
+  EXPECT_EQ(sliceError({base, -1, 1}),
+            "slice range [-1, 1) out of bounds for length 3");
+  EXPECT_EQ(sliceError({base, 0, 1.5}), "slice expects integer bounds");
+  EXPECT_EQ(sliceError({1, 0, 1}), "slice expects an array as first argument");
+  EXPECT_EQ(sliceError({base, 0}), "slice expects 3 arguments");
+}
+
+TEST(ArraySlicesTest, ScriptsPassSlicesToHelpers) {
+  const char *source = R"(
+        int64 total(int32[] values) {
+            int64 t = 0;
+            for (int32 i = 0; i < len(values); i += 1) {
+                t += values[i];
+            }
+            return t;
+        }
+        int64 windows() {
+            int32[] xs = [];
+            for (int32 i = 0; i < 100; i += 1) {
+                push(xs, i);
+            }
+            int32[] mid = slice(xs, 10, 20);
+            int32[] inner = slice(mid, 5, 7);
+            push(mid, 1000);
+            xs[15] = -1;
+            return total(slice(xs, 0, 10)) * 1000000 + total(mid) * 100
+                + inner[0] + inner[1] + len(xs);
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "slices.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("windows", {}, result, errorMsg))
+      << errorMsg;
+  // 0..9 sums to 45; mid is 10..19 plus 1000; inner is [15, 16]
+  EXPECT_EQ(std::get<int64_t>(result),
+            45 * 1000000 + (145 + 1000) * 100 + 15 + 16 + 100);
+}
+
+TEST(ArraySlicesTest, ViewsOfHostArraysAreCopies) {
+  // Scripts change the host's arrays in place, so slices, reshapes and
+  // rows of them must not go on reading the host's buffer
+  const char *source = R"(
+        int32 views() {
+            int32[] v = slice(arr, 0, 3);
+            int32[] shaped = reshape(arr, 3, 1);
+            int32[] row = grid[1];
+            pop(arr);
+            pop(arr);
+            pop(arr);
+            push(arr, 7);
+            grid[1][0] = 9;
+            return v[0] * 100000 + len(v) * 10000 + shaped[0][0] * 1000
+                + row[0] * 100 + arr[0] * 10 + grid[1][0];
+        }
+    )";
+  Value arr = intArray({1, 2, 3});
+  Value grid = ValueHelper::createArray(
+      TypeInfo(DataType::INT32, true),
+      {intArray({0, 1, 2}), intArray({3, 4, 5})});
+  ScriptManager manager;
+  manager.registerExternalVariable(
+      "arr", [&arr]() { return arr; },
+      [&arr](const Value &value) { arr = value; });
+  manager.registerExternalVariable(
+      "grid", [&grid]() { return grid; },
+      [&grid](const Value &value) { grid = value; });
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "host.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("views", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 100000 + 30000 + 1000 + 300 + 70 + 9);
+  EXPECT_EQ(elementsOf<int32_t>(arr), (std::vector<int32_t>{7}));
+}
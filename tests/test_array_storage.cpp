@@ -0,0 +1,95 @@
+#include "ScriptManager.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+
+TEST(ArrayStorageTest, UsesNativeBufferForElementType) {
+  ArrayPtr ints = ValueHelper::createArray(
+      TypeInfo(DataType::INT32),
+      {static_cast<int32_t>(1), static_cast<int32_t>(2)});
+  ASSERT_TRUE(ints->isTyped());
+  ASSERT_NE(ints->buffer<int32_t>(), nullptr);
+  EXPECT_EQ(ints->buffer<double>(), nullptr);
+  EXPECT_EQ(*ints->buffer<int32_t>(), (std::vector<int32_t>{1, 2}));
+
+  ArrayPtr flags =
+      ValueHelper::createArray(TypeInfo(DataType::BOOL), {true, false});
+  ASSERT_NE(flags->buffer<bool>(), nullptr);
+  EXPECT_FALSE(std::get<bool>(flags->get(1)));
+
+  ArrayPtr words = ValueHelper::createArray(TypeInfo(DataType::STRING),
+                                            {std::string("a")});
+  words->push(std::string("b"));
+  ASSERT_NE(words->buffer<std::string>(), nullptr);
+  EXPECT_EQ(std::get<std::string>(words->pop()), "b");
+  EXPECT_EQ(words->size(), 1u);
+}
+
+TEST(ArrayStorageTest, MixedElementsFallBackToValues) {
+  // Literals take their element type from the first element only
+  ArrayPtr mixed = ValueHelper::createArray(
+      TypeInfo(DataType::INT32), {static_cast<int32_t>(1), 2.5});
+  EXPECT_FALSE(mixed->isTyped());
+  EXPECT_TRUE(std::holds_alternative<double>(mixed->get(1)));
+
+  // Storing a value of another type keeps it as is
+  ArrayPtr ints = ValueHelper::createArray(TypeInfo(DataType::INT32),
+                                           {static_cast<int32_t>(1)});
+  ints->set(0, static_cast<int32_t>(4));
+  EXPECT_TRUE(ints->isTyped());
+  ints->push(std::string("x"));
+  EXPECT_FALSE(ints->isTyped());
+  EXPECT_EQ(std::get<int32_t>(ints->get(0)), 4);
+  EXPECT_EQ(std::get<std::string>(ints->get(1)), "x");
+
+  ArrayPtr empty = ValueHelper::createArray(TypeInfo(DataType::VOID), {});
+  EXPECT_TRUE(empty->empty());
+  empty->push(static_cast<uint8_t>(9));
+  EXPECT_TRUE(std::holds_alternative<uint8_t>(empty->pop()));
+}
+
+TEST(ArrayStorageTest, EqualityComparesElementsNotStorage) {
+  Value typed = ValueHelper::createArray(
+      TypeInfo(DataType::INT32),
+      {static_cast<int32_t>(1), static_cast<int32_t>(2)});
+  auto loose = std::make_shared<ArrayValue>(DataType::INT32);
+  loose->push(static_cast<int32_t>(1));
+  loose->push(std::string("dropped"));
+  loose->pop();
+  loose->push(static_cast<int32_t>(2));
+  ASSERT_FALSE(loose->isTyped());
+  EXPECT_TRUE(ValueHelper::equals(typed, Value(loose)));
+  loose->set(1, static_cast<int32_t>(3));
+  EXPECT_FALSE(ValueHelper::equals(typed, Value(loose)));
+}
+
+TEST(ArrayStorageTest, ScriptsSeeTheSameValues) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(R"(
+        double total(int32 n) {
+            double[] values = [0.5];
+            uint8[] bytes = [250];
+            for (int32 i = 0; i < n; i += 1) {
+                push(values, i);
+                push(bytes, i);
+            }
+            bytes[0] = bytes[0] + 10;
+            values[0] = pop(values) * 2;
+            double sum = 0;
+            for (int32 i = 0; i < len(values); i += 1) {
+                sum += values[i];
+            }
+            return sum + bytes[0] + len(bytes);
+        }
+    )",
+                                       "storage.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("total", {static_cast<int32_t>(4)},
+                                       result, errorMsg))
+      << errorMsg;
+  // values: [6, 0, 1, 2]; bytes[0] wraps to 4; five bytes
+  EXPECT_DOUBLE_EQ(std::get<double>(result), 9.0 + 4 + 5);
+}
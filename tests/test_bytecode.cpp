@@ -0,0 +1,217 @@
+#include "Bytecode.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+
+namespace {
+
+// Runs the same procedure on both engines and checks the results agree.
+Value runOnBothEngines(const std::string &source, const std::string &proc,
+                       const std::vector<Value> &args) {
+  Value results[2];
+  ExecutionEngine engines[2] = {ExecutionEngine::TREE_WALKER,
+                                ExecutionEngine::BYTECODE};
+
+  for (int i = 0; i < 2; ++i) {
+    ScriptManager manager;
+    manager.setExecutionEngine(engines[i]);
+    std::vector<CompilationError> errors;
+    EXPECT_TRUE(manager.loadScriptSource(source, "engines.script", errors));
+
+    std::string errorMsg;
+    EXPECT_TRUE(manager.executeProcedure(proc, args, results[i], errorMsg))
+        << errorMsg;
+  }
+
+  EXPECT_EQ(results[0].index(), results[1].index());
+  EXPECT_TRUE(ValueHelper::equals(results[0], results[1]));
+  return results[1];
+}
+
+} // namespace
+
+TEST(BytecodeTest, EngineSelection) {
+  ScriptManager manager;
+  manager.setExecutionEngine(ExecutionEngine::BYTECODE);
+  EXPECT_EQ(manager.getExecutionEngine(), ExecutionEngine::BYTECODE);
+
+  manager.clear();
+  EXPECT_EQ(manager.getExecutionEngine(), ExecutionEngine::BYTECODE);
+
+  manager.setExecutionEngine(ExecutionEngine::TREE_WALKER);
+  EXPECT_EQ(manager.getExecutionEngine(), ExecutionEngine::TREE_WALKER);
+}
+
+TEST(BytecodeTest, LoopsAndScopes) {
+  std::string source = R"(
+        int32 run(int32 n) {
+            int32 total = 0;
+            int32 x = 100;
+            for (int32 i = 0; i < n; i += 1) {
+                int32 x = i * 2;
+                if (i % 3 == 0) { continue; }
+                if (i > 20) { break; }
+                total += x;
+            }
+            int32 j = 0;
+            do { j += 1; total += j; } while (j < 3);
+            while (true) { total -= 1; if (total < 50) { break; } }
+            return total + x;
+        }
+    )";
+
+  Value result = runOnBothEngines(source, "run", {static_cast<int32_t>(30)});
+  EXPECT_EQ(std::get<int32_t>(result), 149);
+}
+
+TEST(BytecodeTest, SwitchFallthroughAndDefaultOrder) {
+  std::string source = R"(
+        int32 pick(int32 v) {
+            int32 out = 0;
+            for (int32 i = 0; i < 2; i += 1) {
+                switch (v) {
+                    case 1: out += 1;
+                    default: out += 10;
+                    case 2: out += 100; continue;
+                    case 3: out += 1000; break;
+                }
+                out += 5;
+            }
+            return out;
+        }
+    )";
+
+  EXPECT_EQ(std::get<int32_t>(
+                runOnBothEngines(source, "pick", {static_cast<int32_t>(1)})),
+            222);
+  EXPECT_EQ(std::get<int32_t>(
+                runOnBothEngines(source, "pick", {static_cast<int32_t>(2)})),
+            220);
+  EXPECT_EQ(std::get<int32_t>(
+                runOnBothEngines(source, "pick", {static_cast<int32_t>(3)})),
+            220);
+  EXPECT_EQ(std::get<int32_t>(
+                runOnBothEngines(source, "pick", {static_cast<int32_t>(9)})),
+            220);
+}
+
+TEST(BytecodeTest, RecursionStringsAndArrays) {
+  std::string source = R"(
+        int32 fib(int32 n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+        string describe(int32 n) {
+            int32[] values = [];
+            for (int32 i = 0; i < n; i += 1) { push(values, fib(i)); }
+            values[0] = 42;
+            int32 last = pop(values);
+            return "len=" + len(values) + " last=" + last + " first=" + values[0];
+        }
+    )";
+
+  Value result =
+      runOnBothEngines(source, "describe", {static_cast<int32_t>(10)});
+  EXPECT_EQ(std::get<std::string>(result), "len=9 last=34 first=42");
+}
+
+TEST(BytecodeTest, MixedWidthArithmeticMatchesTreeWalker) {
+  std::string source = R"(
+        double mix(int8 a, uint16 b, int64 c, double d) {
+            int32 wrapped = 2147483647;
+            wrapped = wrapped + 1;
+            return a + b * c - d / 2.0 + wrapped + (c << 2) + (b & 3) + -a;
+        }
+    )";
+
+  runOnBothEngines(source, "mix",
+                   {static_cast<int8_t>(-3), static_cast<uint16_t>(7),
+                    static_cast<int64_t>(11), 5.0});
+}
+
+TEST(BytecodeTest, ShortCircuitAndExternals) {
+  int calls = 0;
+  int32_t host = 3;
+
+  std::string source = R"(
+        bool check(bool a) {
+            bool r = a && probe();
+            r = r || probe();
+            hostValue += 2;
+            hostValue *= 3;
+            return r && hostValue > 0;
+        }
+    )";
+
+  for (auto engine : {ExecutionEngine::TREE_WALKER, ExecutionEngine::BYTECODE}) {
+    calls = 0;
+    host = 3;
+    ScriptManager manager;
+    manager.setExecutionEngine(engine);
+    manager.registerExternalFunction(
+        "probe", [&](const std::vector<Value> &) -> Value {
+          ++calls;
+          return true;
+        });
+    manager.registerExternalVariable(
+        "hostValue", [&]() -> Value { return host; },
+        [&](const Value &v) { host = std::get<int32_t>(v); });
+
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "ext.script", errors));
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure("check", {false}, result, errorMsg))
+        << errorMsg;
+    EXPECT_TRUE(std::get<bool>(result));
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(host, 15);
+  }
+}
+
+TEST(BytecodeTest, RuntimeErrorsCarryPositions) {
+  std::string source = "int32 bad() {\n"
+                       "  int32[] data = [1, 2];\n"
+                       "  return data[5];\n"
+                       "}\n"
+                       "int32 missing() {\n"
+                       "  return nothing(1);\n"
+                       "}\n";
+
+  ScriptManager manager;
+  manager.setExecutionEngine(ExecutionEngine::BYTECODE);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "errors.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("bad", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("line 3"), std::string::npos) << errorMsg;
+  EXPECT_NE(errorMsg.find("Array index out of bounds"), std::string::npos);
+
+  EXPECT_FALSE(manager.executeProcedure("missing", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Undefined function: nothing"), std::string::npos);
+}
+
+TEST(BytecodeTest, LocalsUseRegistersDirectly) {
+  std::string source = R"(
+        int32 add(int32 a, int32 b) {
+            int32 c = a + b;
+            return c;
+        }
+    )";
+
+  auto script = TestHelpers::parseAndResolve(source);
+  ASSERT_EQ(script->procedures.size(), 1u);
+
+  BytecodeCompiler compiler;
+  BytecodePtr code = compiler.compile(*script->procedures[0]);
+  std::string listing = code->disassemble();
+
+  // a, b and c live in registers 0..2; no moves are needed
+  EXPECT_EQ(code->registerCount, 3u);
+  EXPECT_NE(listing.find("ADD 2 0 1"), std::string::npos) << listing;
+  EXPECT_EQ(listing.find("MOVE"), std::string::npos) << listing;
+  EXPECT_NE(listing.find("RETURN 2"), std::string::npos) << listing;
+}
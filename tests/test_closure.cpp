@@ -0,0 +1,256 @@
+#include "ClosureCompiler.h"
+#include "Interpreter.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+
+namespace {
+
+// Runs the same procedure on the tree walker and the closure engine and
+// checks the results agree.
+Value runOnBothEngines(const std::string &source, const std::string &proc,
+                       const std::vector<Value> &args) {
+  Value results[2];
+  ExecutionEngine engines[2] = {ExecutionEngine::TREE_WALKER,
+                                ExecutionEngine::CLOSURE};
+
+  for (int i = 0; i < 2; ++i) {
+    ScriptManager manager;
+    manager.setExecutionEngine(engines[i]);
+    std::vector<CompilationError> errors;
+    EXPECT_TRUE(manager.loadScriptSource(source, "engines.script", errors));
+
+    std::string errorMsg;
+    EXPECT_TRUE(manager.executeProcedure(proc, args, results[i], errorMsg))
+        << errorMsg;
+  }
+
+  EXPECT_EQ(results[0].index(), results[1].index());
+  EXPECT_TRUE(ValueHelper::equals(results[0], results[1]));
+  return results[1];
+}
+
+ScriptPtr parse(const std::string &source) {
+  return TestHelpers::parse(source, "closure.script");
+}
+
+} // namespace
+
+TEST(ClosureTest, PreparedFormIsCachedPerProcedure) {
+  Interpreter interpreter;
+  interpreter.setExecutionEngine(ExecutionEngine::CLOSURE);
+  interpreter.loadScript(parse(R"(
+        int32 square(int32 x) { return x * x; }
+        int32 sumSquares(int32 n) {
+            int32 total = 0;
+            for (int32 i = 1; i <= n; i += 1) { total += square(i); }
+            return total;
+        }
+    )"));
+
+  auto proc = interpreter.getProcedure("sumSquares");
+  ASSERT_NE(proc, nullptr);
+  auto prepared = proc->closure;
+  ASSERT_NE(prepared, nullptr);
+
+  Value first = interpreter.executeProcedure("sumSquares",
+                                             {static_cast<int32_t>(4)});
+  Value second = interpreter.executeProcedure("sumSquares",
+                                              {static_cast<int32_t>(10)});
+  EXPECT_EQ(std::get<int32_t>(first), 30);
+  EXPECT_EQ(std::get<int32_t>(second), 385);
+  EXPECT_EQ(proc->closure, prepared);
+  EXPECT_NE(interpreter.getProcedure("square")->closure, nullptr);
+}
+
+TEST(ClosureTest, ProceduresArePreparedLazily) {
+  Interpreter interpreter;
+  interpreter.loadScript(parse("int32 one() { return 1; }"));
+  auto proc = interpreter.getProcedure("one");
+  EXPECT_EQ(proc->closure, nullptr);
+
+  interpreter.setExecutionEngine(ExecutionEngine::CLOSURE);
+  Value result = interpreter.executeProcedure("one", {});
+  EXPECT_EQ(std::get<int32_t>(result), 1);
+  EXPECT_NE(proc->closure, nullptr);
+}
+
+TEST(ClosureTest, SpecializedOperandsMatchTreeWalker) {
+  // Plain assignment keeps the right-hand type, so a local declared int32
+  // may hold a double at runtime; the int32 fast paths must notice
+  std::string source = R"(
+        string run(int32 n) {
+            int32 a = 7;
+            a = 2.5;
+            double d = 1.5;
+            int64 wide = 3000000000;
+            uint8 small = 200;
+            string out = "";
+            out = out + (a + 1) + "," + (d * n) + "," + (n / 0.5);
+            out = out + "," + (wide + n) + "," + (small + 100);
+            out = out + "," + (n % 4) + "," + (n - 10) + "," + (n < d);
+            out = out + "," + (2147483647 + n) + "," + (a == 2.5);
+            return out;
+        }
+    )";
+
+  Value result = runOnBothEngines(source, "run", {static_cast<int32_t>(9)});
+  EXPECT_TRUE(std::holds_alternative<std::string>(result));
+}
+
+TEST(ClosureTest, ControlFlowAndCalls) {
+  std::string source = R"(
+        int32 fib(int32 n) {
+            if (n < 2) { return n; }
+            return fib(n - 1) + fib(n - 2);
+        }
+        int32 run(int32 n) {
+            int32 total = 0;
+            int32 i = 0;
+            while (true) {
+                i += 1;
+                if (i > n) { break; }
+                switch (i % 3) {
+                    case 0: continue;
+                    case 1: total += fib(i); break;
+                    default: total -= 1;
+                }
+            }
+            do { total *= 2; } while (total < 0);
+            return total > 100 ? total : -total;
+        }
+    )";
+
+  Value result = runOnBothEngines(source, "run", {static_cast<int32_t>(12)});
+  EXPECT_EQ(std::get<int32_t>(result), 136);
+}
+
+TEST(ClosureTest, ArraysAndDefaults) {
+  std::string source = R"(
+        int32 run(int32 n) {
+            int32 total = 0;
+            for (int32 round = 0; round < 2; round += 1) {
+                int32[] values;
+                for (int32 i = 0; i < n; i += 1) { push(values, i * round); }
+                values[0] = 42;
+                total += len(values) + values[0] + pop(values);
+            }
+            return total;
+        }
+    )";
+
+  Value result = runOnBothEngines(source, "run", {static_cast<int32_t>(5)});
+  EXPECT_EQ(std::get<int32_t>(result), 98);
+}
+
+TEST(ClosureTest, RuntimeErrorsCarryPositions) {
+  std::string source = R"(
+        int32 run(int32[] values) {
+            return values[3];
+        }
+    )";
+
+  ScriptManager manager;
+  manager.setExecutionEngine(ExecutionEngine::CLOSURE);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "closure.script", errors));
+
+  Value array = ValueHelper::createArray(
+      TypeInfo(DataType::INT32), {static_cast<int32_t>(1)});
+  Value result;
+  std::string errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("run", {array}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Array index out of bounds"), std::string::npos)
+      << errorMsg;
+  EXPECT_NE(errorMsg.find("line 3"), std::string::npos) << errorMsg;
+}
+
+TEST(ClosureTest, TypedKernelsMatchTreeWalker) {
+  std::string source = R"(
+        string run(int32 n) {
+            int32 big = 2147483647;
+            int32 neg = -7;
+            double d = 0.25;
+            string out = "";
+            out = out + (big + n) + "," + (big * n) + "," + (neg / 2);
+            out = out + "," + (neg % 3) + "," + (n - big) + "," + (n * n + neg);
+            out = out + "," + (d / 0.5) + "," + (d * d - 1.0) + "," + (d + d);
+            out = out + "," + (n < neg) + "," + (n >= 9) + "," + (d != 0.25);
+            out = out + "," + (d <= 0.5) + "," + (neg == -7) + "," + (1 > n);
+            return out;
+        }
+    )";
+
+  Value result = runOnBothEngines(source, "run", {static_cast<int32_t>(9)});
+  EXPECT_EQ(std::get<std::string>(result).substr(0, 14), "-2147483640,21");
+}
+
+TEST(ClosureTest, TypedKernelsFallBackWhenACalleeChangesType) {
+  // x is statically int32 because f returns one, until a later script
+  // loads an f returning double; plain assignment keeps the double
+  const char *first = R"(
+        int32 f() { return 2; }
+        string run() {
+            int32 x = 0;
+            x = f();
+            return "" + (x + 1) + "," + (x < 3) + "," + (x / 0.5);
+        }
+    )";
+  const char *second = "double f() { return 2.5; }";
+
+  for (ExecutionEngine engine :
+       {ExecutionEngine::TREE_WALKER, ExecutionEngine::CLOSURE}) {
+    ScriptManager manager;
+    manager.setExecutionEngine(engine);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(first, "first.script", errors));
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure("run", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "3,true,4.000000");
+
+    ASSERT_TRUE(manager.loadScriptSource(second, "second.script", errors));
+    ASSERT_TRUE(manager.executeProcedure("run", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "3.500000,true,5.000000");
+  }
+}
+
+TEST(ClosureTest, FramesAreReusedAcrossDeepAndFailedCalls) {
+  std::string source = R"(
+        int32 depth(int32 n) {
+            int32 a = n;
+            int32 b = a * 2;
+            if (n == 0) { return 0; }
+            return depth(n - 1) + b - a - n + 1;
+        }
+        int32 fail(int32 n) {
+            int32[] values = [n];
+            if (n == 0) { return values[1]; }
+            return fail(n - 1);
+        }
+    )";
+
+  ScriptManager manager;
+  manager.setExecutionEngine(ExecutionEngine::CLOSURE);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "frames.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  for (int round = 0; round < 3; ++round) {
+    // Frames of three slots, deep enough to span several blocks
+    ASSERT_TRUE(manager.executeProcedure(
+        "depth", {static_cast<int32_t>(800)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 800);
+
+    EXPECT_FALSE(manager.executeProcedure(
+        "fail", {static_cast<int32_t>(500)}, result, errorMsg));
+    EXPECT_NE(errorMsg.find("Array index out of bounds"), std::string::npos)
+        << errorMsg;
+  }
+}
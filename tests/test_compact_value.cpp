@@ -0,0 +1,204 @@
+#include "CompactValue.h"
+#include "ScriptManager.h"
+#include <gtest/gtest.h>
+#include <limits>
+
+using namespace Script;
+
+TEST(CompactValueTest, RoundTripsEveryType) {
+  const std::vector<Value> values = {
+      static_cast<int8_t>(-128),
+      static_cast<uint8_t>(255),
+      static_cast<int16_t>(-300),
+      static_cast<uint16_t>(65535),
+      static_cast<int32_t>(std::numeric_limits<int32_t>::min()),
+      static_cast<uint32_t>(4000000000u),
+      static_cast<int64_t>(std::numeric_limits<int64_t>::min()),
+      static_cast<uint64_t>(std::numeric_limits<uint64_t>::max()),
+      -2.5,
+      std::string("a string long enough to need its own allocation"),
+      true,
+      ValueHelper::createArray(TypeInfo(DataType::INT32),
+                               {static_cast<int32_t>(1)}),
+  };
+
+  for (const auto &value : values) {
+    CompactValue compact(value);
+    EXPECT_EQ(compact.index(), value.index());
+    EXPECT_TRUE(compact.toValue() == value) << ValueHelper::toString(value);
+  }
+
+  // A default CompactValue matches a default Value
+  EXPECT_TRUE(CompactValue().toValue() == Value());
+}
+
+TEST(CompactValueTest, CopiesShareHeapHandles) {
+  ArrayPtr array = ValueHelper::createArray(TypeInfo(DataType::INT32), {});
+  {
+    CompactValue a{Value(array)};
+    CompactValue b = a;
+    CompactValue c;
+    c = b;
+    EXPECT_EQ(array.use_count(), 2); // one handle shared by three copies
+    EXPECT_EQ(c.array().get(), array.get());
+
+    CompactValue moved = std::move(c);
+    EXPECT_EQ(moved.array().get(), array.get());
+    c = moved; // assigning into a moved-from value
+    a = Value(static_cast<int32_t>(5));
+    EXPECT_TRUE(a.isInt32());
+    EXPECT_EQ(a.int32(), 5);
+  }
+  EXPECT_EQ(array.use_count(), 1);
+
+  CompactValue text{Value(std::string("shared"))};
+  CompactValue copy = text;
+  text.setInt32(7);
+  EXPECT_EQ(std::get<std::string>(copy.toValue()), "shared");
+  copy = copy; // self-assignment keeps the string alive
+  EXPECT_EQ(std::get<std::string>(copy.toValue()), "shared");
+}
+
+TEST(CompactValueTest, MutableStringCopiesOnlyWhenShared) {
+  CompactValue text{Value(std::string("abc"))};
+  CompactValue copy = text;
+  text.mutableString() += "def";
+  EXPECT_EQ(std::get<std::string>(text.toValue()), "abcdef");
+  EXPECT_EQ(std::get<std::string>(copy.toValue()), "abc");
+
+  // Unshared, appends reuse the buffer's capacity
+  size_t reallocations = 0;
+  const char *data = text.mutableString().data();
+  for (int i = 0; i < 100000; ++i) {
+    std::string &s = text.mutableString();
+    s += "xy";
+    if (s.data() != data) {
+      data = s.data();
+      ++reallocations;
+    }
+  }
+  EXPECT_EQ(std::get<std::string>(text.toValue()).size(), 6u + 200000u);
+  EXPECT_LE(reallocations, 20u);
+}
+
+TEST(CompactValueTest, ProcedureLocalsKeepTheirTypes) {
+  ScriptManager manager;
+  manager.setExecutionEngine(ExecutionEngine::TREE_WALKER);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(R"(
+        string describe(int8 small, uint64 big, double ratio) {
+            string label = "n";
+            int32[] values = [1, 2, 3];
+            int64 total = 0;
+            for (int32 i = 0; i < 3; i += 1) {
+                total += values[i];
+            }
+            label += small;
+            label = label + " " + big + " " + ratio + " " + total;
+            return label;
+        }
+    )",
+                                       "locals.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "describe",
+      {static_cast<int32_t>(-3), static_cast<int64_t>(-1), 0.5}, result,
+      errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<std::string>(result),
+            "n-3 18446744073709551615 0.500000 6");
+}
+
+TEST(CompactValueTest, ViewsReadInPlaceAndAssignmentsRefill) {
+  CompactValue text{Value(std::string("long enough to need an allocation"))};
+  Value scratch;
+  const Value &first = text.view(scratch);
+  const Value &second = text.view(scratch);
+  EXPECT_EQ(&first, &second); // no copy out of the slot
+  EXPECT_EQ(std::get<std::string>(first).data(),
+            std::get<std::string>(second).data());
+
+  // An unshared slot takes the new value in its existing box
+  text = Value(std::string("replacement"));
+  EXPECT_EQ(&text.view(scratch), &first);
+  EXPECT_EQ(std::get<std::string>(first), "replacement");
+
+  // A shared one leaves the other holder's view alone
+  CompactValue copy = text;
+  text = Value(std::string("changed"));
+  EXPECT_EQ(std::get<std::string>(copy.view(scratch)), "replacement");
+  EXPECT_EQ(std::get<std::string>(text.toValue()), "changed");
+
+  CompactValue number{Value(static_cast<int32_t>(4))};
+  EXPECT_EQ(&number.view(scratch), &scratch);
+  EXPECT_EQ(std::get<int32_t>(scratch), 4);
+
+  EXPECT_EQ(std::get<std::string>(copy.take()), "replacement");
+  EXPECT_EQ(std::get<std::string>(text.take()), "changed");
+}
+
+TEST(CompactValueTest, MutableArrayCopiesOnlyWhenShared) {
+  CompactValue array{Value(ValueHelper::createArray(
+      TypeInfo(DataType::INT32), {static_cast<int32_t>(1)}))};
+  CompactValue copy = array;
+  Value scratch;
+  const Value &before = copy.view(scratch);
+
+  array.mutableArray().push(static_cast<int32_t>(2));
+  EXPECT_EQ(ValueHelper::arrayValue(before).length(), 1u);
+  EXPECT_EQ(array.array()->length(), 2u);
+
+  // Unshared, the same elements are changed in place
+  const ArrayValue *elements = array.array().get();
+  array.mutableArray().push(static_cast<int32_t>(3));
+  EXPECT_EQ(array.array().get(), elements);
+
+  // A handle held outside the slot still gets its own copy
+  ArrayPtr outside = array.array();
+  array.mutableArray().push(static_cast<int32_t>(4));
+  EXPECT_EQ(outside->length(), 3u);
+  EXPECT_EQ(array.array()->length(), 4u);
+}
+
+TEST(CompactValueTest, LocalsSharedBetweenSlotsStayApart) {
+  // Frame slots, closure slots and VM registers all hold CompactValues
+  for (ExecutionEngine engine :
+       {ExecutionEngine::TREE_WALKER, ExecutionEngine::BYTECODE,
+        ExecutionEngine::CLOSURE}) {
+    ScriptManager manager;
+    manager.setExecutionEngine(engine);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(R"(
+        int32 grow(int32[] values, string text) {
+            push(values, 9);
+            text += "!";
+            return len(values);
+        }
+
+        string shared() {
+            string a = "first";
+            string b = a;
+            b += "-second";
+            int32[] xs = [1, 2];
+            int32[] ys = xs;
+            push(ys, 3);
+            int32[] zs = [0];
+            zs = ys;
+            zs[0] = 7;
+            int32 grown = grow(xs, a);
+            return a + " " + b + " " + len(xs) + " " + len(ys) + " " +
+                   ys[0] + " " + zs[0] + " " + grown;
+        }
+    )",
+                                         "shared.script", errors));
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure("shared", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "first first-second 2 3 1 7 3")
+        << static_cast<int>(engine);
+  }
+}
@@ -158,3 +158,60 @@ TEST(ControlFlowTest, TernaryExpression) {
   ASSERT_TRUE(manager.executeProcedure("nested", {static_cast<int32_t>(-1)}, result, errorMsg));
   EXPECT_EQ(std::get<int32_t>(result), 0);
 }
+
+TEST(ControlFlowTest, ReturnFromNestedLoopsAndSwitch) {
+  std::string source =
+      "int32 find(int32 target) {"
+      "  for (int32 i = 0; i < 10; i += 1) {"
+      "    int32 j = 0;"
+      "    while (true) {"
+      "      switch (j) {"
+      "        case 3: if (i * 3 + j == target) { return i * 100 + j; } break;"
+      "        default: j += 1; continue;"
+      "      }"
+      "      break;"
+      "    }"
+      "  }"
+      "  return -1;"
+      "}";
+
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "nested.script", errors));
+
+  Value result;
+  std::string errorMsg;
+
+  ASSERT_TRUE(manager.executeProcedure("find", {static_cast<int32_t>(15)}, result, errorMsg));
+  EXPECT_EQ(std::get<int32_t>(result), 403);
+
+  ASSERT_TRUE(manager.executeProcedure("find", {static_cast<int32_t>(1)}, result, errorMsg));
+  EXPECT_EQ(std::get<int32_t>(result), -1);
+}
+
+TEST(ControlFlowTest, BreakOrContinueOutsideLoopIsRuntimeError) {
+  std::string source =
+      "void strayBreak() { int32 x = 1; if (x > 0) { break; } }"
+      "void strayContinue() { continue; }"
+      "int32 caller() {"
+      "  int32 n = 0;"
+      "  while (n < 3) { n += 1; strayBreak(); }"
+      "  return n;"
+      "}";
+
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "stray.script", errors));
+
+  Value result;
+  std::string errorMsg;
+
+  EXPECT_FALSE(manager.executeProcedure("strayBreak", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("'break' outside of a loop or switch"), std::string::npos) << errorMsg;
+
+  EXPECT_FALSE(manager.executeProcedure("strayContinue", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("'continue' outside of a loop"), std::string::npos) << errorMsg;
+
+  // A stray break never escapes into the caller's loop
+  EXPECT_FALSE(manager.executeProcedure("caller", {}, result, errorMsg));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Lexer.h"
+#include "Parser.h"
+#include "Resolver.h"
+#include "ScriptManager.h"
+#include <gtest/gtest.h>
+#include <functional>
+#include <initializer_list>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Helpers shared by the tests. Tests that run scripts use the default
+// engine; ctest runs them again under each engine through CXXSCRIPT_ENGINE
+// and CXXSCRIPT_JIT (see ENGINE_TEST_TARGETS in CMakeLists.txt).
+
+namespace TestHelpers {
+
+// The message of the runtime_error f throws, or "" if it throws none
+inline std::string errorOf(const std::function<void()> &f) {
+  try {
+    f();
+  } catch (const std::runtime_error &e) {
+    return e.what();
+  }
+  return "";
+}
+
+inline Script::ScriptPtr parse(const std::string &source,
+                                const std::string &filename = "test") {
+  Script::Lexer lexer(source, filename);
+  Script::Parser parser(lexer.tokenize(), filename);
+  return parser.parse();
+}
+
+// The script with its variables resolved to frame slots, for tests that
+// run single passes over it
+inline Script::ScriptPtr parseAndResolve(const std::string &source,
+                                         const std::string &filename = "test") {
+  Script::ScriptPtr script = parse(source, filename);
+  Script::Resolver resolver;
+  resolver.resolve(*script);
+  return script;
+}
+
+inline Script::BlockStmt *bodyOf(const Script::ScriptPtr &script,
+                                 size_t index = 0) {
+  return dynamic_cast<Script::BlockStmt *>(
+      script->procedures[index]->body.get());
+}
+
+inline Script::Value intArray(std::initializer_list<int32_t> values) {
+  std::vector<Script::Value> elements(values.begin(), values.end());
+  return Script::ValueHelper::createArray(
+      Script::TypeInfo(Script::DataType::INT32), elements);
+}
+
+// The script as loadScriptSource leaves it, printed with the AST dump
+// without its "// filename" line
+inline std::string loaded(Script::ScriptManager &manager,
+                          const std::string &source) {
+  std::ostringstream dump;
+  manager.setAstDump(&dump);
+  std::vector<Script::CompilationError> errors;
+  EXPECT_TRUE(manager.loadScriptSource(source, "test.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+  manager.setAstDump(nullptr);
+  std::string text = dump.str();
+  return text.substr(text.find('\n') + 1);
+}
+
+template <typename T>
+std::vector<T> elementsOf(const Script::Value &array) {
+  std::vector<T> out;
+  for (const auto &element : Script::ValueHelper::arrayElements(array)) {
+    out.push_back(std::get<T>(element));
+  }
+  return out;
+}
+
+} // namespace TestHelpers
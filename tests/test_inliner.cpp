@@ -0,0 +1,255 @@
+#include "AstPrinter.h"
+#include "Inliner.h"
+#include "Interpreter.h"
+#include "Optimizer.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include "TypeChecker.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+ScriptPtr load(Interpreter &interp, const std::string &source) {
+  auto script = parseAndResolve(source);
+  Optimizer optimizer;
+  optimizer.optimize(*script);
+  TypeChecker checker;
+  checker.check(*script);
+  interp.loadScript(script);
+  return script;
+}
+
+// The call returned by the last statement of procedure index
+CallExpr *returnedCall(const ScriptPtr &script, size_t index) {
+  auto *body =
+      dynamic_cast<BlockStmt *>(script->procedures[index]->body.get());
+  auto *ret = dynamic_cast<ReturnStmt *>(body->statements.back().get());
+  return dynamic_cast<CallExpr *>(ret->value.get());
+}
+
+std::string inlinedText(const ScriptPtr &script, size_t index) {
+  CallExpr *call = returnedCall(script, index);
+  return call && call->inlined ? AstPrinter::print(*call->inlined) : "";
+}
+
+const char *HELPERS = R"(
+    bool isValidAge(int32 age) {
+        int32 limit = 150;
+        return age >= 0 && age <= limit;
+    }
+    bool isAdult(int32 age) {
+        return isValidAge(age) && age >= 18;
+    }
+    int32 factorial(int32 n) {
+        return n <= 1 ? 1 : n * factorial(n - 1);
+    }
+    int32 twice(int32 n) {
+        int32 doubled = n * 2;
+        return doubled;
+    }
+    int32 grow(int32[] xs) {
+        return push(xs, 1);
+    }
+    double half(double d) {
+        return d / 2;
+    }
+)";
+
+} // namespace
+
+TEST(InlinerTest, InlinesSmallProcedures) {
+  Interpreter interp;
+  load(interp, HELPERS);
+  auto callers = load(interp, R"(
+        bool valid(int32 a) { return isValidAge(a); }
+        bool adult(int32 a) { return isAdult(a); }
+        bool literal() { return isValidAge(30); }
+        bool computed(int32 a) { return isValidAge(a + 1); }
+        int32 recursive(int32 a) { return factorial(a); }
+        int32 statements(int32 a) { return twice(a); }
+        int32 pushes(int32[] xs) { return grow(xs); }
+        double converted(int32 a) { return half(a); }
+    )");
+
+  EXPECT_EQ(inlinedText(callers, 0), "(a >= 0) && (a <= 150)");
+  EXPECT_EQ(inlinedText(callers, 1), "isValidAge(a) && (a >= 18)");
+  EXPECT_EQ(inlinedText(callers, 2), "(30 >= 0) && (30 <= 150)");
+
+  // The copy's own calls are inlined in turn
+  auto *adult = returnedCall(callers, 1);
+  auto *inner =
+      dynamic_cast<BinaryExpr *>(adult->inlined.get())->left.get();
+  ASSERT_EQ(inner->kind, NodeKind::CALL);
+  EXPECT_TRUE(static_cast<CallExpr *>(inner)->inlined);
+  EXPECT_EQ(adult->inlinedProcedure.lock(), interp.getProcedure("isAdult"));
+
+  // Computed arguments, recursion, bodies that do more than return an
+  // expression, pushes and arguments that need converting are called
+  EXPECT_EQ(inlinedText(callers, 3), "");
+  EXPECT_EQ(inlinedText(callers, 4), "");
+  EXPECT_EQ(inlinedText(callers, 5), "");
+  EXPECT_EQ(inlinedText(callers, 6), "");
+  EXPECT_EQ(inlinedText(callers, 7), "");
+  EXPECT_EQ(Inliner::inlinableBody(*interp.getProcedure("factorial")),
+            nullptr);
+}
+
+TEST(InlinerTest, CallersLoadedFirstInlineLaterCallees) {
+  Interpreter interp;
+  auto callers =
+      load(interp, "bool adult(int32 a) { return isAdult(a); }");
+  EXPECT_EQ(inlinedText(callers, 0), "");
+
+  // Loading the callee afterwards gives the caller the same copy as
+  // loading both together
+  load(interp, HELPERS);
+  EXPECT_EQ(inlinedText(callers, 0), "isValidAge(a) && (a >= 18)");
+  auto *adult = returnedCall(callers, 0);
+  EXPECT_EQ(adult->inlinedProcedure.lock(), interp.getProcedure("isAdult"));
+  EXPECT_TRUE(static_cast<CallExpr *>(
+                  dynamic_cast<BinaryExpr *>(adult->inlined.get())->left.get())
+                  ->inlined);
+  EXPECT_EQ(std::get<bool>(interp.executeProcedure(
+                "adult", {static_cast<int32_t>(20)})),
+            true);
+  EXPECT_EQ(std::get<bool>(interp.executeProcedure(
+                "adult", {static_cast<int32_t>(200)})),
+            false);
+
+  // Callers the engine compiled before the callee arrived run its copy
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(
+      "int32 total(int32 n) { return bonus(n) * 10; }", "first.script",
+      errors));
+  ASSERT_TRUE(manager.loadScriptSource(
+      "int32 bonus(int32 n) { return n + 1; }", "second.script", errors));
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "total", {static_cast<int32_t>(4)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 50);
+}
+
+TEST(InlinerTest, InlinedCallsGiveTheSameResults) {
+  const char *source = R"(
+        bool inRange(int32 v, int32 lo, int32 hi) { return v >= lo && v <= hi; }
+        bool isValidAge(int32 age) { return inRange(age, 0, 150); }
+        bool isValidScore(int32 s) { return inRange(s, 0, 100); }
+        bool isEven(int32 n) { return n % 2 == 0; }
+        int32 clamp(int32 v, int32 lo, int32 hi) {
+            return v < lo ? lo : (v > hi ? hi : v);
+        }
+        string label(int32 n) { return "#" + n; }
+        int32 ratio(int32 a, int32 b) { return a / b; }
+
+        int32 validate(int32 count) {
+            int32 passed = 0;
+            for (int32 i = -20; i < count; i += 1) {
+                if (isValidAge(i) && isValidScore(i) && isEven(i) &&
+                    clamp(i, 10, 90) == i) {
+                    passed += 1;
+                }
+            }
+            return passed;
+        }
+        string describe(int32 n) { return label(n); }
+        int32 divide(int32 a, int32 b) { return ratio(a, b); }
+    )";
+  for (bool inlining : {true, false}) {
+    ScriptManager manager;
+    manager.setInliningEnabled(inlining);
+    EXPECT_EQ(manager.isInliningEnabled(), inlining);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "inline.script", errors))
+        << (errors.empty() ? "" : errors[0].message);
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure(
+        "validate", {static_cast<int32_t>(200)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 41);
+    ASSERT_TRUE(manager.executeProcedure(
+        "describe", {static_cast<int32_t>(7)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "#7");
+
+    // Errors in the callee still surface
+    EXPECT_FALSE(manager.executeProcedure(
+        "divide", {static_cast<int32_t>(1), static_cast<int32_t>(0)},
+        result, errorMsg));
+    EXPECT_NE(errorMsg.find("Division by zero"), std::string::npos)
+        << errorMsg;
+  }
+}
+
+TEST(InlinerTest, ReloadedCalleesAreCalled) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(R"(
+          int32 bonus(int32 n) { return n + 1; }
+          int32 total(int32 n) { return bonus(n) * 10; }
+      )",
+                                       "first.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "total", {static_cast<int32_t>(4)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 50);
+
+  // The copy of the first bonus is out of date once it is replaced,
+  // whether by a small procedure or not
+  ASSERT_TRUE(manager.loadScriptSource(
+      "int32 bonus(int32 n) { return n + 2; }", "second.script", errors));
+  ASSERT_TRUE(manager.executeProcedure(
+      "total", {static_cast<int32_t>(4)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 60);
+
+  ASSERT_TRUE(manager.loadScriptSource(
+      "int32 bonus(int32 n) { int32 m = n * 3; return m; }",
+      "third.script", errors));
+  ASSERT_TRUE(manager.executeProcedure(
+      "total", {static_cast<int32_t>(4)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 120);
+}
+
+TEST(InlinerTest, ReloadedCalleesKeepTheirReturnType) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(R"(
+          int32 callee(int32 x) { return x + 1; }
+          string caller(int32 v) { return "r=" + callee(v); }
+          int32 stored(int32 v) { int32 r = callee(v); return r; }
+      )",
+                                       "first.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "caller", {static_cast<int32_t>(5)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<std::string>(result), "r=6");
+
+  // The callers were typed against the int32 callee; the double one's
+  // result reaches them unconverted, as it would without the checker,
+  // and the declaration still converts it
+  ASSERT_TRUE(manager.loadScriptSource(
+      "double callee(double x) { return x * 1.5; }", "second.script", errors));
+  ASSERT_TRUE(manager.executeProcedure(
+      "caller", {static_cast<int32_t>(5)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<std::string>(result), "r=7.500000");
+  ASSERT_TRUE(manager.executeProcedure(
+      "stored", {static_cast<int32_t>(5)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 7);
+}
@@ -0,0 +1,236 @@
+#include "Interpreter.h"
+#include "JitCompiler.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <cmath>
+#include <gtest/gtest.h>
+
+using namespace Script;
+
+namespace {
+
+// Runs the same procedure with and without the JIT and checks the results
+// agree, including the runtime type of the result.
+Value runWithAndWithoutJit(const std::string &source, const std::string &proc,
+                           const std::vector<Value> &args) {
+  Value results[2];
+
+  for (int i = 0; i < 2; ++i) {
+    ScriptManager manager;
+    manager.setJitEnabled(i == 1);
+    std::vector<CompilationError> errors;
+    EXPECT_TRUE(manager.loadScriptSource(source, "jit.script", errors));
+
+    std::string errorMsg;
+    EXPECT_TRUE(manager.executeProcedure(proc, args, results[i], errorMsg))
+        << errorMsg;
+  }
+
+  EXPECT_EQ(results[0].index(), results[1].index());
+  EXPECT_TRUE(ValueHelper::equals(results[0], results[1]))
+      << ValueHelper::toString(results[0]) << " vs "
+      << ValueHelper::toString(results[1]);
+  return results[1];
+}
+
+// Loads a script into a JIT-enabled interpreter, runs it once and returns
+// the compilation outcome for the procedure.
+std::shared_ptr<JitProcedure> compiled(Interpreter &interpreter,
+                                       const std::string &source,
+                                       const std::string &proc,
+                                       const std::vector<Value> &args) {
+  interpreter.setJitEnabled(true);
+  interpreter.loadScript(TestHelpers::parse(source, "jit.script"));
+  interpreter.executeProcedure(proc, args);
+  return interpreter.getProcedure(proc)->jit;
+}
+
+} // namespace
+
+TEST(JitTest, SettingIsKeptAcrossClear) {
+  ScriptManager manager;
+  manager.setJitEnabled(false);
+  EXPECT_FALSE(manager.isJitEnabled());
+
+  manager.setJitEnabled(true);
+  manager.clear();
+  EXPECT_TRUE(manager.isJitEnabled());
+}
+
+TEST(JitTest, ChecksumAndBitTwiddling) {
+  if (!JitCompiler::isSupported()) {
+    GTEST_SKIP() << "JIT not supported on this platform";
+  }
+
+  std::string source = R"(
+        int64 checksum(int32 n) {
+            int64 hash = 1469598103;
+            for (int32 i = 0; i < n; i += 1) {
+                hash = (hash ^ i) * 16777619;
+                hash = hash & 4294967295;
+                if ((i & 7) == 3) { continue; }
+                hash = hash + ((i << 3) >> 1);
+            }
+            return hash;
+        }
+    )";
+
+  Interpreter interpreter;
+  auto jit = compiled(interpreter, source, "checksum",
+                      {static_cast<int32_t>(1)});
+  ASSERT_NE(jit, nullptr);
+  EXPECT_NE(jit->entry, nullptr) << jit->declined;
+
+  runWithAndWithoutJit(source, "checksum", {static_cast<int32_t>(1000)});
+}
+
+TEST(JitTest, PromotionMatchesInterpreter) {
+  if (!JitCompiler::isSupported()) {
+    GTEST_SKIP() << "JIT not supported on this platform";
+  }
+
+  std::string source = R"(
+        double mixed(int32 a, int64 b, double c, bool flag) {
+            int32 narrow = a * 65536 * 65536;
+            int64 wide = a + b;
+            double ratio = wide / c;
+            int32 truncated = ratio;
+            bool big = ratio > 2 && !flag;
+            int32 neg = -wide;
+            int32 q = a / 7 + a % 7;
+            int64 bits = ~a;
+            if (big == true) { q += 1; }
+            if (flag == 1) { q += 100; }
+            double total = narrow + wide + ratio + truncated + neg + q + bits;
+            return flag ? total : -total;
+        }
+    )";
+
+  Interpreter interpreter;
+  auto jit = compiled(interpreter, source, "mixed",
+                      {static_cast<int32_t>(3), static_cast<int64_t>(4), 1.5,
+                       false});
+  EXPECT_NE(jit->entry, nullptr) << jit->declined;
+
+  Value result = runWithAndWithoutJit(
+      source, "mixed",
+      {static_cast<int32_t>(-123457), static_cast<int64_t>(5000000000), 2.5,
+       true});
+  EXPECT_TRUE(std::holds_alternative<double>(result));
+  runWithAndWithoutJit(source, "mixed",
+                       {static_cast<int32_t>(99), static_cast<int64_t>(-7), 0.25,
+                        false});
+}
+
+TEST(JitTest, DoubleComparisonsWithNaN) {
+  if (!JitCompiler::isSupported()) {
+    GTEST_SKIP() << "JIT not supported on this platform";
+  }
+
+  std::string source = R"(
+        int32 compare(double a, double b) {
+            int32 mask = 0;
+            if (a < b) { mask += 1; }
+            if (a <= b) { mask += 2; }
+            if (a > b) { mask += 4; }
+            if (a >= b) { mask += 8; }
+            if (a == b) { mask += 16; }
+            if (a != b) { mask += 32; }
+            if (a) { mask += 64; }
+            return mask;
+        }
+    )";
+
+  double nan = std::nan("");
+  EXPECT_EQ(std::get<int32_t>(runWithAndWithoutJit(source, "compare",
+                                                   {nan, 1.0})),
+            96);
+  runWithAndWithoutJit(source, "compare", {1.0, 1.0});
+  runWithAndWithoutJit(source, "compare", {0.0, -1.0});
+}
+
+TEST(JitTest, LoopsAndSwitch) {
+  if (!JitCompiler::isSupported()) {
+    GTEST_SKIP() << "JIT not supported on this platform";
+  }
+
+  std::string source = R"(
+        int32 score(int32 n) {
+            int32 total = 0;
+            int32 i = 0;
+            while (true) {
+                i += 1;
+                if (i > n) { break; }
+                switch (i % 4) {
+                    case 0: continue;
+                    case 1: total += i; break;
+                    default: total -= 1;
+                    case 3: total *= 2;
+                }
+            }
+            do { total -= 7; } while (total > 1000);
+            return total;
+        }
+    )";
+
+  Interpreter interpreter;
+  auto jit = compiled(interpreter, source, "score", {static_cast<int32_t>(3)});
+  EXPECT_NE(jit->entry, nullptr) << jit->declined;
+
+  runWithAndWithoutJit(source, "score", {static_cast<int32_t>(25)});
+}
+
+TEST(JitTest, UnsupportedProceduresFallBack) {
+  std::string source = R"(
+        int32 helper(int32 x) { return x + 1; }
+        int32 calls(int32 x) { return helper(x); }
+        int32 arrays(int32 x) { int32[] a = [x, 2]; return a[0]; }
+        int32 retyped(int32 x) { int32 y = 1; y = 2.5; return y * x; }
+    )";
+
+  for (const char *name : {"calls", "arrays", "retyped"}) {
+    Interpreter interpreter;
+    auto jit = compiled(interpreter, source, name, {static_cast<int32_t>(1)});
+    ASSERT_NE(jit, nullptr);
+    EXPECT_EQ(jit->entry, nullptr) << name;
+    EXPECT_FALSE(jit->declined.empty()) << name;
+
+    runWithAndWithoutJit(source, name, {static_cast<int32_t>(4)});
+  }
+}
+
+TEST(JitTest, RuntimeErrorsMatchInterpreter) {
+  std::string source = R"(
+        int32 divide(int32 a, int32 b) { return a / b; }
+        double fdivide(double a, double b) { return a / b; }
+        int32 missing(int32 a) { if (a > 0) { return 1; } }
+    )";
+
+  ScriptManager manager;
+  manager.setJitEnabled(true);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "jit.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "divide", {static_cast<int32_t>(7), static_cast<int32_t>(2)}, result,
+      errorMsg));
+  EXPECT_EQ(std::get<int32_t>(result), 3);
+
+  EXPECT_FALSE(manager.executeProcedure(
+      "divide", {static_cast<int32_t>(7), static_cast<int32_t>(0)}, result,
+      errorMsg));
+  EXPECT_NE(errorMsg.find("Division by zero"), std::string::npos) << errorMsg;
+
+  EXPECT_FALSE(manager.executeProcedure("fdivide", {1.0, -0.0}, result,
+                                        errorMsg));
+  EXPECT_NE(errorMsg.find("Division by zero"), std::string::npos) << errorMsg;
+
+  ASSERT_TRUE(manager.executeProcedure("missing", {static_cast<int32_t>(1)},
+                                       result, errorMsg));
+  EXPECT_FALSE(manager.executeProcedure("missing", {static_cast<int32_t>(0)},
+                                        result, errorMsg));
+  EXPECT_NE(errorMsg.find("must return a value"), std::string::npos)
+      << errorMsg;
+}
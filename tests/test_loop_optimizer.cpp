@@ -0,0 +1,370 @@
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+std::string loaded(const std::string &source) {
+  ScriptManager manager;
+  return TestHelpers::loaded(manager, source);
+}
+
+} // namespace
+
+TEST(LoopOptimizerTest, HoistsInvariantExpressions) {
+  EXPECT_EQ(loaded(R"(
+        int32 total(int32[] xs, int32 scale) {
+            int32 sum = 0;
+            int32 i = 0;
+            while (i < len(xs)) {
+                sum += xs[i] * (scale + 1);
+                i += 1;
+            }
+            return sum;
+        }
+    )"),
+            "int32 total(int32[] xs, int32 scale) {\n"
+            "    int32 sum = 0;\n"
+            "    int32 i = 0;\n"
+            "    {\n"
+            "        int32 $4 = len(xs);\n"
+            "        int32 $5 = scale + 1;\n"
+            "        while (i < $4) {\n"
+            "            sum += xs[i] * $5;\n"
+            "            i += 1;\n"
+            "        }\n"
+            "    }\n"
+            "    return sum;\n"
+            "}\n");
+
+  // What is invariant in both loops leaves both; what the outer loop
+  // writes only leaves the inner one
+  EXPECT_EQ(loaded(R"(
+        int32 grid(int32 w, int32 h) {
+            int32 cells = 0;
+            for (int32 y = 0; y < h * 2; y += 1) {
+                for (int32 x = 0; x < w; x += 1) {
+                    cells += x + y * w + (w - 1);
+                }
+            }
+            return cells;
+        }
+    )"),
+            "int32 grid(int32 w, int32 h) {\n"
+            "    int32 cells = 0;\n"
+            "    {\n"
+            "        int32 $5 = h * 2;\n"
+            "        int32 $6 = w - 1;\n"
+            "        for (int32 y = 0; y < $5; y += 1) {\n"
+            "            {\n"
+            "                int32 $7 = y * w;\n"
+            "                for (int32 x = 0; x < w; x += 1) {\n"
+            "                    cells += (x + $7) + $6;\n"
+            "                }\n"
+            "            }\n"
+            "        }\n"
+            "    }\n"
+            "    return cells;\n"
+            "}\n");
+}
+
+TEST(LoopOptimizerTest, KeepsWhatTheLoopChangesOrMayFail) {
+  // Locals the loop assigns, divisions by a local and array elements in
+  // a branch the loop may not take, fields of records the loop writes to,
+  // and arrays that may share an external array the loop writes to all
+  // stay in the loop
+  const char *source = R"(
+        struct Point { int32 x; int32 y; }
+        int32 f(int32 n, int32 d, int32[] xs, Point p) {
+            int32 k = 0;
+            int32 t = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                k += 1;
+                t += k * 2 + p.x * 3;
+                if (k > 1) {
+                    t += n / d + xs[0];
+                }
+                p.y = i;
+            }
+            return t;
+        }
+        int32 zeroTrip() {
+            Point p = Point(1, 2);
+            return f(0, 0, [1], p);
+        }
+        int32 aliased() {
+            int32[] a = ext;
+            int32 n = 0;
+            int32 i = 0;
+            while (i < len(a)) {
+                if (i < 3) {
+                    push(ext, 9);
+                }
+                i += 1;
+                n += 1;
+            }
+            return n;
+        }
+    )";
+  std::string text = loaded(source);
+  EXPECT_EQ(text.find('$'), std::string::npos) << text;
+
+  for (bool optimize : {true, false}) {
+    Value ext = intArray({1, 2, 3});
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    manager.registerExternalVariable("ext", [&]() -> Value { return ext; });
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "loop.script", errors));
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure("zeroTrip", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 0);
+    ASSERT_TRUE(manager.executeProcedure("aliased", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 3);
+    EXPECT_EQ(ValueHelper::arrayValue(ext).size(), 6u);
+  }
+}
+
+TEST(LoopOptimizerTest, HoistedScriptsGiveTheSameResults) {
+  const char *source = R"(
+        struct Box { int32 w; int32 h; }
+        int32 area(Box b, int32 n) {
+            int32 total = 0;
+            int32 i = 0;
+            do {
+                total += b.w * b.h + i;
+                i += 1;
+            } while (i < n && b.w > 0);
+            return total;
+        }
+        string repeat(string s, int32 n) {
+            string out = "";
+            for (int32 i = 0; i < n; i += 1) {
+                out += s + "-" + n;
+            }
+            return out;
+        }
+        int32 grow(int32 n) {
+            int32[] xs = [1];
+            map<string, int32> seen;
+            int32 steps = 0;
+            while (len(xs) < n) {
+                push(xs, len(xs) * 2);
+                put(seen, "k" + len(xs), len(seen));
+                steps += len(seen) + len(xs) % 3;
+            }
+            return steps;
+        }
+        double scaled(double[] values, double factor, int32 shift) {
+            double total = 0;
+            for (int32 i = 0; i < len(values); i += 1) {
+                total += values[i] * (factor > 1 ? factor : -factor) +
+                         (shift << 2) / 4;
+            }
+            return total;
+        }
+        int32 areaOf(int32 n) { return area(Box(3, 4), n); }
+        double scaledOf(double f) { return scaled([1.5, 2.5], f, 3); }
+    )";
+  for (bool optimize : {true, false}) {
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "loops.script", errors))
+        << (errors.empty() ? "" : errors[0].message);
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure(
+        "areaOf", {static_cast<int32_t>(5)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 70);
+    ASSERT_TRUE(manager.executeProcedure(
+        "repeat", {std::string("ab"), static_cast<int32_t>(2)}, result,
+        errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "ab-2ab-2");
+    ASSERT_TRUE(manager.executeProcedure(
+        "grow", {static_cast<int32_t>(5)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 15);
+    ASSERT_TRUE(manager.executeProcedure("scaledOf", {0.5}, result, errorMsg))
+        << errorMsg;
+    EXPECT_DOUBLE_EQ(std::get<double>(result), 4.0);
+  }
+}
+
+TEST(LoopOptimizerTest, CallsPureExternalsOncePerLoop) {
+  const char *source = R"(
+        int32 run(int32 n, int32 base) {
+            int32 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                total += weight(base) + weight(i);
+            }
+            return total;
+        }
+    )";
+  // weight(i) changes with i; weight(base) is called once if pure and
+  // registered with the type of the local that keeps its result
+  struct Case {
+    bool pure;
+    DataType returns;
+    int calls;
+  };
+  const Case CASES[] = {{true, DataType::INT32, 5},
+                        {true, DataType::VOID, 8},
+                        {false, DataType::INT32, 8}};
+  for (const Case &test : CASES) {
+    int calls = 0;
+    ScriptManager manager;
+    manager.registerExternalFunction(
+        "weight",
+        [&calls](const std::vector<Value> &args) -> Value {
+          ++calls;
+          return static_cast<int32_t>(ValueHelper::toInt64(args[0]) * 10);
+        },
+        test.pure, TypeInfo(test.returns));
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "pure.script", errors));
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure(
+        "run", {static_cast<int32_t>(4), static_cast<int32_t>(2)}, result,
+        errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 140);
+    EXPECT_EQ(calls, test.calls);
+  }
+}
+
+TEST(LoopOptimizerTest, MovesWhatMayFailOnlyWhereItWouldRunFirst) {
+  // strlen(s, s) throws, so it leaves the for loop behind a copy of its
+  // condition and the while loop only because its condition calls it
+  // first; after the assignment to t it stays
+  const char *source = R"(
+        int32 bad(string s, int32 n) {
+            int32 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                total += strlen(s, s);
+            }
+            return total;
+        }
+        int32 scan(string s, int32 n) {
+            int32 i = 0;
+            int32 t = 0;
+            while (i < strlen(s) + n) {
+                t += 1;
+                t += strlen(s);
+                i += 1;
+            }
+            return t;
+        }
+    )";
+  // The typed helper rejects a second argument, and gives the result type
+  auto registerStrlen = [](ScriptManager &manager) {
+    manager.registerExternalFunctionUnary<int32_t, std::string>(
+        "strlen",
+        [](const std::string &s) { return static_cast<int32_t>(s.size()); },
+        true);
+  };
+  ScriptManager manager;
+  registerStrlen(manager);
+  EXPECT_EQ(loaded(manager, source),
+            "int32 bad(string s, int32 n) {\n"
+            "    int32 total = 0;\n"
+            "    {\n"
+            "        int32 i = 0;\n"
+            "        if (i < n) {\n"
+            "            int32 $4 = strlen(s, s);\n"
+            "            for (; i < n; i += 1) {\n"
+            "                total += $4;\n"
+            "            }\n"
+            "        }\n"
+            "    }\n"
+            "    return total;\n"
+            "}\n"
+            "int32 scan(string s, int32 n) {\n"
+            "    int32 i = 0;\n"
+            "    int32 t = 0;\n"
+            "    {\n"
+            "        int32 $4 = strlen(s);\n"
+            "        while (i < ($4 + n)) {\n"
+            "            t += 1;\n"
+            "            t += strlen(s);\n"
+            "            i += 1;\n"
+            "        }\n"
+            "    }\n"
+            "    return t;\n"
+            "}\n");
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "bad", {std::string("abc"), static_cast<int32_t>(0)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 0);
+  EXPECT_FALSE(manager.executeProcedure(
+      "bad", {std::string("abc"), static_cast<int32_t>(1)}, result, errorMsg));
+  ASSERT_TRUE(manager.executeProcedure(
+      "scan", {std::string("abc"), static_cast<int32_t>(1)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 16);
+}
+
+TEST(LoopOptimizerTest, StopsRelyingOnExternalsThatStopBeingPure) {
+  // Once tick is shadowed by a procedure that counts, or registered again
+  // as impure, run calls it on every iteration again
+  const char *source = R"(
+        int32 run(int32 n) {
+            int32 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                total += tick(7) * 1000 + i;
+            }
+            return total;
+        }
+    )";
+  auto run = [](ScriptManager &manager) {
+    Value result;
+    std::string errorMsg;
+    EXPECT_TRUE(manager.executeProcedure("run", {static_cast<int32_t>(4)},
+                                         result, errorMsg))
+        << errorMsg;
+    return std::get<int32_t>(result);
+  };
+  for (bool optimize : {true, false}) {
+    for (bool shadow : {true, false}) {
+      int32_t counter = 0;
+      ScriptManager manager;
+      manager.setOptimizationsEnabled(optimize);
+      manager.registerExternalFunctionUnary<int32_t, int32_t>(
+          "tick", [](int32_t v) { return v; }, true);
+      manager.registerExternalVariable(
+          "counter", [&counter]() -> Value { return counter; },
+          [&counter](const Value &v) { counter = std::get<int32_t>(v); });
+      std::vector<CompilationError> errors;
+      ASSERT_TRUE(manager.loadScriptSource(source, "run.script", errors));
+      EXPECT_EQ(run(manager), 28006);
+
+      if (shadow) {
+        ASSERT_TRUE(manager.loadScriptSource(R"(
+              int32 tick(int32 v) { counter = counter + 1; return counter; }
+          )",
+                                             "tick.script", errors));
+      } else {
+        manager.registerExternalFunction(
+            "tick", [&counter](const std::vector<Value> &) -> Value {
+              return ++counter;
+            });
+      }
+      EXPECT_EQ(run(manager), 10006);
+      EXPECT_EQ(counter, 4);
+    }
+  }
+}
@@ -0,0 +1,297 @@
+#include "MapBuiltins.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <unordered_map>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+Value call(const std::string &name, const std::vector<Value> &args) {
+  return MapBuiltins::call(name, args);
+}
+
+} // namespace
+
+TEST(MapTest, MatchesUnorderedMapThroughPutsAndRemoves) {
+  MapValue map(DataType::INT64, DataType::INT32);
+  std::unordered_map<int64_t, int32_t> reference;
+  std::mt19937 rng(7);
+  for (int i = 0; i < 20000; ++i) {
+    int64_t key = static_cast<int64_t>(rng() % 512) - 256;
+    auto value = static_cast<int32_t>(rng());
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(map.remove(key), reference.erase(key) == 1) << key;
+    } else {
+      map.put(key, value);
+      reference[key] = value;
+    }
+  }
+  ASSERT_EQ(map.size(), reference.size());
+  for (int64_t key = -300; key < 300; ++key) {
+    Value value;
+    auto it = reference.find(key);
+    ASSERT_EQ(map.get(key, value), it != reference.end()) << key;
+    if (it != reference.end()) {
+      EXPECT_EQ(std::get<int32_t>(value), it->second) << key;
+    }
+  }
+  // The keys are a typed array holding each key once
+  const ArrayValue &keys = *map.keys();
+  ASSERT_NE(keys.buffer<int64_t>(), nullptr);
+  for (int64_t key : *keys.buffer<int64_t>()) {
+    EXPECT_EQ(reference.count(key), 1u);
+  }
+}
+
+TEST(MapTest, KeysOfEachScalarType) {
+  MapValue words(DataType::STRING, DataType::DOUBLE);
+  words.put(std::string("a"), 1.0);
+  words.put(std::string("b"), 2.0);
+  words.put(std::string("a"), 3.0);
+  Value value;
+  ASSERT_TRUE(words.get(std::string("a"), value));
+  EXPECT_DOUBLE_EQ(std::get<double>(value), 3.0);
+  EXPECT_EQ(words.size(), 2u);
+
+  // -0.0 and 0.0 are the same key, as == says
+  MapValue doubles(DataType::DOUBLE, DataType::BOOL);
+  doubles.put(-0.0, true);
+  EXPECT_TRUE(doubles.has(0.0));
+
+  MapValue flags(DataType::BOOL, DataType::INT32);
+  flags.put(true, static_cast<int32_t>(1));
+  EXPECT_FALSE(flags.has(false));
+
+  EXPECT_EQ(errorOf([&] { words.put(1.0, 1.0); }), "Map key must be string");
+  EXPECT_EQ(errorOf([&] { words.put(std::string("c"), 1); }),
+            "Map value must be double");
+  EXPECT_EQ(errorOf([] { MapValue(DataType::INT32, DataType::VOID); }),
+            "Map keys and values must be scalars");
+}
+
+TEST(MapTest, KeysAreSharedUntilTheMapChanges) {
+  Value map = ValueHelper::createMap(
+      TypeInfo::map(DataType::INT32, DataType::INT32));
+  call("put", {map, 1, 10});
+  call("put", {map, 2, 20});
+  Value keys = call("keys", {map});
+  EXPECT_EQ(std::get<ArrayPtr>(keys), ValueHelper::mapValue(map).keys());
+
+  call("remove", {map, 1});
+  EXPECT_EQ(ValueHelper::arrayValue(keys).size(), 2u);
+  EXPECT_EQ(ValueHelper::mapValue(map).keys()->size(), 1u);
+}
+
+TEST(MapTest, Builtins) {
+  TypeInfo type = TypeInfo::map(DataType::STRING, DataType::INT64);
+  EXPECT_EQ(ValueHelper::typeToString(type), "map<string, int64>");
+  Value map = ValueHelper::defaultValue(type);
+  EXPECT_TRUE(ValueHelper::getType(map) == type);
+
+  EXPECT_EQ(std::get<int32_t>(call("put", {map, std::string("x"), 5})), 1);
+  EXPECT_EQ(std::get<int64_t>(call("get", {map, std::string("x")})), 5);
+  EXPECT_EQ(std::get<int64_t>(call("get", {map, std::string("y"), 7})), 7);
+  EXPECT_TRUE(std::get<bool>(call("has", {map, std::string("x")})));
+  EXPECT_TRUE(std::get<bool>(call("remove", {map, std::string("x")})));
+  EXPECT_FALSE(std::get<bool>(call("remove", {map, std::string("x")})));
+
+  EXPECT_EQ(errorOf([&] { call("get", {map, std::string("x")}); }),
+            "Map has no key x");
+  EXPECT_EQ(errorOf([&] { call("has", {1, 1}); }),
+            "has expects a map as first argument");
+  EXPECT_EQ(errorOf([&] { call("put", {map, 1}); }), "put expects 3 arguments");
+
+  // Equal contents compare equal, whatever the order of insertion
+  Value other = ValueHelper::defaultValue(type);
+  call("put", {map, std::string("a"), 1});
+  call("put", {map, std::string("b"), 2});
+  call("put", {other, std::string("b"), 2});
+  call("put", {other, std::string("a"), 1});
+  EXPECT_TRUE(ValueHelper::equals(map, other));
+  call("put", {other, std::string("a"), 3});
+  EXPECT_FALSE(ValueHelper::equals(map, other));
+}
+
+TEST(MapTest, ScriptsCountAndShareMaps) {
+  const char *source = R"(
+        void tally(map<string, int32> counts, string word) {
+            put(counts, word, get(counts, word, 0) + 1);
+        }
+        int64 words() {
+            string[] text = ["a", "b", "a", "c", "a", "b"];
+            map<string, int32> counts;
+            for (int32 i = 0; i < len(text); i += 1) {
+                tally(counts, text[i]);
+            }
+            map<string, int32> alias = counts;
+            remove(alias, "c");
+            string[] seen = keys(counts);
+            int32 missing = 0;
+            if (!has(counts, "c")) {
+                missing = 1;
+            }
+            return get(counts, "a") * 10000 + get(counts, "b") * 1000
+                + len(counts) * 100 + len(seen) * 10 + missing;
+        }
+        int32 squares(int32 n) {
+            map<int32, int32> m;
+            for (int32 i = 0; i < n; i += 1) {
+                put(m, i, i * i);
+            }
+            for (int32 i = 0; i < n; i += 2) {
+                remove(m, i);
+            }
+            int32 total = 0;
+            int32[] ks = keys(m);
+            for (int32 i = 0; i < len(ks); i += 1) {
+                total += get(m, ks[i]);
+            }
+            return total;
+        }
+        int32 fresh() {
+            int32 total = 0;
+            for (int32 i = 0; i < 3; i += 1) {
+                map<int32, bool> m;
+                put(m, i, true);
+                total += len(m);
+            }
+            return total;
+        }
+        int32 missing() {
+            map<string, int32> m;
+            return get(m, "nope");
+        }
+        int32 mismatched() {
+            map<string, int32> m;
+            map<string, int64> other = m;
+            return 0;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "map.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("words", {}, result, errorMsg))
+      << errorMsg;
+  // The alias removed "c" from the one map both names refer to
+  EXPECT_EQ(std::get<int64_t>(result), 3 * 10000 + 2 * 1000 + 200 + 20 + 1);
+
+  ASSERT_TRUE(manager.executeProcedure("squares", {static_cast<int32_t>(100)},
+                                       result, errorMsg))
+      << errorMsg;
+  int32_t odd = 0;
+  for (int32_t i = 1; i < 100; i += 2) {
+    odd += i * i;
+  }
+  EXPECT_EQ(std::get<int32_t>(result), odd);
+
+  ASSERT_TRUE(manager.executeProcedure("fresh", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 3);
+
+  EXPECT_FALSE(manager.executeProcedure("missing", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Map has no key nope"), std::string::npos)
+      << errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("mismatched", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find(
+                "Cannot convert map<string, int32> to map<string, int64>"),
+            std::string::npos)
+      << errorMsg;
+}
+
+TEST(MapTest, RejectsMapsOfContainers) {
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  EXPECT_FALSE(manager.loadScriptSource(
+      "void f() { map<int32[], int32> m; }", "bad.script", errors));
+  ASSERT_FALSE(errors.empty());
+  EXPECT_NE(errors[0].message.find("Map keys and values must be scalars"),
+            std::string::npos)
+      << errors[0].message;
+
+  errors.clear();
+  EXPECT_FALSE(manager.loadScriptSource(
+      "void f() { map<int32, int32>[] m; }", "bad.script", errors));
+  ASSERT_FALSE(errors.empty());
+  EXPECT_NE(errors[0].message.find("Arrays of maps are not supported"),
+            std::string::npos)
+      << errors[0].message;
+}
+
+TEST(MapTest, CallsResolvedToBuiltinsFollowLaterRegistrations) {
+  const char *source = R"(
+        int32 lookup(int32 k) {
+            map<int32, int32> m;
+            put(m, 1, 10);
+            return get(m, k, -1);
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "map.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("lookup", {1}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 10);
+
+  // A host function of the same name ranks above the cached builtin
+  manager.registerExternalFunction(
+      "get", [](const std::vector<Value> &) -> Value { return 7; });
+  ASSERT_TRUE(manager.executeProcedure("lookup", {1}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(ValueHelper::toInt64(result), 7);
+
+  manager.unregisterExternalFunction("get");
+  ASSERT_TRUE(manager.executeProcedure("lookup", {2}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), -1);
+}
+
+TEST(MapTest, TypeWordsStayUsableAsNames) {
+  // map, struct and stringbuilder only start a type or a struct
+  // declaration where one can begin, so older scripts using them as names
+  // still load
+  const char *source = R"(
+        struct Pair { int32 a; int32 b; }
+        int32 stringbuilder(int32 x) {
+            return x * 10;
+        }
+        int32 names() {
+            int32 map = 3;
+            int32 struct = 4;
+            map<int32, int32> counts;
+            put(counts, map, struct);
+            bool less = map < struct;
+            map = map + get(counts, 3);
+            if (less) {
+                map += 1;
+            }
+            stringbuilder out;
+            append(out, map);
+            if (build(out) != "8") {
+                return -1;
+            }
+            return map + stringbuilder(struct);
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "names.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("names", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 8 + 40);
+}
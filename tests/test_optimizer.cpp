@@ -0,0 +1,221 @@
+#include "AstPrinter.h"
+#include "Optimizer.h"
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+ScriptPtr parseAndOptimize(const std::string &source) {
+  auto script = parseAndResolve(source);
+  Optimizer optimizer;
+  optimizer.optimize(*script);
+  return script;
+}
+
+std::string optimized(const std::string &source) {
+  return AstPrinter::print(*parseAndOptimize(source));
+}
+
+} // namespace
+
+TEST(OptimizerTest, FoldsLiteralOperators) {
+  EXPECT_EQ(optimized("int32 f() { return 2 * 3 + 4; }"),
+            "int32 f() {\n    return 10;\n}\n");
+  EXPECT_EQ(optimized("string f() { return \"n\" + 1 + \"\\n\"; }"),
+            "string f() {\n    return \"n1\\n\";\n}\n");
+  EXPECT_EQ(optimized("bool f() { return !(1 < 2) || ~0 == -1; }"),
+            "bool f() {\n    return true;\n}\n");
+  EXPECT_EQ(optimized("double f() { return -1.5 * 2; }"),
+            "double f() {\n    return -3.0;\n}\n");
+
+  // Short-circuits decide on their left operand alone; a failing
+  // operation is left to fail when it runs
+  EXPECT_EQ(optimized("bool f(bool b) { return false && b; }"),
+            "bool f(bool b) {\n    return false;\n}\n");
+  EXPECT_EQ(optimized("int32 f(int32 x) { return x + (1 + 2); }"),
+            "int32 f(int32 x) {\n    return x + 3;\n}\n");
+  EXPECT_EQ(optimized("int32 f() { return 1 / 0; }"),
+            "int32 f() {\n    return 1 / 0;\n}\n");
+  EXPECT_EQ(optimized("int32 f(int32 x) { return 1 < 2 ? x : 0; }"),
+            "int32 f(int32 x) {\n    return x;\n}\n");
+}
+
+TEST(OptimizerTest, PropagatesConstantLocals) {
+  EXPECT_EQ(optimized(R"(
+        int32 f(int32 x) {
+            int32 n = 4;
+            int32 m = n * 2;
+            double d = 1;
+            int32 k = 0;
+            k += 1;
+            return x + m + d + k;
+        }
+    )"),
+            "int32 f(int32 x) {\n"
+            "    int32 n = 4;\n"
+            "    int32 m = 8;\n"
+            "    double d = 1;\n"
+            "    int32 k = 0;\n"
+            "    k += 1;\n"
+            "    return ((x + 8) + d) + k;\n"
+            "}\n");
+
+  // An inner declaration shadows the constant only inside its block
+  EXPECT_EQ(optimized(R"(
+        int32 f(int32 x) {
+            int32 n = 1;
+            {
+                int32 n = x;
+                x = n;
+            }
+            return n;
+        }
+    )"),
+            "int32 f(int32 x) {\n"
+            "    int32 n = 1;\n"
+            "    {\n"
+            "        int32 n = x;\n"
+            "        x = n;\n"
+            "    }\n"
+            "    return 1;\n"
+            "}\n");
+}
+
+TEST(OptimizerTest, RemovesUnreachableCode) {
+  EXPECT_EQ(optimized(R"(
+        int32 f(int32 x) {
+            bool debug = false;
+            if (debug) {
+                x = x * 2;
+            } else {
+                x = x + 1;
+            }
+            while (debug) {
+                x = 0;
+            }
+            for (int32 i = 0; false; i += 1) {
+                x = 0;
+            }
+            if (x > 3) {
+                return x;
+                x = 7;
+            }
+            return 0;
+            x = 9;
+        }
+    )"),
+            "int32 f(int32 x) {\n"
+            "    bool debug = false;\n"
+            "    {\n"
+            "        x = x + 1;\n"
+            "    }\n"
+            "    {\n"
+            "        int32 i = 0;\n"
+            "    }\n"
+            "    if (x > 3) {\n"
+            "        return x;\n"
+            "    }\n"
+            "    return 0;\n"
+            "}\n");
+
+  // A branch holding a bare declaration declares into the enclosing scope,
+  // so it stays
+  EXPECT_EQ(optimized("int32 f() { if (true) int32 y = 1; return 0; }"),
+            "int32 f() {\n"
+            "    if (true)\n"
+            "        int32 y = 1;\n"
+            "    return 0;\n"
+            "}\n");
+}
+
+TEST(OptimizerTest, OptimizedScriptsGiveTheSameResults) {
+  const char *source = R"(
+        int32 mix(int32 n) {
+            int32 scale = 3;
+            int32 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                if (scale > 2 && i % 2 == 0) {
+                    total += i * scale;
+                } else {
+                    total -= 1;
+                }
+                if (false) {
+                    total = -100;
+                }
+            }
+            return total + (10 - 4) / 2;
+        }
+        string label(int32 n) {
+            string prefix = "n = ";
+            return prefix + n + (1 > 2 ? "!" : ".");
+        }
+        int32 early(int32 n) {
+            while (true) {
+                if (n > 5) {
+                    break;
+                    n = 0;
+                }
+                n += 1;
+            }
+            return n;
+        }
+        int32 failing() {
+            return 1 / 0;
+        }
+    )";
+  for (bool optimize : {true, false}) {
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "opt.script", errors))
+        << (errors.empty() ? "" : errors[0].message);
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure(
+        "mix", {static_cast<int32_t>(6)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 18);
+    ASSERT_TRUE(manager.executeProcedure(
+        "label", {static_cast<int32_t>(4)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "n = 4.");
+    ASSERT_TRUE(manager.executeProcedure(
+        "early", {static_cast<int32_t>(0)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 6);
+    EXPECT_FALSE(manager.executeProcedure("failing", {}, result, errorMsg));
+    EXPECT_NE(errorMsg.find("Division by zero"), std::string::npos)
+        << errorMsg;
+  }
+}
+
+TEST(OptimizerTest, DumpShowsTheOptimizedTree) {
+  const char *source = "int32 f() { if (1 > 2) { return 1; } return 2 + 3; }";
+  std::ostringstream dump;
+  ScriptManager manager;
+  EXPECT_TRUE(manager.areOptimizationsEnabled());
+  manager.setAstDump(&dump);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "dump.script", errors));
+  EXPECT_EQ(dump.str(), "// dump.script\nint32 f() {\n    return 5;\n}\n");
+
+  std::ostringstream plain;
+  ScriptManager unoptimized;
+  unoptimized.setOptimizationsEnabled(false);
+  EXPECT_FALSE(unoptimized.areOptimizationsEnabled());
+  unoptimized.setAstDump(&plain);
+  ASSERT_TRUE(unoptimized.loadScriptSource(source, "dump.script", errors));
+  EXPECT_EQ(plain.str(), "// dump.script\n"
+                         "int32 f() {\n"
+                         "    if (1 > 2) {\n"
+                         "        return 1;\n"
+                         "    }\n"
+                         "    return 2 + 3;\n"
+                         "}\n");
+}
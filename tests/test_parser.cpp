@@ -151,3 +151,52 @@ TEST(ParserTest, ArrayTypesAndLiterals) {
   auto *indexExpr = dynamic_cast<IndexExpr *>(varFirst->initializer.get());
   ASSERT_NE(indexExpr, nullptr);
 }
+
+TEST(ParserTest, NodesCarryTheirKind) {
+  std::string source = R"(
+        int32 test(int32 x) {
+            int32[] values = [x, 2];
+            for (int32 i = 0; i < 2; i += 1) {
+                if (values[i] > 1) { continue; }
+                values[i] = -x;
+            }
+            return len(values) > 0 ? values[0] : 0;
+        }
+    )";
+
+  Lexer lexer(source, "test");
+  Parser parser(lexer.tokenize(), "test");
+  auto script = parser.parse();
+
+  ASSERT_EQ(script->procedures.size(), 1);
+  auto &proc = script->procedures[0];
+  EXPECT_EQ(proc->kind, NodeKind::PROCEDURE);
+  ASSERT_EQ(proc->body->kind, NodeKind::BLOCK);
+
+  auto *block = static_cast<BlockStmt *>(proc->body.get());
+  ASSERT_EQ(block->statements.size(), 3);
+  EXPECT_EQ(block->statements[0]->kind, NodeKind::VAR_DECL);
+  EXPECT_EQ(block->statements[1]->kind, NodeKind::FOR);
+  EXPECT_EQ(block->statements[2]->kind, NodeKind::RETURN);
+
+  auto *decl = static_cast<VarDeclStmt *>(block->statements[0].get());
+  EXPECT_EQ(decl->initializer->kind, NodeKind::ARRAY_LITERAL);
+
+  auto *loop = static_cast<ForStmt *>(block->statements[1].get());
+  EXPECT_EQ(loop->increment->kind, NodeKind::ASSIGN);
+  auto *body = static_cast<BlockStmt *>(loop->body.get());
+  EXPECT_EQ(body->statements[0]->kind, NodeKind::IF);
+  EXPECT_EQ(body->statements[1]->kind, NodeKind::INDEX_ASSIGN);
+  auto *ifStmt = static_cast<IfStmt *>(body->statements[0].get());
+  EXPECT_EQ(ifStmt->condition->kind, NodeKind::BINARY);
+  auto *thenBlock = static_cast<BlockStmt *>(ifStmt->thenBranch.get());
+  EXPECT_EQ(thenBlock->statements[0]->kind, NodeKind::CONTINUE);
+
+  auto *ret = static_cast<ReturnStmt *>(block->statements[2].get());
+  ASSERT_EQ(ret->value->kind, NodeKind::CONDITIONAL);
+  auto *cond = static_cast<ConditionalExpr *>(ret->value.get());
+  EXPECT_EQ(cond->thenExpr->kind, NodeKind::INDEX);
+  EXPECT_EQ(cond->elseExpr->kind, NodeKind::LITERAL);
+  auto *test = static_cast<BinaryExpr *>(cond->condition.get());
+  EXPECT_EQ(test->left->kind, NodeKind::CALL);
+}
@@ -0,0 +1,131 @@
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+TEST(ResolverTest, ParametersTakeFirstSlots) {
+  auto script = parseAndResolve(R"(
+        int32 add(int32 a, int32 b) {
+            int32 c = a + b;
+            return c;
+        }
+    )");
+
+  auto &proc = *script->procedures[0];
+  EXPECT_TRUE(proc.resolved);
+  EXPECT_EQ(proc.frameSize, 3u);
+
+  auto *body = bodyOf(script);
+  ASSERT_NE(body, nullptr);
+  auto *decl = dynamic_cast<VarDeclStmt *>(body->statements[0].get());
+  ASSERT_NE(decl, nullptr);
+  EXPECT_EQ(decl->slot, 2);
+
+  auto *sum = dynamic_cast<BinaryExpr *>(decl->initializer.get());
+  ASSERT_NE(sum, nullptr);
+  EXPECT_EQ(dynamic_cast<VariableExpr *>(sum->left.get())->slot, 0);
+  EXPECT_EQ(dynamic_cast<VariableExpr *>(sum->right.get())->slot, 1);
+}
+
+TEST(ResolverTest, SiblingBlocksReuseSlots) {
+  auto script = parseAndResolve(R"(
+        void test(bool flag) {
+            if (flag) {
+                int32 a = 1;
+                int32 b = 2;
+            } else {
+                int32 c = 3;
+            }
+            for (int32 i = 0; i < 3; i += 1) {
+                int32 d = i;
+            }
+        }
+    )");
+
+  // flag + two locals from the widest block
+  EXPECT_EQ(script->procedures[0]->frameSize, 3u);
+
+  auto *body = bodyOf(script);
+  auto *ifStmt = dynamic_cast<IfStmt *>(body->statements[0].get());
+  auto *elseBlock = dynamic_cast<BlockStmt *>(ifStmt->elseBranch.get());
+  auto *c = dynamic_cast<VarDeclStmt *>(elseBlock->statements[0].get());
+  EXPECT_EQ(c->slot, 1);
+
+  auto *forStmt = dynamic_cast<ForStmt *>(body->statements[1].get());
+  EXPECT_EQ(dynamic_cast<VarDeclStmt *>(forStmt->initializer.get())->slot, 1);
+}
+
+TEST(ResolverTest, ShadowingAndUnresolvedNames) {
+  auto script = parseAndResolve(R"(
+        int32 test() {
+            int32 x = 1;
+            {
+                int32 x = x + 1;
+                hostValue = x;
+            }
+            return x;
+        }
+    )");
+
+  auto *body = bodyOf(script);
+  auto *inner = dynamic_cast<BlockStmt *>(body->statements[1].get());
+  auto *shadow = dynamic_cast<VarDeclStmt *>(inner->statements[0].get());
+  EXPECT_EQ(shadow->slot, 1);
+
+  // The initializer still sees the outer x
+  auto *init = dynamic_cast<BinaryExpr *>(shadow->initializer.get());
+  EXPECT_EQ(dynamic_cast<VariableExpr *>(init->left.get())->slot, 0);
+
+  auto *assign = dynamic_cast<AssignStmt *>(inner->statements[1].get());
+  EXPECT_EQ(assign->slot, -1);
+  EXPECT_EQ(dynamic_cast<VariableExpr *>(assign->value.get())->slot, 1);
+
+  auto *ret = dynamic_cast<ReturnStmt *>(body->statements[2].get());
+  EXPECT_EQ(dynamic_cast<VariableExpr *>(ret->value.get())->slot, 0);
+}
+
+TEST(ResolverTest, FramesAreIsolatedAcrossRecursion) {
+  std::string source = R"(
+        int32 depth(int32 n) {
+            int32 local = n * 10;
+            if (n > 0) {
+                int32 inner = depth(n - 1);
+                return local + inner;
+            }
+            return local;
+        }
+    )";
+
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "test", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("depth", {static_cast<int32_t>(4)},
+                                       result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 100);
+}
+
+TEST(ResolverTest, CallerLocalsAreNotVisibleToCallee) {
+  std::string source = R"(
+        int32 readSecret() { return secret; }
+        int32 caller() {
+            int32 secret = 7;
+            return readSecret();
+        }
+    )";
+
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "test", errors));
+
+  Value result;
+  std::string errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("caller", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Undefined variable: secret"), std::string::npos)
+      << errorMsg;
+}
@@ -0,0 +1,166 @@
+#include "ScriptManager.h"
+#include "StringBuilderBuiltins.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+TEST(StringBuilderTest, AppendsGrowTheBufferGeometrically) {
+  StringBuilderValue builder;
+  size_t reallocations = 0;
+  size_t capacity = builder.capacity();
+  std::string expected;
+  while (builder.size() < (1u << 20)) {
+    builder.append(std::string("line of a report\n"));
+    expected += "line of a report\n";
+    if (builder.capacity() != capacity) {
+      capacity = builder.capacity();
+      ++reallocations;
+    }
+  }
+  EXPECT_EQ(builder.contents(), expected);
+  // About 65k appends, but the buffer only doubles
+  EXPECT_LE(reallocations, 20u);
+
+  StringBuilderValue mixed;
+  mixed.append(static_cast<int32_t>(42));
+  mixed.append(Value(std::string(" is ")));
+  mixed.append(true);
+  EXPECT_EQ(mixed.contents(), "42 is true");
+}
+
+TEST(StringBuilderTest, Builtins) {
+  Value builder = ValueHelper::defaultValue(
+      TypeInfo(DataType::STRING_BUILDER));
+  ASSERT_TRUE(ValueHelper::isStringBuilder(builder));
+  EXPECT_EQ(ValueHelper::typeToString(ValueHelper::getType(builder)),
+            "stringbuilder");
+
+  Value length = StringBuilderBuiltins::call(
+      "append", {builder, std::string("x = "), static_cast<int32_t>(3)});
+  EXPECT_EQ(std::get<int32_t>(length), 5);
+  EXPECT_EQ(std::get<std::string>(StringBuilderBuiltins::call("build",
+                                                              {builder})),
+            "x = 3");
+  EXPECT_EQ(ValueHelper::toString(builder), "x = 3");
+
+  auto callError = [](const std::string &name, const std::vector<Value> &args) {
+    return errorOf([&] { StringBuilderBuiltins::call(name, args); });
+  };
+  EXPECT_EQ(callError("append", {std::string("s"), 1}),
+            "append expects a stringbuilder as first argument");
+  EXPECT_EQ(callError("append", {builder}),
+            "append expects at least 2 arguments");
+  EXPECT_EQ(callError("build", {builder, builder}), "build expects 1 argument");
+}
+
+TEST(StringBuilderTest, ScriptsBuildReports) {
+  const char *source = R"(
+        void line(stringbuilder out, string label, int32 value) {
+            append(out, label, ": ", value, "\n");
+        }
+        string report(int32 n) {
+            stringbuilder out;
+            append(out, "Report\n");
+            for (int32 i = 0; i < n; i += 1) {
+                line(out, "item " + i, i * i);
+            }
+            stringbuilder alias = out;
+            append(alias, "end");
+            return build(out);
+        }
+        string concatenated(int32 n) {
+            string out = "Report\n";
+            for (int32 i = 0; i < n; i += 1) {
+                out = out + "item " + i + ": " + i * i + "\n";
+            }
+            return out + "end";
+        }
+        int32 fresh() {
+            int32 total = 0;
+            for (int32 i = 0; i < 3; i += 1) {
+                stringbuilder b;
+                total += append(b, "ab");
+            }
+            return total;
+        }
+        string notAString() {
+            stringbuilder b;
+            string s = b;
+            return s;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "report.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value built, expected;
+  std::string errorMsg;
+  Value n = static_cast<int32_t>(200);
+  ASSERT_TRUE(manager.executeProcedure("report", {n}, built, errorMsg))
+      << errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("concatenated", {n}, expected, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<std::string>(built), std::get<std::string>(expected));
+
+  Value result;
+  ASSERT_TRUE(manager.executeProcedure("fresh", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 6);
+
+  EXPECT_FALSE(manager.executeProcedure("notAString", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Cannot convert stringbuilder to string"),
+            std::string::npos)
+      << errorMsg;
+}
+
+TEST(StringBuilderTest, RejectsContainersOfBuilders) {
+  auto loadError = [](const char *source) {
+    ScriptManager manager;
+    std::vector<CompilationError> errors;
+    EXPECT_FALSE(manager.loadScriptSource(source, "bad.script", errors));
+    return errors.empty() ? std::string() : errors[0].message;
+  };
+  EXPECT_NE(loadError("void f() { stringbuilder[] bs; }")
+                .find("Arrays of string builders are not supported"),
+            std::string::npos);
+  EXPECT_NE(loadError("void f() { map<string, stringbuilder> m; }")
+                .find("Map keys and values must be scalars"),
+            std::string::npos);
+}
+
+TEST(StringBuilderTest, ResolvedCallsShareLiteralArguments) {
+  const char *source = R"(
+        string twice() {
+            stringbuilder a;
+            stringbuilder b;
+            for (int32 i = 0; i < 3; i += 1) {
+                append(a, "ab");
+                append(b, "ab", i);
+            }
+            return build(a) + "|" + build(b);
+        }
+        int32 wrongBuilder() {
+            return append("ab", "cd");
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "shared.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value result;
+  std::string errorMsg;
+  for (int run = 0; run < 2; ++run) {
+    ASSERT_TRUE(manager.executeProcedure("twice", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<std::string>(result), "ababab|ab0ab1ab2");
+  }
+
+  EXPECT_FALSE(manager.executeProcedure("wrongBuilder", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("append expects a stringbuilder as first argument"),
+            std::string::npos)
+      << errorMsg;
+}
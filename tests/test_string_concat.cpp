@@ -1,8 +1,41 @@
 #include "ScriptManager.h"
+#include <atomic>
+#include <cstdlib>
 #include <gtest/gtest.h>
+#include <new>
 
 using namespace Script;
 
+namespace {
+
+// Heap allocations of at least LARGE_ALLOCATION bytes made while counting
+// is on, to see how often a growing string is copied
+constexpr std::size_t LARGE_ALLOCATION = 1024;
+std::atomic<bool> countingAllocations{false};
+std::atomic<std::size_t> largeAllocations{0};
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  if (countingAllocations && size >= LARGE_ALLOCATION) {
+    ++largeAllocations;
+  }
+  if (void *memory = std::malloc(size ? size : 1)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+// GCC takes the replaced operator new for the standard one and warns when
+// inlined deletes free what it returned
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+
 TEST(StringConcatTest, StringConcatenation) {
   std::cout << "Testing string concatenation with different types..."
             << std::endl;
@@ -262,3 +295,76 @@ TEST(StringConcatTest, ComplexConcatenation) {
             << std::endl;
 }
 
+TEST(StringConcatTest, PlusAssignAppendsInPlace) {
+  const char *source = R"(
+    string build(int32 n) {
+      string s = "";
+      string before = s;
+      for (int32 i = 0; i < n; i += 1) {
+        s += "ab";
+        s += i % 10;
+      }
+      string snapshot = s;
+      s += s;
+      snapshot += "!";
+      return (before == "" ? "empty" : before) + ":" + s + ":" + snapshot;
+    }
+    string nonString() {
+      int32 x = 1;
+      x += 2;
+      string s = "n";
+      s += true;
+      s += 1.5;
+      return s + x;
+    }
+    string withArray() {
+      string s = "a";
+      int32[] xs = [1];
+      s += xs;
+      return s;
+    }
+    string grow(int32 n) {
+      string s = "";
+      for (int32 i = 0; i < n; i += 1) {
+        s += "ab";
+      }
+      return s;
+    }
+  )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "append.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("build", {static_cast<int32_t>(12)},
+                                       result, errorMsg))
+      << errorMsg;
+  std::string once;
+  for (int i = 0; i < 12; ++i) {
+    once += "ab" + std::to_string(i % 10);
+  }
+  // Appending to s leaves the copies taken before alone
+  EXPECT_EQ(std::get<std::string>(result),
+            "empty:" + once + once + ":" + once + "!");
+
+  ASSERT_TRUE(manager.executeProcedure("nonString", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<std::string>(result), "ntrue1.5000003");
+
+  EXPECT_FALSE(manager.executeProcedure("withArray", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Operator + only supports numeric arrays"),
+            std::string::npos)
+      << errorMsg;
+
+  // Copying s on every append would allocate about n large buffers; growing
+  // it geometrically reallocates only a few dozen times
+  const int32_t appends = 100000;
+  largeAllocations = 0;
+  countingAllocations = true;
+  bool grown = manager.executeProcedure("grow", {appends}, result, errorMsg);
+  countingAllocations = false;
+  ASSERT_TRUE(grown) << errorMsg;
+  EXPECT_EQ(std::get<std::string>(result).size(), 2u * appends);
+  EXPECT_LT(largeAllocations.load(), 100u);
+}
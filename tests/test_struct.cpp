@@ -0,0 +1,256 @@
+#include "ScriptManager.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+
+namespace {
+
+std::shared_ptr<StructType> point() {
+  auto type = std::make_shared<StructType>();
+  type->name = "Point";
+  type->fieldNames = {"x", "y"};
+  type->fieldTypes = {TypeInfo(DataType::INT32), TypeInfo(DataType::DOUBLE)};
+  return type;
+}
+
+} // namespace
+
+TEST(StructTest, RecordsStoreFieldsByIndex) {
+  auto type = point();
+  EXPECT_EQ(type->fieldIndex("y"), 1);
+  EXPECT_EQ(type->fieldIndex("z"), -1);
+
+  Value value = ValueHelper::defaultValue(TypeInfo::record(type));
+  ASSERT_TRUE(ValueHelper::isRecord(value));
+  RecordValue &record = ValueHelper::recordValue(value);
+  EXPECT_EQ(record.fieldCount(), 2u);
+  EXPECT_EQ(std::get<int32_t>(record.field(0)), 0);
+  EXPECT_EQ(std::get<double>(record.field(1)), 0.0);
+  EXPECT_EQ(ValueHelper::typeToString(ValueHelper::getType(value)), "Point");
+
+  // Records are references: copies of the handle see each write
+  Value alias = value;
+  record.setField(0, static_cast<int32_t>(7));
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::recordValue(alias).field(0)), 7);
+
+  // A stale index is only trusted for the layout it was resolved against
+  EXPECT_EQ(record.fieldIndex("y", type.get(), 1), 1u);
+  EXPECT_EQ(record.fieldIndex("y", nullptr, 0), 1u);
+  try {
+    record.fieldIndex("z", nullptr, -1);
+    FAIL() << "expected an error";
+  } catch (const std::runtime_error &e) {
+    EXPECT_STREQ(e.what(), "Point has no field z");
+  }
+}
+
+TEST(StructTest, ScriptsDeclareAndUseStructs) {
+  const char *source = R"(
+        struct User {
+            string name;
+            int32 age;
+        }
+        struct Team {
+            string title;
+            User lead;
+        }
+        void birthday(User u) {
+            u.age = u.age + 1;
+        }
+        int32 defaults() {
+            User u;
+            Team t;
+            t.lead.age = 5;
+            return (u.name == "" ? 100 : 0) + u.age * 10 + t.lead.age;
+        }
+        int32 build() {
+            User bob = User("bob", 30);
+            User alias = bob;
+            birthday(alias);
+            Team t = Team("core", bob);
+            t.lead.name = "robert";
+            return bob.age * 100 + (bob.name == "robert" ? 6 : 0);
+        }
+        int64 roster(int32 n) {
+            User[] users;
+            for (int32 i = 0; i < n; i += 1) {
+                push(users, User("u", i));
+            }
+            users[1].age = 100;
+            int64 total = 0;
+            for (int32 i = 0; i < len(users); i += 1) {
+                total += users[i].age;
+            }
+            return total;
+        }
+        int32 converted() {
+            User u = User("x", 2.9);
+            u.age = 41.7;
+            return u.age;
+        }
+        int32 wrongType() {
+            User u = Team("t", User("a", 1));
+            return 0;
+        }
+        int32 notRecord() {
+            int32 x = 1;
+            return x.age;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "users.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("defaults", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 105);
+
+  ASSERT_TRUE(manager.executeProcedure("build", {}, result, errorMsg))
+      << errorMsg;
+  // birthday and the team both write through to bob
+  EXPECT_EQ(std::get<int32_t>(result), 3106);
+
+  ASSERT_TRUE(manager.executeProcedure("roster", {static_cast<int32_t>(4)},
+                                       result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int64_t>(result), 0 + 100 + 2 + 3);
+
+  ASSERT_TRUE(manager.executeProcedure("converted", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 41);
+
+  EXPECT_FALSE(manager.executeProcedure("wrongType", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Expected User value"), std::string::npos)
+      << errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("notRecord", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Field access on non-record value"),
+            std::string::npos)
+      << errorMsg;
+}
+
+TEST(StructTest, WritesToArrayFieldsStayInTheRecord) {
+  // push, pop and element assignment through a field change the array the
+  // record holds, not a copy of it
+  const char *source = R"(
+        struct S {
+            int32[] items;
+        }
+        int32 pushed() {
+            S s;
+            push(s.items, 1);
+            push(s.items, 2);
+            return len(s.items);
+        }
+        int32 popped() {
+            S s = S([1, 2, 3]);
+            s.items[0] = 7;
+            int32 p = pop(s.items);
+            return s.items[0] * 100 + len(s.items) * 10 + p;
+        }
+        int32 inArray() {
+            S[] xs;
+            push(xs, S([1, 2, 3]));
+            xs[0].items[1] = 9;
+            push(xs[0].items, 4);
+            return xs[0].items[1] * 10 + len(xs[0].items);
+        }
+        int32 copied() {
+            S s = S([1, 2]);
+            int32[] before = s.items;
+            push(s.items, 3);
+            s.items[0] = 5;
+            return len(before) * 100 + before[0] * 10 + len(s.items);
+        }
+    )";
+  for (bool optimize : {true, false}) {
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "fields.script", errors))
+        << (errors.empty() ? "" : errors[0].message);
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure("pushed", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 2);
+    ASSERT_TRUE(manager.executeProcedure("popped", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 723);
+    ASSERT_TRUE(manager.executeProcedure("inArray", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 94);
+    // A local read out of the field keeps its own elements
+    ASSERT_TRUE(manager.executeProcedure("copied", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 213);
+  }
+}
+
+TEST(StructTest, HostRecordsFallBackToFieldNames) {
+  // Nothing is known about an external variable at load time, so its fields
+  // are looked up by name; a declared parameter type still has to match
+  const char *source = R"(
+        struct Point {
+            double y;
+            int32 x;
+        }
+        double readY() {
+            origin.x = origin.x + 1;
+            return origin.y + origin.x;
+        }
+        int32 readZ() {
+            return origin.z;
+        }
+        double take(Point p) {
+            return p.y;
+        }
+    )";
+  Value origin = std::make_shared<RecordValue>(
+      point(), std::vector<Value>{static_cast<int32_t>(1), 2.5});
+  ScriptManager manager;
+  manager.registerExternalVariable("origin", [&]() -> Value { return origin; });
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "host.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("readY", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_DOUBLE_EQ(std::get<double>(result), 4.5);
+  EXPECT_EQ(std::get<int32_t>(ValueHelper::recordValue(origin).field(0)), 2);
+
+  EXPECT_FALSE(manager.executeProcedure("readZ", {}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Point has no field z"), std::string::npos)
+      << errorMsg;
+  EXPECT_FALSE(manager.executeProcedure("take", {origin}, result, errorMsg));
+  EXPECT_NE(errorMsg.find("Expected Point value"), std::string::npos)
+      << errorMsg;
+}
+
+TEST(StructTest, RejectsBadDeclarations) {
+  auto loadError = [](const char *source) {
+    ScriptManager manager;
+    std::vector<CompilationError> errors;
+    EXPECT_FALSE(manager.loadScriptSource(source, "bad.script", errors));
+    return errors.empty() ? std::string() : errors[0].message;
+  };
+  EXPECT_NE(loadError("struct P { int32 x; int32 x; }")
+                .find("Duplicate field x in struct P"),
+            std::string::npos);
+  EXPECT_NE(loadError("struct P { int32 x; } struct P { int32 y; }")
+                .find("Duplicate struct name: P"),
+            std::string::npos);
+  EXPECT_NE(loadError("int32 f(Q q) { return 0; }").find("Unknown type Q"),
+            std::string::npos);
+  EXPECT_NE(loadError("struct P { int32 x; } int32 f() { P p; return p.z; }")
+                .find("P has no field z"),
+            std::string::npos);
+  EXPECT_NE(loadError("struct P { int32 x; } int32 f() { P p = P(1, 2); "
+                      "return 0; }")
+                .find("P expects 1 field"),
+            std::string::npos);
+}
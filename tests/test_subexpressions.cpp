@@ -0,0 +1,225 @@
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+
+namespace {
+
+void registerStrlen(ScriptManager &manager, int &calls,
+                    DataType returns = DataType::INT32) {
+  manager.registerExternalFunction(
+      "strlen",
+      [&calls](const std::vector<Value> &args) -> Value {
+        ++calls;
+        return static_cast<int32_t>(ValueHelper::toString(args[0]).size());
+      },
+      true, TypeInfo(returns));
+}
+
+std::string loaded(const std::string &source,
+                   DataType strlenReturns = DataType::INT32) {
+  int calls = 0;
+  ScriptManager manager;
+  registerStrlen(manager, calls, strlenReturns);
+  return TestHelpers::loaded(manager, source);
+}
+
+const char *VALIDATION = R"(
+    bool valid(string email, int32[] scores, int32 i, int32 weight) {
+        if (strlen(email) < 3) {
+            return false;
+        }
+        if (strlen(email) > 254) {
+            return false;
+        }
+        int32 total = 0;
+        if (scores[i] * weight > 10) {
+            total += scores[i] * weight;
+        }
+        int32 low = (i + 1) * 2;
+        int32 high = (i + 1) * 3;
+        return total + low + high > 0;
+    }
+)";
+
+} // namespace
+
+TEST(SubexpressionTest, SharesRepeatedExpressions) {
+  EXPECT_EQ(loaded(VALIDATION),
+            "bool valid(string email, int32[] scores, int32 i, "
+            "int32 weight) {\n"
+            "    int32 $8 = strlen(email);\n"
+            "    if ($8 < 3) {\n"
+            "        return false;\n"
+            "    }\n"
+            "    if ($8 > 254) {\n"
+            "        return false;\n"
+            "    }\n"
+            "    int32 total = 0;\n"
+            "    if ((scores[i] * weight) > 10) {\n"
+            "        total += scores[i] * weight;\n"
+            "    }\n"
+            "    int32 $7 = i + 1;\n"
+            "    int32 low = $7 * 2;\n"
+            "    int32 high = $7 * 3;\n"
+            "    return ((total + low) + high) > 0;\n"
+            "}\n");
+
+  // Without a return type strlen's result has no local to go to
+  std::string untyped = loaded(VALIDATION, DataType::VOID);
+  EXPECT_NE(untyped.find("if (strlen(email) < 3)"), std::string::npos)
+      << untyped;
+}
+
+TEST(SubexpressionTest, KeepsCopiesApartWhenTheyMayDiffer) {
+  // Copies separated by a write to what they read, through a local, a
+  // map, a record or an external array a local may share, are computed
+  // again; so is an expression that may fail whose first copy would not
+  // have run first
+  const char *source = R"(
+        struct Counter { int32 n; }
+        int32 f(int32 i, int32 d, map<string, int32> m, Counter c) {
+            int32 a = (i + 1) * 2;
+            i += 1;
+            int32 b = (i + 1) * 2;
+            int32 sizeBefore = len(m) + 1;
+            put(m, "k", 1);
+            int32 sizeAfter = len(m) + 1;
+            int32 before = c.n * 2;
+            c.n = 5;
+            int32 after = c.n * 2;
+            if (d != 0 && i / d > 1) {
+                a += 1;
+            }
+            return a + b + sizeBefore + sizeAfter + before + after + i / d;
+        }
+        int32 aliased() {
+            int32[] a = ext;
+            int32 x = len(a) + 1;
+            push(ext, 9);
+            int32 y = len(a) + 1;
+            return x * 100 + y;
+        }
+    )";
+  std::string text = loaded(source);
+  EXPECT_EQ(text.find('$'), std::string::npos) << text;
+
+  for (bool optimize : {true, false}) {
+    Value ext = TestHelpers::intArray({1, 2, 3});
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    manager.registerExternalVariable("ext", [&]() -> Value { return ext; });
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "cse.script", errors));
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure("aliased", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 404);
+    EXPECT_EQ(ValueHelper::arrayValue(ext).size(), 4u);
+  }
+}
+
+TEST(SubexpressionTest, SharedScriptsGiveTheSameResults) {
+  const char *source = R"(
+        struct Counter { int32 n; }
+        bool validAt(string email, int32[] scores, int32 i) {
+            if (strlen(email) < 3 || strlen(email) > 254) {
+                return false;
+            }
+            return scores[i] * 2 > 10 && scores[i] * 2 < 100;
+        }
+        int32 mixed(int32 i, map<string, int32> m, Counter c) {
+            int32 a = (i + 1) * 2;
+            i += 1;
+            int32 b = (i + 1) * 2;
+            int32 sizeBefore = len(m) * 10;
+            put(m, "k" + i, 1);
+            int32 sizeAfter = len(m) * 10;
+            int32 before = c.n * 3;
+            c.n = c.n + 1;
+            int32 after = c.n * 3;
+            return a + b + sizeBefore + sizeAfter + before + after;
+        }
+        int32 run() {
+            map<string, int32> m;
+            put(m, "x", 0);
+            Counter c = Counter(2);
+            return mixed(4, m, c);
+        }
+        bool check(int32 i) {
+            return validAt("someone@example.com", [1, 9, 40], i);
+        }
+    )";
+  for (bool optimize : {true, false}) {
+    int calls = 0;
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    registerStrlen(manager, calls);
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "cse.script", errors))
+        << (errors.empty() ? "" : errors[0].message);
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure(
+        "check", {static_cast<int32_t>(2)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_TRUE(std::get<bool>(result));
+    EXPECT_EQ(calls, optimize ? 1 : 2);
+    ASSERT_TRUE(manager.executeProcedure(
+        "check", {static_cast<int32_t>(0)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_FALSE(std::get<bool>(result));
+    ASSERT_TRUE(manager.executeProcedure("run", {}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 10 + 12 + 10 + 20 + 6 + 9);
+
+    // An element read out of bounds still fails
+    EXPECT_FALSE(manager.executeProcedure(
+        "check", {static_cast<int32_t>(3)}, result, errorMsg));
+    EXPECT_NE(errorMsg.find("out of bounds"), std::string::npos)
+        << errorMsg;
+  }
+}
+
+TEST(SubexpressionTest, StopsSharingCallsToExternalsThatStopBeingPure) {
+  // Once tick is shadowed by a procedure that counts, each copy calls it
+  const char *source = R"(
+        int32 twice(int32 v) {
+            int32 a = tick(v) * 100;
+            int32 b = tick(v) * 10;
+            return a + b + tick(v);
+        }
+    )";
+  for (bool optimize : {true, false}) {
+    int32_t counter = 0;
+    ScriptManager manager;
+    manager.setOptimizationsEnabled(optimize);
+    manager.registerExternalFunctionUnary<int32_t, int32_t>(
+        "tick", [](int32_t v) { return v; }, true);
+    manager.registerExternalVariable(
+        "counter", [&counter]() -> Value { return counter; },
+        [&counter](const Value &v) { counter = std::get<int32_t>(v); });
+    std::vector<CompilationError> errors;
+    ASSERT_TRUE(manager.loadScriptSource(source, "twice.script", errors));
+
+    Value result;
+    std::string errorMsg;
+    ASSERT_TRUE(manager.executeProcedure(
+        "twice", {static_cast<int32_t>(5)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 555);
+
+    ASSERT_TRUE(manager.loadScriptSource(R"(
+          int32 tick(int32 v) { counter = counter + 1; return counter; }
+      )",
+                                         "tick.script", errors));
+    ASSERT_TRUE(manager.executeProcedure(
+        "twice", {static_cast<int32_t>(5)}, result, errorMsg))
+        << errorMsg;
+    EXPECT_EQ(std::get<int32_t>(result), 123);
+    EXPECT_EQ(counter, 3);
+  }
+}
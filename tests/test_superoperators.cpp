@@ -0,0 +1,304 @@
+#include "Interpreter.h"
+#include "ScriptManager.h"
+#include "Superoperators.h"
+#include "test_helpers.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+size_t index(Superop op) { return static_cast<size_t>(op); }
+
+// Runs a procedure with and without superoperators and checks the results
+// (including their runtime type) or error messages agree
+void expectSameWithoutSuperoperators(const std::string &source,
+                                     const std::string &proc,
+                                     const std::vector<Value> &args) {
+  ScriptManager fused;
+  ScriptManager plain;
+  fused.setExecutionEngine(ExecutionEngine::TREE_WALKER);
+  plain.setExecutionEngine(ExecutionEngine::TREE_WALKER);
+  plain.setSuperoperatorsEnabled(false);
+
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(fused.loadScriptSource(source, "fused.script", errors));
+  ASSERT_TRUE(plain.loadScriptSource(source, "plain.script", errors));
+
+  Value expected, actual;
+  std::string expectedError, actualError;
+  bool expectedOk = plain.executeProcedure(proc, args, expected, expectedError);
+  bool actualOk = fused.executeProcedure(proc, args, actual, actualError);
+
+  ASSERT_EQ(expectedOk, actualOk) << proc << ": " << expectedError
+                                  << actualError;
+  if (!expectedOk) {
+    EXPECT_EQ(expectedError, actualError) << proc;
+    return;
+  }
+  EXPECT_EQ(expected.index(), actual.index()) << proc;
+  EXPECT_TRUE(ValueHelper::equals(expected, actual))
+      << proc << ": " << ValueHelper::toString(expected) << " vs "
+      << ValueHelper::toString(actual);
+}
+
+} // namespace
+
+TEST(SuperoperatorTest, TagsHotShapes) {
+  auto script = parseAndResolve(R"(
+        int32 sum(int32[] values, int32 n, int32 limit) {
+            int32 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                if (i >= 0 && total < limit && values[i] != 7) {
+                    total = total + values[i];
+                }
+            }
+            total = total - 1;
+            return total;
+        }
+    )");
+
+  SuperoperatorPass pass;
+  pass.run(*script->procedures[0]);
+
+  const auto &sites = pass.sites();
+  EXPECT_EQ(sites[index(Superop::LOCAL_COMPARE)], 3u);     // i < n, i >= 0, ...
+  EXPECT_EQ(sites[index(Superop::LOCAL_ADD_LITERAL)], 2u); // i += 1, total - 1
+  EXPECT_EQ(sites[index(Superop::LOCAL_INDEX)], 2u);
+  EXPECT_EQ(sites[index(Superop::COMPARE_CHAIN)], 1u);
+
+  auto *body = bodyOf(script);
+  auto *loop = dynamic_cast<ForStmt *>(body->statements[1].get());
+  ASSERT_NE(loop, nullptr);
+  EXPECT_EQ(loop->condition->superop, Superop::LOCAL_COMPARE);
+  EXPECT_EQ(loop->increment->superop, Superop::LOCAL_ADD_LITERAL);
+
+  // total = total + values[i] is not an increment by a literal
+  auto *inner = dynamic_cast<BlockStmt *>(loop->body.get());
+  auto *ifStmt = dynamic_cast<IfStmt *>(inner->statements[0].get());
+  ASSERT_NE(ifStmt, nullptr);
+  EXPECT_EQ(ifStmt->condition->superop, Superop::COMPARE_CHAIN);
+  auto *chain = dynamic_cast<BinaryExpr *>(ifStmt->condition.get());
+  EXPECT_EQ(chain->left->superop, Superop::NONE); // inner && is not tagged
+  auto *add = dynamic_cast<BlockStmt *>(ifStmt->thenBranch.get())
+                  ->statements[0]
+                  .get();
+  EXPECT_EQ(add->superop, Superop::NONE);
+}
+
+TEST(SuperoperatorTest, LeavesOtherShapesAlone) {
+  auto script = parseAndResolve(R"(
+        bool test(int32 x, int32 y) {
+            int32 z = 0;
+            z = y + 1;
+            z = x + 1.5;
+            z *= 2;
+            bool a = 1 < 2;
+            bool b = x < y || x > 3;
+            bool c = (x < y) && true;
+            bool d = x + 1 < y;
+            return a && b && c && d && offset < x;
+        }
+    )");
+
+  SuperoperatorPass pass;
+  pass.run(*script->procedures[0]);
+
+  const auto &sites = pass.sites();
+  EXPECT_EQ(sites[index(Superop::LOCAL_ADD_LITERAL)], 0u);
+  EXPECT_EQ(sites[index(Superop::LOCAL_INDEX)], 0u);
+  EXPECT_EQ(sites[index(Superop::COMPARE_CHAIN)], 0u);
+  // Only x < y, x > 3 and the x < y inside c are fused
+  EXPECT_EQ(sites[index(Superop::LOCAL_COMPARE)], 3u);
+}
+
+TEST(SuperoperatorTest, ReportCountsAbsorbedEvaluations) {
+  ScriptManager manager;
+  manager.setExecutionEngine(ExecutionEngine::TREE_WALKER);
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(R"(
+        int32 count(int32 n) {
+            int32 total = 0;
+            int32 i = 0;
+            while (i < n) {
+                total += 2;
+                i = i + 1;
+            }
+            return total;
+        }
+    )",
+                                       "count.script", errors));
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure("count", {static_cast<int32_t>(10)},
+                                       result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 20);
+
+  std::string report = manager.getSuperoperatorReport();
+  EXPECT_NE(report.find("local-compare"), std::string::npos);
+  EXPECT_NE(report.find("compare-chain"), std::string::npos);
+
+  Interpreter interpreter;
+  interpreter.loadScript(parseAndResolve(R"(
+        int32 count(int32 n) {
+            int32 total = 0;
+            int32 i = 0;
+            while (i < n) {
+                total += 2;
+                i = i + 1;
+            }
+            return total;
+        }
+    )"));
+  interpreter.executeProcedure("count", {static_cast<int32_t>(10)});
+
+  auto counters = interpreter.superoperatorCounters();
+  const auto &compare = counters[index(Superop::LOCAL_COMPARE)];
+  EXPECT_EQ(compare.sites, 1u);
+  EXPECT_EQ(compare.hits, 11u);
+  EXPECT_EQ(compare.absorbed, 33u);
+  const auto &add = counters[index(Superop::LOCAL_ADD_LITERAL)];
+  EXPECT_EQ(add.sites, 2u);
+  EXPECT_EQ(add.hits, 20u);
+  EXPECT_EQ(add.absorbed, 10u * 2 + 10u * 4);
+
+  // Reloading a procedure replaces its sites instead of adding to them
+  interpreter.loadScript(parseAndResolve("int32 count(int32 n) { return n; }"));
+  EXPECT_EQ(interpreter.superoperatorCounters()[index(Superop::LOCAL_COMPARE)]
+                .sites,
+            0u);
+}
+
+TEST(SuperoperatorTest, DisabledLeavesProceduresUntagged) {
+  ScriptManager manager;
+  manager.setSuperoperatorsEnabled(false);
+  manager.clear();
+  EXPECT_FALSE(manager.areSuperoperatorsEnabled());
+
+  Interpreter interpreter;
+  interpreter.setSuperoperatorsEnabled(false);
+  auto script =
+      parseAndResolve("bool less(int32 a, int32 b) { return a < b; }");
+  interpreter.loadScript(script);
+
+  auto *ret = dynamic_cast<ReturnStmt *>(bodyOf(script)->statements[0].get());
+  ASSERT_NE(ret, nullptr);
+  EXPECT_EQ(ret->value->superop, Superop::NONE);
+  Value result = interpreter.executeProcedure(
+      "less", {static_cast<int32_t>(1), static_cast<int32_t>(2)});
+  EXPECT_TRUE(std::get<bool>(result));
+  EXPECT_EQ(interpreter.superoperatorCounters()[index(Superop::LOCAL_COMPARE)]
+                .sites,
+            0u);
+}
+
+TEST(SuperoperatorTest, IncrementsMatchGenericArithmetic) {
+  const char *source = R"(
+        int32 bump(int32 x) {
+            x = x + 1;
+            x += 2147483647;
+            x -= 5;
+            x = x - 2147483647;
+            return x;
+        }
+        int64 widen(int64 x) {
+            x = x + 1;
+            x += 2147483647;
+            return x;
+        }
+        double fractional(double x) {
+            x = x + 1;
+            x -= 3;
+            return x;
+        }
+        string text(string s) {
+            s = s + 1;
+            s += 2;
+            return s;
+        }
+    )";
+  for (int32_t x : {0, 2147483647, -2147483647 - 1, -7}) {
+    expectSameWithoutSuperoperators(source, "bump", {x});
+  }
+  expectSameWithoutSuperoperators(source, "widen",
+                                  {static_cast<int64_t>(4294967296)});
+  expectSameWithoutSuperoperators(source, "fractional", {0.5});
+  expectSameWithoutSuperoperators(source, "text", {std::string("s")});
+}
+
+TEST(SuperoperatorTest, ComparesMatchGenericRules) {
+  const char *source = R"(
+        int32 classify(int32 a, int32 b) {
+            int32 result = 0;
+            if (a < b) { result += 1; }
+            if (a <= b) { result += 2; }
+            if (a > b) { result += 4; }
+            if (a >= b) { result += 8; }
+            if (a == b) { result += 16; }
+            if (a != b) { result += 32; }
+            if (a > 0 && b > 0 && a < 100) { result += 64; }
+            return result;
+        }
+        bool mixed(int64 a, double b, string s, bool flag) {
+            return a < b && s == "x" && flag == true && a != 3;
+        }
+        bool chained(int32 a, int32 b) {
+            bool r = a < b && b < 10;
+            return r;
+        }
+    )";
+  for (int32_t a : {-5, 0, 5, 200}) {
+    for (int32_t b : {-5, 0, 5}) {
+      expectSameWithoutSuperoperators(source, "classify", {a, b});
+      expectSameWithoutSuperoperators(source, "chained", {a, b});
+    }
+  }
+  expectSameWithoutSuperoperators(
+      source, "mixed",
+      {static_cast<int64_t>(1), 2.5, std::string("x"), true});
+  expectSameWithoutSuperoperators(
+      source, "mixed",
+      {static_cast<int64_t>(3), 4.0, std::string("x"), true});
+  expectSameWithoutSuperoperators(
+      source, "mixed",
+      {static_cast<int64_t>(1), 0.5, std::string("y"), false});
+}
+
+TEST(SuperoperatorTest, LocalIndexingMatchesGenericErrors) {
+  const char *source = R"(
+        int32 pick(int32 i) {
+            int32[] values = [10, 20, 30];
+            return values[i];
+        }
+        int32 pickWide(int64 i) {
+            int32[] values = [10, 20, 30];
+            return values[i];
+        }
+        int32 notArray(int32 i) {
+            int32 values = 5;
+            return values[i];
+        }
+        int32 sum(int32 n) {
+            int32[] values = [1, 2, 3, 4];
+            int32 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                total += values[i];
+            }
+            return total;
+        }
+    )";
+  for (int32_t i : {0, 2, 3, -1}) {
+    expectSameWithoutSuperoperators(source, "pick", {i});
+  }
+  expectSameWithoutSuperoperators(source, "pickWide",
+                                  {static_cast<int64_t>(1)});
+  expectSameWithoutSuperoperators(source, "pickWide",
+                                  {static_cast<int64_t>(-1)});
+  expectSameWithoutSuperoperators(source, "notArray",
+                                  {static_cast<int32_t>(0)});
+  expectSameWithoutSuperoperators(source, "sum", {static_cast<int32_t>(4)});
+  expectSameWithoutSuperoperators(source, "sum", {static_cast<int32_t>(5)});
+}
@@ -0,0 +1,240 @@
+#include "ScriptManager.h"
+#include "test_helpers.h"
+#include "TypeChecker.h"
+#include <gtest/gtest.h>
+
+using namespace Script;
+using namespace TestHelpers;
+
+namespace {
+
+ScriptPtr parseAndCheck(const std::string &source, TypeChecker &checker) {
+  auto script = parseAndResolve(source);
+  checker.check(*script);
+  return script;
+}
+
+VarDeclStmt *declAt(const ScriptPtr &script, size_t proc, size_t stmt) {
+  return dynamic_cast<VarDeclStmt *>(
+      bodyOf(script, proc)->statements[stmt].get());
+}
+
+DataType typeOf(VarDeclStmt *decl) {
+  return decl->initializer->staticType.baseType;
+}
+
+} // namespace
+
+TEST(TypeCheckerTest, AnnotatesExpressions) {
+  TypeChecker checker;
+  auto script = parseAndCheck(R"(
+        struct P {
+            double y;
+        }
+        int64 wide(int32 a, int64 big) {
+            int64 b = a + big;
+            string s = "n = " + a;
+            bool less = a < b;
+            double half = a / 2.0;
+            uint32 u = 7;
+            uint32 sum = u + a;
+            int32 n = -a;
+            P p = P(1.5);
+            double y = p.y;
+            int32[] xs = [1, 2];
+            int32 first = xs[0];
+            int32 outside = origin;
+            int64 called = wide(a, b);
+            int32 either = less ? a : 0;
+            int32 mixed = less ? a : 0.5;
+            return b;
+        }
+    )",
+                              checker);
+  EXPECT_TRUE(checker.errors().empty());
+
+  EXPECT_EQ(typeOf(declAt(script, 0, 0)), DataType::INT64);
+  EXPECT_EQ(typeOf(declAt(script, 0, 1)), DataType::STRING);
+  EXPECT_EQ(typeOf(declAt(script, 0, 2)), DataType::BOOL);
+  EXPECT_EQ(typeOf(declAt(script, 0, 3)), DataType::DOUBLE);
+  EXPECT_EQ(typeOf(declAt(script, 0, 5)), DataType::UINT32);
+  EXPECT_EQ(typeOf(declAt(script, 0, 6)), DataType::INT32);
+  EXPECT_TRUE(declAt(script, 0, 7)->initializer->staticType.isRecord());
+  EXPECT_EQ(typeOf(declAt(script, 0, 8)), DataType::DOUBLE);
+  TypeInfo xs = declAt(script, 0, 9)->initializer->staticType;
+  EXPECT_TRUE(xs.isArray);
+  EXPECT_EQ(xs.baseType, DataType::INT32);
+  // Elements, external variables and mixed branches are unknown
+  EXPECT_EQ(typeOf(declAt(script, 0, 10)), DataType::VOID);
+  EXPECT_EQ(typeOf(declAt(script, 0, 11)), DataType::VOID);
+  EXPECT_EQ(typeOf(declAt(script, 0, 12)), DataType::INT64);
+  EXPECT_EQ(typeOf(declAt(script, 0, 13)), DataType::INT32);
+  EXPECT_EQ(typeOf(declAt(script, 0, 14)), DataType::VOID);
+
+  // Only initializers of exactly the declared type skip the conversion
+  EXPECT_FALSE(declAt(script, 0, 4)->initializerTyped);
+  EXPECT_TRUE(declAt(script, 0, 5)->initializerTyped);
+  EXPECT_TRUE(declAt(script, 0, 7)->initializerTyped);
+  EXPECT_FALSE(declAt(script, 0, 9)->initializerTyped);
+  EXPECT_TRUE(script->procedures[0]->returnsTyped);
+
+  auto *call =
+      dynamic_cast<CallExpr *>(declAt(script, 0, 12)->initializer.get());
+  ASSERT_NE(call, nullptr);
+  EXPECT_EQ(call->checkedProcedure.lock(), script->procedures[0]);
+  EXPECT_TRUE(call->argumentsTyped);
+}
+
+TEST(TypeCheckerTest, LocalsKeepTheirTypeOnlyWhileStoresMatch) {
+  TypeChecker checker;
+  auto script = parseAndCheck(R"(
+        int32 chain() {
+            int32 a = 0;
+            int32 b = 0;
+            int32 c = b;
+            int32 d = 0;
+            int32 e = d;
+            b = a;
+            a = 1.5;
+            d += 1;
+            return c;
+        }
+        int32 skipped(int32 k) {
+            switch (k) {
+                case 1:
+                    int32 v = 1;
+                case 2:
+                    int32 w = v;
+                    return w;
+            }
+            return 0;
+        }
+    )",
+                              checker);
+
+  // a holds a double after a = 1.5, so b = a can too, and c = b converts;
+  // c itself is never assigned, so it is still returned as it is
+  EXPECT_FALSE(declAt(script, 0, 2)->initializerTyped);
+  EXPECT_TRUE(declAt(script, 0, 4)->initializerTyped);
+  EXPECT_TRUE(script->procedures[0]->returnsTyped);
+
+  // Reaching case 2 skips the declaration of v
+  auto *switchStmt =
+      dynamic_cast<SwitchStmt *>(bodyOf(script, 1)->statements[0].get());
+  ASSERT_NE(switchStmt, nullptr);
+  auto *w = dynamic_cast<VarDeclStmt *>(
+      switchStmt->cases[1].statements[0].get());
+  ASSERT_NE(w, nullptr);
+  EXPECT_FALSE(w->initializerTyped);
+  EXPECT_FALSE(script->procedures[1]->returnsTyped);
+}
+
+TEST(TypeCheckerTest, TypedPathsGiveTheSameResults) {
+  const char *source = R"(
+        int32 square(int32 x) {
+            return x * x;
+        }
+        double average(int32 a, int32 b) {
+            double total = a + b;
+            return total / 2;
+        }
+        int64 sumSquares(int32 n) {
+            int64 total = 0;
+            for (int32 i = 0; i < n; i += 1) {
+                int32 s = square(i);
+                total += s;
+            }
+            return total;
+        }
+        int32 truncated() {
+            int32 x = 0;
+            x = 2.75;
+            int32 y = x;
+            return y;
+        }
+        int32 viaCall() {
+            int32 r = helper();
+            return r;
+        }
+        int32 helper() {
+            return 5;
+        }
+    )";
+  ScriptManager manager;
+  std::vector<CompilationError> errors;
+  ASSERT_TRUE(manager.loadScriptSource(source, "typed.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  Value result;
+  std::string errorMsg;
+  ASSERT_TRUE(manager.executeProcedure(
+      "sumSquares", {static_cast<int32_t>(10)}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int64_t>(result), 285);
+
+  // Host arguments are still converted
+  ASSERT_TRUE(manager.executeProcedure("square", {2.9}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 4);
+  ASSERT_TRUE(manager.executeProcedure(
+      "average", {static_cast<int32_t>(3), static_cast<int32_t>(4)},
+      result, errorMsg))
+      << errorMsg;
+  EXPECT_DOUBLE_EQ(std::get<double>(result), 3.5);
+
+  ASSERT_TRUE(manager.executeProcedure("truncated", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 2);
+
+  // A later script replaces helper with a double; the caller was checked
+  // against the int32 version, so its declaration still converts
+  ASSERT_TRUE(manager.loadScriptSource("double helper() { return 7.5; }",
+                                       "later.script", errors));
+  ASSERT_TRUE(manager.executeProcedure("viaCall", {}, result, errorMsg))
+      << errorMsg;
+  EXPECT_EQ(std::get<int32_t>(result), 7);
+}
+
+TEST(TypeCheckerTest, StrictTypesRejectMismatches) {
+  auto loadError = [](const char *source) {
+    ScriptManager manager;
+    manager.setStrictTypes(true);
+    std::vector<CompilationError> errors;
+    EXPECT_FALSE(manager.loadScriptSource(source, "bad.script", errors));
+    return errors.empty() ? std::string() : errors[0].message;
+  };
+  EXPECT_NE(loadError("int32 bad(string s) { return s & 1; }")
+                .find("Operator & only supports integers at line 1"),
+            std::string::npos);
+  EXPECT_NE(loadError("double bad(double d) { return d % 2; }")
+                .find("Modulo not supported for floating point"),
+            std::string::npos);
+  EXPECT_NE(loadError("int32 f(int32 x) { return x; } "
+                      "int32 g() { return f(\"one\"); }")
+                .find("Cannot convert string to int32"),
+            std::string::npos);
+  EXPECT_NE(loadError("int32 f(int32 x) { return x; } "
+                      "int32 g() { return f(1, 2); }")
+                .find("Procedure 'f' expects 1 arguments, got 2"),
+            std::string::npos);
+  EXPECT_NE(loadError("int32 f() { int32 x = 1; return x.age; }")
+                .find("Field access on non-record value"),
+            std::string::npos);
+  EXPECT_NE(loadError("struct P { int32 x; } int32 f() { P p = 3; "
+                      "return 0; }")
+                .find("Expected P value"),
+            std::string::npos);
+
+  // Unknown types are never errors, and the check is off by default
+  ScriptManager manager;
+  manager.setStrictTypes(true);
+  EXPECT_TRUE(manager.areStrictTypesEnabled());
+  std::vector<CompilationError> errors;
+  EXPECT_TRUE(manager.loadScriptSource(
+      "int32 f(int32[] xs) { return xs[0] & origin; }", "ok.script", errors))
+      << (errors.empty() ? "" : errors[0].message);
+
+  ScriptManager lenient;
+  EXPECT_TRUE(lenient.loadScriptSource("int32 bad(string s) { return s & 1; }",
+                                       "bad.script", errors));
+}
@@ -0,0 +1,223 @@
+#include "DataTypes.h"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <limits>
+
+using namespace Script;
+
+namespace {
+
+enum class Op { ADD, SUBTRACT, MULTIPLY, DIVIDE, MODULO };
+
+const char *symbol(Op op) {
+  switch (op) {
+  case Op::ADD:
+    return "+";
+  case Op::SUBTRACT:
+    return "-";
+  case Op::MULTIPLY:
+    return "*";
+  case Op::DIVIDE:
+    return "/";
+  case Op::MODULO:
+    return "%";
+  }
+  return "?";
+}
+
+bool isUnsigned(DataType type) {
+  return type == DataType::UINT8 || type == DataType::UINT16 ||
+         type == DataType::UINT32 || type == DataType::UINT64;
+}
+
+// The promotion rules spelled out step by step: arrays apply the operator
+// to each element (the samples hold one-element int32 arrays), `+`
+// concatenates strings, doubles win, then any unsigned operand makes the
+// operation unsigned, and the result takes the larger of the two types
+Value reference(Op op, const Value &a, const Value &b) {
+  TypeInfo ta = ValueHelper::getType(a);
+  TypeInfo tb = ValueHelper::getType(b);
+  if (ta.isArray || tb.isArray) {
+    const Value &x = ta.isArray ? ValueHelper::arrayValue(a).get(0) : a;
+    const Value &y = tb.isArray ? ValueHelper::arrayValue(b).get(0) : b;
+    if (std::holds_alternative<std::string>(x) ||
+        std::holds_alternative<std::string>(y) ||
+        std::holds_alternative<bool>(x) || std::holds_alternative<bool>(y)) {
+      throw std::runtime_error(std::string("Operator ") + symbol(op) +
+                               " only supports numeric arrays");
+    }
+    Value element = reference(op, x, y);
+    return ValueHelper::createArray(ValueHelper::getType(element), {element});
+  }
+  if (op == Op::ADD && (std::holds_alternative<std::string>(a) ||
+                        std::holds_alternative<std::string>(b))) {
+    return ValueHelper::toString(a) + ValueHelper::toString(b);
+  }
+
+  if (ta.baseType == DataType::DOUBLE || tb.baseType == DataType::DOUBLE) {
+    switch (op) {
+    case Op::ADD:
+      return ValueHelper::toDouble(a) + ValueHelper::toDouble(b);
+    case Op::SUBTRACT:
+      return ValueHelper::toDouble(a) - ValueHelper::toDouble(b);
+    case Op::MULTIPLY:
+      return ValueHelper::toDouble(a) * ValueHelper::toDouble(b);
+    case Op::DIVIDE: {
+      double divisor = ValueHelper::toDouble(b);
+      if (divisor == 0.0) {
+        throw std::runtime_error("Division by zero");
+      }
+      return ValueHelper::toDouble(a) / divisor;
+    }
+    case Op::MODULO:
+      throw std::runtime_error("Modulo not supported for floating point");
+    }
+  }
+
+  DataType resultType =
+      static_cast<int>(ta.baseType) > static_cast<int>(tb.baseType)
+          ? ta.baseType
+          : tb.baseType;
+  auto integer = [&](auto x, auto convert) {
+    using T = decltype(x);
+    if (op == Op::DIVIDE || op == Op::MODULO) {
+      T divisor = convert(b);
+      if (divisor == 0) {
+        throw std::runtime_error(op == Op::DIVIDE ? "Division by zero"
+                                                  : "Modulo by zero");
+      }
+      T dividend = convert(a);
+      return ValueHelper::createValue(
+          resultType, op == Op::DIVIDE ? dividend / divisor
+                                       : dividend % divisor);
+    }
+    T l = convert(a);
+    T r = convert(b);
+    T result = op == Op::ADD ? l + r : op == Op::SUBTRACT ? l - r : l * r;
+    return ValueHelper::createValue(resultType, result);
+  };
+  if (isUnsigned(ta.baseType) || isUnsigned(tb.baseType)) {
+    return integer(uint64_t{},
+                   [](const Value &v) { return ValueHelper::toUInt64(v); });
+  }
+  return integer(int64_t{},
+                 [](const Value &v) { return ValueHelper::toInt64(v); });
+}
+
+Value apply(Op op, const Value &a, const Value &b) {
+  switch (op) {
+  case Op::ADD:
+    return ValueHelper::add(a, b);
+  case Op::SUBTRACT:
+    return ValueHelper::subtract(a, b);
+  case Op::MULTIPLY:
+    return ValueHelper::multiply(a, b);
+  case Op::DIVIDE:
+    return ValueHelper::divide(a, b);
+  case Op::MODULO:
+    return ValueHelper::modulo(a, b);
+  }
+  return Value();
+}
+
+// A few values of every runtime type, including zero and the extremes
+std::vector<Value> samples() {
+  return {
+      static_cast<int8_t>(-128),
+      static_cast<int8_t>(0),
+      static_cast<int8_t>(7),
+      static_cast<uint8_t>(0),
+      static_cast<uint8_t>(255),
+      static_cast<int16_t>(-300),
+      static_cast<int16_t>(32767),
+      static_cast<uint16_t>(65535),
+      static_cast<int32_t>(std::numeric_limits<int32_t>::min()),
+      static_cast<int32_t>(-1),
+      static_cast<int32_t>(0),
+      static_cast<int32_t>(3),
+      static_cast<int32_t>(std::numeric_limits<int32_t>::max()),
+      static_cast<uint32_t>(4000000000u),
+      static_cast<int64_t>(-5),
+      static_cast<int64_t>(std::numeric_limits<int64_t>::max()),
+      static_cast<uint64_t>(0),
+      static_cast<uint64_t>(std::numeric_limits<uint64_t>::max()),
+      -2.5,
+      0.0,
+      3.0,
+      std::string("ab"),
+      std::string(""),
+      true,
+      false,
+      ValueHelper::createArray(TypeInfo(DataType::INT32),
+                               {static_cast<int32_t>(1)}),
+  };
+}
+
+} // namespace
+
+TEST(ValueArithmeticTest, EveryTypePairMatchesPromotionRules) {
+  const Op ops[] = {Op::ADD, Op::SUBTRACT, Op::MULTIPLY, Op::DIVIDE,
+                    Op::MODULO};
+  auto values = samples();
+  for (Op op : ops) {
+    for (const auto &a : values) {
+      for (const auto &b : values) {
+        std::string context = ValueHelper::toString(a) + " " + symbol(op) +
+                              " " + ValueHelper::toString(b) + " (types " +
+                              std::to_string(a.index()) + ", " +
+                              std::to_string(b.index()) + ")";
+        Value expected, actual;
+        std::string expectedError, actualError;
+        try {
+          expected = reference(op, a, b);
+        } catch (const std::exception &e) {
+          expectedError = e.what();
+        }
+        try {
+          actual = apply(op, a, b);
+        } catch (const std::exception &e) {
+          actualError = e.what();
+        }
+        EXPECT_EQ(expectedError, actualError) << context;
+        EXPECT_EQ(expected.index(), actual.index()) << context;
+        if (ValueHelper::isArray(expected) && ValueHelper::isArray(actual)) {
+          const ArrayValue &e = ValueHelper::arrayValue(expected);
+          const ArrayValue &r = ValueHelper::arrayValue(actual);
+          ASSERT_EQ(e.size(), r.size()) << context;
+          EXPECT_EQ(e.elementType(), r.elementType()) << context;
+          EXPECT_TRUE(e.get(0) == r.get(0)) << context;
+        } else {
+          EXPECT_TRUE(expected == actual) << context;
+        }
+      }
+    }
+  }
+}
+
+TEST(ValueArithmeticTest, KeepsMixedWidthQuirks) {
+  // The larger DataType wins, even when it is signed and the math unsigned
+  Value r =
+      ValueHelper::add(static_cast<uint8_t>(200), static_cast<int32_t>(1));
+  ASSERT_TRUE(std::holds_alternative<uint32_t>(r));
+  EXPECT_EQ(std::get<uint32_t>(r), 201u);
+
+  // Narrow results wrap
+  r = ValueHelper::add(static_cast<int8_t>(127), static_cast<int8_t>(1));
+  ASSERT_TRUE(std::holds_alternative<int8_t>(r));
+  EXPECT_EQ(std::get<int8_t>(r), -128);
+
+  // bool + bool stays bool
+  r = ValueHelper::add(true, true);
+  ASSERT_TRUE(std::holds_alternative<bool>(r));
+  EXPECT_TRUE(std::get<bool>(r));
+
+  r = ValueHelper::multiply(static_cast<int32_t>(3), 0.5);
+  ASSERT_TRUE(std::holds_alternative<double>(r));
+  EXPECT_DOUBLE_EQ(std::get<double>(r), 1.5);
+
+  r = ValueHelper::add(std::string("n="), static_cast<int64_t>(5));
+  EXPECT_EQ(std::get<std::string>(r), "n=5");
+
+  EXPECT_THROW(ValueHelper::divide(static_cast<int16_t>(1), false),
+               std::runtime_error);
+}
@@ -0,0 +1,72 @@
+// cxxscript-aot: translates a script's procedures into C++ for a native
+// module that ScriptManager::loadNativeModule can load.
+//
+//   cxxscript-aot <input.script> <output.cpp>
+
+#include "AotTranslator.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Resolver.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace Script;
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <input.script> <output.cpp>"
+              << std::endl;
+    return 2;
+  }
+
+  std::string inputPath = argv[1];
+  std::ifstream input(inputPath);
+  if (!input.is_open()) {
+    std::cerr << inputPath << ": error: Failed to open file" << std::endl;
+    return 1;
+  }
+  std::stringstream buffer;
+  buffer << input.rdbuf();
+
+  ScriptPtr script;
+  try {
+    Lexer lexer(buffer.str(), inputPath);
+    Parser parser(lexer.tokenize(), inputPath);
+    script = parser.parse();
+    if (parser.hasErrors()) {
+      for (const auto &error : parser.getErrors()) {
+        std::cerr << inputPath << ":" << error.line << ":" << error.column
+                  << ": error: " << error.what() << std::endl;
+      }
+      return 1;
+    }
+  } catch (const ParseError &e) {
+    std::cerr << inputPath << ":" << e.line << ":" << e.column
+              << ": error: " << e.what() << std::endl;
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << inputPath << ": error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  Resolver resolver;
+  resolver.resolve(*script);
+
+  AotTranslator translator;
+  std::string source = translator.translate(*script);
+
+  for (const auto &skipped : translator.skipped()) {
+    std::cerr << inputPath << ": note: procedure '" << skipped.procedure
+              << "' left to the interpreter: " << skipped.reason << std::endl;
+  }
+
+  std::ofstream output(argv[2]);
+  if (!output.is_open()) {
+    std::cerr << argv[2] << ": error: Failed to open file for writing"
+              << std::endl;
+    return 1;
+  }
+  output << source;
+  return output.good() ? 0 : 1;
+}